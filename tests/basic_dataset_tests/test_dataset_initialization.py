@@ -36,5 +36,34 @@ class CheckDatasetConstruction(unittest.TestCase):
         self.assertTrue(test_xdim == test_offline_dataset.get_xdim())
         self.assertTrue(test_xdim == test_online_dataset.get_xdim())
 
+
+    def test_offline_chunk_reader(self):
+        """Check that the chunks read (and prefetched) from disk by the
+        offline dataset match the data stored by the online dataset."""
+        for conv_kernel in [False, True]:
+            online_dataset, offline_dataset = build_test_dataset(conv_kernel = conv_kernel)
+            for prefetch_depth in [1, 3]:
+                offline_dataset._prefetch_depth = prefetch_depth
+                xchunks, ychunks, lchunks = [], [], []
+                for xchunk, ychunk, lchunk in offline_dataset.get_chunked_data():
+                    xchunks.append(xchunk)
+                    ychunks.append(ychunk)
+                    lchunks.append(lchunk)
+
+                self.assertTrue(np.allclose(np.concatenate(xchunks),
+                    online_dataset.get_xdata()))
+                ydata = (online_dataset.get_ydata() - offline_dataset.get_ymean()) / \
+                        offline_dataset.get_ystd()
+                self.assertTrue(np.allclose(np.concatenate(ychunks), ydata))
+                if conv_kernel:
+                    self.assertTrue(np.allclose(np.concatenate(lchunks),
+                        online_dataset.get_sequence_lengths()))
+                else:
+                    self.assertTrue(all(lchunk is None for lchunk in lchunks))
+
+                xchunks = [xchunk for xchunk, _ in offline_dataset.get_chunked_x_data()]
+                self.assertTrue(np.allclose(np.concatenate(xchunks),
+                    online_dataset.get_xdata()))
+
 if __name__ == "__main__":
     unittest.main()
@@ -10,8 +10,10 @@ import cupy as cp
 from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuFastHadamardTransform as cFHT
 from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuFastHadamardTransform2D as cFHT2D
 from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuSRHT as cSRHT
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuSubsampledSRHT
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuGetFHTInstructionSet, cpuSetFHTInstructionSet
 
-from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaSRHT
+from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaSRHT, cudaSubsampledSRHT
 from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaFastHadamardTransform2D as cudaFHT2D
 
 
@@ -70,17 +72,86 @@ class TestFastHadamardTransform(unittest.TestCase):
         for outcome in outcomes:
             self.assertTrue(outcome)
 
+        dim = (124, 64)
+        outcomes = run_fht_2d_test(dim)
+        for outcome in outcomes:
+            self.assertTrue(outcome)
+
         dim = (3001, 1024)
         outcomes = run_fht_2d_test(dim)
         for outcome in outcomes:
             self.assertTrue(outcome)
 
+        dim = (250, 2048)
+        outcomes = run_fht_2d_test(dim)
+        for outcome in outcomes:
+            self.assertTrue(outcome)
+
         dim = (250, 4096)
         outcomes = run_fht_2d_test(dim)
         for outcome in outcomes:
             self.assertTrue(outcome)
 
 
+    def test_simd_transform(self):
+        """Checks that each vectorized FHT kernel supported on this
+        CPU matches the scalar reference implementation."""
+        default_isa = cpuGetFHTInstructionSet()
+        rng = np.random.default_rng(123)
+
+        for dim in [(5, 3, 2), (5, 3, 8), (7, 2, 16), (7, 2, 64), (3, 1, 8192)]:
+            xarr = rng.uniform(low=-10, high=10, size=dim)
+            cpuSetFHTInstructionSet(0)
+            gt_double, gt_float = xarr.copy(), xarr.astype(np.float32)
+            cFHT(gt_double, 1)
+            cFHT(gt_float, 1)
+
+            for isa in [1, 2, 3]:
+                try:
+                    cpuSetFHTInstructionSet(isa)
+                except RuntimeError:
+                    continue
+                test_double, test_float = xarr.copy(), xarr.astype(np.float32)
+                cFHT(test_double, 2)
+                cFHT(test_float, 2)
+                self.assertTrue(np.allclose(test_double, gt_double))
+                self.assertTrue(np.allclose(test_float, gt_float, rtol=1e-5,
+                    atol=1e-4))
+
+        cpuSetFHTInstructionSet(-1)
+        self.assertTrue(cpuGetFHTInstructionSet() == default_isa)
+
+
+    def test_blocked_transform(self):
+        """Checks the blocked transform used for vectors too large to fit
+        in cache, for each instruction set supported on this CPU, against
+        H_a X H_b, which is the transform of x for x reshaped to (a, b)
+        since H_ab is the Kronecker product of H_a and H_b."""
+        default_isa = cpuGetFHTInstructionSet()
+        rng = np.random.default_rng(123)
+
+        for dim, split in [((3, 2**17), 2**8), ((2, 2**18), 2**9)]:
+            xarr = rng.uniform(low=-10, high=10, size=dim)
+            hmat_a, hmat_b = hadamard(split), hadamard(dim[1] // split)
+            ground_truth = np.stack([(hmat_a @ x.reshape(split, -1) @
+                hmat_b).flatten() for x in xarr])
+
+            for isa in [0, 1, 2, 3]:
+                try:
+                    cpuSetFHTInstructionSet(isa)
+                except RuntimeError:
+                    continue
+                test_double, test_float = xarr.copy(), xarr.astype(np.float32)
+                cFHT2D(test_double, 2)
+                cFHT2D(test_float, 2)
+                self.assertTrue(np.allclose(test_double, ground_truth))
+                self.assertTrue(np.allclose(test_float, ground_truth, rtol=1e-4,
+                    atol=1e-1))
+
+        cpuSetFHTInstructionSet(-1)
+        self.assertTrue(cpuGetFHTInstructionSet() == default_isa)
+
+
     def test_srht(self):
         """Tests SRHT functionality. Note that this tests SRHT
         functionality by using FHT. Therefore if the FHT did not
@@ -99,6 +170,17 @@ class TestFastHadamardTransform(unittest.TestCase):
             self.assertTrue(outcome)
 
 
+    def test_subsampled_srht(self):
+        """Tests the subsampled SRHT, which calculates only the selected
+        columns, against the full SRHT followed by column selection, for
+        inputs that do and do not need zero-padding."""
+        for dim, padded_dim, compression_size in [((150,256), 256, 128),
+                ((37,1000), 1024, 3), ((5,16384), 16384, 512), ((12,3), 4, 2)]:
+            outcomes = run_subsampled_srht_test(dim, padded_dim, compression_size)
+            for outcome in outcomes:
+                self.assertTrue(outcome)
+
+
 def run_fht_test(dim, random_seed = 123):
     """A helper function that runs an FHT test with specified
     dimensionality on a 3d input array."""
@@ -222,6 +304,39 @@ def run_srht_test(dim, compression_size, random_seed = 123):
 
 
 
+def run_subsampled_srht_test(dim, padded_dim, compression_size, random_seed = 123):
+    """A helper function that compares the subsampled SRHT with the
+    full SRHT followed by column selection for specified input
+    dimensions."""
+    rng = np.random.default_rng(random_seed)
+    marr = rng.uniform(low=-10.0,high=10.0, size=dim)
+    radem = rng.choice(np.asarray([-1,1], dtype=np.int8), size=(padded_dim),
+            replace=True)
+    col_idx = rng.permutation(padded_dim)[:compression_size].astype(np.int32)
+
+    outcomes = []
+    for precision, tol in [(np.float64, 1e-8), (np.float32, 1e-4)]:
+        padded = np.zeros((dim[0], padded_dim), dtype=precision)
+        padded[:,:dim[1]] = marr
+        cSRHT(padded, radem, 2)
+        ground_truth = padded[:,col_idx]
+
+        xin = marr.astype(precision)
+        output = np.zeros((dim[0], compression_size), dtype=precision)
+        cpuSubsampledSRHT(xin, output, radem, col_idx, 2)
+        outcomes.append(np.allclose(output, ground_truth, rtol=tol, atol=tol))
+        outcomes.append(np.allclose(xin, marr.astype(precision)))
+
+        if "cupy" not in sys.modules:
+            continue
+        output = cp.zeros((dim[0], compression_size), dtype=precision)
+        cudaSubsampledSRHT(cp.asarray(xin), output, cp.asarray(radem),
+                cp.asarray(col_idx))
+        outcomes.append(np.allclose(cp.asnumpy(output), ground_truth,
+            rtol=tol, atol=tol))
+    return outcomes
+
+
 def setup_srht_test(dim, compression_size, random_seed = 123):
     """A helper function that builds the matrices required for
     the SRHT test, specified using the input dimensions."""
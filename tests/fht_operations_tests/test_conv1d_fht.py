@@ -3,12 +3,16 @@ feature generation routines to ensure they are producing
 correct results by comparing with a clunky, simple
 mostly Python implementation."""
 import sys
+from math import ceil
 
 import unittest
 import numpy as np
 import cupy as cp
 
 from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuConv1dFGen, cpuConvGrad, cpuConv1dMaxpool
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuGetKmerCacheHits, cpuResetKmerCacheStats
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuConv1dTwoLayerFGen, cpuConv1dTwoLayerGrad
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFFeatureGen, cpuRBFGrad
 from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaConv1dFGen, cudaConvGrad, cudaConv1dMaxpool
 
 from conv_testing_functions import get_initial_matrices_fht, get_features
@@ -111,6 +115,98 @@ class TestConv1d(unittest.TestCase):
 
 
 
+    def test_float_output(self):
+        """Tests that generating features and gradients into float32
+        output arrays matches float64 output for the same float input."""
+        for normalization in [0, 1, 2]:
+            outcomes = run_float_output_eval(36, 9, 21, 23, 128, 0.5,
+                    normalization)
+            for outcome in outcomes:
+                self.assertTrue(outcome)
+
+
+
+    def test_kmer_cache(self):
+        """Tests that feature generation with the kmer cache enabled
+        gives the same result as without, for one-hot encoded input
+        where kmers repeat, including a very small cache so that
+        entries are evicted."""
+        for cache_size in [3, 5000]:
+            outcomes = run_kmer_cache_eval(50, 5, 4, 30, 500, cache_size)
+            for outcome in outcomes:
+                self.assertTrue(outcome)
+
+
+
+    def test_kmer_tiling(self):
+        """Tests that features, gradients and maxpool features on cuda
+        match the CPU when a few long sequences are each split across
+        many blocks, and when several short windows share a block."""
+        if "cupy" not in sys.modules:
+            return
+        rng = np.random.default_rng(123)
+        for num_aas, aa_dim, ndatapoints in [(300, 5, 3), (40, 2, 5)]:
+            xdata = rng.uniform(size=(ndatapoints, num_aas, aa_dim))
+            seqlen = rng.integers(low=3, high=num_aas + 1,
+                    size=ndatapoints).astype(np.int32)
+            seqlen[0] = num_aas
+            radem = rng.choice(np.asarray([-1,1], dtype=np.int8),
+                    size=(3, 1, 512), replace=True)
+            s_mat = rng.uniform(size=500)
+
+            features = np.zeros((ndatapoints, 1000))
+            gradient = np.zeros((ndatapoints, 1000, 1))
+            cpuConvGrad(xdata, features, radem, s_mat, seqlen, gradient,
+                    0.5, 3, 2, 1)
+            maxpool = np.zeros((ndatapoints, 500), dtype=np.float32)
+            cpuConv1dMaxpool(xdata, maxpool, radem, s_mat, seqlen, 3, 1)
+
+            cuda_features = cp.zeros((ndatapoints, 1000))
+            cuda_gradient = cp.zeros((ndatapoints, 1000, 1))
+            cudaConvGrad(cp.asarray(xdata), cuda_features, cp.asarray(radem),
+                    cp.asarray(s_mat), seqlen, cuda_gradient, 0.5, 3, 2)
+            self.assertTrue(np.allclose(features, cp.asnumpy(cuda_features)))
+            self.assertTrue(np.allclose(gradient, cp.asnumpy(cuda_gradient)))
+
+            cuda_features[:] = 0
+            cudaConv1dFGen(cp.asarray(xdata * 0.5), cuda_features,
+                    cp.asarray(radem), cp.asarray(s_mat), seqlen, 3, 2)
+            self.assertTrue(np.allclose(features, cp.asnumpy(cuda_features)))
+
+            cuda_maxpool = cp.zeros((ndatapoints, 500), dtype=cp.float32)
+            cudaConv1dMaxpool(cp.asarray(xdata), cuda_maxpool,
+                    cp.asarray(radem), cp.asarray(s_mat), seqlen, 3)
+            self.assertTrue(np.allclose(maxpool, cp.asnumpy(cuda_maxpool),
+                rtol=1e-5, atol=1e-5))
+
+
+
+    def test_token_input(self):
+        """Tests that features, gradients and maxpool features generated
+        from token IDs and an embedding table match those generated from
+        the equivalent dense input, on CPU and (if available) cuda."""
+        for token_type in [np.uint8, np.int16]:
+            outcomes = run_token_input_eval(40, 5, 6, 50, 500, token_type)
+            for outcome in outcomes:
+                self.assertTrue(outcome)
+
+
+
+    def test_two_layer(self):
+        """Tests that the fused two-layer maxpool + RBF ops match
+        maxpool feature generation followed by the RBF ops on the
+        pooled features, with and without the kmer cache, for a
+        number of datapoints that is not a multiple of the block
+        size."""
+        for precision in ["double", "float"]:
+            for cache_size in [0, 50]:
+                outcomes = run_two_layer_eval(43, 5, 4, 30, 300, 1000,
+                        precision, cache_size)
+                for outcome in outcomes:
+                    self.assertTrue(outcome)
+
+
+
 def run_basic_eval(ndatapoints, kernel_width, aa_dim, num_aas,
         num_freqs, sigma, precision = "double",
         normalization = 0):
@@ -211,6 +307,230 @@ def run_gradient_eval(ndatapoints, kernel_width, aa_dim, num_aas,
 
 
 
+def run_float_output_eval(ndatapoints, kernel_width, aa_dim, num_aas,
+        num_freqs, sigma, normalization = 0):
+    """Compares features and gradients written to float32 output arrays
+    against the same quantities written to float64 output arrays."""
+    _, _, xdata, seqlen, features, s_mat, \
+            radem = get_initial_matrices_fht(ndatapoints, kernel_width,
+                    aa_dim, num_aas, num_freqs, "conv", "float")
+    gt_features = np.zeros(features.shape)
+    gt_grad = np.zeros((features.shape[0], features.shape[1], 1))
+    cpuConvGrad(xdata, gt_features, radem, s_mat, seqlen, gt_grad,
+            sigma, kernel_width, normalization, 2)
+
+    features = np.zeros(gt_features.shape, dtype=np.float32)
+    gradient = np.zeros(gt_grad.shape, dtype=np.float32)
+    cpuConvGrad(xdata, features, radem, s_mat, seqlen, gradient,
+            sigma, kernel_width, normalization, 2)
+    outcomes = [check_results(gt_features, features, "float"),
+            check_results(gt_grad, gradient, "float")]
+
+    features[:] = 0
+    cpuConv1dFGen(xdata, features, radem, s_mat, seqlen, kernel_width,
+            normalization, 2)
+    outcomes.append(check_results(gt_features, features, "float"))
+    print(f"Float output for RBF convolution, normalization {normalization}. "
+            f"Does result match on CPU? {outcomes}")
+
+    if "cupy" not in sys.modules:
+        return outcomes
+
+    xdata, s_mat, radem = cp.asarray(xdata), cp.asarray(s_mat), cp.asarray(radem)
+    features = cp.zeros(gt_features.shape, dtype=cp.float32)
+    gradient = cp.zeros(gt_grad.shape, dtype=cp.float32)
+    cudaConvGrad(xdata, features, radem, s_mat, seqlen, gradient, sigma,
+            kernel_width, normalization)
+    outcomes.append(check_results(gt_features, cp.asnumpy(features), "float"))
+    outcomes.append(check_results(gt_grad, cp.asnumpy(gradient), "float"))
+
+    features[:] = 0
+    cudaConv1dFGen(xdata, features, radem, s_mat, seqlen, kernel_width,
+            normalization)
+    outcomes.append(check_results(gt_features, cp.asnumpy(features), "float"))
+    print(f"Float output for RBF convolution, normalization {normalization}. "
+            f"Does result match on cuda? {outcomes[3:]}")
+    return outcomes
+
+
+
+
+
+def run_kmer_cache_eval(ndatapoints, kernel_width, aa_dim, num_aas,
+        num_freqs, cache_size):
+    """Compares features, gradients and maxpool features generated on
+    CPU with and without the kmer cache for one-hot encoded input."""
+    _, _, _, seqlen, features, s_mat, radem = get_initial_matrices_fht(
+            ndatapoints, kernel_width, aa_dim, num_aas, num_freqs, "conv")
+    rng = np.random.default_rng(123)
+    xdata = np.zeros((ndatapoints, num_aas, aa_dim))
+    idx = rng.integers(low=0, high=aa_dim, size=(ndatapoints, num_aas))
+    np.put_along_axis(xdata, idx[:,:,None], 1., axis=2)
+
+    gt_features, gt_grad = np.zeros(features.shape), \
+            np.zeros((features.shape[0], features.shape[1], 1))
+    cpuConvGrad(xdata, gt_features, radem, s_mat, seqlen, gt_grad,
+            0.5, kernel_width, 1, 2)
+    gt_maxpool = np.zeros((ndatapoints, num_freqs), dtype=np.float32)
+    cpuConv1dMaxpool(xdata, gt_maxpool, radem, s_mat, seqlen, kernel_width, 2)
+
+    cpuResetKmerCacheStats()
+    test_features, test_grad = np.zeros(features.shape), np.zeros(gt_grad.shape)
+    cpuConvGrad(xdata, test_features, radem, s_mat, seqlen, test_grad,
+            0.5, kernel_width, 1, 2, kmerCacheSize = cache_size)
+    test_maxpool = np.zeros(gt_maxpool.shape, dtype=np.float32)
+    cpuConv1dMaxpool(xdata, test_maxpool, radem, s_mat, seqlen, kernel_width,
+            2, kmerCacheSize = cache_size)
+    features[:] = 0
+    cpuConv1dFGen(xdata, features, radem, s_mat, seqlen, kernel_width, 1, 2,
+            kmerCacheSize = cache_size)
+
+    outcomes = [np.allclose(gt_features, test_features),
+            np.allclose(gt_grad, test_grad), np.allclose(gt_features, features),
+            np.allclose(gt_maxpool, test_maxpool), cpuGetKmerCacheHits() > 0]
+    print(f"Kmer cache size {cache_size}: hits {cpuGetKmerCacheHits()}. "
+            f"Does result match on CPU? {outcomes}")
+    return outcomes
+
+
+
+
+
+def run_token_input_eval(ndatapoints, kernel_width, aa_dim, num_aas,
+        num_freqs, token_type):
+    """Compares features, gradients and maxpool features generated from
+    token IDs and a random embedding table with those generated from the
+    dense input the tokens encode."""
+    _, _, _, seqlen, features, s_mat, radem = get_initial_matrices_fht(
+            ndatapoints, kernel_width, aa_dim, num_aas, num_freqs, "conv")
+    rng = np.random.default_rng(123)
+    embedding = rng.uniform(low=-2.0, high=2.0, size=(aa_dim, aa_dim))
+    tokens = rng.integers(low=0, high=aa_dim,
+            size=(ndatapoints, num_aas)).astype(token_type)
+    xdata = embedding[tokens]
+
+    gt_features, gt_grad = np.zeros(features.shape), \
+            np.zeros((features.shape[0], features.shape[1], 1))
+    cpuConvGrad(xdata, gt_features, radem, s_mat, seqlen, gt_grad,
+            0.5, kernel_width, 1, 2)
+    gt_maxpool = np.zeros((ndatapoints, num_freqs), dtype=np.float32)
+    cpuConv1dMaxpool(xdata, gt_maxpool, radem, s_mat, seqlen, kernel_width, 2)
+
+    test_features, test_grad = np.zeros(features.shape), np.zeros(gt_grad.shape)
+    cpuConvGrad(tokens, embedding, test_features, radem, s_mat, seqlen,
+            test_grad, 0.5, kernel_width, 1, 2)
+    test_maxpool = np.zeros(gt_maxpool.shape, dtype=np.float32)
+    cpuConv1dMaxpool(tokens, embedding, test_maxpool, radem, s_mat, seqlen,
+            kernel_width, 2)
+    features[:] = 0
+    cpuConv1dFGen(tokens, embedding * 0.5, features, radem, s_mat, seqlen,
+            kernel_width, 1, 2)
+
+    outcomes = [np.allclose(gt_features, test_features),
+            np.allclose(gt_grad, test_grad), np.allclose(gt_features, features),
+            np.allclose(gt_maxpool, test_maxpool)]
+
+    bad_tokens = tokens.copy()
+    bad_tokens[0,0] = aa_dim
+    try:
+        cpuConv1dMaxpool(bad_tokens, embedding, test_maxpool, radem, s_mat,
+                seqlen, kernel_width, 2)
+        outcomes.append(False)
+    except RuntimeError:
+        outcomes.append(True)
+
+    # A table with no rows stands for one-hot input.
+    onehot_table = np.zeros((0, aa_dim))
+    onehot_x = np.eye(aa_dim)[tokens]
+    gt_onehot, gt_onehot_grad = np.zeros(features.shape), np.zeros(gt_grad.shape)
+    cpuConvGrad(onehot_x, gt_onehot, radem, s_mat, seqlen, gt_onehot_grad,
+            0.5, kernel_width, 1, 2)
+    gt_onehot_maxpool = np.zeros(gt_maxpool.shape, dtype=np.float32)
+    cpuConv1dMaxpool(onehot_x, gt_onehot_maxpool, radem, s_mat, seqlen,
+            kernel_width, 2)
+    test_features[:], test_grad[:], test_maxpool[:] = 0, 0, 0
+    cpuConvGrad(tokens, onehot_table, test_features, radem, s_mat, seqlen,
+            test_grad, 0.5, kernel_width, 1, 2)
+    cpuConv1dMaxpool(tokens, onehot_table, test_maxpool, radem, s_mat, seqlen,
+            kernel_width, 2)
+    outcomes += [np.allclose(gt_onehot, test_features),
+            np.allclose(gt_onehot_grad, test_grad),
+            np.allclose(gt_onehot_maxpool, test_maxpool)]
+
+    if "cupy" in sys.modules:
+        cuda_features = cp.zeros(features.shape)
+        cuda_grad = cp.zeros(gt_grad.shape)
+        cudaConvGrad(cp.asarray(tokens), cp.asarray(embedding), cuda_features,
+                cp.asarray(radem), cp.asarray(s_mat), seqlen, cuda_grad,
+                0.5, kernel_width, 1)
+        cuda_maxpool = cp.zeros(gt_maxpool.shape, dtype=cp.float32)
+        cudaConv1dMaxpool(cp.asarray(tokens), cp.asarray(embedding),
+                cuda_maxpool, cp.asarray(radem), cp.asarray(s_mat), seqlen,
+                kernel_width)
+        outcomes += [np.allclose(gt_features, cp.asnumpy(cuda_features)),
+                np.allclose(gt_grad, cp.asnumpy(cuda_grad)),
+                np.allclose(gt_maxpool, cp.asnumpy(cuda_maxpool),
+                    rtol=1e-5, atol=1e-5)]
+
+        cuda_features[:], cuda_grad[:] = 0, 0
+        cudaConvGrad(cp.asarray(tokens), cp.asarray(onehot_table), cuda_features,
+                cp.asarray(radem), cp.asarray(s_mat), seqlen, cuda_grad,
+                0.5, kernel_width, 1)
+        outcomes += [np.allclose(gt_onehot, cp.asnumpy(cuda_features)),
+                np.allclose(gt_onehot_grad, cp.asnumpy(cuda_grad))]
+
+    print(f"Token input ({token_type.__name__}): does result match dense "
+            f"input? {outcomes}")
+    return outcomes
+
+
+
+
+
+def run_two_layer_eval(ndatapoints, kernel_width, aa_dim, num_aas,
+        init_rffs, num_freqs, precision, cache_size):
+    """Compares the fused two-layer ops with the same two layers
+    run one after the other."""
+    _, _, xdata, seqlen, _, s_mat, radem = get_initial_matrices_fht(
+            ndatapoints, kernel_width, aa_dim, num_aas, init_rffs,
+            "maxpool", precision)
+    rng = np.random.default_rng(123)
+    padded_dims = 2**ceil(np.log2(init_rffs))
+    radem2 = rng.choice(np.asarray([-1,1], dtype=np.int8),
+            size=(3, 1, ceil(num_freqs / padded_dims) * padded_dims),
+            replace=True)
+    chi2 = rng.uniform(size=num_freqs).astype(s_mat.dtype)
+    sigma = 0.37
+
+    pooled = np.zeros((ndatapoints, init_rffs), dtype=np.float32)
+    cpuConv1dMaxpool(xdata, pooled, radem, s_mat, seqlen, kernel_width, 2)
+    pooled = pooled.astype(xdata.dtype)
+    gt_features = np.zeros((ndatapoints, 2 * num_freqs))
+    cpuRBFFeatureGen(pooled * sigma, gt_features, radem2, chi2, 2, True)
+    gt_grad_features = np.zeros(gt_features.shape)
+    gt_grad = np.zeros((ndatapoints, 2 * num_freqs, 1))
+    cpuRBFGrad(pooled, gt_grad_features, gt_grad, radem2, chi2, sigma,
+            2, True)
+
+    features = np.zeros(gt_features.shape)
+    cpuConv1dTwoLayerFGen(xdata, features, radem, s_mat, radem2, chi2,
+            seqlen, kernel_width, sigma, 3, cache_size, True)
+    grad_features = np.zeros(gt_features.shape)
+    grad = np.zeros(gt_grad.shape)
+    cpuConv1dTwoLayerGrad(xdata, grad_features, grad, radem, s_mat,
+            radem2, chi2, seqlen, kernel_width, sigma, 3, cache_size, True)
+
+    outcomes = [check_results(gt_features, features, precision),
+            check_results(gt_grad_features, grad_features, precision),
+            check_results(gt_grad, grad, precision)]
+    print(f"Two layer ({precision}, kmer cache {cache_size}): does "
+            f"result match the two-stage ops? {outcomes}")
+    return outcomes
+
+
+
+
+
 def check_results(gt_array, test_array, precision):
     """Checks a ground truth array against a test array. We have
     to use different tolerances for 32-bit vs 64 since 32-bit
@@ -0,0 +1,367 @@
+"""Tests the fused routines that accumulate Z^T Z, Z^T y and Z^T (Z V)
+and calculate the predictive mean and variance without storing the
+random features, by comparing them with the result of generating the
+random features and multiplying."""
+import sys
+import unittest
+import numpy as np
+import cupy as cp
+
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFFeatureGen as cRBF
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFDesignMatrix as cRBFDesign
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuConv1dFGen as cConv1d
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuConv1dDesignMatrix as cConvDesign
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFMatvec as cRBFMatvec
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuConv1dMatvec as cConvMatvec
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFPredictMean, cpuRBFPredictMeanVar
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuConv1dPredictMean, cpuConv1dPredictMeanVar
+
+from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaRBFDesignMatrix as cudaRBFDesign
+from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaConv1dDesignMatrix as cudaConvDesign
+from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaRBFMatvec
+from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaConv1dMatvec
+
+from xGPR.kernels import KERNEL_NAME_TO_CLASS
+
+from test_rbf_rfgen import setup_rbf_test
+
+
+class TestDesignMatrix(unittest.TestCase):
+    """Checks the fused Z^T Z / Z^T y and Z^T (Z V) routines for RBF and
+    RBF-based convolution kernels, for CPU and (if available) GPU."""
+
+    def test_rbf_design_matrix(self):
+        """Compares the fused RBF routine with feature generation
+        followed by matrix multiplication."""
+        for xdim, n_freqs in [((103, 50), 500), ((10, 3), 64), ((7, 2003), 1000)]:
+            for fit_intercept in [True, False]:
+                outcomes = run_rbf_design_test(xdim, n_freqs, fit_intercept)
+                for outcome in outcomes:
+                    self.assertTrue(outcome)
+
+
+    def test_conv_design_matrix(self):
+        """Compares the fused convolution routine with feature generation
+        followed by matrix multiplication."""
+        for fit_intercept in [True, False]:
+            for scaling_type in [0, 1, 2]:
+                outcomes = run_conv_design_test((37, 20, 5), 500, 3,
+                        scaling_type, fit_intercept)
+                for outcome in outcomes:
+                    self.assertTrue(outcome)
+
+
+    def test_rbf_matvec(self):
+        """Compares the fused RBF matvec with feature generation
+        followed by matrix multiplication, for single and multiple
+        vectors."""
+        for xdim, n_freqs in [((103, 50), 500), ((10, 3), 64), ((7, 2003), 1000)]:
+            for fit_intercept in [True, False]:
+                for num_vecs in [1, 5]:
+                    outcomes = run_rbf_matvec_test(xdim, n_freqs, num_vecs,
+                            fit_intercept)
+                    for outcome in outcomes:
+                        self.assertTrue(outcome)
+
+
+    def test_conv_matvec(self):
+        """Compares the fused convolution matvec with feature generation
+        followed by matrix multiplication."""
+        for fit_intercept in [True, False]:
+            for scaling_type in [0, 1, 2]:
+                outcomes = run_conv_matvec_test((37, 20, 5), 500, 3,
+                        scaling_type, 4, fit_intercept)
+                for outcome in outcomes:
+                    self.assertTrue(outcome)
+
+
+    def test_rbf_predict(self):
+        """Compares the fused RBF predictive mean and variance with
+        feature generation followed by matrix multiplication, including
+        batches small enough that the work is split across frequencies."""
+        for xdim, n_freqs in [((103, 50), 500), ((1, 3), 64), ((7, 2003), 1000)]:
+            for fit_intercept in [True, False]:
+                outcomes = run_rbf_predict_test(xdim, n_freqs, fit_intercept)
+                for outcome in outcomes:
+                    self.assertTrue(outcome)
+
+
+    def test_conv_predict(self):
+        """Compares the fused convolution predictive mean and variance
+        with feature generation followed by matrix multiplication."""
+        for xdim in [(37, 20, 5), (2, 20, 5)]:
+            for fit_intercept in [True, False]:
+                for scaling_type in [0, 1, 2]:
+                    outcomes = run_conv_predict_test(xdim, 500, 3,
+                            scaling_type, fit_intercept)
+                    for outcome in outcomes:
+                        self.assertTrue(outcome)
+
+
+    def test_multi_device_accumulate(self):
+        """Checks that splitting design matrix and matvec calculations
+        across all available GPUs gives the same result as using the
+        current GPU only. Skipped unless more than one GPU is present."""
+        if "cupy" not in sys.modules:
+            return
+        num_devices = cp.cuda.runtime.getDeviceCount()
+        if num_devices < 2:
+            return
+        rng = np.random.default_rng(123)
+        for kernel_name, xdim in [("RBF", (103, 50)), ("Conv1dRBF", (37, 20, 5))]:
+            xdata = rng.uniform(size=xdim)
+            yvals = rng.uniform(size=xdim[0])
+            vecs = cp.asarray(rng.uniform(size=(1000, 3)))
+            seqlen = None
+            if len(xdim) == 3:
+                seqlen = rng.integers(low=3, high=xdim[1],
+                        size=xdim[0]).astype(np.int32)
+
+            results = []
+            for cuda_devices in [None, list(range(num_devices))]:
+                kernel = KERNEL_NAME_TO_CLASS[kernel_name](xdim, 1000,
+                        device = "cuda", double_precision = True,
+                        kernel_spec_parms = {"conv_width":3,
+                            "cuda_devices":cuda_devices})
+                ztz, zty = cp.zeros((1000, 1000)), cp.zeros((1000))
+                matvec = cp.zeros((1000, 3))
+                kernel.accumulate_design_mat(xdata, yvals, ztz, zty, seqlen)
+                kernel.accumulate_matvec(xdata, vecs, matvec, seqlen)
+                results.append((ztz, zty, matvec))
+
+            for single, sharded in zip(results[0], results[1]):
+                self.assertTrue(cp.allclose(single, sharded))
+
+
+
+def run_rbf_design_test(xdim, num_freqs, fit_intercept):
+    """Generates ground truth Z^T Z and Z^T y using the feature generation
+    routine, then compares the fused routine for both precisions and
+    (if available) on GPU."""
+    test_array, radem, chi_arr, _, _ = setup_rbf_test(xdim, num_freqs)
+    rng = np.random.default_rng(123)
+    yvals = rng.uniform(size=xdim[0])
+
+    features = np.zeros((xdim[0], 2 * num_freqs))
+    cRBF(test_array, features, radem, chi_arr, 1, fit_intercept)
+    if fit_intercept:
+        features[:,0] = 1.
+    gt_ztz, gt_zty = features.T @ features, features.T @ yvals
+
+    outcomes = []
+    for precision, tol in [(np.float64, 1e-8), (np.float32, 1e-4)]:
+        xin = test_array.astype(precision)
+        chi_in = chi_arr.astype(precision)
+        # Start from a nonzero array to confirm the routine adds to it.
+        ztz, zty = np.ones(gt_ztz.shape), np.ones(gt_zty.shape)
+        cRBFDesign(xin, yvals, ztz, zty, radem, chi_in, 3, fit_intercept)
+        outcomes.append(np.allclose(ztz - 1, gt_ztz, rtol=tol, atol=tol))
+        outcomes.append(np.allclose(zty - 1, gt_zty, rtol=tol, atol=tol))
+
+        if "cupy" not in sys.modules:
+            continue
+        ztz, zty = cp.ones(gt_ztz.shape), cp.ones(gt_zty.shape)
+        cudaRBFDesign(cp.asarray(xin), cp.asarray(yvals), ztz, zty,
+                cp.asarray(radem), cp.asarray(chi_in), fit_intercept)
+        outcomes.append(np.allclose(cp.asnumpy(ztz) - 1, gt_ztz, rtol=tol, atol=tol))
+        outcomes.append(np.allclose(cp.asnumpy(zty) - 1, gt_zty, rtol=tol, atol=tol))
+    return outcomes
+
+
+
+def run_conv_design_test(xdim, num_freqs, conv_width, scaling_type,
+        fit_intercept):
+    """Generates ground truth Z^T Z and Z^T y using the convolution feature
+    generation routine, then compares the fused routine."""
+    rng = np.random.default_rng(123)
+    conv_x = rng.uniform(size=xdim)
+    seqlen = rng.integers(low=conv_width, high=xdim[1],
+            size=xdim[0]).astype(np.int32)
+    conv_radem = rng.choice(np.asarray([-1,1], dtype=np.int8),
+            size=(3, 1, 512), replace=True)
+    conv_chi = rng.uniform(size=num_freqs)
+    yvals = rng.uniform(size=xdim[0])
+
+    features = np.zeros((xdim[0], 2 * num_freqs))
+    cConv1d(conv_x, features, conv_radem, conv_chi, seqlen, conv_width,
+            scaling_type, 1)
+    if fit_intercept:
+        features[:,0] = 1.
+    gt_ztz, gt_zty = features.T @ features, features.T @ yvals
+
+    outcomes = []
+    for precision, tol in [(np.float64, 1e-8), (np.float32, 1e-4)]:
+        xin = conv_x.astype(precision)
+        chi_in = conv_chi.astype(precision)
+        ztz, zty = np.zeros(gt_ztz.shape), np.zeros(gt_zty.shape)
+        cConvDesign(xin, yvals, ztz, zty, conv_radem, chi_in, seqlen,
+                conv_width, scaling_type, 4, fit_intercept)
+        outcomes.append(np.allclose(ztz, gt_ztz, rtol=tol, atol=tol))
+        outcomes.append(np.allclose(zty, gt_zty, rtol=tol, atol=tol))
+
+        if "cupy" not in sys.modules:
+            continue
+        ztz, zty = cp.zeros(gt_ztz.shape), cp.zeros(gt_zty.shape)
+        cudaConvDesign(cp.asarray(xin), cp.asarray(yvals), ztz, zty,
+                cp.asarray(conv_radem), cp.asarray(chi_in), seqlen,
+                conv_width, scaling_type, fit_intercept)
+        outcomes.append(np.allclose(cp.asnumpy(ztz), gt_ztz, rtol=tol, atol=tol))
+        outcomes.append(np.allclose(cp.asnumpy(zty), gt_zty, rtol=tol, atol=tol))
+    return outcomes
+
+
+
+def run_rbf_matvec_test(xdim, num_freqs, num_vecs, fit_intercept):
+    """Generates ground truth Z^T (Z V) using the feature generation
+    routine, then compares the fused routine for both precisions and
+    (if available) on GPU."""
+    test_array, radem, chi_arr, _, _ = setup_rbf_test(xdim, num_freqs)
+    rng = np.random.default_rng(123)
+    vecs = rng.uniform(size=(2 * num_freqs, num_vecs))
+
+    features = np.zeros((xdim[0], 2 * num_freqs))
+    cRBF(test_array, features, radem, chi_arr, 1, fit_intercept)
+    if fit_intercept:
+        features[:,0] = 1.
+    gt_matvec = features.T @ (features @ vecs)
+
+    outcomes = []
+    for precision, tol in [(np.float64, 1e-8), (np.float32, 1e-4)]:
+        xin = test_array.astype(precision)
+        chi_in = chi_arr.astype(precision)
+        # Start from a nonzero array to confirm the routine adds to it.
+        matvec = np.ones(gt_matvec.shape)
+        cRBFMatvec(xin, vecs, matvec, radem, chi_in, 3, fit_intercept)
+        outcomes.append(np.allclose(matvec - 1, gt_matvec, rtol=tol, atol=tol))
+
+        if "cupy" not in sys.modules:
+            continue
+        matvec = cp.ones(gt_matvec.shape)
+        cudaRBFMatvec(cp.asarray(xin), cp.asarray(vecs), matvec,
+                cp.asarray(radem), cp.asarray(chi_in), fit_intercept)
+        outcomes.append(np.allclose(cp.asnumpy(matvec) - 1, gt_matvec,
+            rtol=tol, atol=tol))
+    return outcomes
+
+
+
+def run_conv_matvec_test(xdim, num_freqs, conv_width, scaling_type,
+        num_vecs, fit_intercept):
+    """Generates ground truth Z^T (Z V) using the convolution feature
+    generation routine, then compares the fused routine."""
+    rng = np.random.default_rng(123)
+    conv_x = rng.uniform(size=xdim)
+    seqlen = rng.integers(low=conv_width, high=xdim[1],
+            size=xdim[0]).astype(np.int32)
+    conv_radem = rng.choice(np.asarray([-1,1], dtype=np.int8),
+            size=(3, 1, 512), replace=True)
+    conv_chi = rng.uniform(size=num_freqs)
+    vecs = rng.uniform(size=(2 * num_freqs, num_vecs))
+
+    features = np.zeros((xdim[0], 2 * num_freqs))
+    cConv1d(conv_x, features, conv_radem, conv_chi, seqlen, conv_width,
+            scaling_type, 1)
+    if fit_intercept:
+        features[:,0] = 1.
+    gt_matvec = features.T @ (features @ vecs)
+
+    outcomes = []
+    for precision, tol in [(np.float64, 1e-8), (np.float32, 1e-4)]:
+        xin = conv_x.astype(precision)
+        chi_in = conv_chi.astype(precision)
+        matvec = np.zeros(gt_matvec.shape)
+        cConvMatvec(xin, vecs, matvec, conv_radem, chi_in, seqlen,
+                conv_width, scaling_type, 4, fit_intercept)
+        outcomes.append(np.allclose(matvec, gt_matvec, rtol=tol, atol=tol))
+
+        if "cupy" not in sys.modules:
+            continue
+        matvec = cp.zeros(gt_matvec.shape)
+        cudaConv1dMatvec(cp.asarray(xin), cp.asarray(vecs), matvec,
+                cp.asarray(conv_radem), cp.asarray(chi_in), seqlen,
+                conv_width, scaling_type, fit_intercept)
+        outcomes.append(np.allclose(cp.asnumpy(matvec), gt_matvec,
+            rtol=tol, atol=tol))
+    return outcomes
+
+
+
+def run_rbf_predict_test(xdim, num_freqs, fit_intercept, num_var_rffs = 37):
+    """Generates the ground truth predictive mean Z w and variance
+    term diag(Z_v V Z_v^T) using the feature generation routine, then
+    compares the fused routines for both precisions."""
+    test_array, radem, chi_arr, _, _ = setup_rbf_test(xdim, num_freqs)
+    rng = np.random.default_rng(123)
+    weights = rng.uniform(size=2 * num_freqs)
+    var = rng.uniform(size=(num_var_rffs, num_var_rffs))
+    var = var @ var.T
+
+    features = np.zeros((xdim[0], 2 * num_freqs))
+    cRBF(test_array, features, radem, chi_arr, 1, fit_intercept)
+    if fit_intercept:
+        features[:,0] = 1.
+    gt_mean = features @ weights
+    var_features = features[:,:num_var_rffs]
+    gt_var = (var_features * (var_features @ var)).sum(axis=1)
+
+    outcomes = []
+    for precision, tol in [(np.float64, 1e-8), (np.float32, 1e-4)]:
+        xin = test_array.astype(precision)
+        chi_in = chi_arr.astype(precision)
+        mean = np.zeros((xdim[0]))
+        cpuRBFPredictMean(xin, weights, mean, radem, chi_in, 3, fit_intercept)
+        outcomes.append(np.allclose(mean, gt_mean, rtol=tol, atol=tol))
+
+        mean, var_out = np.zeros((xdim[0])), np.zeros((xdim[0]))
+        cpuRBFPredictMeanVar(xin, weights, var, mean, var_out, radem,
+                chi_in, 3, fit_intercept)
+        outcomes.append(np.allclose(mean, gt_mean, rtol=tol, atol=tol))
+        outcomes.append(np.allclose(var_out, gt_var, rtol=tol, atol=tol))
+    return outcomes
+
+
+
+def run_conv_predict_test(xdim, num_freqs, conv_width, scaling_type,
+        fit_intercept, num_var_rffs = 37):
+    """Generates the ground truth predictive mean and variance term
+    using the convolution feature generation routine, then compares
+    the fused routines."""
+    rng = np.random.default_rng(123)
+    conv_x = rng.uniform(size=xdim)
+    seqlen = rng.integers(low=conv_width, high=xdim[1],
+            size=xdim[0]).astype(np.int32)
+    conv_radem = rng.choice(np.asarray([-1,1], dtype=np.int8),
+            size=(3, 1, 512), replace=True)
+    conv_chi = rng.uniform(size=num_freqs)
+    weights = rng.uniform(size=2 * num_freqs)
+    var = rng.uniform(size=(num_var_rffs, num_var_rffs))
+    var = var @ var.T
+
+    features = np.zeros((xdim[0], 2 * num_freqs))
+    cConv1d(conv_x, features, conv_radem, conv_chi, seqlen, conv_width,
+            scaling_type, 1)
+    if fit_intercept:
+        features[:,0] = 1.
+    gt_mean = features @ weights
+    var_features = features[:,:num_var_rffs]
+    gt_var = (var_features * (var_features @ var)).sum(axis=1)
+
+    outcomes = []
+    for precision, tol in [(np.float64, 1e-8), (np.float32, 1e-4)]:
+        xin = conv_x.astype(precision)
+        chi_in = conv_chi.astype(precision)
+        mean = np.zeros((xdim[0]))
+        cpuConv1dPredictMean(xin, weights, mean, conv_radem, chi_in, seqlen,
+                conv_width, scaling_type, 4, fit_intercept)
+        outcomes.append(np.allclose(mean, gt_mean, rtol=tol, atol=tol))
+
+        mean, var_out = np.zeros((xdim[0])), np.zeros((xdim[0]))
+        cpuConv1dPredictMeanVar(xin, weights, var, mean, var_out, conv_radem,
+                chi_in, seqlen, conv_width, scaling_type, 4, fit_intercept)
+        outcomes.append(np.allclose(mean, gt_mean, rtol=tol, atol=tol))
+        outcomes.append(np.allclose(var_out, gt_var, rtol=tol, atol=tol))
+    return outcomes
+
+
+if __name__ == "__main__":
+    unittest.main()
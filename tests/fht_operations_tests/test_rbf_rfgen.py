@@ -1,6 +1,8 @@
 """Tests the RBF feature generation routines (specific for RBF, Matern
 and MiniARD / ARD kernels, which by extension includes static layer kernels."""
+import os
 import sys
+import tempfile
 import unittest
 from math import ceil
 import numpy as np
@@ -10,9 +12,17 @@ import cupy as cp
 from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFFeatureGen as cRBF
 from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFGrad as cRBFGrad
 from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuFastHadamardTransform2D as cFHT
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuSetFHTInstructionSet
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFProjection, cpuRBFProjectionFGen
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFProjectionGrad, cpuRBFMultiSigmaGrad
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFFeatureGen_async, cpuRBFGrad_async
 
 from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaRBFFeatureGen as cudaRBF
 from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaRBFGrad
+from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaGetWorkspaceSize, cudaReleaseWorkspace
+from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaRBFProjection, cudaRBFProjectionFGen
+from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaRBFProjectionGrad, cudaRBFMultiSigmaGrad
+from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaRBFFeatureGen_async
 
 
 class TestRBFFeatureGen(unittest.TestCase):
@@ -34,6 +44,10 @@ class TestRBFFeatureGen(unittest.TestCase):
             for outcome in outcomes:
                 self.assertTrue(outcome)
 
+            outcomes = run_rbf_test((37,20), n_freqs)
+            for outcome in outcomes:
+                self.assertTrue(outcome)
+
             outcomes = run_rbf_test((3,2003), n_freqs)
             for outcome in outcomes:
                 self.assertTrue(outcome)
@@ -68,7 +82,276 @@ class TestRBFFeatureGen(unittest.TestCase):
                 self.assertTrue(outcome)
 
 
-def run_rbf_test(xdim, num_freqs, random_seed = 123, fit_intercept = False):
+    def test_rbf_scalar_fht(self):
+        """Tests RBF feature generation with vectorized FHT kernels
+        disabled, so that the unrolled scalar transforms used by the
+        size-specialized SORF routines are checked as well."""
+        cpuSetFHTInstructionSet(0)
+        for xdim in [(10,50), (10,3), (11,1076), (3,3001)]:
+            outcomes = run_rbf_test(xdim, 2000)
+            for outcome in outcomes:
+                self.assertTrue(outcome)
+        cpuSetFHTInstructionSet(-1)
+
+
+    def test_rbf_fast_sincos(self):
+        """Tests RBF feature generation and gradient calc on CPU using
+        the vectorized approximate sine / cosine routine."""
+        for xdim in [(10,50), (37,20), (11,1076)]:
+            outcomes = run_rbf_test(xdim, 2000, precision_mode = "fast")
+            for outcome in outcomes:
+                self.assertTrue(outcome)
+            outcomes = run_rbf_grad_test(xdim, 2000, precision_mode = "fast")
+            for outcome in outcomes:
+                self.assertTrue(outcome)
+
+
+    def test_rbf_float_output(self):
+        """Tests RBF feature generation and gradient calc writing to
+        float32 output arrays, for CPU and if available GPU."""
+        for xdim in [(10,50), (37,20), (11,1076)]:
+            outcomes = run_rbf_float_output_test(xdim, 2000)
+            for outcome in outcomes:
+                self.assertTrue(outcome)
+
+
+    def test_packed_radem(self):
+        """Checks that features and gradients generated with bit-packed
+        radem diagonals match those generated with int8 diagonals, for
+        CPU and if available GPU."""
+        for xdim, num_freqs in [((37,3), 10), ((10,50), 2000), ((11,1076), 2000)]:
+            outcomes = run_packed_radem_test(xdim, num_freqs)
+            for outcome in outcomes:
+                self.assertTrue(outcome)
+
+
+    def test_async_ops(self):
+        """Checks that the async variants give the same result as the
+        synchronous ops, run in the order submitted and raise errors
+        from the op when the result is requested."""
+        test_array, radem, chi_arr, _, _ = setup_rbf_test((103, 50), 500)
+        gt_output = np.zeros((test_array.shape[0], 1000))
+        cRBF(test_array, gt_output, radem, chi_arr, 2, False)
+        gt_grad_output = np.zeros(gt_output.shape)
+        gt_grad = np.zeros((test_array.shape[0], 1000, 1))
+        cRBFGrad(test_array, gt_grad_output, gt_grad, radem, chi_arr,
+                1.0, 2, False)
+
+        outputs = [np.zeros(gt_output.shape) for i in range(3)]
+        grad_output = np.zeros(gt_output.shape)
+        grad = np.zeros(gt_grad.shape)
+        handles = [cpuRBFFeatureGen_async(test_array, output, radem,
+            chi_arr, 2, False) for output in outputs]
+        handles.append(cpuRBFGrad_async(test_array, grad_output, grad,
+            radem, chi_arr, 1.0, 2, False))
+        for handle in handles:
+            self.assertTrue(handle.result() == 0)
+            self.assertTrue(handle.done())
+        for output in outputs:
+            self.assertTrue(np.allclose(output, gt_output))
+        self.assertTrue(np.allclose(grad_output, gt_grad_output))
+        self.assertTrue(np.allclose(grad, gt_grad))
+
+        handle = cpuRBFFeatureGen_async(test_array, np.zeros((10, 1000)),
+                radem, chi_arr, 2, False)
+        with self.assertRaises(RuntimeError):
+            handle.result()
+
+        if "cupy" not in sys.modules:
+            return
+        cuda_x, radem, chi_arr = cp.asarray(test_array), cp.asarray(radem), \
+                cp.asarray(chi_arr)
+        output = cp.zeros(gt_output.shape)
+        cudaRBFFeatureGen_async(cuda_x, output, radem, chi_arr, False).result()
+        cp.cuda.Device().synchronize()
+        self.assertTrue(np.allclose(cp.asnumpy(output), gt_output))
+
+        handle = cudaRBFFeatureGen_async(cuda_x, cp.zeros((10, 1000)), radem,
+                chi_arr, False)
+        with self.assertRaises(RuntimeError):
+            handle.result()
+
+
+    def test_cuda_workspace(self):
+        """Checks that cuda scratch memory is reused across calls,
+        only grows for larger inputs and can be released."""
+        if "cupy" not in sys.modules:
+            return
+        test_array, radem, chi_arr, _, _ = setup_rbf_test((103, 50), 500)
+        radem, chi_arr = cp.asarray(radem), cp.asarray(chi_arr)
+        gt_output = cp.zeros((test_array.shape[0], 1000))
+        cudaRBF(cp.asarray(test_array), gt_output, radem, chi_arr, False)
+        footprint = cudaGetWorkspaceSize()
+        self.assertTrue(footprint > 0)
+
+        output = cp.zeros((20, 1000))
+        cudaRBF(cp.asarray(test_array[:20,:]), output, radem, chi_arr, False)
+        self.assertTrue(cudaGetWorkspaceSize() == footprint)
+        self.assertTrue(cp.allclose(output, gt_output[:20,:]))
+
+        cudaReleaseWorkspace()
+        self.assertTrue(cudaGetWorkspaceSize() == 0)
+        output = cp.zeros(gt_output.shape)
+        cudaRBF(cp.asarray(test_array), output, radem, chi_arr, False)
+        self.assertTrue(cp.allclose(output, gt_output))
+
+
+
+    def test_cuda_stream(self):
+        """Checks that feature generation and gradients on a non-default
+        stream give the same result as on the default stream."""
+        if "cupy" not in sys.modules:
+            return
+        test_array, radem, chi_arr, _, _ = setup_rbf_test((103, 50), 500)
+        test_array = cp.asarray(test_array)
+        radem, chi_arr = cp.asarray(radem), cp.asarray(chi_arr)
+        gt_output = cp.zeros((test_array.shape[0], 1000))
+        gt_grad = cp.zeros((test_array.shape[0], 1000, 1))
+        cudaRBFGrad(test_array, gt_output, gt_grad, radem, chi_arr, 0.5, False)
+        cp.cuda.Device().synchronize()
+
+        stream = cp.cuda.Stream(non_blocking=True)
+        with stream:
+            output = cp.zeros(gt_output.shape)
+            grad = cp.zeros(gt_grad.shape)
+            cudaRBFGrad(test_array, output, grad, radem, chi_arr, 0.5, False,
+                    stream = stream.ptr)
+            done = stream.record()
+        done.synchronize()
+        self.assertTrue(cp.allclose(output, gt_output))
+        self.assertTrue(cp.allclose(grad, gt_grad))
+
+
+    def test_cuda_half_precision(self):
+        """Checks that float16 input gives the same features and
+        gradients as float32 input holding the same values."""
+        if "cupy" not in sys.modules:
+            return
+        test_array, radem, chi_arr, _, _ = setup_rbf_test((103, 50), 500)
+        half_array = cp.asarray(test_array.astype(np.float16))
+        radem = cp.asarray(radem)
+        chi_arr = cp.asarray(chi_arr.astype(np.float32))
+
+        gt_output = cp.zeros((test_array.shape[0], 1000), dtype=cp.float32)
+        gt_grad = cp.zeros((test_array.shape[0], 1000, 1), dtype=cp.float32)
+        cudaRBFGrad(half_array.astype(cp.float32), gt_output, gt_grad,
+                radem, chi_arr, 0.5, False)
+
+        output = cp.zeros(gt_output.shape, dtype=cp.float32)
+        grad = cp.zeros(gt_grad.shape, dtype=cp.float32)
+        cudaRBFGrad(half_array, output, grad, radem, chi_arr, 0.5, False)
+        self.assertTrue(cp.allclose(output, gt_output))
+        self.assertTrue(cp.allclose(grad, gt_grad))
+
+        gt_output[:] = 0
+        cudaRBF(half_array.astype(cp.float32), gt_output, radem, chi_arr, False)
+        output[:] = 0
+        cudaRBF(half_array, output, radem, chi_arr, False)
+        self.assertTrue(cp.allclose(output, gt_output))
+
+        half_output = cp.zeros(gt_output.shape, dtype=cp.float16)
+        cudaRBF(half_array, half_output, radem, chi_arr, False)
+        self.assertTrue(cp.allclose(half_output.astype(cp.float32), gt_output,
+            rtol=1e-2, atol=1e-3))
+
+
+    def test_rbf_projection_cache(self):
+        """Checks that features and gradients generated from stored
+        projections, for several sigma values at once, match those
+        generated from the raw input one sigma at a time, including
+        when the projections are stored in a memory-mapped file."""
+        test_array, radem, chi_arr, _, _ = setup_rbf_test((57, 50), 700)
+        sigmas = np.asarray([0.05, 0.5, 1.3])
+        gt_output = np.zeros((sigmas.shape[0], test_array.shape[0], 1400))
+        gt_grad = np.zeros(gt_output.shape + (1,))
+        for i, sigma in enumerate(sigmas):
+            cRBFGrad(test_array, gt_output[i], gt_grad[i], radem, chi_arr,
+                    sigma, 2, True)
+
+        proj = np.zeros((test_array.shape[0], 700))
+        cpuRBFProjection(test_array, proj, radem, chi_arr, 3)
+        output = np.zeros(gt_output.shape)
+        grad = np.zeros(gt_grad.shape)
+        cpuRBFProjectionGrad(proj, output, grad, sigmas, 3, True)
+        self.assertTrue(np.allclose(output, gt_output))
+        self.assertTrue(np.allclose(grad, gt_grad))
+        output[:] = 0
+        cpuRBFProjectionFGen(proj, output, sigmas, 3, True)
+        self.assertTrue(np.allclose(output, gt_output))
+
+        with tempfile.TemporaryDirectory() as tmpdir:
+            mmap_proj = np.memmap(os.path.join(tmpdir, "proj.dat"),
+                    dtype=np.float32, mode="w+", shape=proj.shape)
+            cpuRBFProjection(test_array, mmap_proj, radem, chi_arr, 3)
+            output[:] = 0
+            cpuRBFProjectionFGen(mmap_proj, output, sigmas, 3, True)
+            self.assertTrue(np.allclose(output, gt_output, rtol=1e-4, atol=1e-4))
+            del mmap_proj
+
+        if "cupy" not in sys.modules:
+            return
+        cuda_x, radem, chi_arr = cp.asarray(test_array), cp.asarray(radem), \
+                cp.asarray(chi_arr)
+        cuda_sigmas = cp.asarray(sigmas)
+        cuda_proj = cp.zeros(proj.shape)
+        cudaRBFProjection(cuda_x, cuda_proj, radem, chi_arr)
+        cuda_output = cp.zeros(gt_output.shape)
+        cuda_grad = cp.zeros(gt_grad.shape)
+        cudaRBFProjectionGrad(cuda_proj, cuda_output, cuda_grad, cuda_sigmas, True)
+        self.assertTrue(np.allclose(cp.asnumpy(cuda_output), gt_output))
+        self.assertTrue(np.allclose(cp.asnumpy(cuda_grad), gt_grad))
+
+        half_proj = cp.zeros(proj.shape, dtype=cp.float16)
+        cudaRBFProjection(cuda_x.astype(cp.float32), half_proj, radem,
+                chi_arr.astype(cp.float32))
+        cuda_output[:] = 0
+        cudaRBFProjectionFGen(half_proj, cuda_output, cuda_sigmas, True)
+        self.assertTrue(np.allclose(cp.asnumpy(cuda_output), gt_output,
+            rtol=1e-2, atol=1e-2))
+
+
+    def test_rbf_multi_sigma_grad(self):
+        """Checks that features and gradients generated for several
+        sigma values in one pass over the input match those generated
+        one sigma at a time."""
+        for xdim, num_freqs in [((57, 50), 700), ((12, 3), 9)]:
+            test_array, radem, chi_arr, _, _ = setup_rbf_test(xdim, num_freqs)
+            sigmas = np.asarray([0.05, 0.5, 1.3, 2.0])
+            gt_output = np.zeros((sigmas.shape[0], xdim[0], 2 * num_freqs))
+            gt_grad = np.zeros(gt_output.shape + (1,))
+            for i, sigma in enumerate(sigmas):
+                cRBFGrad(test_array, gt_output[i], gt_grad[i], radem, chi_arr,
+                        sigma, 2, True)
+
+            for precision_mode in ("exact", "fast"):
+                output = np.zeros(gt_output.shape)
+                grad = np.zeros(gt_grad.shape)
+                cpuRBFMultiSigmaGrad(test_array, output, grad, radem, chi_arr,
+                        sigmas, 3, True, precision_mode)
+                self.assertTrue(np.allclose(output, gt_output))
+                self.assertTrue(np.allclose(grad, gt_grad))
+
+            output = np.zeros(gt_output.shape, dtype=np.float32)
+            grad = np.zeros(gt_grad.shape, dtype=np.float32)
+            cpuRBFMultiSigmaGrad(test_array.astype(np.float32), output, grad,
+                    radem, chi_arr.astype(np.float32), sigmas, 3, True)
+            self.assertTrue(np.allclose(output, gt_output, rtol=1e-4, atol=1e-4))
+            self.assertTrue(np.allclose(grad, gt_grad, rtol=1e-3, atol=1e-3))
+
+            if "cupy" not in sys.modules:
+                continue
+            cuda_output = cp.zeros(gt_output.shape)
+            cuda_grad = cp.zeros(gt_grad.shape)
+            cudaRBFMultiSigmaGrad(cp.asarray(test_array), cuda_output, cuda_grad,
+                    cp.asarray(radem), cp.asarray(chi_arr), cp.asarray(sigmas),
+                    True)
+            self.assertTrue(np.allclose(cp.asnumpy(cuda_output), gt_output))
+            self.assertTrue(np.allclose(cp.asnumpy(cuda_grad), gt_grad))
+
+
+
+def run_rbf_test(xdim, num_freqs, random_seed = 123, fit_intercept = False,
+        precision_mode = "exact"):
     """A helper function that runs the RBF test for
     specified input dimensions."""
 
@@ -81,11 +364,12 @@ def run_rbf_test(xdim, num_freqs, random_seed = 123, fit_intercept = False):
             chi_arr.astype(np.float32), nblocks, padded_dims, fit_intercept)
 
     double_output = np.zeros((test_array.shape[0], num_freqs * 2))
-    cRBF(test_array, double_output, radem, chi_arr, 2, fit_intercept)
+    cRBF(test_array, double_output, radem, chi_arr, 2, fit_intercept,
+            precision_mode)
 
     float_output = np.zeros((test_array.shape[0], num_freqs * 2))
     cRBF(test_array.astype(np.float32), float_output, radem,
-            chi_arr.astype(np.float32), 2, fit_intercept)
+            chi_arr.astype(np.float32), 2, fit_intercept, precision_mode)
 
     if "cupy" in sys.modules:
         cuda_test_array = cp.asarray(test_array)
@@ -118,7 +402,7 @@ def run_rbf_test(xdim, num_freqs, random_seed = 123, fit_intercept = False):
 
 
 def run_rbf_grad_test(xdim, num_freqs, random_seed = 123,
-        fit_intercept = False):
+        fit_intercept = False, precision_mode = "exact"):
     """A helper function that tests the Cython wrapper which both
     generates RFs and calculates the gradient for specified input params."""
 
@@ -134,13 +418,13 @@ def run_rbf_grad_test(xdim, num_freqs, random_seed = 123,
     double_output = np.zeros((test_array.shape[0], num_freqs * 2))
     double_grad = np.zeros((double_output.shape[0], double_output.shape[1], 1))
     cRBFGrad(test_array, double_output, double_grad, radem, chi_arr,
-            1.0, 2, fit_intercept)
+            1.0, 2, fit_intercept, precision_mode)
 
     float_output = np.zeros((test_array.shape[0], num_freqs * 2))
     float_grad = np.zeros((float_output.shape[0], float_output.shape[1], 1))
     cRBFGrad(test_array.astype(np.float32), float_output,
             float_grad, radem, chi_arr.astype(np.float32), 1.0,
-            2, fit_intercept)
+            2, fit_intercept, precision_mode)
 
     if "cupy" in sys.modules:
         cuda_test_array = cp.asarray(test_array)
@@ -189,6 +473,86 @@ def run_rbf_grad_test(xdim, num_freqs, random_seed = 123,
 
 
 
+def run_rbf_float_output_test(xdim, num_freqs, random_seed = 123,
+        fit_intercept = False):
+    """A helper function that compares features and gradients written
+    to float32 output arrays with the same written to float64 arrays,
+    using float input in both cases."""
+    test_array, radem, chi_arr, _, _ = setup_rbf_test(xdim, num_freqs,
+            random_seed)
+    test_array, chi_arr = test_array.astype(np.float32), chi_arr.astype(np.float32)
+
+    gt_output = np.zeros((test_array.shape[0], num_freqs * 2))
+    gt_grad = np.zeros((gt_output.shape[0], gt_output.shape[1], 1))
+    cRBFGrad(test_array, gt_output, gt_grad, radem, chi_arr, 1.0, 2,
+            fit_intercept)
+
+    outputs = [np.zeros(gt_output.shape, dtype=np.float32)]
+    cRBF(test_array, outputs[0], radem, chi_arr, 2, fit_intercept)
+    outputs += [np.zeros(gt_output.shape, dtype=np.float32),
+            np.zeros(gt_grad.shape, dtype=np.float32)]
+    cRBFGrad(test_array, outputs[1], outputs[2], radem, chi_arr, 1.0, 2,
+            fit_intercept)
+
+    if "cupy" in sys.modules:
+        cuda_test_array = cp.asarray(test_array)
+        radem, chi_arr = cp.asarray(radem), cp.asarray(chi_arr)
+        outputs.append(cp.zeros(gt_output.shape, dtype=cp.float32))
+        cudaRBF(cuda_test_array, outputs[3], radem, chi_arr, fit_intercept)
+        outputs += [cp.zeros(gt_output.shape, dtype=cp.float32),
+                cp.zeros(gt_grad.shape, dtype=cp.float32)]
+        cudaRBFGrad(cuda_test_array, outputs[4], outputs[5], radem,
+                chi_arr, 1.0, fit_intercept)
+        outputs = outputs[:3] + [cp.asnumpy(o) for o in outputs[3:]]
+
+    outcomes = []
+    for i, output in enumerate(outputs):
+        gt_array = gt_grad if i in (2, 5) else gt_output
+        outcomes.append(np.allclose(gt_array, output, rtol=1e-5, atol=1e-5))
+    print(f"Correct result for float output for RBF of {xdim}, {num_freqs}? "
+            f"{outcomes}")
+    return outcomes
+
+
+
+def run_packed_radem_test(xdim, num_freqs, random_seed = 123):
+    """A helper function that compares features and gradients generated
+    using radem packed to one bit per element with the same generated
+    using the int8 radem."""
+    test_array, radem, chi_arr, _, _ = setup_rbf_test(xdim, num_freqs,
+            random_seed)
+    packed_radem = np.packbits(radem < 0, axis=2, bitorder="little")
+
+    gt_output = np.zeros((test_array.shape[0], num_freqs * 2))
+    gt_grad = np.zeros((gt_output.shape[0], gt_output.shape[1], 1))
+    cRBFGrad(test_array, gt_output, gt_grad, radem, chi_arr, 0.5, 2, True)
+
+    outputs = [np.zeros(gt_output.shape), np.zeros(gt_output.shape),
+            np.zeros(gt_grad.shape)]
+    cRBF(test_array, outputs[0], packed_radem, chi_arr, 2, True)
+    cRBFGrad(test_array, outputs[1], outputs[2], packed_radem, chi_arr,
+            0.5, 2, True)
+
+    if "cupy" in sys.modules:
+        cuda_test_array = cp.asarray(test_array)
+        packed_radem, chi_arr = cp.asarray(packed_radem), cp.asarray(chi_arr)
+        outputs += [cp.zeros(gt_output.shape), cp.zeros(gt_output.shape),
+                cp.zeros(gt_grad.shape)]
+        cudaRBF(cuda_test_array, outputs[3], packed_radem, chi_arr, True)
+        cudaRBFGrad(cuda_test_array, outputs[4], outputs[5], packed_radem,
+                chi_arr, 0.5, True)
+        outputs = outputs[:3] + [cp.asnumpy(o) for o in outputs[3:]]
+
+    outcomes = []
+    for i, output in enumerate(outputs):
+        gt_array = gt_grad if i in (2, 5) else gt_output
+        outcomes.append(np.allclose(gt_array, output))
+    print(f"Correct result for packed radem for RBF of {xdim}, {num_freqs}? "
+            f"{outcomes}")
+    return outcomes
+
+
+
 def setup_rbf_test(xdim, num_freqs, random_seed = 123):
     """A helper function that builds the matrices required for
     the RBF test, specified using the input dimensions."""
@@ -0,0 +1,157 @@
+"""Tests the persistent worker pool used by the CPU extension. Repeated
+calls with different thread counts, pool resizing and shutdown must
+all give results identical to a single-threaded call."""
+import unittest
+import numpy as np
+
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFFeatureGen as cRBF
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuConv1dFGen as cConv1d
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuConvGrad as cConvGrad
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuConv1dMaxpool as cConvMaxpool
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuSetThreadPoolSize, cpuGetThreadPoolSize
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuShutdownThreadPool
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuSetNUMAMode, cpuGetNUMANodes
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuAllocateFirstTouch
+from xGPR.native_profiling import set_profiling, get_profile, reset_profile
+
+from test_rbf_rfgen import setup_rbf_test
+
+
+class TestThreadPool(unittest.TestCase):
+    """Checks that the worker pool gives consistent results
+    across thread counts and across shutdown / restart."""
+
+    def test_pool_consistency(self):
+        """Runs RBF and conv feature generation with a variety
+        of thread counts and checks results are unchanged."""
+        test_array, radem, chi_arr, _, _ = setup_rbf_test((103, 50), 500)
+        gt_output = np.zeros((test_array.shape[0], 1000))
+        cRBF(test_array, gt_output, radem, chi_arr, 1, True)
+
+        for num_threads in [2, 3, 8, 200, 2]:
+            output = np.zeros((test_array.shape[0], 1000))
+            cRBF(test_array, output, radem, chi_arr, num_threads, True)
+            self.assertTrue(np.allclose(output, gt_output))
+
+        cpuShutdownThreadPool()
+        self.assertTrue(cpuGetThreadPoolSize() == 1)
+        output = np.zeros((test_array.shape[0], 1000))
+        cRBF(test_array, output, radem, chi_arr, 4, True)
+        self.assertTrue(np.allclose(output, gt_output))
+
+        rng = np.random.default_rng(123)
+        conv_x = rng.uniform(size=(37, 20, 5))
+        seqlen = rng.integers(low=5, high=20, size=37).astype(np.int32)
+        conv_radem = rng.choice(np.asarray([-1,1], dtype=np.int8),
+                size=(3, 1, 512), replace=True)
+        conv_chi = rng.uniform(size=500)
+        gt_conv = np.zeros((37, 1000))
+        cConv1d(conv_x, gt_conv, conv_radem, conv_chi, seqlen, 3, 0, 1)
+        conv_output = np.zeros((37, 1000))
+        cConv1d(conv_x, conv_output, conv_radem, conv_chi, seqlen, 3, 0, 5)
+        self.assertTrue(np.allclose(conv_output, gt_conv))
+
+
+    def test_length_balancing(self):
+        """Checks that conv feature generation, gradients and maxpool
+        features are unchanged when a few very long sequences are
+        split across more threads than there are sequences."""
+        rng = np.random.default_rng(123)
+        conv_x = rng.uniform(size=(4, 300, 5))
+        seqlen = np.asarray([300, 3, 12, 150], dtype=np.int32)
+        conv_radem = rng.choice(np.asarray([-1,1], dtype=np.int8),
+                size=(3, 1, 512), replace=True)
+        conv_chi = rng.uniform(size=500)
+
+        gt_conv, gt_grad = np.zeros((4, 1000)), np.zeros((4, 1000, 1))
+        cConvGrad(conv_x, gt_conv, conv_radem, conv_chi, seqlen, gt_grad,
+                0.5, 3, 2, 1)
+        gt_maxpool = np.zeros((4, 500), dtype=np.float32)
+        cConvMaxpool(conv_x, gt_maxpool, conv_radem, conv_chi, seqlen, 3, 1)
+
+        for num_threads in [2, 5, 16]:
+            conv_output = np.zeros((4, 1000))
+            cConv1d(conv_x * 0.5, conv_output, conv_radem, conv_chi, seqlen, 3,
+                    2, num_threads)
+            self.assertTrue(np.allclose(conv_output, gt_conv))
+            conv_output[:] = 0
+            grad_output = np.zeros((4, 1000, 1))
+            cConvGrad(conv_x, conv_output, conv_radem, conv_chi, seqlen,
+                    grad_output, 0.5, 3, 2, num_threads)
+            self.assertTrue(np.allclose(conv_output, gt_conv))
+            self.assertTrue(np.allclose(grad_output, gt_grad))
+            maxpool_output = np.zeros((4, 500), dtype=np.float32)
+            cConvMaxpool(conv_x, maxpool_output, conv_radem, conv_chi,
+                    seqlen, 3, num_threads)
+            self.assertTrue(np.array_equal(maxpool_output, gt_maxpool))
+
+
+    def test_pool_resize(self):
+        """Checks that the pool can be resized and shut down."""
+        cpuSetThreadPoolSize(6)
+        self.assertTrue(cpuGetThreadPoolSize() == 6)
+        cpuSetThreadPoolSize(2)
+        self.assertTrue(cpuGetThreadPoolSize() == 2)
+        cpuShutdownThreadPool()
+        self.assertTrue(cpuGetThreadPoolSize() == 1)
+
+
+    def test_numa_mode(self):
+        """Checks that first-touch output arrays are zeroed and have
+        the requested shape and dtype, and that results are unchanged
+        in NUMA mode (which is a no-op on single-node machines)."""
+        test_array, radem, chi_arr, _, _ = setup_rbf_test((103, 50), 500)
+        gt_output = np.zeros((test_array.shape[0], 1000))
+        cRBF(test_array, gt_output, radem, chi_arr, 1, True)
+
+        num_nodes = cpuSetNUMAMode(True, 4)
+        self.assertTrue(num_nodes == cpuGetNUMANodes())
+        self.assertTrue(num_nodes == 0 or num_nodes > 1)
+
+        output = cpuAllocateFirstTouch((test_array.shape[0], 1000), 4)
+        self.assertTrue(output.shape == gt_output.shape)
+        self.assertTrue(output.dtype == np.float64)
+        self.assertTrue(np.all(output == 0))
+        cRBF(test_array, output, radem, chi_arr, 4, True)
+        self.assertTrue(np.allclose(output, gt_output))
+
+        grad_output = cpuAllocateFirstTouch((3, 7, 1), 5, False)
+        self.assertTrue(grad_output.shape == (3, 7, 1))
+        self.assertTrue(grad_output.dtype == np.float32)
+        self.assertTrue(np.all(grad_output == 0))
+
+        self.assertTrue(cpuSetNUMAMode(False, 2) == 0)
+        self.assertTrue(cpuGetNUMANodes() == 0)
+
+
+    def test_profiling(self):
+        """Checks that the profile reports the rows processed and is
+        cleared by a reset if the extension was built with profiling,
+        and that results are unchanged whether or not it is on."""
+        test_array, radem, chi_arr, _, _ = setup_rbf_test((103, 50), 500)
+        gt_output = np.zeros((test_array.shape[0], 1000))
+        cRBF(test_array, gt_output, radem, chi_arr, 1, True)
+
+        available = set_profiling(True)
+        reset_profile()
+        output = np.zeros((test_array.shape[0], 1000))
+        cRBF(test_array, output, radem, chi_arr, 3, True)
+        self.assertTrue(np.allclose(output, gt_output))
+
+        profile = get_profile()["cpu"]
+        self.assertTrue(profile["available"] == available)
+        if available:
+            self.assertTrue(profile["enabled"])
+            self.assertTrue(profile["counts"]["rows"] == test_array.shape[0])
+            self.assertTrue(len(profile["thread_counts"]["rows"]) == 3)
+            self.assertTrue(profile["phase_seconds"]["fht"] > 0)
+            self.assertTrue(profile["load_imbalance"]["jobs"] == 1)
+            reset_profile()
+            self.assertTrue(get_profile()["cpu"]["counts"]["rows"] == 0)
+
+        set_profiling(False)
+        reset_profile()
+
+
+if __name__ == "__main__":
+    unittest.main()
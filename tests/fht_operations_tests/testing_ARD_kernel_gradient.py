@@ -39,6 +39,45 @@ class TestARDGradCalcs(unittest.TestCase):
         for outcome in outcomes:
             self.assertTrue(outcome)
 
+        # Many lengthscales, some narrower than a tile of columns.
+        outcomes = run_mini_ard_grad_test((37,130), 700,
+                [3, 5] + list(range(12, 130, 6)))
+        for outcome in outcomes:
+            self.assertTrue(outcome)
+
+
+    def test_mini_ard_candidates(self):
+        """Checks that features and gradients generated for several
+        candidate sets of lengthscales in one pass match those generated
+        by setting each candidate in turn."""
+        rng = np.random.default_rng(123)
+        input_x = rng.uniform(low=-10.0,high=10.0, size=(57, 130))
+        for split_points, fit_intercept in [([25], False), ([3, 40, 100], True)]:
+            candidates = rng.uniform(low=0.05, high=2.0,
+                    size=(3, len(split_points) + 1))
+            devices = ["cpu", "cuda"] if "cupy" in sys.modules else ["cpu"]
+            for double_precision in (True, False):
+                for device in devices:
+                    kernel = build_mini_ard_kernel(input_x.shape, 300, split_points,
+                            123, double_precision = double_precision,
+                            fit_intercept = fit_intercept)
+                    kernel.device = device
+                    x_device = cp.asarray(input_x) if device == "cuda" else input_x
+                    xtrans, gradient = kernel.gradient_candidates(x_device,
+                            candidates)
+                    if device == "cuda":
+                        xtrans, gradient = cp.asnumpy(xtrans), cp.asnumpy(gradient)
+
+                    for i in range(candidates.shape[0]):
+                        kernel.set_hyperparams(np.concatenate([[1.0],
+                            candidates[i]]), logspace = False)
+                        gt_xtrans, gt_gradient = kernel.gradient_x(x_device)
+                        if device == "cuda":
+                            gt_xtrans = cp.asnumpy(gt_xtrans)
+                            gt_gradient = cp.asnumpy(gt_gradient)
+                        self.assertTrue(np.allclose(xtrans[i], gt_xtrans))
+                        self.assertTrue(np.allclose(gradient[i], gt_gradient))
+
 
 
 
@@ -0,0 +1,156 @@
+#ifndef XGPR_BENCH_ARRAYS_H
+#define XGPR_BENCH_ARRAYS_H
+
+/*!
+ * # bench_arrays.h
+ *
+ * Small helpers shared by the native benchmarks for building the
+ * arrays the wrapper-facing routines expect. Each BenchArray owns its
+ * data and hands out nanobind views of it, so the views can be built
+ * once per benchmark, outside of the timed loop, and no Python objects
+ * are involved.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <random>
+#include <thread>
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <nanobind/nanobind.h>
+#include <nanobind/ndarray.h>
+
+namespace nb = nanobind;
+
+#define BENCH_RANDOM_SEED 123
+
+// The problem sizes shared by the CPU and CUDA benchmarks, so that their
+// results can be compared directly: the number of rows used by the RBF
+// and ARD benchmarks and the number of elements transformed per
+// iteration by the transform benchmarks.
+#define BENCH_NUM_ROWS 1000
+#define BENCH_TRANSFORM_ELEMENTS (1 << 22)
+
+// The input dimensionality and number of frequencies used by the conv
+// benchmarks, which instead vary the width and sequence lengths.
+#define BENCH_CONV_FEATURES 21
+#define BENCH_CONV_FREQS 2048
+#define BENCH_CONV_ROWS 64
+#define BENCH_CONV_MAXLEN 256
+
+
+// Defined by each benchmark executable: adds any backend-specific
+// details (e.g. the FHT instruction set in use) to the context section
+// of the output, and releases any native resources (the thread pool,
+// device workspaces) before exit.
+void addBenchContext();
+void releaseBenchResources();
+
+
+template <typename T>
+class BenchArray {
+    public:
+        explicit BenchArray(std::vector<size_t> arrayShape) : arrayShape(arrayShape) {
+            size_t numElements = 1;
+            for (size_t dimSize : arrayShape)
+                numElements *= dimSize;
+            values.assign(numElements, T(0));
+        }
+
+        T *data() { return values.data(); }
+        size_t size() const { return values.size(); }
+        const std::vector<size_t> &shape() const { return arrayShape; }
+
+        void fillUniform(std::mt19937_64 &rng, double low, double high){
+            std::uniform_real_distribution<double> dist(low, high);
+            for (T &value : values)
+                value = static_cast<T>(dist(rng));
+        }
+
+        void fillRadem(std::mt19937_64 &rng){
+            std::bernoulli_distribution dist(0.5);
+            for (T &value : values)
+                value = dist(rng) ? T(1) : T(-1);
+        }
+
+        void zero(){
+            std::fill(values.begin(), values.end(), T(0));
+        }
+
+        template <typename... Opts>
+        nb::ndarray<T, Opts...> view(){
+            return nb::ndarray<T, Opts...>(values.data(), arrayShape.size(),
+                    arrayShape.data(), nb::handle());
+        }
+
+    private:
+        std::vector<size_t> arrayShape;
+        std::vector<T> values;
+};
+
+
+// Fills the radem array with +/-1 and chiArr with values of about the
+// size chi.rvs gives for the dimensions used here.
+template <typename T>
+inline void fillRademChi(BenchArray<int8_t> &radem, BenchArray<T> &chiArr,
+        std::mt19937_64 &rng){
+    radem.fillRadem(rng);
+    chiArr.fillUniform(rng, 0.5, 2.0);
+}
+
+// The radem shape the Python kernels use: (3, 1, numFreqs padded up to a
+// multiple of paddedDim).
+inline std::vector<size_t> rademShape(int numFreqs, int paddedDim){
+    size_t numBlocks = (numFreqs + paddedDim - 1) / paddedDim;
+    return {3, 1, numBlocks * paddedDim};
+}
+
+// Fills seqlengths for the conv benchmarks. Distribution 0 uses the full
+// length for every sequence, 1 draws lengths uniformly and 2 gives a few
+// very long sequences among many short ones, the case the weighted row
+// partitioning is meant for.
+inline void fillSeqlengths(BenchArray<int32_t> &seqlengths, int distribution,
+        int minLength, std::mt19937_64 &rng){
+    std::uniform_int_distribution<int> uniformLength(minLength, BENCH_CONV_MAXLEN);
+    std::uniform_int_distribution<int> shortLength(minLength, BENCH_CONV_MAXLEN / 16);
+    for (size_t i=0; i < seqlengths.size(); i++){
+        if (distribution == 0)
+            seqlengths.data()[i] = BENCH_CONV_MAXLEN;
+        else if (distribution == 1)
+            seqlengths.data()[i] = uniformLength(rng);
+        else
+            seqlengths.data()[i] = (i % 32 == 0) ? BENCH_CONV_MAXLEN : shortLength(rng);
+    }
+}
+
+
+// Wraps a BenchArray as the C-contiguous CPU ndarray type used
+// throughout the CPU wrappers.
+#define CPU_VIEW(arr, ...) (arr).template view<nb::shape<__VA_ARGS__>, \
+        nb::device::cpu, nb::c_contig>()
+
+
+// The smallest power of two >= dim, as used by the Python kernels to
+// pad the input to the transforms.
+inline int paddedSize(int dim){
+    int padded = 2;
+    while (padded < dim)
+        padded *= 2;
+    return padded;
+}
+
+
+// Adds the thread counts 1, 2, 4, ... up to the number of hardware
+// threads (and always at least 1 and 2) for each of the given values
+// of the first argument.
+inline void threadCountArgs(benchmark::internal::Benchmark *bench,
+        const std::vector<int64_t> &firstArgs){
+    int maxThreads = std::max(2u, std::thread::hardware_concurrency());
+    for (int64_t firstArg : firstArgs){
+        for (int numThreads = 1; numThreads <= maxThreads; numThreads *= 2)
+            bench->Args({firstArg, numThreads});
+    }
+}
+
+#endif
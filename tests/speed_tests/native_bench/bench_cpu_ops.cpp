@@ -0,0 +1,320 @@
+/*!
+ * # bench_cpu_ops.cpp
+ *
+ * Benchmarks for the CPU feature generation routines, run directly
+ * against the native code. The transforms are benchmarked through
+ * transformRows and singleVectorSORF; each feature kernel is
+ * benchmarked through the same wrapper-facing function the Python
+ * code calls, so that the timings include the setup those do before
+ * handing rows to the thread pool (e.g. sorting the ARD weights by
+ * lengthscale) but no Python overhead.
+ *
+ * Each benchmark reports rows (or vectors) per second as
+ * items_per_second. Benchmarks that take a thread count are run for
+ * 1, 2, 4... threads up to the number of hardware threads.
+ */
+#include <string>
+#include "bench_arrays.h"
+#include "shared_fht_functions/hadamard_transforms.h"
+#include "shared_fht_functions/shared_rfgen_ops.h"
+#include "shared_fht_functions/thread_pool.h"
+#include "shared_fht_functions/simd_hadamard.h"
+#include "rbf_ops/rbf_ops.h"
+#include "rbf_ops/ard_ops.h"
+#include "convolution_ops/rbf_convolution.h"
+#include "convolution_ops/conv1d_operations.h"
+
+
+void addBenchContext(){
+    benchmark::AddCustomContext("fht_instruction_set",
+            std::to_string(getFHTInstructionSet_()));
+}
+
+void releaseBenchResources(){
+    shutdownThreadPool_();
+}
+
+
+
+// Transforms BENCH_TRANSFORM_ELEMENTS elements arranged as
+// (N, 1, dim) rows, split across the thread pool. Args: dim, numThreads.
+template <typename T>
+static void BM_TransformRows(benchmark::State &state){
+    int dim = state.range(0), numThreads = state.range(1);
+    int numRows = std::max(1, BENCH_TRANSFORM_ELEMENTS / dim);
+    std::mt19937_64 rng(BENCH_RANDOM_SEED);
+    BenchArray<T> xArr({static_cast<size_t>(numRows), 1, static_cast<size_t>(dim)});
+    xArr.fillUniform(rng, -1.0, 1.0);
+    T *xPtr = xArr.data();
+
+    for (auto _ : state){
+        RFGenThreadPool::getInstance().parallelForRows(numRows, numThreads,
+                [&](int startRow, int endRow, int threadIndex){
+            transformRows<T>(xPtr, startRow, endRow, 1, dim);
+        });
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * numRows);
+    state.SetBytesProcessed(state.iterations() * xArr.size() * sizeof(T));
+}
+
+static void transformRowsArgs(benchmark::internal::Benchmark *bench){
+    bench->ArgNames({"dim", "threads"});
+    threadCountArgs(bench, {128, 1024, 8192, 65536, 1 << 20});
+}
+
+BENCHMARK_TEMPLATE(BM_TransformRows, float)->Apply(transformRowsArgs)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_TransformRows, double)->Apply(transformRowsArgs)->UseRealTime();
+
+
+
+// A single structured orthogonal transform on one vector, the unit of
+// work inside most of the feature generation routines. Args: dim.
+template <typename T>
+static void BM_SingleVectorSORF(benchmark::State &state){
+    int dim = state.range(0);
+    std::mt19937_64 rng(BENCH_RANDOM_SEED);
+    BenchArray<T> buffer({static_cast<size_t>(dim)});
+    BenchArray<int8_t> radem({3, 1, static_cast<size_t>(dim)});
+    buffer.fillUniform(rng, -1.0, 1.0);
+    radem.fillRadem(rng);
+
+    for (auto _ : state){
+        singleVectorSORF<T>(buffer.data(), radem.data(), 0, dim, dim);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(BM_SingleVectorSORF, float)->ArgName("dim")->RangeMultiplier(4)->Range(64, 65536);
+BENCHMARK_TEMPLATE(BM_SingleVectorSORF, double)->ArgName("dim")->RangeMultiplier(4)->Range(64, 65536);
+
+
+
+
+// RBF feature generation (allInOneRBFGen) for BENCH_NUM_ROWS rows of
+// 64 features. Args: numFreqs, numThreads.
+template <typename T>
+static void BM_RBFFeatureGen(benchmark::State &state){
+    int numFreqs = state.range(0), numThreads = state.range(1);
+    size_t numRows = BENCH_NUM_ROWS, numFeatures = 64;
+    std::mt19937_64 rng(BENCH_RANDOM_SEED);
+
+    BenchArray<T> xArr({numRows, numFeatures}), chiArr({static_cast<size_t>(numFreqs)});
+    BenchArray<double> outputArr({numRows, 2 * static_cast<size_t>(numFreqs)});
+    BenchArray<int8_t> radem(rademShape(numFreqs, paddedSize(numFeatures)));
+    xArr.fillUniform(rng, -1.0, 1.0);
+    fillRademChi(radem, chiArr, rng);
+
+    auto xView = CPU_VIEW(xArr, -1, -1);
+    auto outputView = CPU_VIEW(outputArr, -1, -1);
+    auto rademView = CPU_VIEW(radem, 3, 1, -1);
+    auto chiView = CPU_VIEW(chiArr, -1);
+
+    for (auto _ : state){
+        rbfFeatureGen_<T, double>(xView, outputView, rademView, chiView,
+                numThreads, true, "exact");
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * numRows);
+}
+
+// As BM_RBFFeatureGen, but also generating the gradient (allInOneRBFGrad).
+template <typename T>
+static void BM_RBFGrad(benchmark::State &state){
+    int numFreqs = state.range(0), numThreads = state.range(1);
+    size_t numRows = BENCH_NUM_ROWS, numFeatures = 64;
+    std::mt19937_64 rng(BENCH_RANDOM_SEED);
+
+    BenchArray<T> xArr({numRows, numFeatures}), chiArr({static_cast<size_t>(numFreqs)});
+    BenchArray<double> outputArr({numRows, 2 * static_cast<size_t>(numFreqs)});
+    BenchArray<double> gradArr({numRows, 2 * static_cast<size_t>(numFreqs), 1});
+    BenchArray<int8_t> radem(rademShape(numFreqs, paddedSize(numFeatures)));
+    xArr.fillUniform(rng, -1.0, 1.0);
+    fillRademChi(radem, chiArr, rng);
+
+    auto xView = CPU_VIEW(xArr, -1, -1);
+    auto outputView = CPU_VIEW(outputArr, -1, -1);
+    auto gradView = CPU_VIEW(gradArr, -1, -1, 1);
+    auto rademView = CPU_VIEW(radem, 3, 1, -1);
+    auto chiView = CPU_VIEW(chiArr, -1);
+
+    for (auto _ : state){
+        rbfGrad_<T, double>(xView, outputView, gradView, rademView, chiView,
+                1.0f, numThreads, true, "exact");
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * numRows);
+}
+
+static void rbfArgs(benchmark::internal::Benchmark *bench){
+    bench->ArgNames({"numFreqs", "threads"});
+    threadCountArgs(bench, {1024, 8192});
+}
+
+BENCHMARK_TEMPLATE(BM_RBFFeatureGen, float)->Apply(rbfArgs)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_RBFFeatureGen, double)->Apply(rbfArgs)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_RBFGrad, float)->Apply(rbfArgs)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_RBFGrad, double)->Apply(rbfArgs)->UseRealTime();
+
+
+
+
+// MiniARD gradient (ThreadARDGrad) for BENCH_NUM_ROWS / 4 rows of 64
+// features split across 8 lengthscales (fewer rows than for RBF since the
+// gradient has 8 columns per feature). Args: numFreqs, numThreads.
+template <typename T>
+static void BM_ARDGrad(benchmark::State &state){
+    int numFreqs = state.range(0), numThreads = state.range(1);
+    size_t numRows = BENCH_NUM_ROWS / 4, numFeatures = 64, numLengthscales = 8;
+    std::mt19937_64 rng(BENCH_RANDOM_SEED);
+
+    BenchArray<T> xArr({numRows, numFeatures});
+    BenchArray<T> precompWeights({static_cast<size_t>(numFreqs), numFeatures});
+    BenchArray<int32_t> sigmaMap({numFeatures});
+    BenchArray<double> sigmaVals({numFeatures});
+    BenchArray<double> outputArr({numRows, 2 * static_cast<size_t>(numFreqs)});
+    BenchArray<double> gradArr({numRows, 2 * static_cast<size_t>(numFreqs),
+            numLengthscales});
+    xArr.fillUniform(rng, -1.0, 1.0);
+    precompWeights.fillUniform(rng, -1.0, 1.0);
+    sigmaVals.fillUniform(rng, 0.5, 2.0);
+    for (size_t k=0; k < numFeatures; k++)
+        sigmaMap.data()[k] = k % numLengthscales;
+
+    auto xView = CPU_VIEW(xArr, -1, -1);
+    auto outputView = CPU_VIEW(outputArr, -1, -1);
+    auto weightView = CPU_VIEW(precompWeights, -1, -1);
+    auto sigmaMapView = CPU_VIEW(sigmaMap, -1);
+    auto sigmaValView = CPU_VIEW(sigmaVals, -1);
+    auto gradView = CPU_VIEW(gradArr, -1, -1, -1);
+
+    for (auto _ : state){
+        ardGrad_<T>(xView, outputView, weightView, sigmaMapView, sigmaValView,
+                gradView, numThreads, true);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * numRows);
+}
+
+static void ardArgs(benchmark::internal::Benchmark *bench){
+    bench->ArgNames({"numFreqs", "threads"});
+    threadCountArgs(bench, {512, 2048});
+}
+
+BENCHMARK_TEMPLATE(BM_ARDGrad, float)->Apply(ardArgs)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ARDGrad, double)->Apply(ardArgs)->UseRealTime();
+
+
+
+
+// The inputs shared by the conv benchmarks, built once per benchmark.
+template <typename T>
+struct ConvBenchInputs {
+    BenchArray<T> xArr, chiArr;
+    BenchArray<int8_t> radem;
+    BenchArray<int32_t> seqlengths;
+    int64_t numKmers = 0;
+
+    ConvBenchInputs(int convWidth, int distribution) :
+        xArr({BENCH_CONV_ROWS, BENCH_CONV_MAXLEN, BENCH_CONV_FEATURES}),
+        chiArr({BENCH_CONV_FREQS}),
+        radem(rademShape(BENCH_CONV_FREQS, paddedSize(convWidth * BENCH_CONV_FEATURES))),
+        seqlengths({BENCH_CONV_ROWS}) {
+        std::mt19937_64 rng(BENCH_RANDOM_SEED);
+        xArr.fillUniform(rng, -1.0, 1.0);
+        fillRademChi(radem, chiArr, rng);
+        fillSeqlengths(seqlengths, distribution, convWidth, rng);
+        for (size_t i=0; i < seqlengths.size(); i++)
+            numKmers += seqlengths.data()[i] - convWidth + 1;
+    }
+};
+
+
+// Conv RBF feature generation (allInOneConvRBFGen). Args: convWidth,
+// seqlength distribution (see fillSeqlengths), numThreads. Reports kmers
+// per second.
+template <typename T>
+static void BM_ConvRBFFeatureGen(benchmark::State &state){
+    int convWidth = state.range(0), numThreads = state.range(2);
+    ConvBenchInputs<T> inputs(convWidth, state.range(1));
+    BenchArray<double> outputArr({BENCH_CONV_ROWS, 2 * BENCH_CONV_FREQS});
+
+    auto xView = CPU_VIEW(inputs.xArr, -1, -1, -1);
+    auto outputView = CPU_VIEW(outputArr, -1, -1);
+    auto rademView = CPU_VIEW(inputs.radem, 3, 1, -1);
+    auto chiView = CPU_VIEW(inputs.chiArr, -1);
+    auto seqlenView = CPU_VIEW(inputs.seqlengths, -1);
+
+    for (auto _ : state){
+        convRBFFeatureGen_<T, double>(xView, outputView, rademView, chiView,
+                seqlenView, convWidth, 0, numThreads, "exact", 0);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * inputs.numKmers);
+}
+
+// As BM_ConvRBFFeatureGen, but also generating the gradient
+// (allInOneConvRBFGrad).
+template <typename T>
+static void BM_ConvRBFGrad(benchmark::State &state){
+    int convWidth = state.range(0), numThreads = state.range(2);
+    ConvBenchInputs<T> inputs(convWidth, state.range(1));
+    BenchArray<double> outputArr({BENCH_CONV_ROWS, 2 * BENCH_CONV_FREQS});
+    BenchArray<double> gradArr({BENCH_CONV_ROWS, 2 * BENCH_CONV_FREQS, 1});
+
+    auto xView = CPU_VIEW(inputs.xArr, -1, -1, -1);
+    auto outputView = CPU_VIEW(outputArr, -1, -1);
+    auto gradView = CPU_VIEW(gradArr, -1, -1, 1);
+    auto rademView = CPU_VIEW(inputs.radem, 3, 1, -1);
+    auto chiView = CPU_VIEW(inputs.chiArr, -1);
+    auto seqlenView = CPU_VIEW(inputs.seqlengths, -1);
+
+    for (auto _ : state){
+        convRBFGrad_<T, double>(xView, outputView, rademView, chiView,
+                seqlenView, gradView, 1.0, convWidth, 0, numThreads, "exact", 0);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * inputs.numKmers);
+}
+
+// Maxpool conv features (allInOneConvMaxpoolGen). Output is zeroed before
+// each call, since the routine takes the max with its current contents.
+template <typename T>
+static void BM_ConvMaxpool(benchmark::State &state){
+    int convWidth = state.range(0), numThreads = state.range(2);
+    ConvBenchInputs<T> inputs(convWidth, state.range(1));
+    BenchArray<float> outputArr({BENCH_CONV_ROWS, BENCH_CONV_FREQS});
+
+    auto xView = CPU_VIEW(inputs.xArr, -1, -1, -1);
+    auto outputView = CPU_VIEW(outputArr, -1, -1);
+    auto rademView = CPU_VIEW(inputs.radem, 3, 1, -1);
+    auto chiView = CPU_VIEW(inputs.chiArr, -1);
+    auto seqlenView = CPU_VIEW(inputs.seqlengths, -1);
+
+    for (auto _ : state){
+        outputArr.zero();
+        conv1dMaxpoolFeatureGen_<T>(xView, outputView, rademView, chiView,
+                seqlenView, convWidth, numThreads, 0);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * inputs.numKmers);
+}
+
+static void convArgs(benchmark::internal::Benchmark *bench){
+    bench->ArgNames({"convWidth", "seqlenDist", "threads"});
+    int maxThreads = std::max(2u, std::thread::hardware_concurrency());
+    for (int convWidth : {3, 9}){
+        for (int distribution : {0, 1, 2}){
+            for (int numThreads = 1; numThreads <= maxThreads; numThreads *= 2)
+                bench->Args({convWidth, distribution, numThreads});
+        }
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_ConvRBFFeatureGen, float)->Apply(convArgs)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ConvRBFFeatureGen, double)->Apply(convArgs)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ConvRBFGrad, float)->Apply(convArgs)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ConvRBFGrad, double)->Apply(convArgs)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ConvMaxpool, float)->Apply(convArgs)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_ConvMaxpool, double)->Apply(convArgs)->UseRealTime();
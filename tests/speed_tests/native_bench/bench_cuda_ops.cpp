@@ -0,0 +1,343 @@
+/*!
+ * # bench_cuda_ops.cpp
+ *
+ * Benchmarks for the CUDA feature generation routines, using the same
+ * problem sizes as bench_cpu_ops.cpp so that results can be compared
+ * directly. Each routine is called through its wrapper-facing function
+ * on the default stream, and timed with CUDA events, so the reported
+ * time is the time until the device has finished rather than the time
+ * taken to queue the kernels.
+ */
+#include <string>
+#include <stdexcept>
+#include <cuda_runtime.h>
+#include "bench_arrays.h"
+#include "basic_ops/basic_array_operations.h"
+#include "basic_ops/device_workspace.h"
+#include "rbf_ops/rbf_ops.h"
+#include "rbf_ops/ard_ops.h"
+#include "convolution_ops/convolution.h"
+#include "convolution_ops/rbf_convolution.h"
+
+
+
+void addBenchContext(){
+    cudaDeviceProp deviceProps;
+    if (cudaGetDeviceProperties(&deviceProps, 0) == cudaSuccess)
+        benchmark::AddCustomContext("cuda_device", deviceProps.name);
+}
+
+void releaseBenchResources(){
+    releaseCudaWorkspace_();
+}
+
+
+
+// A device copy of a BenchArray, freed when it goes out of scope.
+template <typename T>
+class DeviceArray {
+    public:
+        explicit DeviceArray(BenchArray<T> &hostArray) : arrayShape(hostArray.shape()) {
+            size_t numBytes = hostArray.size() * sizeof(T);
+            if (cudaMalloc(&devicePtr, numBytes) != cudaSuccess)
+                throw std::runtime_error("could not allocate device memory");
+            cudaMemcpy(devicePtr, hostArray.data(), numBytes, cudaMemcpyHostToDevice);
+        }
+        ~DeviceArray(){
+            cudaFree(devicePtr);
+        }
+
+        template <typename V, typename... Opts>
+        nb::ndarray<V, Opts..., nb::device::cuda, nb::c_contig> view(){
+            return nb::ndarray<V, Opts..., nb::device::cuda, nb::c_contig>(
+                    devicePtr, arrayShape.size(), arrayShape.data(), nb::handle());
+        }
+
+        DeviceArray(const DeviceArray&) = delete;
+        DeviceArray &operator=(const DeviceArray&) = delete;
+
+    private:
+        std::vector<size_t> arrayShape;
+        void *devicePtr = nullptr;
+};
+
+#define CUDA_VIEW(arr, V, ...) (arr).template view<V, nb::shape<__VA_ARGS__>>()
+
+
+// Runs op once per benchmark iteration and records the time until the
+// device finishes it as the iteration time.
+template <typename Op>
+static void runTimed(benchmark::State &state, Op op){
+    cudaEvent_t start, stop;
+    cudaEventCreate(&start);
+    cudaEventCreate(&stop);
+    // One untimed call so that workspace allocation is not included.
+    op();
+    cudaDeviceSynchronize();
+
+    for (auto _ : state){
+        cudaEventRecord(start, 0);
+        op();
+        cudaEventRecord(stop, 0);
+        cudaEventSynchronize(stop);
+        float elapsedMs;
+        cudaEventElapsedTime(&elapsedMs, start, stop);
+        state.SetIterationTime(elapsedMs / 1000.0);
+    }
+    cudaEventDestroy(start);
+    cudaEventDestroy(stop);
+}
+
+
+
+
+// Transforms BENCH_TRANSFORM_ELEMENTS elements arranged as (N, dim)
+// rows. Args: dim.
+template <typename T>
+static void BM_CudaTransformRows(benchmark::State &state){
+    int dim = state.range(0);
+    size_t numRows = std::max(1, BENCH_TRANSFORM_ELEMENTS / dim);
+    std::mt19937_64 rng(BENCH_RANDOM_SEED);
+    BenchArray<T> xArr({numRows, static_cast<size_t>(dim)});
+    xArr.fillUniform(rng, -1.0, 1.0);
+    DeviceArray<T> xDevice(xArr);
+    auto xView = CUDA_VIEW(xDevice, T, -1, -1);
+
+    runTimed(state, [&]{ cudaHTransform<T>(xView, 0); });
+    state.SetItemsProcessed(state.iterations() * numRows);
+    state.SetBytesProcessed(state.iterations() * xArr.size() * sizeof(T));
+}
+
+BENCHMARK_TEMPLATE(BM_CudaTransformRows, float)->ArgName("dim")
+    ->RangeMultiplier(8)->Range(128, 1 << 15)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_CudaTransformRows, double)->ArgName("dim")
+    ->RangeMultiplier(8)->Range(128, 1 << 15)->UseManualTime();
+
+
+
+
+// RBF feature generation for BENCH_NUM_ROWS rows of 64 features.
+// Args: numFreqs.
+template <typename T>
+static void BM_CudaRBFFeatureGen(benchmark::State &state){
+    int numFreqs = state.range(0);
+    size_t numRows = BENCH_NUM_ROWS, numFeatures = 64;
+    std::mt19937_64 rng(BENCH_RANDOM_SEED);
+
+    BenchArray<T> xArr({numRows, numFeatures}), chiArr({static_cast<size_t>(numFreqs)});
+    BenchArray<double> outputArr({numRows, 2 * static_cast<size_t>(numFreqs)});
+    BenchArray<int8_t> radem(rademShape(numFreqs, paddedSize(numFeatures)));
+    xArr.fillUniform(rng, -1.0, 1.0);
+    fillRademChi(radem, chiArr, rng);
+
+    DeviceArray<T> xDevice(xArr), chiDevice(chiArr);
+    DeviceArray<double> outputDevice(outputArr);
+    DeviceArray<int8_t> rademDevice(radem);
+    auto xView = CUDA_VIEW(xDevice, const T, -1, -1);
+    auto outputView = CUDA_VIEW(outputDevice, double, -1, -1);
+    auto rademView = CUDA_VIEW(rademDevice, const int8_t, 3, 1, -1);
+    auto chiView = CUDA_VIEW(chiDevice, const T, -1);
+
+    runTimed(state, [&]{
+        RBFFeatureGen<T, double>(xView, outputView, rademView, chiView, true, 0);
+    });
+    state.SetItemsProcessed(state.iterations() * numRows);
+}
+
+// As BM_CudaRBFFeatureGen, but also generating the gradient.
+template <typename T>
+static void BM_CudaRBFGrad(benchmark::State &state){
+    int numFreqs = state.range(0);
+    size_t numRows = BENCH_NUM_ROWS, numFeatures = 64;
+    std::mt19937_64 rng(BENCH_RANDOM_SEED);
+
+    BenchArray<T> xArr({numRows, numFeatures}), chiArr({static_cast<size_t>(numFreqs)});
+    BenchArray<double> outputArr({numRows, 2 * static_cast<size_t>(numFreqs)});
+    BenchArray<double> gradArr({numRows, 2 * static_cast<size_t>(numFreqs), 1});
+    BenchArray<int8_t> radem(rademShape(numFreqs, paddedSize(numFeatures)));
+    xArr.fillUniform(rng, -1.0, 1.0);
+    fillRademChi(radem, chiArr, rng);
+
+    DeviceArray<T> xDevice(xArr), chiDevice(chiArr);
+    DeviceArray<double> outputDevice(outputArr), gradDevice(gradArr);
+    DeviceArray<int8_t> rademDevice(radem);
+    auto xView = CUDA_VIEW(xDevice, const T, -1, -1);
+    auto outputView = CUDA_VIEW(outputDevice, double, -1, -1);
+    auto gradView = CUDA_VIEW(gradDevice, double, -1, -1, 1);
+    auto rademView = CUDA_VIEW(rademDevice, const int8_t, 3, 1, -1);
+    auto chiView = CUDA_VIEW(chiDevice, const T, -1);
+
+    runTimed(state, [&]{
+        RBFFeatureGrad<T, double>(xView, outputView, gradView, rademView,
+                chiView, 1.0f, true, 0);
+    });
+    state.SetItemsProcessed(state.iterations() * numRows);
+}
+
+BENCHMARK_TEMPLATE(BM_CudaRBFFeatureGen, float)->ArgName("numFreqs")
+    ->Arg(1024)->Arg(8192)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_CudaRBFFeatureGen, double)->ArgName("numFreqs")
+    ->Arg(1024)->Arg(8192)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_CudaRBFGrad, float)->ArgName("numFreqs")
+    ->Arg(1024)->Arg(8192)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_CudaRBFGrad, double)->ArgName("numFreqs")
+    ->Arg(1024)->Arg(8192)->UseManualTime();
+
+
+
+
+// MiniARD gradient for BENCH_NUM_ROWS / 4 rows of 64 features split across
+// 8 lengthscales, as in the CPU benchmark. Args: numFreqs.
+template <typename T>
+static void BM_CudaARDGrad(benchmark::State &state){
+    int numFreqs = state.range(0);
+    size_t numRows = BENCH_NUM_ROWS / 4, numFeatures = 64, numLengthscales = 8;
+    std::mt19937_64 rng(BENCH_RANDOM_SEED);
+
+    BenchArray<T> xArr({numRows, numFeatures});
+    BenchArray<T> precompWeights({static_cast<size_t>(numFreqs), numFeatures});
+    BenchArray<int32_t> sigmaMap({numFeatures});
+    BenchArray<double> sigmaVals({numFeatures});
+    BenchArray<double> outputArr({numRows, 2 * static_cast<size_t>(numFreqs)});
+    BenchArray<double> gradArr({numRows, 2 * static_cast<size_t>(numFreqs),
+            numLengthscales});
+    xArr.fillUniform(rng, -1.0, 1.0);
+    precompWeights.fillUniform(rng, -1.0, 1.0);
+    sigmaVals.fillUniform(rng, 0.5, 2.0);
+    for (size_t k=0; k < numFeatures; k++)
+        sigmaMap.data()[k] = k % numLengthscales;
+
+    DeviceArray<T> xDevice(xArr), weightDevice(precompWeights);
+    DeviceArray<int32_t> sigmaMapDevice(sigmaMap);
+    DeviceArray<double> sigmaValDevice(sigmaVals), outputDevice(outputArr),
+        gradDevice(gradArr);
+    auto xView = CUDA_VIEW(xDevice, T, -1, -1);
+    auto weightView = CUDA_VIEW(weightDevice, T, -1, -1);
+    auto sigmaMapView = CUDA_VIEW(sigmaMapDevice, int32_t, -1);
+    auto sigmaValView = CUDA_VIEW(sigmaValDevice, double, -1);
+    auto outputView = CUDA_VIEW(outputDevice, double, -1, -1);
+    auto gradView = CUDA_VIEW(gradDevice, double, -1, -1, -1);
+
+    runTimed(state, [&]{
+        ardCudaGrad<T>(xView, outputView, weightView, sigmaMapView,
+                sigmaValView, gradView, true, 0);
+    });
+    state.SetItemsProcessed(state.iterations() * numRows);
+}
+
+BENCHMARK_TEMPLATE(BM_CudaARDGrad, float)->ArgName("numFreqs")
+    ->Arg(512)->Arg(2048)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_CudaARDGrad, double)->ArgName("numFreqs")
+    ->Arg(512)->Arg(2048)->UseManualTime();
+
+
+
+
+// The inputs shared by the conv benchmarks, built once per benchmark on
+// the host and copied to the device. The sequence lengths stay on the
+// host, as the wrappers expect.
+template <typename T>
+struct CudaConvBenchInputs {
+    BenchArray<T> xArr, chiArr;
+    BenchArray<int8_t> radem;
+    BenchArray<int32_t> seqlengths;
+    int64_t numKmers = 0;
+
+    CudaConvBenchInputs(int convWidth, int distribution) :
+        xArr({BENCH_CONV_ROWS, BENCH_CONV_MAXLEN, BENCH_CONV_FEATURES}),
+        chiArr({BENCH_CONV_FREQS}),
+        radem(rademShape(BENCH_CONV_FREQS, paddedSize(convWidth * BENCH_CONV_FEATURES))),
+        seqlengths({BENCH_CONV_ROWS}) {
+        std::mt19937_64 rng(BENCH_RANDOM_SEED);
+        xArr.fillUniform(rng, -1.0, 1.0);
+        fillRademChi(radem, chiArr, rng);
+        fillSeqlengths(seqlengths, distribution, convWidth, rng);
+        for (size_t i=0; i < seqlengths.size(); i++)
+            numKmers += seqlengths.data()[i] - convWidth + 1;
+    }
+};
+
+
+// Conv RBF feature generation. Args: convWidth, seqlength distribution
+// (see fillSeqlengths). Reports kmers per second.
+template <typename T>
+static void BM_CudaConvRBFFeatureGen(benchmark::State &state){
+    int convWidth = state.range(0);
+    CudaConvBenchInputs<T> inputs(convWidth, state.range(1));
+    BenchArray<double> outputArr({BENCH_CONV_ROWS, 2 * BENCH_CONV_FREQS});
+
+    DeviceArray<T> xDevice(inputs.xArr), chiDevice(inputs.chiArr);
+    DeviceArray<int8_t> rademDevice(inputs.radem);
+    DeviceArray<double> outputDevice(outputArr);
+    auto xView = CUDA_VIEW(xDevice, T, -1, -1, -1);
+    auto outputView = CUDA_VIEW(outputDevice, double, -1, -1);
+    auto rademView = CUDA_VIEW(rademDevice, int8_t, 3, 1, -1);
+    auto chiView = CUDA_VIEW(chiDevice, T, -1);
+    auto seqlenView = CPU_VIEW(inputs.seqlengths, -1);
+
+    runTimed(state, [&]{
+        convRBFFeatureGen<T, double>(xView, outputView, rademView, chiView,
+                seqlenView, convWidth, 0, 0);
+    });
+    state.SetItemsProcessed(state.iterations() * inputs.numKmers);
+}
+
+// As BM_CudaConvRBFFeatureGen, but also generating the gradient.
+template <typename T>
+static void BM_CudaConvRBFGrad(benchmark::State &state){
+    int convWidth = state.range(0);
+    CudaConvBenchInputs<T> inputs(convWidth, state.range(1));
+    BenchArray<double> outputArr({BENCH_CONV_ROWS, 2 * BENCH_CONV_FREQS});
+    BenchArray<double> gradArr({BENCH_CONV_ROWS, 2 * BENCH_CONV_FREQS, 1});
+
+    DeviceArray<T> xDevice(inputs.xArr), chiDevice(inputs.chiArr);
+    DeviceArray<int8_t> rademDevice(inputs.radem);
+    DeviceArray<double> outputDevice(outputArr), gradDevice(gradArr);
+    auto xView = CUDA_VIEW(xDevice, T, -1, -1, -1);
+    auto outputView = CUDA_VIEW(outputDevice, double, -1, -1);
+    auto gradView = CUDA_VIEW(gradDevice, double, -1, -1, 1);
+    auto rademView = CUDA_VIEW(rademDevice, int8_t, 3, 1, -1);
+    auto chiView = CUDA_VIEW(chiDevice, T, -1);
+    auto seqlenView = CPU_VIEW(inputs.seqlengths, -1);
+
+    runTimed(state, [&]{
+        convRBFFeatureGrad<T, double>(xView, outputView, rademView, chiView,
+                seqlenView, gradView, 1.0, convWidth, 0, 0);
+    });
+    state.SetItemsProcessed(state.iterations() * inputs.numKmers);
+}
+
+// Maxpool conv features.
+template <typename T>
+static void BM_CudaConvMaxpool(benchmark::State &state){
+    int convWidth = state.range(0);
+    CudaConvBenchInputs<T> inputs(convWidth, state.range(1));
+    BenchArray<float> outputArr({BENCH_CONV_ROWS, BENCH_CONV_FREQS});
+
+    DeviceArray<T> xDevice(inputs.xArr), chiDevice(inputs.chiArr);
+    DeviceArray<int8_t> rademDevice(inputs.radem);
+    DeviceArray<float> outputDevice(outputArr);
+    auto xView = CUDA_VIEW(xDevice, T, -1, -1, -1);
+    auto outputView = CUDA_VIEW(outputDevice, float, -1, -1);
+    auto rademView = CUDA_VIEW(rademDevice, int8_t, 3, 1, -1);
+    auto chiView = CUDA_VIEW(chiDevice, T, -1);
+    auto seqlenView = CPU_VIEW(inputs.seqlengths, -1);
+
+    runTimed(state, [&]{
+        conv1dMaxpoolFeatureGen<T>(xView, outputView, rademView, chiView,
+                seqlenView, convWidth, 0);
+    });
+    state.SetItemsProcessed(state.iterations() * inputs.numKmers);
+}
+
+static void cudaConvArgs(benchmark::internal::Benchmark *bench){
+    bench->ArgNames({"convWidth", "seqlenDist"});
+    bench->ArgsProduct({{3, 9}, {0, 1, 2}});
+}
+
+BENCHMARK_TEMPLATE(BM_CudaConvRBFFeatureGen, float)->Apply(cudaConvArgs)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_CudaConvRBFFeatureGen, double)->Apply(cudaConvArgs)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_CudaConvRBFGrad, float)->Apply(cudaConvArgs)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_CudaConvRBFGrad, double)->Apply(cudaConvArgs)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_CudaConvMaxpool, float)->Apply(cudaConvArgs)->UseManualTime();
+BENCHMARK_TEMPLATE(BM_CudaConvMaxpool, double)->Apply(cudaConvArgs)->UseManualTime();
@@ -0,0 +1,32 @@
+/*!
+ * # bench_main.cpp
+ *
+ * Entry point shared by xgpr_bench and xgpr_cuda_bench. The routines under test take nanobind
+ * ndarrays, whose reference counting needs an initialized interpreter,
+ * so one is started (but never used) for the lifetime of the run. All
+ * of the usual Google Benchmark flags are accepted, e.g.
+ *
+ *   xgpr_bench --benchmark_out=results.json --benchmark_out_format=json
+ *   xgpr_bench --benchmark_filter='BM_ConvRBF.*'
+ *
+ * Results from two runs can be compared with the compare.py tool that
+ * ships with Google Benchmark.
+ */
+#include <Python.h>
+#include "bench_arrays.h"
+
+
+int main(int argc, char **argv){
+    Py_InitializeEx(0);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    addBenchContext();
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    releaseBenchResources();
+    Py_FinalizeEx();
+    return 0;
+}
@@ -2,6 +2,8 @@
 #Otherwise, do not change.
 __version__ = "0.4.6"
 
+import atexit
+
 #Key imports.
 from .xgp_regression import xGPRegression
 from .data_handling.dataset_builder import build_regression_dataset
@@ -10,3 +12,8 @@ from .data_handling.dataset_builder import build_classification_dataset
 from .kernel_fgen import KernelFGen
 
 from .static_layers import FastConv1d
+
+#The CPU extension keeps a pool of worker threads alive between calls;
+#join them before the interpreter shuts down.
+from .xgpr_cpu_rfgen_cpp_ext import cpuShutdownThreadPool
+atexit.register(cpuShutdownThreadPool)
@@ -37,8 +37,7 @@ class GPU_ConjugateGrad:
         """
         matvec[:] = 0
         for x, lengths in dataset.get_chunked_x_data():
-            Z = kernel.transform_x(x, lengths)
-            matvec += Z.T @ (Z @ vec)
+            kernel.accumulate_matvec(x, vec, matvec, lengths)
         matvec += kernel.get_lambda()**2 * vec
 
 
@@ -168,8 +167,7 @@ class CPU_ConjugateGrad:
         """
         matvec[:] = 0
         for x, lengths in dataset.get_chunked_x_data():
-            Z = kernel.transform_x(x, lengths)
-            matvec += Z.T @ (Z @ vec)
+            kernel.accumulate_matvec(x, vec, matvec, lengths)
         matvec += kernel.get_lambda()**2 * vec
 
 
@@ -12,6 +12,7 @@ import copy
 import numpy as np
 
 from .data_handling_baseclass import DatasetBaseclass
+from ..xgpr_cpu_rfgen_cpp_ext import cpuNpyChunkReader
 
 
 
@@ -28,6 +29,8 @@ class OfflineDataset(DatasetBaseclass):
         _sequence_lengths: Either None or a list of absolute filepaths
             to the locations of each .npy file containing the length
             of the sequence / graph for the corresponding datapoint.
+        _prefetch_depth (int): The number of chunks to read ahead of
+            the one currently in use when iterating over the dataset.
     """
     def __init__(self, xfiles,
                        yfiles,
@@ -36,7 +39,8 @@ class OfflineDataset(DatasetBaseclass):
                        trainy_mean = 0.,
                        trainy_std = 1.,
                        max_class = 1,
-                       chunk_size = 2000):
+                       chunk_size = 2000,
+                       prefetch_depth = 2):
         """The class constructor for an OfflineDataset.
 
         Args:
@@ -60,6 +64,9 @@ class OfflineDataset(DatasetBaseclass):
             device (str): The current device.
             chunk_size (int): The largest allowed file size (in # datapoints)
                 for this dataset. Should be checked and enforced by caller.
+            prefetch_depth (int): The number of chunks to read ahead of
+                the one currently in use when iterating over the dataset,
+                so that disk reads overlap with computation.
         """
         super().__init__(xdim, chunk_size, trainy_mean,
                 trainy_std, max_class)
@@ -69,6 +76,22 @@ class OfflineDataset(DatasetBaseclass):
             self._sequence_lengths = [os.path.abspath(f) for f in sequence_lengths]
         else:
             self._sequence_lengths = None
+        self._prefetch_depth = max(int(prefetch_depth), 1)
+
+
+    def _read_chunks(self, chunk_files):
+        """A generator that returns the arrays stored in each group
+        of files in chunk_files in order. The files are memory-mapped
+        and prefetched on a background thread; any chunk the reader
+        cannot handle (e.g. a Fortran-ordered or object array) is
+        loaded with np.load instead."""
+        reader = iter(cpuNpyChunkReader(chunk_files, self._prefetch_depth))
+        for files in chunk_files:
+            try:
+                arrays = next(reader)
+            except RuntimeError:
+                arrays = [np.load(f) for f in files]
+            yield arrays
 
 
     def get_chunked_data(self):
@@ -76,20 +99,18 @@ class OfflineDataset(DatasetBaseclass):
         file in the data list in order with paired x and y
         data."""
         if self._sequence_lengths is None:
-            for xfile, yfile in zip(self._xfiles, self._yfiles):
-                xchunk = np.load(xfile)
-                ychunk = np.load(yfile).astype(np.float64)
-                ychunk -= self._trainy_mean
-                ychunk /= self._trainy_std
-                yield xchunk, ychunk, None
+            chunk_files = [[xfile, yfile] for xfile, yfile in
+                    zip(self._xfiles, self._yfiles)]
         else:
-            for xfile, yfile, lfile in zip(self._xfiles, self._yfiles,
-                    self._sequence_lengths):
-                xchunk, lchunk = np.load(xfile), np.load(lfile)
-                ychunk = np.load(yfile).astype(np.float64)
-                ychunk -= self._trainy_mean
-                ychunk /= self._trainy_std
-                yield xchunk, ychunk, lchunk
+            chunk_files = [[xfile, yfile, lfile] for xfile, yfile, lfile in
+                    zip(self._xfiles, self._yfiles, self._sequence_lengths)]
+
+        for arrays in self._read_chunks(chunk_files):
+            ychunk = arrays[1].astype(np.float64)
+            ychunk -= self._trainy_mean
+            ychunk /= self._trainy_std
+            lchunk = arrays[2] if self._sequence_lengths is not None else None
+            yield arrays[0], ychunk, lchunk
 
 
 
@@ -98,11 +119,14 @@ class OfflineDataset(DatasetBaseclass):
         file in the data list in order, retrieving x data
         and sequence length only."""
         if self._sequence_lengths is None:
-            for xfile in self._xfiles:
-                yield np.load(xfile), None
+            chunk_files = [[xfile] for xfile in self._xfiles]
         else:
-            for xfile, lfile in zip(self._xfiles, self._sequence_lengths):
-                yield np.load(xfile), np.load(lfile)
+            chunk_files = [[xfile, lfile] for xfile, lfile in
+                    zip(self._xfiles, self._sequence_lengths)]
+
+        for arrays in self._read_chunks(chunk_files):
+            lchunk = arrays[1] if self._sequence_lengths is not None else None
+            yield arrays[0], lchunk
 
 
     def get_yfiles(self):
@@ -7,10 +7,13 @@ import numpy as np
 from scipy.stats import chi
 
 from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuFastHadamardTransform2D as dFHT2d
-from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFFeatureGen, cpuMiniARDGrad
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFFeatureGen, cpuMiniARDGrad, cpuMiniARDMultiGrad
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFDesignMatrix, cpuRBFMatvec
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFPredictMean, cpuRBFPredictMeanVar
 try:
     import cupy as cp
-    from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaRBFFeatureGen, cudaMiniARDGrad
+    from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaRBFFeatureGen, cudaMiniARDGrad, cudaMiniARDMultiGrad
+    from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaRBFDesignMatrix, cudaRBFMatvec
 except:
     pass
 from ..kernel_baseclass import KernelBaseclass
@@ -193,20 +196,115 @@ class MiniARD(KernelBaseclass):
         xtrans = input_x * self.full_ard_weights[None,:]
 
         if self.device == "cpu":
-            output_x = np.zeros((input_x.shape[0], self.num_rffs), np.float64)
+            output_x = self._cpu_output_array((input_x.shape[0], self.num_rffs))
             if not self.double_precision:
                 xtrans = xtrans.astype(np.float32)
             cpuRBFFeatureGen(xtrans, output_x, self.radem_diag, self.chi_arr,
-                    self.num_threads, self.fit_intercept)
+                    self.num_threads, self.fit_intercept, self.sincos_precision)
         else:
             output_x = cp.zeros((input_x.shape[0], self.num_rffs), cp.float64)
             if not self.double_precision:
                 xtrans = xtrans.astype(cp.float32)
             cudaRBFFeatureGen(xtrans, output_x, self.radem_diag, self.chi_arr,
-                    self.fit_intercept)
+                    self.fit_intercept,
+                    stream = cp.cuda.get_current_stream().ptr)
         return output_x
 
 
+    def kernel_specific_design_mat(self, input_x, input_y, z_trans_z,
+            z_trans_y, sequence_length = None):
+        """Adds Z^T Z and Z^T y for the input to z_trans_z and z_trans_y
+        without storing the random features Z.
+
+        Args:
+            input_x: Either a cupy or numpy array containing the input.
+            input_y: A cupy or numpy float64 array of y-values.
+            z_trans_z: A cupy or numpy (num_rffs, num_rffs) array.
+            z_trans_y: A cupy or numpy (num_rffs) array.
+            sequence_length: Accepted for consistency with baseclass
+                but not used by this kernel and thus ignored.
+        """
+        xtrans = input_x * self.full_ard_weights[None,:]
+
+        if self.device == "cpu":
+            if not self.double_precision:
+                xtrans = xtrans.astype(np.float32)
+            cpuRBFDesignMatrix(xtrans, input_y, z_trans_z, z_trans_y,
+                    self.radem_diag, self.chi_arr, self.num_threads,
+                    self.fit_intercept, self.sincos_precision)
+        else:
+            if not self.double_precision:
+                xtrans = xtrans.astype(cp.float32)
+            cudaRBFDesignMatrix(xtrans, input_y, z_trans_z, z_trans_y,
+                    self.radem_diag, self.chi_arr, self.fit_intercept,
+                    stream = cp.cuda.get_current_stream().ptr)
+
+
+    def kernel_specific_matvec(self, input_x, input_vec, output,
+            sequence_length = None):
+        """Adds Z^T (Z V) for the input to output without storing
+        the random features Z.
+
+        Args:
+            input_x: Either a cupy or numpy array containing the input.
+            input_vec: A cupy or numpy float64 (num_rffs, k) array V.
+            output: A cupy or numpy float64 (num_rffs, k) array.
+            sequence_length: Accepted for consistency with baseclass
+                but not used by this kernel and thus ignored.
+        """
+        xtrans = input_x * self.full_ard_weights[None,:]
+
+        if self.device == "cpu":
+            if not self.double_precision:
+                xtrans = xtrans.astype(np.float32)
+            cpuRBFMatvec(xtrans, input_vec, output, self.radem_diag,
+                    self.chi_arr, self.num_threads, self.fit_intercept,
+                    self.sincos_precision)
+        else:
+            if not self.double_precision:
+                xtrans = xtrans.astype(cp.float32)
+            cudaRBFMatvec(xtrans, input_vec, output, self.radem_diag,
+                    self.chi_arr, self.fit_intercept,
+                    stream = cp.cuda.get_current_stream().ptr)
+
+
+    def kernel_specific_predict(self, input_x, weights, var,
+            sequence_length = None):
+        """Calculates Z w and (if var is not None) the diagonal of
+        Z_v V Z_v^T for the input without storing the random features
+        Z. On GPU this uses the baseclass implementation.
+
+        Args:
+            input_x: Either a cupy or numpy array containing the input.
+            weights: A cupy or numpy float64 (num_rffs) array.
+            var: None or a cupy or numpy float64 (K, K) array.
+            sequence_length: Accepted for consistency with baseclass
+                but not used by this kernel and thus ignored.
+
+        Returns:
+            mean: A cupy or numpy (N) array.
+            var_prod: None or a cupy or numpy (N) array.
+        """
+        if self.device != "cpu":
+            return super().kernel_specific_predict(input_x, weights, var,
+                    sequence_length)
+        xtrans = input_x * self.full_ard_weights[None,:]
+        if not self.double_precision:
+            xtrans = xtrans.astype(np.float32)
+
+        mean = np.zeros((xtrans.shape[0]), np.float64)
+        if var is None:
+            cpuRBFPredictMean(xtrans, weights, mean, self.radem_diag,
+                    self.chi_arr, self.num_threads, self.fit_intercept,
+                    self.sincos_precision)
+            return mean, None
+        var_prod = np.zeros((xtrans.shape[0]), np.float64)
+        cpuRBFPredictMeanVar(xtrans, weights, var, mean, var_prod,
+                self.radem_diag, self.chi_arr, self.num_threads,
+                self.fit_intercept, self.sincos_precision)
+        return mean, var_prod
+
+
     def precompute_weights(self):
         """The kernel does not automatically generate precomputed weights,
         because for generating features during fitting or prediction,
@@ -280,9 +378,9 @@ class MiniARD(KernelBaseclass):
         max_map_position = int(self.ard_position_key.max())
 
         if self.device == "cpu":
-            xtrans = np.zeros((input_x.shape[0], self.num_rffs), np.float64)
-            dz_dsigma = np.zeros((input_x.shape[0], self.num_rffs,
-                max_map_position + 1), np.float64)
+            xtrans = self._cpu_output_array((input_x.shape[0], self.num_rffs))
+            dz_dsigma = self._cpu_output_array((input_x.shape[0], self.num_rffs,
+                max_map_position + 1))
             cpuMiniARDGrad(input_x, xtrans, self.precomputed_weights,
                 self.ard_position_key, self.full_ard_weights,
                 dz_dsigma, self.num_threads, self.fit_intercept)
@@ -292,6 +390,64 @@ class MiniARD(KernelBaseclass):
                 max_map_position + 1), cp.float64)
             cudaMiniARDGrad(input_x, xtrans, self.precomputed_weights,
                 self.ard_position_key, self.full_ard_weights,
-                dz_dsigma, self.fit_intercept)
+                dz_dsigma, self.fit_intercept,
+                stream = cp.cuda.get_current_stream().ptr)
+
+        return xtrans, dz_dsigma
 
+
+    def gradient_candidates(self, input_x, lengthscale_sets):
+        """Generates random features and the gradient w/r/t the
+        lengthscales for several candidate sets of lengthscales in a
+        single pass over the input. The product of each datapoint with
+        the precomputed weights does not depend on the lengthscales, so
+        it is calculated once and reused for every candidate.
+
+        Args:
+            input_x: A cupy or numpy array containing the raw input data.
+            lengthscale_sets: An (S, L) array of S candidate sets of the
+                L kernel-specific hyperparameters (not log-transformed).
+
+        Returns:
+            xtrans: A cupy or numpy (S, N, num_rffs) array containing the
+                generated features.
+            dz_dsigma: A cupy or numpy (S, N, num_rffs, L) array containing
+                the derivative of xtrans with respect to the lengthscales.
+
+        Raises:
+            ValueError: A ValueError is raised if lengthscale_sets is not
+                of the expected shape.
+        """
+        if self.precomputed_weights is None:
+            self.precompute_weights()
+        num_lengthscales = self.split_pts.shape[0] - 1
+        lengthscales = np.ascontiguousarray(lengthscale_sets, dtype=np.float64)
+        if lengthscales.ndim == 1:
+            lengthscales = lengthscales.reshape(1, -1)
+        if lengthscales.ndim != 2 or lengthscales.shape[0] == 0 or \
+                lengthscales.shape[1] != num_lengthscales:
+            raise ValueError("lengthscale_sets must be an (S, L) array, where L "
+                    "is the number of kernel-specific hyperparameters.")
+        xtype = np.float64 if self.double_precision else np.float32
+
+        if self.device == "cpu":
+            xin = np.ascontiguousarray(input_x, xtype)
+            out_shape = (lengthscales.shape[0], xin.shape[0], self.num_rffs)
+            xtrans = np.zeros(out_shape, np.float64)
+            dz_dsigma = np.zeros(out_shape + (num_lengthscales,), np.float64)
+            cpuMiniARDMultiGrad(xin, xtrans, self.precomputed_weights,
+                self.ard_position_key, lengthscales, dz_dsigma,
+                self.num_threads, self.fit_intercept)
+        else:
+            xin = cp.ascontiguousarray(cp.asarray(input_x), xtype)
+            out_shape = (lengthscales.shape[0], xin.shape[0], self.num_rffs)
+            xtrans = cp.zeros(out_shape, cp.float64)
+            dz_dsigma = cp.zeros(out_shape + (num_lengthscales,), cp.float64)
+            cudaMiniARDMultiGrad(xin, xtrans, self.precomputed_weights,
+                self.ard_position_key, cp.asarray(lengthscales), dz_dsigma,
+                self.fit_intercept, stream = cp.cuda.get_current_stream().ptr)
+
+        if self.fit_intercept:
+            xtrans[:,:,0] = 1.
+            dz_dsigma[:,:,0,:] = 0.
         return xtrans, dz_dsigma
@@ -80,7 +80,9 @@ class Linear(KernelBaseclass):
                 xtrans = np.zeros((input_x.shape[0], input_x.shape[1] + 1), np.float64)
             xtrans[:,1:] = input_x
             return xtrans
-        return input_x
+        # The input may be the caller's array (see the baseclass
+        # _prepare_input), so return a copy rather than the input itself.
+        return input_x.copy()
 
 
     def kernel_specific_gradient(self, input_x, sequence_length = None):
@@ -158,21 +158,20 @@ class RBFLinear(KernelBaseclass, ABC):
         Returns:
             xtrans: A cupy or numpy array containing the generated features.
         """
-        xcopy = input_x.copy()
-        input_x *= self.hyperparams[1]
+        scaled_x = self._scaled_input(input_x)
         if self.device == "cpu":
             output_x = np.zeros((input_x.shape[0], self.num_rffs), np.float64)
             rf_features = np.zeros((input_x.shape[0], self.internal_rffs), np.float64)
-            cpuRBFFeatureGen(input_x, rf_features, self.radem_diag, self.chi_arr,
-                self.num_threads, self.fit_intercept)
+            cpuRBFFeatureGen(scaled_x, rf_features, self.radem_diag, self.chi_arr,
+                self.num_threads, self.fit_intercept, self.sincos_precision)
         else:
             output_x = cp.zeros((input_x.shape[0], self.num_rffs), cp.float64)
             rf_features = cp.zeros((input_x.shape[0], self.internal_rffs), cp.float64)
-            cudaRBFFeatureGen(input_x, rf_features, self.radem_diag, self.chi_arr,
-                self.fit_intercept)
+            cudaRBFFeatureGen(scaled_x, rf_features, self.radem_diag, self.chi_arr,
+                self.fit_intercept, stream = cp.cuda.get_current_stream().ptr)
 
         output_x[:,:self.internal_rffs] = rf_features
-        output_x[:,self.internal_rffs:] = xcopy
+        output_x[:,self.internal_rffs:] = input_x
         return output_x
 
 
@@ -205,14 +204,16 @@ class RBFLinear(KernelBaseclass, ABC):
             rf_features = np.zeros((input_x.shape[0], self.internal_rffs), np.float64)
             rf_grad = np.zeros((input_x.shape[0], self.internal_rffs, 1), np.float64)
             cpuRBFGrad(input_x, rf_features, rf_grad, self.radem_diag, self.chi_arr,
-                self.hyperparams[1], self.num_threads, self.fit_intercept)
+                self.hyperparams[1], self.num_threads, self.fit_intercept,
+                self.sincos_precision)
         else:
             output_x = cp.zeros((input_x.shape[0], self.num_rffs), cp.float64)
             output_grad = cp.zeros((input_x.shape[0], self.num_rffs, 1), cp.float64)
             rf_features = cp.zeros((input_x.shape[0], self.internal_rffs), cp.float64)
             rf_grad = cp.zeros((input_x.shape[0], self.internal_rffs, 1), cp.float64)
             cudaRBFGrad(input_x, rf_features, rf_grad, self.radem_diag, self.chi_arr,
-                self.hyperparams[1], self.fit_intercept)
+                self.hyperparams[1], self.fit_intercept,
+                stream = cp.cuda.get_current_stream().ptr)
 
 
         output_x[:,:self.internal_rffs] = rf_features
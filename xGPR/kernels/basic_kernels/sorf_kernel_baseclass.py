@@ -10,9 +10,16 @@ import numpy as np
 from scipy.stats import chi
 
 from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFFeatureGen, cpuRBFGrad
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFDesignMatrix, cpuRBFMatvec
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFProjection, cpuRBFProjectionFGen
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFProjectionGrad, cpuRBFMultiSigmaGrad
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFPredictMean, cpuRBFPredictMeanVar
 try:
     import cupy as cp
     from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaRBFFeatureGen, cudaRBFGrad
+    from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaRBFDesignMatrix, cudaRBFMatvec
+    from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaRBFProjection, cudaRBFProjectionFGen
+    from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaRBFProjectionGrad, cudaRBFMultiSigmaGrad
 except:
     pass
 
@@ -117,18 +124,102 @@ class SORFKernelBaseclass(KernelBaseclass, ABC):
         Returns:
             xtrans: A cupy or numpy array containing the generated features.
         """
-        input_x *= self.hyperparams[1]
+        input_x = self._scaled_input(input_x)
         if self.device == "cpu":
-            output_x = np.zeros((input_x.shape[0], self.num_rffs), np.float64)
+            output_x = self._cpu_output_array((input_x.shape[0], self.num_rffs))
             cpuRBFFeatureGen(input_x, output_x, self.radem_diag, self.chi_arr,
-                self.num_threads, self.fit_intercept)
+                self.num_threads, self.fit_intercept, self.sincos_precision)
         else:
             output_x = cp.zeros((input_x.shape[0], self.num_rffs), cp.float64)
             cudaRBFFeatureGen(input_x, output_x, self.radem_diag, self.chi_arr,
-                self.fit_intercept)
+                self.fit_intercept, stream = cp.cuda.get_current_stream().ptr)
         return output_x
 
 
+    def kernel_specific_design_mat(self, input_x, input_y, z_trans_z,
+            z_trans_y, sequence_length = None):
+        """Adds Z^T Z and Z^T y for the input to z_trans_z and z_trans_y
+        without storing the random features Z.
+
+        Args:
+            input_x: Either a cupy or numpy array containing the input.
+            input_y: A cupy or numpy float64 array of y-values.
+            z_trans_z: A cupy or numpy (num_rffs, num_rffs) array.
+            z_trans_y: A cupy or numpy (num_rffs) array.
+            sequence_length: Accepted for consistency with baseclass and
+                kernels that use this argument but is not used by this
+                class of kernels and is therefore ignored.
+        """
+        input_x = self._scaled_input(input_x)
+        if self.device == "cpu":
+            cpuRBFDesignMatrix(input_x, input_y, z_trans_z, z_trans_y,
+                self.radem_diag, self.chi_arr, self.num_threads,
+                self.fit_intercept, self.sincos_precision)
+        else:
+            cudaRBFDesignMatrix(input_x, input_y, z_trans_z, z_trans_y,
+                self.radem_diag, self.chi_arr, self.fit_intercept,
+                stream = cp.cuda.get_current_stream().ptr)
+
+
+    def kernel_specific_matvec(self, input_x, input_vec, output,
+            sequence_length = None):
+        """Adds Z^T (Z V) for the input to output without storing
+        the random features Z.
+
+        Args:
+            input_x: Either a cupy or numpy array containing the input.
+            input_vec: A cupy or numpy float64 (num_rffs, k) array V.
+            output: A cupy or numpy float64 (num_rffs, k) array.
+            sequence_length: Accepted for consistency with baseclass and
+                kernels that use this argument but is not used by this
+                class of kernels and is therefore ignored.
+        """
+        input_x = self._scaled_input(input_x)
+        if self.device == "cpu":
+            cpuRBFMatvec(input_x, input_vec, output, self.radem_diag,
+                self.chi_arr, self.num_threads, self.fit_intercept,
+                self.sincos_precision)
+        else:
+            cudaRBFMatvec(input_x, input_vec, output, self.radem_diag,
+                self.chi_arr, self.fit_intercept,
+                stream = cp.cuda.get_current_stream().ptr)
+
+
+    def kernel_specific_predict(self, input_x, weights, var,
+            sequence_length = None):
+        """Calculates Z w and (if var is not None) the diagonal of
+        Z_v V Z_v^T for the input without storing the random features
+        Z. On GPU this uses the baseclass implementation.
+
+        Args:
+            input_x: Either a cupy or numpy array containing the input.
+            weights: A cupy or numpy float64 (num_rffs) array.
+            var: None or a cupy or numpy float64 (K, K) array.
+            sequence_length: Accepted for consistency with baseclass and
+                kernels that use this argument but is not used by this
+                class of kernels and is therefore ignored.
+
+        Returns:
+            mean: A cupy or numpy (N) array.
+            var_prod: None or a cupy or numpy (N) array.
+        """
+        if self.device != "cpu":
+            return super().kernel_specific_predict(input_x, weights, var,
+                    sequence_length)
+        input_x = self._scaled_input(input_x)
+        mean = np.zeros((input_x.shape[0]), np.float64)
+        if var is None:
+            cpuRBFPredictMean(input_x, weights, mean, self.radem_diag,
+                self.chi_arr, self.num_threads, self.fit_intercept,
+                self.sincos_precision)
+            return mean, None
+        var_prod = np.zeros((input_x.shape[0]), np.float64)
+        cpuRBFPredictMeanVar(input_x, weights, var, mean, var_prod,
+            self.radem_diag, self.chi_arr, self.num_threads,
+            self.fit_intercept, self.sincos_precision)
+        return mean, var_prod
+
+
     def kernel_specific_set_hyperparams(self):
         """Provided for consistency with baseclass. This
         kernel has no kernel-specific properties that must
@@ -153,13 +244,212 @@ class SORFKernelBaseclass(KernelBaseclass, ABC):
                 output_x with respect to the kernel-specific hyperparameters.
         """
         if self.device == "cpu":
-            output_x = np.zeros((input_x.shape[0], self.num_rffs), np.float64)
-            dz_dsigma = np.zeros((input_x.shape[0], self.num_rffs, 1), np.float64)
+            output_x = self._cpu_output_array((input_x.shape[0], self.num_rffs))
+            dz_dsigma = self._cpu_output_array((input_x.shape[0], self.num_rffs, 1))
             cpuRBFGrad(input_x, output_x, dz_dsigma, self.radem_diag, self.chi_arr,
-                self.hyperparams[1], self.num_threads, self.fit_intercept)
+                self.hyperparams[1], self.num_threads, self.fit_intercept,
+                self.sincos_precision)
         else:
             output_x = cp.zeros((input_x.shape[0], self.num_rffs), cp.float64)
             dz_dsigma = cp.zeros((input_x.shape[0], self.num_rffs, 1), cp.float64)
             cudaRBFGrad(input_x, output_x, dz_dsigma, self.radem_diag, self.chi_arr,
-                self.hyperparams[1], self.fit_intercept)
+                self.hyperparams[1], self.fit_intercept,
+                stream = cp.cuda.get_current_stream().ptr)
         return output_x, dz_dsigma
+
+
+
+    def get_sorf_projections(self, input_x, storage_dtype = None, out = None):
+        """Generates the pre-activation projections chi * SORF(x) for
+        the input. These do not depend on sigma, so when tuning they can
+        be generated once per chunk of data, stored, and then passed to
+        transform_projections or gradient_projections for each candidate
+        sigma so that only the sine and cosine are recalculated.
+
+        Args:
+            input_x: A cupy or numpy array containing the raw input data.
+            storage_dtype: The type in which the projections are stored.
+                One of np.float32, np.float64 (if double precision) or
+                np.float16 (GPU only). If None, the kernel precision
+                is used.
+            out: Either None or a C-contiguous (N, num_freqs) array of
+                type storage_dtype in which to store the projections,
+                e.g. an np.memmap to keep the projections for a large
+                dataset on disk. Must be on the current device.
+
+        Returns:
+            projections: A cupy or numpy (N, num_freqs) array.
+
+        Raises:
+            ValueError: A ValueError is raised if an invalid storage
+                type or output array is supplied.
+        """
+        xtype = np.float64 if self.double_precision else np.float32
+        if storage_dtype is None:
+            storage_dtype = xtype
+        storage_dtype = np.dtype(storage_dtype)
+        if storage_dtype not in (np.float16, np.float32, np.float64):
+            raise ValueError("storage_dtype must be one of float16, float32, float64.")
+        if storage_dtype == np.float64 and not self.double_precision:
+            raise ValueError("float64 projections require double precision.")
+        if storage_dtype == np.float16 and self.device != "cuda":
+            raise ValueError("float16 projections are only available on GPU.")
+
+        if self.device == "cuda":
+            xin = cp.ascontiguousarray(cp.asarray(input_x), xtype)
+            if out is None:
+                out = cp.empty((xin.shape[0], self.num_freqs), storage_dtype)
+        else:
+            xin = np.ascontiguousarray(input_x, xtype)
+            if out is None:
+                out = np.empty((xin.shape[0], self.num_freqs), storage_dtype)
+
+        if out.shape != (xin.shape[0], self.num_freqs) or out.dtype != storage_dtype \
+                or not out.flags["C_CONTIGUOUS"]:
+            raise ValueError("out must be a C-contiguous (N, num_freqs) array of "
+                    "type storage_dtype.")
+
+        if self.device == "cpu":
+            cpuRBFProjection(xin, out, self.radem_diag, self.chi_arr,
+                    self.num_threads)
+        else:
+            cudaRBFProjection(xin, out, self.radem_diag, self.chi_arr,
+                    stream = cp.cuda.get_current_stream().ptr)
+        return out
+
+
+    def _get_projection_sigmas(self, sigmas):
+        """Converts the sigma values for transform_projections /
+        gradient_projections to a float64 array on the current
+        device. If sigmas is None, the kernel's current sigma is used."""
+        if sigmas is None:
+            sigma_arr = np.asarray([self.hyperparams[1]], dtype=np.float64)
+        else:
+            sigma_arr = np.ascontiguousarray(sigmas, dtype=np.float64).reshape(-1)
+        if sigma_arr.shape[0] == 0:
+            raise ValueError("At least one sigma value must be supplied.")
+        if self.device == "cuda":
+            sigma_arr = cp.asarray(sigma_arr)
+        return sigma_arr
+
+
+    def transform_projections(self, projections, sigmas = None):
+        """Generates random features from projections stored using
+        get_sorf_projections for one or several sigma values in a
+        single pass over the projections.
+
+        Args:
+            projections: A cupy or numpy (N, num_freqs) array from
+                get_sorf_projections.
+            sigmas: Either None, in which case the current sigma
+                hyperparameter is used, or an array of S sigma values
+                (not log-transformed).
+
+        Returns:
+            xtrans: A cupy or numpy array containing the generated features.
+                If sigmas is None this is (N, num_rffs), otherwise it is
+                (S, N, num_rffs).
+        """
+        sigma_arr = self._get_projection_sigmas(sigmas)
+        out_shape = (sigma_arr.shape[0], projections.shape[0], self.num_rffs)
+
+        if self.device == "cpu":
+            xtrans = np.zeros(out_shape, np.float64)
+            cpuRBFProjectionFGen(projections, xtrans, sigma_arr,
+                self.num_threads, self.fit_intercept, self.sincos_precision)
+        else:
+            xtrans = cp.zeros(out_shape, cp.float64)
+            cudaRBFProjectionFGen(projections, xtrans, sigma_arr,
+                self.fit_intercept, stream = cp.cuda.get_current_stream().ptr)
+
+        if self.fit_intercept:
+            xtrans[:,:,0] = 1.
+        if sigmas is None:
+            return xtrans[0]
+        return xtrans
+
+
+    def gradient_projections(self, projections, sigmas = None):
+        """Generates random features and the gradient w/r/t sigma from
+        projections stored using get_sorf_projections for one or several
+        sigma values in a single pass over the projections.
+
+        Args:
+            projections: A cupy or numpy (N, num_freqs) array from
+                get_sorf_projections.
+            sigmas: Either None, in which case the current sigma
+                hyperparameter is used, or an array of S sigma values
+                (not log-transformed).
+
+        Returns:
+            xtrans: A cupy or numpy array containing the generated features.
+                If sigmas is None this is (N, num_rffs), otherwise it is
+                (S, N, num_rffs).
+            dz_dsigma: A cupy or numpy array containing the derivative of
+                xtrans with respect to sigma. If sigmas is None this is
+                (N, num_rffs, 1), otherwise it is (S, N, num_rffs, 1).
+        """
+        sigma_arr = self._get_projection_sigmas(sigmas)
+        out_shape = (sigma_arr.shape[0], projections.shape[0], self.num_rffs)
+
+        if self.device == "cpu":
+            xtrans = np.zeros(out_shape, np.float64)
+            dz_dsigma = np.zeros(out_shape + (1,), np.float64)
+            cpuRBFProjectionGrad(projections, xtrans, dz_dsigma, sigma_arr,
+                self.num_threads, self.fit_intercept, self.sincos_precision)
+        else:
+            xtrans = cp.zeros(out_shape, cp.float64)
+            dz_dsigma = cp.zeros(out_shape + (1,), cp.float64)
+            cudaRBFProjectionGrad(projections, xtrans, dz_dsigma, sigma_arr,
+                self.fit_intercept, stream = cp.cuda.get_current_stream().ptr)
+
+        if self.fit_intercept:
+            xtrans[:,:,0] = 1.
+            dz_dsigma[:,:,0,:] = 0.
+        if sigmas is None:
+            return xtrans[0], dz_dsigma[0]
+        return xtrans, dz_dsigma
+
+
+    def gradient_candidates(self, input_x, sigmas):
+        """Generates random features and the gradient w/r/t sigma for
+        several candidate sigma values in a single pass over the input.
+        Each datapoint is transformed once and all of the candidates are
+        applied to it, so this is cheaper than calling gradient_x once
+        per candidate, and unlike get_sorf_projections it does not need
+        to store the projections.
+
+        Args:
+            input_x: A cupy or numpy array containing the raw input data.
+            sigmas: An array of S sigma values (not log-transformed).
+
+        Returns:
+            xtrans: A cupy or numpy (S, N, num_rffs) array containing the
+                generated features.
+            dz_dsigma: A cupy or numpy (S, N, num_rffs, 1) array containing
+                the derivative of xtrans with respect to sigma.
+        """
+        sigma_arr = self._get_projection_sigmas(sigmas)
+        xtype = np.float64 if self.double_precision else np.float32
+
+        if self.device == "cpu":
+            xin = np.ascontiguousarray(input_x, xtype)
+            out_shape = (sigma_arr.shape[0], xin.shape[0], self.num_rffs)
+            xtrans = np.zeros(out_shape, np.float64)
+            dz_dsigma = np.zeros(out_shape + (1,), np.float64)
+            cpuRBFMultiSigmaGrad(xin, xtrans, dz_dsigma, self.radem_diag,
+                self.chi_arr, sigma_arr, self.num_threads, self.fit_intercept,
+                self.sincos_precision)
+        else:
+            xin = cp.ascontiguousarray(cp.asarray(input_x), xtype)
+            out_shape = (sigma_arr.shape[0], xin.shape[0], self.num_rffs)
+            xtrans = cp.zeros(out_shape, cp.float64)
+            dz_dsigma = cp.zeros(out_shape + (1,), cp.float64)
+            cudaRBFMultiSigmaGrad(xin, xtrans, dz_dsigma, self.radem_diag,
+                self.chi_arr, sigma_arr, self.fit_intercept,
+                stream = cp.cuda.get_current_stream().ptr)
+
+        if self.fit_intercept:
+            xtrans[:,:,0] = 1.
+            dz_dsigma[:,:,0,:] = 0.
+        return xtrans, dz_dsigma
@@ -34,10 +34,13 @@ class FHTMaxpoolConv1dFeatureExtractor():
             from S H D1 H D2 H D3 are correct.
         num_threads (int): Number of threads to use if running on CPU;
             ignored if running on GPU.
+        kmer_cache_size (int): The number of k-mers for which each CPU thread
+            keeps the SORF output, so that repeated k-mers are not
+            re-transformed. 0 (the default) disables the cache.
     """
 
     def __init__(self, seqwidth, num_rffs, random_seed = 123, device = "cpu",
-                    conv_width = 9, num_threads = 2):
+                    conv_width = 9, num_threads = 2, kmer_cache_size = 0):
         """Constructor for FHT_Conv1d.
 
         Args:
@@ -50,6 +53,8 @@ class FHTMaxpoolConv1dFeatureExtractor():
             conv_width (int): The width of the convolution kernel. Defaults to 9.
             num_threads (int): Number of threads to use if running on CPU;
                 ignored if running on GPU.
+            kmer_cache_size (int): The number of k-mers for which each CPU
+                thread caches the SORF output. Defaults to 0 (no cache).
 
         Raises:
             ValueError: A ValueError is raised if the dimensions of the input are
@@ -73,6 +78,7 @@ class FHTMaxpoolConv1dFeatureExtractor():
                             random_state = random_seed).astype(np.float32)
 
         self.num_threads = num_threads
+        self.kmer_cache_size = kmer_cache_size
         self.device = device
 
 
@@ -103,12 +109,14 @@ class FHTMaxpoolConv1dFeatureExtractor():
             output_x = np.zeros((input_x.shape[0], self.num_rffs), np.float32)
             x_in = np.ascontiguousarray(input_x.astype(np.float32, copy=False))
             cpuConv1dMaxpool(x_in, output_x, self.radem_diag, self.chi_arr,
-                    sequence_length, self.conv_width, self.num_threads)
+                    sequence_length, self.conv_width, self.num_threads,
+                    self.kmer_cache_size)
         else:
             output_x = cp.zeros((input_x.shape[0], self.num_rffs), cp.float32)
             x_in = cp.ascontiguousarray(cp.asarray(input_x).astype(cp.float32, copy=False))
             cudaConv1dMaxpool(x_in, output_x, self.radem_diag, self.chi_arr,
-                    sequence_length, self.conv_width)
+                    sequence_length, self.conv_width,
+                    stream = cp.cuda.get_current_stream().ptr)
 
         return output_x
 
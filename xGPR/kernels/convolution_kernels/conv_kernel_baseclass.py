@@ -8,9 +8,12 @@ import numpy as np
 from scipy.stats import chi
 
 from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuConv1dFGen, cpuConvGrad
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuConv1dDesignMatrix, cpuConv1dMatvec
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuConv1dPredictMean, cpuConv1dPredictMeanVar
 try:
     import cupy as cp
     from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaConv1dFGen, cudaConvGrad
+    from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaConv1dDesignMatrix, cudaConv1dMatvec
 except:
     pass
 
@@ -135,21 +138,140 @@ class ConvKernelBaseclass(KernelBaseclass, ABC):
         if input_x.shape[2] != self._xdim[2]:
             raise RuntimeError("Unexpected input shape supplied.")
 
-        input_x *= self.hyperparams[1]
+        input_x = self._scaled_input(input_x)
 
         if self.device == "cpu":
             xtrans = np.zeros((input_x.shape[0], self.num_rffs), np.float64)
             cpuConv1dFGen(input_x, xtrans, self.radem_diag, self.chi_arr,
                     sequence_length, self.conv_width, self.scaling_type,
-                    self.num_threads)
+                    self.num_threads, self.sincos_precision,
+                    self.kmer_cache_size)
         else:
             xtrans = cp.zeros((input_x.shape[0], self.num_rffs), cp.float64)
             cudaConv1dFGen(input_x, xtrans, self.radem_diag, self.chi_arr,
-                    sequence_length, self.conv_width, self.scaling_type)
+                    sequence_length, self.conv_width, self.scaling_type,
+                    stream = cp.cuda.get_current_stream().ptr)
 
         return xtrans
 
 
+    def kernel_specific_design_mat(self, input_x, input_y, z_trans_z,
+            z_trans_y, sequence_length):
+        """Adds Z^T Z and Z^T y for the input to z_trans_z and z_trans_y
+        without storing the random features Z.
+
+        Args:
+            input_x: A numpy or cupy array containing the raw input data.
+            input_y: A cupy or numpy float64 array of y-values.
+            z_trans_z: A cupy or numpy (num_rffs, num_rffs) array.
+            z_trans_y: A cupy or numpy (num_rffs) array.
+            sequence_length: A numpy or cupy array containing the number of
+                elements in each sequence -- so that zero padding can be masked.
+
+        Raises:
+            RuntimeError: A value error is raised if the dimensionality of the
+                input does not meet validity criteria.
+        """
+        if sequence_length is None:
+            raise RuntimeError("sequence_length is required for convolution kernels.")
+        if input_x.shape[2] != self._xdim[2]:
+            raise RuntimeError("Unexpected input shape supplied.")
+
+        input_x = self._scaled_input(input_x)
+
+        if self.device == "cpu":
+            cpuConv1dDesignMatrix(input_x, input_y, z_trans_z, z_trans_y,
+                    self.radem_diag, self.chi_arr, sequence_length,
+                    self.conv_width, self.scaling_type, self.num_threads,
+                    self.fit_intercept, self.sincos_precision,
+                    self.kmer_cache_size)
+        else:
+            cudaConv1dDesignMatrix(input_x, input_y, z_trans_z, z_trans_y,
+                    self.radem_diag, self.chi_arr, sequence_length,
+                    self.conv_width, self.scaling_type, self.fit_intercept,
+                    stream = cp.cuda.get_current_stream().ptr)
+
+
+    def kernel_specific_matvec(self, input_x, input_vec, output,
+            sequence_length):
+        """Adds Z^T (Z V) for the input to output without storing
+        the random features Z.
+
+        Args:
+            input_x: A numpy or cupy array containing the raw input data.
+            input_vec: A cupy or numpy float64 (num_rffs, k) array V.
+            output: A cupy or numpy float64 (num_rffs, k) array.
+            sequence_length: A numpy or cupy array containing the number of
+                elements in each sequence -- so that zero padding can be masked.
+
+        Raises:
+            RuntimeError: A value error is raised if the dimensionality of the
+                input does not meet validity criteria.
+        """
+        if sequence_length is None:
+            raise RuntimeError("sequence_length is required for convolution kernels.")
+        if input_x.shape[2] != self._xdim[2]:
+            raise RuntimeError("Unexpected input shape supplied.")
+
+        input_x = self._scaled_input(input_x)
+
+        if self.device == "cpu":
+            cpuConv1dMatvec(input_x, input_vec, output, self.radem_diag,
+                    self.chi_arr, sequence_length, self.conv_width,
+                    self.scaling_type, self.num_threads, self.fit_intercept,
+                    self.sincos_precision, self.kmer_cache_size)
+        else:
+            cudaConv1dMatvec(input_x, input_vec, output, self.radem_diag,
+                    self.chi_arr, sequence_length, self.conv_width,
+                    self.scaling_type, self.fit_intercept,
+                    stream = cp.cuda.get_current_stream().ptr)
+
+
+    def kernel_specific_predict(self, input_x, weights, var,
+            sequence_length):
+        """Calculates Z w and (if var is not None) the diagonal of
+        Z_v V Z_v^T for the input without storing the random features
+        Z. On GPU this uses the baseclass implementation.
+
+        Args:
+            input_x: A numpy or cupy array containing the raw input data.
+            weights: A cupy or numpy float64 (num_rffs) array.
+            var: None or a cupy or numpy float64 (K, K) array.
+            sequence_length: A numpy or cupy array containing the number of
+                elements in each sequence -- so that zero padding can be masked.
+
+        Returns:
+            mean: A cupy or numpy (N) array.
+            var_prod: None or a cupy or numpy (N) array.
+
+        Raises:
+            RuntimeError: A value error is raised if the dimensionality of the
+                input does not meet validity criteria.
+        """
+        if self.device != "cpu":
+            return super().kernel_specific_predict(input_x, weights, var,
+                    sequence_length)
+        if sequence_length is None:
+            raise RuntimeError("sequence_length is required for convolution kernels.")
+        if input_x.shape[2] != self._xdim[2]:
+            raise RuntimeError("Unexpected input shape supplied.")
+
+        input_x = self._scaled_input(input_x)
+        mean = np.zeros((input_x.shape[0]), np.float64)
+        if var is None:
+            cpuConv1dPredictMean(input_x, weights, mean, self.radem_diag,
+                    self.chi_arr, sequence_length, self.conv_width,
+                    self.scaling_type, self.num_threads, self.fit_intercept,
+                    self.sincos_precision)
+            return mean, None
+        var_prod = np.zeros((input_x.shape[0]), np.float64)
+        cpuConv1dPredictMeanVar(input_x, weights, var, mean, var_prod,
+                self.radem_diag, self.chi_arr, sequence_length, self.conv_width,
+                self.scaling_type, self.num_threads, self.fit_intercept,
+                self.sincos_precision)
+        return mean, var_prod
+
+
     def kernel_specific_set_hyperparams(self):
         """Provided for consistency with baseclass. This
         kernel has no kernel-specific properties that must
@@ -183,12 +305,14 @@ class ConvKernelBaseclass(KernelBaseclass, ABC):
             cpuConvGrad(input_x, xtrans, self.radem_diag, self.chi_arr,
                     sequence_length, dz_dsigma, self.hyperparams[1],
                     self.conv_width, self.scaling_type,
-                    self.num_threads)
+                    self.num_threads, self.sincos_precision,
+                    self.kmer_cache_size)
         else:
             xtrans = cp.zeros((input_x.shape[0], self.num_rffs), cp.float64)
             dz_dsigma = cp.zeros((input_x.shape[0], self.num_rffs, 1), cp.float64)
             cudaConvGrad(input_x, xtrans, self.radem_diag, self.chi_arr,
                     sequence_length, dz_dsigma, self.hyperparams[1],
-                    self.conv_width, self.scaling_type)
+                    self.conv_width, self.scaling_type,
+                    stream = cp.cuda.get_current_stream().ptr)
 
         return xtrans, dz_dsigma
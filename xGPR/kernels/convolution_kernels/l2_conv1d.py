@@ -6,8 +6,7 @@ from math import ceil
 import numpy as np
 from scipy.stats import chi
 
-from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuConv1dMaxpool
-from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFFeatureGen, cpuRBFGrad
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuConv1dTwoLayerFGen, cpuConv1dTwoLayerGrad
 try:
     import cupy as cp
     from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaConv1dMaxpool
@@ -171,23 +170,24 @@ class Conv1dTwoLayer(KernelBaseclass):
         sequence_length = sequence_length.astype(np.int32, copy=False)
 
         if self.device == "cpu":
-            featurized_x = np.zeros((input_x.shape[0], self.init_rffs), np.float32)
-            cpuConv1dMaxpool(input_x, featurized_x, self.radem_diag1, self.chi_arr1,
-                    sequence_length, self.conv_width, self.num_threads)
-            xtrans = np.zeros((featurized_x.shape[0], self.num_rffs), np.float64)
-            featurized_x *= self.hyperparams[1]
-            cpuRBFFeatureGen(featurized_x, xtrans, self.radem_diag2, self.chi_arr2,
-                self.num_threads, self.fit_intercept)
+            # The first layer output is pooled and fed to the RBF layer in
+            # small blocks of rows, so it never has to be stored in full.
+            xtrans = np.zeros((input_x.shape[0], self.num_rffs), np.float64)
+            cpuConv1dTwoLayerFGen(input_x, xtrans, self.radem_diag1, self.chi_arr1,
+                    self.radem_diag2, self.chi_arr2, sequence_length,
+                    self.conv_width, self.hyperparams[1], self.num_threads,
+                    self.kmer_cache_size, self.fit_intercept, self.sincos_precision)
 
         else:
             featurized_x = cp.zeros((input_x.shape[0], self.init_rffs), cp.float32)
             cudaConv1dMaxpool(input_x, featurized_x, self.radem_diag1, self.chi_arr1,
-                    sequence_length, self.conv_width)
+                    sequence_length, self.conv_width,
+                    stream = cp.cuda.get_current_stream().ptr)
 
             xtrans = cp.zeros((featurized_x.shape[0], self.num_rffs), cp.float64)
             featurized_x *= self.hyperparams[1]
             cudaRBFFeatureGen(featurized_x, xtrans, self.radem_diag2, self.chi_arr2,
-                self.fit_intercept)
+                self.fit_intercept, stream = cp.cuda.get_current_stream().ptr)
 
         return xtrans
 
@@ -208,21 +208,21 @@ class Conv1dTwoLayer(KernelBaseclass):
                 output_x with respect to the kernel-specific hyperparameters.
         """
         if self.device == "cpu":
-            featurized_x = np.zeros((input_x.shape[0], self.init_rffs), np.float32)
-            cpuConv1dMaxpool(input_x, featurized_x, self.radem_diag1, self.chi_arr1,
-                    sequence_length, self.conv_width, self.num_threads)
-
             output_x = np.zeros((input_x.shape[0], self.num_rffs), np.float64)
             dz_dsigma = np.zeros((input_x.shape[0], self.num_rffs, 1), np.float64)
-            cpuRBFGrad(featurized_x, output_x, dz_dsigma, self.radem_diag2, self.chi_arr2,
-                self.hyperparams[1], self.num_threads, self.fit_intercept)
+            cpuConv1dTwoLayerGrad(input_x, output_x, dz_dsigma, self.radem_diag1,
+                    self.chi_arr1, self.radem_diag2, self.chi_arr2, sequence_length,
+                    self.conv_width, self.hyperparams[1], self.num_threads,
+                    self.kmer_cache_size, self.fit_intercept, self.sincos_precision)
         else:
             featurized_x = cp.zeros((input_x.shape[0], self.init_rffs), cp.float32)
             cudaConv1dMaxpool(input_x, featurized_x, self.radem_diag1, self.chi_arr1,
-                    sequence_length, self.conv_width)
+                    sequence_length, self.conv_width,
+                    stream = cp.cuda.get_current_stream().ptr)
 
             output_x = cp.zeros((input_x.shape[0], self.num_rffs), cp.float64)
             dz_dsigma = cp.zeros((input_x.shape[0], self.num_rffs, 1), cp.float64)
             cudaRBFGrad(featurized_x, output_x, dz_dsigma, self.radem_diag2, self.chi_arr2,
-                self.hyperparams[1], self.fit_intercept)
+                self.hyperparams[1], self.fit_intercept,
+                stream = cp.cuda.get_current_stream().ptr)
         return output_x, dz_dsigma
@@ -7,10 +7,13 @@ each kernel exposes the same methods to the model classes.
 """
 import abc
 from abc import ABC
+from contextlib import contextmanager
 
 import numpy as np
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuGetNUMANodes, cpuAllocateFirstTouch
 try:
     import cupy as cp
+    from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaEnablePeerAccess
 except:
     pass
 
@@ -44,6 +47,21 @@ class KernelBaseclass(ABC):
             Otherwise, generate as single precision.
         fit_intercept (bool): Whether to fit a y-intercept. Defaults to True but can
             be set to False by adding "intercept":False to kernel_spec_parms.
+        sincos_precision (str): One of "exact", "fast". Determines whether sine and
+            cosine of the projected features are evaluated on CPU using the standard
+            library ("exact") or a vectorized polynomial approximation ("fast"). Defaults
+            to "exact"; can be changed by adding "sincos_precision" to kernel_spec_parms.
+        kmer_cache_size (int): Used by convolution kernels only. The number of
+            k-mers for which each CPU thread keeps the SORF output so that repeated
+            k-mers (common with one-hot encoded sequences) are not re-transformed.
+            Defaults to 0 (no cache); can be changed by adding "kmer_cache_size"
+            to kernel_spec_parms.
+        cuda_devices (list): Either None or a list of cuda device ids. If a list
+            of more than one device is supplied, accumulate_design_mat and
+            accumulate_matvec split the rows of each chunk of data across these
+            devices when running on cuda and sum the results on the current
+            device. Defaults to None (use the current device only); can be
+            changed by adding "cuda_devices" to kernel_spec_parms.
     """
 
     def __init__(self, num_rffs, xdim, num_threads = 2,
@@ -73,7 +91,9 @@ class KernelBaseclass(ABC):
 
         Raises:
             ValueError: Raises a ValueError if a sine-cosine kernel is requested
-                but num_rffs is not an integer multiple of 2.
+                but num_rffs is not an integer multiple of 2, or if an
+                unrecognized sincos_precision or invalid kmer_cache_size or
+                cuda_devices is supplied.
         """
         self.double_precision = double_precision
         if num_rffs < 2:
@@ -95,6 +115,32 @@ class KernelBaseclass(ABC):
             if kernel_spec_parms["intercept"] is False:
                 self.fit_intercept = False
 
+        self.sincos_precision = "exact"
+        if "sincos_precision" in kernel_spec_parms:
+            if kernel_spec_parms["sincos_precision"] not in ("exact", "fast"):
+                raise ValueError("sincos_precision if supplied must be one of "
+                        "'exact', 'fast'.")
+            self.sincos_precision = kernel_spec_parms["sincos_precision"]
+
+        self.kmer_cache_size = 0
+        if "kmer_cache_size" in kernel_spec_parms:
+            if not isinstance(kernel_spec_parms["kmer_cache_size"], int) or \
+                    kernel_spec_parms["kmer_cache_size"] < 0:
+                raise ValueError("kmer_cache_size if supplied must be an "
+                        "integer >= 0.")
+            self.kmer_cache_size = kernel_spec_parms["kmer_cache_size"]
+
+        self.cuda_devices = None
+        if kernel_spec_parms.get("cuda_devices", None) is not None:
+            cuda_devices = kernel_spec_parms["cuda_devices"]
+            if not isinstance(cuda_devices, (list, tuple)) or len(cuda_devices) == 0 \
+                    or len(set(cuda_devices)) != len(cuda_devices) or \
+                    not all(isinstance(d, int) and d >= 0 for d in cuda_devices):
+                raise ValueError("cuda_devices if supplied must be a list of "
+                        "distinct non-negative integer device ids.")
+            self.cuda_devices = list(cuda_devices)
+        self._cuda_replicas = {}
+
         self._xdim = xdim
         self.hyperparams = None
         self.bounds = None
@@ -125,6 +171,46 @@ class KernelBaseclass(ABC):
         any kernel-specific changes necessary after the hyperparameters
         have been reset."""
 
+    def kernel_specific_design_mat(self, input_x, input_y, z_trans_z,
+            z_trans_y, sequence_length):
+        """Adds Z^T Z and Z^T y for a given set of inputs to z_trans_z
+        and z_trans_y. Kernels that have a native routine which does this
+        without storing the random features should override this; the
+        default generates the random features, then multiplies."""
+        xtrans = self.kernel_specific_transform(input_x, sequence_length)
+        if self.fit_intercept:
+            xtrans[:,0] = 1.
+        z_trans_y += xtrans.T @ input_y
+        z_trans_z += xtrans.T @ xtrans
+
+    def kernel_specific_matvec(self, input_x, input_vec, output,
+            sequence_length):
+        """Adds Z^T (Z V) for a given set of inputs and a 2d array of
+        vectors V to output. Kernels that have a native routine which
+        does this without storing the random features should override
+        this; the default generates the random features, then multiplies."""
+        xtrans = self.kernel_specific_transform(input_x, sequence_length)
+        if self.fit_intercept:
+            xtrans[:,0] = 1.
+        output += xtrans.T @ (xtrans @ input_vec)
+
+    def kernel_specific_predict(self, input_x, weights, var,
+            sequence_length):
+        """Calculates Z w and, if var is not None, the diagonal of
+        Z_v V Z_v^T (where Z_v is the first var.shape[0] columns of Z)
+        for a given set of inputs. Kernels that have a native routine
+        which does this without storing the random features should
+        override this; the default generates the random features, then
+        multiplies."""
+        xtrans = self.kernel_specific_transform(input_x, sequence_length)
+        if self.fit_intercept:
+            xtrans[:,0] = 1.
+        mean = xtrans @ weights
+        if var is None:
+            return mean, None
+        xtrans = xtrans[:,:var.shape[0]]
+        return mean, (xtrans * (xtrans @ var.T)).sum(axis=1)
+
 
     def check_bounds(self, bounds):
         """Checks a set of bounds provided by the caller to ensure they
@@ -274,25 +360,7 @@ class KernelBaseclass(ABC):
         which is none for most kernels but must be specified
         for convolution kernels), generate random features
         as output."""
-        # This always generates a copy, which means that we
-        # are never working on the input data, only on a copy,
-        # and can therefore modify it with impunity.
-        if not input_x.flags["C_CONTIGUOUS"]:
-            if self.double_precision:
-                xin = np.ascontiguousarray(input_x, np.float64)
-            else:
-                xin = np.ascontiguousarray(input_x, np.float32)
-        elif self.double_precision:
-            xin = input_x.astype(np.float64, copy=True)
-        else:
-            xin = input_x.astype(np.float32, copy=True)
-
-        if self.device == "cuda":
-            xin = cp.asarray(xin)
-
-        slen = None
-        if sequence_length is not None:
-            slen = sequence_length.astype(np.int32, copy=False)
+        xin, slen = self._prepare_input(input_x, sequence_length)
 
         xtrans = self.kernel_specific_transform(xin, slen)
         if self.fit_intercept:
@@ -316,30 +384,274 @@ class KernelBaseclass(ABC):
         return self.transform_x(input_x, sequence_length), y_out
 
 
-    def gradient_x(self, input_x, sequence_length = None):
+    def accumulate_design_mat(self, input_x, input_y, z_trans_z, z_trans_y,
+            sequence_length = None):
         """Given a numpy array as input (and sequence_length,
         which is none for most kernels but must be specified
-        for convolution kernels), generate random features
-        and gradient as output."""
-        # This always generates a copy, which means that we
-        # are never working on the input data, only on a copy,
-        # and can therefore modify it with impunity.
-        if not input_x.flags["C_CONTIGUOUS"]:
-            if self.double_precision:
-                xin = np.ascontiguousarray(input_x, np.float64)
-            else:
-                xin = np.ascontiguousarray(input_x, np.float32)
-        elif self.double_precision:
-            xin = input_x.astype(np.float64, copy=True)
+        for convolution kernels), adds Z^T Z and Z^T y to z_trans_z
+        and z_trans_y, where Z is the random features for the input.
+        Where possible this is done without ever storing Z.
+
+        Args:
+            input_x (np.ndarray): The raw input data.
+            input_y (np.ndarray): The y-values corresponding to input_x.
+            z_trans_z: A cupy or numpy (as appropriate for device) array
+                of shape (num_rffs, num_rffs) to which Z^T Z is added.
+            z_trans_y: A cupy or numpy array of shape (num_rffs) to
+                which Z^T y is added.
+            sequence_length: None or a numpy array of sequence lengths.
+        """
+        xin, slen = self._prepare_input(input_x, sequence_length,
+                move_to_device = False)
+
+        if self._use_multiple_devices(xin.shape[0]):
+            self._sharded_accumulate(self.kernel_specific_design_mat, xin,
+                    slen, [input_y], [], [z_trans_z, z_trans_y])
+            return
+
+        if self.device == "cuda":
+            xin = cp.asarray(xin)
+            y_in = cp.ascontiguousarray(cp.asarray(input_y), dtype=cp.float64)
         else:
-            xin = input_x.astype(np.float32, copy=True)
+            y_in = np.ascontiguousarray(input_y, dtype=np.float64)
+
+        self.kernel_specific_design_mat(xin, y_in, z_trans_z, z_trans_y, slen)
+
+
+    def accumulate_matvec(self, input_x, input_vec, output,
+            sequence_length = None):
+        """Given a numpy array as input (and sequence_length,
+        which is none for most kernels but must be specified
+        for convolution kernels), adds Z^T (Z V) to output, where
+        Z is the random features for the input. Where possible this
+        is done without ever storing Z, and the cost of generating
+        the features is shared across all the columns of V.
+
+        Args:
+            input_x (np.ndarray): The raw input data.
+            input_vec: A cupy or numpy (as appropriate for device) array
+                of shape (num_rffs) or (num_rffs, k).
+            output: A cupy or numpy array of the same shape as input_vec
+                to which Z^T (Z V) is added.
+            sequence_length: None or a numpy array of sequence lengths.
+        """
+        xin, slen = self._prepare_input(input_x, sequence_length,
+                move_to_device = False)
+
+        if self._use_multiple_devices(xin.shape[0]):
+            vec_in = cp.ascontiguousarray(input_vec.reshape(input_vec.shape[0], -1),
+                    dtype=cp.float64)
+            out_arr = cp.zeros(vec_in.shape)
+            self._sharded_accumulate(self.kernel_specific_matvec, xin,
+                    slen, [], [vec_in], [out_arr])
+            output += out_arr.reshape(output.shape)
+            return
 
         if self.device == "cuda":
             xin = cp.asarray(xin)
+            vec_in = cp.ascontiguousarray(input_vec.reshape(input_vec.shape[0], -1),
+                    dtype=cp.float64)
+            out_arr = cp.zeros(vec_in.shape)
+        else:
+            vec_in = np.ascontiguousarray(input_vec.reshape(input_vec.shape[0], -1),
+                    dtype=np.float64)
+            out_arr = np.zeros(vec_in.shape)
+
+        self.kernel_specific_matvec(xin, vec_in, out_arr, slen)
+        output += out_arr.reshape(output.shape)
+
+
+    def predict_mean_var(self, input_x, weights, var = None,
+            sequence_length = None):
+        """Given a numpy array as input (and sequence_length,
+        which is none for most kernels but must be specified
+        for convolution kernels), calculates Z w and (if var is
+        supplied) the diagonal of Z_v V Z_v^T, where Z is the random
+        features for the input and Z_v is its first var.shape[0]
+        columns. Where possible this is done without ever storing Z.
+
+        Args:
+            input_x (np.ndarray): The raw input data.
+            weights: A cupy or numpy (as appropriate for device) array
+                of shape (num_rffs).
+            var: Either None or a cupy or numpy array of shape (K, K)
+                for some K <= num_rffs.
+            sequence_length: None or a numpy array of sequence lengths.
+
+        Returns:
+            mean: A cupy or numpy array of shape (N) containing Z w.
+            var_prod: None if var is None, otherwise a cupy or numpy array
+                of shape (N) containing the diagonal of Z_v V Z_v^T.
+        """
+        xin, slen = self._prepare_input(input_x, sequence_length)
+
+        if self.device == "cuda":
+            weights_in = cp.ascontiguousarray(weights, dtype=cp.float64)
+            var_in = None if var is None else \
+                    cp.ascontiguousarray(var, dtype=cp.float64)
+        else:
+            weights_in = np.ascontiguousarray(weights, dtype=np.float64)
+            var_in = None if var is None else \
+                    np.ascontiguousarray(var, dtype=np.float64)
+
+        return self.kernel_specific_predict(xin, weights_in, var_in, slen)
+
+
+    def _prepare_input(self, input_x, sequence_length = None,
+            move_to_device = True):
+        """Converts a chunk of raw input to the C-contiguous float32 or
+        float64 (depending on self.double_precision) array the native
+        routines expect and, if move_to_device, moves it to the current
+        cuda device if the kernel is on cuda. A copy is made only if the
+        input does not already have the right dtype, layout and device,
+        so the result may be the caller's array; kernel-specific routines
+        must therefore not modify it in place (see _scaled_input).
+
+        Args:
+            input_x: A numpy or cupy array containing the raw input data.
+            sequence_length: None or a numpy array of sequence lengths.
+            move_to_device (bool): If False, numpy input is left on the
+                host, e.g. so that it can be split across several devices.
+
+        Returns:
+            xin: The converted input.
+            slen: None if sequence_length is None, otherwise sequence_length
+                as a numpy int32 array.
+        """
+        xtype = np.float64 if self.double_precision else np.float32
+        if isinstance(input_x, np.ndarray):
+            xin = np.ascontiguousarray(input_x, xtype)
+            if move_to_device and self.device == "cuda":
+                xin = cp.asarray(xin)
+        else:
+            xin = cp.ascontiguousarray(input_x, xtype)
 
         slen = None
         if sequence_length is not None:
             slen = sequence_length.astype(np.int32, copy=False)
+        return xin, slen
+
+
+    def _scaled_input(self, input_x):
+        """Returns the input multiplied by the lengthscale (self.hyperparams[1])
+        as a new array of the same dtype, leaving input_x, which may be the
+        caller's data (see _prepare_input), unchanged."""
+        return input_x * input_x.dtype.type(self.hyperparams[1])
+
+
+    def _cpu_output_array(self, shape, dtype = np.float64):
+        """Returns a zeroed numpy array for a CPU routine that splits
+        its rows evenly across self.num_threads threads to write to.
+        If the CPU thread pool is in NUMA mode (see cpuSetNUMAMode),
+        the array is zeroed by those same threads, so that each row
+        is placed on the node of the thread that will write it;
+        otherwise this is just np.zeros."""
+        if cpuGetNUMANodes() > 0:
+            return cpuAllocateFirstTouch(shape, self.num_threads,
+                    dtype == np.float64)
+        return np.zeros(shape, dtype)
+
+
+    def _use_multiple_devices(self, num_rows):
+        """Checks whether a chunk of data with num_rows rows should
+        be split across several cuda devices."""
+        cuda_devices = getattr(self, "cuda_devices", None)
+        return self.device == "cuda" and cuda_devices is not None and \
+                len(cuda_devices) > 1 and num_rows > 1
+
+
+    def _sharded_accumulate(self, kernel_fn, xin, slen, row_arrays,
+            shared_arrays, outputs):
+        """Splits the rows of a chunk of data into one contiguous shard
+        per device in self.cuda_devices, runs kernel_fn for each shard
+        on its own device and adds the partial results from each device
+        to outputs, which live on the current device. The work for all
+        shards is launched before any of the partial results are
+        collected, so that the devices run concurrently.
+
+        Args:
+            kernel_fn: Either self.kernel_specific_design_mat or
+                self.kernel_specific_matvec.
+            xin: The (already typecast) numpy or cupy input.
+            slen: None or a numpy int32 array of sequence lengths.
+            row_arrays (list): Arrays with one row per row of xin (e.g.
+                the y-values), which are split the same way as xin.
+            shared_arrays (list): Arrays that are needed in full by
+                every shard (e.g. the vectors for a matvec).
+            outputs (list): Arrays on the current device to which the
+                partial results are added.
+        """
+        shard_bounds = np.linspace(0, xin.shape[0],
+                len(self.cuda_devices) + 1).astype(np.int64)
+        launched = []
+
+        for device_id, start, end in zip(self.cuda_devices, shard_bounds[:-1],
+                shard_bounds[1:]):
+            if end <= start:
+                continue
+            with cp.cuda.Device(device_id):
+                x_shard = _copy_to_current_device(xin[start:end])
+                row_shards = [cp.ascontiguousarray(_copy_to_current_device(r[start:end]),
+                    dtype=cp.float64) for r in row_arrays]
+                shared_copies = [_copy_to_current_device(a) for a in shared_arrays]
+                partials = [cp.zeros(o.shape, dtype=o.dtype) for o in outputs]
+                slen_shard = None
+                if slen is not None:
+                    slen_shard = np.ascontiguousarray(slen[start:end])
+
+                with self._cuda_device_replicas(device_id):
+                    kernel_fn(x_shard, *row_shards, *shared_copies, *partials,
+                            slen_shard)
+                launched.append((device_id, partials))
+
+        for device_id, partials in launched:
+            with cp.cuda.Device(device_id):
+                cp.cuda.get_current_stream().synchronize()
+            for output, partial in zip(outputs, partials):
+                output += _copy_to_current_device(partial)
+
+        # The copies read memory that belongs to the other devices' memory
+        # pools; wait for them before the partial results are released.
+        cp.cuda.get_current_stream().synchronize()
+
+
+    @contextmanager
+    def _cuda_device_replicas(self, device_id):
+        """Temporarily replaces each cupy array attribute of the kernel
+        (radem_diag, chi_arr etc.) that does not live on device_id with a
+        copy that does, so that kernel-specific routines can be run on
+        device_id unchanged. Copies are cached and reused for as long as
+        the attribute they were made from is not replaced.
+
+        Args:
+            device_id (int): The device the copies should live on. Must
+                be the current device.
+        """
+        if not hasattr(self, "_cuda_replicas"):
+            self._cuda_replicas = {}
+        replaced = {}
+        for name, value in list(vars(self).items()):
+            if not isinstance(value, cp.ndarray) or value.device.id == device_id:
+                continue
+            cached = self._cuda_replicas.get((name, device_id), None)
+            if cached is None or cached[0] is not value:
+                cached = (value, value.copy())
+                self._cuda_replicas[(name, device_id)] = cached
+            replaced[name] = value
+            setattr(self, name, cached[1])
+        try:
+            yield
+        finally:
+            for name, value in replaced.items():
+                setattr(self, name, value)
+
+
+    def gradient_x(self, input_x, sequence_length = None):
+        """Given a numpy array as input (and sequence_length,
+        which is none for most kernels but must be specified
+        for convolution kernels), generate random features
+        and gradient as output."""
+        xin, slen = self._prepare_input(input_x, sequence_length)
 
         xtrans, xgrad = self.kernel_specific_gradient(xin, slen)
         if self.fit_intercept:
@@ -430,3 +742,18 @@ class KernelBaseclass(ABC):
                     "of 'cpu', 'cuda'.")
         self.device_ = value
         self.kernel_specific_set_device(value)
+        self._cuda_replicas = {}
+        if value == "cuda" and getattr(self, "cuda_devices", None) is not None:
+            if len(self.cuda_devices) > 1:
+                cudaEnablePeerAccess(self.cuda_devices)
+
+
+
+def _copy_to_current_device(input_arr):
+    """Returns input_arr (a numpy or cupy array) as a cupy array on the
+    current device, copying it only if it lives somewhere else."""
+    if isinstance(input_arr, np.ndarray):
+        return cp.asarray(input_arr)
+    if input_arr.device.id == cp.cuda.Device().id:
+        return input_arr
+    return input_arr.copy()
@@ -7,10 +7,10 @@ from math import ceil
 import numpy as np
 
 from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuRBFFeatureGen, cpuRBFGrad
-from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuSRHT
+from xGPR.xgpr_cpu_rfgen_cpp_ext import cpuSRHT, cpuSubsampledSRHT
 try:
     import cupy as cp
-    from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaSRHT
+    from xGPR.xgpr_cuda_rfgen_cpp_ext import cudaSRHT, cudaSubsampledSRHT
 except:
     pass
 
@@ -26,9 +26,15 @@ class SRHTCompressor():
             than input_size. Used for padding the input.
         radem: A numpy or cupy diagonal matrix drawn from a
             Rademacher distribution of shape (padded_dims).
-        col_sampler (np.ndarray): A numpy array of shape (compression_size)
+        col_sampler (np.ndarray): A numpy array of shape (padded_dims)
             that permutes the columns of the compressed data.
+        truncated_sampler (np.ndarray): The first compression_size elements
+            of col_sampler, i.e. the columns that are kept.
+        col_idx: A numpy or cupy int32 copy of truncated_sampler, used by the
+            subsampled SRHT routines.
         compressor_func: A reference to an appropriate wrapped C++ function.
+        subsampled_func: A reference to the wrapped C++ function that
+            calculates only the columns that are kept.
         device: Either "cpu" or "cuda".
         double_precision (bool): If True, input is assumed to be
                 doubles, else floats. Right now set to True by default.
@@ -66,7 +72,9 @@ class SRHTCompressor():
                                 replace=True)
         self.col_sampler = rng.permutation(self.padded_dims)
         self.truncated_sampler = self.col_sampler[:self.compression_size]
+        self.col_idx = self.truncated_sampler.astype(np.int32)
         self.compressor_func = None
+        self.subsampled_func = None
         self.device = device
         self.num_threads = num_threads
 
@@ -88,17 +96,36 @@ class SRHTCompressor():
         if features.shape[1] != self.input_size or len(features.shape) != 2:
             raise ValueError("Input with unexpected size passed to a compressor "
                     "module.")
+
+        # If truncating, calculate only the columns that are kept;
+        # the input does not need to be padded for this.
+        if not no_compression:
+            if self.device == "cuda":
+                xfeatures = cp.ascontiguousarray(features, self.dtype)
+                output = cp.empty((features.shape[0], self.compression_size),
+                        self.dtype)
+                self.subsampled_func(xfeatures, output, self.radem, self.col_idx,
+                        stream = cp.cuda.get_current_stream().ptr)
+            else:
+                xfeatures = np.ascontiguousarray(features, self.dtype)
+                output = np.empty((features.shape[0], self.compression_size),
+                        self.dtype)
+                self.subsampled_func(xfeatures, output, self.radem, self.col_idx,
+                        self.num_threads)
+            return output
+
         if features.shape[1] < self.padded_dims:
             xfeatures = self.zero_arr((features.shape[0], self.padded_dims), self.dtype)
             xfeatures[:,:features.shape[1]] = features
         else:
             xfeatures = features.astype(self.dtype)
 
-        self.compressor_func(xfeatures, self.radem, self.num_threads)
-        if no_compression:
-            return xfeatures[:,self.col_sampler]
-
-        return xfeatures[:,self.truncated_sampler]
+        if self.device == "cuda":
+            self.compressor_func(xfeatures, self.radem, self.num_threads,
+                    stream = cp.cuda.get_current_stream().ptr)
+        else:
+            self.compressor_func(xfeatures, self.radem, self.num_threads)
+        return xfeatures[:,self.col_sampler]
 
 
     @property
@@ -131,8 +158,10 @@ class SRHTCompressor():
         if value == "cpu":
             if not isinstance(self.radem, np.ndarray):
                 self.radem = cp.asnumpy(self.radem)
+                self.col_idx = cp.asnumpy(self.col_idx)
             self.zero_arr = np.zeros
             self.compressor_func = cpuSRHT
+            self.subsampled_func = cpuSubsampledSRHT
             if self.double_precision:
                 self.dtype = np.float64
             else:
@@ -140,8 +169,10 @@ class SRHTCompressor():
 
         elif value == "cuda":
             self.radem = cp.asarray(self.radem)
+            self.col_idx = cp.asarray(self.col_idx)
             self.zero_arr = cp.zeros
             self.compressor_func = cudaSRHT
+            self.subsampled_func = cudaSubsampledSRHT
             if self.double_precision:
                 self.dtype = cp.float64
             else:
@@ -0,0 +1,57 @@
+"""Access to the optional profiling instrumentation in the native
+extensions. It is only compiled in if xGPR is built with the CMake
+option XGPR_PROFILING=ON, e.g.
+
+    pip install --no-build-isolation -ve . -Ccmake.define.XGPR_PROFILING=ON
+
+and must then also be switched on with set_profiling(True). Otherwise
+the functions below still work but record nothing."""
+from .xgpr_cpu_rfgen_cpp_ext import cpuSetProfiling, cpuGetProfile, cpuResetProfile
+try:
+    from .xgpr_cuda_rfgen_cpp_ext import cudaSetProfiling, cudaGetProfile, cudaResetProfile
+except:
+    cudaSetProfiling, cudaGetProfile, cudaResetProfile = None, None, None
+
+
+
+def set_profiling(enabled = True):
+    """Switches recording on or off in each available extension.
+
+    Args:
+        enabled (bool): Whether to record.
+
+    Returns:
+        available (bool): True if the CPU extension was built with
+            profiling, so that something will be recorded.
+    """
+    if cudaSetProfiling is not None:
+        cudaSetProfiling(enabled)
+    return cpuSetProfiling(enabled)
+
+
+def get_profile():
+    """Returns the profile recorded since the last reset.
+
+    Returns:
+        profile (dict): Has the key "cpu" and, if the CUDA extension is
+            available, "cuda". Each is a dict with keys "available" and
+            "enabled" and, if available, "phase_seconds" and "phase_calls"
+            (time spent in and number of calls to each phase, e.g. "fht",
+            "postprocess"), "thread_phase_seconds" (the same times broken
+            down by thread), "counts" and "thread_counts" (rows, kmers and
+            bytes processed; for CUDA bytes are those copied to the
+            device) and "load_imbalance" (for the CPU thread pool, the
+            summed wall time of its jobs and the part of it the average
+            thread spent waiting for the slowest).
+    """
+    profile = {"cpu":cpuGetProfile()}
+    if cudaGetProfile is not None:
+        profile["cuda"] = cudaGetProfile()
+    return profile
+
+
+def reset_profile():
+    """Clears everything recorded so far in each available extension."""
+    cpuResetProfile()
+    if cudaResetProfile is not None:
+        cudaResetProfile()
@@ -29,8 +29,7 @@ def single_pass_gauss(dataset, kernel, q_mat, acc_results, verbose):
         verbose (bool): Whether to print updates.
     """
     for j, (xdata, ldata) in enumerate(dataset.get_chunked_x_data()):
-        xdata = kernel.transform_x(xdata, ldata)
-        acc_results += xdata.T @ (xdata @ q_mat)
+        kernel.accumulate_matvec(xdata, q_mat, acc_results, ldata)
         if j % 10 == 0 and verbose:
             print(f"Chunk {j} complete.")
 
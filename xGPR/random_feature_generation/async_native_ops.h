@@ -0,0 +1,242 @@
+#ifndef XGPR_ASYNC_NATIVE_OPS_H
+#define XGPR_ASYNC_NATIVE_OPS_H
+
+/*!
+ * # async_native_ops.h
+ *
+ * Helpers shared by the CPU and CUDA wrappers for binding the long
+ * running ops (feature generation, gradients, transforms). Each op is
+ * registered twice: once under its own name, releasing the GIL while
+ * the native work runs, and once under name_async, which queues the
+ * op on a background thread and returns an AsyncOpHandle immediately,
+ * so that Python can work on the previous chunk while the op runs.
+ *
+ * Both templates take an OpLock, an RAII type held for the duration
+ * of each op, for backends whose ops must not run concurrently with
+ * each other (e.g. because they share scratch memory).
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <tuple>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <type_traits>
+#include <utility>
+#include <nanobind/nanobind.h>
+
+namespace nb = nanobind;
+
+
+/*!
+ * # NoOpLock
+ *
+ * OpLock for backends whose ops are already safe to call from several
+ * threads at once.
+ */
+struct NoOpLock {};
+
+
+
+/*!
+ * # AsyncOpQueue
+ *
+ * A single background thread that runs queued ops in the order they
+ * were submitted, so that ops submitted one after another (e.g. on the
+ * same stream, or reading each other's output) still run in order.
+ * The queue is deliberately never destroyed, for the same reason as
+ * the other process-wide native state: it may still be needed by
+ * handles released during interpreter shutdown.
+ */
+template <typename OpLock>
+class AsyncOpQueue {
+    public:
+        static AsyncOpQueue &getInstance(){
+            static AsyncOpQueue *queue = new AsyncOpQueue();
+            return *queue;
+        }
+
+        void submit(std::function<void()> job){
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.push_back(std::move(job));
+            }
+            jobCondition.notify_one();
+        }
+
+        AsyncOpQueue(const AsyncOpQueue&) = delete;
+        AsyncOpQueue &operator=(const AsyncOpQueue&) = delete;
+
+    private:
+        AsyncOpQueue(){
+            worker = std::thread(&AsyncOpQueue::workerLoop, this);
+            worker.detach();
+        }
+
+        void workerLoop(){
+            while (true){
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    jobCondition.wait(lock, [this]{ return !jobs.empty(); });
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+                job();
+            }
+        }
+
+        std::mutex mutex;
+        std::condition_variable jobCondition;
+        std::deque<std::function<void()>> jobs;
+        std::thread worker;
+};
+
+
+
+/*!
+ * # AsyncOpHandle
+ *
+ * Returned to Python by the name_async variant of an op. It owns a
+ * copy of the op's arguments, so the arrays the op reads and writes
+ * stay alive until it has finished, and since those copies are only
+ * ever released by the handle's destructor, which runs with the GIL
+ * held, the background thread never touches a Python object. A handle
+ * that is destroyed before its op finishes waits for it first.
+ */
+template <typename OpLock>
+class AsyncOpHandle {
+    public:
+        template <typename Op>
+        explicit AsyncOpHandle(Op &&op) : op(std::forward<Op>(op)) {
+            AsyncOpQueue<OpLock>::getInstance().submit([this]{ runOp(); });
+        }
+
+        ~AsyncOpHandle(){
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!finished){
+                nb::gil_scoped_release release;
+                doneCondition.wait(lock, [this]{ return finished; });
+            }
+        }
+
+        /*!
+         * # done
+         *
+         * Returns true if the op has finished (successfully or not).
+         */
+        bool done(){
+            std::lock_guard<std::mutex> lock(mutex);
+            return finished;
+        }
+
+        /*!
+         * # result
+         *
+         * Waits for the op to finish and returns its return value, or
+         * rethrows the exception it threw, which the wrapper hands to
+         * Python exactly as for the synchronous variant. Should be
+         * called with the GIL released.
+         */
+        int result(){
+            std::unique_lock<std::mutex> lock(mutex);
+            doneCondition.wait(lock, [this]{ return finished; });
+            if (error)
+                std::rethrow_exception(error);
+            return returnValue;
+        }
+
+        AsyncOpHandle(const AsyncOpHandle&) = delete;
+        AsyncOpHandle &operator=(const AsyncOpHandle&) = delete;
+
+    private:
+        void runOp(){
+            int opReturn = 0;
+            std::exception_ptr opError = nullptr;
+            try {
+                [[maybe_unused]] OpLock opLock;
+                opReturn = op();
+            }
+            catch (...) {
+                opError = std::current_exception();
+            }
+
+            // Notify while holding the lock, so that the handle cannot be
+            // destroyed until this thread is done with it.
+            std::lock_guard<std::mutex> lock(mutex);
+            returnValue = opReturn;
+            error = opError;
+            finished = true;
+            doneCondition.notify_all();
+        }
+
+        std::function<int()> op;
+        std::mutex mutex;
+        std::condition_variable doneCondition;
+        bool finished = false;
+        int returnValue = 0;
+        std::exception_ptr error = nullptr;
+};
+
+
+
+/*!
+ * # defAsyncOpHandle
+ *
+ * Registers the AsyncOpHandle type for this backend. Must be called
+ * before any op is registered with defNativeOp.
+ */
+template <typename OpLock>
+void defAsyncOpHandle(nb::module_ &m, const char *className){
+    nb::class_<AsyncOpHandle<OpLock>>(m, className)
+        .def("done", &AsyncOpHandle<OpLock>::done)
+        .def("result", &AsyncOpHandle<OpLock>::result,
+                nb::call_guard<nb::gil_scoped_release>());
+}
+
+
+
+/*!
+ * # defNativeOp
+ *
+ * Registers op under name, releasing the GIL and holding an OpLock
+ * while it runs, and under asyncName, which copies the arguments into
+ * an AsyncOpHandle, queues the op and returns the handle.
+ *
+ * ## Args:
+ *
+ * + `m` The module.
+ * + `name` The name for the synchronous variant.
+ * + `asyncName` The name for the asynchronous variant.
+ * + `op` The wrapper-facing function for the op.
+ * + `extra` The nb::arg annotations for op's arguments.
+ */
+template <typename OpLock, typename... Args, typename... Extra>
+void defNativeOp(nb::module_ &m, const char *name, const char *asyncName,
+        int (*op)(Args...), const Extra&... extra){
+    m.def(name, [op](Args... args) -> int {
+                nb::gil_scoped_release release;
+                [[maybe_unused]] OpLock opLock;
+                return op(std::forward<Args>(args)...);
+            }, extra...);
+
+    m.def(asyncName, [op](std::decay_t<Args>... args) -> AsyncOpHandle<OpLock>* {
+                auto opArgs = std::make_tuple(std::move(args)...);
+                return new AsyncOpHandle<OpLock>([op, opArgs]() mutable -> int {
+                            return std::apply(op, opArgs);
+                        });
+            }, extra..., nb::rv_policy::take_ownership);
+}
+
+
+// Registers an op with defNativeOp under name and name_async. The op
+// and its nb::arg annotations are passed through unchanged, so the
+// name must be a string literal.
+#define DEF_NATIVE_OP(m, opLock, name, ...) \
+    defNativeOp<opLock>(m, name, name "_async", __VA_ARGS__)
+
+#endif
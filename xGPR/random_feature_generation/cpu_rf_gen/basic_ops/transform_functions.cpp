@@ -4,12 +4,13 @@
  * Performs fast Hadamard transforms, SORF and SRHT operations on a variety of different
  * array shapes.
  */
+#include <math.h>
 #include <vector>
-#include <thread>
 #include <stdexcept>
 #include "transform_functions.h"
 #include "../shared_fht_functions/hadamard_transforms.h"
 #include "../shared_fht_functions/shared_rfgen_ops.h"
+#include "../shared_fht_functions/thread_pool.h"
 
 namespace nb = nanobind;
 
@@ -47,24 +48,10 @@ int fastHadamard3dArray_(nb::ndarray<T, nb::shape<-1,-1,-1>,
         throw std::runtime_error("last dim not power of 2");
 
 
-    if (numThreads > zDim0)
-        numThreads = zDim0;
-
-    std::vector<std::thread> threads(numThreads);
-    int startPosition, endPosition;
-    int chunkSize = (zDim0 + numThreads - 1) / numThreads;
-
-    for (int i=0; i < numThreads; i++){
-        startPosition = i * chunkSize;
-        endPosition = (i + 1) * chunkSize;
-        if (endPosition > zDim0)
-            endPosition = zDim0;
-        threads[i] = std::thread(&ThreadTransformRows3D<T>, inputPtr, startPosition,
-                                endPosition, zDim1, zDim2);
-    }
-
-    for (auto& th : threads)
-        th.join();
+    RFGenThreadPool::getInstance().parallelForRows(zDim0, numThreads,
+            [&](int startRow, int endRow, int){
+        ThreadTransformRows3D<T>(inputPtr, startRow, endRow, zDim1, zDim2);
+    });
     return 0;
 }
 template int fastHadamard3dArray_<double>(nb::ndarray<double, nb::shape<-1,-1,-1>,
@@ -107,24 +94,10 @@ int fastHadamard2dArray_(nb::ndarray<T, nb::shape<-1,-1>,
     if ((zDim1 & (zDim1 - 1)) != 0)
         throw std::runtime_error("last dim not power of 2");
 
-    if (numThreads > zDim0)
-        numThreads = zDim0;
-
-    std::vector<std::thread> threads(numThreads);
-    int startPosition, endPosition;
-    int chunkSize = (zDim0 + numThreads - 1) / numThreads;
-
-    for (int i=0; i < numThreads; i++){
-        startPosition = i * chunkSize;
-        endPosition = (i + 1) * chunkSize;
-        if (endPosition > zDim0)
-            endPosition = zDim0;
-        threads[i] = std::thread(&ThreadTransformRows2D<T>, inputPtr,
-                        startPosition, endPosition, zDim1);
-    }
-
-    for (auto& th : threads)
-        th.join();
+    RFGenThreadPool::getInstance().parallelForRows(zDim0, numThreads,
+            [&](int startRow, int endRow, int){
+        ThreadTransformRows2D<T>(inputPtr, startRow, endRow, zDim1);
+    });
     return 0;
 }
 template int fastHadamard2dArray_<double>(nb::ndarray<double, nb::shape<-1,-1>,
@@ -176,36 +149,195 @@ int SRHTBlockTransform(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_c
     if ((zDim1 & (zDim1 - 1)) != 0)
         throw std::runtime_error("last dim not power of 2");
 
-    if (numThreads > zDim0)
-        numThreads = zDim0;
+    RFGenThreadPool::getInstance().parallelForRows(zDim0, numThreads,
+            [&](int startRow, int endRow, int){
+        ThreadSRHTRows2D<T>(inputPtr, rademPtr, zDim1, startRow, endRow);
+    });
+    return 0;
+}
+template int SRHTBlockTransform<double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<int8_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> radem,
+        int numThreads);
+template int SRHTBlockTransform<float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<int8_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> radem,
+        int numThreads);
+
+
+
+
+
+
+/*!
+ * # subsampledSRHT_
+ *
+ * Performs the SRHT operation H D1 along the last dimension of the
+ * input array X (zero-padded to the length of radem), where H is a
+ * normalized Hadamard transform and D1 is a diagonal array, but
+ * calculates only the output columns listed in colIdx, which are
+ * written in that order to outputArr. The input array is not modified.
+ *
+ * Each row is split into blocks of length L, each of which is
+ * transformed separately (the first log2(L) stages of the transform);
+ * the selected columns of the full transform are then sums over the
+ * blocks with signs given by the block index. This costs roughly
+ * C log2(L) + M C / L operations per row for M selected columns, and
+ * L is chosen to minimize this, so that when M is much smaller than C
+ * most of the later stages of the transform are never calculated.
+ * Blocks that lie entirely in the zero padding are skipped.
+ *
+ * ## Args:
+ *
+ * + `inputArr` A nanobind reference to a numpy array of shape
+ * (N x D), where D <= C.
+ * + `outputArr` A nanobind reference to a numpy array of shape
+ * (N x M) in which the selected columns are stored.
+ * + `radem` A diagonal array of shape (C) containing int8_t, where
+ * C must be a power of 2.
+ * + `colIdx` An array of shape (M) containing the columns to keep,
+ * each of which must be in [0, C).
+ * + `numThreads` The number of threads to use.
+ */
+template <typename T>
+int subsampledSRHT_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> colIdx,
+        int numThreads){
+
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = inputArr.shape(0);
+    int zDim1 = inputArr.shape(1);
+    int paddedDim = radem.shape(0);
+    int numCols = colIdx.shape(0);
+    T *inputPtr = static_cast<T*>(inputArr.data());
+    T *outputPtr = static_cast<T*>(outputArr.data());
+    int8_t *rademPtr = static_cast<int8_t*>(radem.data());
+    int32_t *colIdxPtr = static_cast<int32_t*>(colIdx.data());
 
-    std::vector<std::thread> threads(numThreads);
-    int startPosition, endPosition;
-    int chunkSize = (zDim0 + numThreads - 1) / numThreads;
+    if (inputArr.shape(0) == 0 || numCols == 0)
+        throw std::runtime_error("no datapoints");
+    if (outputArr.shape(0) != inputArr.shape(0) || outputArr.shape(1) != colIdx.shape(0))
+        throw std::runtime_error("incorrect array dims passed");
+    if (zDim1 > paddedDim || zDim1 == 0)
+        throw std::runtime_error("incorrect array dims passed");
+    if (paddedDim < 2)
+        throw std::runtime_error("last dim not power of 2 > 1");
+    if ((paddedDim & (paddedDim - 1)) != 0)
+        throw std::runtime_error("last dim not power of 2");
+    for (int k = 0; k < numCols; k++){
+        if (colIdxPtr[k] < 0 || colIdxPtr[k] >= paddedDim)
+            throw std::runtime_error("column index out of range");
+    }
 
-    for (int i=0; i < numThreads; i++){
-        startPosition = i * chunkSize;
-        endPosition = (i + 1) * chunkSize;
-        if (endPosition > zDim0)
-            endPosition = zDim0;
-        threads[i] = std::thread(&ThreadSRHTRows2D<T>, inputPtr,
-                rademPtr, zDim1, startPosition, endPosition);
+    int blockSize = getSubsampledSRHTBlockSize(paddedDim, numCols);
+    int log2Block = static_cast<int>(log2(blockSize));
+    int numBlocks = (zDim1 + blockSize - 1) / blockSize;
+    T normConstant = 1 / sqrt(static_cast<T>(paddedDim));
+
+    // Split each selected column into its position within a block and the
+    // sign with which each block contributes to it.
+    std::vector<int32_t> blockPosition(numCols);
+    std::vector<T> blockSigns(static_cast<size_t>(numBlocks) * numCols);
+    for (int k = 0; k < numCols; k++){
+        blockPosition[k] = colIdxPtr[k] & (blockSize - 1);
+        for (int b = 0; b < numBlocks; b++)
+            blockSigns[static_cast<size_t>(b) * numCols + k] =
+                bitParity(b & (colIdxPtr[k] >> log2Block)) ? -1 : 1;
     }
 
-    for (auto& th : threads)
-        th.join();
+    RFGenThreadPool::getInstance().parallelForRows(zDim0, numThreads,
+            [&](int startRow, int endRow, int threadIndex){
+        T *blockBuffer = RFGenThreadPool::getInstance().getScratchBuffer<T>(threadIndex,
+                blockSize);
+
+        for (int i = startRow; i < endRow; i++){
+            T *xRow = inputPtr + static_cast<size_t>(i) * zDim1;
+            T *outRow = outputPtr + static_cast<size_t>(i) * numCols;
+            for (int k = 0; k < numCols; k++)
+                outRow[k] = 0;
+
+            for (int b = 0; b < numBlocks; b++){
+                int blockStart = b * blockSize;
+                int blockEnd = MIN(blockStart + blockSize, zDim1);
+                for (int j = blockStart; j < blockEnd; j++)
+                    blockBuffer[j - blockStart] = xRow[j] * rademPtr[j] * normConstant;
+                for (int j = blockEnd - blockStart; j < blockSize; j++)
+                    blockBuffer[j] = 0;
+
+                transformRows<T>(blockBuffer, 0, 1, 1, blockSize);
+
+                const T *signs = blockSigns.data() + static_cast<size_t>(b) * numCols;
+                #pragma omp simd
+                for (int k = 0; k < numCols; k++)
+                    outRow[k] += signs[k] * blockBuffer[blockPosition[k]];
+            }
+        }
+    });
     return 0;
 }
-template int SRHTBlockTransform<double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+template int subsampledSRHT_<double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> colIdx,
         int numThreads);
-template int SRHTBlockTransform<float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+template int subsampledSRHT_<float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> colIdx,
         int numThreads);
 
 
 
 
+/*!
+ * # getSubsampledSRHTBlockSize
+ *
+ * Chooses the block length L for subsampledSRHT_, the power of 2 that
+ * minimizes the approximate cost C log2(L) + g M C / L of calculating M
+ * columns of a length C transform. The gather term is weighted by
+ * g = SUBSAMPLED_SRHT_GATHER_COST since, unlike the butterfly stages,
+ * it reads the block at scattered positions.
+ */
+int getSubsampledSRHTBlockSize(int paddedDim, int numCols){
+    int bestBlockSize = paddedDim;
+    double bestCost = static_cast<double>(paddedDim) * log2(paddedDim) + numCols;
+
+    for (int blockSize = 2; blockSize < paddedDim; blockSize <<= 1){
+        double cost = static_cast<double>(paddedDim) * log2(blockSize) +
+            SUBSAMPLED_SRHT_GATHER_COST * static_cast<double>(numCols) *
+            (paddedDim / blockSize);
+        if (cost < bestCost){
+            bestCost = cost;
+            bestBlockSize = blockSize;
+        }
+    }
+    return bestBlockSize;
+}
+
+
+
+
+/*!
+ * # bitParity
+ *
+ * Returns 1 if an odd number of bits of x are set, 0 otherwise, which
+ * gives the sign of element (i, j) of a Hadamard matrix for x = i & j.
+ */
+int bitParity(unsigned int x){
+    x ^= x >> 16;
+    x ^= x >> 8;
+    x ^= x >> 4;
+    x ^= x >> 2;
+    x ^= x >> 1;
+    return x & 1;
+}
+
+
+
+
 
 
 /*!
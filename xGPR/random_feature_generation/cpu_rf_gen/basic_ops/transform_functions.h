@@ -7,6 +7,10 @@
 
 namespace nb = nanobind;
 
+// The approximate cost of one step of the gather in subsampledSRHT_
+// relative to one butterfly operation of the Hadamard transform.
+#define SUBSAMPLED_SRHT_GATHER_COST 2.0
+
 
 template <typename T>
 int fastHadamard3dArray_(nb::ndarray<T, nb::shape<-1,-1,-1>,
@@ -22,6 +26,17 @@ int SRHTBlockTransform(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_c
         nb::ndarray<int8_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> radem,
         int numThreads);
 
+template <typename T>
+int subsampledSRHT_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> colIdx,
+        int numThreads);
+
+int getSubsampledSRHTBlockSize(int paddedDim, int numCols);
+
+int bitParity(unsigned int x);
+
 template <typename T>
 void *ThreadSRHTRows2D(T arrayStart[], int8_t* rademArray,
         int dim1, int startPosition, int endPosition);
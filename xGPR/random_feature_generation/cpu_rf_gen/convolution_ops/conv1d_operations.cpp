@@ -5,12 +5,87 @@
  * kernels in xGPR, essentially orthogonal random features based
  * convolution, for non-RBF kernels.
  */
-#include <vector>
-#include <thread>
 #include <math.h>
+#include <vector>
+#include <limits>
+#include <atomic>
+#include <algorithm>
 #include "conv1d_operations.h"
+#include "rbf_convolution.h"
+#include "../rbf_ops/rbf_ops.h"
 #include "../shared_fht_functions/hadamard_transforms.h"
 #include "../shared_fht_functions/shared_rfgen_ops.h"
+#include "../shared_fht_functions/thread_pool.h"
+#include "../shared_fht_functions/token_input.h"
+#include "../shared_fht_functions/sincos_ops.h"
+#include "../../native_profiler.h"
+
+
+
+
+/*!
+ * # convMaxpoolGenRows
+ *
+ * Generates maxpool-based convolution features for all rows once the
+ * caller has checked the inputs. getWindows(row, kmerStart, kmerEnd,
+ * threadIndex) must return a pointer to the input for kmers kmerStart
+ * to kmerEnd of row, with kmer j starting at (j - kmerStart) * zDim2,
+ * so that dense and token-ID inputs can share this routine. The
+ * remaining arguments are as for conv1dMaxpoolFeatureGen_.
+ */
+template <typename T, typename WindowFetcher>
+static void convMaxpoolGenRows(WindowFetcher getWindows, float *outputPtr,
+        int8_t *rademPtr, T *chiPtr, int32_t *seqlengthsPtr, int zDim0,
+        int zDim2, size_t numFreqs, int convWidth, int paddedBufferSize,
+        int numThreads, int kmerCacheSize) {
+    size_t numRffs = numFreqs;
+    int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
+    SORFFunction<T> sorfFunction = getSORFFunction<T>(paddedBufferSize);
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+
+    // Work is split across threads by kmer count rather than by row, since
+    // the cost of each row is proportional to its number of kmers. Rows
+    // that are split between threads are pooled separately (each thread
+    // has at most two) and merged into the output once all threads have
+    // finished.
+    std::vector<int32_t> rowKmers(zDim0);
+    for (int i=0; i < zDim0; i++)
+        rowKmers[i] = seqlengthsPtr[i] - convWidth + 1;
+    int maxThreads = numThreads > 0 ? numThreads : 1;
+    std::vector<float> sharedFeatures(2 * maxThreads * numRffs,
+            std::numeric_limits<float>::lowest());
+    std::vector<int> sharedRows(2 * maxThreads, -1);
+    std::vector<std::unique_ptr<KmerCache<T>>> kmerCaches(maxThreads);
+
+    threadPool.parallelForWeightedRows(rowKmers.data(), zDim0, numThreads,
+            [&](int row, int kmerStart, int kmerEnd, bool sharedRow, int threadIndex){
+        T *copyBuffer = threadPool.getScratchBuffer<T>(threadIndex,
+                paddedBufferSize);
+        if (!kmerCaches[threadIndex])
+            kmerCaches[threadIndex] = makeKmerCache<T>(kmerCacheSize,
+                    convWidth * zDim2, numRepeats * paddedBufferSize);
+        float *featureRow = outputPtr + static_cast<size_t>(row) * numRffs;
+
+        if (sharedRow) {
+            int slot = 2 * threadIndex + (sharedRows[2 * threadIndex] >= 0 ? 1 : 0);
+            sharedRows[slot] = row;
+            featureRow = sharedFeatures.data() + slot * numRffs;
+        }
+        convMaxpoolKmerRange<T>(getWindows(row, kmerStart, kmerEnd, threadIndex),
+                rademPtr, chiPtr, featureRow, 0, 0, kmerEnd - kmerStart, zDim2,
+                numFreqs, convWidth, paddedBufferSize, sorfFunction,
+                copyBuffer, kmerCaches[threadIndex].get());
+    });
+
+    for (size_t slot=0; slot < sharedRows.size(); slot++) {
+        if (sharedRows[slot] < 0)
+            continue;
+        float *outputRow = outputPtr + static_cast<size_t>(sharedRows[slot]) * numRffs;
+        float *featureRow = sharedFeatures.data() + slot * numRffs;
+        for (size_t j=0; j < numRffs; j++)
+            outputRow[j] = MAX(outputRow[j], featureRow[j]);
+    }
+}
 
 
 
@@ -39,6 +114,9 @@
  * + `convWidth` The width of the convolution to perform.
  * + `paddedBufferSize` dim2 of the copy buffer to create to perform
  * the convolution.
+ * + `kmerCacheSize` The maximum number of kmers for which each thread
+ * keeps the SORF output, so that repeated kmers skip the transforms.
+ * 0 disables the cache. See kmer_cache.cpp.
  *
  * ## Returns:
  * "error" if an error, "no_error" otherwise.
@@ -49,7 +127,7 @@ int conv1dMaxpoolFeatureGen_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
         nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        int convWidth, int numThreads) {
+        int convWidth, int numThreads, int kmerCacheSize) {
 
     // Perform safety checks. Any exceptions thrown here are handed off to Python
     // by the Nanobind wrapper. We do not expect the user to see these because
@@ -65,80 +143,474 @@ int conv1dMaxpoolFeatureGen_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu
     int8_t *rademPtr = static_cast<int8_t*>(radem.data());
     int32_t *seqlengthsPtr = static_cast<int32_t*>(seqlengths.data());
 
-    if (inputArr.shape(0) == 0 || outputArr.shape(0) != inputArr.shape(0))
+    if (outputArr.shape(0) != inputArr.shape(0))
         throw std::runtime_error("no datapoints");
     if (numRffs < 2 || (numRffs & 1) != 0)
         throw std::runtime_error("last dim of output must be even number");
-    if ( numFreqs != numRffs || numFreqs > radem.shape(2) )
+    if (numFreqs != numRffs)
         throw std::runtime_error("incorrect number of rffs and or freqs.");
 
-    if (seqlengths.shape(0) != inputArr.shape(0))
-        throw std::runtime_error("wrong array sizes");
-    if (static_cast<int>(inputArr.shape(1)) < convWidth || convWidth <= 0)
-        throw std::runtime_error("invalid conv_width");
-
-    double expectedNFreq = static_cast<double>(convWidth * inputArr.shape(2));
-    expectedNFreq = MAX(expectedNFreq, 2);
-    double log2Freqs = std::log2(expectedNFreq);
-    log2Freqs = std::ceil(log2Freqs);
-    int paddedBufferSize = std::pow(2, log2Freqs);
+    int paddedBufferSize = checkConvInputs(inputArr.shape(0), inputArr.shape(1),
+            inputArr.shape(2), numFreqs, radem.shape(2), seqlengths, convWidth);
     int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
-
-    if (radem.shape(2) % paddedBufferSize != 0 ||
-            radem.shape(2) != numRepeats * paddedBufferSize) {
+    if (radem.shape(2) != numRepeats * paddedBufferSize)
         throw std::runtime_error("incorrect number of rffs and or freqs.");
-    }
 
+    int zDim1 = inputArr.shape(1);
+    int zDim2 = inputArr.shape(2);
 
-    int32_t minSeqLength = 2147483647, maxSeqLength = 0;
-    for (size_t i=0; i < seqlengths.shape(0); i++) {
-        if (seqlengths(i) > maxSeqLength)
-            maxSeqLength = seqlengths(i);
-        if (seqlengths(i) < minSeqLength)
-            minSeqLength = seqlengths(i);
-    }
+    PROFILE_COUNT(PROFILE_BYTES, inputArr.nbytes() + outputArr.nbytes());
+    convMaxpoolGenRows<T>([&](int row, int kmerStart, int, int){
+                return inputPtr + (static_cast<size_t>(row) * zDim1 + kmerStart) * zDim2;
+            }, outputPtr, rademPtr, chiPtr, seqlengthsPtr, zDim0, zDim2,
+            numFreqs, convWidth, paddedBufferSize, numThreads, kmerCacheSize);
 
-    if (maxSeqLength > static_cast<int32_t>(inputArr.shape(1)) || minSeqLength < convWidth) {
-        throw std::runtime_error("All sequence lengths must be >= conv width and < "
-                "array size.");
-    }
+    return 0;
+}
+template int conv1dMaxpoolFeatureGen_<double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int numThreads, int kmerCacheSize);
+template int conv1dMaxpoolFeatureGen_<float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int numThreads, int kmerCacheSize);
 
-    if (numThreads > zDim0)
-        numThreads = zDim0;
-
-    std::vector<std::thread> threads(numThreads);
-    int startRow, endRow;
-    int chunkSize = (zDim0 + numThreads - 1) / numThreads;
-    
-    for (int i=0; i < numThreads; i++) {
-        startRow = i * chunkSize;
-        endRow = (i + 1) * chunkSize;
-        if (endRow > zDim0)
-            endRow = zDim0;
-
-        threads[i] = std::thread(&allInOneConvMaxpoolGen<T>, inputPtr,
-                rademPtr, chiPtr, outputPtr, seqlengthsPtr, inputArr.shape(1),
-                inputArr.shape(2), numFreqs, startRow, endRow, convWidth,
-                paddedBufferSize);
-    }
 
-    for (auto& th : threads)
-        th.join();
+
+/*!
+ * # conv1dTokenMaxpoolFeatureGen_
+ *
+ * As for conv1dMaxpoolFeatureGen_, but the input is supplied as token
+ * IDs together with an embedding table, rather than as a dense
+ * (N x D x C) array. Each window is expanded from the embedding table
+ * only when it is needed, so the dense array is never built. As for
+ * the RBF token ops, this is exposed by the extension only.
+ *
+ * ## Args:
+ *
+ * + `tokenArr` The (N x D) array of token IDs, of type K.
+ * + `embeddingArr` The (V x C) array whose row t is the encoding of token
+ * t, or a (0 x C) array for one-hot input, as for convRBFTokenFeatureGen_.
+ *
+ * The remaining arguments are as for conv1dMaxpoolFeatureGen_.
+ */
+template <typename K, typename T>
+int conv1dTokenMaxpoolFeatureGen_(nb::ndarray<K, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int numThreads, int kmerCacheSize) {
+
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = tokenArr.shape(0);
+    size_t numRffs = outputArr.shape(1);
+    size_t numFreqs = chiArr.shape(0);
+
+    K *tokenPtr = static_cast<K*>(tokenArr.data());
+    float *outputPtr = static_cast<float*>(outputArr.data());
+    T *chiPtr = static_cast<T*>(chiArr.data());
+    int8_t *rademPtr = static_cast<int8_t*>(radem.data());
+    int32_t *seqlengthsPtr = static_cast<int32_t*>(seqlengths.data());
+
+    if (outputArr.shape(0) != tokenArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numRffs < 2 || (numRffs & 1) != 0)
+        throw std::runtime_error("last dim of output must be even number");
+    if (numFreqs != numRffs)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    if (embeddingArr.shape(1) == 0)
+        throw std::runtime_error("wrong array sizes");
+    int paddedBufferSize = checkConvInputs(tokenArr.shape(0), tokenArr.shape(1),
+            embeddingArr.shape(1), numFreqs, radem.shape(2), seqlengths, convWidth);
+    int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
+    if (radem.shape(2) != numRepeats * paddedBufferSize)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    // An embedding table with no rows stands for the (C x C) identity,
+    // i.e. one-hot input, which is then expanded without a lookup.
+    bool oneHotInput = (embeddingArr.shape(0) == 0);
+    int vocabSize = oneHotInput ? embeddingArr.shape(1) : embeddingArr.shape(0);
+    T *embeddingPtr = oneHotInput ? NULL : static_cast<T*>(embeddingArr.data());
+
+    int zDim1 = tokenArr.shape(1);
+    int zDim2 = embeddingArr.shape(1);
+    if (!tokensInRange<K>(tokenPtr, seqlengthsPtr, zDim0, zDim1, vocabSize))
+        throw std::runtime_error("token ids must be valid rows of the embedding table");
+
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+
+    PROFILE_COUNT(PROFILE_BYTES, tokenArr.nbytes() + embeddingArr.nbytes() +
+            outputArr.nbytes());
+    convMaxpoolGenRows<T>([&](int row, int kmerStart, int kmerEnd, int threadIndex){
+                int numPositions = kmerEnd - kmerStart + convWidth - 1;
+                T *windows = threadPool.getScratchBuffer<T>(threadIndex,
+                        static_cast<size_t>(numPositions) * zDim2,
+                        TOKEN_WINDOW_SCRATCH_SLOT);
+                expandTokenWindows<K, T>(tokenPtr + static_cast<size_t>(row) * zDim1 + kmerStart,
+                        embeddingPtr, windows, numPositions, zDim2);
+                return windows;
+            }, outputPtr, rademPtr, chiPtr, seqlengthsPtr, zDim0, zDim2,
+            numFreqs, convWidth, paddedBufferSize, numThreads, kmerCacheSize);
 
     return 0;
 }
-template int conv1dMaxpoolFeatureGen_<double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+template int conv1dTokenMaxpoolFeatureGen_<uint8_t, double>(nb::ndarray<uint8_t, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
         nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
         nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        int convWidth, int numThreads);
-template int conv1dMaxpoolFeatureGen_<float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        int convWidth, int numThreads, int kmerCacheSize);
+template int conv1dTokenMaxpoolFeatureGen_<uint8_t, float>(nb::ndarray<uint8_t, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
         nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
         nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        int convWidth, int numThreads);
+        int convWidth, int numThreads, int kmerCacheSize);
+template int conv1dTokenMaxpoolFeatureGen_<int16_t, double>(nb::ndarray<int16_t, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int numThreads, int kmerCacheSize);
+template int conv1dTokenMaxpoolFeatureGen_<int16_t, float>(nb::ndarray<int16_t, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int numThreads, int kmerCacheSize);
+
+
+
+/*!
+ * # convTwoLayerGenRows
+ *
+ * Runs the two-layer (maxpool convolution followed by RBF) feature
+ * generation once the caller has checked the inputs. Each thread
+ * claims blocks of TWO_LAYER_BLOCK_ROWS rows in turn, pools the first
+ * layer features for the block into its own scratch buffer, and then
+ * calls secondLayer(pooled, startRow, endRow, copyBuffer, threadIndex)
+ * to generate the output for those rows from the pooled features, so
+ * the full (N x numInitFreqs) intermediate array is never stored.
+ * Rows are claimed dynamically since their cost is proportional to
+ * their number of kmers. copyBuffer holds copyBufferSize elements and
+ * is shared by both layers, which use it one after the other.
+ */
+template <typename T, typename SecondLayer>
+static void convTwoLayerGenRows(SecondLayer secondLayer, T *inputPtr,
+        int8_t *rademPtr, T *chiPtr, int32_t *seqlengthsPtr, int zDim0,
+        int zDim1, int zDim2, int numInitFreqs, int convWidth,
+        int paddedBufferSize, size_t copyBufferSize, int numThreads,
+        int kmerCacheSize) {
+    int numRepeats = (numInitFreqs + paddedBufferSize - 1) / paddedBufferSize;
+    int numBlocks = (zDim0 + TWO_LAYER_BLOCK_ROWS - 1) / TWO_LAYER_BLOCK_ROWS;
+    numThreads = MAX(MIN(numThreads, numBlocks), 1);
+
+    SORFFunction<T> sorfFunction = getSORFFunction<T>(paddedBufferSize);
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+    std::vector<std::unique_ptr<KmerCache<T>>> kmerCaches(numThreads);
+    std::atomic<int> nextBlock(0);
+
+    threadPool.run(numThreads, [&](int threadIndex){
+        T *copyBuffer = threadPool.getScratchBuffer<T>(threadIndex,
+                copyBufferSize);
+        float *pooled = threadPool.getScratchBuffer<float>(threadIndex,
+                static_cast<size_t>(TWO_LAYER_BLOCK_ROWS) * numInitFreqs,
+                TWO_LAYER_POOLED_SCRATCH_SLOT);
+        kmerCaches[threadIndex] = makeKmerCache<T>(kmerCacheSize,
+                convWidth * zDim2, numRepeats * paddedBufferSize);
+
+        for (int block = nextBlock++; block < numBlocks; block = nextBlock++) {
+            int startRow = block * TWO_LAYER_BLOCK_ROWS;
+            int endRow = MIN(startRow + TWO_LAYER_BLOCK_ROWS, zDim0);
+
+            // The pooled features start from zero, as for conv1dMaxpoolFeatureGen_
+            // with a zero-initialized output array.
+            std::fill(pooled, pooled + static_cast<size_t>(endRow - startRow) *
+                    numInitFreqs, 0.0f);
+            for (int i=startRow; i < endRow; i++) {
+                convMaxpoolKmerRange<T>(inputPtr + static_cast<size_t>(i) * zDim1 * zDim2,
+                        rademPtr, chiPtr, pooled, i - startRow, 0,
+                        seqlengthsPtr[i] - convWidth + 1, zDim2, numInitFreqs,
+                        convWidth, paddedBufferSize, sorfFunction,
+                        copyBuffer, kmerCaches[threadIndex].get());
+            }
+            secondLayer(pooled, startRow, endRow, copyBuffer, threadIndex);
+        }
+    });
+}
+
+
+
+
+/*!
+ * # checkTwoLayerInputs
+ *
+ * Performs the safety checks shared by conv1dTwoLayerFeatureGen_ and
+ * conv1dTwoLayerGrad_ and returns the padded buffer sizes for the first
+ * layer and for the RBF layer. The arguments are as for
+ * conv1dTwoLayerFeatureGen_; numRffs is the last dimension of the output.
+ */
+template <typename T>
+static std::pair<int, int> checkTwoLayerInputs(
+        nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> &inputArr,
+        size_t numRows, size_t numRffs,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> &initRadem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> &initChiArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> &radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> &chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> &seqlengths,
+        int convWidth) {
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    size_t numInitFreqs = initChiArr.shape(0);
+    size_t numFreqs = chiArr.shape(0);
+
+    if (numRows != inputArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numRffs < 2 || (numRffs & 1) != 0)
+        throw std::runtime_error("last dim of output must be even number");
+    if ( (2 * numFreqs) != numRffs || numFreqs > radem.shape(2) )
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+    if (numInitFreqs < 2)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    int initPaddedSize = checkConvInputs(inputArr.shape(0), inputArr.shape(1),
+            inputArr.shape(2), numInitFreqs, initRadem.shape(2), seqlengths,
+            convWidth);
+    int numRepeats = (numInitFreqs + initPaddedSize - 1) / initPaddedSize;
+    if (initRadem.shape(2) != static_cast<size_t>(numRepeats * initPaddedSize))
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    double expectedNFreq = MAX(static_cast<double>(numInitFreqs), 2);
+    int paddedBufferSize = std::pow(2, std::ceil(std::log2(expectedNFreq)));
+    if (radem.shape(2) % paddedBufferSize != 0)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    return std::make_pair(initPaddedSize, paddedBufferSize);
+}
+
+
+
+
+/*!
+ * # conv1dTwoLayerFeatureGen_
+ *
+ * Generates features for the two-layer convolution kernel: maxpool
+ * convolution features for each sequence, which are multiplied by
+ * sigma and used as the input for RBF features, in a single pass.
+ * This is equivalent to calling conv1dMaxpoolFeatureGen_ with a
+ * zero-initialized output, multiplying the result by sigma and calling
+ * rbfFeatureGen_ on it, but the intermediate features for each block
+ * of rows stay in the calling thread's scratch buffer.
+ *
+ * ## Args:
+ *
+ * + `inputArr` The raw input 3d array, of shape (N x D x K).
+ * + `outputArr` The (N x R) array in which the RBF features are stored,
+ * where R is 2x the number of RBF frequencies.
+ * + `initRadem` The (3 x 1 x m * C) stack of diagonal matrices for the
+ * first layer, as for conv1dMaxpoolFeatureGen_.
+ * + `initChiArr` The (F) diagonal array for the first layer, where F
+ * is the number of first layer features.
+ * + `radem` The (3 x 1 x M) stack of diagonal matrices for the RBF layer,
+ * where M is a multiple of the smallest power of 2 >= F.
+ * + `chiArr` The (R / 2) diagonal array for the RBF layer.
+ * + `seqlengths` The length of each sequence in the input. Of shape (N).
+ * + `convWidth` The width of the convolution to perform.
+ * + `sigma` The kernel hyperparameter by which the first layer features
+ * are multiplied.
+ * + `numThreads` The number of threads to use.
+ * + `kmerCacheSize` As for conv1dMaxpoolFeatureGen_.
+ * + `fitIntercept` If True, a y-intercept will be fitted.
+ * + `precisionMode` One of "exact" or "fast"; see sincos_ops.cpp.
+ */
+template <typename T>
+int conv1dTwoLayerFeatureGen_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> initRadem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> initChiArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, float sigma, int numThreads, int kmerCacheSize,
+        bool fitIntercept, const std::string &precisionMode) {
+    size_t numRffs = outputArr.shape(1);
+    std::pair<int, int> paddedSizes = checkTwoLayerInputs<T>(inputArr,
+            outputArr.shape(0), numRffs, initRadem, initChiArr, radem, chiArr,
+            seqlengths, convWidth);
+    int initPaddedSize = paddedSizes.first, paddedBufferSize = paddedSizes.second;
+
+    int numInitFreqs = initChiArr.shape(0);
+    int numFreqs = chiArr.shape(0);
+    int rademShape2 = radem.shape(2);
+    double *outputPtr = static_cast<double*>(outputArr.data());
+    int8_t *rademPtr = static_cast<int8_t*>(radem.data());
+    T *chiPtr = static_cast<T*>(chiArr.data());
+
+    T rbfNormConstant;
+    if (fitIntercept)
+        rbfNormConstant = std::sqrt(1.0 / (static_cast<double>(numFreqs) - 0.5));
+    else
+        rbfNormConstant = std::sqrt(1.0 / static_cast<double>(numFreqs));
+
+    int sincosMode = getSinCosMode(precisionMode);
+    SORFFunction<T> sorfFunction = getSORFFunction<T>(paddedBufferSize);
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+    T scaling = sigma;
+
+    convTwoLayerGenRows<T>([&](const float *pooled, int startRow, int endRow,
+                T *copyBuffer, int threadIndex){
+                size_t numElements = static_cast<size_t>(endRow - startRow) * numInitFreqs;
+                T *rbfInput = threadPool.getScratchBuffer<T>(threadIndex,
+                        numElements, TWO_LAYER_INPUT_SCRATCH_SLOT);
+                for (size_t i=0; i < numElements; i++)
+                    rbfInput[i] = static_cast<T>(pooled[i]) * scaling;
+
+                allInOneRBFGen<T, double>(rbfInput, rademPtr, chiPtr,
+                        outputPtr + static_cast<size_t>(startRow) * numRffs,
+                        numInitFreqs, numFreqs, rademShape2, 0, endRow - startRow,
+                        paddedBufferSize, rbfNormConstant, sincosMode,
+                        sorfFunction, copyBuffer);
+            }, static_cast<T*>(inputArr.data()), static_cast<int8_t*>(initRadem.data()),
+            static_cast<T*>(initChiArr.data()), static_cast<int32_t*>(seqlengths.data()),
+            inputArr.shape(0), inputArr.shape(1), inputArr.shape(2), numInitFreqs,
+            convWidth, initPaddedSize, MAX(static_cast<size_t>(initPaddedSize),
+                static_cast<size_t>(getRBFGenBufferSize(paddedBufferSize))),
+            numThreads, kmerCacheSize);
+
+    return 0;
+}
+template int conv1dTwoLayerFeatureGen_<double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> initRadem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> initChiArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, float sigma, int numThreads, int kmerCacheSize,
+        bool fitIntercept, const std::string &precisionMode);
+template int conv1dTwoLayerFeatureGen_<float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> initRadem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> initChiArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, float sigma, int numThreads, int kmerCacheSize,
+        bool fitIntercept, const std::string &precisionMode);
+
+
+
+
+/*!
+ * # conv1dTwoLayerGrad_
+ *
+ * As for conv1dTwoLayerFeatureGen_, but also generates the gradient of
+ * the RBF features with respect to sigma, as rbfGrad_ does when called
+ * on the (unscaled) first layer features.
+ *
+ * ## Args:
+ *
+ * + `gradArr` The (N x R x 1) array in which the gradient is stored.
+ *
+ * The remaining arguments are as for conv1dTwoLayerFeatureGen_.
+ */
+template <typename T>
+int conv1dTwoLayerGrad_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> initRadem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> initChiArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, float sigma, int numThreads, int kmerCacheSize,
+        bool fitIntercept, const std::string &precisionMode) {
+    size_t numRffs = outputArr.shape(1);
+    std::pair<int, int> paddedSizes = checkTwoLayerInputs<T>(inputArr,
+            outputArr.shape(0), numRffs, initRadem, initChiArr, radem, chiArr,
+            seqlengths, convWidth);
+    int initPaddedSize = paddedSizes.first, paddedBufferSize = paddedSizes.second;
+    if (gradArr.shape(0) != outputArr.shape(0) || gradArr.shape(1) != outputArr.shape(1))
+        throw std::runtime_error("Wrong array sizes.");
+
+    int numInitFreqs = initChiArr.shape(0);
+    int numFreqs = chiArr.shape(0);
+    int rademShape2 = radem.shape(2);
+    double *outputPtr = static_cast<double*>(outputArr.data());
+    double *gradientPtr = static_cast<double*>(gradArr.data());
+    int8_t *rademPtr = static_cast<int8_t*>(radem.data());
+    T *chiPtr = static_cast<T*>(chiArr.data());
+
+    T rbfNormConstant;
+    if (fitIntercept)
+        rbfNormConstant = std::sqrt(1.0 / (static_cast<double>(numFreqs) - 0.5));
+    else
+        rbfNormConstant = std::sqrt(1.0 / static_cast<double>(numFreqs));
+
+    int sincosMode = getSinCosMode(precisionMode);
+    SORFFunction<T> sorfFunction = getSORFFunction<T>(paddedBufferSize);
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+
+    convTwoLayerGenRows<T>([&](const float *pooled, int startRow, int endRow,
+                T *copyBuffer, int threadIndex){
+                size_t numElements = static_cast<size_t>(endRow - startRow) * numInitFreqs;
+                T *rbfInput = threadPool.getScratchBuffer<T>(threadIndex,
+                        numElements, TWO_LAYER_INPUT_SCRATCH_SLOT);
+                for (size_t i=0; i < numElements; i++)
+                    rbfInput[i] = pooled[i];
+
+                allInOneRBFGrad<T, double>(rbfInput, rademPtr, chiPtr,
+                        outputPtr + static_cast<size_t>(startRow) * numRffs,
+                        gradientPtr + static_cast<size_t>(startRow) * numRffs,
+                        numInitFreqs, numFreqs, rademShape2, 0, endRow - startRow,
+                        paddedBufferSize, rbfNormConstant, sigma, sincosMode,
+                        sorfFunction, copyBuffer);
+            }, static_cast<T*>(inputArr.data()), static_cast<int8_t*>(initRadem.data()),
+            static_cast<T*>(initChiArr.data()), static_cast<int32_t*>(seqlengths.data()),
+            inputArr.shape(0), inputArr.shape(1), inputArr.shape(2), numInitFreqs,
+            convWidth, initPaddedSize, MAX(initPaddedSize, paddedBufferSize),
+            numThreads, kmerCacheSize);
+
+    return 0;
+}
+template int conv1dTwoLayerGrad_<double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> initRadem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> initChiArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, float sigma, int numThreads, int kmerCacheSize,
+        bool fitIntercept, const std::string &precisionMode);
+template int conv1dTwoLayerGrad_<float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> initRadem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> initChiArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, float sigma, int numThreads, int kmerCacheSize,
+        bool fitIntercept, const std::string &precisionMode);
 
 
 
@@ -146,46 +618,88 @@ template int conv1dMaxpoolFeatureGen_<float>(nb::ndarray<float, nb::shape<-1,-1,
  * # allInOneConvMaxpoolGen
  *
  * Performs the maxpool-based convolution kernel feature generation
- * process for the input, for one thread.
+ * process for the input, for one thread. copyBuffer is the
+ * calling thread's scratch buffer and must be of size
+ * paddedBufferSize; sorfFunction is the SORF routine for
+ * that size, as returned by getSORFFunction. kmerCache is the
+ * calling thread's kmer cache, or NULL if caching is disabled.
  */
 template <typename T>
 void *allInOneConvMaxpoolGen(T xdata[], int8_t *rademArray, T chiArr[],
         float *outputArray, int32_t *seqlengths, int dim1, int dim2,
         int numFreqs, int startRow, int endRow,
-        int convWidth, int paddedBufferSize) {
+        int convWidth, int paddedBufferSize, SORFFunction<T> sorfFunction,
+        T *copyBuffer, KmerCache<T> *kmerCache) {
+    for (int i=startRow; i < endRow; i++) {
+        int numKmers = seqlengths[i] - convWidth + 1;
+        convMaxpoolKmerRange<T>(xdata + static_cast<size_t>(i) * dim1 * dim2,
+                rademArray, chiArr, outputArray, i, 0, numKmers, dim2,
+                numFreqs, convWidth, paddedBufferSize, sorfFunction,
+                copyBuffer, kmerCache);
+    }
+    return NULL;
+}
+
+
+
+
+/*!
+ * # convMaxpoolKmerRange
+ *
+ * Performs maxpool-based convolution feature generation for kmers
+ * kmerStart to kmerEnd of a single sequence, pooling the results into
+ * row rowNumber of outputArray. Since the pooling is a max, a sequence
+ * can be split into several ranges (e.g. across threads) and the
+ * results merged with an elementwise max.
+ *
+ * ## Args:
+ *
+ * + `xrow` Pointer to the first element of the sequence (D x C).
+ * + `outputArray` The array into which the features are pooled.
+ * + `rowNumber` The row of outputArray to use.
+ * + `kmerStart` The first kmer to process.
+ * + `kmerEnd` One past the last kmer to process.
+ *
+ * The remaining arguments are as for allInOneConvMaxpoolGen.
+ */
+template <typename T>
+void convMaxpoolKmerRange(T xrow[], int8_t *rademArray, T chiArr[],
+        float *outputArray, int rowNumber, int kmerStart, int kmerEnd,
+        int dim2, int numFreqs, int convWidth, int paddedBufferSize,
+        SORFFunction<T> sorfFunction, T *copyBuffer,
+        KmerCache<T> *kmerCache) {
     int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
     int rademShape2 = numRepeats * paddedBufferSize;
-    //Notice that we don't have error handling here...very naughty. Out of
-    //memory should be extremely rare since we are only allocating memory
-    //for one row of the convolution. TODO: add error handling here.
-    T *copyBuffer = new T[paddedBufferSize];
     T *xElement;
+    PROFILE_LAP_START(profileLap);
+
+    for (int j=kmerStart; j < kmerEnd; j++) {
+        int repeatPosition = 0;
+        xElement = xrow + j * dim2;
+        const T *cachedSORF = NULL;
+        T *newEntry = NULL;
+        if (kmerCache != NULL) {
+            cachedSORF = kmerCache->lookup(xElement);
+            if (cachedSORF == NULL)
+                newEntry = kmerCache->insert(xElement);
+        }
 
-    for (int i=startRow; i < endRow; i++) {
-        int seqlength = seqlengths[i];
-        int numKmers = seqlength - convWidth + 1;
-
-        for (int j=0; j < numKmers; j++) {
-            int repeatPosition = 0;
-            xElement = xdata + i * dim1 * dim2 + j * dim2;
-
-            for (int k=0; k < numRepeats; k++) {
-                for (int m=0; m < (convWidth * dim2); m++)
-                    copyBuffer[m] = xElement[m];
-                for (int m=(convWidth * dim2); m < paddedBufferSize; m++)
-                    copyBuffer[m] = 0;
-
-                singleVectorSORF(copyBuffer, rademArray, repeatPosition,
-                        rademShape2, paddedBufferSize);
-                singleVectorMaxpoolPostProcess(copyBuffer, chiArr, outputArray,
-                        paddedBufferSize, numFreqs, i, k);
-                repeatPosition += paddedBufferSize;
+        for (int k=0; k < numRepeats; k++) {
+            const T *sorfOutput = copyBuffer;
+            if (cachedSORF != NULL)
+                sorfOutput = cachedSORF + repeatPosition;
+            else {
+                computeKmerSORF(xElement, copyBuffer, newEntry, rademArray,
+                        repeatPosition, rademShape2, convWidth * dim2,
+                        paddedBufferSize, sorfFunction);
             }
+            PROFILE_LAP(profileLap, PROFILE_FHT);
+            singleVectorMaxpoolPostProcess(sorfOutput, chiArr, outputArray,
+                    paddedBufferSize, numFreqs, rowNumber, k);
+            PROFILE_LAP(profileLap, PROFILE_POSTPROCESS);
+            repeatPosition += paddedBufferSize;
         }
     }
-    delete[] copyBuffer;
-
-    return NULL;
 }
 
 
@@ -3,14 +3,26 @@
 
 
 #include <stdint.h>
+#include <string>
 #include <nanobind/nanobind.h>
 #include <nanobind/ndarray.h>
+#include "../shared_fht_functions/kmer_cache.h"
+#include "../shared_fht_functions/shared_rfgen_ops.h"
 
 namespace nb = nanobind;
 
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 
+// The two-layer ops pool the first layer features for this many rows at
+// a time before running the RBF layer on them, so that the RBF layer can
+// use the batched SORF path (see allInOneRBFGen).
+#define TWO_LAYER_BLOCK_ROWS SORF_BATCH_ROWS
+// The scratch slots the two-layer ops use for the pooled first layer
+// features and for their (scaled) copy in the input type.
+#define TWO_LAYER_POOLED_SCRATCH_SLOT 1
+#define TWO_LAYER_INPUT_SCRATCH_SLOT 2
+
 
 template <typename T>
 int conv1dMaxpoolFeatureGen_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
@@ -18,13 +30,53 @@ int conv1dMaxpoolFeatureGen_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
         nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        int convWidth, int numThreads);
+        int convWidth, int numThreads, int kmerCacheSize);
+
+template <typename K, typename T>
+int conv1dTokenMaxpoolFeatureGen_(nb::ndarray<K, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int numThreads, int kmerCacheSize);
+
+template <typename T>
+int conv1dTwoLayerFeatureGen_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> initRadem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> initChiArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, float sigma, int numThreads, int kmerCacheSize,
+        bool fitIntercept, const std::string &precisionMode);
+
+template <typename T>
+int conv1dTwoLayerGrad_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> initRadem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> initChiArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, float sigma, int numThreads, int kmerCacheSize,
+        bool fitIntercept, const std::string &precisionMode);
 
 template <typename T>
 void *allInOneConvMaxpoolGen(T xdata[], int8_t *rademArray, T chiArr[],
         float *outputArray, int32_t *seqlengths, int dim1, int dim2,
         int numFreqs, int startRow, int endRow,
-        int convWidth, int paddedBufferSize);
+        int convWidth, int paddedBufferSize, SORFFunction<T> sorfFunction,
+        T *copyBuffer, KmerCache<T> *kmerCache);
+
+template <typename T>
+void convMaxpoolKmerRange(T xrow[], int8_t *rademArray, T chiArr[],
+        float *outputArray, int rowNumber, int kmerStart, int kmerEnd,
+        int dim2, int numFreqs, int convWidth, int paddedBufferSize,
+        SORFFunction<T> sorfFunction, T *copyBuffer,
+        KmerCache<T> *kmerCache);
 
 template <typename T>
 void singleVectorMaxpoolPostProcess(const T xdata[],
@@ -4,12 +4,197 @@
  * This module performs operations unique to the RBF-based convolution
  * kernels in xGPR.
  */
-#include <thread>
-#include <vector>
 #include <math.h>
+#include <vector>
+#include <type_traits>
 #include "rbf_convolution.h"
 #include "../shared_fht_functions/hadamard_transforms.h"
 #include "../shared_fht_functions/shared_rfgen_ops.h"
+#include "../shared_fht_functions/thread_pool.h"
+#include "../shared_fht_functions/design_matrix_ops.h"
+#include "../shared_fht_functions/sincos_ops.h"
+#include "../shared_fht_functions/kmer_cache.h"
+#include "../shared_fht_functions/token_input.h"
+#include "../../native_profiler.h"
+
+
+
+
+/*!
+ * # convRBFGenRows
+ *
+ * Generates RBF-based convolution features for all rows once the
+ * caller has checked the inputs. getWindows(row, kmerStart, kmerEnd,
+ * threadIndex) must return a pointer to the input for kmers kmerStart
+ * to kmerEnd of row, with kmer j starting at (j - kmerStart) * zDim2,
+ * so that dense and token-ID inputs can share this routine. The
+ * remaining arguments are as for convRBFFeatureGen_.
+ */
+template <typename T, typename U, typename WindowFetcher>
+static void convRBFGenRows(WindowFetcher getWindows, U *outputPtr,
+        int8_t *rademPtr, T *chiPtr, int32_t *seqlengthsPtr, int zDim0,
+        int zDim2, size_t numFreqs, int rademShape2, int convWidth,
+        int paddedBufferSize, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize) {
+    size_t numRffs = 2 * numFreqs;
+    double scalingTerm = std::sqrt(1.0 / static_cast<double>(numFreqs));
+    int sincosMode = getSinCosMode(precisionMode);
+    SORFFunction<T> sorfFunction = getSORFFunction<T>(paddedBufferSize);
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+
+    // Work is split across threads by kmer count rather than by row, since
+    // the cost of each row is proportional to its number of kmers. Rows
+    // that are split between threads are accumulated separately (each
+    // thread has at most two) and added to the output once all threads
+    // have finished.
+    std::vector<int32_t> rowKmers(zDim0);
+    for (int i=0; i < zDim0; i++)
+        rowKmers[i] = seqlengthsPtr[i] - convWidth + 1;
+    int maxThreads = numThreads > 0 ? numThreads : 1;
+    std::vector<double> sharedFeatures(2 * maxThreads * numRffs, 0);
+    std::vector<int> sharedRows(2 * maxThreads, -1);
+    std::vector<std::unique_ptr<KmerCache<T>>> kmerCaches(maxThreads);
+
+    threadPool.parallelForWeightedRows(rowKmers.data(), zDim0, numThreads,
+            [&](int row, int kmerStart, int kmerEnd, bool sharedRow, int threadIndex){
+        T *copyBuffer = threadPool.getScratchBuffer<T>(threadIndex,
+                paddedBufferSize);
+        if (!kmerCaches[threadIndex])
+            kmerCaches[threadIndex] = makeKmerCache<T>(kmerCacheSize,
+                    convWidth * zDim2, rademShape2);
+        U *outputRow = outputPtr + static_cast<size_t>(row) * numRffs;
+        double *featureRow;
+
+        if (sharedRow) {
+            int slot = 2 * threadIndex + (sharedRows[2 * threadIndex] >= 0 ? 1 : 0);
+            sharedRows[slot] = row;
+            featureRow = sharedFeatures.data() + slot * numRffs;
+        } else if constexpr (std::is_same<U, double>::value) {
+            featureRow = outputRow;
+        } else {
+            // Sum over the kmers for each row in double precision, then
+            // add the result to the lower-precision output.
+            featureRow = threadPool.getScratchBuffer<double>(threadIndex,
+                    numRffs, 1);
+            for (size_t j=0; j < numRffs; j++)
+                featureRow[j] = 0;
+        }
+
+        convRBFKmerRangeGen<T>(getWindows(row, kmerStart, kmerEnd, threadIndex),
+                rademPtr, chiPtr, featureRow, 0, rowKmers[row], 0,
+                kmerEnd - kmerStart, zDim2, numFreqs, rademShape2, convWidth,
+                paddedBufferSize, scalingTerm, scalingType, sincosMode,
+                sorfFunction, copyBuffer, kmerCaches[threadIndex].get());
+
+        if constexpr (!std::is_same<U, double>::value) {
+            if (!sharedRow) {
+                for (size_t j=0; j < numRffs; j++)
+                    outputRow[j] += featureRow[j];
+            }
+        }
+    });
+
+    for (size_t slot=0; slot < sharedRows.size(); slot++) {
+        if (sharedRows[slot] < 0)
+            continue;
+        U *outputRow = outputPtr + static_cast<size_t>(sharedRows[slot]) * numRffs;
+        double *featureRow = sharedFeatures.data() + slot * numRffs;
+        for (size_t j=0; j < numRffs; j++)
+            outputRow[j] += featureRow[j];
+    }
+}
+
+
+
+
+/*!
+ * # convRBFGradRows
+ *
+ * As for convRBFGenRows, but also calculates the gradient, which is
+ * added to gradientPtr. The remaining arguments are as for convRBFGrad_.
+ */
+template <typename T, typename U, typename WindowFetcher>
+static void convRBFGradRows(WindowFetcher getWindows, U *outputPtr,
+        U *gradientPtr, int8_t *rademPtr, T *chiPtr, int32_t *seqlengthsPtr,
+        int zDim0, int zDim2, size_t numFreqs, int rademShape2,
+        int convWidth, int paddedBufferSize, double sigma, int scalingType,
+        int numThreads, const std::string &precisionMode, int kmerCacheSize) {
+    size_t numRffs = 2 * numFreqs;
+    double scalingTerm = std::sqrt(1.0 / static_cast<double>(numFreqs));
+    int sincosMode = getSinCosMode(precisionMode);
+    SORFFunction<T> sorfFunction = getSORFFunction<T>(paddedBufferSize);
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+
+    // Work is split across threads by kmer count, as for
+    // convRBFGenRows; see that function for details.
+    std::vector<int32_t> rowKmers(zDim0);
+    for (int i=0; i < zDim0; i++)
+        rowKmers[i] = seqlengthsPtr[i] - convWidth + 1;
+    int maxThreads = numThreads > 0 ? numThreads : 1;
+    std::vector<double> sharedFeatures(2 * maxThreads * numRffs, 0);
+    std::vector<double> sharedGradients(2 * maxThreads * numRffs, 0);
+    std::vector<int> sharedRows(2 * maxThreads, -1);
+    std::vector<std::unique_ptr<KmerCache<T>>> kmerCaches(maxThreads);
+
+    threadPool.parallelForWeightedRows(rowKmers.data(), zDim0, numThreads,
+            [&](int row, int kmerStart, int kmerEnd, bool sharedRow, int threadIndex){
+        T *copyBuffer = threadPool.getScratchBuffer<T>(threadIndex,
+                paddedBufferSize);
+        if (!kmerCaches[threadIndex])
+            kmerCaches[threadIndex] = makeKmerCache<T>(kmerCacheSize,
+                    convWidth * zDim2, rademShape2);
+        U *outputRow = outputPtr + static_cast<size_t>(row) * numRffs;
+        U *gradientRowOut = gradientPtr + static_cast<size_t>(row) * numRffs;
+        double *featureRow, *gradientRow;
+
+        if (sharedRow) {
+            int slot = 2 * threadIndex + (sharedRows[2 * threadIndex] >= 0 ? 1 : 0);
+            sharedRows[slot] = row;
+            featureRow = sharedFeatures.data() + slot * numRffs;
+            gradientRow = sharedGradients.data() + slot * numRffs;
+        } else if constexpr (std::is_same<U, double>::value) {
+            featureRow = outputRow;
+            gradientRow = gradientRowOut;
+        } else {
+            // Sum over the kmers for each row in double precision, then
+            // add the result to the lower-precision output and gradient.
+            featureRow = threadPool.getScratchBuffer<double>(threadIndex,
+                    numRffs, 1);
+            gradientRow = threadPool.getScratchBuffer<double>(threadIndex,
+                    numRffs, 2);
+            for (size_t j=0; j < numRffs; j++){
+                featureRow[j] = 0;
+                gradientRow[j] = 0;
+            }
+        }
+
+        convRBFKmerRangeGrad<T>(getWindows(row, kmerStart, kmerEnd, threadIndex),
+                rademPtr, chiPtr, featureRow, gradientRow, 0, rowKmers[row],
+                0, kmerEnd - kmerStart, zDim2, numFreqs, rademShape2, convWidth,
+                paddedBufferSize, scalingTerm, scalingType,
+                static_cast<T>(sigma), sincosMode, sorfFunction, copyBuffer,
+                kmerCaches[threadIndex].get());
+
+        if constexpr (!std::is_same<U, double>::value) {
+            if (!sharedRow) {
+                for (size_t j=0; j < numRffs; j++){
+                    outputRow[j] += featureRow[j];
+                    gradientRowOut[j] += gradientRow[j];
+                }
+            }
+        }
+    });
+
+    for (size_t slot=0; slot < sharedRows.size(); slot++) {
+        if (sharedRows[slot] < 0)
+            continue;
+        size_t rowStart = static_cast<size_t>(sharedRows[slot]) * numRffs;
+        for (size_t j=0; j < numRffs; j++){
+            outputPtr[rowStart + j] += sharedFeatures[slot * numRffs + j];
+            gradientPtr[rowStart + j] += sharedGradients[slot * numRffs + j];
+        }
+    }
+}
 
 
 
@@ -25,6 +210,8 @@
  *
  * + `inputArr` The (N x D x C) array containing the input data.
  * + `outputArr` The (N x R) output array, where R = 2 * F and F is numFreqs.
+ * May be float or double (U); for float, the sum over kmers for each row
+ * is still accumulated in double.
  * + `radem` The (3 x 1 x M) array of int8_t diagonal matrices, where M is
  * some integer multiple of the smallest power of 2 > C and is > numFreqs.
  * + `chiArr` The (F) shape numpy diagonal matrix by which the results are scaled.
@@ -34,14 +221,21 @@
  * + `scalingType` One of 0, 1 or 2; indicates the type of scaling. These
  * are defined in the header.
  * + `numThreads` The number of threads to use.
+ * + `precisionMode` One of "exact" (use libm for the sine and cosine
+ * calculations) or "fast" (use a faster polynomial approximation).
+ * See sincos_ops.cpp.
+ * + `kmerCacheSize` The maximum number of kmers for which each thread
+ * keeps the SORF output, so that repeated kmers skip the transforms.
+ * 0 disables the cache. See kmer_cache.cpp.
  */
-template <typename T>
+template <typename T, typename U>
 int convRBFFeatureGen_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
-        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<3,1,-1>, nb::device::cpu, nb::c_contig> radem,
         nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        int convWidth, int scalingType, int numThreads) {
+        int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize) {
 
     // Perform safety checks. Any exceptions thrown here are handed off to Python
     // by the Nanobind wrapper. We do not expect the user to see these because
@@ -50,167 +244,1017 @@ int convRBFFeatureGen_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::
     int zDim0 = inputArr.shape(0);
     size_t numRffs = outputArr.shape(1);
     size_t numFreqs = chiArr.shape(0);
-    double scalingTerm = std::sqrt(1.0 / static_cast<double>(numFreqs));
 
     T *inputPtr = static_cast<T*>(inputArr.data());
-    double *outputPtr = static_cast<double*>(outputArr.data());
+    U *outputPtr = static_cast<U*>(outputArr.data());
     T *chiPtr = static_cast<T*>(chiArr.data());
     int8_t *rademPtr = static_cast<int8_t*>(radem.data());
     int32_t *seqlengthsPtr = static_cast<int32_t*>(seqlengths.data());
 
-    if (inputArr.shape(0) == 0 || outputArr.shape(0) != inputArr.shape(0))
+    if (outputArr.shape(0) != inputArr.shape(0))
         throw std::runtime_error("no datapoints");
     if (numRffs < 2 || (numRffs & 1) != 0)
         throw std::runtime_error("last dim of output must be even number");
-    if ( (2 * numFreqs) != numRffs || numFreqs > radem.shape(2) )
+    if ((2 * numFreqs) != numRffs)
         throw std::runtime_error("incorrect number of rffs and or freqs.");
 
-    if (seqlengths.shape(0) != inputArr.shape(0))
-        throw std::runtime_error("wrong array sizes");
-    if (static_cast<int>(inputArr.shape(1)) < convWidth || convWidth <= 0)
-        throw std::runtime_error("invalid conv_width");
+    int paddedBufferSize = checkConvInputs(inputArr.shape(0), inputArr.shape(1),
+            inputArr.shape(2), numFreqs, radem.shape(2), seqlengths, convWidth);
+
+    int zDim1 = inputArr.shape(1);
+    int zDim2 = inputArr.shape(2);
+
+    PROFILE_COUNT(PROFILE_BYTES, inputArr.nbytes() + outputArr.nbytes());
+    convRBFGenRows<T, U>([&](int row, int kmerStart, int, int){
+                return inputPtr + (static_cast<size_t>(row) * zDim1 + kmerStart) * zDim2;
+            }, outputPtr, rademPtr, chiPtr, seqlengthsPtr, zDim0, zDim2,
+            numFreqs, radem.shape(2), convWidth, paddedBufferSize, scalingType,
+            numThreads, precisionMode, kmerCacheSize);
+
+    return 0;
+}
+//Instantiate the templates the wrapper will need to access.
+template int convRBFFeatureGen_<double, double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+template int convRBFFeatureGen_<float, double>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+template int convRBFFeatureGen_<float, float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+
+
 
-    double expectedNFreq = static_cast<double>(convWidth * inputArr.shape(2));
-    expectedNFreq = MAX(expectedNFreq, 2);
-    double log2Freqs = std::log2(expectedNFreq);
-    log2Freqs = std::ceil(log2Freqs);
-    int paddedBufferSize = std::pow(2, log2Freqs);
 
-    if (radem.shape(2) % paddedBufferSize != 0)
+
+/*!
+ * # convRBFGrad_
+ * Performs all steps required to generate random features for RBF-based
+ * convolution kernels (FHTConv1d, GraphConv1d, ARD variants of GraphConv1d),
+ * TOGETHER with the gradient.
+ * It is assumed that caller has checked dimensions and they are all correct.
+ *
+ * ## Args:
+ *
+ * + `inputArr` The (N x D x C) array containing the input data.
+ * + `outputArr` The (N x R) output array, where R = 2 * F and F is numFreqs.
+ * May be float or double (U); for float, the sum over kmers for each row
+ * is still accumulated in double.
+ * + `radem` The (3 x 1 x M) array of int8_t diagonal matrices, where M is
+ * some integer multiple of the smallest power of 2 > C and is > numFreqs.
+ * + `chiArr` The (F) shape numpy diagonal matrix by which the results are scaled.
+ * + `seqlengths` An (N) shape numpy array of sequence lengths (to exclude zero
+ * padding).
+ * + `gradArr` The (N x R x 1) array containing the gradient, of type U.
+ * + `convWidth` The width of the convolution kernel.
+ * + `sigma` The sigma hyperparameter.
+ * + `scalingType` One of 0, 1 or 2; indicates the type of scaling. These
+ * are defined in the header.
+ * + `numThreads` The number of threads to use.
+ * + `precisionMode` One of "exact" (use libm for the sine and cosine
+ * calculations) or "fast" (use a faster polynomial approximation).
+ * See sincos_ops.cpp.
+ * + `kmerCacheSize` The maximum number of kmers for which each thread
+ * keeps the SORF output, so that repeated kmers skip the transforms.
+ * 0 disables the cache. See kmer_cache.cpp.
+ */
+template <typename T, typename U>
+int convRBFGrad_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<U, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize) {
+
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = inputArr.shape(0);
+    size_t numRffs = outputArr.shape(1);
+    size_t numFreqs = chiArr.shape(0);
+
+    T *inputPtr = static_cast<T*>(inputArr.data());
+    U *outputPtr = static_cast<U*>(outputArr.data());
+    T *chiPtr = static_cast<T*>(chiArr.data());
+    int8_t *rademPtr = static_cast<int8_t*>(radem.data());
+    int32_t *seqlengthsPtr = static_cast<int32_t*>(seqlengths.data());
+    U *gradientPtr = static_cast<U*>(gradArr.data());
+
+    if (outputArr.shape(0) != inputArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numRffs < 2 || (numRffs & 1) != 0)
+        throw std::runtime_error("last dim of output must be even number");
+    if ((2 * numFreqs) != numRffs)
         throw std::runtime_error("incorrect number of rffs and or freqs.");
+    if (gradArr.shape(0) != outputArr.shape(0) || gradArr.shape(1) != outputArr.shape(1))
+        throw std::runtime_error("wrong array sizes");
 
+    int paddedBufferSize = checkConvInputs(inputArr.shape(0), inputArr.shape(1),
+            inputArr.shape(2), numFreqs, radem.shape(2), seqlengths, convWidth);
 
-    int32_t minSeqLength = 2147483647, maxSeqLength = 0;
-    for (size_t i=0; i < seqlengths.shape(0); i++) {
-        if (seqlengths(i) > maxSeqLength)
-            maxSeqLength = seqlengths(i);
-        if (seqlengths(i) < minSeqLength)
-            minSeqLength = seqlengths(i);
-    }
+    int zDim1 = inputArr.shape(1);
+    int zDim2 = inputArr.shape(2);
 
-    if (maxSeqLength > static_cast<int32_t>(inputArr.shape(1)) || minSeqLength < convWidth) {
-        throw std::runtime_error("All sequence lengths must be >= conv width and < "
-                "array size.");
-    }
+    PROFILE_COUNT(PROFILE_BYTES, inputArr.nbytes() + outputArr.nbytes() +
+            gradArr.nbytes());
+    convRBFGradRows<T, U>([&](int row, int kmerStart, int, int){
+                return inputPtr + (static_cast<size_t>(row) * zDim1 + kmerStart) * zDim2;
+            }, outputPtr, gradientPtr, rademPtr, chiPtr, seqlengthsPtr, zDim0,
+            zDim2, numFreqs, radem.shape(2), convWidth, paddedBufferSize, sigma,
+            scalingType, numThreads, precisionMode, kmerCacheSize);
+
+    return 0;
+}
+//Instantiate templates for use by wrapper.
+template int convRBFGrad_<double, double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+template int convRBFGrad_<float, double>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+template int convRBFGrad_<float, float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<float, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
 
 
 
-    if (numThreads > zDim0)
-        numThreads = zDim0;
 
-    std::vector<std::thread> threads(numThreads);
-    int startRow, endRow;
-    int chunkSize = (zDim0 + numThreads - 1) / numThreads;
-    
-    for (int i=0; i < numThreads; i++) {
-        startRow = i * chunkSize;
-        endRow = (i + 1) * chunkSize;
-        if (endRow > zDim0)
-            endRow = zDim0;
+/*!
+ * # convRBFTokenFeatureGen_
+ * As for convRBFFeatureGen_, but the input is supplied as token IDs
+ * together with an embedding table, rather than as a dense (N x D x C)
+ * array. Each window is expanded from the embedding table only when it
+ * is needed, so that e.g. one-hot encoded sequences can be stored as
+ * uint8 and the dense array is never built. The token ops are exposed
+ * by the extension only; the kernel classes and OfflineDataset do not
+ * yet call them.
+ *
+ * ## Args:
+ *
+ * + `tokenArr` The (N x D) array of token IDs, of type K.
+ * + `embeddingArr` The (V x C) array whose row t is the encoding of token
+ * t, multiplied by any scaling the caller would otherwise apply to the
+ * input. A (0 x C) array stands for the (C x C) identity, i.e. one-hot
+ * input; since the SORF is linear, any scaling can then be applied to
+ * chiArr instead.
+ *
+ * The remaining arguments are as for convRBFFeatureGen_.
+ */
+template <typename K, typename T, typename U>
+int convRBFTokenFeatureGen_(nb::ndarray<K, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3,1,-1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize) {
 
-        threads[i] = std::thread(&allInOneConvRBFGen<T>, inputPtr,
-                rademPtr, chiPtr, outputPtr,
-                seqlengthsPtr, inputArr.shape(1), inputArr.shape(2),
-                numFreqs, radem.shape(2), startRow, endRow, convWidth,
-                paddedBufferSize, scalingTerm, scalingType);
-    }
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = tokenArr.shape(0);
+    size_t numRffs = outputArr.shape(1);
+    size_t numFreqs = chiArr.shape(0);
+
+    K *tokenPtr = static_cast<K*>(tokenArr.data());
+    U *outputPtr = static_cast<U*>(outputArr.data());
+    T *chiPtr = static_cast<T*>(chiArr.data());
+    int8_t *rademPtr = static_cast<int8_t*>(radem.data());
+    int32_t *seqlengthsPtr = static_cast<int32_t*>(seqlengths.data());
 
-    for (auto& th : threads)
-        th.join();
+    if (outputArr.shape(0) != tokenArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numRffs < 2 || (numRffs & 1) != 0)
+        throw std::runtime_error("last dim of output must be even number");
+    if ((2 * numFreqs) != numRffs)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    if (embeddingArr.shape(1) == 0)
+        throw std::runtime_error("wrong array sizes");
+    int paddedBufferSize = checkConvInputs(tokenArr.shape(0), tokenArr.shape(1),
+            embeddingArr.shape(1), numFreqs, radem.shape(2), seqlengths, convWidth);
+
+    // An embedding table with no rows stands for the (C x C) identity,
+    // i.e. one-hot input, which is then expanded without a lookup.
+    bool oneHotInput = (embeddingArr.shape(0) == 0);
+    int vocabSize = oneHotInput ? embeddingArr.shape(1) : embeddingArr.shape(0);
+    T *embeddingPtr = oneHotInput ? NULL : static_cast<T*>(embeddingArr.data());
+
+    int zDim1 = tokenArr.shape(1);
+    int zDim2 = embeddingArr.shape(1);
+    if (!tokensInRange<K>(tokenPtr, seqlengthsPtr, zDim0, zDim1, vocabSize))
+        throw std::runtime_error("token ids must be valid rows of the embedding table");
+
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+
+    PROFILE_COUNT(PROFILE_BYTES, tokenArr.nbytes() + embeddingArr.nbytes() +
+            outputArr.nbytes());
+    convRBFGenRows<T, U>([&](int row, int kmerStart, int kmerEnd, int threadIndex){
+                int numPositions = kmerEnd - kmerStart + convWidth - 1;
+                T *windows = threadPool.getScratchBuffer<T>(threadIndex,
+                        static_cast<size_t>(numPositions) * zDim2,
+                        TOKEN_WINDOW_SCRATCH_SLOT);
+                expandTokenWindows<K, T>(tokenPtr + static_cast<size_t>(row) * zDim1 + kmerStart,
+                        embeddingPtr, windows, numPositions, zDim2);
+                return windows;
+            }, outputPtr, rademPtr, chiPtr, seqlengthsPtr, zDim0, zDim2,
+            numFreqs, radem.shape(2), convWidth, paddedBufferSize, scalingType,
+            numThreads, precisionMode, kmerCacheSize);
 
     return 0;
 }
 //Instantiate the templates the wrapper will need to access.
-template int convRBFFeatureGen_<double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+template int convRBFTokenFeatureGen_<uint8_t, double, double>(nb::ndarray<uint8_t, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
         nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        int convWidth, int scalingType, int numThreads);
-template int convRBFFeatureGen_<float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+template int convRBFTokenFeatureGen_<uint8_t, float, double>(nb::ndarray<uint8_t, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
         nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        int convWidth, int scalingType, int numThreads);
+        int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+template int convRBFTokenFeatureGen_<uint8_t, float, float>(nb::ndarray<uint8_t, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+template int convRBFTokenFeatureGen_<int16_t, double, double>(nb::ndarray<int16_t, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+template int convRBFTokenFeatureGen_<int16_t, float, double>(nb::ndarray<int16_t, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+template int convRBFTokenFeatureGen_<int16_t, float, float>(nb::ndarray<int16_t, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+
+
+
+
+/*!
+ * # convRBFTokenGrad_
+ * As for convRBFGrad_, but the input is supplied as token IDs together
+ * with an embedding table, as for convRBFTokenFeatureGen_. As for
+ * convRBFGrad_, the embedding table should not be multiplied by sigma,
+ * which is supplied separately.
+ *
+ * ## Args:
+ *
+ * + `tokenArr` The (N x D) array of token IDs, of type K.
+ * + `embeddingArr` The (V x C) array whose row t is the encoding of token
+ * t, or a (0 x C) array for one-hot input, as for convRBFTokenFeatureGen_.
+ *
+ * The remaining arguments are as for convRBFGrad_.
+ */
+template <typename K, typename T, typename U>
+int convRBFTokenGrad_(nb::ndarray<K, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<U, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize) {
+
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = tokenArr.shape(0);
+    size_t numRffs = outputArr.shape(1);
+    size_t numFreqs = chiArr.shape(0);
+
+    K *tokenPtr = static_cast<K*>(tokenArr.data());
+    U *outputPtr = static_cast<U*>(outputArr.data());
+    T *chiPtr = static_cast<T*>(chiArr.data());
+    int8_t *rademPtr = static_cast<int8_t*>(radem.data());
+    int32_t *seqlengthsPtr = static_cast<int32_t*>(seqlengths.data());
+    U *gradientPtr = static_cast<U*>(gradArr.data());
 
+    if (outputArr.shape(0) != tokenArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numRffs < 2 || (numRffs & 1) != 0)
+        throw std::runtime_error("last dim of output must be even number");
+    if ((2 * numFreqs) != numRffs)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+    if (gradArr.shape(0) != outputArr.shape(0) || gradArr.shape(1) != outputArr.shape(1))
+        throw std::runtime_error("wrong array sizes");
+
+    if (embeddingArr.shape(1) == 0)
+        throw std::runtime_error("wrong array sizes");
+    int paddedBufferSize = checkConvInputs(tokenArr.shape(0), tokenArr.shape(1),
+            embeddingArr.shape(1), numFreqs, radem.shape(2), seqlengths, convWidth);
+
+    // An embedding table with no rows stands for the (C x C) identity,
+    // i.e. one-hot input, which is then expanded without a lookup.
+    bool oneHotInput = (embeddingArr.shape(0) == 0);
+    int vocabSize = oneHotInput ? embeddingArr.shape(1) : embeddingArr.shape(0);
+    T *embeddingPtr = oneHotInput ? NULL : static_cast<T*>(embeddingArr.data());
+
+    int zDim1 = tokenArr.shape(1);
+    int zDim2 = embeddingArr.shape(1);
+    if (!tokensInRange<K>(tokenPtr, seqlengthsPtr, zDim0, zDim1, vocabSize))
+        throw std::runtime_error("token ids must be valid rows of the embedding table");
+
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+
+    PROFILE_COUNT(PROFILE_BYTES, tokenArr.nbytes() + embeddingArr.nbytes() +
+            outputArr.nbytes() + gradArr.nbytes());
+    convRBFGradRows<T, U>([&](int row, int kmerStart, int kmerEnd, int threadIndex){
+                int numPositions = kmerEnd - kmerStart + convWidth - 1;
+                T *windows = threadPool.getScratchBuffer<T>(threadIndex,
+                        static_cast<size_t>(numPositions) * zDim2,
+                        TOKEN_WINDOW_SCRATCH_SLOT);
+                expandTokenWindows<K, T>(tokenPtr + static_cast<size_t>(row) * zDim1 + kmerStart,
+                        embeddingPtr, windows, numPositions, zDim2);
+                return windows;
+            }, outputPtr, gradientPtr, rademPtr, chiPtr, seqlengthsPtr, zDim0,
+            zDim2, numFreqs, radem.shape(2), convWidth, paddedBufferSize, sigma,
+            scalingType, numThreads, precisionMode, kmerCacheSize);
+
+    return 0;
+}
+//Instantiate templates for use by wrapper.
+template int convRBFTokenGrad_<uint8_t, double, double>(nb::ndarray<uint8_t, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+template int convRBFTokenGrad_<uint8_t, float, double>(nb::ndarray<uint8_t, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+template int convRBFTokenGrad_<uint8_t, float, float>(nb::ndarray<uint8_t, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<float, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+template int convRBFTokenGrad_<int16_t, double, double>(nb::ndarray<int16_t, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+template int convRBFTokenGrad_<int16_t, float, double>(nb::ndarray<int16_t, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+template int convRBFTokenGrad_<int16_t, float, float>(nb::ndarray<int16_t, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<float, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
 
 
 
 
 /*!
- * # convRBFGrad_
- * Performs all steps required to generate random features for RBF-based
- * convolution kernels (FHTConv1d, GraphConv1d, ARD variants of GraphConv1d),
- * TOGETHER with the gradient.
- * It is assumed that caller has checked dimensions and they are all correct.
+ * # convRBFDesignMatrix_
+ * Generates random features for RBF-based convolution kernels and adds
+ * Z^T Z and Z^T y to the arrays supplied by the caller, without storing
+ * the full feature array. Features are generated for one block of rows
+ * at a time, and each block is added to zTzArr and zTyArr before the
+ * next is generated.
  *
  * ## Args:
  *
  * + `inputArr` The (N x D x C) array containing the input data.
- * + `outputArr` The (N x R) output array, where R = 2 * F and F is numFreqs.
+ * + `yArr` The (N) array containing the y-values.
+ * + `zTzArr` The (R x R) array to which Z^T Z is added, where R = 2 * F
+ * and F is numFreqs.
+ * + `zTyArr` The (R) array to which Z^T y is added.
  * + `radem` The (3 x 1 x M) array of int8_t diagonal matrices, where M is
  * some integer multiple of the smallest power of 2 > C and is > numFreqs.
  * + `chiArr` The (F) shape numpy diagonal matrix by which the results are scaled.
  * + `seqlengths` An (N) shape numpy array of sequence lengths (to exclude zero
  * padding).
- * + `gradArr` The (N x R x 1) array containing the gradient.
  * + `convWidth` The width of the convolution kernel.
- * + `sigma` The sigma hyperparameter.
  * + `scalingType` One of 0, 1 or 2; indicates the type of scaling. These
  * are defined in the header.
  * + `numThreads` The number of threads to use.
+ * + `fitIntercept` If True, the first feature for each datapoint is set to 1.
+ * + `precisionMode` One of "exact" (use libm for the sine and cosine
+ * calculations) or "fast" (use a faster polynomial approximation).
+ * See sincos_ops.cpp.
+ * + `kmerCacheSize` The maximum number of kmers for which each thread
+ * keeps the SORF output, so that repeated kmers skip the transforms.
+ * 0 disables the cache. See kmer_cache.cpp.
  */
 template <typename T>
-int convRBFGrad_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
-        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+int convRBFDesignMatrix_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> zTyArr,
+        nb::ndarray<int8_t, nb::shape<3,1,-1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads, bool fitIntercept,
+        const std::string &precisionMode, int kmerCacheSize) {
+
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = inputArr.shape(0);
+    size_t numRffs = zTzArr.shape(1);
+    size_t numFreqs = chiArr.shape(0);
+    double scalingTerm = std::sqrt(1.0 / static_cast<double>(numFreqs));
+
+    T *inputPtr = static_cast<T*>(inputArr.data());
+    double *yPtr = static_cast<double*>(yArr.data());
+    double *zTzPtr = static_cast<double*>(zTzArr.data());
+    double *zTyPtr = static_cast<double*>(zTyArr.data());
+    T *chiPtr = static_cast<T*>(chiArr.data());
+    int8_t *rademPtr = static_cast<int8_t*>(radem.data());
+    int32_t *seqlengthsPtr = static_cast<int32_t*>(seqlengths.data());
+
+    if (yArr.shape(0) != inputArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numRffs < 2 || (numRffs & 1) != 0)
+        throw std::runtime_error("last dim of output must be even number");
+    if (zTzArr.shape(0) != numRffs || zTyArr.shape(0) != numRffs)
+        throw std::runtime_error("wrong array sizes");
+    if ((2 * numFreqs) != numRffs)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    int paddedBufferSize = checkConvInputs(inputArr.shape(0), inputArr.shape(1),
+            inputArr.shape(2), numFreqs, radem.shape(2), seqlengths, convWidth);
+
+    int zDim1 = inputArr.shape(1);
+    int zDim2 = inputArr.shape(2);
+    int rademShape2 = radem.shape(2);
+    int sincosMode = getSinCosMode(precisionMode);
+    SORFFunction<T> sorfFunction = getSORFFunction<T>(paddedBufferSize);
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+
+    int blockRows = getDesignMatrixBlockRows(zDim0, numRffs);
+    std::vector<double> featureBlock(static_cast<size_t>(blockRows) * numRffs);
+    double *featurePtr = featureBlock.data();
+    // The kmer caches are kept across blocks, since the radem and chi
+    // arrays do not change within a call.
+    std::vector<std::unique_ptr<KmerCache<T>>> kmerCaches(numThreads > 0 ?
+            numThreads : 1);
+
+    for (int blockStart=0; blockStart < zDim0; blockStart += blockRows){
+        int currentRows = zDim0 - blockStart;
+        if (currentRows > blockRows)
+            currentRows = blockRows;
+        T *blockInputPtr = inputPtr + static_cast<size_t>(blockStart) * zDim1 * zDim2;
+        int32_t *blockSeqlengthsPtr = seqlengthsPtr + blockStart;
+
+        threadPool.parallelForRows(currentRows, numThreads,
+                [&](int startRow, int endRow, int threadIndex){
+            T *copyBuffer = threadPool.getScratchBuffer<T>(threadIndex,
+                    paddedBufferSize);
+            if (!kmerCaches[threadIndex])
+                kmerCaches[threadIndex] = makeKmerCache<T>(kmerCacheSize,
+                        convWidth * zDim2, rademShape2);
+            for (size_t i=startRow * numRffs; i < endRow * numRffs; i++)
+                featurePtr[i] = 0;
+
+            allInOneConvRBFGen<T>(blockInputPtr, rademPtr, chiPtr, featurePtr,
+                    blockSeqlengthsPtr, zDim1, zDim2, numFreqs, rademShape2,
+                    startRow, endRow, convWidth, paddedBufferSize,
+                    scalingTerm, scalingType, sincosMode, sorfFunction,
+                    copyBuffer, kmerCaches[threadIndex].get());
+
+            if (fitIntercept){
+                for (int i=startRow; i < endRow; i++)
+                    featurePtr[i * numRffs] = 1;
+            }
+        });
+
+        accumulateGramBlock(featurePtr, yPtr + blockStart, zTzPtr, zTyPtr,
+                currentRows, numRffs, numThreads);
+    }
+
+    return 0;
+}
+//Instantiate the templates the wrapper will need to access.
+template int convRBFDesignMatrix_<double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> zTyArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads, bool fitIntercept,
+        const std::string &precisionMode, int kmerCacheSize);
+template int convRBFDesignMatrix_<float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> zTyArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads, bool fitIntercept,
+        const std::string &precisionMode, int kmerCacheSize);
+
+
+
+
+/*!
+ * # convRBFMatvec_
+ * Generates random features for RBF-based convolution kernels and adds
+ * Z^T (Z V) to outputArr, where V is a batch of vectors, without storing
+ * the feature array. Each thread generates one feature row at a time in
+ * its scratch buffer and accumulates into its own copy of the output;
+ * the per-thread copies are summed into outputArr at the end.
+ *
+ * ## Args:
+ *
+ * + `inputArr` The (N x D x C) array containing the input data.
+ * + `vecArr` The (R x K) array containing the K vectors V, where R = 2 * F
+ * and F is numFreqs.
+ * + `outputArr` The (R x K) array to which Z^T (Z V) is added.
+ * + `radem` The (3 x 1 x M) array of int8_t diagonal matrices, where M is
+ * some integer multiple of the smallest power of 2 > C and is > numFreqs.
+ * + `chiArr` The (F) shape numpy diagonal matrix by which the results are scaled.
+ * + `seqlengths` An (N) shape numpy array of sequence lengths (to exclude zero
+ * padding).
+ * + `convWidth` The width of the convolution kernel.
+ * + `scalingType` One of 0, 1 or 2; indicates the type of scaling. These
+ * are defined in the header.
+ * + `numThreads` The number of threads to use.
+ * + `fitIntercept` If True, the first feature for each datapoint is set to 1.
+ * + `precisionMode` One of "exact" (use libm for the sine and cosine
+ * calculations) or "fast" (use a faster polynomial approximation).
+ * See sincos_ops.cpp.
+ * + `kmerCacheSize` The maximum number of kmers for which each thread
+ * keeps the SORF output, so that repeated kmers skip the transforms.
+ * 0 disables the cache. See kmer_cache.cpp.
+ */
+template <typename T>
+int convRBFMatvec_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> vecArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3,1,-1>, nb::device::cpu, nb::c_contig> radem,
         nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
-        double sigma, int convWidth, int scalingType, int numThreads) {
+        int convWidth, int scalingType, int numThreads, bool fitIntercept,
+        const std::string &precisionMode, int kmerCacheSize) {
 
     // Perform safety checks. Any exceptions thrown here are handed off to Python
     // by the Nanobind wrapper. We do not expect the user to see these because
     // the Python code will always ensure inputs are correct -- these are a failsafe
     // -- so we do not need to provide detailed exception messages here.
     int zDim0 = inputArr.shape(0);
-    size_t numRffs = outputArr.shape(1);
+    size_t numRffs = vecArr.shape(0);
+    int numVecs = vecArr.shape(1);
     size_t numFreqs = chiArr.shape(0);
     double scalingTerm = std::sqrt(1.0 / static_cast<double>(numFreqs));
 
     T *inputPtr = static_cast<T*>(inputArr.data());
+    double *vecPtr = static_cast<double*>(vecArr.data());
     double *outputPtr = static_cast<double*>(outputArr.data());
     T *chiPtr = static_cast<T*>(chiArr.data());
     int8_t *rademPtr = static_cast<int8_t*>(radem.data());
     int32_t *seqlengthsPtr = static_cast<int32_t*>(seqlengths.data());
-    double *gradientPtr = static_cast<double*>(gradArr.data());
 
-    if (inputArr.shape(0) == 0 || outputArr.shape(0) != inputArr.shape(0))
+    if (numRffs < 2 || (numRffs & 1) != 0)
+        throw std::runtime_error("last dim of output must be even number");
+    if (numVecs == 0 || outputArr.shape(0) != numRffs ||
+            outputArr.shape(1) != vecArr.shape(1))
+        throw std::runtime_error("wrong array sizes");
+    if ((2 * numFreqs) != numRffs)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    int paddedBufferSize = checkConvInputs(inputArr.shape(0), inputArr.shape(1),
+            inputArr.shape(2), numFreqs, radem.shape(2), seqlengths, convWidth);
+
+    int zDim1 = inputArr.shape(1);
+    int zDim2 = inputArr.shape(2);
+    int rademShape2 = radem.shape(2);
+    size_t outputSize = numRffs * numVecs;
+    int sincosMode = getSinCosMode(precisionMode);
+    SORFFunction<T> sorfFunction = getSORFFunction<T>(paddedBufferSize);
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+    std::vector<double*> threadOutputs(numThreads > 0 ? numThreads : 1, nullptr);
+
+    threadPool.parallelForRows(zDim0, numThreads,
+            [&](int startRow, int endRow, int threadIndex){
+        T *copyBuffer = threadPool.getScratchBuffer<T>(threadIndex,
+                paddedBufferSize, 0);
+        std::unique_ptr<KmerCache<T>> kmerCache = makeKmerCache<T>(kmerCacheSize,
+                convWidth * zDim2, rademShape2);
+        double *featureRow = threadPool.getScratchBuffer<double>(threadIndex,
+                numRffs, 1);
+        double *threadOutput = threadPool.getScratchBuffer<double>(threadIndex,
+                outputSize, 2);
+        double *rowProducts = threadPool.getScratchBuffer<double>(threadIndex,
+                numVecs, 3);
+
+        for (size_t i=0; i < outputSize; i++)
+            threadOutput[i] = 0;
+
+        for (int i=startRow; i < endRow; i++){
+            for (size_t j=0; j < numRffs; j++)
+                featureRow[j] = 0;
+
+            allInOneConvRBFGen<T>(inputPtr + static_cast<size_t>(i) * zDim1 * zDim2,
+                    rademPtr, chiPtr, featureRow, seqlengthsPtr + i, zDim1,
+                    zDim2, numFreqs, rademShape2, 0, 1, convWidth,
+                    paddedBufferSize, scalingTerm, scalingType,
+                    sincosMode, sorfFunction, copyBuffer,
+                    kmerCache.get());
+            if (fitIntercept)
+                featureRow[0] = 1;
+
+            featureRowMatvec(featureRow, vecPtr, threadOutput, rowProducts,
+                    numRffs, numVecs);
+        }
+        threadOutputs[threadIndex] = threadOutput;
+    });
+
+    reduceThreadOutputs(threadOutputs, outputPtr, outputSize, numThreads);
+    return 0;
+}
+//Instantiate the templates the wrapper will need to access.
+template int convRBFMatvec_<double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> vecArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads, bool fitIntercept,
+        const std::string &precisionMode, int kmerCacheSize);
+template int convRBFMatvec_<float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> vecArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads, bool fitIntercept,
+        const std::string &precisionMode, int kmerCacheSize);
+
+
+
+
+/*!
+ * # convRBFPredict
+ *
+ * Shared implementation of convRBFPredictMean_ and convRBFPredictMeanVar_;
+ * varPtr and varOutPtr are null for convRBFPredictMean_. See
+ * predictFromFeatureTiles.
+ */
+template <typename T>
+static void convRBFPredict(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> &inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> &weightArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> &meanArr,
+        nb::ndarray<int8_t, nb::shape<3,1,-1>, nb::device::cpu, nb::c_contig> &radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> &chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> &seqlengths,
+        const double *varPtr, int numVarRffs, double *varOutPtr,
+        int convWidth, int scalingType, int numThreads, bool fitIntercept,
+        const std::string &precisionMode) {
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = inputArr.shape(0);
+    size_t numRffs = weightArr.shape(0);
+    size_t numFreqs = chiArr.shape(0);
+    double scalingTerm = std::sqrt(1.0 / static_cast<double>(numFreqs));
+
+    if (meanArr.shape(0) != inputArr.shape(0))
         throw std::runtime_error("no datapoints");
     if (numRffs < 2 || (numRffs & 1) != 0)
         throw std::runtime_error("last dim of output must be even number");
-    if ( (2 * numFreqs) != numRffs || numFreqs > radem.shape(2) )
+    if ((2 * numFreqs) != numRffs)
         throw std::runtime_error("incorrect number of rffs and or freqs.");
+    if (numVarRffs < 0 || static_cast<size_t>(numVarRffs) > numRffs)
+        throw std::runtime_error("wrong array sizes");
+
+    int paddedBufferSize = checkConvInputs(inputArr.shape(0), inputArr.shape(1),
+            inputArr.shape(2), numFreqs, radem.shape(2), seqlengths, convWidth);
 
-    if (seqlengths.shape(0) != inputArr.shape(0))
+    int zDim1 = inputArr.shape(1);
+    int zDim2 = inputArr.shape(2);
+    T *inputPtr = static_cast<T*>(inputArr.data());
+    T *chiPtr = static_cast<T*>(chiArr.data());
+    int8_t *rademPtr = static_cast<int8_t*>(radem.data());
+    int32_t *seqlengthsPtr = static_cast<int32_t*>(seqlengths.data());
+    int rademShape2 = radem.shape(2);
+    int sincosMode = getSinCosMode(precisionMode);
+    SORFFunction<T> sorfFunction = getSORFFunction<T>(paddedBufferSize);
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+
+    predictFromFeatureTiles([&](int row, int repeatNum, double *featureTile,
+                int threadIndex){
+                T *copyBuffer = threadPool.getScratchBuffer<T>(threadIndex,
+                        paddedBufferSize, 0);
+                T *xrow = inputPtr + static_cast<size_t>(row) * zDim1 * zDim2;
+                int numKmers = seqlengthsPtr[row] - convWidth + 1;
+                int repeatPosition = repeatNum * paddedBufferSize;
+                double rowScaler = getConvRowScaler(scalingTerm, scalingType,
+                        numKmers);
+
+                for (int j=0; j < numKmers; j++) {
+                    computeKmerSORF(xrow + j * zDim2, copyBuffer,
+                            static_cast<T*>(NULL), rademPtr, repeatPosition,
+                            rademShape2, convWidth * zDim2, paddedBufferSize,
+                            sorfFunction);
+                    singleVectorRBFPostProcess(copyBuffer, chiPtr + repeatPosition,
+                            featureTile, paddedBufferSize,
+                            numFreqs - repeatPosition, 0, 0, rowScaler,
+                            sincosMode);
+                }
+            }, zDim0, numFreqs, paddedBufferSize, fitIntercept,
+            static_cast<double*>(weightArr.data()),
+            static_cast<double*>(meanArr.data()), varPtr, numVarRffs,
+            varOutPtr, numThreads);
+}
+
+
+
+
+/*!
+ * # convRBFPredictMean_
+ *
+ * Calculates the predictive mean z w for each sequence in the input
+ * for RBF-based convolution kernels, without storing the features z.
+ * The frequencies rather than the sequences are split between threads,
+ * so small batches (down to a single sequence) still use all threads.
+ * Since each thread only transforms its own frequencies for each kmer,
+ * the kmer cache is not used here.
+ *
+ * ## Args:
+ *
+ * + `inputArr` The (N x D x C) array containing the input data.
+ * + `weightArr` The (R) array containing the weights, where R = 2 * F
+ * and F is numFreqs.
+ * + `meanArr` The (N) array in which z w is stored.
+ * + `radem` The (3 x 1 x M) array of int8_t diagonal matrices, where M is
+ * some integer multiple of the smallest power of 2 > C and is > numFreqs.
+ * + `chiArr` The (F) shape numpy diagonal matrix by which the results are scaled.
+ * + `seqlengths` An (N) shape numpy array of sequence lengths (to exclude zero
+ * padding).
+ * + `convWidth` The width of the convolution kernel.
+ * + `scalingType` One of 0, 1 or 2; indicates the type of scaling. These
+ * are defined in the header.
+ * + `numThreads` The number of threads to use.
+ * + `fitIntercept` If True, the first feature for each datapoint is set to 1.
+ * + `precisionMode` One of "exact" (use libm for the sine and cosine
+ * calculations) or "fast" (use a faster polynomial approximation).
+ * See sincos_ops.cpp.
+ */
+template <typename T>
+int convRBFPredictMean_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> weightArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> meanArr,
+        nb::ndarray<int8_t, nb::shape<3,1,-1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads, bool fitIntercept,
+        const std::string &precisionMode) {
+    convRBFPredict<T>(inputArr, weightArr, meanArr, radem, chiArr, seqlengths,
+            nullptr, 0, nullptr, convWidth, scalingType, numThreads,
+            fitIntercept, precisionMode);
+    return 0;
+}
+//Instantiate the templates the wrapper will need to access.
+template int convRBFPredictMean_<double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> weightArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> meanArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int convRBFPredictMean_<float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> weightArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> meanArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+
+
+
+
+/*!
+ * # convRBFPredictMeanVar_
+ *
+ * As for convRBFPredictMean_, but also calculates z_v V z_v^T for each
+ * sequence, where z_v is the first K features of z and V is the (K x K)
+ * variance matrix, without storing z. The predictive variance is
+ * lambda^2 (1 + z_v V z_v^T), which is left to the caller.
+ *
+ * ## Args:
+ *
+ * + `varArr` The (K x K) array containing V, where K <= R.
+ * + `varOutArr` The (N) array in which z_v V z_v^T is stored.
+ *
+ * The remaining arguments are as for convRBFPredictMean_.
+ */
+template <typename T>
+int convRBFPredictMeanVar_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> weightArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> varArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> meanArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> varOutArr,
+        nb::ndarray<int8_t, nb::shape<3,1,-1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads, bool fitIntercept,
+        const std::string &precisionMode) {
+    if (varArr.shape(0) != varArr.shape(1) || varArr.shape(0) == 0 ||
+            varOutArr.shape(0) != inputArr.shape(0))
         throw std::runtime_error("wrong array sizes");
-    if (static_cast<int>(inputArr.shape(1)) < convWidth || convWidth <= 0)
-        throw std::runtime_error("invalid conv_width");
 
-    if (gradArr.shape(0) != outputArr.shape(0) || gradArr.shape(1) != outputArr.shape(1))
+    convRBFPredict<T>(inputArr, weightArr, meanArr, radem, chiArr, seqlengths,
+            static_cast<double*>(varArr.data()), varArr.shape(0),
+            static_cast<double*>(varOutArr.data()), convWidth, scalingType,
+            numThreads, fitIntercept, precisionMode);
+    return 0;
+}
+//Instantiate the templates the wrapper will need to access.
+template int convRBFPredictMeanVar_<double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> weightArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> varArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> meanArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> varOutArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int convRBFPredictMeanVar_<float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> weightArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> varArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> meanArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> varOutArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+
+
+
+
+/*!
+ * # computeKmerSORF
+ *
+ * Copies one kmer into copyBuffer (zero-padded to paddedBufferSize)
+ * and performs the SORF transform for one repeat. If cacheEntry is not
+ * NULL, the result is also stored in the cache entry at repeatPosition.
+ */
+template <typename T>
+void computeKmerSORF(const T xElement[], T *copyBuffer, T *cacheEntry,
+        int8_t *rademArray, int repeatPosition, int rademShape2,
+        int kmerLength, int paddedBufferSize,
+        SORFFunction<T> sorfFunction) {
+    for (int m=0; m < kmerLength; m++)
+        copyBuffer[m] = xElement[m];
+    for (int m=kmerLength; m < paddedBufferSize; m++)
+        copyBuffer[m] = 0;
+
+    sorfFunction(copyBuffer, rademArray, repeatPosition,
+            rademShape2, paddedBufferSize);
+    if (cacheEntry != NULL) {
+        for (int m=0; m < paddedBufferSize; m++)
+            cacheEntry[repeatPosition + m] = copyBuffer[m];
+    }
+}
+template void computeKmerSORF<double>(const double xElement[], double *copyBuffer,
+        double *cacheEntry, int8_t *rademArray, int repeatPosition, int rademShape2,
+        int kmerLength, int paddedBufferSize, SORFFunction<double> sorfFunction);
+template void computeKmerSORF<float>(const float xElement[], float *copyBuffer,
+        float *cacheEntry, int8_t *rademArray, int repeatPosition, int rademShape2,
+        int kmerLength, int paddedBufferSize, SORFFunction<float> sorfFunction);
+
+
+
+
+/*!
+ * # checkConvInputs
+ *
+ * Performs the safety checks on the input, radem and sequence lengths
+ * that are shared by all of the convolution ops, and returns the padded
+ * buffer size for a kmer of convWidth * xDim2 elements. Checks on the
+ * output arrays differ between ops and are left to the caller.
+ *
+ * ## Args:
+ *
+ * + `numRows` The number of sequences N in the input.
+ * + `rowLength` The length D of each row of the input.
+ * + `xDim2` The number of features C per sequence element (for token-ID
+ * input, the number of columns of the embedding table).
+ * + `numFreqs` The number of frequencies to sample.
+ * + `rademShape2` The last dimension of radem.
+ * + `seqlengths` The length of each sequence in the input. Of shape (N).
+ * + `convWidth` The width of the convolution to perform.
+ */
+int checkConvInputs(size_t numRows, size_t rowLength, size_t xDim2,
+        size_t numFreqs, size_t rademShape2,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> &seqlengths,
+        int convWidth) {
+    // Any exceptions thrown here are handed off to Python by the Nanobind
+    // wrapper, as for the checks in the calling op.
+    if (numRows == 0)
+        throw std::runtime_error("no datapoints");
+    if (numFreqs > rademShape2)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+    if (seqlengths.shape(0) != numRows)
         throw std::runtime_error("wrong array sizes");
+    if (static_cast<int>(rowLength) < convWidth || convWidth <= 0)
+        throw std::runtime_error("invalid conv_width");
 
-    double expectedNFreq = static_cast<double>(convWidth * inputArr.shape(2));
+    double expectedNFreq = static_cast<double>(convWidth * xDim2);
     expectedNFreq = MAX(expectedNFreq, 2);
     double log2Freqs = std::log2(expectedNFreq);
     log2Freqs = std::ceil(log2Freqs);
     int paddedBufferSize = std::pow(2, log2Freqs);
 
-    if (radem.shape(2) % paddedBufferSize != 0)
+    if (rademShape2 % paddedBufferSize != 0)
         throw std::runtime_error("incorrect number of rffs and or freqs.");
 
-
     int32_t minSeqLength = 2147483647, maxSeqLength = 0;
     for (size_t i=0; i < seqlengths.shape(0); i++) {
         if (seqlengths(i) > maxSeqLength)
@@ -219,55 +1263,151 @@ int convRBFGrad_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_cont
             minSeqLength = seqlengths(i);
     }
 
-    if (maxSeqLength > static_cast<int32_t>(inputArr.shape(1)) || minSeqLength < convWidth) {
+    if (maxSeqLength > static_cast<int32_t>(rowLength) || minSeqLength < convWidth) {
         throw std::runtime_error("All sequence lengths must be >= conv width and < "
                 "array size.");
     }
+    return paddedBufferSize;
+}
 
 
 
-    if (numThreads > zDim0)
-        numThreads = zDim0;
 
-    std::vector<std::thread> threads(numThreads);
-    int startRow, endRow;
-    int chunkSize = (zDim0 + numThreads - 1) / numThreads;
-    
-    for (int i=0; i < numThreads; i++) {
-        startRow = i * chunkSize;
-        endRow = (i + 1) * chunkSize;
-        if (endRow > zDim0)
-            endRow = zDim0;
+/*!
+ * # getConvRowScaler
+ *
+ * Returns the factor by which the features for a sequence with
+ * numKmers kmers are scaled, for the specified scalingType.
+ */
+double getConvRowScaler(double scalingTerm, int scalingType, int numKmers) {
+    switch (scalingType) {
+        case SQRT_CONVOLUTION_SCALING:
+            return scalingTerm / std::sqrt(static_cast<double>(numKmers));
+        case FULL_CONVOLUTION_SCALING:
+            return scalingTerm / static_cast<double>(numKmers);
+        default:
+            return scalingTerm;
+    }
+}
+
+
+
+
+/*!
+ * # convRBFKmerRangeGen
+ *
+ * Generates the RBF-based convolution features for kmers kmerStart
+ * to kmerEnd of a single sequence and adds them to row rowNumber of
+ * outputArray. The scaling is determined by the total number of kmers
+ * numKmers in the sequence, so that a sequence can be split into
+ * several ranges (e.g. across threads) and the results summed.
+ *
+ * ## Args:
+ *
+ * + `xrow` Pointer to the first element of the sequence (D x C).
+ * + `outputArray` The array to which the features are added; row
+ * rowNumber is used.
+ * + `numKmers` The total number of kmers in the sequence.
+ * + `kmerStart` The first kmer to process.
+ * + `kmerEnd` One past the last kmer to process.
+ *
+ * The remaining arguments are as for allInOneConvRBFGen.
+ */
+template <typename T>
+void convRBFKmerRangeGen(T xrow[], int8_t *rademArray, T chiArr[],
+        double *outputArray, int rowNumber, int numKmers, int kmerStart,
+        int kmerEnd, int dim2, int numFreqs, int rademShape2,
+        int convWidth, int paddedBufferSize, double scalingTerm,
+        int scalingType, int sincosMode, SORFFunction<T> sorfFunction,
+        T *copyBuffer, KmerCache<T> *kmerCache) {
 
-        threads[i] = std::thread(&allInOneConvRBFGrad<T>, inputPtr,
-                rademPtr, chiPtr, outputPtr, seqlengthsPtr, gradientPtr,
-                inputArr.shape(1), inputArr.shape(2),
-                numFreqs, radem.shape(2), startRow,
-                endRow, convWidth, paddedBufferSize,
-                scalingTerm, scalingType, sigma);
+    int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
+    double rowScaler = getConvRowScaler(scalingTerm, scalingType, numKmers);
+    T *xElement;
+    PROFILE_LAP_START(profileLap);
+
+    for (int j=kmerStart; j < kmerEnd; j++) {
+        int repeatPosition = 0;
+        xElement = xrow + j * dim2;
+        const T *cachedSORF = NULL;
+        T *newEntry = NULL;
+        if (kmerCache != NULL) {
+            cachedSORF = kmerCache->lookup(xElement);
+            if (cachedSORF == NULL)
+                newEntry = kmerCache->insert(xElement);
+        }
 
+        for (int k=0; k < numRepeats; k++) {
+            const T *sorfOutput = copyBuffer;
+            if (cachedSORF != NULL)
+                sorfOutput = cachedSORF + repeatPosition;
+            else {
+                computeKmerSORF(xElement, copyBuffer, newEntry, rademArray,
+                        repeatPosition, rademShape2, convWidth * dim2,
+                        paddedBufferSize, sorfFunction);
+            }
+            PROFILE_LAP(profileLap, PROFILE_FHT);
+            singleVectorRBFPostProcess(sorfOutput, chiArr, outputArray,
+                    paddedBufferSize, numFreqs, rowNumber, k, rowScaler,
+                    sincosMode);
+            PROFILE_LAP(profileLap, PROFILE_POSTPROCESS);
+            repeatPosition += paddedBufferSize;
+        }
     }
+}
 
-    for (auto& th : threads)
-        th.join();
 
-    return 0;
+
+
+/*!
+ * # convRBFKmerRangeGrad
+ *
+ * As for convRBFKmerRangeGen, but also calculates the gradient, which
+ * is added to row rowNumber of gradientArray.
+ */
+template <typename T>
+void convRBFKmerRangeGrad(T xrow[], int8_t *rademArray, T chiArr[],
+        double *outputArray, double *gradientArray, int rowNumber,
+        int numKmers, int kmerStart, int kmerEnd, int dim2, int numFreqs,
+        int rademShape2, int convWidth, int paddedBufferSize,
+        double scalingTerm, int scalingType, T sigma, int sincosMode,
+        SORFFunction<T> sorfFunction, T *copyBuffer,
+        KmerCache<T> *kmerCache) {
+
+    int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
+    double rowScaler = getConvRowScaler(scalingTerm, scalingType, numKmers);
+    T *xElement;
+    PROFILE_LAP_START(profileLap);
+
+    for (int j=kmerStart; j < kmerEnd; j++) {
+        int repeatPosition = 0;
+        xElement = xrow + j * dim2;
+        const T *cachedSORF = NULL;
+        T *newEntry = NULL;
+        if (kmerCache != NULL) {
+            cachedSORF = kmerCache->lookup(xElement);
+            if (cachedSORF == NULL)
+                newEntry = kmerCache->insert(xElement);
+        }
+
+        for (int k=0; k < numRepeats; k++) {
+            const T *sorfOutput = copyBuffer;
+            if (cachedSORF != NULL)
+                sorfOutput = cachedSORF + repeatPosition;
+            else {
+                computeKmerSORF(xElement, copyBuffer, newEntry, rademArray,
+                        repeatPosition, rademShape2, convWidth * dim2,
+                        paddedBufferSize, sorfFunction);
+            }
+            PROFILE_LAP(profileLap, PROFILE_FHT);
+            singleVectorRBFPostGrad(sorfOutput, chiArr, outputArray,
+                    gradientArray, sigma, paddedBufferSize, numFreqs,
+                    rowNumber, k, rowScaler, sincosMode);
+            PROFILE_LAP(profileLap, PROFILE_POSTPROCESS);
+            repeatPosition += paddedBufferSize;
+        }
+    }
 }
-//Instantiate templates for use by wrapper.
-template int convRBFGrad_<double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
-        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
-        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
-        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
-        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
-        double sigma, int convWidth, int scalingType, int numThreads);
-template int convRBFGrad_<float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
-        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
-        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
-        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
-        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
-        double sigma, int convWidth, int scalingType, int numThreads);
 
 
 
@@ -276,61 +1416,31 @@ template int convRBFGrad_<float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::dev
  * # allInOneConvRBFGen
  *
  * Performs the RBF-based convolution kernel feature generation
- * process for the input, for one thread.
+ * process for the input, for one thread. copyBuffer is the
+ * calling thread's scratch buffer and must be of size
+ * paddedBufferSize; sorfFunction is the SORF routine for
+ * that size, as returned by getSORFFunction. sincosMode is one
+ * of the SINCOS constants in sincos_ops.h. kmerCache is the calling
+ * thread's kmer cache, or NULL if caching is disabled.
  */
 template <typename T>
 void *allInOneConvRBFGen(T xdata[], int8_t *rademArray, T chiArr[],
         double *outputArray, int32_t *seqlengths, int dim1, int dim2,
         int numFreqs, int rademShape2, int startRow, int endRow,
         int convWidth, int paddedBufferSize,
-        double scalingTerm, int scalingType) {
-
-    int numKmers;
-    int32_t seqlength;
-    int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
-    double rowScaler;
-    //Notice that we don't have error handling here...very naughty. Out of
-    //memory should be extremely rare since we are only allocating memory
-    //for one row of the convolution. TODO: add error handling here.
-    T *copyBuffer = new T[paddedBufferSize];
-    T *xElement;
+        double scalingTerm, int scalingType, int sincosMode,
+        SORFFunction<T> sorfFunction, T *copyBuffer,
+        KmerCache<T> *kmerCache) {
 
     for (int i=startRow; i < endRow; i++) {
-        seqlength = seqlengths[i];
-        numKmers = seqlength - convWidth + 1;
-        switch (scalingType) {
-            case SQRT_CONVOLUTION_SCALING:
-                rowScaler = scalingTerm / std::sqrt( (double)numKmers);
-                break;
-            case FULL_CONVOLUTION_SCALING:
-                rowScaler = scalingTerm / (double)numKmers;
-                break;
-            default:
-               rowScaler = scalingTerm;
-              break; 
-        }
-
-        for (int j=0; j < numKmers; j++) {
-            int repeatPosition = 0;
-            xElement = xdata + i * dim1 * dim2 + j * dim2;
-
-            for (int k=0; k < numRepeats; k++) {
-                for (int m=0; m < (convWidth * dim2); m++)
-                    copyBuffer[m] = xElement[m];
-                for (int m=(convWidth * dim2); m < paddedBufferSize; m++)
-                    copyBuffer[m] = 0;
-
-                singleVectorSORF(copyBuffer, rademArray, repeatPosition,
-                        rademShape2, paddedBufferSize);
-                singleVectorRBFPostProcess(copyBuffer, chiArr, outputArray,
-                        paddedBufferSize, numFreqs, i, k, rowScaler);
-                repeatPosition += paddedBufferSize;
-            }
-        }
+        int numKmers = seqlengths[i] - convWidth + 1;
+        convRBFKmerRangeGen<T>(xdata + static_cast<size_t>(i) * dim1 * dim2,
+                rademArray, chiArr, outputArray, i, numKmers, 0, numKmers,
+                dim2, numFreqs, rademShape2, convWidth, paddedBufferSize,
+                scalingTerm, scalingType, sincosMode, sorfFunction,
+                copyBuffer, kmerCache);
     }
 
-    delete[] copyBuffer;
-
     return NULL;
 }
 
@@ -345,61 +1455,29 @@ void *allInOneConvRBFGen(T xdata[], int8_t *rademArray, T chiArr[],
  *
  * Performs the RBF-based convolution kernel feature generation
  * process for the input, for one thread, and calculates the
- * gradient, which is stored in a separate array.
+ * gradient, which is stored in a separate array. copyBuffer is
+ * the calling thread's scratch buffer and must be of size
+ * paddedBufferSize; sorfFunction is the SORF routine for
+ * that size, as returned by getSORFFunction. sincosMode is one
+ * of the SINCOS constants in sincos_ops.h. kmerCache is the calling
+ * thread's kmer cache, or NULL if caching is disabled.
  */
 template <typename T>
 void *allInOneConvRBFGrad(T xdata[], int8_t *rademArray, T chiArr[],
         double *outputArray, int32_t *seqlengths, double *gradientArray,
         int dim1, int dim2, int numFreqs, int rademShape2, int startRow,
         int endRow, int convWidth, int paddedBufferSize,
-        double scalingTerm, int scalingType, T sigma) {
-
-    int numKmers;
-    int32_t seqlength;
-    int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
-    double rowScaler;
-    //Notice that we don't have error handling here...very naughty. Out of
-    //memory should be extremely rare since we are only allocating memory
-    //for one row of the convolution. TODO: add error handling here.
-    T *copyBuffer = new T[paddedBufferSize];
-    T *xElement;
+        double scalingTerm, int scalingType, T sigma,
+        int sincosMode, SORFFunction<T> sorfFunction, T *copyBuffer,
+        KmerCache<T> *kmerCache) {
 
     for (int i=startRow; i < endRow; i++) {
-        seqlength = seqlengths[i];
-        numKmers = seqlength - convWidth + 1;
-        switch (scalingType) {
-            case SQRT_CONVOLUTION_SCALING:
-                rowScaler = scalingTerm / std::sqrt(
-                        static_cast<double>(numKmers));
-                break;
-            case FULL_CONVOLUTION_SCALING:
-                rowScaler = scalingTerm / static_cast<double>(numKmers);
-                break;
-            default:
-                rowScaler = scalingTerm;
-              break;
-        }
-
-        for (int j=0; j < numKmers; j++) {
-            int repeatPosition = 0;
-            xElement = xdata + i * dim1 * dim2 + j * dim2;
-
-            for (int k=0; k < numRepeats; k++) {
-                for (int m=0; m < (convWidth * dim2); m++)
-                    copyBuffer[m] = xElement[m];
-                for (int m=(convWidth * dim2); m < paddedBufferSize; m++)
-                    copyBuffer[m] = 0;
-
-                singleVectorSORF(copyBuffer, rademArray, repeatPosition,
-                        rademShape2, paddedBufferSize);
-                singleVectorRBFPostGrad(copyBuffer, chiArr, outputArray,
-                        gradientArray, sigma, paddedBufferSize, numFreqs,
-                        i, k, rowScaler);
-                repeatPosition += paddedBufferSize;
-            }
-        }
+        int numKmers = seqlengths[i] - convWidth + 1;
+        convRBFKmerRangeGrad<T>(xdata + static_cast<size_t>(i) * dim1 * dim2,
+                rademArray, chiArr, outputArray, gradientArray, i, numKmers,
+                0, numKmers, dim2, numFreqs, rademShape2, convWidth,
+                paddedBufferSize, scalingTerm, scalingType, sigma,
+                sincosMode, sorfFunction, copyBuffer, kmerCache);
     }
-    delete[] copyBuffer;
-
     return NULL;
 }
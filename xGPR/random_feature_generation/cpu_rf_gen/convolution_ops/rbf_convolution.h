@@ -2,8 +2,11 @@
 #define RBF_CONVOLUTION_H
 
 #include <stdint.h>
+#include <string>
 #include <nanobind/nanobind.h>
 #include <nanobind/ndarray.h>
+#include "../shared_fht_functions/shared_rfgen_ops.h"
+#include "../shared_fht_functions/kmer_cache.h"
 
 namespace nb = nanobind;
 
@@ -16,35 +19,135 @@ namespace nb = nanobind;
 
 
 
-template <typename T>
+template <typename T, typename U>
 int convRBFFeatureGen_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
-        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
         nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        int convWidth, int scalingType, int numThreads);
+        int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
 
-template <typename T>
+template <typename T, typename U>
 int convRBFGrad_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<U, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+
+template <typename K, typename T, typename U>
+int convRBFTokenFeatureGen_(nb::ndarray<K, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+
+template <typename K, typename T, typename U>
+int convRBFTokenGrad_(nb::ndarray<K, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> tokenArr,
+        nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> embeddingArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<U, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, int numThreads,
+        const std::string &precisionMode, int kmerCacheSize);
+
+template <typename T>
+int convRBFDesignMatrix_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> zTyArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads, bool fitIntercept,
+        const std::string &precisionMode, int kmerCacheSize);
+
+template <typename T>
+int convRBFMatvec_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> vecArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
         nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
-        double sigma, int convWidth, int scalingType, int numThreads);
+        int convWidth, int scalingType, int numThreads, bool fitIntercept,
+        const std::string &precisionMode, int kmerCacheSize);
+
+template <typename T>
+int convRBFPredictMean_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> weightArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> meanArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+
+template <typename T>
+int convRBFPredictMeanVar_(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> weightArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> varArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> meanArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> varOutArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+
+template <typename T>
+void computeKmerSORF(const T xElement[], T *copyBuffer, T *cacheEntry,
+        int8_t *rademArray, int repeatPosition, int rademShape2,
+        int kmerLength, int paddedBufferSize,
+        SORFFunction<T> sorfFunction);
+
+int checkConvInputs(size_t numRows, size_t rowLength, size_t xDim2,
+        size_t numFreqs, size_t rademShape2,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> &seqlengths,
+        int convWidth);
+
+double getConvRowScaler(double scalingTerm, int scalingType, int numKmers);
+
+template <typename T>
+void convRBFKmerRangeGen(T xrow[], int8_t *rademArray, T chiArr[],
+        double *outputArray, int rowNumber, int numKmers, int kmerStart,
+        int kmerEnd, int dim2, int numFreqs, int rademShape2,
+        int convWidth, int paddedBufferSize, double scalingTerm,
+        int scalingType, int sincosMode, SORFFunction<T> sorfFunction,
+        T *copyBuffer, KmerCache<T> *kmerCache);
+
+template <typename T>
+void convRBFKmerRangeGrad(T xrow[], int8_t *rademArray, T chiArr[],
+        double *outputArray, double *gradientArray, int rowNumber,
+        int numKmers, int kmerStart, int kmerEnd, int dim2, int numFreqs,
+        int rademShape2, int convWidth, int paddedBufferSize,
+        double scalingTerm, int scalingType, T sigma, int sincosMode,
+        SORFFunction<T> sorfFunction, T *copyBuffer,
+        KmerCache<T> *kmerCache);
 
 template <typename T>
 void *allInOneConvRBFGen(T xdata[], int8_t *rademArray, T chiArr[],
         double *outputArray, int32_t *seqlengths, int dim1, int dim2,
         int numFreqs, int rademShape2, int startRow, int endRow,
         int convWidth, int paddedBufferSize,
-        double scalingTerm, int scalingType);
+        double scalingTerm, int scalingType, int sincosMode,
+        SORFFunction<T> sorfFunction, T *copyBuffer,
+        KmerCache<T> *kmerCache);
 
 template <typename T>
 void *allInOneConvRBFGrad(T xdata[], int8_t *rademArray, T chiArr[],
         double *outputArray, int32_t *seqlengths, double *gradientArray,
         int dim1, int dim2, int numFreqs, int rademShape2, int startRow,
         int endRow, int convWidth, int paddedBufferSize,
-        double scalingTerm, int scalingType, T sigma);
+        double scalingTerm, int scalingType, T sigma,
+        int sincosMode, SORFFunction<T> sorfFunction, T *copyBuffer,
+        KmerCache<T> *kmerCache);
 
 #endif
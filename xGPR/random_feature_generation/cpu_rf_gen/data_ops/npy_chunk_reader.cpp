@@ -0,0 +1,349 @@
+/*!
+ * # npy_chunk_reader.cpp
+ *
+ * This module contains a reader for datasets stored on disk as a list
+ * of .npy files, which memory-maps each file and prefetches upcoming
+ * chunks on a background thread so that the feature generation
+ * routines are not left waiting on disk reads. The arrays are handed
+ * to Python as numpy views of the mapped files.
+ */
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <nanobind/ndarray.h>
+#include "npy_chunk_reader.h"
+
+#ifdef _WIN32
+#define NPY_READER_USE_MMAP 0
+#else
+#define NPY_READER_USE_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+
+/*!
+ * # MappedNpyFile
+ *
+ * Maps the file (or on platforms without mmap reads it into memory)
+ * and parses the header. Throws if the file cannot be read or is not
+ * a supported .npy file.
+ */
+MappedNpyFile::MappedNpyFile(const std::string &filepath){
+#if NPY_READER_USE_MMAP
+    int fd = open(filepath.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("could not open " + filepath);
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size <= 0){
+        close(fd);
+        throw std::runtime_error("could not read " + filepath);
+    }
+    fileSize = fileStat.st_size;
+    mapping = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED){
+        mapping = nullptr;
+        throw std::runtime_error("could not map " + filepath);
+    }
+#else
+    std::ifstream infile(filepath, std::ios::binary | std::ios::ate);
+    if (!infile)
+        throw std::runtime_error("could not open " + filepath);
+    fileSize = infile.tellg();
+    mapping = std::malloc(fileSize > 0 ? fileSize : 1);
+    heapAllocated = true;
+    infile.seekg(0);
+    if (mapping == nullptr || !infile.read(static_cast<char*>(mapping), fileSize)){
+        std::free(mapping);
+        mapping = nullptr;
+        throw std::runtime_error("could not read " + filepath);
+    }
+#endif
+
+    try {
+        parseHeader(filepath);
+    }
+    catch (...) {
+        unmap();
+        throw;
+    }
+}
+
+
+MappedNpyFile::~MappedNpyFile(){
+    unmap();
+}
+
+
+void MappedNpyFile::unmap(){
+    if (mapping == nullptr)
+        return;
+    if (heapAllocated)
+        std::free(mapping);
+#if NPY_READER_USE_MMAP
+    else
+        munmap(mapping, fileSize);
+#endif
+    mapping = nullptr;
+}
+
+
+/*!
+ * # parseHeader
+ *
+ * Parses the .npy header, which is the magic string, a version, the
+ * header length and a Python dict literal of the form
+ * {'descr': '<f8', 'fortran_order': False, 'shape': (2000, 50), }.
+ */
+void MappedNpyFile::parseHeader(const std::string &filepath){
+    const char *bytes = static_cast<const char*>(mapping);
+    if (fileSize < 10 || std::memcmp(bytes, "\x93NUMPY", 6) != 0)
+        throw std::runtime_error(filepath + " is not a .npy file");
+
+    size_t headerLength, headerStart;
+    const unsigned char *lengthBytes = reinterpret_cast<const unsigned char*>(bytes + 8);
+    if (bytes[6] == 1){
+        headerLength = lengthBytes[0] | (lengthBytes[1] << 8);
+        headerStart = 10;
+    }
+    else {
+        if (fileSize < 12)
+            throw std::runtime_error(filepath + " is not a .npy file");
+        headerLength = static_cast<size_t>(lengthBytes[0]) | (lengthBytes[1] << 8) |
+            (lengthBytes[2] << 16) | (static_cast<size_t>(lengthBytes[3]) << 24);
+        headerStart = 12;
+    }
+    if (headerStart + headerLength > fileSize)
+        throw std::runtime_error(filepath + " has an invalid header");
+    std::string header(bytes + headerStart, headerLength);
+    dataOffset = headerStart + headerLength;
+
+    size_t pos = header.find("'descr'");
+    if (pos == std::string::npos)
+        throw std::runtime_error(filepath + " has an invalid header");
+    pos = header.find('\'', pos + 7);
+    size_t end = header.find('\'', pos + 1);
+    if (pos == std::string::npos || end == std::string::npos || end - pos < 4)
+        throw std::runtime_error(filepath + " has an invalid header");
+    std::string descr = header.substr(pos + 1, end - pos - 1);
+    arrayTypeCode = descr[1];
+    arrayItemSize = std::atoi(descr.c_str() + 2);
+    if (descr[0] == '>' && arrayItemSize > 1)
+        throw std::runtime_error(filepath + " is big-endian, which is not supported");
+    if ( (arrayTypeCode != 'f' && arrayTypeCode != 'i' && arrayTypeCode != 'u' &&
+            arrayTypeCode != 'b') || (arrayItemSize != 1 && arrayItemSize != 2 &&
+            arrayItemSize != 4 && arrayItemSize != 8) )
+        throw std::runtime_error(filepath + " has an unsupported dtype " + descr);
+
+    pos = header.find("'fortran_order'");
+    pos = (pos == std::string::npos) ? pos : header.find_first_not_of(" :", pos + 15);
+    if (pos == std::string::npos)
+        throw std::runtime_error(filepath + " has an invalid header");
+    if (header.compare(pos, 4, "True") == 0)
+        throw std::runtime_error(filepath + " is Fortran-ordered, which is not supported");
+
+    pos = header.find("'shape'");
+    pos = (pos == std::string::npos) ? pos : header.find('(', pos);
+    end = (pos == std::string::npos) ? pos : header.find(')', pos);
+    if (end == std::string::npos)
+        throw std::runtime_error(filepath + " has an invalid header");
+
+    size_t numElements = 1;
+    const char *shapeStr = header.c_str() + pos + 1;
+    const char *shapeEnd = header.c_str() + end;
+    while (shapeStr < shapeEnd){
+        char *parsedEnd;
+        unsigned long long dimSize = std::strtoull(shapeStr, &parsedEnd, 10);
+        if (parsedEnd == shapeStr){
+            shapeStr++;
+            continue;
+        }
+        arrayShape.push_back(dimSize);
+        numElements *= dimSize;
+        shapeStr = parsedEnd;
+    }
+    if (numElements * arrayItemSize > numBytes())
+        throw std::runtime_error(filepath + " is shorter than its header indicates");
+}
+
+
+/*!
+ * # prefetch
+ *
+ * Asks the OS to start reading the whole file and then touches one
+ * byte per page, so that by the time the caller uses the array it is
+ * already resident rather than faulted in page by page.
+ */
+void MappedNpyFile::prefetch(){
+#if NPY_READER_USE_MMAP
+    if (heapAllocated)
+        return;
+    madvise(mapping, fileSize, MADV_WILLNEED);
+    madvise(mapping, fileSize, MADV_SEQUENTIAL);
+
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (pageSize <= 0)
+        pageSize = 4096;
+    const volatile char *bytes = static_cast<const volatile char*>(mapping);
+    char total = 0;
+    for (size_t i = 0; i < fileSize; i += pageSize)
+        total ^= bytes[i];
+    (void)total;
+#endif
+}
+
+
+
+
+/*!
+ * # NpyChunkReader
+ *
+ * Starts the I/O thread, which begins prefetching the first chunks
+ * immediately.
+ *
+ * ## Args:
+ *
+ * + `chunkFiles` A list with one entry per chunk, each of which is
+ * the list of .npy files for that chunk.
+ * + `prefetchDepth` The number of chunks beyond the one currently
+ * in use to load ahead of time. Must be at least 1.
+ */
+NpyChunkReader::NpyChunkReader(const std::vector<std::vector<std::string>> &chunkFiles,
+        int prefetchDepth) : chunkFiles(chunkFiles) {
+    if (prefetchDepth < 1)
+        throw std::runtime_error("prefetchDepth must be at least 1");
+    this->prefetchDepth = prefetchDepth;
+    ioThread = std::thread(&NpyChunkReader::ioLoop, this);
+}
+
+
+NpyChunkReader::~NpyChunkReader(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    consumedCondition.notify_all();
+    if (ioThread.joinable())
+        ioThread.join();
+}
+
+
+/*!
+ * # ioLoop
+ *
+ * Loads chunks in order, waiting whenever prefetchDepth chunks are
+ * loaded but not yet consumed. Any error reading a chunk is stored
+ * with it and rethrown by next().
+ */
+void NpyChunkReader::ioLoop(){
+    for (size_t i = 0; i < chunkFiles.size(); i++){
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            consumedCondition.wait(lock, [&]{ return stopping ||
+                    loadedChunks.size() < prefetchDepth; });
+            if (stopping)
+                return;
+        }
+
+        LoadedChunk chunk;
+        try {
+            for (const std::string &filepath : chunkFiles[i]){
+                chunk.files.push_back(std::make_shared<MappedNpyFile>(filepath));
+                chunk.files.back()->prefetch();
+            }
+        }
+        catch (...) {
+            chunk.files.clear();
+            chunk.error = std::current_exception();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            loadedChunks.push_back(std::move(chunk));
+        }
+        loadedCondition.notify_all();
+    }
+}
+
+
+/*!
+ * # next
+ *
+ * Returns the files for the next chunk, waiting for the I/O thread if
+ * it has not been loaded yet, or an empty list once all chunks have
+ * been returned. If the chunk could not be read, the error is rethrown
+ * and the chunk is skipped.
+ */
+std::vector<std::shared_ptr<MappedNpyFile>> NpyChunkReader::next(){
+    LoadedChunk chunk;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (numConsumed >= chunkFiles.size())
+            return {};
+        loadedCondition.wait(lock, [&]{ return !loadedChunks.empty(); });
+        chunk = std::move(loadedChunks.front());
+        loadedChunks.pop_front();
+        numConsumed++;
+    }
+    consumedCondition.notify_all();
+
+    if (chunk.error)
+        std::rethrow_exception(chunk.error);
+    return chunk.files;
+}
+
+
+
+
+/*!
+ * # npyChunkReaderNext_
+ *
+ * Implements __next__ for the Python wrapper: returns a tuple with a
+ * numpy view of each file in the next chunk, or raises StopIteration.
+ * Each view keeps its file mapped for as long as it is alive. The GIL
+ * is released while waiting for the I/O thread.
+ */
+nb::object npyChunkReaderNext_(NpyChunkReader &reader){
+    std::vector<std::shared_ptr<MappedNpyFile>> files;
+    {
+        nb::gil_scoped_release release;
+        files = reader.next();
+    }
+    if (files.empty())
+        throw nb::stop_iteration();
+
+    nb::list arrays;
+    for (const std::shared_ptr<MappedNpyFile> &file : files){
+        nb::dlpack::dtype dtype;
+        dtype.lanes = 1;
+        dtype.bits = file->itemSize() * 8;
+        switch (file->typeCode()){
+            case 'f':
+                dtype.code = static_cast<uint8_t>(nb::dlpack::dtype_code::Float);
+                break;
+            case 'u':
+                dtype.code = static_cast<uint8_t>(nb::dlpack::dtype_code::UInt);
+                break;
+            case 'b':
+                dtype.code = static_cast<uint8_t>(nb::dlpack::dtype_code::Bool);
+                break;
+            default:
+                dtype.code = static_cast<uint8_t>(nb::dlpack::dtype_code::Int);
+                break;
+        }
+
+        std::shared_ptr<MappedNpyFile> *owner = new std::shared_ptr<MappedNpyFile>(file);
+        nb::capsule deleter(owner, [](void *p) noexcept {
+            delete static_cast<std::shared_ptr<MappedNpyFile>*>(p);
+        });
+        nb::ndarray<nb::numpy> view(file->data(), file->shape().size(),
+                file->shape().data(), deleter, nullptr, dtype);
+        arrays.append(nb::cast(view));
+    }
+    return nb::tuple(arrays);
+}
@@ -0,0 +1,113 @@
+#ifndef NPY_CHUNK_READER_H
+#define NPY_CHUNK_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <nanobind/nanobind.h>
+
+namespace nb = nanobind;
+
+#define DEFAULT_CHUNK_PREFETCH_DEPTH 2
+
+
+/*!
+ * # MappedNpyFile
+ *
+ * A .npy file mapped into memory. The header is parsed on construction
+ * and data() points directly at the array stored in the file, so no
+ * copy is made. The mapping is private (copy-on-write), so the array
+ * may be modified in place without changing the file. Only C-ordered
+ * arrays of little-endian (or single-byte) bool, integer and floating
+ * point types are supported; anything else throws.
+ */
+class MappedNpyFile {
+    public:
+        explicit MappedNpyFile(const std::string &filepath);
+        ~MappedNpyFile();
+
+        void *data() { return static_cast<char*>(mapping) + dataOffset; }
+        const std::vector<size_t> &shape() const { return arrayShape; }
+        char typeCode() const { return arrayTypeCode; }
+        int itemSize() const { return arrayItemSize; }
+        size_t numBytes() const { return fileSize - dataOffset; }
+
+        void prefetch();
+
+        MappedNpyFile(const MappedNpyFile&) = delete;
+        MappedNpyFile &operator=(const MappedNpyFile&) = delete;
+
+    private:
+        void parseHeader(const std::string &filepath);
+        void unmap();
+
+        void *mapping = nullptr;
+        size_t fileSize = 0;
+        size_t dataOffset = 0;
+        bool heapAllocated = false;
+        std::vector<size_t> arrayShape;
+        char arrayTypeCode = 0;
+        int arrayItemSize = 0;
+};
+
+
+/*!
+ * # NpyChunkReader
+ *
+ * Reads a list of chunks, each of which is a group of .npy files
+ * (e.g. the x, y and sequence length files for one chunk of a
+ * dataset), in order. A background I/O thread maps and prefetches up
+ * to prefetchDepth chunks ahead of the one the caller is working on,
+ * so that reading the next chunk from disk overlaps with featurizing
+ * the current one.
+ *
+ * If a file in a chunk cannot be read, next() throws for that chunk
+ * but the reader still moves on to the following chunk, so the caller
+ * may load that chunk some other way and continue.
+ */
+class NpyChunkReader {
+    public:
+        NpyChunkReader(const std::vector<std::vector<std::string>> &chunkFiles,
+                int prefetchDepth = DEFAULT_CHUNK_PREFETCH_DEPTH);
+        ~NpyChunkReader();
+
+        std::vector<std::shared_ptr<MappedNpyFile>> next();
+        size_t numChunks() const { return chunkFiles.size(); }
+
+        NpyChunkReader(const NpyChunkReader&) = delete;
+        NpyChunkReader &operator=(const NpyChunkReader&) = delete;
+
+    private:
+        struct LoadedChunk {
+            std::vector<std::shared_ptr<MappedNpyFile>> files;
+            std::exception_ptr error;
+        };
+
+        void ioLoop();
+
+        std::vector<std::vector<std::string>> chunkFiles;
+        size_t prefetchDepth;
+
+        // mutex protects everything below it, which is shared with the
+        // I/O thread.
+        std::mutex mutex;
+        std::condition_variable loadedCondition;
+        std::condition_variable consumedCondition;
+        std::deque<LoadedChunk> loadedChunks;
+        size_t numConsumed = 0;
+        bool stopping = false;
+
+        std::thread ioThread;
+};
+
+
+nb::object npyChunkReaderNext_(NpyChunkReader &reader);
+
+#endif
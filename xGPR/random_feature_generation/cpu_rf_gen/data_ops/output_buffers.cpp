@@ -0,0 +1,87 @@
+/*!
+ * # output_buffers.cpp
+ *
+ * This module contains a helper for allocating the output arrays the
+ * CPU feature generation routines write to, so that when the thread
+ * pool is in NUMA mode each output row is placed on the node of the
+ * thread that will later write it. Memory returned by NumPy (through
+ * malloc / calloc) is either zeroed by the calling thread or faulted in
+ * by whichever thread touches it first, so on a multi-socket machine
+ * much of it can end up on the wrong node.
+ */
+#include <new>
+#include <cstring>
+#include <stdexcept>
+#include <nanobind/ndarray.h>
+#include "output_buffers.h"
+#include "../shared_fht_functions/thread_pool.h"
+
+
+
+/*!
+ * # allocateFirstTouch_
+ *
+ * Allocates a zeroed, C-ordered array and returns it as a numpy array.
+ * The rows (along the first dimension) are zeroed by the thread pool
+ * using the same contiguous split as parallelForRows, so that if the
+ * array is then passed to a routine run with the same numThreads, each
+ * thread writes pages that it touched first (and that the OS therefore
+ * placed on its node). Outside of NUMA mode this is just a parallel
+ * zero fill.
+ *
+ * ## Args:
+ *
+ * + `shape` The shape of the array. Must have at least one dimension.
+ * + `numThreads` The number of threads the array will be written with.
+ * + `doublePrecision` If true the array is float64, otherwise float32.
+ */
+nb::object allocateFirstTouch_(const std::vector<size_t> &shape, int numThreads,
+        bool doublePrecision){
+    // Perform safety checks. Any exceptions thrown here are handed
+    // off to Python by the Nanobind wrapper. We do not expect the user
+    // to see these because the Python code will always ensure inputs
+    // are correct -- these are a failsafe -- so we do not need to
+    // provide detailed exception messages here.
+    if (shape.empty())
+        throw std::runtime_error("no shape was specified");
+    if (numThreads < 1)
+        throw std::runtime_error("numThreads must be at least 1");
+
+    size_t itemSize = doublePrecision ? sizeof(double) : sizeof(float);
+    size_t rowBytes = itemSize;
+    for (size_t i=1; i < shape.size(); i++)
+        rowBytes *= shape[i];
+    size_t numRows = shape[0];
+    if (numRows > static_cast<size_t>(INT32_MAX))
+        throw std::runtime_error("too many rows were requested");
+    size_t numBytes = numRows * rowBytes;
+
+    char *buffer = static_cast<char*>(::operator new(numBytes > 0 ? numBytes : 1,
+                std::align_val_t(FIRST_TOUCH_ALIGNMENT)));
+
+    {
+        nb::gil_scoped_release release;
+        try {
+            RFGenThreadPool::getInstance().parallelForRows(numRows, numThreads,
+                    [&](int startRow, int endRow, int){
+                std::memset(buffer + startRow * rowBytes, 0,
+                        (endRow - startRow) * rowBytes);
+            });
+        }
+        catch (...) {
+            ::operator delete(buffer, std::align_val_t(FIRST_TOUCH_ALIGNMENT));
+            throw;
+        }
+    }
+
+    nb::capsule deleter(buffer, [](void *p) noexcept {
+        ::operator delete(p, std::align_val_t(FIRST_TOUCH_ALIGNMENT));
+    });
+    nb::dlpack::dtype dtype;
+    dtype.code = static_cast<uint8_t>(nb::dlpack::dtype_code::Float);
+    dtype.bits = itemSize * 8;
+    dtype.lanes = 1;
+    nb::ndarray<nb::numpy> array(buffer, shape.size(), shape.data(),
+            deleter, nullptr, dtype);
+    return nb::cast(array);
+}
@@ -0,0 +1,15 @@
+#ifndef OUTPUT_BUFFERS_H
+#define OUTPUT_BUFFERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <nanobind/nanobind.h>
+
+namespace nb = nanobind;
+
+
+nb::object allocateFirstTouch_(const std::vector<size_t> &shape, int numThreads,
+        bool doublePrecision);
+
+#endif
@@ -2,17 +2,19 @@
  * # ard_ops.cpp
  * 
  * This module performs major steps involved in calculating gradients for
- * ARD kernels (a somewhat specialized task). TODO: Further optimization
- * needed for this module.
+ * ARD kernels (a somewhat specialized task). The input columns are
+ * grouped by lengthscale, so that the product of the input with the
+ * precomputed weights for each lengthscale is a dense, contiguous
+ * block product rather than a scatter into the gradient.
  */
 #include <Python.h>
 #include <stdint.h>
 #include <math.h>
 #include <vector>
-#include <thread>
 #include "ard_ops.h"
 #include "../shared_fht_functions/hadamard_transforms.h"
 #include "../shared_fht_functions/shared_rfgen_ops.h"
+#include "../shared_fht_functions/thread_pool.h"
 
 namespace nb = nanobind;
 
@@ -82,27 +84,41 @@ int ardGrad_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inp
     else
         rbfNormConstant = std::sqrt(1.0 / numFreqsFlt);
 
-    if (numThreads > zDim0)
-        numThreads = zDim0;
-
-    std::vector<std::thread> threads(numThreads);
-    int startPosition, endPosition;
-    int chunkSize = (zDim0 + numThreads - 1) / numThreads;
-
-    for (int i=0; i < numThreads; i++){
-        startPosition = i * chunkSize;
-        endPosition = (i + 1) * chunkSize;
-        if (endPosition > zDim0)
-            endPosition = zDim0;
- 
-        threads[i] = std::thread(&ThreadARDGrad<T>, inputPtr, outputPtr,
-                precompWeightsPtr, sigmaMapPtr, sigmaValsPtr, gradientPtr,
-                startPosition, endPosition, inputArr.shape(1),
-                numLengthscales, numFreqs, rbfNormConstant);
+    int zDim1 = inputArr.shape(1);
+
+    // Order the columns by lengthscale (keeping their original order within
+    // each lengthscale), then store the weights and lengthscales in that
+    // order, so that the columns for each lengthscale are contiguous.
+    std::vector<int32_t> columnOrder(zDim1), groupStarts(numLengthscales + 1, 0);
+    for (int k=0; k < zDim1; k++){
+        if (sigmaMapPtr[k] < 0 || sigmaMapPtr[k] >= static_cast<int32_t>(numLengthscales))
+            throw std::runtime_error("Wrong array sizes.");
+        groupStarts[sigmaMapPtr[k] + 1] += 1;
+    }
+    for (size_t l=0; l < numLengthscales; l++)
+        groupStarts[l + 1] += groupStarts[l];
+
+    std::vector<int32_t> groupPositions(groupStarts.begin(), groupStarts.end() - 1);
+    std::vector<double> groupedSigmaVals(zDim1);
+    for (int k=0; k < zDim1; k++){
+        int32_t position = groupPositions[sigmaMapPtr[k]]++;
+        columnOrder[position] = k;
+        groupedSigmaVals[position] = sigmaValsPtr[k];
+    }
+
+    std::vector<T> groupedWeights(numFreqs * zDim1);
+    for (size_t j=0; j < numFreqs; j++){
+        for (int k=0; k < zDim1; k++)
+            groupedWeights[j * zDim1 + k] = precompWeightsPtr[j * zDim1 + columnOrder[k]];
     }
 
-    for (auto& th : threads)
-        th.join();
+    RFGenThreadPool::getInstance().parallelForRows(zDim0, numThreads,
+            [&](int startRow, int endRow, int threadIndex){
+        ThreadARDGrad<T>(inputPtr, outputPtr, groupedWeights.data(),
+                columnOrder.data(), groupStarts.data(), groupedSigmaVals.data(),
+                gradientPtr, startRow, endRow, zDim1, numLengthscales,
+                numFreqs, rbfNormConstant, threadIndex);
+    });
     return 0;
 }
 template int ardGrad_<double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
@@ -124,60 +140,410 @@ template int ardGrad_<float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cp
 
 
 
+/*!
+ * # ardMultiGrad_
+ *
+ * Performs gradient-only calculations for the mini ARD kernel for
+ * one or more candidate sets of lengthscales in a single pass over
+ * the input. The per-lengthscale products of the input with the
+ * precomputed weights do not depend on the lengthscales, so they
+ * are calculated once for each row and reused for every candidate.
+ *
+ * ## Args:
+ *
+ * + `inputArr` A numpy array of shape (N x C).
+ * + `outputArr` A numpy array of shape (S x N x R), where S is the
+ * number of candidates and R is the number of RFFs and is 2x numFreqs;
+ * + `precompWeights` Numpy array containing the precomputed
+ * weights, a (C x D) array.
+ * + `sigmaMap` Numpy array containing a mapping from positions
+ * to lengthscales, a (D) array.
+ * + `lengthscaleArr` A shape (S x L) numpy array containing the L
+ * lengthscales for each candidate.
+ * + `gradArr` The (S x N x R x L) numpy array for the gradient.
+ * + `numThreads` The number of threads to use.
+ * + `fitIntercept` Whether an intercept will be fitted.
+ */
+template <typename T>
+int ardMultiGrad_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> precompWeights,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaMap,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> lengthscaleArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,-1>, nb::device::cpu, nb::c_contig> gradArr,
+        int numThreads, bool fitIntercept){
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = inputArr.shape(0);
+
+    T *inputPtr = static_cast<T*>(inputArr.data());
+    T *precompWeightsPtr = static_cast<T*>(precompWeights.data());
+    double *outputPtr = static_cast<double*>(outputArr.data());
+    double *gradientPtr = static_cast<double*>(gradArr.data());
+    int32_t *sigmaMapPtr = static_cast<int32_t*>(sigmaMap.data());
+    double *lengthscalePtr = static_cast<double*>(lengthscaleArr.data());
+
+    size_t numFreqs = precompWeights.shape(0);
+    double numFreqsFlt = numFreqs;
+    size_t numLengthscales = gradArr.shape(3);
+    int numCandidates = lengthscaleArr.shape(0);
+
+    if (inputArr.shape(0) == 0 || outputArr.shape(1) != inputArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numCandidates == 0 || outputArr.shape(0) != lengthscaleArr.shape(0) ||
+            lengthscaleArr.shape(1) != numLengthscales)
+        throw std::runtime_error("Wrong array sizes.");
+    if (gradArr.shape(0) != outputArr.shape(0) || gradArr.shape(1) != outputArr.shape(1) ||
+            gradArr.shape(2) != outputArr.shape(2))
+        throw std::runtime_error("Wrong array sizes.");
+    if (precompWeights.shape(1) != inputArr.shape(1))
+        throw std::runtime_error("Wrong array sizes.");
+    if (outputArr.shape(2) != 2 * precompWeights.shape(0) || sigmaMap.shape(0) != precompWeights.shape(1))
+        throw std::runtime_error("Wrong array sizes.");
+
+
+    T rbfNormConstant;
+
+    if (fitIntercept)
+        rbfNormConstant = std::sqrt(1.0 / (numFreqsFlt - 0.5));
+    else
+        rbfNormConstant = std::sqrt(1.0 / numFreqsFlt);
+
+    int zDim1 = inputArr.shape(1);
+
+    // Group the columns by lengthscale as for ardGrad_. The lengthscales of
+    // the first candidate are used by the microkernel, so that its features
+    // come directly from the weighted sums; the others are calculated from
+    // the per-lengthscale products.
+    std::vector<int32_t> columnOrder(zDim1), groupStarts(numLengthscales + 1, 0);
+    for (int k=0; k < zDim1; k++){
+        if (sigmaMapPtr[k] < 0 || sigmaMapPtr[k] >= static_cast<int32_t>(numLengthscales))
+            throw std::runtime_error("Wrong array sizes.");
+        groupStarts[sigmaMapPtr[k] + 1] += 1;
+    }
+    for (size_t l=0; l < numLengthscales; l++)
+        groupStarts[l + 1] += groupStarts[l];
+
+    std::vector<int32_t> groupPositions(groupStarts.begin(), groupStarts.end() - 1);
+    std::vector<double> groupedSigmaVals(zDim1);
+    for (int k=0; k < zDim1; k++){
+        int32_t position = groupPositions[sigmaMapPtr[k]]++;
+        columnOrder[position] = k;
+        groupedSigmaVals[position] = lengthscalePtr[sigmaMapPtr[k]];
+    }
+
+    std::vector<T> groupedWeights(numFreqs * zDim1);
+    for (size_t j=0; j < numFreqs; j++){
+        for (int k=0; k < zDim1; k++)
+            groupedWeights[j * zDim1 + k] = precompWeightsPtr[j * zDim1 + columnOrder[k]];
+    }
+
+    RFGenThreadPool::getInstance().parallelForRows(zDim0, numThreads,
+            [&](int startRow, int endRow, int threadIndex){
+        ThreadARDMultiGrad<T>(inputPtr, outputPtr, groupedWeights.data(),
+                columnOrder.data(), groupStarts.data(), groupedSigmaVals.data(),
+                lengthscalePtr, gradientPtr, startRow, endRow, zDim0, zDim1,
+                numLengthscales, numFreqs, numCandidates, rbfNormConstant,
+                threadIndex);
+    });
+    return 0;
+}
+template int ardMultiGrad_<double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> precompWeights,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaMap,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> lengthscaleArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,-1>, nb::device::cpu, nb::c_contig> gradArr,
+        int numThreads, bool fitIntercept);
+template int ardMultiGrad_<float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> precompWeights,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaMap,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> lengthscaleArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,-1>, nb::device::cpu, nb::c_contig> gradArr,
+        int numThreads, bool fitIntercept);
+
+
+
+
+
+
+
+/*!
+ * # ardMicroKernel
+ *
+ * Calculates the product of ARD_ROW_BLOCK rows of the (grouped) input with
+ * one row of the (grouped) precomputed weights for each lengthscale, and
+ * the lengthscale-weighted sum over all columns. Each weight is loaded once
+ * and used for all of the rows in the block.
+ *
+ * ## Args:
+ *
+ * + `xBlock` ARD_ROW_BLOCK rows of the input, each of length dim1, with
+ * the columns in grouped order.
+ * + `weightRow` One row of the grouped precomputed weights.
+ * + `groupedSigmaVals` The lengthscale for each column in grouped order.
+ * + `groupStarts` The first column for each lengthscale, followed by dim1.
+ * + `numLengthscales` The number of lengthscales.
+ * + `dim1` The number of columns.
+ * + `gradSums` A (ARD_ROW_BLOCK x numLengthscales) array for the
+ * per-lengthscale products.
+ * + `rfSums` An ARD_ROW_BLOCK array for the lengthscale-weighted sums.
+ */
+template <typename T>
+static inline void ardMicroKernel(const T *xBlock, const T *weightRow,
+        const double *groupedSigmaVals, const int32_t *groupStarts,
+        int numLengthscales, int dim1, double *gradSums, double *rfSums){
+    const T *x0 = xBlock, *x1 = xBlock + dim1, *x2 = xBlock + 2 * dim1,
+          *x3 = xBlock + 3 * dim1;
+    double rf0 = 0, rf1 = 0, rf2 = 0, rf3 = 0;
+
+    for (int l=0; l < numLengthscales; l++){
+        double g0 = 0, g1 = 0, g2 = 0, g3 = 0;
+
+        for (int k=groupStarts[l]; k < groupStarts[l+1]; k++){
+            T weight = weightRow[k];
+            double sigmaVal = groupedSigmaVals[k];
+            double p0 = x0[k] * weight, p1 = x1[k] * weight,
+                   p2 = x2[k] * weight, p3 = x3[k] * weight;
+            g0 += p0;
+            g1 += p1;
+            g2 += p2;
+            g3 += p3;
+            rf0 += sigmaVal * p0;
+            rf1 += sigmaVal * p1;
+            rf2 += sigmaVal * p2;
+            rf3 += sigmaVal * p3;
+        }
+        gradSums[l] = g0;
+        gradSums[l + numLengthscales] = g1;
+        gradSums[l + 2 * numLengthscales] = g2;
+        gradSums[l + 3 * numLengthscales] = g3;
+    }
+    rfSums[0] = rf0;
+    rfSums[1] = rf1;
+    rfSums[2] = rf2;
+    rfSums[3] = rf3;
+}
+
 
 
 /*!
  * # ThreadARDGrad
  *
  * Performs ARD gradient-only calculations using pregenerated
- * features and weights.
+ * features and weights. The rows assigned to this thread are
+ * copied, ARD_ROW_PANEL at a time, into a scratch buffer with the
+ * columns in grouped order. Each panel is then multiplied against
+ * the weights ARD_FREQ_TILE frequencies at a time, so that a tile
+ * of weights stays in cache while it is used for every row in the
+ * panel.
+ *
+ * ## Args:
+ *
+ * + `inputX` The (N x dim1) input.
+ * + `randomFeatures` The (N x 2 * numFreqs) output array.
+ * + `groupedWeights` The (numFreqs x dim1) precomputed weights with the
+ * columns in grouped order.
+ * + `columnOrder` The original column for each grouped column.
+ * + `groupStarts` The first grouped column for each lengthscale, followed
+ * by dim1.
+ * + `groupedSigmaVals` The lengthscale for each grouped column.
+ * + `gradient` The (N x 2 * numFreqs x numLengthscales) gradient array.
+ * + `startRow` The first row to process.
+ * + `endRow` The last row to process (not inclusive).
+ * + `dim1` The number of columns.
+ * + `numLengthscales` The number of lengthscales.
+ * + `numFreqs` The number of frequencies.
+ * + `rbfNormConstant` The normalization constant for the features.
+ * + `threadIndex` The thread pool index of the calling thread.
  */
 template <typename T>
 void *ThreadARDGrad(T inputX[], double *randomFeatures,
-        T precompWeights[], int32_t *sigmaMap,
-        double *sigmaVals, double *gradient,
-        int startRow, int endRow,
+        const T groupedWeights[], const int32_t *columnOrder,
+        const int32_t *groupStarts, const double *groupedSigmaVals,
+        double *gradient, int startRow, int endRow,
         int dim1, int numLengthscales,
-        int numFreqs, double rbfNormConstant){
-    int i, j, k;
-    int gradIncrement = numFreqs * numLengthscales;
-    T *xElement, *precompWeight;
-    double dotProd;
-    double *gradientElement, *randomFeature;
-    double gradVal, sinVal, cosVal, rfSum;
-
-    xElement = inputX + startRow * dim1;
-
-    for (i=startRow; i < endRow; i++){
-        precompWeight = precompWeights;
-        gradientElement = gradient + i * 2 * gradIncrement;
-        randomFeature = randomFeatures + i * numFreqs * 2;
-
-        for (j=0; j < numFreqs; j++){
-            rfSum = 0;
-
-            for (k=0; k < dim1; k++){
-                dotProd = xElement[k] * *precompWeight;
-                gradientElement[sigmaMap[k]] += dotProd;
-                rfSum += sigmaVals[k] * dotProd;
-                precompWeight++;
+        int numFreqs, double rbfNormConstant, int threadIndex){
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+    T *xPanel = threadPool.getScratchBuffer<T>(threadIndex,
+            static_cast<size_t>(ARD_ROW_PANEL) * dim1);
+    double *gradSums = threadPool.getScratchBuffer<double>(threadIndex,
+            ARD_ROW_BLOCK * numLengthscales, 1);
+    double rfSums[ARD_ROW_BLOCK];
+    size_t gradIncrement = 2 * static_cast<size_t>(numFreqs) * numLengthscales;
+
+    for (int panelStart=startRow; panelStart < endRow; panelStart += ARD_ROW_PANEL){
+        int panelRows = MIN(ARD_ROW_PANEL, endRow - panelStart);
+
+        // Copy the panel with the columns in grouped order, padding it
+        // with zeros to a whole number of row blocks.
+        for (int r=0; r < ARD_ROW_PANEL; r++){
+            T *xCopy = xPanel + static_cast<size_t>(r) * dim1;
+            if (r >= panelRows){
+                if (r >= (panelRows + ARD_ROW_BLOCK - 1) / ARD_ROW_BLOCK * ARD_ROW_BLOCK)
+                    break;
+                for (int k=0; k < dim1; k++)
+                    xCopy[k] = 0;
+                continue;
             }
+            T *xRow = inputX + static_cast<size_t>(panelStart + r) * dim1;
+            for (int k=0; k < dim1; k++)
+                xCopy[k] = xRow[columnOrder[k]];
+        }
+
+        for (int freqStart=0; freqStart < numFreqs; freqStart += ARD_FREQ_TILE){
+            int freqEnd = MIN(freqStart + ARD_FREQ_TILE, numFreqs);
+
+            for (int blockStart=0; blockStart < panelRows; blockStart += ARD_ROW_BLOCK){
+                int blockRows = MIN(ARD_ROW_BLOCK, panelRows - blockStart);
+                const T *xBlock = xPanel + static_cast<size_t>(blockStart) * dim1;
+
+                for (int j=freqStart; j < freqEnd; j++){
+                    ardMicroKernel<T>(xBlock, groupedWeights + static_cast<size_t>(j) * dim1,
+                            groupedSigmaVals, groupStarts, numLengthscales, dim1,
+                            gradSums, rfSums);
+
+                    for (int r=0; r < blockRows; r++){
+                        size_t row = panelStart + blockStart + r;
+                        double cosVal = rbfNormConstant * cos(rfSums[r]);
+                        double sinVal = rbfNormConstant * sin(rfSums[r]);
+                        double *randomFeature = randomFeatures + row * 2 * numFreqs + 2 * j;
+                        double *gradientElement = gradient + row * gradIncrement +
+                            2 * static_cast<size_t>(j) * numLengthscales;
+                        const double *gradSum = gradSums + r * numLengthscales;
+
+                        randomFeature[0] = cosVal;
+                        randomFeature[1] = sinVal;
+                        for (int l=0; l < numLengthscales; l++){
+                            gradientElement[l] = -gradSum[l] * sinVal;
+                            gradientElement[l + numLengthscales] = gradSum[l] * cosVal;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+
+
+
+/*!
+ * # ThreadARDMultiGrad
+ *
+ * Performs ARD gradient-only calculations for each of numCandidates
+ * sets of lengthscales, tiling the rows and frequencies as for
+ * ThreadARDGrad. Each per-lengthscale product from the microkernel
+ * is used for every candidate while it is in cache.
+ *
+ * ## Args:
+ *
+ * + `inputX` The (N x dim1) input.
+ * + `randomFeatures` The (numCandidates x N x 2 * numFreqs) output array.
+ * + `groupedWeights` The (numFreqs x dim1) precomputed weights with the
+ * columns in grouped order.
+ * + `columnOrder` The original column for each grouped column.
+ * + `groupStarts` The first grouped column for each lengthscale, followed
+ * by dim1.
+ * + `groupedSigmaVals` The first candidate's lengthscale for each
+ * grouped column.
+ * + `lengthscales` The (numCandidates x numLengthscales) lengthscales.
+ * + `gradient` The (numCandidates x N x 2 * numFreqs x numLengthscales)
+ * gradient array.
+ * + `startRow` The first row to process.
+ * + `endRow` The last row to process (not inclusive).
+ * + `numRows` The number of rows (N).
+ * + `dim1` The number of columns.
+ * + `numLengthscales` The number of lengthscales.
+ * + `numFreqs` The number of frequencies.
+ * + `numCandidates` The number of sets of lengthscales.
+ * + `rbfNormConstant` The normalization constant for the features.
+ * + `threadIndex` The thread pool index of the calling thread.
+ */
+template <typename T>
+void *ThreadARDMultiGrad(T inputX[], double *randomFeatures,
+        const T groupedWeights[], const int32_t *columnOrder,
+        const int32_t *groupStarts, const double *groupedSigmaVals,
+        const double *lengthscales, double *gradient, int startRow,
+        int endRow, int numRows, int dim1, int numLengthscales,
+        int numFreqs, int numCandidates, double rbfNormConstant,
+        int threadIndex){
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+    T *xPanel = threadPool.getScratchBuffer<T>(threadIndex,
+            static_cast<size_t>(ARD_ROW_PANEL) * dim1);
+    double *gradSums = threadPool.getScratchBuffer<double>(threadIndex,
+            ARD_ROW_BLOCK * numLengthscales, 1);
+    double rfSums[ARD_ROW_BLOCK];
+    size_t gradIncrement = 2 * static_cast<size_t>(numFreqs) * numLengthscales;
+    size_t rfCandidateStride = 2 * static_cast<size_t>(numFreqs) * numRows;
+    size_t gradCandidateStride = gradIncrement * numRows;
+
+    for (int panelStart=startRow; panelStart < endRow; panelStart += ARD_ROW_PANEL){
+        int panelRows = MIN(ARD_ROW_PANEL, endRow - panelStart);
+
+        // Copy the panel with the columns in grouped order, padding it
+        // with zeros to a whole number of row blocks.
+        for (int r=0; r < ARD_ROW_PANEL; r++){
+            T *xCopy = xPanel + static_cast<size_t>(r) * dim1;
+            if (r >= panelRows){
+                if (r >= (panelRows + ARD_ROW_BLOCK - 1) / ARD_ROW_BLOCK * ARD_ROW_BLOCK)
+                    break;
+                for (int k=0; k < dim1; k++)
+                    xCopy[k] = 0;
+                continue;
+            }
+            T *xRow = inputX + static_cast<size_t>(panelStart + r) * dim1;
+            for (int k=0; k < dim1; k++)
+                xCopy[k] = xRow[columnOrder[k]];
+        }
+
+        for (int freqStart=0; freqStart < numFreqs; freqStart += ARD_FREQ_TILE){
+            int freqEnd = MIN(freqStart + ARD_FREQ_TILE, numFreqs);
+
+            for (int blockStart=0; blockStart < panelRows; blockStart += ARD_ROW_BLOCK){
+                int blockRows = MIN(ARD_ROW_BLOCK, panelRows - blockStart);
+                const T *xBlock = xPanel + static_cast<size_t>(blockStart) * dim1;
+
+                for (int j=freqStart; j < freqEnd; j++){
+                    ardMicroKernel<T>(xBlock, groupedWeights + static_cast<size_t>(j) * dim1,
+                            groupedSigmaVals, groupStarts, numLengthscales, dim1,
+                            gradSums, rfSums);
+
+                    for (int r=0; r < blockRows; r++){
+                        size_t row = panelStart + blockStart + r;
+                        const double *gradSum = gradSums + r * numLengthscales;
+
+                        for (int c=0; c < numCandidates; c++){
+                            double rfVal = rfSums[r];
+                            if (c > 0){
+                                const double *candidate = lengthscales +
+                                    static_cast<size_t>(c) * numLengthscales;
+                                rfVal = 0;
+                                for (int l=0; l < numLengthscales; l++)
+                                    rfVal += candidate[l] * gradSum[l];
+                            }
+                            double cosVal = rbfNormConstant * cos(rfVal);
+                            double sinVal = rbfNormConstant * sin(rfVal);
+                            double *randomFeature = randomFeatures + c * rfCandidateStride +
+                                row * 2 * numFreqs + 2 * j;
+                            double *gradientElement = gradient + c * gradCandidateStride +
+                                row * gradIncrement + 2 * static_cast<size_t>(j) * numLengthscales;
 
-            cosVal = rbfNormConstant * cos(rfSum);
-            sinVal = rbfNormConstant * sin(rfSum);
-            *randomFeature = cosVal;
-            randomFeature++;
-            *randomFeature = sinVal;
-            randomFeature++;
-
-            for (k=0; k < numLengthscales; k++){
-                gradVal = gradientElement[k];
-                gradientElement[k] = -gradVal * sinVal;
-                gradientElement[k + numLengthscales] = gradVal * cosVal;
+                            randomFeature[0] = cosVal;
+                            randomFeature[1] = sinVal;
+                            for (int l=0; l < numLengthscales; l++){
+                                gradientElement[l] = -gradSum[l] * sinVal;
+                                gradientElement[l + numLengthscales] = gradSum[l] * cosVal;
+                            }
+                        }
+                    }
+                }
             }
-            gradientElement += 2 * numLengthscales;
         }
-        xElement += dim1;
     }
     return NULL;
 }
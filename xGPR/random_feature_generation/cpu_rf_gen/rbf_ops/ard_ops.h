@@ -7,6 +7,13 @@
 
 namespace nb = nanobind;
 
+// The number of rows handled together by the gradient microkernel, the
+// number of rows copied into scratch at a time, and the number of
+// frequencies whose weights are reused across a panel before moving on.
+#define ARD_ROW_BLOCK 4
+#define ARD_ROW_PANEL 32
+#define ARD_FREQ_TILE 16
+
 
 template <typename T>
 int ardGrad_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
@@ -17,14 +24,32 @@ int ardGrad_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inp
         nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> gradArr,
         int numThreads, bool fitIntercept);
 
+template <typename T>
+int ardMultiGrad_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> precompWeights,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaMap,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> lengthscaleArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,-1>, nb::device::cpu, nb::c_contig> gradArr,
+        int numThreads, bool fitIntercept);
+
 
 
 template <typename T>
 void *ThreadARDGrad(T inputX[], double *randomFeatures,
-        T precompWeights[], int32_t *sigmaMap,
-        double *sigmaVals, double *gradient,
-        int startRow, int endRow,
+        const T groupedWeights[], const int32_t *columnOrder,
+        const int32_t *groupStarts, const double *groupedSigmaVals,
+        double *gradient, int startRow, int endRow,
         int dim1, int numLengthscales,
-        int numFreqs, double rbfNormConstant);
+        int numFreqs, double rbfNormConstant, int threadIndex);
+
+template <typename T>
+void *ThreadARDMultiGrad(T inputX[], double *randomFeatures,
+        const T groupedWeights[], const int32_t *columnOrder,
+        const int32_t *groupStarts, const double *groupedSigmaVals,
+        const double *lengthscales, double *gradient, int startRow,
+        int endRow, int numRows, int dim1, int numLengthscales,
+        int numFreqs, int numCandidates, double rbfNormConstant,
+        int threadIndex);
 
 #endif
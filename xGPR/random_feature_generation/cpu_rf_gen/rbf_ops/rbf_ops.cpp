@@ -6,10 +6,13 @@
  */
 #include <math.h>
 #include <vector>
-#include <thread>
 #include "rbf_ops.h"
 #include "../shared_fht_functions/hadamard_transforms.h"
 #include "../shared_fht_functions/shared_rfgen_ops.h"
+#include "../shared_fht_functions/thread_pool.h"
+#include "../shared_fht_functions/design_matrix_ops.h"
+#include "../shared_fht_functions/sincos_ops.h"
+#include "../../native_profiler.h"
 
 namespace nb = nanobind;
 
@@ -18,44 +21,744 @@ namespace nb = nanobind;
 /*!
  * # rbfFeatureGen_
  *
- * Generates features for the input array.
+ * Generates features for the input array. The output may be
+ * float or double regardless of the input type; float output
+ * halves the memory required for the features.
  *
  * ## Args:
  *
  * + `inputArr` A numpy array of shape (N x C).
- * + `outputArr` A numpy array of shape (N x R),
+ * + `outputArr` A numpy array of shape (N x R) of type U,
  * where R is the number of RFFs and is 2x numFreqs;
  * + `radem` A numpy stack of diagonal matrices of type int8_t
+ * of shape (3 x 1 x M) where M is the smallest power of 2 > numFreqs,
+ * or the same bit-packed into a uint8_t array of shape (3 x 1 x M / 8)
+ * (see getRademLength).
+ * + `chiArr` A numpy array of shape (numFreqs)
+ * + `numThreads` The number of threads to use.
+ * + `fitIntercept` If True, a y-intercept will be fitted.
+ * + `precisionMode` One of "exact" (use libm for the sine and cosine
+ * calculations) or "fast" (use a faster polynomial approximation).
+ * See sincos_ops.cpp.
+ */
+template <typename T, typename U, typename R>
+int rbfFeatureGen_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<R, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode) {
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = inputArr.shape(0);
+    int zDim1 = inputArr.shape(1);
+    size_t numRffs = outputArr.shape(1);
+    size_t numFreqs = chiArr.shape(0);
+    double numFreqsFlt = numFreqs;
+
+    T *inputPtr = static_cast<T*>(inputArr.data());
+    U *outputPtr = static_cast<U*>(outputArr.data());
+    T *chiPtr = static_cast<T*>(chiArr.data());
+    const R *rademPtr = static_cast<const R*>(radem.data());
+    int rademShape2 = getRademLength<R>(radem.shape(2));
+
+    if (inputArr.shape(0) == 0 || outputArr.shape(0) != inputArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numRffs < 2 || (numRffs & 1) != 0)
+        throw std::runtime_error("last dim of output must be even number");
+    if ( (2 * numFreqs) != numRffs || numFreqs > static_cast<size_t>(rademShape2) )
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    double expectedNFreq = (zDim1 > 2) ? static_cast<double>(zDim1) : 2.0;
+    double log2Freqs = std::log2(expectedNFreq);
+    log2Freqs = std::ceil(log2Freqs);
+    int paddedBufferSize = std::pow(2, log2Freqs);
+
+    if (rademShape2 % paddedBufferSize != 0)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    T rbfNormConstant;
+
+    if (fitIntercept)
+        rbfNormConstant = std::sqrt(1.0 / (numFreqsFlt - 0.5));
+    else
+        rbfNormConstant = std::sqrt(1.0 / numFreqsFlt);
+
+
+    int sincosMode = getSinCosMode(precisionMode);
+    SORFFunction<T, R> sorfFunction = getSORFFunction<T, R>(paddedBufferSize);
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+
+    PROFILE_COUNT(PROFILE_BYTES, inputArr.nbytes() + outputArr.nbytes());
+    threadPool.parallelForRows(zDim0, numThreads,
+            [&](int startRow, int endRow, int threadIndex){
+        T *copyBuffer = threadPool.getScratchBuffer<T>(threadIndex,
+                getRBFGenBufferSize(paddedBufferSize));
+        allInOneRBFGen<T, U, R>(inputPtr, rademPtr, chiPtr, outputPtr,
+                zDim1, numFreqs, rademShape2, startRow, endRow,
+                paddedBufferSize, rbfNormConstant, sincosMode,
+                sorfFunction, copyBuffer);
+    });
+    return 0;
+}
+//Explicitly instantiate so wrapper can use.
+template int rbfFeatureGen_<double, double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfFeatureGen_<float, double>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfFeatureGen_<float, float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfFeatureGen_<double, double, uint8_t>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<uint8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfFeatureGen_<float, double, uint8_t>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<uint8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfFeatureGen_<float, float, uint8_t>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<uint8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+
+
+
+
+/*!
+ * # rbfGrad_
+ *
+ * Generates features and the gradient w/r/t sigma. As for
+ * rbfFeatureGen_, the output and gradient may be float or double.
+ *
+ * ## Args:
+ *
+ * + `inputArr` A numpy array of shape (N x C).
+ * + `outputArr` A numpy array of shape (N x R) of type U,
+ * where R is the number of RFFs and is 2x numFreqs;
+ * + `gradArr` A numpy array of shape (N x R x 1) of type U,
+ * where R is the number of RFFs and is 2x numFreqs;
+ * + `radem` A numpy stack of diagonal matrices of type int8_t
+ * of shape (3 x 1 x M) where M is the smallest power of 2 > numFreqs,
+ * or the same bit-packed into a uint8_t array of shape (3 x 1 x M / 8)
+ * (see getRademLength).
+ * + `chiArr` A numpy array of shape (numFreqs)
+ * + `sigma` The sigma hyperparameter
+ * + `numThreads` The number of threads to use.
+ * + `fitIntercept` If True, a y-intercept will be fitted.
+ * + `precisionMode` One of "exact" (use libm for the sine and cosine
+ * calculations) or "fast" (use a faster polynomial approximation).
+ * See sincos_ops.cpp.
+ */
+template <typename T, typename U, typename R>
+int rbfGrad_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<U, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<R, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        float sigma, int numThreads, bool fitIntercept,
+        const std::string &precisionMode) {
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = inputArr.shape(0);
+    int zDim1 = inputArr.shape(1);
+    size_t numRffs = outputArr.shape(1);
+    size_t numFreqs = chiArr.shape(0);
+    double numFreqsFlt = numFreqs;
+
+    T *inputPtr = static_cast<T*>(inputArr.data());
+    U *outputPtr = static_cast<U*>(outputArr.data());
+    U *gradientPtr = static_cast<U*>(gradArr.data());
+    T *chiPtr = static_cast<T*>(chiArr.data());
+    const R *rademPtr = static_cast<const R*>(radem.data());
+    int rademShape2 = getRademLength<R>(radem.shape(2));
+
+    if (inputArr.shape(0) == 0 || outputArr.shape(0) != inputArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numRffs < 2 || (numRffs & 1) != 0)
+        throw std::runtime_error("last dim of output must be even number");
+    if ( (2 * numFreqs) != numRffs || numFreqs > static_cast<size_t>(rademShape2) )
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+    if (gradArr.shape(0) != outputArr.shape(0) || gradArr.shape(1) != outputArr.shape(1))
+        throw std::runtime_error("Wrong array sizes.");
+
+    double expectedNFreq = (zDim1 > 2) ? static_cast<double>(zDim1) : 2.0;
+    double log2Freqs = std::log2(expectedNFreq);
+    log2Freqs = std::ceil(log2Freqs);
+    int paddedBufferSize = std::pow(2, log2Freqs);
+
+    if (rademShape2 % paddedBufferSize != 0)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    T rbfNormConstant;
+
+    if (fitIntercept)
+        rbfNormConstant = std::sqrt(1.0 / (numFreqsFlt - 0.5));
+    else
+        rbfNormConstant = std::sqrt(1.0 / numFreqsFlt);
+
+    int sincosMode = getSinCosMode(precisionMode);
+    SORFFunction<T, R> sorfFunction = getSORFFunction<T, R>(paddedBufferSize);
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+
+    PROFILE_COUNT(PROFILE_BYTES, inputArr.nbytes() + outputArr.nbytes() +
+            gradArr.nbytes());
+    threadPool.parallelForRows(zDim0, numThreads,
+            [&](int startRow, int endRow, int threadIndex){
+        T *copyBuffer = threadPool.getScratchBuffer<T>(threadIndex,
+                paddedBufferSize);
+        allInOneRBFGrad<T, U, R>(inputPtr, rademPtr, chiPtr, outputPtr,
+                gradientPtr, zDim1, numFreqs, rademShape2, startRow,
+                endRow, paddedBufferSize, rbfNormConstant, sigma,
+                sincosMode, sorfFunction, copyBuffer);
+    });
+    return 0;
+}
+//Explicitly instantiate for external use.
+template int rbfGrad_<double, double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        float sigma, int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfGrad_<float, double>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        float sigma, int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfGrad_<float, float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        float sigma, int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfGrad_<double, double, uint8_t>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<uint8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        float sigma, int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfGrad_<float, double, uint8_t>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<uint8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        float sigma, int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfGrad_<float, float, uint8_t>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<uint8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        float sigma, int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+
+
+
+
+/*!
+ * # rbfProjection_
+ *
+ * Stores the pre-activation projections chi * SORF(x) for the input.
+ * These do not depend on sigma, so they can be generated once for a
+ * chunk of data and reused by rbfProjectionFGen_ / rbfProjectionGrad_
+ * for each candidate sigma during tuning. The projections may be
+ * stored as float or double regardless of the input type, and
+ * projArr may be a memory-mapped array.
+ *
+ * ## Args:
+ *
+ * + `inputArr` A numpy array of shape (N x C). Unlike for rbfFeatureGen_,
+ * this should NOT have been multiplied by sigma.
+ * + `projArr` A numpy array of shape (N x numFreqs) of type P in
+ * which the projections will be stored.
+ * + `radem` A numpy stack of diagonal matrices of type int8_t
+ * of shape (3 x 1 x M) where M is the smallest power of 2 > numFreqs.
+ * + `chiArr` A numpy array of shape (numFreqs)
+ * + `numThreads` The number of threads to use.
+ */
+template <typename T, typename P>
+int rbfProjection_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<P, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> projArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads) {
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = inputArr.shape(0);
+    int zDim1 = inputArr.shape(1);
+    size_t numFreqs = chiArr.shape(0);
+
+    T *inputPtr = static_cast<T*>(inputArr.data());
+    P *projPtr = static_cast<P*>(projArr.data());
+    T *chiPtr = static_cast<T*>(chiArr.data());
+    int8_t *rademPtr = static_cast<int8_t*>(radem.data());
+
+    if (inputArr.shape(0) == 0 || projArr.shape(0) != inputArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numFreqs == 0 || projArr.shape(1) != numFreqs || numFreqs > radem.shape(2) )
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    double expectedNFreq = (zDim1 > 2) ? static_cast<double>(zDim1) : 2.0;
+    double log2Freqs = std::log2(expectedNFreq);
+    log2Freqs = std::ceil(log2Freqs);
+    int paddedBufferSize = std::pow(2, log2Freqs);
+
+    if (radem.shape(2) % paddedBufferSize != 0)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    int rademShape2 = radem.shape(2);
+    SORFFunction<T> sorfFunction = getSORFFunction<T>(paddedBufferSize);
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+
+    threadPool.parallelForRows(zDim0, numThreads,
+            [&](int startRow, int endRow, int threadIndex){
+        T *copyBuffer = threadPool.getScratchBuffer<T>(threadIndex,
+                paddedBufferSize);
+        allInOneRBFProjection<T, P>(inputPtr, rademPtr, chiPtr, projPtr,
+                zDim1, numFreqs, rademShape2, startRow, endRow,
+                paddedBufferSize, sorfFunction, copyBuffer);
+    });
+    return 0;
+}
+//Explicitly instantiate so wrapper can use.
+template int rbfProjection_<double, double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> projArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads);
+template int rbfProjection_<double, float>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> projArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads);
+template int rbfProjection_<float, float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> projArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads);
+
+
+
+
+/*!
+ * # rbfProjectionFGen_
+ *
+ * Generates features from stored projections (see rbfProjection_)
+ * for one or more values of sigma in a single pass over the
+ * projections, so that each candidate sigma only costs the sine
+ * and cosine evaluations.
+ *
+ * ## Args:
+ *
+ * + `projArr` A numpy array of shape (N x numFreqs) of type P.
+ * + `outputArr` A numpy array of shape (S x N x R) of type U,
+ * where S is the number of sigma values and R is 2x numFreqs.
+ * + `sigmaArr` A numpy array of shape (S) containing the sigma values.
+ * + `numThreads` The number of threads to use.
+ * + `fitIntercept` If True, a y-intercept will be fitted.
+ * + `precisionMode` One of "exact" (use libm for the sine and cosine
+ * calculations) or "fast" (use a faster polynomial approximation).
+ * See sincos_ops.cpp.
+ */
+template <typename P, typename U>
+int rbfProjectionFGen_(nb::ndarray<P, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> projArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode) {
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = projArr.shape(0);
+    int numFreqs = projArr.shape(1);
+    int numSigmas = sigmaArr.shape(0);
+    double numFreqsFlt = numFreqs;
+
+    P *projPtr = static_cast<P*>(projArr.data());
+    U *outputPtr = static_cast<U*>(outputArr.data());
+    double *sigmaPtr = static_cast<double*>(sigmaArr.data());
+
+    if (projArr.shape(0) == 0 || outputArr.shape(1) != projArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numSigmas == 0 || outputArr.shape(0) != sigmaArr.shape(0))
+        throw std::runtime_error("Wrong array sizes.");
+    if (numFreqs == 0 || outputArr.shape(2) != 2 * projArr.shape(1))
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    double rbfNormConstant;
+
+    if (fitIntercept)
+        rbfNormConstant = std::sqrt(1.0 / (numFreqsFlt - 0.5));
+    else
+        rbfNormConstant = std::sqrt(1.0 / numFreqsFlt);
+
+    int sincosMode = getSinCosMode(precisionMode);
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+
+    threadPool.parallelForRows(zDim0, numThreads,
+            [&](int startRow, int endRow, int){
+        rbfProjectionPostProcess<P, U>(projPtr, sigmaPtr, outputPtr,
+                static_cast<U*>(NULL), zDim0, numFreqs, numSigmas,
+                startRow, endRow, rbfNormConstant, sincosMode);
+    });
+    return 0;
+}
+//Explicitly instantiate so wrapper can use.
+template int rbfProjectionFGen_<double, double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> projArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfProjectionFGen_<float, double>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> projArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfProjectionFGen_<float, float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> projArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+
+
+
+
+/*!
+ * # rbfProjectionGrad_
+ *
+ * Generates features and the gradient w/r/t sigma from stored
+ * projections (see rbfProjection_) for one or more values of
+ * sigma in a single pass over the projections.
+ *
+ * ## Args:
+ *
+ * + `projArr` A numpy array of shape (N x numFreqs) of type P.
+ * + `outputArr` A numpy array of shape (S x N x R) of type U,
+ * where S is the number of sigma values and R is 2x numFreqs.
+ * + `gradArr` A numpy array of shape (S x N x R x 1) of type U.
+ * + `sigmaArr` A numpy array of shape (S) containing the sigma values.
+ * + `numThreads` The number of threads to use.
+ * + `fitIntercept` If True, a y-intercept will be fitted.
+ * + `precisionMode` One of "exact" (use libm for the sine and cosine
+ * calculations) or "fast" (use a faster polynomial approximation).
+ * See sincos_ops.cpp.
+ */
+template <typename P, typename U>
+int rbfProjectionGrad_(nb::ndarray<P, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> projArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode) {
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = projArr.shape(0);
+    int numFreqs = projArr.shape(1);
+    int numSigmas = sigmaArr.shape(0);
+    double numFreqsFlt = numFreqs;
+
+    P *projPtr = static_cast<P*>(projArr.data());
+    U *outputPtr = static_cast<U*>(outputArr.data());
+    U *gradientPtr = static_cast<U*>(gradArr.data());
+    double *sigmaPtr = static_cast<double*>(sigmaArr.data());
+
+    if (projArr.shape(0) == 0 || outputArr.shape(1) != projArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numSigmas == 0 || outputArr.shape(0) != sigmaArr.shape(0))
+        throw std::runtime_error("Wrong array sizes.");
+    if (numFreqs == 0 || outputArr.shape(2) != 2 * projArr.shape(1))
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+    if (gradArr.shape(0) != outputArr.shape(0) || gradArr.shape(1) != outputArr.shape(1) ||
+            gradArr.shape(2) != outputArr.shape(2))
+        throw std::runtime_error("Wrong array sizes.");
+
+    double rbfNormConstant;
+
+    if (fitIntercept)
+        rbfNormConstant = std::sqrt(1.0 / (numFreqsFlt - 0.5));
+    else
+        rbfNormConstant = std::sqrt(1.0 / numFreqsFlt);
+
+    int sincosMode = getSinCosMode(precisionMode);
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+
+    threadPool.parallelForRows(zDim0, numThreads,
+            [&](int startRow, int endRow, int){
+        rbfProjectionPostProcess<P, U>(projPtr, sigmaPtr, outputPtr,
+                gradientPtr, zDim0, numFreqs, numSigmas,
+                startRow, endRow, rbfNormConstant, sincosMode);
+    });
+    return 0;
+}
+//Explicitly instantiate so wrapper can use.
+template int rbfProjectionGrad_<double, double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> projArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfProjectionGrad_<float, double>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> projArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfProjectionGrad_<float, float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> projArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+
+
+
+
+/*!
+ * # rbfMultiSigmaGrad_
+ *
+ * Generates features and the gradient w/r/t sigma for one or more
+ * values of sigma in a single pass over the input. Each row is
+ * transformed once and all of the sigma values are applied to it
+ * while it is in cache, so that each additional candidate sigma
+ * only costs the sine and cosine evaluations. Unlike
+ * rbfProjection_ / rbfProjectionGrad_, no projections are stored.
+ *
+ * ## Args:
+ *
+ * + `inputArr` A numpy array of shape (N x C). Unlike for rbfGrad_,
+ * this should NOT have been multiplied by sigma.
+ * + `outputArr` A numpy array of shape (S x N x R) of type U,
+ * where S is the number of sigma values and R is 2x numFreqs.
+ * + `gradArr` A numpy array of shape (S x N x R x 1) of type U.
+ * + `radem` A numpy stack of diagonal matrices of type int8_t
+ * of shape (3 x 1 x M) where M is the smallest power of 2 > numFreqs,
+ * or the same bit-packed into a uint8_t array of shape (3 x 1 x M / 8)
+ * (see getRademLength).
+ * + `chiArr` A numpy array of shape (numFreqs)
+ * + `sigmaArr` A numpy array of shape (S) containing the sigma values.
+ * + `numThreads` The number of threads to use.
+ * + `fitIntercept` If True, a y-intercept will be fitted.
+ * + `precisionMode` One of "exact" (use libm for the sine and cosine
+ * calculations) or "fast" (use a faster polynomial approximation).
+ * See sincos_ops.cpp.
+ */
+template <typename T, typename U, typename R>
+int rbfMultiSigmaGrad_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<R, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode) {
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = inputArr.shape(0);
+    int zDim1 = inputArr.shape(1);
+    int numSigmas = sigmaArr.shape(0);
+    size_t numFreqs = chiArr.shape(0);
+    double numFreqsFlt = numFreqs;
+
+    T *inputPtr = static_cast<T*>(inputArr.data());
+    U *outputPtr = static_cast<U*>(outputArr.data());
+    U *gradientPtr = static_cast<U*>(gradArr.data());
+    T *chiPtr = static_cast<T*>(chiArr.data());
+    double *sigmaPtr = static_cast<double*>(sigmaArr.data());
+    const R *rademPtr = static_cast<const R*>(radem.data());
+    int rademShape2 = getRademLength<R>(radem.shape(2));
+
+    if (inputArr.shape(0) == 0 || outputArr.shape(1) != inputArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numSigmas == 0 || outputArr.shape(0) != sigmaArr.shape(0))
+        throw std::runtime_error("Wrong array sizes.");
+    if (numFreqs == 0 || outputArr.shape(2) != 2 * numFreqs ||
+            numFreqs > static_cast<size_t>(rademShape2) )
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+    if (gradArr.shape(0) != outputArr.shape(0) || gradArr.shape(1) != outputArr.shape(1) ||
+            gradArr.shape(2) != outputArr.shape(2))
+        throw std::runtime_error("Wrong array sizes.");
+
+    double expectedNFreq = (zDim1 > 2) ? static_cast<double>(zDim1) : 2.0;
+    double log2Freqs = std::log2(expectedNFreq);
+    log2Freqs = std::ceil(log2Freqs);
+    int paddedBufferSize = std::pow(2, log2Freqs);
+
+    if (rademShape2 % paddedBufferSize != 0)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    double rbfNormConstant;
+
+    if (fitIntercept)
+        rbfNormConstant = std::sqrt(1.0 / (numFreqsFlt - 0.5));
+    else
+        rbfNormConstant = std::sqrt(1.0 / numFreqsFlt);
+
+    int sincosMode = getSinCosMode(precisionMode);
+    SORFFunction<T, R> sorfFunction = getSORFFunction<T, R>(paddedBufferSize);
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+
+    PROFILE_COUNT(PROFILE_BYTES, inputArr.nbytes() + outputArr.nbytes() +
+            gradArr.nbytes());
+    threadPool.parallelForRows(zDim0, numThreads,
+            [&](int startRow, int endRow, int threadIndex){
+        T *copyBuffer = threadPool.getScratchBuffer<T>(threadIndex,
+                paddedBufferSize, 0);
+        T *projBuffer = threadPool.getScratchBuffer<T>(threadIndex,
+                numFreqs, 1);
+        allInOneRBFMultiSigmaGrad<T, U, R>(inputPtr, rademPtr, chiPtr,
+                outputPtr, gradientPtr, sigmaPtr, numSigmas, zDim1,
+                zDim0, numFreqs, rademShape2, startRow, endRow,
+                paddedBufferSize, rbfNormConstant, sincosMode,
+                sorfFunction, copyBuffer, projBuffer);
+    });
+    return 0;
+}
+//Explicitly instantiate so wrapper can use.
+template int rbfMultiSigmaGrad_<double, double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfMultiSigmaGrad_<float, double>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfMultiSigmaGrad_<float, float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfMultiSigmaGrad_<double, double, uint8_t>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<uint8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfMultiSigmaGrad_<float, double, uint8_t>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<uint8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfMultiSigmaGrad_<float, float, uint8_t>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<uint8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+
+
+
+
+/*!
+ * # rbfDesignMatrix_
+ *
+ * Generates features for the input array and adds Z^T Z and Z^T y
+ * to the arrays supplied by the caller, without storing the full
+ * feature array. Features are generated for one block of rows at a
+ * time, and each block is added to zTzArr and zTyArr before the next
+ * is generated. This is used for RBF-type kernels and for MiniARD
+ * (if the input has already been multiplied by the lengthscales).
+ *
+ * ## Args:
+ *
+ * + `inputArr` A numpy array of shape (N x C).
+ * + `yArr` A numpy array of shape (N) containing the y-values.
+ * + `zTzArr` A numpy array of shape (R x R) to which Z^T Z is added,
+ * where R is the number of RFFs and is 2x numFreqs.
+ * + `zTyArr` A numpy array of shape (R) to which Z^T y is added.
+ * + `radem` A numpy stack of diagonal matrices of type int8_t
  * of shape (3 x 1 x M) where M is the smallest power of 2 > numFreqs.
  * + `chiArr` A numpy array of shape (numFreqs)
  * + `numThreads` The number of threads to use.
- * + `fitIntercept` If True, a y-intercept will be fitted.
+ * + `fitIntercept` If True, a y-intercept will be fitted, and the
+ * first feature for each datapoint is set to 1.
+ * + `precisionMode` One of "exact" (use libm for the sine and cosine
+ * calculations) or "fast" (use a faster polynomial approximation).
+ * See sincos_ops.cpp.
  */
 template <typename T>
-int rbfFeatureGen_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
-        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+int rbfDesignMatrix_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> zTyArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
         nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
-        int numThreads, bool fitIntercept) {
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode) {
     // Perform safety checks. Any exceptions thrown here are handed off to Python
     // by the Nanobind wrapper. We do not expect the user to see these because
     // the Python code will always ensure inputs are correct -- these are a failsafe
     // -- so we do not need to provide detailed exception messages here.
     int zDim0 = inputArr.shape(0);
     int zDim1 = inputArr.shape(1);
-    size_t numRffs = outputArr.shape(1);
+    size_t numRffs = zTzArr.shape(1);
     size_t numFreqs = chiArr.shape(0);
     double numFreqsFlt = numFreqs;
 
     T *inputPtr = static_cast<T*>(inputArr.data());
-    double *outputPtr = static_cast<double*>(outputArr.data());
+    double *yPtr = static_cast<double*>(yArr.data());
+    double *zTzPtr = static_cast<double*>(zTzArr.data());
+    double *zTyPtr = static_cast<double*>(zTyArr.data());
     T *chiPtr = static_cast<T*>(chiArr.data());
     int8_t *rademPtr = static_cast<int8_t*>(radem.data());
 
-    if (inputArr.shape(0) == 0 || outputArr.shape(0) != inputArr.shape(0))
+    if (inputArr.shape(0) == 0 || yArr.shape(0) != inputArr.shape(0))
         throw std::runtime_error("no datapoints");
     if (numRffs < 2 || (numRffs & 1) != 0)
         throw std::runtime_error("last dim of output must be even number");
+    if (zTzArr.shape(0) != numRffs || zTyArr.shape(0) != numRffs)
+        throw std::runtime_error("wrong array sizes");
     if ( (2 * numFreqs) != numRffs || numFreqs > radem.shape(2) )
         throw std::runtime_error("incorrect number of rffs and or freqs.");
 
@@ -74,96 +777,125 @@ int rbfFeatureGen_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_conti
     else
         rbfNormConstant = std::sqrt(1.0 / numFreqsFlt);
 
+    int rademShape2 = radem.shape(2);
+    int sincosMode = getSinCosMode(precisionMode);
+    SORFFunction<T> sorfFunction = getSORFFunction<T>(paddedBufferSize);
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
 
-    if (numThreads > zDim0)
-        numThreads = zDim0;
+    int blockRows = getDesignMatrixBlockRows(zDim0, numRffs);
+    std::vector<double> featureBlock(static_cast<size_t>(blockRows) * numRffs);
+    double *featurePtr = featureBlock.data();
 
-    std::vector<std::thread> threads(numThreads);
-    int startPosition, endPosition;
+    for (int blockStart=0; blockStart < zDim0; blockStart += blockRows){
+        int currentRows = zDim0 - blockStart;
+        if (currentRows > blockRows)
+            currentRows = blockRows;
+        T *blockInputPtr = inputPtr + static_cast<size_t>(blockStart) * zDim1;
 
-    int chunkSize = (zDim0 + numThreads - 1) / numThreads;
+        threadPool.parallelForRows(currentRows, numThreads,
+                [&](int startRow, int endRow, int threadIndex){
+            T *copyBuffer = threadPool.getScratchBuffer<T>(threadIndex,
+                    getRBFGenBufferSize(paddedBufferSize));
+            for (size_t i=startRow * numRffs; i < endRow * numRffs; i++)
+                featurePtr[i] = 0;
 
-    for (int i=0; i < numThreads; i++) {
-        startPosition = i * chunkSize;
-        endPosition = (i + 1) * chunkSize;
-        if (endPosition > zDim0)
-            endPosition = zDim0;
+            allInOneRBFGen<T, double>(blockInputPtr, rademPtr, chiPtr, featurePtr,
+                    zDim1, numFreqs, rademShape2, startRow, endRow,
+                    paddedBufferSize, rbfNormConstant, sincosMode,
+                    sorfFunction, copyBuffer);
 
-        threads[i] = std::thread(&allInOneRBFGen<T>, inputPtr,
-                rademPtr, chiPtr, outputPtr, inputArr.shape(1), numFreqs,
-                radem.shape(2), startPosition, endPosition,
-                paddedBufferSize, rbfNormConstant);
-    }
+            if (fitIntercept){
+                for (int i=startRow; i < endRow; i++)
+                    featurePtr[i * numRffs] = 1;
+            }
+        });
 
-    for (auto& th : threads)
-        th.join();
+        accumulateGramBlock(featurePtr, yPtr + blockStart, zTzPtr, zTyPtr,
+                currentRows, numRffs, numThreads);
+    }
     return 0;
 }
-//Explicitly instantiate so wrapper can use.
-template int rbfFeatureGen_<double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
-        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+//Explicitly instantiate for external use.
+template int rbfDesignMatrix_<double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> zTyArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
         nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
-        int numThreads, bool fitIntercept);
-template int rbfFeatureGen_<float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
-        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfDesignMatrix_<float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> zTyArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
         nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
-        int numThreads, bool fitIntercept);
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
 
 
 
 
 /*!
- * # rbfGrad_
+ * # rbfMatvec_
  *
- * Generates features and the gradient w/r/t sigma.
+ * Generates features for the input array and adds Z^T (Z V) to
+ * outputArr, where V is a batch of vectors, without storing the
+ * feature array. Each thread generates one feature row at a time in
+ * its scratch buffer and accumulates into its own copy of the output,
+ * so the cost of feature generation is shared across all columns of V.
+ * The per-thread copies are summed into outputArr at the end.
  *
  * ## Args:
  *
  * + `inputArr` A numpy array of shape (N x C).
- * + `outputArr` A numpy array of shape (N x R),
- * where R is the number of RFFs and is 2x numFreqs;
- * + `gradArr` A numpy array of shape (N x R x 1),
- * where R is the number of RFFs and is 2x numFreqs;
+ * + `vecArr` A numpy array of shape (R x K) containing the K vectors V,
+ * where R is the number of RFFs and is 2x numFreqs.
+ * + `outputArr` A numpy array of shape (R x K) to which Z^T (Z V) is added.
  * + `radem` A numpy stack of diagonal matrices of type int8_t
  * of shape (3 x 1 x M) where M is the smallest power of 2 > numFreqs.
  * + `chiArr` A numpy array of shape (numFreqs)
- * + `sigma` The sigma hyperparameter
  * + `numThreads` The number of threads to use.
- * + `fitIntercept` If True, a y-intercept will be fitted.
+ * + `fitIntercept` If True, a y-intercept will be fitted, and the
+ * first feature for each datapoint is set to 1.
+ * + `precisionMode` One of "exact" (use libm for the sine and cosine
+ * calculations) or "fast" (use a faster polynomial approximation).
+ * See sincos_ops.cpp.
  */
 template <typename T>
-int rbfGrad_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+int rbfMatvec_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> vecArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
-        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
         nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
-        float sigma, int numThreads, bool fitIntercept) {
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode) {
     // Perform safety checks. Any exceptions thrown here are handed off to Python
     // by the Nanobind wrapper. We do not expect the user to see these because
     // the Python code will always ensure inputs are correct -- these are a failsafe
     // -- so we do not need to provide detailed exception messages here.
     int zDim0 = inputArr.shape(0);
     int zDim1 = inputArr.shape(1);
-    size_t numRffs = outputArr.shape(1);
+    size_t numRffs = vecArr.shape(0);
+    int numVecs = vecArr.shape(1);
     size_t numFreqs = chiArr.shape(0);
     double numFreqsFlt = numFreqs;
 
     T *inputPtr = static_cast<T*>(inputArr.data());
+    double *vecPtr = static_cast<double*>(vecArr.data());
     double *outputPtr = static_cast<double*>(outputArr.data());
-    double *gradientPtr = static_cast<double*>(gradArr.data());
     T *chiPtr = static_cast<T*>(chiArr.data());
     int8_t *rademPtr = static_cast<int8_t*>(radem.data());
 
-    if (inputArr.shape(0) == 0 || outputArr.shape(0) != inputArr.shape(0))
+    if (inputArr.shape(0) == 0)
         throw std::runtime_error("no datapoints");
     if (numRffs < 2 || (numRffs & 1) != 0)
         throw std::runtime_error("last dim of output must be even number");
+    if (numVecs == 0 || outputArr.shape(0) != numRffs ||
+            outputArr.shape(1) != vecArr.shape(1))
+        throw std::runtime_error("wrong array sizes");
     if ( (2 * numFreqs) != numRffs || numFreqs > radem.shape(2) )
         throw std::runtime_error("incorrect number of rffs and or freqs.");
-    if (gradArr.shape(0) != outputArr.shape(0) || gradArr.shape(1) != outputArr.shape(1))
-        throw std::runtime_error("Wrong array sizes.");
 
     double expectedNFreq = (zDim1 > 2) ? static_cast<double>(zDim1) : 2.0;
     double log2Freqs = std::log2(expectedNFreq);
@@ -179,48 +911,277 @@ int rbfGrad_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inp
         rbfNormConstant = std::sqrt(1.0 / (numFreqsFlt - 0.5));
     else
         rbfNormConstant = std::sqrt(1.0 / numFreqsFlt);
-    
-    
-    
-    if (numThreads > zDim0)
-        numThreads = zDim0;
-
-    std::vector<std::thread> threads(numThreads);
-    int startPosition, endPosition;
-    int chunkSize = (zDim0 + numThreads - 1) / numThreads;
-
-    for (int i=0; i < numThreads; i++) {
-        startPosition = i * chunkSize;
-        endPosition = (i + 1) * chunkSize;
-        if (endPosition > zDim0)
-            endPosition = zDim0;
-
-        threads[i] = std::thread(&allInOneRBFGrad<T>, inputPtr,
-                rademPtr, chiPtr, outputPtr,
-                gradientPtr, inputArr.shape(1),
-                numFreqs, radem.shape(2), startPosition,
-                endPosition, paddedBufferSize,
-                rbfNormConstant, sigma);
-    }
 
-    for (auto& th : threads)
-        th.join();
+    int rademShape2 = radem.shape(2);
+    size_t outputSize = numRffs * numVecs;
+    int sincosMode = getSinCosMode(precisionMode);
+    SORFFunction<T> sorfFunction = getSORFFunction<T>(paddedBufferSize);
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+    std::vector<double*> threadOutputs(numThreads > 0 ? numThreads : 1, nullptr);
+
+    threadPool.parallelForRows(zDim0, numThreads,
+            [&](int startRow, int endRow, int threadIndex){
+        T *copyBuffer = threadPool.getScratchBuffer<T>(threadIndex,
+                getRBFGenBufferSize(paddedBufferSize), 0);
+        double *featureRow = threadPool.getScratchBuffer<double>(threadIndex,
+                numRffs, 1);
+        double *threadOutput = threadPool.getScratchBuffer<double>(threadIndex,
+                outputSize, 2);
+        double *rowProducts = threadPool.getScratchBuffer<double>(threadIndex,
+                numVecs, 3);
+
+        for (size_t i=0; i < outputSize; i++)
+            threadOutput[i] = 0;
+
+        for (int i=startRow; i < endRow; i++){
+            for (size_t j=0; j < numRffs; j++)
+                featureRow[j] = 0;
+
+            allInOneRBFGen<T, double>(inputPtr + static_cast<size_t>(i) * zDim1,
+                    rademPtr, chiPtr, featureRow, zDim1, numFreqs,
+                    rademShape2, 0, 1, paddedBufferSize, rbfNormConstant,
+                    sincosMode, sorfFunction, copyBuffer);
+            if (fitIntercept)
+                featureRow[0] = 1;
+
+            featureRowMatvec(featureRow, vecPtr, threadOutput, rowProducts,
+                    numRffs, numVecs);
+        }
+        threadOutputs[threadIndex] = threadOutput;
+    });
+
+    reduceThreadOutputs(threadOutputs, outputPtr, outputSize, numThreads);
     return 0;
 }
 //Explicitly instantiate for external use.
-template int rbfGrad_<double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+template int rbfMatvec_<double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> vecArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
-        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
         nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
-        float sigma, int numThreads, bool fitIntercept);
-template int rbfGrad_<float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfMatvec_<float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> vecArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
-        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
         nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
-        float sigma, int numThreads, bool fitIntercept);
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+
+
+
+
+/*!
+ * # rbfPredict
+ *
+ * Shared implementation of rbfPredictMean_ and rbfPredictMeanVar_;
+ * varPtr and varOutPtr are null for rbfPredictMean_. See
+ * predictFromFeatureTiles.
+ */
+template <typename T>
+static void rbfPredict(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> &inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> &weightArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> &meanArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> &radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> &chiArr,
+        const double *varPtr, int numVarRffs, double *varOutPtr,
+        int numThreads, bool fitIntercept, const std::string &precisionMode) {
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = inputArr.shape(0);
+    int zDim1 = inputArr.shape(1);
+    size_t numRffs = weightArr.shape(0);
+    size_t numFreqs = chiArr.shape(0);
+    double numFreqsFlt = numFreqs;
+
+    if (inputArr.shape(0) == 0 || meanArr.shape(0) != inputArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numRffs < 2 || (numRffs & 1) != 0)
+        throw std::runtime_error("last dim of output must be even number");
+    if ( (2 * numFreqs) != numRffs || numFreqs > radem.shape(2) )
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+    if (numVarRffs < 0 || static_cast<size_t>(numVarRffs) > numRffs)
+        throw std::runtime_error("wrong array sizes");
+
+    double expectedNFreq = (zDim1 > 2) ? static_cast<double>(zDim1) : 2.0;
+    double log2Freqs = std::log2(expectedNFreq);
+    log2Freqs = std::ceil(log2Freqs);
+    int paddedBufferSize = std::pow(2, log2Freqs);
+
+    if (radem.shape(2) % paddedBufferSize != 0)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    T rbfNormConstant;
+
+    if (fitIntercept)
+        rbfNormConstant = std::sqrt(1.0 / (numFreqsFlt - 0.5));
+    else
+        rbfNormConstant = std::sqrt(1.0 / numFreqsFlt);
+
+    T *inputPtr = static_cast<T*>(inputArr.data());
+    T *chiPtr = static_cast<T*>(chiArr.data());
+    int8_t *rademPtr = static_cast<int8_t*>(radem.data());
+    int rademShape2 = radem.shape(2);
+    int sincosMode = getSinCosMode(precisionMode);
+    SORFFunction<T> sorfFunction = getSORFFunction<T>(paddedBufferSize);
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+
+    predictFromFeatureTiles([&](int row, int repeatNum, double *featureTile,
+                int threadIndex){
+                T *copyBuffer = threadPool.getScratchBuffer<T>(threadIndex,
+                        paddedBufferSize, 0);
+                T *xElement = inputPtr + static_cast<size_t>(row) * zDim1;
+                int repeatPosition = repeatNum * paddedBufferSize;
+
+                for (int m=0; m < zDim1; m++)
+                    copyBuffer[m] = xElement[m];
+                for (int m=zDim1; m < paddedBufferSize; m++)
+                    copyBuffer[m] = 0;
+
+                sorfFunction(copyBuffer, rademPtr, repeatPosition,
+                        rademShape2, paddedBufferSize);
+                singleVectorRBFPostProcess(copyBuffer, chiPtr + repeatPosition,
+                        featureTile, paddedBufferSize, numFreqs - repeatPosition,
+                        0, 0, rbfNormConstant, sincosMode);
+            }, zDim0, numFreqs, paddedBufferSize, fitIntercept,
+            static_cast<double*>(weightArr.data()),
+            static_cast<double*>(meanArr.data()), varPtr, numVarRffs,
+            varOutPtr, numThreads);
+}
+
+
+
+
+/*!
+ * # rbfPredictMean_
+ *
+ * Calculates the predictive mean z w for each row of the input
+ * without storing the features z. The frequencies rather than the rows
+ * are split between threads, so small batches (down to a single row)
+ * still use all threads. This is used for RBF-type kernels and for
+ * MiniARD (if the input has already been multiplied by the lengthscales).
+ *
+ * ## Args:
+ *
+ * + `inputArr` A numpy array of shape (N x C).
+ * + `weightArr` A numpy array of shape (R) containing the weights,
+ * where R is the number of RFFs and is 2x numFreqs.
+ * + `meanArr` A numpy array of shape (N) in which z w is stored.
+ * + `radem` A numpy stack of diagonal matrices of type int8_t
+ * of shape (3 x 1 x M) where M is the smallest power of 2 > numFreqs.
+ * + `chiArr` A numpy array of shape (numFreqs)
+ * + `numThreads` The number of threads to use.
+ * + `fitIntercept` If True, a y-intercept will be fitted, and the
+ * first feature for each datapoint is set to 1.
+ * + `precisionMode` One of "exact" (use libm for the sine and cosine
+ * calculations) or "fast" (use a faster polynomial approximation).
+ * See sincos_ops.cpp.
+ */
+template <typename T>
+int rbfPredictMean_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> weightArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> meanArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode) {
+    rbfPredict<T>(inputArr, weightArr, meanArr, radem, chiArr, nullptr, 0,
+            nullptr, numThreads, fitIntercept, precisionMode);
+    return 0;
+}
+//Explicitly instantiate for external use.
+template int rbfPredictMean_<double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> weightArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> meanArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfPredictMean_<float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> weightArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> meanArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+
+
+
+
+/*!
+ * # rbfPredictMeanVar_
+ *
+ * As for rbfPredictMean_, but also calculates z_v V z_v^T for each row,
+ * where z_v is the first K features of z and V is the (K x K) variance
+ * matrix, without storing z. The predictive variance is
+ * lambda^2 (1 + z_v V z_v^T), which is left to the caller.
+ *
+ * ## Args:
+ *
+ * + `varArr` A numpy array of shape (K x K) containing V, where K <= R.
+ * + `varOutArr` A numpy array of shape (N) in which z_v V z_v^T is stored.
+ *
+ * The remaining arguments are as for rbfPredictMean_.
+ */
+template <typename T>
+int rbfPredictMeanVar_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> weightArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> varArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> meanArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> varOutArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode) {
+    if (varArr.shape(0) != varArr.shape(1) || varArr.shape(0) == 0 ||
+            varOutArr.shape(0) != inputArr.shape(0))
+        throw std::runtime_error("wrong array sizes");
+
+    rbfPredict<T>(inputArr, weightArr, meanArr, radem, chiArr,
+            static_cast<double*>(varArr.data()), varArr.shape(0),
+            static_cast<double*>(varOutArr.data()), numThreads,
+            fitIntercept, precisionMode);
+    return 0;
+}
+//Explicitly instantiate for external use.
+template int rbfPredictMeanVar_<double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> weightArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> varArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> meanArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> varOutArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+template int rbfPredictMeanVar_<float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> weightArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> varArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> meanArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> varOutArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+
+
+
 
+/*!
+ * # getRBFGenBufferSize
+ *
+ * Returns the number of elements of scratch space that allInOneRBFGen
+ * needs for a given padded buffer size. This is one row if the batched
+ * path can never be used for this size, and one row plus one interleaved
+ * tile of SORF_BATCH_ROWS rows if it may be.
+ */
+int getRBFGenBufferSize(int paddedBufferSize){
+    if (paddedBufferSize > MAX_BATCHED_SORF_SIZE)
+        return paddedBufferSize;
+    return paddedBufferSize * (SORF_BATCH_ROWS + 1);
+}
 
 
 
@@ -228,21 +1189,65 @@ template int rbfGrad_<float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cp
  * # allInOneRBFGen
  *
  * Performs the RBF-based kernel feature generation
- * process for the input, for one thread.
+ * process for the input, for one thread. copyBuffer is the
+ * calling thread's scratch buffer and must be of size
+ * getRBFGenBufferSize(paddedBufferSize); sorfFunction is
+ * the SORF routine for that size, as returned by getSORFFunction.
+ * sincosMode is one of the SINCOS constants in sincos_ops.h.
+ *
+ * For small padded sizes (see useBatchedSORF), full groups of
+ * SORF_BATCH_ROWS rows are packed into an interleaved tile and
+ * transformed together, with all of the repeats for that group
+ * processed back to back so that each slice of radem is reused
+ * across the group while in cache. Any remaining rows are
+ * processed one at a time.
  */
-template <typename T>
-void *allInOneRBFGen(T xdata[], int8_t *rademArray, T chiArr[],
-        double *outputArray, int dim1, int numFreqs, int rademShape2,
+template <typename T, typename U, typename R>
+void *allInOneRBFGen(T xdata[], const R *rademArray, T chiArr[],
+        U *outputArray, int dim1, int numFreqs, int rademShape2,
         int startRow, int endRow, int paddedBufferSize,
-        double scalingTerm) {
+        double scalingTerm, int sincosMode,
+        SORFFunction<T, R> sorfFunction, T *copyBuffer) {
     int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
-    //Notice that we don't have error handling here...very naughty. Out of
-    //memory should be extremely rare since we are only allocating memory
-    //for one row of the convolution. TODO: add error handling here.
-    T *copyBuffer = new T[paddedBufferSize];
+    int i = startRow;
     T *xElement;
+    PROFILE_LAP_START(profileLap);
 
-    for (int i=startRow; i < endRow; i++) {
+    if (useBatchedSORF<T>(paddedBufferSize)) {
+        T *tile = copyBuffer + paddedBufferSize;
+
+        for (; i + SORF_BATCH_ROWS <= endRow; i += SORF_BATCH_ROWS) {
+            int repeatPosition = 0;
+
+            for (int k=0; k < numRepeats; k++) {
+                for (int b=0; b < SORF_BATCH_ROWS; b++) {
+                    xElement = xdata + (i + b) * dim1;
+                    for (int m=0; m < dim1; m++)
+                        tile[m * SORF_BATCH_ROWS + b] = xElement[m];
+                }
+                for (int m=dim1 * SORF_BATCH_ROWS;
+                        m < paddedBufferSize * SORF_BATCH_ROWS; m++)
+                    tile[m] = 0;
+                PROFILE_LAP(profileLap, PROFILE_COPY);
+
+                interleavedBatchSORF(tile, rademArray, repeatPosition,
+                        rademShape2, paddedBufferSize);
+                PROFILE_LAP(profileLap, PROFILE_FHT);
+
+                for (int b=0; b < SORF_BATCH_ROWS; b++) {
+                    for (int m=0; m < paddedBufferSize; m++)
+                        copyBuffer[m] = tile[m * SORF_BATCH_ROWS + b];
+                    singleVectorRBFPostProcess(copyBuffer, chiArr, outputArray,
+                            paddedBufferSize, numFreqs, i + b, k, scalingTerm,
+                            sincosMode);
+                }
+                PROFILE_LAP(profileLap, PROFILE_POSTPROCESS);
+                repeatPosition += paddedBufferSize;
+            }
+        }
+    }
+
+    for (; i < endRow; i++) {
 
         int repeatPosition = 0;
         xElement = xdata + i * dim1;
@@ -252,19 +1257,32 @@ void *allInOneRBFGen(T xdata[], int8_t *rademArray, T chiArr[],
                 copyBuffer[m] = xElement[m];
             for (int m=dim1; m < paddedBufferSize; m++)
                 copyBuffer[m] = 0;
+            PROFILE_LAP(profileLap, PROFILE_COPY);
 
-            singleVectorSORF(copyBuffer, rademArray, repeatPosition,
+            sorfFunction(copyBuffer, rademArray, repeatPosition,
                         rademShape2, paddedBufferSize);
+            PROFILE_LAP(profileLap, PROFILE_FHT);
             singleVectorRBFPostProcess(copyBuffer, chiArr, outputArray,
-                        paddedBufferSize, numFreqs, i, k, scalingTerm);
+                        paddedBufferSize, numFreqs, i, k, scalingTerm,
+                        sincosMode);
+            PROFILE_LAP(profileLap, PROFILE_POSTPROCESS);
             repeatPosition += paddedBufferSize;
         }
     }
-    delete[] copyBuffer;
-
     return NULL;
 }
 
+// Instantiated here for the fused two-layer convolution ops, which
+// call these directly on their pooled intermediate rows.
+template void *allInOneRBFGen<double, double, int8_t>(double xdata[], const int8_t *rademArray,
+        double chiArr[], double *outputArray, int dim1, int numFreqs, int rademShape2,
+        int startRow, int endRow, int paddedBufferSize, double scalingTerm, int sincosMode,
+        SORFFunction<double, int8_t> sorfFunction, double *copyBuffer);
+template void *allInOneRBFGen<float, double, int8_t>(float xdata[], const int8_t *rademArray,
+        float chiArr[], double *outputArray, int dim1, int numFreqs, int rademShape2,
+        int startRow, int endRow, int paddedBufferSize, double scalingTerm, int sincosMode,
+        SORFFunction<float, int8_t> sorfFunction, float *copyBuffer);
+
 
 
 
@@ -274,20 +1292,22 @@ void *allInOneRBFGen(T xdata[], int8_t *rademArray, T chiArr[],
  *
  * Performs the RBF-based kernel feature generation
  * process for the input, for one thread, and calculates the
- * gradient, which is stored in a separate array.
+ * gradient, which is stored in a separate array. copyBuffer
+ * is the calling thread's scratch buffer and must be of size
+ * paddedBufferSize; sorfFunction is the SORF routine for
+ * that size, as returned by getSORFFunction. sincosMode is one
+ * of the SINCOS constants in sincos_ops.h.
  */
-template <typename T>
-void *allInOneRBFGrad(T xdata[], int8_t *rademArray, T chiArr[],
-        double *outputArray, double *gradientArray,
+template <typename T, typename U, typename R>
+void *allInOneRBFGrad(T xdata[], const R *rademArray, T chiArr[],
+        U *outputArray, U *gradientArray,
         int dim1, int numFreqs, int rademShape2, int startRow,
         int endRow, int paddedBufferSize,
-        double scalingTerm, T sigma) {
+        double scalingTerm, T sigma, int sincosMode,
+        SORFFunction<T, R> sorfFunction, T *copyBuffer) {
     int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
-    //Notice that we don't have error handling here...very naughty. Out of
-    //memory should be extremely rare since we are only allocating memory
-    //for one row of the convolution. TODO: add error handling here.
-    T *copyBuffer = new T[paddedBufferSize];
     T *xElement;
+    PROFILE_LAP_START(profileLap);
 
     for (int i=startRow; i < endRow; i++) {
         int repeatPosition = 0;
@@ -298,16 +1318,213 @@ void *allInOneRBFGrad(T xdata[], int8_t *rademArray, T chiArr[],
                 copyBuffer[m] = xElement[m];
             for (int m=dim1; m < paddedBufferSize; m++)
                 copyBuffer[m] = 0;
+            PROFILE_LAP(profileLap, PROFILE_COPY);
 
-            singleVectorSORF(copyBuffer, rademArray, repeatPosition,
+            sorfFunction(copyBuffer, rademArray, repeatPosition,
                         rademShape2, paddedBufferSize);
+            PROFILE_LAP(profileLap, PROFILE_FHT);
             singleVectorRBFPostGrad(copyBuffer, chiArr, outputArray,
                         gradientArray, sigma, paddedBufferSize, numFreqs,
-                        i, k, scalingTerm);
+                        i, k, scalingTerm, sincosMode);
+            PROFILE_LAP(profileLap, PROFILE_POSTPROCESS);
+            repeatPosition += paddedBufferSize;
+        }
+    }
+    return NULL;
+}
+
+template void *allInOneRBFGrad<double, double, int8_t>(double xdata[], const int8_t *rademArray,
+        double chiArr[], double *outputArray, double *gradientArray,
+        int dim1, int numFreqs, int rademShape2, int startRow, int endRow,
+        int paddedBufferSize, double scalingTerm, double sigma, int sincosMode,
+        SORFFunction<double, int8_t> sorfFunction, double *copyBuffer);
+template void *allInOneRBFGrad<float, double, int8_t>(float xdata[], const int8_t *rademArray,
+        float chiArr[], double *outputArray, double *gradientArray,
+        int dim1, int numFreqs, int rademShape2, int startRow, int endRow,
+        int paddedBufferSize, double scalingTerm, float sigma, int sincosMode,
+        SORFFunction<float, int8_t> sorfFunction, float *copyBuffer);
+
+
+
+
+
+/*!
+ * # allInOneRBFProjection
+ *
+ * Generates the pre-activation projections chi * SORF(x) for the
+ * input, for one thread, and stores them in projArray. copyBuffer
+ * is the calling thread's scratch buffer and must be of size
+ * paddedBufferSize; sorfFunction is the SORF routine for that
+ * size, as returned by getSORFFunction.
+ */
+template <typename T, typename P>
+void *allInOneRBFProjection(T xdata[], int8_t *rademArray, T chiArr[],
+        P *projArray, int dim1, int numFreqs, int rademShape2,
+        int startRow, int endRow, int paddedBufferSize,
+        SORFFunction<T> sorfFunction, T *copyBuffer) {
+    int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
+    T *xElement;
+
+    for (int i=startRow; i < endRow; i++) {
+        int repeatPosition = 0;
+        xElement = xdata + i * dim1;
+        P *projRow = projArray + (size_t)i * numFreqs;
+
+        for (int k=0; k < numRepeats; k++) {
+            for (int m=0; m < dim1; m++)
+                copyBuffer[m] = xElement[m];
+            for (int m=dim1; m < paddedBufferSize; m++)
+                copyBuffer[m] = 0;
+
+            sorfFunction(copyBuffer, rademArray, repeatPosition,
+                        rademShape2, paddedBufferSize);
+            //NOTE: MIN is defined in hadamard_transforms.h.
+            int endPosition = MIN(numFreqs - repeatPosition, paddedBufferSize);
+            for (int m=0; m < endPosition; m++)
+                projRow[repeatPosition + m] = copyBuffer[m] *
+                    chiArr[repeatPosition + m];
             repeatPosition += paddedBufferSize;
         }
     }
-    delete[] copyBuffer;
+    return NULL;
+}
+
+
+
+
+
+/*!
+ * # rbfProjectionRowPostProcess
+ *
+ * Applies the activation function to one row of projections for
+ * each of numSigmas sigma values. The feature (and, if gradientArray
+ * is not NULL, gradient) for sigma s is written to row
+ * s * numRows + rowNumber of the output. sincosMode is one of the
+ * SINCOS constants in sincos_ops.h.
+ */
+template <typename P, typename U>
+static void rbfProjectionRowPostProcess(const P projRow[], const double sigmaArr[],
+        U *outputArray, U *gradientArray, int numRows, int numFreqs,
+        int numSigmas, int rowNumber, double scalingTerm,
+        int sincosMode) {
+    P prodVals[SINCOS_CHUNK_SIZE], sinVals[SINCOS_CHUNK_SIZE];
+    P cosVals[SINCOS_CHUNK_SIZE];
+
+    for (int s=0; s < numSigmas; s++) {
+        P sigma = sigmaArr[s];
+        size_t outputStart = ((size_t)s * numRows + rowNumber) * 2 * numFreqs;
+        U *__restrict xOut = outputArray + outputStart;
+        U *__restrict gradOut = (gradientArray == NULL) ? NULL :
+            gradientArray + outputStart;
+
+        for (int start=0; start < numFreqs; start += SINCOS_CHUNK_SIZE){
+            int chunkSize = MIN(SINCOS_CHUNK_SIZE, numFreqs - start);
+            for (int j=0; j < chunkSize; j++)
+                prodVals[j] = projRow[start + j] * sigma;
+
+            if (sincosMode != SINCOS_FAST ||
+                    !fastVectorSinCos(prodVals, sinVals, cosVals, chunkSize)){
+                for (int j=0; j < chunkSize; j++){
+                    cosVals[j] = cos(prodVals[j]);
+                    sinVals[j] = sin(prodVals[j]);
+                }
+            }
+            for (int j=0; j < chunkSize; j++){
+                P cosVal = cosVals[j] * scalingTerm;
+                P sinVal = sinVals[j] * scalingTerm;
+                xOut[2 * (start + j)] = cosVal;
+                xOut[2 * (start + j) + 1] = sinVal;
+            }
+            if (gradOut == NULL)
+                continue;
+            for (int j=0; j < chunkSize; j++){
+                P cosVal = cosVals[j] * scalingTerm;
+                P sinVal = sinVals[j] * scalingTerm;
+                gradOut[2 * (start + j)] = -sinVal * projRow[start + j];
+                gradOut[2 * (start + j) + 1] = cosVal * projRow[start + j];
+            }
+        }
+    }
+}
+
 
+
+
+
+/*!
+ * # rbfProjectionPostProcess
+ *
+ * Applies the activation function to stored projections for each
+ * of numSigmas sigma values, for one thread. Each row of projections
+ * is reused for all of the sigma values while it is in cache. The
+ * feature (and, if gradientArray is not NULL, gradient) for sigma
+ * s and row i is written to row s * numRows + i of the output.
+ * sincosMode is one of the SINCOS constants in sincos_ops.h.
+ */
+template <typename P, typename U>
+void rbfProjectionPostProcess(const P projArray[], const double sigmaArr[],
+        U *outputArray, U *gradientArray, int numRows, int numFreqs,
+        int numSigmas, int startRow, int endRow, double scalingTerm,
+        int sincosMode) {
+    for (int i=startRow; i < endRow; i++)
+        rbfProjectionRowPostProcess<P, U>(projArray + (size_t)i * numFreqs,
+                sigmaArr, outputArray, gradientArray, numRows, numFreqs,
+                numSigmas, i, scalingTerm, sincosMode);
+}
+
+
+
+
+
+/*!
+ * # allInOneRBFMultiSigmaGrad
+ *
+ * Generates features and the gradient w/r/t sigma for each of
+ * numSigmas sigma values, for one thread. The SORF transform of
+ * each row is computed once into projBuffer, which must be of
+ * size numFreqs, and all of the sigma values are then applied
+ * while it is in cache. Output is laid out as for
+ * rbfProjectionPostProcess. copyBuffer is the calling thread's
+ * scratch buffer and must be of size paddedBufferSize;
+ * sorfFunction is the SORF routine for that size, as returned
+ * by getSORFFunction.
+ */
+template <typename T, typename U, typename R>
+void *allInOneRBFMultiSigmaGrad(T xdata[], const R *rademArray, T chiArr[],
+        U *outputArray, U *gradientArray, const double sigmaArr[],
+        int numSigmas, int dim1, int numRows, int numFreqs,
+        int rademShape2, int startRow, int endRow, int paddedBufferSize,
+        double scalingTerm, int sincosMode,
+        SORFFunction<T, R> sorfFunction, T *copyBuffer, T *projBuffer) {
+    int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
+    T *xElement;
+    PROFILE_LAP_START(profileLap);
+
+    for (int i=startRow; i < endRow; i++) {
+        int repeatPosition = 0;
+        xElement = xdata + i * dim1;
+
+        for (int k=0; k < numRepeats; k++) {
+            for (int m=0; m < dim1; m++)
+                copyBuffer[m] = xElement[m];
+            for (int m=dim1; m < paddedBufferSize; m++)
+                copyBuffer[m] = 0;
+            PROFILE_LAP(profileLap, PROFILE_COPY);
+
+            sorfFunction(copyBuffer, rademArray, repeatPosition,
+                        rademShape2, paddedBufferSize);
+            PROFILE_LAP(profileLap, PROFILE_FHT);
+            //NOTE: MIN is defined in hadamard_transforms.h.
+            int endPosition = MIN(numFreqs - repeatPosition, paddedBufferSize);
+            for (int m=0; m < endPosition; m++)
+                projBuffer[repeatPosition + m] = copyBuffer[m] *
+                    chiArr[repeatPosition + m];
+            repeatPosition += paddedBufferSize;
+        }
+        rbfProjectionRowPostProcess<T, U>(projBuffer, sigmaArr, outputArray,
+                gradientArray, numRows, numFreqs, numSigmas, i,
+                scalingTerm, sincosMode);
+        PROFILE_LAP(profileLap, PROFILE_POSTPROCESS);
+    }
     return NULL;
 }
@@ -2,39 +2,141 @@
 #define SPEC_CPU_RBF_OPS_H
 
 #include <stdint.h>
+#include <string>
 #include "nanobind/nanobind.h"
 #include <nanobind/ndarray.h>
+#include "../shared_fht_functions/shared_rfgen_ops.h"
 
 namespace nb = nanobind;
 
-template <typename T>
+template <typename T, typename U, typename R = int8_t>
 int rbfFeatureGen_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
-        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<R, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+
+template <typename T, typename U, typename R = int8_t>
+int rbfGrad_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<U, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<R, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        float sigma, int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+
+template <typename T, typename P>
+int rbfProjection_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<P, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> projArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads);
+
+template <typename P, typename U>
+int rbfProjectionFGen_(nb::ndarray<P, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> projArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+
+template <typename P, typename U>
+int rbfProjectionGrad_(nb::ndarray<P, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> projArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+
+template <typename T, typename U, typename R = int8_t>
+int rbfMultiSigmaGrad_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
+        nb::ndarray<R, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> sigmaArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+
+template <typename T>
+int rbfDesignMatrix_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> zTyArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
         nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
-        int numThreads, bool fitIntercept);
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
 
 template <typename T>
-int rbfGrad_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+int rbfMatvec_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> vecArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> outputArr,
-        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cpu, nb::c_contig> gradArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
         nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
-        float sigma, int numThreads, bool fitIntercept);
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
 
+template <typename T>
+int rbfPredictMean_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> weightArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> meanArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
 
 template <typename T>
-void *allInOneRBFGen(T xdata[], int8_t *rademArray, T chiArr[],
-        double *outputArray, int dim1, int numFreqs, int rademShape2,
+int rbfPredictMeanVar_(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> weightArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cpu, nb::c_contig> varArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> meanArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cpu, nb::c_contig> varOutArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cpu, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cpu, nb::c_contig> chiArr,
+        int numThreads, bool fitIntercept,
+        const std::string &precisionMode);
+
+int getRBFGenBufferSize(int paddedBufferSize);
+
+template <typename T, typename U, typename R = int8_t>
+void *allInOneRBFGen(T xdata[], const R *rademArray, T chiArr[],
+        U *outputArray, int dim1, int numFreqs, int rademShape2,
         int startRow, int endRow, int paddedBufferSize,
-        double scalingTerm);
+        double scalingTerm, int sincosMode,
+        SORFFunction<T, R> sorfFunction, T *copyBuffer);
 
 
-template <typename T>
-void *allInOneRBFGrad(T xdata[], int8_t *rademArray, T chiArr[],
-        double *outputArray, double *gradientArray,
+template <typename T, typename U, typename R = int8_t>
+void *allInOneRBFGrad(T xdata[], const R *rademArray, T chiArr[],
+        U *outputArray, U *gradientArray,
         int dim1, int numFreqs, int rademShape2, int startRow,
         int endRow, int paddedBufferSize,
-        double scalingTerm, T sigma);
+        double scalingTerm, T sigma, int sincosMode,
+        SORFFunction<T, R> sorfFunction, T *copyBuffer);
+
+
+template <typename T, typename P>
+void *allInOneRBFProjection(T xdata[], int8_t *rademArray, T chiArr[],
+        P *projArray, int dim1, int numFreqs, int rademShape2,
+        int startRow, int endRow, int paddedBufferSize,
+        SORFFunction<T> sorfFunction, T *copyBuffer);
+
+
+template <typename P, typename U>
+void rbfProjectionPostProcess(const P projArray[], const double sigmaArr[],
+        U *outputArray, U *gradientArray, int numRows, int numFreqs,
+        int numSigmas, int startRow, int endRow, double scalingTerm,
+        int sincosMode);
+
+
+template <typename T, typename U, typename R = int8_t>
+void *allInOneRBFMultiSigmaGrad(T xdata[], const R *rademArray, T chiArr[],
+        U *outputArray, U *gradientArray, const double sigmaArr[],
+        int numSigmas, int dim1, int numRows, int numFreqs,
+        int rademShape2, int startRow, int endRow, int paddedBufferSize,
+        double scalingTerm, int sincosMode,
+        SORFFunction<T, R> sorfFunction, T *copyBuffer, T *projBuffer);
+
 
 #endif
@@ -0,0 +1,337 @@
+/*!
+ * # design_matrix_ops.cpp
+ *
+ * This module accumulates Z^T Z and Z^T y from blocks of random
+ * feature rows, Z^T (Z V) from single feature rows, and the predictive
+ * mean and variance from tiles of features, so that routines which
+ * only need these products never have to write the full (N x R)
+ * feature array Z.
+ */
+#include "design_matrix_ops.h"
+#include "thread_pool.h"
+
+
+static void updateGramRowGroup(const double *featureBlock,
+        const double *yBlock, double *zTzArray, double *zTyArray,
+        int blockRows, int numRffs, int firstRow);
+
+
+
+/*!
+ * # getDesignMatrixBlockRows
+ *
+ * Returns the number of feature rows to generate per block so that
+ * the block holds roughly DESIGN_MATRIX_BLOCK_ELEMENTS doubles.
+ *
+ * ## Args:
+ *
+ * + `numRows` The number of datapoints in the input.
+ * + `numRffs` The number of random features per datapoint.
+ */
+int getDesignMatrixBlockRows(int numRows, size_t numRffs){
+    size_t blockRows = DESIGN_MATRIX_BLOCK_ELEMENTS / numRffs;
+    if (blockRows < 1)
+        blockRows = 1;
+    if (blockRows > static_cast<size_t>(numRows))
+        blockRows = numRows;
+    return static_cast<int>(blockRows);
+}
+
+
+
+/*!
+ * # accumulateGramBlock
+ *
+ * Adds Z_b^T Z_b to zTzArray and Z_b^T y_b to zTyArray, where Z_b is
+ * a block of feature rows. The rows of zTzArray are split into groups of
+ * GRAM_ROW_GROUP which are dealt out to the threads in turn. Each thread
+ * sums the products for its group into a small accumulator tile and adds
+ * the tile to both the upper triangle and its mirror image, so no two
+ * threads write to the same element and no reduction step is needed.
+ *
+ * ## Args:
+ *
+ * + `featureBlock` The (blockRows x numRffs) block of features.
+ * + `yBlock` The (blockRows) y-values corresponding to featureBlock.
+ * + `zTzArray` The (numRffs x numRffs) array to which Z^T Z is added.
+ * + `zTyArray` The (numRffs) array to which Z^T y is added.
+ * + `blockRows` The number of rows in featureBlock.
+ * + `numRffs` The number of features per row.
+ * + `numThreads` The number of threads to use.
+ */
+void accumulateGramBlock(const double *featureBlock, const double *yBlock,
+        double *zTzArray, double *zTyArray, int blockRows,
+        int numRffs, int numThreads){
+    int numGroups = (numRffs + GRAM_ROW_GROUP - 1) / GRAM_ROW_GROUP;
+    if (numThreads > numGroups)
+        numThreads = numGroups;
+    if (numThreads < 1)
+        numThreads = 1;
+
+    RFGenThreadPool::getInstance().run(numThreads, [&](int threadIndex){
+        for (int i=threadIndex; i < numGroups; i += numThreads)
+            updateGramRowGroup(featureBlock, yBlock, zTzArray, zTyArray,
+                    blockRows, numRffs, i * GRAM_ROW_GROUP);
+    });
+}
+
+
+
+/*!
+ * # featureRowMatvec
+ *
+ * Adds z^T (z V) to outputArray for a single feature row z, where V
+ * is a (numRffs x numVecs) array, so that summing over all rows gives
+ * Z^T (Z V). z V is computed once and shared across all numVecs
+ * columns.
+ *
+ * ## Args:
+ *
+ * + `featureRow` The (numRffs) feature row.
+ * + `vecArray` The (numRffs x numVecs) array V.
+ * + `outputArray` The (numRffs x numVecs) array to which the
+ * product is added.
+ * + `rowProducts` A buffer of size numVecs to store z V.
+ * + `numRffs` The number of features per row.
+ * + `numVecs` The number of columns in V.
+ */
+void featureRowMatvec(const double *featureRow, const double *vecArray,
+        double *outputArray, double *rowProducts, int numRffs, int numVecs){
+    for (int j=0; j < numVecs; j++)
+        rowProducts[j] = 0;
+
+    for (int r=0; r < numRffs; r++){
+        double rowVal = featureRow[r];
+        const double *vecRow = vecArray + static_cast<size_t>(r) * numVecs;
+        for (int j=0; j < numVecs; j++)
+            rowProducts[j] += rowVal * vecRow[j];
+    }
+
+    for (int r=0; r < numRffs; r++){
+        double rowVal = featureRow[r];
+        double *outputRow = outputArray + static_cast<size_t>(r) * numVecs;
+        for (int j=0; j < numVecs; j++)
+            outputRow[j] += rowVal * rowProducts[j];
+    }
+}
+
+
+
+/*!
+ * # predictFromFeatureTiles
+ *
+ * Calculates z w (the predictive mean) and, if varArray is not null,
+ * z_v V z_v^T (the quadratic form in the predictive variance, where z_v
+ * is the first numVarRffs features of z) for each row z of the features,
+ * without storing the features. The feature repeats, each of which is
+ * one block of paddedBufferSize frequencies, are split between threads,
+ * so that even a single row is spread across all threads. Each thread
+ * generates one tile at a time with genTile and immediately takes its
+ * dot product with the matching slice of w. Only the part of each row
+ * that falls in the first numVarRffs features is kept, and once all
+ * tiles are done the rows of V are split between threads, so that each
+ * row of V is read once for all of the rows of z.
+ *
+ * ## Args:
+ *
+ * + `genTile` The function that generates each tile.
+ * + `numRows` The number of datapoints.
+ * + `numFreqs` The number of frequencies; there are 2 * numFreqs features.
+ * + `paddedBufferSize` The number of frequencies in each repeat.
+ * + `fitIntercept` If True, the first feature is set to 1.
+ * + `weights` The (2 * numFreqs) weights w.
+ * + `meanArray` The (numRows) array in which z w is stored.
+ * + `varArray` The (numVarRffs x numVarRffs) matrix V, or null to skip
+ * the variance.
+ * + `numVarRffs` The number of features used for the variance.
+ * + `varOutArray` The (numRows) array in which z_v V z_v^T is stored.
+ * + `numThreads` The number of threads to use.
+ */
+void predictFromFeatureTiles(const FeatureTileFunction &genTile,
+        int numRows, int numFreqs, int paddedBufferSize, bool fitIntercept,
+        const double *weights, double *meanArray, const double *varArray,
+        int numVarRffs, double *varOutArray, int numThreads){
+    RFGenThreadPool &threadPool = RFGenThreadPool::getInstance();
+    int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
+    int activeThreads = numThreads > 0 ? numThreads : 1;
+    std::vector<double*> threadMeans(activeThreads, nullptr);
+    std::vector<double> varFeatures;
+    if (varArray != nullptr)
+        varFeatures.assign(static_cast<size_t>(numRows) * numVarRffs, 0);
+
+    threadPool.parallelForRows(numRepeats, numThreads,
+            [&](int startRepeat, int endRepeat, int threadIndex){
+        double *featureTile = threadPool.getScratchBuffer<double>(threadIndex,
+                2 * paddedBufferSize, PREDICTION_TILE_SLOT);
+        double *threadMean = threadPool.getScratchBuffer<double>(threadIndex,
+                numRows, PREDICTION_MEAN_SLOT);
+        for (int i=0; i < numRows; i++)
+            threadMean[i] = 0;
+
+        for (int k=startRepeat; k < endRepeat; k++){
+            int tileStart = 2 * k * paddedBufferSize;
+            int tileSize = 2 * numFreqs - tileStart;
+            if (tileSize > 2 * paddedBufferSize)
+                tileSize = 2 * paddedBufferSize;
+            int varSize = numVarRffs - tileStart;
+            if (varSize > tileSize)
+                varSize = tileSize;
+            if (varArray == nullptr)
+                varSize = 0;
+            const double *tileWeights = weights + tileStart;
+
+            for (int i=0; i < numRows; i++){
+                for (int j=0; j < tileSize; j++)
+                    featureTile[j] = 0;
+                genTile(i, k, featureTile, threadIndex);
+                if (fitIntercept && k == 0)
+                    featureTile[0] = 1;
+
+                double dotProd = 0;
+                for (int j=0; j < tileSize; j++)
+                    dotProd += featureTile[j] * tileWeights[j];
+                threadMean[i] += dotProd;
+
+                double *varRow = varFeatures.data() +
+                    static_cast<size_t>(i) * numVarRffs + tileStart;
+                for (int j=0; j < varSize; j++)
+                    varRow[j] = featureTile[j];
+            }
+        }
+        threadMeans[threadIndex] = threadMean;
+    });
+
+    for (int i=0; i < numRows; i++)
+        meanArray[i] = 0;
+    reduceThreadOutputs(threadMeans, meanArray, numRows, 1);
+    if (varArray == nullptr)
+        return;
+
+    std::vector<double*> threadVars(activeThreads, nullptr);
+    threadPool.parallelForRows(numVarRffs, numThreads,
+            [&](int startRow, int endRow, int threadIndex){
+        double *threadVar = threadPool.getScratchBuffer<double>(threadIndex,
+                numRows, PREDICTION_MEAN_SLOT);
+        for (int i=0; i < numRows; i++)
+            threadVar[i] = 0;
+
+        for (int r=startRow; r < endRow; r++){
+            const double *varRow = varArray + static_cast<size_t>(r) * numVarRffs;
+            for (int i=0; i < numRows; i++){
+                const double *zRow = varFeatures.data() +
+                    static_cast<size_t>(i) * numVarRffs;
+                double dotProd = 0;
+                for (int j=0; j < numVarRffs; j++)
+                    dotProd += varRow[j] * zRow[j];
+                threadVar[i] += zRow[r] * dotProd;
+            }
+        }
+        threadVars[threadIndex] = threadVar;
+    });
+
+    for (int i=0; i < numRows; i++)
+        varOutArray[i] = 0;
+    reduceThreadOutputs(threadVars, varOutArray, numRows, 1);
+}
+
+
+
+/*!
+ * # reduceThreadOutputs
+ *
+ * Adds each of the per-thread partial results in threadOutputs to
+ * outputArray. Entries that are null (threads that had no rows) are
+ * skipped. The elements of outputArray are split between threads.
+ *
+ * ## Args:
+ *
+ * + `threadOutputs` Pointers to the per-thread partial results, each
+ * of size numElements.
+ * + `outputArray` The array to which the partial results are added.
+ * + `numElements` The size of outputArray.
+ * + `numThreads` The number of threads to use.
+ */
+void reduceThreadOutputs(const std::vector<double*> &threadOutputs,
+        double *outputArray, size_t numElements, int numThreads){
+    int numChunks = static_cast<int>((numElements + GRAM_COL_TILE - 1) / GRAM_COL_TILE);
+
+    RFGenThreadPool::getInstance().parallelForRows(numChunks, numThreads,
+            [&](int startChunk, int endChunk, int){
+        size_t start = static_cast<size_t>(startChunk) * GRAM_COL_TILE;
+        size_t end = static_cast<size_t>(endChunk) * GRAM_COL_TILE;
+        if (end > numElements)
+            end = numElements;
+
+        for (const double *partial : threadOutputs){
+            if (partial == nullptr)
+                continue;
+            for (size_t i=start; i < end; i++)
+                outputArray[i] += partial[i];
+        }
+    });
+}
+
+
+
+/*!
+ * # updateGramRowGroup
+ *
+ * Updates rows firstRow to firstRow + GRAM_ROW_GROUP of Z^T Z (the
+ * upper triangle only, together with the mirrored elements of the lower
+ * triangle) and the corresponding elements of Z^T y, for one thread.
+ */
+static void updateGramRowGroup(const double *featureBlock,
+        const double *yBlock, double *zTzArray, double *zTyArray,
+        int blockRows, int numRffs, int firstRow){
+    double tile[GRAM_ROW_GROUP][GRAM_COL_TILE];
+    int groupSize = numRffs - firstRow;
+    if (groupSize > GRAM_ROW_GROUP)
+        groupSize = GRAM_ROW_GROUP;
+
+    for (int r=0; r < groupSize; r++){
+        double ztyVal = 0;
+        for (int b=0; b < blockRows; b++)
+            ztyVal += featureBlock[static_cast<size_t>(b) * numRffs + firstRow + r] * yBlock[b];
+        zTyArray[firstRow + r] += ztyVal;
+    }
+
+    for (int colStart=firstRow; colStart < numRffs; colStart += GRAM_COL_TILE){
+        int tileWidth = numRffs - colStart;
+        if (tileWidth > GRAM_COL_TILE)
+            tileWidth = GRAM_COL_TILE;
+
+        for (int r=0; r < groupSize; r++){
+            for (int c=0; c < tileWidth; c++)
+                tile[r][c] = 0;
+        }
+
+        for (int b=0; b < blockRows; b++){
+            const double *featureRow = featureBlock + static_cast<size_t>(b) * numRffs;
+            const double *featureCols = featureRow + colStart;
+
+            for (int r=0; r < groupSize; r++){
+                double rowVal = featureRow[firstRow + r];
+                double *tileRow = tile[r];
+                for (int c=0; c < tileWidth; c++)
+                    tileRow[c] += rowVal * featureCols[c];
+            }
+        }
+
+        //Elements that fall below the diagonal within the group
+        //are the mirror images of elements of earlier rows in the
+        //group, and are written when those rows are written.
+        for (int r=0; r < groupSize; r++){
+            int row = firstRow + r;
+            double *zTzRow = zTzArray + static_cast<size_t>(row) * numRffs;
+
+            for (int c=0; c < tileWidth; c++){
+                int col = colStart + c;
+                if (col < row)
+                    continue;
+                zTzRow[col] += tile[r][c];
+                if (col > row)
+                    zTzArray[static_cast<size_t>(col) * numRffs + row] += tile[r][c];
+            }
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef SHARED_DESIGN_MATRIX_OPERATIONS_H
+#define SHARED_DESIGN_MATRIX_OPERATIONS_H
+
+#include <stddef.h>
+#include <vector>
+#include <functional>
+
+// The approximate number of doubles in the block of feature rows
+// generated before each update of Z^T Z (32 MB).
+#define DESIGN_MATRIX_BLOCK_ELEMENTS 4194304
+// The number of rows of Z^T Z updated together by one thread, and
+// the number of columns in each thread's accumulator tile.
+#define GRAM_ROW_GROUP 4
+#define GRAM_COL_TILE 256
+// The thread pool scratch slots used by predictFromFeatureTiles. Slot 0
+// is left free for the tile generator's own buffer.
+#define PREDICTION_TILE_SLOT 1
+#define PREDICTION_MEAN_SLOT 2
+
+
+// Adds the features for one repeat (block of paddedBufferSize frequencies)
+// of one row to a zero-initialized tile, for predictFromFeatureTiles. The
+// arguments are (row, repeatNum, featureTile, threadIndex).
+using FeatureTileFunction = std::function<void(int, int, double*, int)>;
+
+
+int getDesignMatrixBlockRows(int numRows, size_t numRffs);
+
+void accumulateGramBlock(const double *featureBlock, const double *yBlock,
+        double *zTzArray, double *zTyArray, int blockRows,
+        int numRffs, int numThreads);
+
+void featureRowMatvec(const double *featureRow, const double *vecArray,
+        double *outputArray, double *rowProducts, int numRffs, int numVecs);
+
+void predictFromFeatureTiles(const FeatureTileFunction &genTile,
+        int numRows, int numFreqs, int paddedBufferSize, bool fitIntercept,
+        const double *weights, double *meanArray, const double *varArray,
+        int numVarRffs, double *varOutArray, int numThreads);
+
+void reduceThreadOutputs(const std::vector<double*> &threadOutputs,
+        double *outputArray, size_t numElements, int numThreads);
+
+#endif
@@ -6,6 +6,7 @@
 #include <stdint.h>
 #include <math.h>
 #include "hadamard_transforms.h"
+#include "simd_hadamard.h"
 
 template <typename T>
 void smallBlockTransform(T xArray[], int startRow, int endRow,
@@ -141,7 +142,9 @@ void generalTransform(T xArray[], int startRow, int endRow,
  * in place so nothing is returned. Assumes dimensions have
  * already been checked by caller. Designed to be compatible
  * with multithreading. Can be used with a 2d array by specifying
- * dim1 = 1.
+ * dim1 = 1. Uses a vectorized kernel if one is available for this
+ * CPU and the scalar transforms below otherwise, and the blocked
+ * transform for vectors too large to fit in cache.
  *
  * ## Args:
  *
@@ -160,6 +163,22 @@ void generalTransform(T xArray[], int startRow, int endRow,
 template <typename T>
 void transformRows(T __restrict xArray[], int startRow, int endRow,
                     int dim1, int dim2){
+    if (useBlockedTransform<T>(dim2)){
+        for (int i = startRow; i < endRow; i++){
+            for (int j = 0; j < dim1; j++)
+                blockedTransform<T>(xArray + (static_cast<size_t>(i) * dim1 + j) * dim2, dim2);
+        }
+        return;
+    }
+
+    if (simdTransformAvailable<T>(dim2)){
+        for (int i = startRow; i < endRow; i++){
+            for (int j = 0; j < dim1; j++)
+                simdVectorTransform<T>(xArray + (static_cast<size_t>(i) * dim1 + j) * dim2, dim2);
+        }
+        return;
+    }
+
     switch (dim2){
         case 2:
         case 4:
@@ -185,7 +204,9 @@ template void transformRows<float>(float *__restrict xArray, int startRow, int e
  * # singleVectorTransform
  *
  * Performs an unnormalized Hadamard transform along a single
- * vector, which allows for some simplifications.
+ * vector, which allows for some simplifications. Uses a vectorized
+ * kernel if one is available for this CPU and dim, and the blocked
+ * transform for vectors too large to fit in cache.
  *
  * ## Args:
  *
@@ -198,7 +219,14 @@ template <typename T>
 void singleVectorTransform(T xArray[], int dim){
     T y;
     T *__restrict xElement;
-    
+
+    if (useBlockedTransform<T>(dim)){
+        blockedTransform<T>(xArray, dim);
+        return;
+    }
+    if (simdVectorTransform<T>(xArray, dim))
+        return;
+
     xElement = xArray;
     for (int i = 0; i < dim; i += 2){
         y = xElement[1];
@@ -267,3 +295,189 @@ void singleVectorTransform(T xArray[], int dim){
 }
 template void singleVectorTransform<double>(double *__restrict xArray, int dim);
 template void singleVectorTransform<float>(float *__restrict xArray, int dim);
+
+
+
+
+
+
+/*!
+ * # useBlockedTransform
+ *
+ * Checks whether a vector of length dim is large enough that
+ * blockedTransform should be used rather than performing the
+ * stages of the transform one pass at a time.
+ */
+template <typename T>
+bool useBlockedTransform(int dim){
+    return static_cast<size_t>(dim) * sizeof(T) > FHT_BLOCKED_MIN_BYTES;
+}
+template bool useBlockedTransform<double>(int dim);
+template bool useBlockedTransform<float>(int dim);
+
+
+
+
+/*!
+ * # radix4Stage
+ *
+ * Performs two consecutive butterfly stages, of stride h and 2h, of an
+ * unnormalized Hadamard transform in a single pass. The vector is of
+ * length 4h, i.e. these are the last two stages.
+ */
+template <typename T>
+static inline void radix4Stage(T *__restrict xArray, int h){
+    T *__restrict x0 = xArray;
+    T *__restrict x1 = xArray + h;
+    T *__restrict x2 = xArray + 2 * h;
+    T *__restrict x3 = xArray + 3 * h;
+
+    #pragma omp simd
+    for (int j = 0; j < h; j++){
+        T a = x0[j] + x1[j];
+        T b = x0[j] - x1[j];
+        T c = x2[j] + x3[j];
+        T d = x2[j] - x3[j];
+        x0[j] = a + c;
+        x1[j] = b + d;
+        x2[j] = a - c;
+        x3[j] = b - d;
+    }
+}
+
+
+
+/*!
+ * # radix2Stage
+ *
+ * Performs the last butterfly stage, of stride h, of an unnormalized
+ * Hadamard transform on a vector of length 2h.
+ */
+template <typename T>
+static inline void radix2Stage(T *__restrict xArray, int h){
+    T *__restrict x0 = xArray;
+    T *__restrict x1 = xArray + h;
+
+    #pragma omp simd
+    for (int j = 0; j < h; j++){
+        T a = x0[j];
+        x0[j] = a + x1[j];
+        x1[j] = a - x1[j];
+    }
+}
+
+
+
+/*!
+ * # blockedTransform
+ *
+ * Performs an unnormalized Hadamard transform on a single vector that
+ * is too large to fit in cache. Performing one stage at a time (as
+ * singleVectorTransform does) would stream the whole vector through
+ * cache once per stage. Instead, the vector is split into four quarters
+ * that are transformed recursively (depth first), then the last two
+ * stages are combined into a single radix-4 pass. The recursion stops
+ * once a sub-vector is at most FHT_BLOCKED_BASE_BYTES, which is
+ * transformed in cache by the usual kernel, so only the few stages
+ * above that size touch the whole vector, and they do so in half as
+ * many passes. Both use a vectorized kernel if one is available.
+ *
+ * ## Args:
+ *
+ * + `xArray` Pointer to the first element of the vector to be
+ * modified.
+ * + `dim` The length of the vector. MUST be a power of 2.
+ */
+template <typename T>
+void blockedTransform(T xArray[], int dim){
+    static_assert(FHT_BLOCKED_BASE_BYTES < FHT_BLOCKED_MIN_BYTES,
+            "The blocked transform base size must be below its threshold.");
+    int baseSize = FHT_BLOCKED_BASE_BYTES / sizeof(T);
+    if (dim <= baseSize){
+        if (!simdVectorTransform<T>(xArray, dim))
+            generalTransform<T>(xArray, 0, 1, 1, dim);
+        return;
+    }
+
+    //If only one stage remains above the base size, split in two.
+    if ((dim >> 1) <= baseSize){
+        int half = dim >> 1;
+        blockedTransform<T>(xArray, half);
+        blockedTransform<T>(xArray + half, half);
+        radix2Stage<T>(xArray, half);
+        return;
+    }
+
+    int quarter = dim >> 2;
+    for (int i = 0; i < 4; i++)
+        blockedTransform<T>(xArray + static_cast<size_t>(i) * quarter, quarter);
+    if (!simdRadix4Stage<T>(xArray, quarter))
+        radix4Stage<T>(xArray, quarter);
+}
+template void blockedTransform<double>(double xArray[], int dim);
+template void blockedTransform<float>(float xArray[], int dim);
+
+
+
+
+
+
+/*!
+ * # fixedSizeStages
+ *
+ * Performs the butterfly stages of stride h and above of an unnormalized
+ * Hadamard transform on a vector whose length is known at compile time.
+ * Each stage instantiates the next, so that the full sequence of stages
+ * is unrolled and the trip count of every inner loop is a constant.
+ */
+template <typename T, int dim, int h>
+static inline void fixedSizeStages(T *__restrict xArray){
+    T y;
+    for (int i = 0; i < dim; i += (h << 1)){
+        #pragma omp simd
+        for (int j = i; j < i + h; j++){
+            y = xArray[j + h];
+            xArray[j + h] = xArray[j] - y;
+            xArray[j] += y;
+        }
+    }
+    if constexpr ((h << 1) < dim)
+        fixedSizeStages<T, dim, (h << 1)>(xArray);
+}
+
+
+
+/*!
+ * # fixedSizeTransform
+ *
+ * Performs an unnormalized Hadamard transform along a single
+ * vector whose length is a compile-time constant. This is the
+ * scalar fallback used by the size-specialized SORF routines
+ * when no vectorized kernel is available.
+ *
+ * ## Args:
+ *
+ * + `xArray` Pointer to the first element of the array to be
+ * modified. Must be of length dim.
+ */
+template <typename T, int dim>
+void fixedSizeTransform(T xArray[]){
+    static_assert(dim >= 2 && (dim & (dim - 1)) == 0,
+            "fixedSizeTransform requires a power of 2 size.");
+    fixedSizeStages<T, dim, 1>(xArray);
+}
+//Explicitly instantiate for the sizes used by the specialized SORF routines.
+template void fixedSizeTransform<double, 64>(double xArray[]);
+template void fixedSizeTransform<double, 128>(double xArray[]);
+template void fixedSizeTransform<double, 256>(double xArray[]);
+template void fixedSizeTransform<double, 512>(double xArray[]);
+template void fixedSizeTransform<double, 1024>(double xArray[]);
+template void fixedSizeTransform<double, 2048>(double xArray[]);
+template void fixedSizeTransform<double, 4096>(double xArray[]);
+template void fixedSizeTransform<float, 64>(float xArray[]);
+template void fixedSizeTransform<float, 128>(float xArray[]);
+template void fixedSizeTransform<float, 256>(float xArray[]);
+template void fixedSizeTransform<float, 512>(float xArray[]);
+template void fixedSizeTransform<float, 1024>(float xArray[]);
+template void fixedSizeTransform<float, 2048>(float xArray[]);
+template void fixedSizeTransform<float, 4096>(float xArray[]);
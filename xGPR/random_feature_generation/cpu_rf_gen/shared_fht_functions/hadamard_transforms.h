@@ -1,8 +1,18 @@
 #ifndef HADAMARD_TRANSFORM_OPERATIONS_H
 #define HADAMARD_TRANSFORM_OPERATIONS_H
 
+#include <stddef.h>
+
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
+// Vectors larger than FHT_BLOCKED_MIN_BYTES are transformed by
+// blockedTransform, which splits them into sub-vectors of at most
+// FHT_BLOCKED_BASE_BYTES (roughly the size of L1) that are transformed
+// in cache before the stages that combine them. Below the threshold the
+// whole vector stays in L2 and the per-stage transform is as fast.
+#define FHT_BLOCKED_MIN_BYTES 262144
+#define FHT_BLOCKED_BASE_BYTES 32768
+
 template <typename T>
 void transformRows(T __restrict xArray[], int startRow, int endRow,
                     int dim1, int dim2);
@@ -18,4 +28,13 @@ void generalTransform(T xArray[], int startRow, int endRow,
 template <typename T>
 void singleVectorTransform(T xArray[], int dim);
 
+template <typename T, int dim>
+void fixedSizeTransform(T xArray[]);
+
+template <typename T>
+bool useBlockedTransform(int dim);
+
+template <typename T>
+void blockedTransform(T xArray[], int dim);
+
 #endif
@@ -0,0 +1,218 @@
+/*!
+ * # kmer_cache.cpp
+ *
+ * Implements the per-thread kmer cache used by the convolution
+ * feature generation routines to avoid repeating the SORF transforms
+ * for kmers that have already been seen, together with process-wide
+ * hit / miss counters so that the effect can be measured.
+ */
+#include <string.h>
+#include <atomic>
+#include "kmer_cache.h"
+
+
+// Process-wide counters, updated once by each cache when it is
+// destroyed so that threads do not contend on every lookup.
+static std::atomic<long long> kmerCacheHits{0};
+static std::atomic<long long> kmerCacheMisses{0};
+
+
+
+
+/*!
+ * # KmerCache
+ *
+ * Constructor.
+ *
+ * ## Args:
+ *
+ * + `maxEntries` The maximum number of kmers to store. Must be > 0.
+ * + `kmerLength` The number of elements in each kmer (convWidth * dim2).
+ * + `vectorLength` The number of elements stored for each kmer.
+ */
+template <typename T>
+KmerCache<T>::KmerCache(int maxEntries, int kmerLength, size_t vectorLength):
+    maxEntries(maxEntries), kmerLength(kmerLength), vectorLength(vectorLength),
+    keys(new T[static_cast<size_t>(maxEntries) * kmerLength]),
+    values(new T[static_cast<size_t>(maxEntries) * vectorLength]),
+    slotHashes(maxEntries), prevSlot(maxEntries), nextSlot(maxEntries) {
+    slotLookup.reserve(maxEntries);
+}
+
+
+template <typename T>
+KmerCache<T>::~KmerCache(){
+    kmerCacheHits += hits;
+    kmerCacheMisses += misses;
+}
+
+
+
+/*!
+ * # lookup
+ *
+ * Returns a pointer to the stored vector for kmer if present (and marks
+ * it as most recently used), or NULL if it is not.
+ */
+template <typename T>
+const T *KmerCache<T>::lookup(const T kmer[]){
+    auto match = slotLookup.find(hashKmer(kmer));
+    if (match != slotLookup.end()) {
+        int slot = match->second;
+        if (memcmp(keys.get() + static_cast<size_t>(slot) * kmerLength, kmer,
+                    sizeof(T) * kmerLength) == 0) {
+            if (slot != head) {
+                unlink(slot);
+                pushFront(slot);
+            }
+            hits++;
+            return values.get() + static_cast<size_t>(slot) * vectorLength;
+        }
+    }
+    misses++;
+    return NULL;
+}
+
+
+
+/*!
+ * # insert
+ *
+ * Stores kmer as the most recently used entry, evicting the least
+ * recently used entry if the cache is full (or the entry with the same
+ * hash if there is a collision), and returns a pointer to the
+ * vectorLength elements the caller should fill in.
+ */
+template <typename T>
+T *KmerCache<T>::insert(const T kmer[]){
+    uint64_t hashVal = hashKmer(kmer);
+    int slot;
+    auto match = slotLookup.find(hashVal);
+
+    if (match != slotLookup.end()) {
+        slot = match->second;
+        unlink(slot);
+    } else if (numUsed < maxEntries) {
+        slot = numUsed;
+        numUsed++;
+        slotLookup[hashVal] = slot;
+    } else {
+        slot = tail;
+        unlink(slot);
+        slotLookup.erase(slotHashes[slot]);
+        slotLookup[hashVal] = slot;
+    }
+
+    slotHashes[slot] = hashVal;
+    memcpy(keys.get() + static_cast<size_t>(slot) * kmerLength, kmer,
+            sizeof(T) * kmerLength);
+    pushFront(slot);
+    return values.get() + static_cast<size_t>(slot) * vectorLength;
+}
+
+
+
+/*!
+ * # hashKmer
+ *
+ * FNV-1a hash of the bytes of a kmer.
+ */
+template <typename T>
+uint64_t KmerCache<T>::hashKmer(const T kmer[]){
+    const unsigned char *kmerBytes = reinterpret_cast<const unsigned char*>(kmer);
+    uint64_t hashVal = 14695981039346656037ULL;
+
+    for (size_t i=0; i < sizeof(T) * kmerLength; i++) {
+        hashVal ^= kmerBytes[i];
+        hashVal *= 1099511628211ULL;
+    }
+    return hashVal;
+}
+
+
+template <typename T>
+void KmerCache<T>::unlink(int slot){
+    if (prevSlot[slot] >= 0)
+        nextSlot[prevSlot[slot]] = nextSlot[slot];
+    else
+        head = nextSlot[slot];
+    if (nextSlot[slot] >= 0)
+        prevSlot[nextSlot[slot]] = prevSlot[slot];
+    else
+        tail = prevSlot[slot];
+}
+
+
+template <typename T>
+void KmerCache<T>::pushFront(int slot){
+    prevSlot[slot] = -1;
+    nextSlot[slot] = head;
+    if (head >= 0)
+        prevSlot[head] = slot;
+    head = slot;
+    if (tail < 0)
+        tail = slot;
+}
+
+template class KmerCache<double>;
+template class KmerCache<float>;
+
+
+
+
+/*!
+ * # makeKmerCache
+ *
+ * Returns a new cache with the specified capacity, or an empty pointer
+ * if maxEntries <= 0 (i.e. caching is disabled), so that callers can
+ * pass the result of get() straight to routines that accept a NULL cache.
+ */
+template <typename T>
+std::unique_ptr<KmerCache<T>> makeKmerCache(int maxEntries, int kmerLength,
+        size_t vectorLength){
+    if (maxEntries <= 0)
+        return std::unique_ptr<KmerCache<T>>();
+    return std::unique_ptr<KmerCache<T>>(new KmerCache<T>(maxEntries,
+                kmerLength, vectorLength));
+}
+template std::unique_ptr<KmerCache<double>> makeKmerCache<double>(int maxEntries,
+        int kmerLength, size_t vectorLength);
+template std::unique_ptr<KmerCache<float>> makeKmerCache<float>(int maxEntries,
+        int kmerLength, size_t vectorLength);
+
+
+
+
+/*!
+ * # getKmerCacheHits_
+ *
+ * Wrapper-facing function that returns the number of kmer cache hits
+ * since the counters were last reset.
+ */
+long long getKmerCacheHits_(){
+    return kmerCacheHits.load();
+}
+
+
+/*!
+ * # getKmerCacheMisses_
+ *
+ * Wrapper-facing function that returns the number of kmer cache misses
+ * (i.e. kmers for which the SORF transforms had to be performed) since
+ * the counters were last reset.
+ */
+long long getKmerCacheMisses_(){
+    return kmerCacheMisses.load();
+}
+
+
+/*!
+ * # resetKmerCacheStats_
+ *
+ * Wrapper-facing function that resets the kmer cache counters.
+ */
+int resetKmerCacheStats_(){
+    kmerCacheHits = 0;
+    kmerCacheMisses = 0;
+    return 0;
+}
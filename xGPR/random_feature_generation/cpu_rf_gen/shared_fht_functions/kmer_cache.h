@@ -0,0 +1,71 @@
+#ifndef KMER_CACHE_OPERATIONS_H
+#define KMER_CACHE_OPERATIONS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+
+/*!
+ * # KmerCache
+ *
+ * A bounded least-recently-used cache that maps a kmer (the raw
+ * convWidth * dim2 input window for one position in a sequence) to
+ * the post-SORF vectors already computed for it. With one-hot
+ * encodings and short convolution widths the same kmer recurs
+ * often, so a hit skips all of the SORF transforms for that window.
+ *
+ * Each cache belongs to a single thread and lives for a single call,
+ * so entries never outlive the radem / chi arrays they were computed
+ * with. Keys are hashed but are also stored and compared exactly, so
+ * a hash collision is treated as a miss and never returns the wrong
+ * vector. Storage is allocated up front but uninitialized, so pages
+ * for slots that are never used are not touched.
+ */
+template <typename T>
+class KmerCache {
+    public:
+        KmerCache(int maxEntries, int kmerLength, size_t vectorLength);
+        ~KmerCache();
+
+        const T *lookup(const T kmer[]);
+        T *insert(const T kmer[]);
+
+        KmerCache(const KmerCache&) = delete;
+        KmerCache &operator=(const KmerCache&) = delete;
+
+    private:
+        uint64_t hashKmer(const T kmer[]);
+        void unlink(int slot);
+        void pushFront(int slot);
+
+        int maxEntries;
+        int kmerLength;
+        size_t vectorLength;
+        int numUsed = 0;
+        int head = -1;
+        int tail = -1;
+
+        std::unique_ptr<T[]> keys;
+        std::unique_ptr<T[]> values;
+        std::vector<uint64_t> slotHashes;
+        std::vector<int> prevSlot;
+        std::vector<int> nextSlot;
+        std::unordered_map<uint64_t, int> slotLookup;
+
+        long long hits = 0;
+        long long misses = 0;
+};
+
+
+template <typename T>
+std::unique_ptr<KmerCache<T>> makeKmerCache(int maxEntries, int kmerLength,
+        size_t vectorLength);
+
+long long getKmerCacheHits_();
+long long getKmerCacheMisses_();
+int resetKmerCacheStats_();
+
+#endif
@@ -9,6 +9,8 @@
 #include <cstring>
 #include "shared_rfgen_ops.h"
 #include "hadamard_transforms.h"
+#include "simd_hadamard.h"
+#include "sincos_ops.h"
 
 
 /*!
@@ -135,6 +137,90 @@ template void multiplyByDiagonalRademacherMat<float>(float *__restrict xArray,
 
 
 
+/*!
+ * # applyRademDiagonal
+ *
+ * Multiplies n elements of cbuffer by elements start to start + n of
+ * one diagonal of an int8_t radem array and by the scaling factor for
+ * that diagonal.
+ */
+template <typename T>
+static inline void applyRademDiagonal(T *__restrict cbuffer,
+        const int8_t *rademArray, int start, int n, T scale){
+    const int8_t *rademElement = rademArray + start;
+    #pragma omp simd
+    for (int i = 0; i < n; i++)
+        cbuffer[i] *= rademElement[i] * scale;
+}
+
+
+/*!
+ * # applyRademDiagonal
+ *
+ * As above for a bit-packed radem array. Each element is negated by
+ * XOR-ing its sign bit with the corresponding bit of rademArray, so
+ * no conversion or multiply is needed unless scale is not 1.
+ */
+template <typename T>
+static inline void applyRademDiagonal(T *__restrict cbuffer,
+        const uint8_t *rademArray, int start, int n, T scale){
+    using Bits = typename std::conditional<sizeof(T) == 8,
+          uint64_t, uint32_t>::type;
+    constexpr int signShift = sizeof(T) * 8 - 1;
+
+    #pragma omp simd
+    for (int i = 0; i < n; i++){
+        int j = start + i;
+        Bits value;
+        std::memcpy(&value, cbuffer + i, sizeof(T));
+        value ^= static_cast<Bits>((rademArray[j >> 3] >> (j & 7)) & 1) << signShift;
+        std::memcpy(cbuffer + i, &value, sizeof(T));
+    }
+    if (scale != 1){
+        #pragma omp simd
+        for (int i = 0; i < n; i++)
+            cbuffer[i] *= scale;
+    }
+}
+
+
+/*!
+ * # rademDiagonalScale
+ *
+ * Returns the factor to apply together with diagonal k (0, 1 or 2)
+ * of the SORF operation, given the normalization constant for the
+ * Hadamard transform. For int8_t radem each diagonal carries one
+ * normalization constant. For bit-packed radem the first two
+ * diagonals are pure sign flips and the last carries all three,
+ * which is equivalent since every step is linear.
+ */
+template <typename T>
+static inline T rademDiagonalScale(const int8_t *, T normConstant, int){
+    return normConstant;
+}
+
+template <typename T>
+static inline T rademDiagonalScale(const uint8_t *, T normConstant, int k){
+    return (k == 2) ? normConstant * normConstant * normConstant : 1;
+}
+
+
+/*!
+ * # rademElementValue
+ *
+ * Returns element j of a radem array (+1 or -1) for either storage
+ * type.
+ */
+static inline int rademElementValue(const int8_t *rademArray, int j){
+    return rademArray[j];
+}
+
+static inline int rademElementValue(const uint8_t *rademArray, int j){
+    return 1 - 2 * ((rademArray[j >> 3] >> (j & 7)) & 1);
+}
+
+
+
 /*!
  * # singleVectorSORF
  *
@@ -146,48 +232,218 @@ template void multiplyByDiagonalRademacherMat<float>(float *__restrict xArray,
  * + `cbuffer` Pointer to the first element of the 1d array. Size must
  * be a power of 2.
  * + `rademArray` Pointer to the first element of the diagonal rademacher
- * array (size (3,1,F) where F is a multiple of C).
+ * array (size (3,1,F) where F is a multiple of C), either int8_t or
+ * bit-packed (see getRademLength).
  * + `repeatPosition` A multiple of C that indicates how far along dim2 of
  * rademArray to start.
- * + `rademShape2` dim2 of radem (i.e. F from above).
+ * + `rademShape2` The number of elements in each diagonal of radem
+ * (i.e. F from above).
  * + `cbufferDim2` The size of cbuffer. Must be a power of 2.
  */
-template <typename T>
-void singleVectorSORF(T cbuffer[], const int8_t *rademArray,
+template <typename T, typename R>
+void singleVectorSORF(T cbuffer[], const R *rademArray,
         int repeatPosition, int rademShape2,
         int cbufferDim2){
     T normConstant = log2(cbufferDim2) / 2;
     normConstant = 1 / pow(2, normConstant);
-    const int8_t *rademElement = rademArray + repeatPosition;
 
-    #pragma omp simd
-    for (int i = 0; i < cbufferDim2; i++)
-        cbuffer[i] *= rademElement[i] * normConstant;
+    for (int k = 0; k < 3; k++){
+        applyRademDiagonal<T>(cbuffer, rademArray, repeatPosition +
+                k * rademShape2, cbufferDim2,
+                rademDiagonalScale<T>(rademArray, normConstant, k));
+        singleVectorTransform<T>(cbuffer, cbufferDim2);
+    }
+}
+//Explicitly instantiate for external use.
+template void singleVectorSORF<double, int8_t>(double cbuffer[], const int8_t *rademArray,
+        int repeatPosition, int rademShape2,
+        int cbufferDim2);
+template void singleVectorSORF<float, int8_t>(float cbuffer[], const int8_t *rademArray,
+        int repeatPosition, int rademShape2,
+        int cbufferDim2);
+template void singleVectorSORF<double, uint8_t>(double cbuffer[], const uint8_t *rademArray,
+        int repeatPosition, int rademShape2,
+        int cbufferDim2);
+template void singleVectorSORF<float, uint8_t>(float cbuffer[], const uint8_t *rademArray,
+        int repeatPosition, int rademShape2,
+        int cbufferDim2);
 
-    rademElement += rademShape2;
-    singleVectorTransform<T>(cbuffer, cbufferDim2);
 
-    #pragma omp simd
-    for (int i = 0; i < cbufferDim2; i++)
-        cbuffer[i] *= rademElement[i] * normConstant;
 
-    rademElement += rademShape2;
-    singleVectorTransform<T>(cbuffer, cbufferDim2);
 
+/*!
+ * # sorfNormConstant
+ *
+ * Calculates 1 / sqrt(dim) for a power of 2 dim at compile time
+ * (std::sqrt and std::pow are not constexpr).
+ */
+static constexpr double sorfNormConstant(int dim){
+    double normConstant = 1.0;
+    for (; dim >= 4; dim >>= 2)
+        normConstant *= 0.5;
+    if (dim == 2)
+        normConstant *= 0.70710678118654752440;
+    return normConstant;
+}
+
+
+/*!
+ * # fixedSizeSORF
+ *
+ * Performs the same operations as singleVectorSORF for a buffer
+ * whose size is a compile-time constant, so that the normalization
+ * constant is computed at compile time and all loop trip counts
+ * are fixed. The transform uses the active vectorized kernel if
+ * there is one and otherwise the unrolled fixedSizeTransform.
+ * The cbufferDim2 argument is ignored and is present only so that
+ * this matches the signature of singleVectorSORF.
+ */
+template <typename T, int dim, typename R>
+static void fixedSizeSORF(T cbuffer[], const R *rademArray,
+        int repeatPosition, int rademShape2, int){
+    constexpr T normConstant = static_cast<T>(sorfNormConstant(dim));
+
+    for (int k = 0; k < 3; k++){
+        applyRademDiagonal<T>(cbuffer, rademArray, repeatPosition +
+                k * rademShape2, dim,
+                rademDiagonalScale<T>(rademArray, normConstant, k));
+
+        if (!simdVectorTransform<T>(cbuffer, dim))
+            fixedSizeTransform<T, dim>(cbuffer);
+    }
+}
 
-    #pragma omp simd
-    for (int i = 0; i < cbufferDim2; i++)
-        cbuffer[i] *= rademElement[i] * normConstant;
 
-    singleVectorTransform<T>(cbuffer, cbufferDim2);
+
+/*!
+ * # getSORFFunction
+ *
+ * Returns the SORF routine to use for buffers of size cbufferDim2:
+ * a size-specialized routine if one exists for that size, or
+ * singleVectorSORF otherwise. Callers should look this up once
+ * per call rather than once per row.
+ *
+ * ## Args:
+ *
+ * + `cbufferDim2` The size of the buffer. Must be a power of 2.
+ */
+template <typename T, typename R>
+SORFFunction<T, R> getSORFFunction(int cbufferDim2){
+    switch (cbufferDim2){
+        case 64:
+            return &fixedSizeSORF<T, 64, R>;
+        case 128:
+            return &fixedSizeSORF<T, 128, R>;
+        case 256:
+            return &fixedSizeSORF<T, 256, R>;
+        case 512:
+            return &fixedSizeSORF<T, 512, R>;
+        case 1024:
+            return &fixedSizeSORF<T, 1024, R>;
+        case 2048:
+            return &fixedSizeSORF<T, 2048, R>;
+        case 4096:
+            return &fixedSizeSORF<T, 4096, R>;
+        default:
+            break;
+    }
+    return &singleVectorSORF<T, R>;
 }
 //Explicitly instantiate for external use.
-template void singleVectorSORF<double>(double cbuffer[], const int8_t *rademArray,
-        int repeatPosition, int rademShape2,
-        int cbufferDim2);
-template void singleVectorSORF<float>(float cbuffer[], const int8_t *rademArray,
-        int repeatPosition, int rademShape2,
-        int cbufferDim2);
+template SORFFunction<double, int8_t> getSORFFunction<double, int8_t>(int cbufferDim2);
+template SORFFunction<float, int8_t> getSORFFunction<float, int8_t>(int cbufferDim2);
+template SORFFunction<double, uint8_t> getSORFFunction<double, uint8_t>(int cbufferDim2);
+template SORFFunction<float, uint8_t> getSORFFunction<float, uint8_t>(int cbufferDim2);
+
+
+
+
+/*!
+ * # useBatchedSORF
+ *
+ * Checks whether interleavedBatchSORF is expected to be faster than
+ * transforming rows one at a time for buffers of size cbufferDim2.
+ */
+template <typename T>
+bool useBatchedSORF(int cbufferDim2){
+    if (simdInterleavedTransformAvailable<T>(SORF_BATCH_ROWS))
+        return cbufferDim2 <= MAX_BATCHED_SORF_SIZE;
+    return cbufferDim2 <= MAX_SCALAR_BATCHED_SORF_SIZE;
+}
+//Explicitly instantiate for external use.
+template bool useBatchedSORF<double>(int cbufferDim2);
+template bool useBatchedSORF<float>(int cbufferDim2);
+
+
+
+/*!
+ * # interleavedBatchSORF
+ *
+ * Performs the same operations as singleVectorSORF on SORF_BATCH_ROWS
+ * vectors at once. The vectors are stored interleaved, so that element
+ * m of vector b is at tile[m * SORF_BATCH_ROWS + b]. Each diagonal
+ * multiply and each butterfly of the transform is then one operation
+ * across all of the vectors, which the compiler can vectorize, rather
+ * than a short dependency chain within one small vector.
+ *
+ * ## Args:
+ *
+ * + `tile` Pointer to the first element of the interleaved array, of
+ * size cbufferDim2 * SORF_BATCH_ROWS.
+ * + `rademArray` Pointer to the first element of the diagonal rademacher
+ * array (size (3,1,F) where F is a multiple of C), either int8_t or
+ * bit-packed (see getRademLength).
+ * + `repeatPosition` A multiple of C that indicates how far along dim2 of
+ * rademArray to start.
+ * + `rademShape2` The number of elements in each diagonal of radem
+ * (i.e. F from above).
+ * + `cbufferDim2` The length of each vector. Must be a power of 2.
+ */
+template <typename T, typename R>
+void interleavedBatchSORF(T tile[], const R *rademArray,
+        int repeatPosition, int rademShape2, int cbufferDim2){
+    T normConstant = log2(cbufferDim2) / 2;
+    normConstant = 1 / pow(2, normConstant);
+
+    for (int k = 0; k < 3; k++){
+        T scale = rademDiagonalScale<T>(rademArray, normConstant, k);
+        int rademStart = repeatPosition + k * rademShape2;
+
+        for (int m = 0; m < cbufferDim2; m++){
+            T *__restrict lane = tile + m * SORF_BATCH_ROWS;
+            T rademValue = rademElementValue(rademArray, rademStart + m) * scale;
+            #pragma omp simd
+            for (int b = 0; b < SORF_BATCH_ROWS; b++)
+                lane[b] *= rademValue;
+        }
+
+        if (!simdInterleavedTransform<T>(tile, cbufferDim2, SORF_BATCH_ROWS)){
+            for (int h = 1; h < cbufferDim2; h <<= 1){
+                for (int i = 0; i < cbufferDim2; i += (h << 1)){
+                    for (int j = i; j < i + h; j++){
+                        T *__restrict lowLane = tile + j * SORF_BATCH_ROWS;
+                        T *__restrict highLane = lowLane + h * SORF_BATCH_ROWS;
+                        #pragma omp simd
+                        for (int b = 0; b < SORF_BATCH_ROWS; b++){
+                            T y = highLane[b];
+                            highLane[b] = lowLane[b] - y;
+                            lowLane[b] += y;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+//Explicitly instantiate for external use.
+template void interleavedBatchSORF<double, int8_t>(double tile[], const int8_t *rademArray,
+        int repeatPosition, int rademShape2, int cbufferDim2);
+template void interleavedBatchSORF<float, int8_t>(float tile[], const int8_t *rademArray,
+        int repeatPosition, int rademShape2, int cbufferDim2);
+template void interleavedBatchSORF<double, uint8_t>(double tile[], const uint8_t *rademArray,
+        int repeatPosition, int rademShape2, int cbufferDim2);
+template void interleavedBatchSORF<float, uint8_t>(float tile[], const uint8_t *rademArray,
+        int repeatPosition, int rademShape2, int cbufferDim2);
 
 
 
@@ -206,25 +462,27 @@ template void singleVectorSORF<float>(float cbuffer[], const int8_t *rademArray,
  * + `chiArr` Pointer to the first element of chiArr, a diagonal array
  * that will be multipled against xdata.
  * + `outputArray` A pointer to the first element of the array in which
- * the output will be stored.
+ * the output will be stored. May be double or float (U), independent
+ * of the input type T.
  * + `dim2` The last dimension of xdata
  * + `numFreqs` The number of frequencies to sample.
  * + `rowNumber` The row of the output array to use.
  * + `repeatNum` The repeat number
  * + `convWidth` The convolution width
  * + `scalingTerm` The scaling term to apply for the random feature generation.
+ * + `sincosMode` One of the SINCOS constants in sincos_ops.h.
  *
  */
-template <typename T>
+template <typename T, typename U>
 void singleVectorRBFPostProcess(const T xdata[],
-        const T chiArr[], double *outputArray,
+        const T chiArr[], U *outputArray,
         int dim2, int numFreqs,
         int rowNumber, int repeatNum,
-        double scalingTerm){
+        double scalingTerm, int sincosMode){
 
     int outputStart = repeatNum * dim2;
     T prodVal;
-    double *__restrict xOut;
+    U *__restrict xOut;
     const T *chiIn;
     //NOTE: MIN is defined in the header.
     int endPosition = MIN(numFreqs, (repeatNum + 1) * dim2);
@@ -233,6 +491,31 @@ void singleVectorRBFPostProcess(const T xdata[],
     chiIn = chiArr + outputStart;
     xOut = outputArray + 2 * outputStart + rowNumber * 2 * numFreqs;
 
+    if (sincosMode == SINCOS_FAST){
+        T prodVals[SINCOS_CHUNK_SIZE], sinVals[SINCOS_CHUNK_SIZE];
+        T cosVals[SINCOS_CHUNK_SIZE];
+
+        for (int start=0; start < endPosition; start += SINCOS_CHUNK_SIZE){
+            int chunkSize = MIN(SINCOS_CHUNK_SIZE, endPosition - start);
+            for (int i=0; i < chunkSize; i++)
+                prodVals[i] = xdata[start + i] * chiIn[start + i];
+
+            if (!fastVectorSinCos(prodVals, sinVals, cosVals, chunkSize)){
+                for (int i=0; i < chunkSize; i++){
+                    cosVals[i] = cos(prodVals[i]);
+                    sinVals[i] = sin(prodVals[i]);
+                }
+            }
+            for (int i=0; i < chunkSize; i++){
+                *xOut += cosVals[i] * scalingTerm;
+                xOut++;
+                *xOut += sinVals[i] * scalingTerm;
+                xOut++;
+            }
+        }
+        return;
+    }
+
     #pragma omp simd
     for (int i=0; i < endPosition; i++){
         prodVal = xdata[i] * chiIn[i];
@@ -243,12 +526,15 @@ void singleVectorRBFPostProcess(const T xdata[],
     }
 }
 //Explicitly instantiate for external use.
-template void singleVectorRBFPostProcess<double>(const double xdata[], const double chiArr[],
-        double *outputArray, int dim2, int numFreqs, int rowNumber, int repeatNum,
-        double scalingTerm);
-template void singleVectorRBFPostProcess<float>(const float xdata[], const float chiArr[],
-        double *outputArray, int dim2, int numFreqs, int rowNumber, int repeatNum,
-        double scalingTerm);
+template void singleVectorRBFPostProcess<double, double>(const double xdata[],
+        const double chiArr[], double *outputArray, int dim2, int numFreqs,
+        int rowNumber, int repeatNum, double scalingTerm, int sincosMode);
+template void singleVectorRBFPostProcess<float, double>(const float xdata[],
+        const float chiArr[], double *outputArray, int dim2, int numFreqs,
+        int rowNumber, int repeatNum, double scalingTerm, int sincosMode);
+template void singleVectorRBFPostProcess<float, float>(const float xdata[],
+        const float chiArr[], float *outputArray, int dim2, int numFreqs,
+        int rowNumber, int repeatNum, double scalingTerm, int sincosMode);
 
 
 
@@ -267,7 +553,7 @@ template void singleVectorRBFPostProcess<float>(const float xdata[], const float
  * + `outputArray` A pointer to the first element of the array in which
  * the output will be stored.
  * + `gradientArray` A pointer to the first element of the array in
- * which the gradient will be stored.
+ * which the gradient will be stored. Same type as outputArray.
  * + `sigma` The sigma hyperparameter.
  * + `dim2` The last dimension of xdata
  * + `numFreqs` The number of frequencies to sample.
@@ -275,19 +561,20 @@ template void singleVectorRBFPostProcess<float>(const float xdata[], const float
  * + `repeatNum` The repeat number
  * + `convWidth` The convolution width
  * + `scalingTerm` The scaling term to apply for the random feature generation.
+ * + `sincosMode` One of the SINCOS constants in sincos_ops.h.
  *
  */
-template <typename T>
+template <typename T, typename U>
 void singleVectorRBFPostGrad(const T xdata[],
-        const T chiArr[], double *outputArray,
-        double *gradientArray, T sigma,
+        const T chiArr[], U *outputArray,
+        U *gradientArray, T sigma,
         int dim2, int numFreqs,
         int rowNumber, int repeatNum,
-        double scalingTerm){
+        double scalingTerm, int sincosMode){
 
     int outputStart = repeatNum * dim2;
     T prodVal, gradVal, cosVal, sinVal;
-    double *__restrict xOut, *__restrict gradOut;
+    U *__restrict xOut, *__restrict gradOut;
     const T *chiIn;
     //NOTE: MIN is defined in the header.
     int endPosition = MIN(numFreqs, (repeatNum + 1) * dim2);
@@ -297,6 +584,39 @@ void singleVectorRBFPostGrad(const T xdata[],
     xOut = outputArray + 2 * outputStart + rowNumber * 2 * numFreqs;
     gradOut = gradientArray + 2 * outputStart + rowNumber * 2 * numFreqs;
 
+    if (sincosMode == SINCOS_FAST){
+        T gradVals[SINCOS_CHUNK_SIZE], prodVals[SINCOS_CHUNK_SIZE];
+        T sinVals[SINCOS_CHUNK_SIZE], cosVals[SINCOS_CHUNK_SIZE];
+
+        for (int start=0; start < endPosition; start += SINCOS_CHUNK_SIZE){
+            int chunkSize = MIN(SINCOS_CHUNK_SIZE, endPosition - start);
+            for (int i=0; i < chunkSize; i++){
+                gradVals[i] = xdata[start + i] * chiIn[start + i];
+                prodVals[i] = gradVals[i] * sigma;
+            }
+
+            if (!fastVectorSinCos(prodVals, sinVals, cosVals, chunkSize)){
+                for (int i=0; i < chunkSize; i++){
+                    cosVals[i] = cos(prodVals[i]);
+                    sinVals[i] = sin(prodVals[i]);
+                }
+            }
+            for (int i=0; i < chunkSize; i++){
+                cosVal = cosVals[i] * scalingTerm;
+                sinVal = sinVals[i] * scalingTerm;
+                *xOut += cosVal;
+                xOut++;
+                *xOut += sinVal;
+                xOut++;
+                *gradOut -= sinVal * gradVals[i];
+                gradOut++;
+                *gradOut += cosVal * gradVals[i];
+                gradOut++;
+            }
+        }
+        return;
+    }
+
     for (int i=0; i < endPosition; i++){
         gradVal = xdata[i] * chiIn[i];
         prodVal = gradVal * sigma;
@@ -313,11 +633,15 @@ void singleVectorRBFPostGrad(const T xdata[],
     }
 }
 //Explicitly instantiate for external use.
-template void singleVectorRBFPostGrad<double>(const double xdata[], const double chiArr[],
-        double *outputArray, double *gradientArray, double sigma,
-        int dim2, int numFreqs, int rowNumber, int repeatNum,
-        double scalingTerm);
-template void singleVectorRBFPostGrad<float>(const float xdata[], const float chiArr[],
-        double *outputArray, double *gradientArray, float sigma,
-        int dim2, int numFreqs, int rowNumber, int repeatNum,
-        double scalingTerm);
+template void singleVectorRBFPostGrad<double, double>(const double xdata[],
+        const double chiArr[], double *outputArray, double *gradientArray,
+        double sigma, int dim2, int numFreqs, int rowNumber, int repeatNum,
+        double scalingTerm, int sincosMode);
+template void singleVectorRBFPostGrad<float, double>(const float xdata[],
+        const float chiArr[], double *outputArray, double *gradientArray,
+        float sigma, int dim2, int numFreqs, int rowNumber, int repeatNum,
+        double scalingTerm, int sincosMode);
+template void singleVectorRBFPostGrad<float, float>(const float xdata[],
+        const float chiArr[], float *outputArray, float *gradientArray,
+        float sigma, int dim2, int numFreqs, int rowNumber, int repeatNum,
+        double scalingTerm, int sincosMode);
@@ -1,7 +1,36 @@
 #ifndef SHARED_RFGEN_OPERATIONS_H
 #define SHARED_RFGEN_OPERATIONS_H
 #include <stdint.h>
+#include <stddef.h>
+#include <type_traits>
 
+// The number of rows packed into one interleaved tile by
+// interleavedBatchSORF, and the largest padded buffer sizes for
+// which the batched path is used with and without a vectorized
+// FHT kernel. Above these sizes a single row is long enough that
+// the single-vector transform is faster.
+#define SORF_BATCH_ROWS 8
+#define MAX_BATCHED_SORF_SIZE 32
+#define MAX_SCALAR_BATCHED_SORF_SIZE 8
+
+// The signature shared by singleVectorSORF and its size-specialized
+// variants, so that callers can select one once and reuse it. R is
+// the type of the radem array: int8_t for one +/-1 entry per element,
+// or uint8_t for the bit-packed form (see getRademLength).
+template <typename T, typename R = int8_t>
+using SORFFunction = void (*)(T cbuffer[], const R *rademArray,
+        int repeatPosition, int rademShape2, int cbufferDim2);
+
+
+// The number of diagonal elements stored in the last dimension of a
+// radem array whose last dimension has length shape2. A bit-packed
+// radem array (type uint8_t) stores 8 elements per byte; bit (j & 7)
+// of byte (j >> 3) is set if element j is -1, i.e. the layout
+// produced by np.packbits(radem < 0, axis=2, bitorder="little").
+template <typename R>
+inline int getRademLength(size_t shape2){
+    return std::is_same<R, uint8_t>::value ? shape2 * 8 : shape2;
+}
 
 template <typename T>
 void multiplyByDiagonalRademacherMat2D(T __restrict xArray[],
@@ -16,24 +45,34 @@ void multiplyByDiagonalRademacherMat(T __restrict xArray[],
                     int startRow, int endRow);
 
 
-template <typename T>
-void singleVectorSORF(T cbuffer[], const int8_t *rademArray,
+template <typename T, typename R = int8_t>
+void singleVectorSORF(T cbuffer[], const R *rademArray,
         int repeatPosition, int rademShape2,
         int cbufferDim2);
 
+template <typename T, typename R = int8_t>
+SORFFunction<T, R> getSORFFunction(int cbufferDim2);
+
 template <typename T>
+bool useBatchedSORF(int cbufferDim2);
+
+template <typename T, typename R = int8_t>
+void interleavedBatchSORF(T tile[], const R *rademArray,
+        int repeatPosition, int rademShape2, int cbufferDim2);
+
+template <typename T, typename U>
 void singleVectorRBFPostProcess(const T xdata[],
-        const T chiArr[], double *outputArray,
+        const T chiArr[], U *outputArray,
         int dim2, int numFreqs,
         int rowNumber, int repeatNum,
-        double scalingTerm);
+        double scalingTerm, int sincosMode);
 
-template <typename T>
+template <typename T, typename U>
 void singleVectorRBFPostGrad(const T xdata[],
-        const T chiArr[], double *outputArray,
-        double *gradientArray, T sigma,
+        const T chiArr[], U *outputArray,
+        U *gradientArray, T sigma,
         int dim2, int numFreqs,
         int rowNumber, int repeatNum,
-        double scalingTerm);
+        double scalingTerm, int sincosMode);
 
 #endif
@@ -0,0 +1,723 @@
+/*!
+ * # simd_hadamard.cpp
+ *
+ * This module contains hand-vectorized unnormalized Hadamard transforms
+ * for a single vector, for AVX2, AVX-512 and NEON, together with the
+ * runtime dispatcher that selects among them. The x86 kernels are compiled
+ * with function-level target attributes so that the extension itself can
+ * be built without -march flags; the kernel actually used is chosen the
+ * first time a transform is requested, based on what the CPU supports.
+ *
+ * Every kernel performs the lowest strides (those that fit within one
+ * register) with in-register permutes, then the higher strides with
+ * full-width loads and stores. Each instruction set also has a radix-4
+ * stage, which performs two of the higher strides in one pass, for the
+ * blocked transform used for very large vectors. The scalar transform in hadamard_transforms.cpp
+ * remains the fallback and the reference implementation.
+ */
+#include <atomic>
+#include <stdexcept>
+#include "simd_hadamard.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define XGPR_FHT_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define XGPR_FHT_NEON_KERNELS
+#include <arm_neon.h>
+#endif
+
+
+static std::atomic<int> activeInstructionSet(-1);
+
+
+
+
+#ifdef XGPR_FHT_X86_KERNELS
+
+/*
+ * AVX2 kernels. Double precision handles strides 1 and 2 in register and
+ * stride 4 across a pair of registers; single precision handles strides 1,
+ * 2 and 4 in register and stride 8 across a pair.
+ */
+
+__attribute__((target("avx2")))
+static inline __m256d avx2Stride1(__m256d v){
+    __m256d p = _mm256_permute_pd(v, 0x5);
+    return _mm256_blend_pd(_mm256_add_pd(v, p), _mm256_sub_pd(p, v), 0xA);
+}
+
+__attribute__((target("avx2")))
+static inline __m256d avx2Stride2(__m256d v){
+    __m256d p = _mm256_permute2f128_pd(v, v, 0x01);
+    return _mm256_blend_pd(_mm256_add_pd(v, p), _mm256_sub_pd(p, v), 0xC);
+}
+
+__attribute__((target("avx2")))
+static void avx2WideStages(double *xArray, int dim, int firstStride){
+    for (int h = firstStride; h < dim; h <<= 1){
+        for (int i = 0; i < dim; i += (h << 1)){
+            for (int j = i; j < i + h; j += 4){
+                __m256d a = _mm256_loadu_pd(xArray + j);
+                __m256d b = _mm256_loadu_pd(xArray + j + h);
+                _mm256_storeu_pd(xArray + j, _mm256_add_pd(a, b));
+                _mm256_storeu_pd(xArray + j + h, _mm256_sub_pd(a, b));
+            }
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void avx2Transform(double *xArray, int dim){
+    for (int i = 0; i < dim; i += 8){
+        __m256d v0 = _mm256_loadu_pd(xArray + i);
+        __m256d v1 = _mm256_loadu_pd(xArray + i + 4);
+        v0 = avx2Stride2(avx2Stride1(v0));
+        v1 = avx2Stride2(avx2Stride1(v1));
+        _mm256_storeu_pd(xArray + i, _mm256_add_pd(v0, v1));
+        _mm256_storeu_pd(xArray + i + 4, _mm256_sub_pd(v0, v1));
+    }
+
+    avx2WideStages(xArray, dim, 8);
+}
+
+__attribute__((target("avx2")))
+static void avx2Radix4Stage(double *xArray, int h){
+    for (int j = 0; j < h; j += 4){
+        __m256d x0 = _mm256_loadu_pd(xArray + j);
+        __m256d x1 = _mm256_loadu_pd(xArray + j + h);
+        __m256d x2 = _mm256_loadu_pd(xArray + j + 2 * h);
+        __m256d x3 = _mm256_loadu_pd(xArray + j + 3 * h);
+        __m256d a = _mm256_add_pd(x0, x1), b = _mm256_sub_pd(x0, x1);
+        __m256d c = _mm256_add_pd(x2, x3), d = _mm256_sub_pd(x2, x3);
+        _mm256_storeu_pd(xArray + j, _mm256_add_pd(a, c));
+        _mm256_storeu_pd(xArray + j + h, _mm256_add_pd(b, d));
+        _mm256_storeu_pd(xArray + j + 2 * h, _mm256_sub_pd(a, c));
+        _mm256_storeu_pd(xArray + j + 3 * h, _mm256_sub_pd(b, d));
+    }
+}
+
+
+__attribute__((target("avx2")))
+static inline __m256 avx2Stride1(__m256 v){
+    __m256 p = _mm256_permute_ps(v, 0xB1);
+    return _mm256_blend_ps(_mm256_add_ps(v, p), _mm256_sub_ps(p, v), 0xAA);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 avx2Stride2(__m256 v){
+    __m256 p = _mm256_permute_ps(v, 0x4E);
+    return _mm256_blend_ps(_mm256_add_ps(v, p), _mm256_sub_ps(p, v), 0xCC);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 avx2Stride4(__m256 v){
+    __m256 p = _mm256_permute2f128_ps(v, v, 0x01);
+    return _mm256_blend_ps(_mm256_add_ps(v, p), _mm256_sub_ps(p, v), 0xF0);
+}
+
+__attribute__((target("avx2")))
+static void avx2WideStages(float *xArray, int dim, int firstStride){
+    for (int h = firstStride; h < dim; h <<= 1){
+        for (int i = 0; i < dim; i += (h << 1)){
+            for (int j = i; j < i + h; j += 8){
+                __m256 a = _mm256_loadu_ps(xArray + j);
+                __m256 b = _mm256_loadu_ps(xArray + j + h);
+                _mm256_storeu_ps(xArray + j, _mm256_add_ps(a, b));
+                _mm256_storeu_ps(xArray + j + h, _mm256_sub_ps(a, b));
+            }
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void avx2Transform(float *xArray, int dim){
+    for (int i = 0; i < dim; i += 16){
+        __m256 v0 = _mm256_loadu_ps(xArray + i);
+        __m256 v1 = _mm256_loadu_ps(xArray + i + 8);
+        v0 = avx2Stride4(avx2Stride2(avx2Stride1(v0)));
+        v1 = avx2Stride4(avx2Stride2(avx2Stride1(v1)));
+        _mm256_storeu_ps(xArray + i, _mm256_add_ps(v0, v1));
+        _mm256_storeu_ps(xArray + i + 8, _mm256_sub_ps(v0, v1));
+    }
+
+    avx2WideStages(xArray, dim, 16);
+}
+
+__attribute__((target("avx2")))
+static void avx2Radix4Stage(float *xArray, int h){
+    for (int j = 0; j < h; j += 8){
+        __m256 x0 = _mm256_loadu_ps(xArray + j);
+        __m256 x1 = _mm256_loadu_ps(xArray + j + h);
+        __m256 x2 = _mm256_loadu_ps(xArray + j + 2 * h);
+        __m256 x3 = _mm256_loadu_ps(xArray + j + 3 * h);
+        __m256 a = _mm256_add_ps(x0, x1), b = _mm256_sub_ps(x0, x1);
+        __m256 c = _mm256_add_ps(x2, x3), d = _mm256_sub_ps(x2, x3);
+        _mm256_storeu_ps(xArray + j, _mm256_add_ps(a, c));
+        _mm256_storeu_ps(xArray + j + h, _mm256_add_ps(b, d));
+        _mm256_storeu_ps(xArray + j + 2 * h, _mm256_sub_ps(a, c));
+        _mm256_storeu_ps(xArray + j + 3 * h, _mm256_sub_ps(b, d));
+    }
+}
+
+
+
+
+/*
+ * AVX-512 kernels. Double precision handles strides 1, 2 and 4 in register
+ * and stride 8 across a pair of registers; single precision handles strides
+ * 1 through 8 in register and stride 16 across a pair.
+ */
+
+__attribute__((target("avx512f")))
+static inline __m512d avx512Stride1(__m512d v){
+    __m512d p = _mm512_permute_pd(v, 0x55);
+    return _mm512_mask_blend_pd(0xAA, _mm512_add_pd(v, p), _mm512_sub_pd(p, v));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d avx512Stride2(__m512d v){
+    __m512d p = _mm512_permutex_pd(v, 0x4E);
+    return _mm512_mask_blend_pd(0xCC, _mm512_add_pd(v, p), _mm512_sub_pd(p, v));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d avx512Stride4(__m512d v){
+    __m512d p = _mm512_shuffle_f64x2(v, v, 0x4E);
+    return _mm512_mask_blend_pd(0xF0, _mm512_add_pd(v, p), _mm512_sub_pd(p, v));
+}
+
+__attribute__((target("avx512f")))
+static void avx512WideStages(double *xArray, int dim, int firstStride){
+    for (int h = firstStride; h < dim; h <<= 1){
+        for (int i = 0; i < dim; i += (h << 1)){
+            for (int j = i; j < i + h; j += 8){
+                __m512d a = _mm512_loadu_pd(xArray + j);
+                __m512d b = _mm512_loadu_pd(xArray + j + h);
+                _mm512_storeu_pd(xArray + j, _mm512_add_pd(a, b));
+                _mm512_storeu_pd(xArray + j + h, _mm512_sub_pd(a, b));
+            }
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+static void avx512Transform(double *xArray, int dim){
+    for (int i = 0; i < dim; i += 16){
+        __m512d v0 = _mm512_loadu_pd(xArray + i);
+        __m512d v1 = _mm512_loadu_pd(xArray + i + 8);
+        v0 = avx512Stride4(avx512Stride2(avx512Stride1(v0)));
+        v1 = avx512Stride4(avx512Stride2(avx512Stride1(v1)));
+        _mm512_storeu_pd(xArray + i, _mm512_add_pd(v0, v1));
+        _mm512_storeu_pd(xArray + i + 8, _mm512_sub_pd(v0, v1));
+    }
+
+    avx512WideStages(xArray, dim, 16);
+}
+
+__attribute__((target("avx512f")))
+static void avx512Radix4Stage(double *xArray, int h){
+    for (int j = 0; j < h; j += 8){
+        __m512d x0 = _mm512_loadu_pd(xArray + j);
+        __m512d x1 = _mm512_loadu_pd(xArray + j + h);
+        __m512d x2 = _mm512_loadu_pd(xArray + j + 2 * h);
+        __m512d x3 = _mm512_loadu_pd(xArray + j + 3 * h);
+        __m512d a = _mm512_add_pd(x0, x1), b = _mm512_sub_pd(x0, x1);
+        __m512d c = _mm512_add_pd(x2, x3), d = _mm512_sub_pd(x2, x3);
+        _mm512_storeu_pd(xArray + j, _mm512_add_pd(a, c));
+        _mm512_storeu_pd(xArray + j + h, _mm512_add_pd(b, d));
+        _mm512_storeu_pd(xArray + j + 2 * h, _mm512_sub_pd(a, c));
+        _mm512_storeu_pd(xArray + j + 3 * h, _mm512_sub_pd(b, d));
+    }
+}
+
+
+__attribute__((target("avx512f")))
+static inline __m512 avx512Stride1(__m512 v){
+    __m512 p = _mm512_permute_ps(v, 0xB1);
+    return _mm512_mask_blend_ps(0xAAAA, _mm512_add_ps(v, p), _mm512_sub_ps(p, v));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 avx512Stride2(__m512 v){
+    __m512 p = _mm512_permute_ps(v, 0x4E);
+    return _mm512_mask_blend_ps(0xCCCC, _mm512_add_ps(v, p), _mm512_sub_ps(p, v));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 avx512Stride4(__m512 v){
+    __m512 p = _mm512_shuffle_f32x4(v, v, 0xB1);
+    return _mm512_mask_blend_ps(0xF0F0, _mm512_add_ps(v, p), _mm512_sub_ps(p, v));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 avx512Stride8(__m512 v){
+    __m512 p = _mm512_shuffle_f32x4(v, v, 0x4E);
+    return _mm512_mask_blend_ps(0xFF00, _mm512_add_ps(v, p), _mm512_sub_ps(p, v));
+}
+
+__attribute__((target("avx512f")))
+static void avx512WideStages(float *xArray, int dim, int firstStride){
+    for (int h = firstStride; h < dim; h <<= 1){
+        for (int i = 0; i < dim; i += (h << 1)){
+            for (int j = i; j < i + h; j += 16){
+                __m512 a = _mm512_loadu_ps(xArray + j);
+                __m512 b = _mm512_loadu_ps(xArray + j + h);
+                _mm512_storeu_ps(xArray + j, _mm512_add_ps(a, b));
+                _mm512_storeu_ps(xArray + j + h, _mm512_sub_ps(a, b));
+            }
+        }
+    }
+}
+
+__attribute__((target("avx512f")))
+static void avx512Transform(float *xArray, int dim){
+    for (int i = 0; i < dim; i += 32){
+        __m512 v0 = _mm512_loadu_ps(xArray + i);
+        __m512 v1 = _mm512_loadu_ps(xArray + i + 16);
+        v0 = avx512Stride8(avx512Stride4(avx512Stride2(avx512Stride1(v0))));
+        v1 = avx512Stride8(avx512Stride4(avx512Stride2(avx512Stride1(v1))));
+        _mm512_storeu_ps(xArray + i, _mm512_add_ps(v0, v1));
+        _mm512_storeu_ps(xArray + i + 16, _mm512_sub_ps(v0, v1));
+    }
+
+    avx512WideStages(xArray, dim, 32);
+}
+
+__attribute__((target("avx512f")))
+static void avx512Radix4Stage(float *xArray, int h){
+    for (int j = 0; j < h; j += 16){
+        __m512 x0 = _mm512_loadu_ps(xArray + j);
+        __m512 x1 = _mm512_loadu_ps(xArray + j + h);
+        __m512 x2 = _mm512_loadu_ps(xArray + j + 2 * h);
+        __m512 x3 = _mm512_loadu_ps(xArray + j + 3 * h);
+        __m512 a = _mm512_add_ps(x0, x1), b = _mm512_sub_ps(x0, x1);
+        __m512 c = _mm512_add_ps(x2, x3), d = _mm512_sub_ps(x2, x3);
+        _mm512_storeu_ps(xArray + j, _mm512_add_ps(a, c));
+        _mm512_storeu_ps(xArray + j + h, _mm512_add_ps(b, d));
+        _mm512_storeu_ps(xArray + j + 2 * h, _mm512_sub_ps(a, c));
+        _mm512_storeu_ps(xArray + j + 3 * h, _mm512_sub_ps(b, d));
+    }
+}
+
+#endif
+
+
+
+
+#ifdef XGPR_FHT_NEON_KERNELS
+
+/*
+ * NEON kernels. Stride 1 uses an interleaving load so that the pairs
+ * land in separate registers; double precision then handles stride 2
+ * across a pair of registers, while single precision handles stride 2
+ * in register and stride 4 across a pair.
+ */
+
+static void neonWideStages(double *xArray, int dim, int firstStride){
+    for (int h = firstStride; h < dim; h <<= 1){
+        for (int i = 0; i < dim; i += (h << 1)){
+            for (int j = i; j < i + h; j += 2){
+                float64x2_t a = vld1q_f64(xArray + j);
+                float64x2_t b = vld1q_f64(xArray + j + h);
+                vst1q_f64(xArray + j, vaddq_f64(a, b));
+                vst1q_f64(xArray + j + h, vsubq_f64(a, b));
+            }
+        }
+    }
+}
+
+static void neonTransform(double *xArray, int dim){
+    for (int i = 0; i < dim; i += 4){
+        float64x2x2_t pairs = vld2q_f64(xArray + i);
+        float64x2_t s = vaddq_f64(pairs.val[0], pairs.val[1]);
+        float64x2_t d = vsubq_f64(pairs.val[0], pairs.val[1]);
+        float64x2_t v0 = vzip1q_f64(s, d);
+        float64x2_t v1 = vzip2q_f64(s, d);
+        vst1q_f64(xArray + i, vaddq_f64(v0, v1));
+        vst1q_f64(xArray + i + 2, vsubq_f64(v0, v1));
+    }
+
+    neonWideStages(xArray, dim, 4);
+}
+
+static void neonRadix4Stage(double *xArray, int h){
+    for (int j = 0; j < h; j += 2){
+        float64x2_t x0 = vld1q_f64(xArray + j);
+        float64x2_t x1 = vld1q_f64(xArray + j + h);
+        float64x2_t x2 = vld1q_f64(xArray + j + 2 * h);
+        float64x2_t x3 = vld1q_f64(xArray + j + 3 * h);
+        float64x2_t a = vaddq_f64(x0, x1), b = vsubq_f64(x0, x1);
+        float64x2_t c = vaddq_f64(x2, x3), d = vsubq_f64(x2, x3);
+        vst1q_f64(xArray + j, vaddq_f64(a, c));
+        vst1q_f64(xArray + j + h, vaddq_f64(b, d));
+        vst1q_f64(xArray + j + 2 * h, vsubq_f64(a, c));
+        vst1q_f64(xArray + j + 3 * h, vsubq_f64(b, d));
+    }
+}
+
+
+static inline float32x4_t neonStride2(float32x4_t v){
+    float32x2_t lo = vget_low_f32(v), hi = vget_high_f32(v);
+    return vcombine_f32(vadd_f32(lo, hi), vsub_f32(lo, hi));
+}
+
+static void neonWideStages(float *xArray, int dim, int firstStride){
+    for (int h = firstStride; h < dim; h <<= 1){
+        for (int i = 0; i < dim; i += (h << 1)){
+            for (int j = i; j < i + h; j += 4){
+                float32x4_t a = vld1q_f32(xArray + j);
+                float32x4_t b = vld1q_f32(xArray + j + h);
+                vst1q_f32(xArray + j, vaddq_f32(a, b));
+                vst1q_f32(xArray + j + h, vsubq_f32(a, b));
+            }
+        }
+    }
+}
+
+static void neonTransform(float *xArray, int dim){
+    for (int i = 0; i < dim; i += 8){
+        float32x4x2_t pairs = vld2q_f32(xArray + i);
+        float32x4_t s = vaddq_f32(pairs.val[0], pairs.val[1]);
+        float32x4_t d = vsubq_f32(pairs.val[0], pairs.val[1]);
+        float32x4_t v0 = neonStride2(vzip1q_f32(s, d));
+        float32x4_t v1 = neonStride2(vzip2q_f32(s, d));
+        vst1q_f32(xArray + i, vaddq_f32(v0, v1));
+        vst1q_f32(xArray + i + 4, vsubq_f32(v0, v1));
+    }
+
+    neonWideStages(xArray, dim, 8);
+}
+
+static void neonRadix4Stage(float *xArray, int h){
+    for (int j = 0; j < h; j += 4){
+        float32x4_t x0 = vld1q_f32(xArray + j);
+        float32x4_t x1 = vld1q_f32(xArray + j + h);
+        float32x4_t x2 = vld1q_f32(xArray + j + 2 * h);
+        float32x4_t x3 = vld1q_f32(xArray + j + 3 * h);
+        float32x4_t a = vaddq_f32(x0, x1), b = vsubq_f32(x0, x1);
+        float32x4_t c = vaddq_f32(x2, x3), d = vsubq_f32(x2, x3);
+        vst1q_f32(xArray + j, vaddq_f32(a, c));
+        vst1q_f32(xArray + j + h, vaddq_f32(b, d));
+        vst1q_f32(xArray + j + 2 * h, vsubq_f32(a, c));
+        vst1q_f32(xArray + j + 3 * h, vsubq_f32(b, d));
+    }
+}
+
+#endif
+
+
+
+
+/*!
+ * # detectFHTInstructionSet
+ *
+ * Returns the best instruction set supported by this CPU for which
+ * a vectorized transform was compiled.
+ */
+int detectFHTInstructionSet(){
+#ifdef XGPR_FHT_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return FHT_ISA_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return FHT_ISA_AVX2;
+#endif
+#ifdef XGPR_FHT_NEON_KERNELS
+    return FHT_ISA_NEON;
+#endif
+    return FHT_ISA_SCALAR;
+}
+
+
+/*!
+ * # fhtInstructionSetSupported
+ *
+ * Checks whether the requested instruction set can be used on this CPU.
+ */
+bool fhtInstructionSetSupported(int instructionSet){
+    switch (instructionSet){
+        case FHT_ISA_SCALAR:
+            return true;
+#ifdef XGPR_FHT_X86_KERNELS
+        case FHT_ISA_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+        case FHT_ISA_AVX512:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx512f");
+#endif
+#ifdef XGPR_FHT_NEON_KERNELS
+        case FHT_ISA_NEON:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+
+
+/*!
+ * # getFHTInstructionSet_
+ *
+ * Wrapper-facing function that returns the instruction set currently
+ * used for Hadamard transforms, detecting it on first use.
+ */
+int getFHTInstructionSet_(){
+    int instructionSet = activeInstructionSet.load(std::memory_order_relaxed);
+    if (instructionSet < 0){
+        instructionSet = detectFHTInstructionSet();
+        activeInstructionSet.store(instructionSet, std::memory_order_relaxed);
+    }
+    return instructionSet;
+}
+
+
+/*!
+ * # setFHTInstructionSet_
+ *
+ * Wrapper-facing function that overrides the instruction set used for
+ * Hadamard transforms, e.g. to force the scalar reference path for testing.
+ * Passing -1 restores automatic detection.
+ */
+int setFHTInstructionSet_(int instructionSet){
+    if (instructionSet < 0)
+        instructionSet = detectFHTInstructionSet();
+    if (!fhtInstructionSetSupported(instructionSet))
+        throw std::runtime_error("The requested instruction set is not "
+                "supported on this CPU.");
+    activeInstructionSet.store(instructionSet, std::memory_order_relaxed);
+    return 0;
+}
+
+
+
+/*!
+ * # simdKernelFor
+ *
+ * Returns the instruction set of the vectorized kernel that will be
+ * used for a vector of length dim, or FHT_ISA_SCALAR if the vector is too
+ * short for any active kernel. Each kernel works on blocks of two full
+ * registers, so dim must be at least that long.
+ */
+template <typename T>
+static int simdKernelFor(int dim){
+    switch (getFHTInstructionSet_()){
+#ifdef XGPR_FHT_X86_KERNELS
+        case FHT_ISA_AVX512:
+            if (dim >= static_cast<int>(128 / sizeof(T)))
+                return FHT_ISA_AVX512;
+            //Every CPU with AVX-512F also supports AVX2, so shorter vectors
+            //can still use the AVX2 kernel.
+            [[fallthrough]];
+        case FHT_ISA_AVX2:
+            if (dim >= static_cast<int>(64 / sizeof(T)))
+                return FHT_ISA_AVX2;
+            break;
+#endif
+#ifdef XGPR_FHT_NEON_KERNELS
+        case FHT_ISA_NEON:
+            if (dim >= static_cast<int>(32 / sizeof(T)))
+                return FHT_ISA_NEON;
+            break;
+#endif
+        default:
+            break;
+    }
+    return FHT_ISA_SCALAR;
+}
+
+
+/*!
+ * # simdTransformAvailable
+ *
+ * Checks whether simdVectorTransform can be used for vectors of length dim.
+ */
+template <typename T>
+bool simdTransformAvailable(int dim){
+    return simdKernelFor<T>(dim) != FHT_ISA_SCALAR;
+}
+template bool simdTransformAvailable<double>(int dim);
+template bool simdTransformAvailable<float>(int dim);
+
+
+
+/*!
+ * # simdVectorTransform
+ *
+ * Performs an unnormalized Hadamard transform on a single vector using
+ * the active vectorized kernel. Returns false without modifying xArray if
+ * no vectorized kernel is active or if dim is too short for the kernel,
+ * in which case the caller should use the scalar transform.
+ *
+ * ## Args:
+ *
+ * + `xArray` Pointer to the first element of the vector. Must be of
+ * length dim, which MUST be a power of 2.
+ * + `dim` The length of the vector.
+ */
+template <typename T>
+bool simdVectorTransform(T xArray[], int dim){
+    switch (simdKernelFor<T>(dim)){
+#ifdef XGPR_FHT_X86_KERNELS
+        case FHT_ISA_AVX512:
+            avx512Transform(xArray, dim);
+            return true;
+        case FHT_ISA_AVX2:
+            avx2Transform(xArray, dim);
+            return true;
+#endif
+#ifdef XGPR_FHT_NEON_KERNELS
+        case FHT_ISA_NEON:
+            neonTransform(xArray, dim);
+            return true;
+#endif
+        default:
+            break;
+    }
+    return false;
+}
+template bool simdVectorTransform<double>(double xArray[], int dim);
+template bool simdVectorTransform<float>(float xArray[], int dim);
+
+
+
+
+/*!
+ * # simdRadix4Stage
+ *
+ * Performs the last two butterfly stages (of stride h and 2h) of an
+ * unnormalized Hadamard transform on a vector of length 4h in a single
+ * pass using the active vectorized kernel, as used by blockedTransform.
+ * Returns false without modifying xArray if no vectorized kernel is
+ * active or h is too short for it, in which case the caller should use
+ * the scalar version.
+ *
+ * ## Args:
+ *
+ * + `xArray` Pointer to the first element of the vector.
+ * + `h` A quarter of the length of the vector. MUST be a power of 2.
+ */
+template <typename T>
+bool simdRadix4Stage(T xArray[], int h){
+    switch (simdKernelFor<T>(h)){
+#ifdef XGPR_FHT_X86_KERNELS
+        case FHT_ISA_AVX512:
+            avx512Radix4Stage(xArray, h);
+            return true;
+        case FHT_ISA_AVX2:
+            avx2Radix4Stage(xArray, h);
+            return true;
+#endif
+#ifdef XGPR_FHT_NEON_KERNELS
+        case FHT_ISA_NEON:
+            neonRadix4Stage(xArray, h);
+            return true;
+#endif
+        default:
+            break;
+    }
+    return false;
+}
+template bool simdRadix4Stage<double>(double xArray[], int h);
+template bool simdRadix4Stage<float>(float xArray[], int h);
+
+
+
+
+/*!
+ * # simdInterleavedKernelFor
+ *
+ * Returns the instruction set of the vectorized kernel that will be
+ * used to transform numInterleaved interleaved vectors, or FHT_ISA_SCALAR
+ * if none is active. Each butterfly of an interleaved transform acts on
+ * numInterleaved contiguous elements, so numInterleaved must be a multiple
+ * of the register width.
+ */
+template <typename T>
+static int simdInterleavedKernelFor(int numInterleaved){
+    switch (getFHTInstructionSet_()){
+#ifdef XGPR_FHT_X86_KERNELS
+        case FHT_ISA_AVX512:
+            if (numInterleaved % static_cast<int>(64 / sizeof(T)) == 0)
+                return FHT_ISA_AVX512;
+            [[fallthrough]];
+        case FHT_ISA_AVX2:
+            if (numInterleaved % static_cast<int>(32 / sizeof(T)) == 0)
+                return FHT_ISA_AVX2;
+            break;
+#endif
+#ifdef XGPR_FHT_NEON_KERNELS
+        case FHT_ISA_NEON:
+            if (numInterleaved % static_cast<int>(16 / sizeof(T)) == 0)
+                return FHT_ISA_NEON;
+            break;
+#endif
+        default:
+            break;
+    }
+    return FHT_ISA_SCALAR;
+}
+
+
+/*!
+ * # simdInterleavedTransformAvailable
+ *
+ * Checks whether simdInterleavedTransform can be used for a group of
+ * numInterleaved vectors.
+ */
+template <typename T>
+bool simdInterleavedTransformAvailable(int numInterleaved){
+    return simdInterleavedKernelFor<T>(numInterleaved) != FHT_ISA_SCALAR;
+}
+template bool simdInterleavedTransformAvailable<double>(int numInterleaved);
+template bool simdInterleavedTransformAvailable<float>(int numInterleaved);
+
+
+
+/*!
+ * # simdInterleavedTransform
+ *
+ * Performs an unnormalized Hadamard transform on each of numInterleaved
+ * vectors stored interleaved, so that element m of vector b is at
+ * xArray[m * numInterleaved + b]. In this layout the transform is the
+ * same sequence of butterflies as for one long vector, starting at stride
+ * numInterleaved, so it uses only the full-width stages of each kernel.
+ * Returns false without modifying xArray if no suitable kernel is active.
+ *
+ * ## Args:
+ *
+ * + `xArray` Pointer to the first element of the interleaved array, of
+ * length dim * numInterleaved.
+ * + `dim` The length of each vector. MUST be a power of 2.
+ * + `numInterleaved` The number of vectors. Must be a power of 2.
+ */
+template <typename T>
+bool simdInterleavedTransform(T xArray[], int dim, int numInterleaved){
+    int totalSize = dim * numInterleaved;
+    switch (simdInterleavedKernelFor<T>(numInterleaved)){
+#ifdef XGPR_FHT_X86_KERNELS
+        case FHT_ISA_AVX512:
+            avx512WideStages(xArray, totalSize, numInterleaved);
+            return true;
+        case FHT_ISA_AVX2:
+            avx2WideStages(xArray, totalSize, numInterleaved);
+            return true;
+#endif
+#ifdef XGPR_FHT_NEON_KERNELS
+        case FHT_ISA_NEON:
+            neonWideStages(xArray, totalSize, numInterleaved);
+            return true;
+#endif
+        default:
+            break;
+    }
+    return false;
+}
+template bool simdInterleavedTransform<double>(double xArray[], int dim,
+        int numInterleaved);
+template bool simdInterleavedTransform<float>(float xArray[], int dim,
+        int numInterleaved);
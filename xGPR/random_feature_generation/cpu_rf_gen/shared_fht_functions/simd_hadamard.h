@@ -0,0 +1,34 @@
+#ifndef SIMD_HADAMARD_TRANSFORM_OPERATIONS_H
+#define SIMD_HADAMARD_TRANSFORM_OPERATIONS_H
+
+// The instruction sets for which a hand-vectorized transform is available.
+// Scalar is always available and is used as a fallback if the CPU does not
+// support any of the others or for very short vectors.
+#define FHT_ISA_SCALAR 0
+#define FHT_ISA_AVX2 1
+#define FHT_ISA_AVX512 2
+#define FHT_ISA_NEON 3
+
+
+int detectFHTInstructionSet();
+bool fhtInstructionSetSupported(int instructionSet);
+
+int getFHTInstructionSet_();
+int setFHTInstructionSet_(int instructionSet);
+
+template <typename T>
+bool simdTransformAvailable(int dim);
+
+template <typename T>
+bool simdVectorTransform(T xArray[], int dim);
+
+template <typename T>
+bool simdRadix4Stage(T xArray[], int h);
+
+template <typename T>
+bool simdInterleavedTransformAvailable(int numInterleaved);
+
+template <typename T>
+bool simdInterleavedTransform(T xArray[], int dim, int numInterleaved);
+
+#endif
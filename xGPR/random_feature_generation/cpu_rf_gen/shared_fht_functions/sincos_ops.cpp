@@ -0,0 +1,202 @@
+/*!
+ * # sincos_ops.cpp
+ *
+ * This module contains a combined sine / cosine kernel used as a faster
+ * alternative to libm in the RBF post-processing step. Each value is
+ * reduced to [-pi/4, pi/4] by subtracting a multiple of pi/2 (using
+ * a constant split into two or three parts, Cody-Waite style, so that
+ * the subtraction is close to exact), after which sine and cosine are
+ * approximated by the minimax polynomials from the Cephes library.
+ * The quadrant is then used to select and negate the results. There
+ * are no branches or calls in the per-element code, so the loop can
+ * be vectorized by the compiler.
+ *
+ * Maximum error is about 1e-7 relative in single precision and 1e-12
+ * in double precision, provided the inputs are below the limits
+ * defined below. For larger inputs the range reduction loses accuracy,
+ * so fastVectorSinCos reports failure and the caller uses libm.
+ */
+#include <math.h>
+#include <stdexcept>
+#include "sincos_ops.h"
+#include "simd_hadamard.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define XGPR_SINCOS_X86_KERNELS
+#endif
+
+// The largest magnitude for which range reduction is accurate. For
+// double precision, q * pio2 must be exact for the first part of the
+// split constant, which holds for q < 2^20; for single precision the
+// Cephes limit is used.
+#define FAST_SINCOS_DOUBLE_LIMIT 1.0e6
+#define FAST_SINCOS_FLOAT_LIMIT 8192.0f
+
+
+
+/*!
+ * # getSinCosMode
+ *
+ * Converts the precision mode string accepted by the wrappers to one
+ * of the SINCOS constants in the header.
+ *
+ * ## Args:
+ *
+ * + `precisionMode` One of "exact" or "fast".
+ */
+int getSinCosMode(const std::string &precisionMode){
+    if (precisionMode == "exact")
+        return SINCOS_EXACT;
+    if (precisionMode == "fast")
+        return SINCOS_FAST;
+    throw std::runtime_error("Unrecognized precision mode; must be one of "
+            "'exact', 'fast'.");
+}
+
+
+
+/*
+ * Single-element kernels. The magic constant is 1.5 * 2^(mantissa bits);
+ * adding and subtracting it rounds to the nearest integer without a
+ * call to rint, which not all targets can vectorize.
+ */
+
+static inline void sinCosKernel(double x, double &sinVal, double &cosVal){
+    const double magic = 6755399441055744.0;
+    double q = (x * 0.63661977236758134308 + magic) - magic;
+    int quadrant = static_cast<int>(q);
+
+    double r = (x - q * 1.57079632673412561417e+00) - q * 6.07710050650619224932e-11;
+    double z = r * r;
+
+    double s = 1.58962301576546568060e-10;
+    s = s * z - 2.50507477628578072866e-8;
+    s = s * z + 2.75573136213857245213e-6;
+    s = s * z - 1.98412698295895385996e-4;
+    s = s * z + 8.33333333332211858878e-3;
+    s = s * z - 1.66666666666666307295e-1;
+    s = r + r * z * s;
+
+    double c = -1.13585365213876817300e-11;
+    c = c * z + 2.08757008419747316778e-9;
+    c = c * z - 2.75573141792967388112e-7;
+    c = c * z + 2.48015872888517045348e-5;
+    c = c * z - 1.38888888888730564116e-3;
+    c = c * z + 4.16666666666665929218e-2;
+    c = 1.0 - 0.5 * z + z * z * c;
+
+    double swappedSin = (quadrant & 1) ? c : s;
+    double swappedCos = (quadrant & 1) ? s : c;
+    sinVal = (quadrant & 2) ? -swappedSin : swappedSin;
+    cosVal = ((quadrant + 1) & 2) ? -swappedCos : swappedCos;
+}
+
+
+static inline void sinCosKernel(float x, float &sinVal, float &cosVal){
+    const float magic = 12582912.0f;
+    float q = (x * 0.636619772367581f + magic) - magic;
+    int quadrant = static_cast<int>(q);
+
+    float r = ((x - q * 1.5703125f) - q * 4.837512969970703125e-4f)
+        - q * 7.54978995489188216e-8f;
+    float z = r * r;
+
+    float s = -1.9515295891e-4f;
+    s = s * z + 8.3321608736e-3f;
+    s = s * z - 1.6666654611e-1f;
+    s = r + r * z * s;
+
+    float c = 2.443315711809948e-5f;
+    c = c * z - 1.388731625493765e-3f;
+    c = c * z + 4.166664568298827e-2f;
+    c = 1.0f - 0.5f * z + z * z * c;
+
+    float swappedSin = (quadrant & 1) ? c : s;
+    float swappedCos = (quadrant & 1) ? s : c;
+    sinVal = (quadrant & 2) ? -swappedSin : swappedSin;
+    cosVal = ((quadrant + 1) & 2) ? -swappedCos : swappedCos;
+}
+
+
+/*
+ * The loop over the kernel, compiled once for the baseline target and,
+ * on x86, once more with AVX2 enabled so that four doubles or eight
+ * floats are processed per instruction. The AVX2 version is used
+ * whenever the vectorized FHT kernels are (every CPU with AVX-512F
+ * also supports AVX2).
+ */
+template <typename T>
+static void sinCosLoop(const T *__restrict xArray, T *__restrict sinArray,
+        T *__restrict cosArray, int numElements){
+    #pragma omp simd
+    for (int i=0; i < numElements; i++)
+        sinCosKernel(xArray[i], sinArray[i], cosArray[i]);
+}
+
+#ifdef XGPR_SINCOS_X86_KERNELS
+template <typename T>
+__attribute__((target("avx2")))
+static void avx2SinCosLoop(const T *__restrict xArray, T *__restrict sinArray,
+        T *__restrict cosArray, int numElements){
+    #pragma omp simd
+    for (int i=0; i < numElements; i++)
+        sinCosKernel(xArray[i], sinArray[i], cosArray[i]);
+}
+#endif
+
+
+static inline double fastSinCosLimit(double){
+    return FAST_SINCOS_DOUBLE_LIMIT;
+}
+
+static inline float fastSinCosLimit(float){
+    return FAST_SINCOS_FLOAT_LIMIT;
+}
+
+
+
+/*!
+ * # fastVectorSinCos
+ *
+ * Calculates the sine and cosine of each element of an array using
+ * the polynomial kernel. Returns false without modifying the outputs
+ * if any element is too large in magnitude for accurate range
+ * reduction (or is NaN), in which case the caller should use libm.
+ *
+ * ## Args:
+ *
+ * + `xArray` Pointer to the first element of the input array.
+ * + `sinArray` Pointer to the first element of the array in which the
+ * sines will be stored.
+ * + `cosArray` Pointer to the first element of the array in which the
+ * cosines will be stored.
+ * + `numElements` The length of all three arrays.
+ */
+template <typename T>
+bool fastVectorSinCos(const T xArray[], T sinArray[], T cosArray[], int numElements){
+    const T limit = fastSinCosLimit(static_cast<T>(0));
+    int outOfRange = 0;
+
+    //Written so that NaN inputs also count as out of range.
+    #pragma omp simd reduction(+:outOfRange)
+    for (int i=0; i < numElements; i++){
+        T absVal = xArray[i] < 0 ? -xArray[i] : xArray[i];
+        outOfRange += !(absVal < limit);
+    }
+    if (outOfRange > 0)
+        return false;
+
+#ifdef XGPR_SINCOS_X86_KERNELS
+    if (getFHTInstructionSet_() != FHT_ISA_SCALAR){
+        avx2SinCosLoop(xArray, sinArray, cosArray, numElements);
+        return true;
+    }
+#endif
+    sinCosLoop(xArray, sinArray, cosArray, numElements);
+    return true;
+}
+//Explicitly instantiate for external use.
+template bool fastVectorSinCos<double>(const double xArray[], double sinArray[],
+        double cosArray[], int numElements);
+template bool fastVectorSinCos<float>(const float xArray[], float sinArray[],
+        float cosArray[], int numElements);
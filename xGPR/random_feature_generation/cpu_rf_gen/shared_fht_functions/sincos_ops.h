@@ -0,0 +1,22 @@
+#ifndef SINCOS_OPERATIONS_H
+#define SINCOS_OPERATIONS_H
+
+#include <string>
+
+// The precision modes for the sine and cosine calculations in the RBF
+// post-processing step. Exact uses libm; fast uses a polynomial kernel
+// with range reduction that the compiler can vectorize.
+#define SINCOS_EXACT 0
+#define SINCOS_FAST 1
+
+// The number of values processed together by the fast kernel. This
+// bounds the size of the stack buffers used by calling loops.
+#define SINCOS_CHUNK_SIZE 64
+
+
+int getSinCosMode(const std::string &precisionMode);
+
+template <typename T>
+bool fastVectorSinCos(const T xArray[], T sinArray[], T cosArray[], int numElements);
+
+#endif
@@ -0,0 +1,586 @@
+/*!
+ * # thread_pool.cpp
+ *
+ * This module contains the persistent worker pool used by all of the
+ * CPU feature generation and transform routines, together with the
+ * small set of functions that let the Python wrapper configure it.
+ */
+#include <new>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "thread_pool.h"
+#include "../../native_profiler.h"
+
+#ifdef __linux__
+#define THREAD_POOL_USE_NUMA 1
+#include <sched.h>
+#else
+#define THREAD_POOL_USE_NUMA 0
+#endif
+
+
+
+/*!
+ * # getInstance
+ *
+ * Returns the process-wide pool. It is created on first use and
+ * destroyed (joining all workers) at process exit if it has not
+ * already been shut down by the caller.
+ */
+RFGenThreadPool &RFGenThreadPool::getInstance(){
+    static RFGenThreadPool threadPool;
+    return threadPool;
+}
+
+
+RFGenThreadPool::~RFGenThreadPool(){
+    shutdown();
+}
+
+
+
+/*!
+ * # run
+ *
+ * Runs job(threadIndex) once for each threadIndex in [0, numThreads)
+ * and blocks until all have finished. Thread index 0 is run by the
+ * caller. If any of the jobs throws, the first exception is rethrown
+ * here once all jobs have finished, so that the nanobind wrapper can
+ * hand it off to Python.
+ *
+ * ## Args:
+ *
+ * + `numThreads` The number of threads to use. Additional workers are
+ * created if the pool is currently too small.
+ * + `job` The function to run on each thread.
+ */
+void RFGenThreadPool::run(int numThreads, const std::function<void(int)> &job){
+    if (numThreads < 1)
+        numThreads = 1;
+
+    std::lock_guard<std::mutex> submitLock(submitMutex);
+    ensureThreads(numThreads);
+
+#if THREAD_POOL_USE_NUMA
+    // In NUMA mode the caller is pinned to thread 0's node for the
+    // duration of the job and then restored, so that the Python
+    // thread is not left pinned between calls.
+    cpu_set_t callerAffinity;
+    bool restoreCaller = !numaNodeCpus.empty() &&
+        sched_getaffinity(0, sizeof(cpu_set_t), &callerAffinity) == 0 &&
+        pinToNode(threadNode(0));
+    struct CallerRestore {
+        bool active;
+        cpu_set_t *affinity;
+        ~CallerRestore(){
+            if (active)
+                sched_setaffinity(0, sizeof(cpu_set_t), affinity);
+        }
+    } callerRestore{restoreCaller, &callerAffinity};
+#endif
+
+#ifdef XGPR_PROFILING
+    // When profiling, each thread's time in the job is recorded so that
+    // the load imbalance can be reported once all have finished.
+    std::vector<uint64_t> threadJobNs;
+    std::function<void(int)> timedJob;
+    const std::function<void(int)> *jobToRun = &job;
+    if (PROFILE_ENABLED()){
+        threadJobNs.assign(numThreads, 0);
+        timedJob = [&job, &threadJobNs](int threadIndex){
+            auto jobStart = std::chrono::steady_clock::now();
+            job(threadIndex);
+            threadJobNs[threadIndex] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - jobStart).count();
+        };
+        jobToRun = &timedJob;
+    }
+    struct JobRecorder {
+        std::vector<uint64_t> &threadJobNs;
+        ~JobRecorder(){
+            NativeProfiler::getInstance().addJob(threadJobNs);
+        }
+    } jobRecorder{threadJobNs};
+    const std::function<void(int)> &poolJob = *jobToRun;
+#else
+    const std::function<void(int)> &poolJob = job;
+#endif
+
+    if (numThreads == 1){
+        poolJob(0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> stateLock(stateMutex);
+        currentJob = &poolJob;
+        activeThreads = numThreads;
+        pendingThreads = numThreads - 1;
+        workerException = nullptr;
+        jobGeneration++;
+    }
+    wakeCondition.notify_all();
+
+    std::exception_ptr callerException = nullptr;
+    try {
+        poolJob(0);
+    }
+    catch (...) {
+        callerException = std::current_exception();
+    }
+
+    std::exception_ptr poolException;
+    {
+        std::unique_lock<std::mutex> stateLock(stateMutex);
+        doneCondition.wait(stateLock, [this]{ return pendingThreads == 0; });
+        currentJob = nullptr;
+        poolException = workerException;
+        workerException = nullptr;
+    }
+
+    if (callerException)
+        std::rethrow_exception(callerException);
+    if (poolException)
+        std::rethrow_exception(poolException);
+}
+
+
+
+/*!
+ * # parallelForRows
+ *
+ * Splits numRows rows into equal contiguous chunks, one per thread,
+ * and runs rowJob(startRow, endRow, threadIndex) on each. This is the
+ * same static partitioning previously used by each routine.
+ *
+ * ## Args:
+ *
+ * + `numRows` The number of rows in the array to be processed.
+ * + `numThreads` The number of threads to use. This is capped at numRows.
+ * + `rowJob` The function to run on each chunk of rows.
+ */
+void RFGenThreadPool::parallelForRows(int numRows, int numThreads,
+        const std::function<void(int, int, int)> &rowJob){
+    if (numThreads > numRows)
+        numThreads = numRows;
+    if (numThreads < 1)
+        numThreads = 1;
+
+    int chunkSize = (numRows + numThreads - 1) / numThreads;
+
+    run(numThreads, [&](int threadIndex){
+        int startRow = threadIndex * chunkSize;
+        int endRow = (threadIndex + 1) * chunkSize;
+        if (endRow > numRows)
+            endRow = numRows;
+        if (startRow < endRow){
+            PROFILE_COUNT(PROFILE_ROWS, endRow - startRow);
+            rowJob(startRow, endRow, threadIndex);
+        }
+    });
+}
+
+
+
+/*!
+ * # parallelForWeightedRows
+ *
+ * Splits the work for numRows rows, where row i consists of
+ * rowWeights[i] units of work (e.g. kmers), into contiguous ranges
+ * with (nearly) equal numbers of units, one per thread, using prefix
+ * sums of the weights. A range may begin or end partway through a
+ * row, so a long row can be split across threads. For each row that
+ * overlaps a thread's range, that thread calls
+ * segmentJob(row, unitStart, unitEnd, sharedRow, threadIndex), where
+ * unitStart and unitEnd are relative to the start of the row and
+ * sharedRow is true if the segment does not cover the whole row (so
+ * that other threads will also process part of it). A thread calls
+ * segmentJob with sharedRow true at most twice (for the first and last
+ * rows in its range). Rows with zero weight are skipped.
+ *
+ * ## Args:
+ *
+ * + `rowWeights` The (numRows) array of work units per row.
+ * + `numRows` The number of rows.
+ * + `numThreads` The number of threads to use. This is capped at the
+ * total number of units.
+ * + `segmentJob` The function to run on each row segment.
+ */
+void RFGenThreadPool::parallelForWeightedRows(const int32_t *rowWeights,
+        int numRows, int numThreads,
+        const std::function<void(int, int, int, bool, int)> &segmentJob){
+    std::vector<int64_t> prefixSums(numRows + 1, 0);
+    for (int i=0; i < numRows; i++)
+        prefixSums[i + 1] = prefixSums[i] + (rowWeights[i] > 0 ? rowWeights[i] : 0);
+
+    int64_t totalUnits = prefixSums[numRows];
+    if (totalUnits == 0)
+        return;
+    if (numThreads > totalUnits)
+        numThreads = totalUnits;
+    if (numThreads < 1)
+        numThreads = 1;
+
+    run(numThreads, [&](int threadIndex){
+        int64_t unitStart = totalUnits * threadIndex / numThreads;
+        int64_t unitEnd = totalUnits * (threadIndex + 1) / numThreads;
+        if (unitStart >= unitEnd)
+            return;
+        PROFILE_COUNT(PROFILE_KMERS, unitEnd - unitStart);
+
+        int row = std::upper_bound(prefixSums.begin(), prefixSums.end(),
+                unitStart) - prefixSums.begin() - 1;
+
+        for (; row < numRows && prefixSums[row] < unitEnd; row++) {
+            int64_t segmentStart = std::max(unitStart, prefixSums[row]) - prefixSums[row];
+            int64_t segmentEnd = std::min(unitEnd, prefixSums[row + 1]) - prefixSums[row];
+            if (segmentEnd <= segmentStart)
+                continue;
+            bool sharedRow = (segmentEnd - segmentStart) < (prefixSums[row + 1] -
+                    prefixSums[row]);
+            segmentJob(row, segmentStart, segmentEnd, sharedRow, threadIndex);
+        }
+    });
+}
+
+
+
+/*!
+ * # getScratchBytes
+ *
+ * Returns a scratch buffer of at least numBytes bytes, aligned to
+ * SCRATCH_BUFFER_ALIGNMENT, that belongs to the thread with index
+ * threadIndex. The buffer is kept between calls and only reallocated
+ * if a larger size is requested; its contents are unspecified. Should
+ * only be called from inside a job, by the thread that owns threadIndex.
+ *
+ * ## Args:
+ *
+ * + `threadIndex` The index of the calling thread within the job.
+ * + `numBytes` The minimum required size.
+ * + `slot` Which of the thread's scratch buffers to use, so that
+ * routines which need several buffers at once can request them.
+ */
+void *RFGenThreadPool::getScratchBytes(int threadIndex, size_t numBytes, int slot){
+    std::vector<ScratchBuffer> &threadScratch = scratch.at(threadIndex);
+    if (static_cast<int>(threadScratch.size()) <= slot)
+        threadScratch.resize(slot + 1);
+
+    ScratchBuffer &buffer = threadScratch[slot];
+    if (buffer.numBytes < numBytes || buffer.data == nullptr){
+        if (buffer.data != nullptr)
+            ::operator delete(buffer.data, std::align_val_t(SCRATCH_BUFFER_ALIGNMENT));
+        buffer.data = nullptr;
+        buffer.numBytes = 0;
+        // Any std::bad_alloc thrown here is passed back to the caller of run.
+        buffer.data = ::operator new(numBytes > 0 ? numBytes : 1,
+                std::align_val_t(SCRATCH_BUFFER_ALIGNMENT));
+        buffer.numBytes = numBytes;
+    }
+    return buffer.data;
+}
+
+
+
+/*!
+ * # resize
+ *
+ * Sets the number of threads the pool keeps alive (including the
+ * calling thread), creating or joining workers as needed. A later
+ * call that requests more threads will still grow the pool.
+ */
+void RFGenThreadPool::resize(int numThreads){
+    if (numThreads < 1)
+        numThreads = 1;
+
+    std::lock_guard<std::mutex> submitLock(submitMutex);
+    if (numThreads - 1 < static_cast<int>(workers.size())){
+        stopWorkers();
+        while (static_cast<int>(scratch.size()) > numThreads){
+            for (auto &buffer : scratch.back()){
+                if (buffer.data != nullptr)
+                    ::operator delete(buffer.data, std::align_val_t(SCRATCH_BUFFER_ALIGNMENT));
+            }
+            scratch.pop_back();
+        }
+    }
+    ensureThreads(numThreads);
+}
+
+
+
+/*!
+ * # shutdown
+ *
+ * Joins all workers and frees all scratch buffers. The pool can
+ * still be used afterwards; workers are recreated on demand.
+ */
+void RFGenThreadPool::shutdown(){
+    std::lock_guard<std::mutex> submitLock(submitMutex);
+    stopWorkers();
+    releaseScratch();
+}
+
+
+/*!
+ * # size
+ *
+ * Returns the number of threads currently available, including the caller.
+ */
+int RFGenThreadPool::size(){
+    std::lock_guard<std::mutex> submitLock(submitMutex);
+    return static_cast<int>(workers.size()) + 1;
+}
+
+
+
+/*!
+ * # setNumaMode
+ *
+ * Turns NUMA mode on or off. When enabling it, reads the node layout
+ * from /sys/devices/system/node, keeping only the CPUs this process
+ * is allowed to run on, and resizes the pool to numThreads. If fewer
+ * than two nodes are found, or on platforms other than Linux, NUMA
+ * mode stays off, since pinning would then only restrict the OS
+ * scheduler for no benefit. Existing workers are joined so that they
+ * are recreated with the new placement on the next call.
+ *
+ * ## Args:
+ *
+ * + `enabled` Whether NUMA mode should be on.
+ * + `numThreads` The number of threads jobs will normally be run with,
+ * which determines which node each thread index is pinned to.
+ *
+ * ## Returns:
+ * The number of NUMA nodes now in use (0 if NUMA mode is off).
+ */
+int RFGenThreadPool::setNumaMode(bool enabled, int numThreads){
+    if (numThreads < 1)
+        numThreads = 1;
+
+    std::lock_guard<std::mutex> submitLock(submitMutex);
+    stopWorkers();
+    numaNodeCpus.clear();
+    numaThreads = numThreads;
+
+#if THREAD_POOL_USE_NUMA
+    cpu_set_t allowedCpus;
+    if (enabled && sched_getaffinity(0, sizeof(cpu_set_t), &allowedCpus) == 0){
+        for (int node=0; ; node++){
+            std::ifstream cpuListFile("/sys/devices/system/node/node" +
+                    std::to_string(node) + "/cpulist");
+            if (!cpuListFile)
+                break;
+
+            // The cpulist has the form "0-15,32-47".
+            std::vector<int> nodeCpus;
+            std::string range;
+            while (std::getline(cpuListFile, range, ',')){
+                std::istringstream rangeStream(range);
+                int first, last;
+                char dash;
+                if (!(rangeStream >> first))
+                    continue;
+                last = (rangeStream >> dash >> last) ? last : first;
+                for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++){
+                    if (CPU_ISSET(cpu, &allowedCpus))
+                        nodeCpus.push_back(cpu);
+                }
+            }
+            if (!nodeCpus.empty())
+                numaNodeCpus.push_back(nodeCpus);
+        }
+    }
+#endif
+    if (numaNodeCpus.size() < 2)
+        numaNodeCpus.clear();
+
+    ensureThreads(numThreads);
+    return static_cast<int>(numaNodeCpus.size());
+}
+
+
+/*!
+ * # numaNodes
+ *
+ * Returns the number of NUMA nodes in use, or 0 if NUMA mode is off.
+ */
+int RFGenThreadPool::numaNodes(){
+    std::lock_guard<std::mutex> submitLock(submitMutex);
+    return static_cast<int>(numaNodeCpus.size());
+}
+
+
+//Returns the node thread threadIndex is pinned to in NUMA mode. Thread
+//indices beyond the NUMA thread count wrap around.
+int RFGenThreadPool::threadNode(int threadIndex){
+    int numNodes = static_cast<int>(numaNodeCpus.size());
+    return static_cast<int>( static_cast<int64_t>(threadIndex % numaThreads) *
+            numNodes / numaThreads );
+}
+
+
+//Restricts the calling thread to the CPUs on node. Returns false if NUMA
+//mode is off or the affinity could not be set.
+bool RFGenThreadPool::pinToNode(int node){
+#if THREAD_POOL_USE_NUMA
+    if (node < 0 || node >= static_cast<int>(numaNodeCpus.size()))
+        return false;
+    cpu_set_t nodeCpus;
+    CPU_ZERO(&nodeCpus);
+    for (int cpu : numaNodeCpus[node])
+        CPU_SET(cpu, &nodeCpus);
+    return sched_setaffinity(0, sizeof(cpu_set_t), &nodeCpus) == 0;
+#else
+    (void)node;
+    return false;
+#endif
+}
+
+
+
+//Creates workers until numThreads threads (including the caller) are
+//available. Caller must hold submitMutex.
+void RFGenThreadPool::ensureThreads(int numThreads){
+    if (static_cast<int>(scratch.size()) < numThreads)
+        scratch.resize(numThreads);
+
+    while (static_cast<int>(workers.size()) + 1 < numThreads){
+        int threadIndex = static_cast<int>(workers.size()) + 1;
+        workers.emplace_back(&RFGenThreadPool::workerLoop, this,
+                threadIndex, jobGeneration);
+    }
+}
+
+
+//Joins all workers. Caller must hold submitMutex.
+void RFGenThreadPool::stopWorkers(){
+    {
+        std::lock_guard<std::mutex> stateLock(stateMutex);
+        stopping = true;
+    }
+    wakeCondition.notify_all();
+
+    for (auto &worker : workers)
+        worker.join();
+    workers.clear();
+
+    std::lock_guard<std::mutex> stateLock(stateMutex);
+    stopping = false;
+}
+
+
+//Frees all scratch buffers. Caller must hold submitMutex and
+//there must be no running workers.
+void RFGenThreadPool::releaseScratch(){
+    for (auto &threadScratch : scratch){
+        for (auto &buffer : threadScratch){
+            if (buffer.data != nullptr)
+                ::operator delete(buffer.data, std::align_val_t(SCRATCH_BUFFER_ALIGNMENT));
+        }
+    }
+    scratch.clear();
+}
+
+
+
+//The loop each worker runs until the pool is stopped. Workers sleep on
+//wakeCondition until a new job is posted.
+void RFGenThreadPool::workerLoop(int threadIndex, size_t startGeneration){
+    size_t seenGeneration = startGeneration;
+    PROFILE_SET_THREAD(threadIndex);
+    if (!numaNodeCpus.empty())
+        pinToNode(threadNode(threadIndex));
+
+    while (true){
+        const std::function<void(int)> *job;
+        {
+            std::unique_lock<std::mutex> stateLock(stateMutex);
+            wakeCondition.wait(stateLock, [&]{
+                    return stopping || jobGeneration != seenGeneration; });
+            if (stopping)
+                return;
+            seenGeneration = jobGeneration;
+            if (threadIndex >= activeThreads)
+                continue;
+            job = currentJob;
+        }
+
+        std::exception_ptr jobException = nullptr;
+        try {
+            (*job)(threadIndex);
+        }
+        catch (...) {
+            jobException = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> stateLock(stateMutex);
+        if (jobException && !workerException)
+            workerException = jobException;
+        pendingThreads--;
+        if (pendingThreads == 0)
+            doneCondition.notify_one();
+    }
+}
+
+
+
+
+
+/*!
+ * # setThreadPoolSize_
+ *
+ * Wrapper-facing function that sets the number of threads kept
+ * alive by the pool (workers plus the calling thread).
+ */
+int setThreadPoolSize_(int numThreads){
+    RFGenThreadPool::getInstance().resize(numThreads);
+    return 0;
+}
+
+
+/*!
+ * # getThreadPoolSize_
+ *
+ * Wrapper-facing function that returns the number of threads
+ * currently available in the pool, including the calling thread.
+ */
+int getThreadPoolSize_(){
+    return RFGenThreadPool::getInstance().size();
+}
+
+
+/*!
+ * # shutdownThreadPool_
+ *
+ * Wrapper-facing function that joins all pool workers and frees
+ * their scratch buffers.
+ */
+int shutdownThreadPool_(){
+    RFGenThreadPool::getInstance().shutdown();
+    return 0;
+}
+
+
+/*!
+ * # setNumaMode_
+ *
+ * Wrapper-facing function that turns NUMA thread placement on or off
+ * and returns the number of nodes in use (0 if it is off).
+ */
+int setNumaMode_(bool enabled, int numThreads){
+    return RFGenThreadPool::getInstance().setNumaMode(enabled, numThreads);
+}
+
+
+/*!
+ * # getNumaNodes_
+ *
+ * Wrapper-facing function that returns the number of NUMA nodes in
+ * use, or 0 if NUMA mode is off.
+ */
+int getNumaNodes_(){
+    return RFGenThreadPool::getInstance().numaNodes();
+}
@@ -0,0 +1,113 @@
+#ifndef RFGEN_THREAD_POOL_H
+#define RFGEN_THREAD_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+#define SCRATCH_BUFFER_ALIGNMENT 64
+#define FIRST_TOUCH_ALIGNMENT 4096
+
+
+/*!
+ * # RFGenThreadPool
+ *
+ * A process-wide pool of worker threads shared by all of the CPU
+ * random feature generation and transform routines. Workers are
+ * created lazily the first time they are needed and stay alive
+ * between calls, so that repeated calls on small chunks do not
+ * pay the cost of thread creation. Each worker also owns a set of
+ * scratch buffers that persist between calls.
+ *
+ * The calling thread always participates as thread index 0, so a
+ * job run with numThreads threads uses numThreads - 1 pool workers.
+ * Only one job runs at a time; concurrent callers are serialized.
+ *
+ * In NUMA mode (off by default, Linux only), thread index t of a job
+ * run with the NUMA thread count is pinned to the CPUs of node
+ * t * numNodes / numThreads, so that with the contiguous split used
+ * by parallelForRows each node's threads always handle the same rows.
+ * Output arrays allocated with allocateFirstTouch_ are zeroed using that
+ * same split, so the pages each thread writes are local to its node.
+ */
+class RFGenThreadPool {
+    public:
+        static RFGenThreadPool &getInstance();
+
+        void run(int numThreads, const std::function<void(int)> &job);
+        void parallelForRows(int numRows, int numThreads,
+                const std::function<void(int, int, int)> &rowJob);
+        void parallelForWeightedRows(const int32_t *rowWeights, int numRows,
+                int numThreads,
+                const std::function<void(int, int, int, bool, int)> &segmentJob);
+
+        void *getScratchBytes(int threadIndex, size_t numBytes, int slot = 0);
+        template <typename T>
+        T *getScratchBuffer(int threadIndex, size_t numElements, int slot = 0){
+            return static_cast<T*>(getScratchBytes(threadIndex,
+                        numElements * sizeof(T), slot));
+        }
+
+        void resize(int numThreads);
+        void shutdown();
+        int size();
+
+        int setNumaMode(bool enabled, int numThreads);
+        int numaNodes();
+
+        RFGenThreadPool(const RFGenThreadPool&) = delete;
+        RFGenThreadPool &operator=(const RFGenThreadPool&) = delete;
+
+    private:
+        struct ScratchBuffer {
+            void *data = nullptr;
+            size_t numBytes = 0;
+        };
+
+        RFGenThreadPool() {}
+        ~RFGenThreadPool();
+
+        void ensureThreads(int numThreads);
+        void stopWorkers();
+        void releaseScratch();
+        void workerLoop(int threadIndex, size_t startGeneration);
+        int threadNode(int threadIndex);
+        bool pinToNode(int node);
+
+        std::vector<std::thread> workers;
+        std::vector<std::vector<ScratchBuffer>> scratch;
+
+        // submitMutex serializes callers of run(); stateMutex protects the
+        // job description shared with the workers.
+        std::mutex submitMutex;
+        std::mutex stateMutex;
+        std::condition_variable wakeCondition;
+        std::condition_variable doneCondition;
+
+        const std::function<void(int)> *currentJob = nullptr;
+        size_t jobGeneration = 0;
+        int activeThreads = 0;
+        int pendingThreads = 0;
+        bool stopping = false;
+        std::exception_ptr workerException;
+
+        // The CPUs on each NUMA node that this process may run on, filled
+        // in when NUMA mode is enabled. Only changed while holding
+        // submitMutex with no workers running.
+        std::vector<std::vector<int>> numaNodeCpus;
+        int numaThreads = 1;
+};
+
+
+int setThreadPoolSize_(int numThreads);
+int getThreadPoolSize_();
+int shutdownThreadPool_();
+int setNumaMode_(bool enabled, int numThreads);
+int getNumaNodes_();
+
+#endif
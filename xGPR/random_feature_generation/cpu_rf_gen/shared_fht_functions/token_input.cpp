@@ -0,0 +1,99 @@
+/*!
+ * # token_input.cpp
+ *
+ * Helpers for convolution kernel input supplied as an (N x D) array of
+ * token IDs together with a (V x C) embedding table, rather than as a
+ * dense (N x D x C) array. A table with no rows stands for one-hot
+ * input. Only the windows that are needed are expanded, so the dense
+ * array is never built.
+ */
+#include "token_input.h"
+
+
+
+
+/*!
+ * # tokensInRange
+ *
+ * Checks that every token within the first seqlengths[i] elements of
+ * each row i is a valid row of the embedding table. Tokens in the zero
+ * padding past the end of each sequence are never read and so are not
+ * checked.
+ *
+ * ## Args:
+ *
+ * + `tokens` The (N x D) array of token IDs.
+ * + `seqlengths` The (N) array of sequence lengths.
+ * + `numRows` N.
+ * + `rowLength` D.
+ * + `vocabSize` The number of rows in the embedding table.
+ *
+ * ## Returns:
+ * true if all tokens are in [0, vocabSize), false otherwise.
+ */
+template <typename K>
+bool tokensInRange(const K *tokens, const int32_t *seqlengths, int numRows,
+        int rowLength, int vocabSize) {
+    for (int i=0; i < numRows; i++) {
+        const K *tokenRow = tokens + static_cast<size_t>(i) * rowLength;
+        for (int j=0; j < seqlengths[i]; j++) {
+            int token = tokenRow[j];
+            if (token < 0 || token >= vocabSize)
+                return false;
+        }
+    }
+    return true;
+}
+template bool tokensInRange<uint8_t>(const uint8_t *tokens, const int32_t *seqlengths,
+        int numRows, int rowLength, int vocabSize);
+template bool tokensInRange<int16_t>(const int16_t *tokens, const int32_t *seqlengths,
+        int numRows, int rowLength, int vocabSize);
+
+
+
+
+/*!
+ * # expandTokenWindows
+ *
+ * Looks up the embedding for numPositions consecutive tokens and
+ * writes them to windows, so that element c of position p is at
+ * p * embedDim + c -- the same layout as the corresponding stretch of
+ * a dense input array. The caller must have checked the tokens using
+ * tokensInRange.
+ *
+ * ## Args:
+ *
+ * + `tokens` Pointer to the first token to expand.
+ * + `embedding` The (V x C) embedding table, or NULL for one-hot input,
+ * in which case token t is expanded to row t of the (C x C) identity.
+ * + `windows` The (numPositions x C) array in which the result is stored.
+ * + `numPositions` The number of tokens to expand.
+ * + `embedDim` C.
+ */
+template <typename K, typename T>
+void expandTokenWindows(const K *tokens, const T *embedding, T *windows,
+        int numPositions, int embedDim) {
+    if (embedding == NULL) {
+        for (int i=0; i < numPositions; i++) {
+            T *windowPosition = windows + static_cast<size_t>(i) * embedDim;
+            for (int j=0; j < embedDim; j++)
+                windowPosition[j] = 0;
+            windowPosition[tokens[i]] = 1;
+        }
+        return;
+    }
+    for (int i=0; i < numPositions; i++) {
+        const T *tokenEmbedding = embedding + static_cast<size_t>(tokens[i]) * embedDim;
+        T *windowPosition = windows + static_cast<size_t>(i) * embedDim;
+        for (int j=0; j < embedDim; j++)
+            windowPosition[j] = tokenEmbedding[j];
+    }
+}
+template void expandTokenWindows<uint8_t, double>(const uint8_t *tokens,
+        const double *embedding, double *windows, int numPositions, int embedDim);
+template void expandTokenWindows<uint8_t, float>(const uint8_t *tokens,
+        const float *embedding, float *windows, int numPositions, int embedDim);
+template void expandTokenWindows<int16_t, double>(const int16_t *tokens,
+        const double *embedding, double *windows, int numPositions, int embedDim);
+template void expandTokenWindows<int16_t, float>(const int16_t *tokens,
+        const float *embedding, float *windows, int numPositions, int embedDim);
@@ -0,0 +1,22 @@
+#ifndef TOKEN_INPUT_OPERATIONS_H
+#define TOKEN_INPUT_OPERATIONS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// The thread pool scratch slot used for the expanded windows of a
+// token-ID input. Slots 0 - 2 are used by the convolution routines
+// for the SORF buffer and the double precision feature / gradient rows.
+#define TOKEN_WINDOW_SCRATCH_SLOT 3
+
+
+template <typename K>
+bool tokensInRange(const K *tokens, const int32_t *seqlengths, int numRows,
+        int rowLength, int vocabSize);
+
+template <typename K, typename T>
+void expandTokenWindows(const K *tokens, const T *embedding, T *windows,
+        int numPositions, int embedDim);
+
+#endif
@@ -3,11 +3,20 @@
 
 #include <nanobind/nanobind.h>
 #include <nanobind/ndarray.h>
+#include <nanobind/stl/string.h>
+#include <nanobind/stl/vector.h>
 #include "basic_ops/transform_functions.h"
 #include "rbf_ops/rbf_ops.h"
 #include "rbf_ops/ard_ops.h"
 #include "convolution_ops/conv1d_operations.h"
 #include "convolution_ops/rbf_convolution.h"
+#include "shared_fht_functions/thread_pool.h"
+#include "shared_fht_functions/simd_hadamard.h"
+#include "shared_fht_functions/kmer_cache.h"
+#include "data_ops/npy_chunk_reader.h"
+#include "data_ops/output_buffers.h"
+#include "../async_native_ops.h"
+#include "../native_profiler.h"
 
 
 
@@ -15,77 +24,516 @@ namespace nb = nanobind;
 using namespace std;
 
 NB_MODULE(xgpr_cpu_rfgen_cpp_ext, m){
-    m.def("cpuFastHadamardTransform", &fastHadamard3dArray_<float>,
+    defAsyncOpHandle<NoOpLock>(m, "cpuAsyncOpHandle");
+
+    DEF_NATIVE_OP(m, NoOpLock, "cpuFastHadamardTransform", &fastHadamard3dArray_<float>,
             nb::arg("inputArr").noconvert(), nb::arg("numThreads"));
-    m.def("cpuFastHadamardTransform", &fastHadamard3dArray_<double>,
+    DEF_NATIVE_OP(m, NoOpLock, "cpuFastHadamardTransform", &fastHadamard3dArray_<double>,
             nb::arg("inputArr").noconvert(), nb::arg("numThreads"));
 
-    m.def("cpuFastHadamardTransform2D", &fastHadamard2dArray_<float>,
+    DEF_NATIVE_OP(m, NoOpLock, "cpuFastHadamardTransform2D", &fastHadamard2dArray_<float>,
             nb::arg("inputArr").noconvert(), nb::arg("numThreads"));
-    m.def("cpuFastHadamardTransform2D", &fastHadamard2dArray_<double>,
+    DEF_NATIVE_OP(m, NoOpLock, "cpuFastHadamardTransform2D", &fastHadamard2dArray_<double>,
             nb::arg("inputArr").noconvert(), nb::arg("numThreads"));
 
-    m.def("cpuSRHT", &SRHTBlockTransform<float>, nb::arg("inputArr").noconvert(),
+    DEF_NATIVE_OP(m, NoOpLock, "cpuSRHT", &SRHTBlockTransform<float>, nb::arg("inputArr").noconvert(),
             nb::arg("radem").noconvert(), nb::arg("numThreads"));
-    m.def("cpuSRHT", &SRHTBlockTransform<double>, nb::arg("inputArr").noconvert(),
+    DEF_NATIVE_OP(m, NoOpLock, "cpuSRHT", &SRHTBlockTransform<double>, nb::arg("inputArr").noconvert(),
             nb::arg("radem").noconvert(), nb::arg("numThreads"));
+    DEF_NATIVE_OP(m, NoOpLock, "cpuSubsampledSRHT", &subsampledSRHT_<float>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("colIdx").noconvert(), nb::arg("numThreads"));
+    DEF_NATIVE_OP(m, NoOpLock, "cpuSubsampledSRHT", &subsampledSRHT_<double>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("colIdx").noconvert(), nb::arg("numThreads"));
 
-    m.def("cpuRBFFeatureGen", &rbfFeatureGen_<float>, nb::arg("inputArr").noconvert(),
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFFeatureGen", &rbfFeatureGen_<float, double>, nb::arg("inputArr").noconvert(),
             nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
             nb::arg("chiArr").noconvert(), nb::arg("numThreads"),
-            nb::arg("fitIntercept"));
-    m.def("cpuRBFFeatureGen", &rbfFeatureGen_<double>, nb::arg("inputArr").noconvert(),
+            nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFFeatureGen", &rbfFeatureGen_<float, float>, nb::arg("inputArr").noconvert(),
             nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
             nb::arg("chiArr").noconvert(), nb::arg("numThreads"),
-            nb::arg("fitIntercept"));
+            nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFFeatureGen", &rbfFeatureGen_<double, double>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("numThreads"),
+            nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFFeatureGen", &rbfFeatureGen_<float, double, uint8_t>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("numThreads"),
+            nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFFeatureGen", &rbfFeatureGen_<float, float, uint8_t>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("numThreads"),
+            nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFFeatureGen", &rbfFeatureGen_<double, double, uint8_t>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("numThreads"),
+            nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
 
-    m.def("cpuRBFGrad", &rbfGrad_<float>, nb::arg("inputArr").noconvert(),
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFGrad", &rbfGrad_<float, double>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("sigma"), nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFGrad", &rbfGrad_<float, float>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("sigma"), nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFGrad", &rbfGrad_<double, double>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("sigma"), nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFGrad", &rbfGrad_<float, double, uint8_t>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("sigma"), nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFGrad", &rbfGrad_<float, float, uint8_t>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("sigma"), nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFGrad", &rbfGrad_<double, double, uint8_t>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("sigma"), nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFProjection", &rbfProjection_<float, float>, nb::arg("inputArr").noconvert(),
+            nb::arg("projArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("numThreads"));
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFProjection", &rbfProjection_<double, float>, nb::arg("inputArr").noconvert(),
+            nb::arg("projArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("numThreads"));
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFProjection", &rbfProjection_<double, double>, nb::arg("inputArr").noconvert(),
+            nb::arg("projArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("numThreads"));
+
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFProjectionFGen", &rbfProjectionFGen_<float, double>, nb::arg("projArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFProjectionFGen", &rbfProjectionFGen_<float, float>, nb::arg("projArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFProjectionFGen", &rbfProjectionFGen_<double, double>, nb::arg("projArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFProjectionGrad", &rbfProjectionGrad_<float, double>, nb::arg("projArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("gradArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFProjectionGrad", &rbfProjectionGrad_<float, float>, nb::arg("projArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("gradArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFProjectionGrad", &rbfProjectionGrad_<double, double>, nb::arg("projArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("gradArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFMultiSigmaGrad", &rbfMultiSigmaGrad_<float, double>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("sigmaArr").noconvert(), nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFMultiSigmaGrad", &rbfMultiSigmaGrad_<float, float>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("sigmaArr").noconvert(), nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFMultiSigmaGrad", &rbfMultiSigmaGrad_<double, double>, nb::arg("inputArr").noconvert(),
             nb::arg("outputArr").noconvert(), nb::arg("gradArr").noconvert(),
             nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
-            nb::arg("sigma"), nb::arg("numThreads"), nb::arg("fitIntercept"));
-    m.def("cpuRBFGrad", &rbfGrad_<double>, nb::arg("inputArr").noconvert(),
+            nb::arg("sigmaArr").noconvert(), nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFMultiSigmaGrad", &rbfMultiSigmaGrad_<float, double, uint8_t>, nb::arg("inputArr").noconvert(),
             nb::arg("outputArr").noconvert(), nb::arg("gradArr").noconvert(),
             nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
-            nb::arg("sigma"), nb::arg("numThreads"), nb::arg("fitIntercept"));
-    m.def("cpuMiniARDGrad", &ardGrad_<float>, nb::arg("inputArr").noconvert(),
+            nb::arg("sigmaArr").noconvert(), nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFMultiSigmaGrad", &rbfMultiSigmaGrad_<float, float, uint8_t>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("sigmaArr").noconvert(), nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFMultiSigmaGrad", &rbfMultiSigmaGrad_<double, double, uint8_t>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("sigmaArr").noconvert(), nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+
+    DEF_NATIVE_OP(m, NoOpLock, "cpuMiniARDGrad", &ardGrad_<float>, nb::arg("inputArr").noconvert(),
             nb::arg("outputArr").noconvert(), nb::arg("precompWeights").noconvert(),
             nb::arg("sigmaMap").noconvert(), nb::arg("sigmaVals").noconvert(),
             nb::arg("gradArr").noconvert(), nb::arg("numThreads"),
             nb::arg("fitIntercept")); 
-    m.def("cpuMiniARDGrad", &ardGrad_<double>, nb::arg("inputArr").noconvert(),
+    DEF_NATIVE_OP(m, NoOpLock, "cpuMiniARDGrad", &ardGrad_<double>, nb::arg("inputArr").noconvert(),
             nb::arg("outputArr").noconvert(), nb::arg("precompWeights").noconvert(),
             nb::arg("sigmaMap").noconvert(), nb::arg("sigmaVals").noconvert(),
             nb::arg("gradArr").noconvert(), nb::arg("numThreads"),
             nb::arg("fitIntercept")); 
+    DEF_NATIVE_OP(m, NoOpLock, "cpuMiniARDMultiGrad", &ardMultiGrad_<float>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("precompWeights").noconvert(),
+            nb::arg("sigmaMap").noconvert(), nb::arg("lengthscaleArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("numThreads"),
+            nb::arg("fitIntercept"));
+    DEF_NATIVE_OP(m, NoOpLock, "cpuMiniARDMultiGrad", &ardMultiGrad_<double>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("precompWeights").noconvert(),
+            nb::arg("sigmaMap").noconvert(), nb::arg("lengthscaleArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("numThreads"),
+            nb::arg("fitIntercept"));
 
-    m.def("cpuConv1dMaxpool", &conv1dMaxpoolFeatureGen_<float>, nb::arg("inputArr").noconvert(),
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dMaxpool", &conv1dMaxpoolFeatureGen_<float>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("numThreads"),
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dMaxpool", &conv1dMaxpoolFeatureGen_<double>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("numThreads"),
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dMaxpool", &conv1dTokenMaxpoolFeatureGen_<uint8_t, float>, nb::arg("tokenArr").noconvert(),
+            nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("numThreads"),
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dMaxpool", &conv1dTokenMaxpoolFeatureGen_<uint8_t, double>, nb::arg("tokenArr").noconvert(),
+            nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("numThreads"),
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dMaxpool", &conv1dTokenMaxpoolFeatureGen_<int16_t, float>, nb::arg("tokenArr").noconvert(),
+            nb::arg("embeddingArr").noconvert(),
             nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
             nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
-            nb::arg("convWidth"), nb::arg("numThreads"));
-    m.def("cpuConv1dMaxpool", &conv1dMaxpoolFeatureGen_<double>, nb::arg("inputArr").noconvert(),
+            nb::arg("convWidth"), nb::arg("numThreads"),
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dMaxpool", &conv1dTokenMaxpoolFeatureGen_<int16_t, double>, nb::arg("tokenArr").noconvert(),
+            nb::arg("embeddingArr").noconvert(),
             nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
             nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
-            nb::arg("convWidth"), nb::arg("numThreads"));
+            nb::arg("convWidth"), nb::arg("numThreads"),
+            nb::arg("kmerCacheSize") = 0);
+
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dTwoLayerFGen", &conv1dTwoLayerFeatureGen_<float>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("initRadem").noconvert(),
+            nb::arg("initChiArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("sigma"), nb::arg("numThreads"),
+            nb::arg("kmerCacheSize"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dTwoLayerFGen", &conv1dTwoLayerFeatureGen_<double>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("initRadem").noconvert(),
+            nb::arg("initChiArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("sigma"), nb::arg("numThreads"),
+            nb::arg("kmerCacheSize"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dTwoLayerGrad", &conv1dTwoLayerGrad_<float>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("initRadem").noconvert(), nb::arg("initChiArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("sigma"), nb::arg("numThreads"),
+            nb::arg("kmerCacheSize"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dTwoLayerGrad", &conv1dTwoLayerGrad_<double>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("initRadem").noconvert(), nb::arg("initChiArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("sigma"), nb::arg("numThreads"),
+            nb::arg("kmerCacheSize"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
 
-    m.def("cpuConv1dFGen", &convRBFFeatureGen_<float>, nb::arg("inputArr").noconvert(),
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dFGen", &convRBFFeatureGen_<float, double>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("scalingType"),
+            nb::arg("numThreads"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dFGen", &convRBFFeatureGen_<float, float>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("scalingType"),
+            nb::arg("numThreads"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dFGen", &convRBFFeatureGen_<double, double>, nb::arg("inputArr").noconvert(),
             nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
             nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
             nb::arg("convWidth"), nb::arg("scalingType"),
-            nb::arg("numThreads"));
-    m.def("cpuConv1dFGen", &convRBFFeatureGen_<double>, nb::arg("inputArr").noconvert(),
+            nb::arg("numThreads"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dFGen", &convRBFTokenFeatureGen_<uint8_t, float, double>, nb::arg("tokenArr").noconvert(),
+            nb::arg("embeddingArr").noconvert(),
             nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
             nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
             nb::arg("convWidth"), nb::arg("scalingType"),
-            nb::arg("numThreads"));
+            nb::arg("numThreads"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dFGen", &convRBFTokenFeatureGen_<uint8_t, float, float>, nb::arg("tokenArr").noconvert(),
+            nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("scalingType"),
+            nb::arg("numThreads"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dFGen", &convRBFTokenFeatureGen_<uint8_t, double, double>, nb::arg("tokenArr").noconvert(),
+            nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("scalingType"),
+            nb::arg("numThreads"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dFGen", &convRBFTokenFeatureGen_<int16_t, float, double>, nb::arg("tokenArr").noconvert(),
+            nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("scalingType"),
+            nb::arg("numThreads"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dFGen", &convRBFTokenFeatureGen_<int16_t, float, float>, nb::arg("tokenArr").noconvert(),
+            nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("scalingType"),
+            nb::arg("numThreads"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dFGen", &convRBFTokenFeatureGen_<int16_t, double, double>, nb::arg("tokenArr").noconvert(),
+            nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("scalingType"),
+            nb::arg("numThreads"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
 
-    m.def("cpuConvGrad", &convRBFGrad_<float>, nb::arg("inputArr").noconvert(),
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConvGrad", &convRBFGrad_<float, double>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("sigma"),
+            nb::arg("convWidth"), nb::arg("scalingType"), nb::arg("numThreads"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConvGrad", &convRBFGrad_<float, float>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("sigma"),
+            nb::arg("convWidth"), nb::arg("scalingType"), nb::arg("numThreads"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConvGrad", &convRBFGrad_<double, double>, nb::arg("inputArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("sigma"),
+            nb::arg("convWidth"), nb::arg("scalingType"), nb::arg("numThreads"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConvGrad", &convRBFTokenGrad_<uint8_t, float, double>, nb::arg("tokenArr").noconvert(),
+            nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("sigma"),
+            nb::arg("convWidth"), nb::arg("scalingType"), nb::arg("numThreads"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConvGrad", &convRBFTokenGrad_<uint8_t, float, float>, nb::arg("tokenArr").noconvert(),
+            nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("sigma"),
+            nb::arg("convWidth"), nb::arg("scalingType"), nb::arg("numThreads"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConvGrad", &convRBFTokenGrad_<uint8_t, double, double>, nb::arg("tokenArr").noconvert(),
+            nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("sigma"),
+            nb::arg("convWidth"), nb::arg("scalingType"), nb::arg("numThreads"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConvGrad", &convRBFTokenGrad_<int16_t, float, double>, nb::arg("tokenArr").noconvert(),
+            nb::arg("embeddingArr").noconvert(),
             nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
             nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
             nb::arg("gradArr").noconvert(), nb::arg("sigma"),
-            nb::arg("convWidth"), nb::arg("scalingType"), nb::arg("numThreads"));
-    m.def("cpuConvGrad", &convRBFGrad_<double>, nb::arg("inputArr").noconvert(),
+            nb::arg("convWidth"), nb::arg("scalingType"), nb::arg("numThreads"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConvGrad", &convRBFTokenGrad_<int16_t, float, float>, nb::arg("tokenArr").noconvert(),
+            nb::arg("embeddingArr").noconvert(),
             nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
             nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
             nb::arg("gradArr").noconvert(), nb::arg("sigma"),
-            nb::arg("convWidth"), nb::arg("scalingType"), nb::arg("numThreads"));
+            nb::arg("convWidth"), nb::arg("scalingType"), nb::arg("numThreads"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConvGrad", &convRBFTokenGrad_<int16_t, double, double>, nb::arg("tokenArr").noconvert(),
+            nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("sigma"),
+            nb::arg("convWidth"), nb::arg("scalingType"), nb::arg("numThreads"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFDesignMatrix", &rbfDesignMatrix_<float>, nb::arg("inputArr").noconvert(),
+            nb::arg("yArr").noconvert(), nb::arg("zTzArr").noconvert(),
+            nb::arg("zTyArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("numThreads"),
+            nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFDesignMatrix", &rbfDesignMatrix_<double>, nb::arg("inputArr").noconvert(),
+            nb::arg("yArr").noconvert(), nb::arg("zTzArr").noconvert(),
+            nb::arg("zTyArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("numThreads"),
+            nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dDesignMatrix", &convRBFDesignMatrix_<float>, nb::arg("inputArr").noconvert(),
+            nb::arg("yArr").noconvert(), nb::arg("zTzArr").noconvert(),
+            nb::arg("zTyArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("scalingType"),
+            nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dDesignMatrix", &convRBFDesignMatrix_<double>, nb::arg("inputArr").noconvert(),
+            nb::arg("yArr").noconvert(), nb::arg("zTzArr").noconvert(),
+            nb::arg("zTyArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("scalingType"),
+            nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFMatvec", &rbfMatvec_<float>, nb::arg("inputArr").noconvert(),
+            nb::arg("vecArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFMatvec", &rbfMatvec_<double>, nb::arg("inputArr").noconvert(),
+            nb::arg("vecArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dMatvec", &convRBFMatvec_<float>, nb::arg("inputArr").noconvert(),
+            nb::arg("vecArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dMatvec", &convRBFMatvec_<double>, nb::arg("inputArr").noconvert(),
+            nb::arg("vecArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact",
+            nb::arg("kmerCacheSize") = 0);
+
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFPredictMean", &rbfPredictMean_<float>, nb::arg("inputArr").noconvert(),
+            nb::arg("weightArr").noconvert(), nb::arg("meanArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFPredictMean", &rbfPredictMean_<double>, nb::arg("inputArr").noconvert(),
+            nb::arg("weightArr").noconvert(), nb::arg("meanArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFPredictMeanVar", &rbfPredictMeanVar_<float>, nb::arg("inputArr").noconvert(),
+            nb::arg("weightArr").noconvert(), nb::arg("varArr").noconvert(),
+            nb::arg("meanArr").noconvert(), nb::arg("varOutArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuRBFPredictMeanVar", &rbfPredictMeanVar_<double>, nb::arg("inputArr").noconvert(),
+            nb::arg("weightArr").noconvert(), nb::arg("varArr").noconvert(),
+            nb::arg("meanArr").noconvert(), nb::arg("varOutArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dPredictMean", &convRBFPredictMean_<float>, nb::arg("inputArr").noconvert(),
+            nb::arg("weightArr").noconvert(), nb::arg("meanArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dPredictMean", &convRBFPredictMean_<double>, nb::arg("inputArr").noconvert(),
+            nb::arg("weightArr").noconvert(), nb::arg("meanArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dPredictMeanVar", &convRBFPredictMeanVar_<float>, nb::arg("inputArr").noconvert(),
+            nb::arg("weightArr").noconvert(), nb::arg("varArr").noconvert(),
+            nb::arg("meanArr").noconvert(), nb::arg("varOutArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+    DEF_NATIVE_OP(m, NoOpLock, "cpuConv1dPredictMeanVar", &convRBFPredictMeanVar_<double>, nb::arg("inputArr").noconvert(),
+            nb::arg("weightArr").noconvert(), nb::arg("varArr").noconvert(),
+            nb::arg("meanArr").noconvert(), nb::arg("varOutArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("numThreads"), nb::arg("fitIntercept"),
+            nb::arg("precisionMode") = "exact");
+
+    m.def("cpuSetThreadPoolSize", &setThreadPoolSize_, nb::arg("numThreads"));
+    m.def("cpuGetThreadPoolSize", &getThreadPoolSize_);
+    m.def("cpuShutdownThreadPool", &shutdownThreadPool_);
+    m.def("cpuSetNUMAMode", &setNumaMode_, nb::arg("enabled"), nb::arg("numThreads"));
+    m.def("cpuGetNUMANodes", &getNumaNodes_);
+    m.def("cpuAllocateFirstTouch", &allocateFirstTouch_, nb::arg("shape"),
+            nb::arg("numThreads"), nb::arg("doublePrecision") = true);
+
+    m.def("cpuGetKmerCacheHits", &getKmerCacheHits_);
+    m.def("cpuGetKmerCacheMisses", &getKmerCacheMisses_);
+    m.def("cpuResetKmerCacheStats", &resetKmerCacheStats_);
+
+    m.def("cpuSetProfiling", &setNativeProfiling_, nb::arg("enabled"));
+    m.def("cpuGetProfile", &getNativeProfile_);
+    m.def("cpuResetProfile", &resetNativeProfile_);
+
+    nb::class_<NpyChunkReader>(m, "cpuNpyChunkReader")
+        .def(nb::init<const std::vector<std::vector<std::string>> &, int>(),
+                nb::arg("chunkFiles"),
+                nb::arg("prefetchDepth") = DEFAULT_CHUNK_PREFETCH_DEPTH)
+        .def("__len__", &NpyChunkReader::numChunks)
+        .def("__iter__", [](NpyChunkReader &reader) -> NpyChunkReader& { return reader; },
+                nb::rv_policy::reference_internal)
+        .def("__next__", &npyChunkReaderNext_);
+
+    m.def("cpuGetFHTInstructionSet", &getFHTInstructionSet_);
+    m.def("cpuSetFHTInstructionSet", &setFHTInstructionSet_, nb::arg("instructionSet"));
 }
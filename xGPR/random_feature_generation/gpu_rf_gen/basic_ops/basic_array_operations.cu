@@ -10,8 +10,11 @@
 #include <stdlib.h>
 #include <math.h>
 #include "../shared_constants.h"
+#include "device_workspace.h"
+#include "kernel_timer.h"
 #include "basic_array_operations.h"
 #include "../sharedmem.h"
+#include "fht_device_functions.h"
 
 
 namespace nb = nanobind;
@@ -29,35 +32,13 @@ __global__ void hadamardTransform(T cArray[], int N, int log2N){
 
     SharedMemory<T> shared;
     T *s_data = shared.getPointer();
-    int spacing, pos = threadIdx.x;
-    int lo, id1, id2;
     T *src_ptr = cArray + (blockIdx.x << log2N);
-    T y;
 
     for (int rep = 0; rep < nRepeats; rep++){
         for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
             s_data[i] = src_ptr[i];
 
-        id1 = (pos << 1);
-        id2 = id1 + 1;
-        __syncthreads();
-        y = s_data[id2];
-        s_data[id2] = s_data[id1] - y;
-        s_data[id1] += y;
-
-
-        for (spacing = 2; spacing < stepSize; spacing <<= 1){
-            //Equivalent to pos mod spacing if spacing is a power of 2,
-            //which here is always true.
-            lo = pos & (spacing - 1);
-            id1 = ((pos - lo) << 1) + lo;
-            id2 = id1 + spacing;
-            __syncthreads();
-            y = s_data[id2];
-            s_data[id2] = s_data[id1] - y;
-            s_data[id1] += y;
-        }
-        __syncthreads();
+        blockFHT<T>(s_data, stepSize);
         for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
             src_ptr[i] = s_data[i];
         __syncthreads();
@@ -65,21 +46,8 @@ __global__ void hadamardTransform(T cArray[], int N, int log2N){
     }
 
     if (N > MAX_BASE_LEVEL_TRANSFORM){
-        src_ptr = cArray + (blockIdx.x << log2N);
-
-        for (int spacing = stepSize; spacing < N; spacing <<= 1){
-            __syncthreads();
-
-            for (int k = 0; k < N; k += (spacing << 1)){
-                for (int i = threadIdx.x; i < spacing; i += blockDim.x){
-                    id1 = i+k;
-                    id2 = id1 + spacing;
-                    y = src_ptr[id2];
-                    src_ptr[id2] = src_ptr[id1] - y;
-                    src_ptr[id1] += y;
-                }
-            }
-        }
+        stridedFHT<T>(cArray + (blockIdx.x << log2N), s_data, N,
+                stepSize);
     }
 }
 
@@ -95,10 +63,7 @@ __global__ void hadamardTransformRadMult(T cArray[], int N, int log2N,
 
     SharedMemory<T> shared;
     T *s_data = shared.getPointer();
-    int spacing, pos = threadIdx.x;
-    int lo, id1, id2;
     T *src_ptr = cArray + (blockIdx.x << log2N);
-    T y;
 
     const int8_t *rademPtr = radem;
 
@@ -112,26 +77,7 @@ __global__ void hadamardTransformRadMult(T cArray[], int N, int log2N,
 
         rademPtr += stepSize;
 
-        id1 = (pos << 1);
-        id2 = id1 + 1;
-        __syncthreads();
-        y = s_data[id2];
-        s_data[id2] = s_data[id1] - y;
-        s_data[id1] += y;
-
-
-        for (spacing = 2; spacing < stepSize; spacing <<= 1){
-            //Equivalent to pos mod spacing if spacing is a power of 2,
-            //which here is always true.
-            lo = pos & (spacing - 1);
-            id1 = ((pos - lo) << 1) + lo;
-            id2 = id1 + spacing;
-            __syncthreads();
-            y = s_data[id2];
-            s_data[id2] = s_data[id1] - y;
-            s_data[id1] += y;
-        }
-        __syncthreads();
+        blockFHT<T>(s_data, stepSize);
         for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
             src_ptr[i] = s_data[i];
         __syncthreads();
@@ -139,21 +85,52 @@ __global__ void hadamardTransformRadMult(T cArray[], int N, int log2N,
     }
 
     if (N > MAX_BASE_LEVEL_TRANSFORM){
-        src_ptr = cArray + (blockIdx.x << log2N);
-
-        for (int spacing = stepSize; spacing < N; spacing <<= 1){
-            __syncthreads();
-
-            for (int k = 0; k < N; k += (spacing << 1)){
-                for (int i = threadIdx.x; i < spacing; i += blockDim.x){
-                    id1 = i+k;
-                    id2 = id1 + spacing;
-                    y = src_ptr[id2];
-                    src_ptr[id2] = src_ptr[id1] - y;
-                    src_ptr[id1] += y;
-                }
-            }
+        stridedFHT<T>(cArray + (blockIdx.x << log2N), s_data, N,
+                stepSize);
+    }
+}
+
+
+//Performs the SRHT operation HD on each row of a 2d array (zero-padded to
+//the length of radem) but calculates only the numCols output columns listed in colIdx.
+//Each block of blockSize elements of the row is multiplied by the diagonal,
+//transformed in shared memory, and then added to each selected column with
+//the sign that the full transform would give it, so that the later stages
+//of the transform (which would combine the blocks) are never performed.
+//Must be launched with one block per row and blockSize / 2 threads.
+template <typename T>
+__global__ void subsampledHadamardRadMult(const T inputArray[], T outputArray[],
+        int inputDim, int blockSize, int log2BlockSize,
+        const int8_t *radem, const int32_t *colIdx, int numCols,
+        T normConstant){
+    SharedMemory<T> shared;
+    T *s_data = shared.getPointer();
+    const T *src_ptr = inputArray + static_cast<size_t>(blockIdx.x) * inputDim;
+    T *out_ptr = outputArray + static_cast<size_t>(blockIdx.x) * numCols;
+
+    for (int k = threadIdx.x; k < numCols; k += blockDim.x)
+        out_ptr[k] = 0;
+
+    for (int blockStart = 0; blockStart < inputDim; blockStart += blockSize){
+        int blockNum = blockStart >> log2BlockSize;
+        for (int i = threadIdx.x; i < blockSize; i += blockDim.x){
+            int position = blockStart + i;
+            s_data[i] = position < inputDim ?
+                src_ptr[position] * radem[position] * normConstant : 0;
         }
+
+        blockFHT<T>(s_data, blockSize);
+        __syncthreads();
+
+        for (int k = threadIdx.x; k < numCols; k += blockDim.x){
+            int col = colIdx[k];
+            T value = s_data[col & (blockSize - 1)];
+            if (__popc(blockNum & (col >> log2BlockSize)) & 1)
+                out_ptr[k] -= value;
+            else
+                out_ptr[k] += value;
+        }
+        __syncthreads();
     }
 }
 
@@ -194,12 +171,164 @@ __global__ void conv1dDiagonalRademMultiply(T cArray[],
 
 
 
+//Adds Z_b^T Z_b for a block of feature rows Z_b to zTzArray. Each
+//thread block computes one GRAM_TILE_DIM x GRAM_TILE_DIM tile of the
+//upper triangle, looping over the rows of the feature block, and adds
+//it to both the tile and its mirror image. Tiles below the diagonal
+//return immediately. If fitIntercept, the first feature is taken to be 1.
+__global__ void gramBlockKernel(const double *featureBlock, double *zTzArray,
+        int blockRows, int numRffs, bool fitIntercept){
+    __shared__ double rowTile[GRAM_TILE_DIM][GRAM_TILE_DIM];
+    __shared__ double colTile[GRAM_TILE_DIM][GRAM_TILE_DIM];
+
+    if (blockIdx.y > blockIdx.x)
+        return;
+
+    int row = blockIdx.y * GRAM_TILE_DIM + threadIdx.y;
+    int col = blockIdx.x * GRAM_TILE_DIM + threadIdx.x;
+    int rowTileCol = blockIdx.y * GRAM_TILE_DIM + threadIdx.x;
+    double sum = 0, loadVal;
+
+    for (int bStart = 0; bStart < blockRows; bStart += GRAM_TILE_DIM){
+        int b = bStart + threadIdx.y;
+
+        loadVal = 0;
+        if (b < blockRows && rowTileCol < numRffs)
+            loadVal = featureBlock[(size_t)b * numRffs + rowTileCol];
+        if (fitIntercept && rowTileCol == 0 && b < blockRows)
+            loadVal = 1;
+        rowTile[threadIdx.y][threadIdx.x] = loadVal;
+
+        loadVal = 0;
+        if (b < blockRows && col < numRffs)
+            loadVal = featureBlock[(size_t)b * numRffs + col];
+        if (fitIntercept && col == 0 && b < blockRows)
+            loadVal = 1;
+        colTile[threadIdx.y][threadIdx.x] = loadVal;
+
+        __syncthreads();
+        for (int k = 0; k < GRAM_TILE_DIM; k++)
+            sum += rowTile[k][threadIdx.y] * colTile[k][threadIdx.x];
+        __syncthreads();
+    }
+
+    if (row < numRffs && col < numRffs && col >= row){
+        zTzArray[(size_t)row * numRffs + col] += sum;
+        if (col > row)
+            zTzArray[(size_t)col * numRffs + row] += sum;
+    }
+}
+
+
+//Adds Z_b^T y_b for a block of feature rows Z_b to zTyArray, with one
+//thread per feature. If fitIntercept, the first feature is taken to be 1.
+__global__ void gramBlockZTYKernel(const double *featureBlock, const double *yBlock,
+        double *zTyArray, int blockRows, int numRffs, bool fitIntercept){
+    int col = blockDim.x * blockIdx.x + threadIdx.x;
+    double sum = 0;
+
+    if (col >= numRffs)
+        return;
+
+    for (int b = 0; b < blockRows; b++){
+        if (fitIntercept && col == 0)
+            sum += yBlock[b];
+        else
+            sum += featureBlock[(size_t)b * numRffs + col] * yBlock[b];
+    }
+    zTyArray[col] += sum;
+}
+
+
+
+//Computes S = Z_b V for a block of feature rows Z_b and a batch of vectors
+//V, where V is (numRffs x numVecs). Each thread block computes one
+//GRAM_TILE_DIM x GRAM_TILE_DIM tile of S. If fitIntercept, the first
+//feature is taken to be 1.
+__global__ void blockVecProductKernel(const double *featureBlock,
+        const double *vecArray, double *rowProducts, int blockRows,
+        int numRffs, int numVecs, bool fitIntercept){
+    __shared__ double featureTile[GRAM_TILE_DIM][GRAM_TILE_DIM];
+    __shared__ double vecTile[GRAM_TILE_DIM][GRAM_TILE_DIM];
+
+    int row = blockIdx.x * GRAM_TILE_DIM + threadIdx.y;
+    int col = blockIdx.y * GRAM_TILE_DIM + threadIdx.x;
+    double sum = 0, loadVal;
+
+    for (int rStart = 0; rStart < numRffs; rStart += GRAM_TILE_DIM){
+        int featureCol = rStart + threadIdx.x;
+        int vecRow = rStart + threadIdx.y;
+
+        loadVal = 0;
+        if (row < blockRows && featureCol < numRffs)
+            loadVal = featureBlock[(size_t)row * numRffs + featureCol];
+        if (fitIntercept && featureCol == 0 && row < blockRows)
+            loadVal = 1;
+        featureTile[threadIdx.y][threadIdx.x] = loadVal;
+
+        loadVal = 0;
+        if (vecRow < numRffs && col < numVecs)
+            loadVal = vecArray[(size_t)vecRow * numVecs + col];
+        vecTile[threadIdx.y][threadIdx.x] = loadVal;
+
+        __syncthreads();
+        for (int k = 0; k < GRAM_TILE_DIM; k++)
+            sum += featureTile[threadIdx.y][k] * vecTile[k][threadIdx.x];
+        __syncthreads();
+    }
+
+    if (row < blockRows && col < numVecs)
+        rowProducts[(size_t)row * numVecs + col] = sum;
+}
+
+
+//Adds Z_b^T S to outputArray, where S = Z_b V is the (blockRows x numVecs)
+//output of blockVecProductKernel. Each thread block computes one
+//GRAM_TILE_DIM x GRAM_TILE_DIM tile of the output. If fitIntercept, the
+//first feature is taken to be 1.
+__global__ void blockTransposeProductKernel(const double *featureBlock,
+        const double *rowProducts, double *outputArray, int blockRows,
+        int numRffs, int numVecs, bool fitIntercept){
+    __shared__ double featureTile[GRAM_TILE_DIM][GRAM_TILE_DIM];
+    __shared__ double productTile[GRAM_TILE_DIM][GRAM_TILE_DIM];
+
+    int row = blockIdx.x * GRAM_TILE_DIM + threadIdx.y;
+    int col = blockIdx.y * GRAM_TILE_DIM + threadIdx.x;
+    int featureCol = blockIdx.x * GRAM_TILE_DIM + threadIdx.x;
+    double sum = 0, loadVal;
+
+    for (int bStart = 0; bStart < blockRows; bStart += GRAM_TILE_DIM){
+        int b = bStart + threadIdx.y;
+
+        loadVal = 0;
+        if (b < blockRows && featureCol < numRffs)
+            loadVal = featureBlock[(size_t)b * numRffs + featureCol];
+        if (fitIntercept && featureCol == 0 && b < blockRows)
+            loadVal = 1;
+        featureTile[threadIdx.y][threadIdx.x] = loadVal;
+
+        loadVal = 0;
+        if (b < blockRows && col < numVecs)
+            loadVal = rowProducts[(size_t)b * numVecs + col];
+        productTile[threadIdx.y][threadIdx.x] = loadVal;
+
+        __syncthreads();
+        for (int k = 0; k < GRAM_TILE_DIM; k++)
+            sum += featureTile[k][threadIdx.y] * productTile[k][threadIdx.x];
+        __syncthreads();
+    }
+
+    if (row < numRffs && col < numVecs)
+        outputArray[(size_t)row * numVecs + col] += sum;
+}
+
+
 
 //Performs an unnormalized fast Hadamard transform over the last
 //dimension of the input array.
 template <typename T>
 int cudaHTransform(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda,
-        nb::c_contig> inputArr){
+        nb::c_contig> inputArr, uintptr_t streamPtr){
 
     // Perform safety checks. Any exceptions thrown here are handed off to Python
     // by the Nanobind wrapper. We do not expect the user to see these because
@@ -221,17 +350,20 @@ int cudaHTransform(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda,
     stepSize = MIN(MAX_BASE_LEVEL_TRANSFORM, zDim1);
     log2N = log2(zDim1);
 
+    ScopedCudaDevice deviceGuard(inputArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, inputArr.shape(0));
     hadamardTransform<T><<<zDim0, stepSize / 2,
-                    stepSize * sizeof(T)>>>(inputPtr, zDim1, log2N);
+                    stepSize * sizeof(T), stream>>>(inputPtr, zDim1, log2N);
 
     // Update this to add error code handling.
     return 0;
 }
 //Instantiate templates explicitly so wrapper can use.
 template int cudaHTransform<double>(nb::ndarray<double, nb::shape<-1, -1>, nb::device::cuda,
-        nb::c_contig> inputArr);
+        nb::c_contig> inputArr, uintptr_t streamPtr);
 template int cudaHTransform<float>(nb::ndarray<float, nb::shape<-1, -1>, nb::device::cuda,
-        nb::c_contig> inputArr);
+        nb::c_contig> inputArr, uintptr_t streamPtr);
 
 
 
@@ -241,7 +373,7 @@ int cudaSRHT2d(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda,
         nb::c_contig> inputArr,
         nb::ndarray<const int8_t, nb::shape<-1>, nb::device::cuda,
         nb::c_contig> radem,
-        int numThreads){
+        int numThreads, uintptr_t streamPtr){
     // Perform safety checks. Any exceptions thrown here are handed off to Python
     // by the Nanobind wrapper. We do not expect the user to see these because
     // the Python code will always ensure inputs are correct -- these are a failsafe
@@ -268,9 +400,12 @@ int cudaSRHT2d(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda,
     log2N = log2(zDim1);
 
 
+    ScopedCudaDevice deviceGuard(inputArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, inputArr.shape(0));
     //cudaProfilerStart();
     hadamardTransformRadMult<T><<<zDim0, stepSize / 2,
-        stepSize * sizeof(T)>>>(inputPtr, zDim1, log2N,
+        stepSize * sizeof(T), stream>>>(inputPtr, zDim1, log2N,
                     rademPtr, normConstant);
 
 
@@ -282,9 +417,195 @@ template int cudaSRHT2d<double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device
         nb::c_contig> inputArr,
         nb::ndarray<const int8_t, nb::shape<-1>, nb::device::cuda,
         nb::c_contig> radem,
-        int numThreads);
+        int numThreads, uintptr_t streamPtr);
 template int cudaSRHT2d<float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda,
         nb::c_contig> inputArr,
         nb::ndarray<const int8_t, nb::shape<-1>, nb::device::cuda,
         nb::c_contig> radem,
-        int numThreads);
+        int numThreads, uintptr_t streamPtr);
+
+
+
+
+//Performs the SRHT operation HD, then keeps only the columns listed in
+//colIdx, without performing the full transform; see
+//subsampledHadamardRadMult. The input may be narrower than radem, in which
+//case it is treated as zero-padded, and is not modified.
+template <typename T>
+int cudaSubsampledSRHT2d(nb::ndarray<const T, nb::shape<-1,-1>, nb::device::cuda,
+        nb::c_contig> inputArr,
+        nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const int8_t, nb::shape<-1>, nb::device::cuda,
+        nb::c_contig> radem,
+        nb::ndarray<const int32_t, nb::shape<-1>, nb::device::cuda,
+        nb::c_contig> colIdx,
+        uintptr_t streamPtr){
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = inputArr.shape(0);
+    int zDim1 = inputArr.shape(1);
+    int paddedDim = radem.shape(0);
+    int numCols = colIdx.shape(0);
+    const T *inputPtr = inputArr.data();
+    T *outputPtr = outputArr.data();
+    const int8_t *rademPtr = radem.data();
+    const int32_t *colIdxPtr = colIdx.data();
+
+    if (inputArr.shape(0) == 0 || numCols == 0)
+        throw std::runtime_error("no datapoints");
+    if (outputArr.shape(0) != inputArr.shape(0) || outputArr.shape(1) != colIdx.shape(0))
+        throw std::runtime_error("wrong array sizes");
+    if (zDim1 > paddedDim || zDim1 == 0)
+        throw std::runtime_error("wrong array sizes");
+    if (paddedDim < 2)
+        throw std::runtime_error("last dim not power of 2 > 1");
+    if ((paddedDim & (paddedDim - 1)) != 0)
+        throw std::runtime_error("last dim not power of 2");
+
+    //The column indices are on the device, so unlike on CPU they are not
+    //checked here; the Python wrapper generates them.
+    T normConstant = log2(paddedDim) / 2;
+    normConstant = 1 / pow(2, normConstant);
+    int blockSize = getSubsampledSRHTBlockSize(paddedDim, numCols,
+            MAX_BASE_LEVEL_TRANSFORM);
+    int log2BlockSize = log2(blockSize);
+
+    ScopedCudaDevice deviceGuard(inputArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, inputArr.shape(0));
+    subsampledHadamardRadMult<T><<<zDim0, blockSize / 2,
+        blockSize * sizeof(T), stream>>>(inputPtr, outputPtr, zDim1,
+                blockSize, log2BlockSize, rademPtr, colIdxPtr,
+                numCols, normConstant);
+    return 0;
+}
+//Instantiate templates explicitly so wrapper can use.
+template int cudaSubsampledSRHT2d<double>(nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda,
+        nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const int8_t, nb::shape<-1>, nb::device::cuda,
+        nb::c_contig> radem,
+        nb::ndarray<const int32_t, nb::shape<-1>, nb::device::cuda,
+        nb::c_contig> colIdx,
+        uintptr_t streamPtr);
+template int cudaSubsampledSRHT2d<float>(nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda,
+        nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const int8_t, nb::shape<-1>, nb::device::cuda,
+        nb::c_contig> radem,
+        nb::ndarray<const int32_t, nb::shape<-1>, nb::device::cuda,
+        nb::c_contig> colIdx,
+        uintptr_t streamPtr);
+
+
+//Chooses the block length L for cudaSubsampledSRHT2d, the power of 2 up
+//to maxBlockSize that minimizes the approximate cost N log2(L) + 2 M N / L
+//of calculating M columns of a length N transform. The gather term is
+//weighted more heavily since it reads shared memory at scattered positions.
+int getSubsampledSRHTBlockSize(int paddedDim, int numCols, int maxBlockSize){
+    int bestBlockSize = 2;
+    double bestCost = -1;
+
+    for (int blockSize = 2; blockSize <= paddedDim && blockSize <= maxBlockSize;
+            blockSize <<= 1){
+        double cost = static_cast<double>(paddedDim) * log2(blockSize) +
+            2.0 * static_cast<double>(numCols) * (paddedDim / blockSize);
+        if (bestCost < 0 || cost < bestCost){
+            bestCost = cost;
+            bestBlockSize = blockSize;
+        }
+    }
+    return bestBlockSize;
+}
+
+
+
+
+//Returns the number of feature rows to generate per block so that
+//the block holds roughly DESIGN_MATRIX_BLOCK_ELEMENTS doubles.
+int getDesignMatrixBlockRows(int numRows, size_t numRffs){
+    size_t blockRows = DESIGN_MATRIX_BLOCK_ELEMENTS / numRffs;
+    if (blockRows < 1)
+        blockRows = 1;
+    if (blockRows > static_cast<size_t>(numRows))
+        blockRows = numRows;
+    return static_cast<int>(blockRows);
+}
+
+
+//Chooses the launch layout for the convolution kernels, which loop over the
+//kmers of each sequence. Each row is handled by kmerTiles blocks, each of
+//which works on windowsPerBlock kmers at a time, giving kmerTiles *
+//windowsPerBlock slices per row (the return value). Short transforms would
+//otherwise give blocks with very few threads, so several windows are
+//packed into each block until it has at least CONV_MIN_THREADS_PER_BLOCK
+//threads, and rows are split across more blocks until there are about
+//CONV_TARGET_BLOCKS blocks in total. Each slice needs sliceElements of
+//scratch and output storage, so the number of slices is limited to keep
+//that within DESIGN_MATRIX_BLOCK_ELEMENTS for all rows; if even two
+//slices per row will not fit, a single slice is used (one block per row).
+int getConvKmerLayout(int numRows, int maxKmers, int stepSize,
+        size_t sliceElements, int &kmerTiles, int &windowsPerBlock){
+    int threadsPerWindow = MAX(stepSize / 2, 1);
+    size_t maxSlices = DESIGN_MATRIX_BLOCK_ELEMENTS /
+        (static_cast<size_t>(numRows) * sliceElements);
+    maxSlices = MIN(maxSlices, static_cast<size_t>(maxKmers));
+
+    windowsPerBlock = (CONV_MIN_THREADS_PER_BLOCK + threadsPerWindow - 1) / threadsPerWindow;
+    windowsPerBlock = MAX(MIN(static_cast<size_t>(windowsPerBlock), maxSlices), 1);
+
+    int kmerGroups = (maxKmers + windowsPerBlock - 1) / windowsPerBlock;
+    int rowBlocks = (CONV_TARGET_BLOCKS + numRows - 1) / numRows;
+    kmerTiles = MIN(MIN(kmerGroups, rowBlocks), static_cast<int>(maxSlices / windowsPerBlock));
+    kmerTiles = MAX(kmerTiles, 1);
+
+    if (kmerTiles * windowsPerBlock < 2){
+        kmerTiles = 1;
+        windowsPerBlock = 1;
+    }
+    return kmerTiles * windowsPerBlock;
+}
+
+
+//Adds Z_b^T Z_b and Z_b^T y_b for a block of feature rows Z_b (already
+//on the device) to zTzArray and zTyArray. Not called directly from
+//Python -- used by the design matrix routines for each kernel.
+int cudaAccumulateGram(const double *featureBlock, const double *yBlock,
+        double *zTzArray, double *zTyArray, int blockRows, int numRffs,
+        bool fitIntercept, cudaStream_t stream){
+    int numTiles = (numRffs + GRAM_TILE_DIM - 1) / GRAM_TILE_DIM;
+    dim3 gramBlocks(numTiles, numTiles);
+    dim3 gramThreads(GRAM_TILE_DIM, GRAM_TILE_DIM);
+
+    gramBlockKernel<<<gramBlocks, gramThreads, 0, stream>>>(featureBlock, zTzArray,
+            blockRows, numRffs, fitIntercept);
+
+    int ztyBlocks = (numRffs + DEFAULT_THREADS_PER_BLOCK - 1) / DEFAULT_THREADS_PER_BLOCK;
+    gramBlockZTYKernel<<<ztyBlocks, DEFAULT_THREADS_PER_BLOCK, 0, stream>>>(featureBlock,
+            yBlock, zTyArray, blockRows, numRffs, fitIntercept);
+    return 0;
+}
+
+
+
+//Adds Z_b^T (Z_b V) for a block of feature rows Z_b (already on the
+//device) and a batch of vectors V to outputArray. rowProducts must be
+//a device buffer of size blockRows * numVecs. Not called directly from
+//Python -- used by the matvec routines for each kernel.
+int cudaAccumulateMatvec(const double *featureBlock, const double *vecArray,
+        double *outputArray, double *rowProducts, int blockRows, int numRffs,
+        int numVecs, bool fitIntercept, cudaStream_t stream){
+    int vecTiles = (numVecs + GRAM_TILE_DIM - 1) / GRAM_TILE_DIM;
+    int rowTiles = (blockRows + GRAM_TILE_DIM - 1) / GRAM_TILE_DIM;
+    int rffTiles = (numRffs + GRAM_TILE_DIM - 1) / GRAM_TILE_DIM;
+    dim3 tileThreads(GRAM_TILE_DIM, GRAM_TILE_DIM);
+
+    //Rows go on the x-axis of the grid since blockRows may be large.
+    blockVecProductKernel<<<dim3(rowTiles, vecTiles), tileThreads, 0, stream>>>(featureBlock,
+            vecArray, rowProducts, blockRows, numRffs, numVecs, fitIntercept);
+    blockTransposeProductKernel<<<dim3(rffTiles, vecTiles), tileThreads, 0, stream>>>(featureBlock,
+            rowProducts, outputArray, blockRows, numRffs, numVecs, fitIntercept);
+    return 0;
+}
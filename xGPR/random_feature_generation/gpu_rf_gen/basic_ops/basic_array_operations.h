@@ -4,20 +4,45 @@
 #include <stdint.h>
 #include <nanobind/nanobind.h>
 #include <nanobind/ndarray.h>
+#include "device_workspace.h"
 
 namespace nb = nanobind;
 
 
 template <typename T>
 int cudaHTransform(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda,
-        nb::c_contig> inputArr);
+        nb::c_contig> inputArr, uintptr_t streamPtr);
 
 template <typename T>
 int cudaSRHT2d(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda,
         nb::c_contig> inputArr,
         nb::ndarray<const int8_t, nb::shape<-1>, nb::device::cuda,
         nb::c_contig> radem,
-        int numThreads);
+        int numThreads, uintptr_t streamPtr);
 
+template <typename T>
+int cudaSubsampledSRHT2d(nb::ndarray<const T, nb::shape<-1,-1>, nb::device::cuda,
+        nb::c_contig> inputArr,
+        nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const int8_t, nb::shape<-1>, nb::device::cuda,
+        nb::c_contig> radem,
+        nb::ndarray<const int32_t, nb::shape<-1>, nb::device::cuda,
+        nb::c_contig> colIdx,
+        uintptr_t streamPtr);
+
+int getSubsampledSRHTBlockSize(int paddedDim, int numCols, int maxBlockSize);
+
+int getDesignMatrixBlockRows(int numRows, size_t numRffs);
+
+int getConvKmerLayout(int numRows, int maxKmers, int stepSize,
+        size_t sliceElements, int &kmerTiles, int &windowsPerBlock);
+
+int cudaAccumulateGram(const double *featureBlock, const double *yBlock,
+        double *zTzArray, double *zTyArray, int blockRows, int numRffs,
+        bool fitIntercept, cudaStream_t stream);
+
+int cudaAccumulateMatvec(const double *featureBlock, const double *vecArray,
+        double *outputArray, double *rowProducts, int blockRows, int numRffs,
+        int numVecs, bool fitIntercept, cudaStream_t stream);
 
 #endif
@@ -0,0 +1,310 @@
+/*
+* Contains the device workspace that supplies scratch memory to the
+* CUDA ops, together with wrapper-facing functions for querying
+* and releasing it.
+*/
+#include <cuda.h>
+#include <cuda_runtime.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdexcept>
+#include <vector>
+#include <mutex>
+#include "../shared_constants.h"
+#include "device_workspace.h"
+#include "../../native_profiler.h"
+
+
+
+DeviceWorkspace &DeviceWorkspace::getInstance(){
+    // The workspace is deliberately never destroyed. Freeing device memory
+    // from a static destructor at interpreter exit may run after the CUDA
+    // context has already been torn down; the driver reclaims it anyway.
+    static DeviceWorkspace *workspace = new DeviceWorkspace();
+    return *workspace;
+}
+
+
+//Returns the buffers for the current device and the specified stream,
+//or NULL if the current device cannot be determined. Caller must hold
+//the lock.
+DeviceWorkspace::DeviceBuffers *DeviceWorkspace::getDeviceBuffers(cudaStream_t stream){
+    int device;
+    if (cudaGetDevice(&device) != cudaSuccess)
+        return NULL;
+    return &deviceBuffers[std::make_pair(device, reinterpret_cast<uintptr_t>(stream))];
+}
+
+
+//Grows the buffer in the specified slot if it is smaller than numBytes
+//and returns it, or NULL if the device is out of memory. Caller must
+//hold the lock.
+void *DeviceWorkspace::growBuffer(DeviceBuffers &current, int slot, size_t numBytes){
+    if (current.buffers[slot] != NULL && current.sizes[slot] >= numBytes)
+        return current.buffers[slot];
+    PROFILE_SCOPE(PROFILE_ALLOC);
+
+    // Free the old buffer first so that peak memory use while growing
+    // is not the sum of the old and new sizes.
+    if (current.buffers[slot] != NULL)
+        cudaFree(current.buffers[slot]);
+    current.buffers[slot] = NULL;
+    current.sizes[slot] = 0;
+
+    void *newBuffer;
+    if (cudaMalloc(&newBuffer, MAX(numBytes, (size_t)1)) != cudaSuccess)
+        return NULL;
+
+    current.buffers[slot] = newBuffer;
+    current.sizes[slot] = numBytes;
+    return newBuffer;
+}
+
+
+//Returns a buffer of at least numBytes for the requested slot on the
+//current device for use on the specified stream, growing it if necessary,
+//or NULL if the slot is invalid or the device is out of memory. The
+//contents are not preserved when a buffer grows and are not initialized.
+void *DeviceWorkspace::getBuffer(int slot, size_t numBytes, cudaStream_t stream){
+    if (slot < 0 || slot >= NUM_WORKSPACE_SLOTS)
+        return NULL;
+
+    std::lock_guard<std::mutex> guard(workspaceLock);
+    DeviceBuffers *current = getDeviceBuffers(stream);
+    if (current == NULL)
+        return NULL;
+    return growBuffer(*current, slot, numBytes);
+}
+
+
+//Copies an array of sequence lengths from pageable host memory into the
+//sequence length slot on the device, asynchronously on the specified
+//stream, via a pinned staging buffer. Only the copy into the staging
+//buffer is synchronous, so the caller does not wait for earlier work
+//on the stream to finish (unless an earlier copy out of the staging
+//buffer is still pending). Returns NULL on failure.
+int32_t *DeviceWorkspace::stageSeqlengths(const int32_t *seqlengths,
+        size_t numElements, cudaStream_t stream){
+    size_t numBytes = sizeof(int32_t) * numElements;
+
+    std::lock_guard<std::mutex> guard(workspaceLock);
+    DeviceBuffers *current = getDeviceBuffers(stream);
+    if (current == NULL)
+        return NULL;
+
+    void *deviceBuffer = growBuffer(*current, WORKSPACE_SEQLEN_SLOT, numBytes);
+    if (deviceBuffer == NULL)
+        return NULL;
+
+    if (current->copyDone == NULL) {
+        if (cudaEventCreateWithFlags(&current->copyDone, cudaEventDisableTiming) !=
+                cudaSuccess) {
+            current->copyDone = NULL;
+            return NULL;
+        }
+    } else if (cudaEventSynchronize(current->copyDone) != cudaSuccess)
+        return NULL;
+
+    if (current->pinnedSize < numBytes){
+        if (current->pinnedBuffer != NULL)
+            cudaFreeHost(current->pinnedBuffer);
+        current->pinnedBuffer = NULL;
+        current->pinnedSize = 0;
+        if (cudaMallocHost(&current->pinnedBuffer, MAX(numBytes, (size_t)1)) !=
+                cudaSuccess) {
+            current->pinnedBuffer = NULL;
+            return NULL;
+        }
+        current->pinnedSize = numBytes;
+    }
+
+    PROFILE_SCOPE(PROFILE_H2D);
+    PROFILE_COUNT(PROFILE_BYTES, numBytes);
+    memcpy(current->pinnedBuffer, seqlengths, numBytes);
+    if (cudaMemcpyAsync(deviceBuffer, current->pinnedBuffer, numBytes,
+                cudaMemcpyHostToDevice, stream) != cudaSuccess)
+        return NULL;
+    cudaEventRecord(current->copyDone, stream);
+    return static_cast<int32_t*>(deviceBuffer);
+}
+
+
+//Returns the total number of bytes of device memory currently held
+//across all devices and streams.
+size_t DeviceWorkspace::getFootprint(){
+    std::lock_guard<std::mutex> guard(workspaceLock);
+    size_t footprint = 0;
+
+    for (auto &devBuffers : deviceBuffers){
+        for (int i=0; i < NUM_WORKSPACE_SLOTS; i++)
+            footprint += devBuffers.second.sizes[i];
+    }
+    return footprint;
+}
+
+
+//Frees all buffers on all devices (e.g. so the memory can be used by
+//the CuPy memory pool). The next call to any op reallocates what it needs.
+//Since cudaFree synchronizes the device, no pending work can still be
+//using a buffer when it is freed.
+void DeviceWorkspace::release(){
+    std::lock_guard<std::mutex> guard(workspaceLock);
+    int currentDevice;
+    bool restoreDevice = (cudaGetDevice(&currentDevice) == cudaSuccess);
+
+    for (auto &devBuffers : deviceBuffers){
+        DeviceBuffers &current = devBuffers.second;
+        cudaSetDevice(devBuffers.first.first);
+
+        for (int i=0; i < NUM_WORKSPACE_SLOTS; i++){
+            if (current.buffers[i] != NULL)
+                cudaFree(current.buffers[i]);
+        }
+        if (current.copyDone != NULL) {
+            cudaEventSynchronize(current.copyDone);
+            cudaEventDestroy(current.copyDone);
+        }
+        if (current.pinnedBuffer != NULL)
+            cudaFreeHost(current.pinnedBuffer);
+    }
+    deviceBuffers.clear();
+
+    if (restoreDevice)
+        cudaSetDevice(currentDevice);
+}
+
+
+
+ScopedCudaDevice::ScopedCudaDevice(int device){
+    restoreDevice = (cudaGetDevice(&previousDevice) == cudaSuccess);
+    if (restoreDevice && previousDevice == device)
+        restoreDevice = false;
+    else
+        cudaSetDevice(device);
+}
+
+
+ScopedCudaDevice::~ScopedCudaDevice(){
+    if (restoreDevice)
+        cudaSetDevice(previousDevice);
+}
+
+
+
+//The mutex behind CudaOpLock. Like the workspace, it is never destroyed,
+//so that ops still running at interpreter exit cannot find it gone.
+static std::mutex &getCudaOpMutex(){
+    static std::mutex *opMutex = new std::mutex();
+    return *opMutex;
+}
+
+
+CudaOpLock::CudaOpLock(){
+    getCudaOpMutex().lock();
+}
+
+
+CudaOpLock::~CudaOpLock(){
+    getCudaOpMutex().unlock();
+}
+
+
+
+//Convenience function for the ops: returns a buffer with room for
+//numElements elements of type T from the specified slot of the
+//workspace for the specified stream, or NULL if it could not be allocated.
+template <typename T>
+T *getWorkspaceBuffer(int slot, size_t numElements, cudaStream_t stream){
+    return static_cast<T*>(DeviceWorkspace::getInstance().getBuffer(slot,
+                sizeof(T) * numElements, stream));
+}
+template double *getWorkspaceBuffer<double>(int slot, size_t numElements,
+        cudaStream_t stream);
+template float *getWorkspaceBuffer<float>(int slot, size_t numElements,
+        cudaStream_t stream);
+template int32_t *getWorkspaceBuffer<int32_t>(int slot, size_t numElements,
+        cudaStream_t stream);
+
+
+//Convenience function for the ops: copies the sequence lengths for a
+//convolution op to the device on the specified stream and returns the
+//device copy, or NULL on failure.
+int32_t *copySeqlengthsToDevice(const int32_t *seqlengths, size_t numElements,
+        cudaStream_t stream){
+    return DeviceWorkspace::getInstance().stageSeqlengths(seqlengths,
+            numElements, stream);
+}
+
+
+//Converts a stream handle passed from Python as an integer (e.g. the
+//ptr attribute of a CuPy stream, where 0 is the default stream) to
+//a cudaStream_t.
+cudaStream_t getCudaStream(uintptr_t streamPtr){
+    return reinterpret_cast<cudaStream_t>(streamPtr);
+}
+
+
+
+//Wrapper-facing function that returns the current workspace footprint
+//in bytes.
+size_t getCudaWorkspaceSize_(){
+    return DeviceWorkspace::getInstance().getFootprint();
+}
+
+
+//Wrapper-facing function that frees the workspace.
+int releaseCudaWorkspace_(){
+    CudaOpLock opLock;
+    DeviceWorkspace::getInstance().release();
+    return 0;
+}
+
+
+//Wrapper-facing function that returns the number of visible devices,
+//or 0 if there are none or the count cannot be determined.
+int getCudaDeviceCount_(){
+    int deviceCount;
+    if (cudaGetDeviceCount(&deviceCount) != cudaSuccess)
+        return 0;
+    return deviceCount;
+}
+
+
+//Wrapper-facing function that enables peer access between every pair
+//of the specified devices where the hardware supports it, so that
+//partial results on one device can be copied directly to another
+//when they are reduced. Returns the number of (ordered) device pairs
+//that can access each other's memory directly.
+int enableCudaPeerAccess_(std::vector<int> deviceIds){
+    int deviceCount = getCudaDeviceCount_();
+    for (int deviceId : deviceIds){
+        if (deviceId < 0 || deviceId >= deviceCount)
+            throw std::runtime_error("Invalid device id supplied.");
+    }
+
+    int numPeerPairs = 0;
+    for (int deviceId : deviceIds){
+        ScopedCudaDevice deviceGuard(deviceId);
+
+        for (int peerId : deviceIds){
+            int canAccess = 0;
+            if (peerId == deviceId)
+                continue;
+            if (cudaDeviceCanAccessPeer(&canAccess, deviceId, peerId) !=
+                    cudaSuccess || !canAccess)
+                continue;
+
+            cudaError_t status = cudaDeviceEnablePeerAccess(peerId, 0);
+            // Peer access already being enabled (e.g. from an earlier
+            // call) is not an error; clear it so it is not reported by
+            // the next op.
+            if (status == cudaErrorPeerAccessAlreadyEnabled){
+                cudaGetLastError();
+                status = cudaSuccess;
+            }
+            if (status == cudaSuccess)
+                numPeerPairs += 1;
+        }
+    }
+    return numPeerPairs;
+}
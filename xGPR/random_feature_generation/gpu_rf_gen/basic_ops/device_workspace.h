@@ -0,0 +1,123 @@
+#ifndef CUDA_DEVICE_WORKSPACE_H
+#define CUDA_DEVICE_WORKSPACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Matches the definitions in the CUDA runtime headers, so that this
+// header can also be included by the (host-compiled) wrapper.
+typedef struct CUstream_st *cudaStream_t;
+typedef struct CUevent_st *cudaEvent_t;
+
+// The scratch buffers an op can request from the workspace. An op
+// never holds two buffers from the same slot at once, so buffers
+// in different slots never alias.
+#define WORKSPACE_FEATURE_SLOT 0
+#define WORKSPACE_BLOCK_SLOT 1
+#define WORKSPACE_PRODUCT_SLOT 2
+#define WORKSPACE_SEQLEN_SLOT 3
+#define WORKSPACE_SLICE_SLOT 4
+#define WORKSPACE_INDEX_SLOT 5
+#define NUM_WORKSPACE_SLOTS 6
+
+
+// A persistent, growable set of device scratch buffers shared by all
+// of the CUDA ops, so that repeated calls (e.g. one per chunk on every
+// CG iteration) do not pay for a cudaMalloc / cudaFree (and the device
+// synchronization cudaFree implies) each time. Each buffer is only
+// reallocated when a request arrives that is larger than its current
+// size.
+//
+// Buffers are kept separately for each (device, stream) pair. All work
+// an op enqueues goes on the caller's stream, so a buffer handed to one
+// call is never overwritten by the next call on the same stream until
+// the first call's kernels have completed, while ops running on
+// different streams never share scratch memory.
+class DeviceWorkspace {
+    public:
+        static DeviceWorkspace &getInstance();
+
+        void *getBuffer(int slot, size_t numBytes, cudaStream_t stream);
+        int32_t *stageSeqlengths(const int32_t *seqlengths, size_t numElements,
+                cudaStream_t stream);
+        size_t getFootprint();
+        void release();
+
+        DeviceWorkspace(const DeviceWorkspace&) = delete;
+        DeviceWorkspace &operator=(const DeviceWorkspace&) = delete;
+
+    private:
+        DeviceWorkspace() = default;
+
+        struct DeviceBuffers {
+            void *buffers[NUM_WORKSPACE_SLOTS] = {NULL};
+            size_t sizes[NUM_WORKSPACE_SLOTS] = {0};
+            // Pinned host staging buffer for host to device copies, and
+            // an event marking when the last copy out of it completed.
+            void *pinnedBuffer = NULL;
+            size_t pinnedSize = 0;
+            cudaEvent_t copyDone = NULL;
+        };
+
+        DeviceBuffers *getDeviceBuffers(cudaStream_t stream);
+        void *growBuffer(DeviceBuffers &current, int slot, size_t numBytes);
+
+        std::mutex workspaceLock;
+        std::map<std::pair<int, uintptr_t>, DeviceBuffers> deviceBuffers;
+};
+
+
+// Makes the specified device current for the lifetime of the object
+// and restores the previously current device afterwards. The ops use
+// this so that they always run on the device their input lives on,
+// whichever device happens to be current in the caller, which lets
+// the caller shard work across devices by passing each op arrays
+// that live on different devices.
+class ScopedCudaDevice {
+    public:
+        explicit ScopedCudaDevice(int device);
+        ~ScopedCudaDevice();
+
+        ScopedCudaDevice(const ScopedCudaDevice&) = delete;
+        ScopedCudaDevice &operator=(const ScopedCudaDevice&) = delete;
+
+    private:
+        int previousDevice;
+        bool restoreDevice;
+};
+
+
+// Held by the wrapper for the duration of every op (and while the
+// workspace is released). Buffers are shared by all ops on the same
+// stream, so two host threads running ops at the same time (which
+// they can, since the wrapper releases the GIL) could otherwise each
+// be handed the same buffer, or one could grow and free a buffer the
+// other has already enqueued kernels on.
+class CudaOpLock {
+    public:
+        CudaOpLock();
+        ~CudaOpLock();
+
+        CudaOpLock(const CudaOpLock&) = delete;
+        CudaOpLock &operator=(const CudaOpLock&) = delete;
+};
+
+
+template <typename T>
+T *getWorkspaceBuffer(int slot, size_t numElements, cudaStream_t stream);
+
+int32_t *copySeqlengthsToDevice(const int32_t *seqlengths, size_t numElements,
+        cudaStream_t stream);
+
+cudaStream_t getCudaStream(uintptr_t streamPtr);
+
+size_t getCudaWorkspaceSize_();
+int releaseCudaWorkspace_();
+int getCudaDeviceCount_();
+int enableCudaPeerAccess_(std::vector<int> deviceIds);
+
+#endif
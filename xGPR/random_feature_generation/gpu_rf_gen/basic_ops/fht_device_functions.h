@@ -0,0 +1,119 @@
+#ifndef CUDA_FHT_DEVICE_FUNCTIONS_H
+#define CUDA_FHT_DEVICE_FUNCTIONS_H
+
+#include "../shared_constants.h"
+
+
+//Performs the butterfly stages from startSpacing up to stepSize / 2 of an
+//unnormalized Hadamard transform on stepSize elements in shared memory,
+//one butterfly per thread (blockDim.x must be stepSize / 2). The elements
+//may belong to several independent shorter transforms -- e.g. with
+//startSpacing > 1 this completes transforms over strided columns.
+template <typename T>
+__device__ void sharedFHTStages(T s_data[], int stepSize, int startSpacing){
+    int pos = threadIdx.x;
+    int lo, id1, id2;
+    T y;
+
+    for (int spacing = startSpacing; spacing < stepSize; spacing <<= 1){
+        //Equivalent to pos mod spacing if spacing is a power of 2,
+        //which here is always true.
+        lo = pos & (spacing - 1);
+        id1 = ((pos - lo) << 1) + lo;
+        id2 = id1 + spacing;
+        __syncthreads();
+        y = s_data[id2];
+        s_data[id2] = s_data[id1] - y;
+        s_data[id1] += y;
+    }
+    __syncthreads();
+}
+
+
+//Performs an unnormalized Hadamard transform on stepSize elements in shared
+//memory, where stepSize <= MAX_BASE_LEVEL_TRANSFORM and blockDim.x must be
+//stepSize / 2. If stepSize is at least 2 * WARP_SIZE, each warp first loads
+//a contiguous block of 2 * WARP_SIZE elements into registers (two per
+//thread) and performs the first six stages without any block-level
+//synchronization -- five using warp shuffles and the sixth within each
+//thread -- before the remaining stages are run in shared memory. The
+//additions are performed in the same order either way, so the result
+//is identical.
+template <typename T>
+__device__ void blockFHT(T s_data[], int stepSize){
+    int startSpacing = 1;
+    __syncthreads();
+
+    if (stepSize >= 2 * WARP_SIZE){
+        int lane = threadIdx.x & (WARP_SIZE - 1);
+        int warpStart = (threadIdx.x - lane) << 1;
+        T lower = s_data[warpStart + lane];
+        T upper = s_data[warpStart + lane + WARP_SIZE];
+
+        for (int spacing = 1; spacing < WARP_SIZE; spacing <<= 1){
+            T lowerPartner = __shfl_xor_sync(FULL_WARP_MASK, lower, spacing);
+            T upperPartner = __shfl_xor_sync(FULL_WARP_MASK, upper, spacing);
+            lower = (lane & spacing) ? lowerPartner - lower : lower + lowerPartner;
+            upper = (lane & spacing) ? upperPartner - upper : upper + upperPartner;
+        }
+        s_data[warpStart + lane] = lower + upper;
+        s_data[warpStart + lane + WARP_SIZE] = lower - upper;
+        startSpacing = 2 * WARP_SIZE;
+    }
+    sharedFHTStages<T>(s_data, stepSize, startSpacing);
+}
+
+
+//Completes an unnormalized Hadamard transform of a vector of length
+//N > stepSize in global memory, once each contiguous block of stepSize
+//elements has already been transformed (stepSize as for blockFHT). The
+//remaining stages only combine elements at the same position in different
+//blocks, so they form stepSize independent transforms of length
+//N / stepSize over strided columns. Groups of columns are loaded into
+//shared memory one tile at a time and transformed there, so that all of
+//the remaining stages take a single pass through global memory rather
+//than one pass per stage. Vectors too long for this (N > stepSize^2)
+//fall back to a stage-by-stage global memory procedure.
+template <typename T>
+__device__ void stridedFHT(T cArray[], T s_data[], int N, int stepSize){
+    int numBlocks = N / stepSize;
+    int id1, id2;
+    T y;
+
+    if (numBlocks > stepSize){
+        for (int spacing = stepSize; spacing < N; spacing <<= 1){
+            for (int k = 0; k < N; k += (spacing << 1)){
+                for (int i = threadIdx.x; i < spacing; i += blockDim.x){
+                    id1 = i + k;
+                    id2 = id1 + spacing;
+                    y = cArray[id2];
+                    cArray[id2] = cArray[id1] - y;
+                    cArray[id1] += y;
+                }
+                __syncthreads();
+            }
+        }
+        return;
+    }
+
+    //Each tile holds tileCols adjacent columns, one row of the tile for
+    //each block, so tile element i is column (i & (tileCols - 1)) of
+    //block (i >> log2TileCols).
+    int tileCols = stepSize / numBlocks;
+    int log2TileCols = __ffs(tileCols) - 1;
+
+    for (int colStart = 0; colStart < stepSize; colStart += tileCols){
+        for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
+            s_data[i] = cArray[(i >> log2TileCols) * stepSize + colStart +
+                (i & (tileCols - 1))];
+
+        sharedFHTStages<T>(s_data, stepSize, tileCols);
+
+        for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
+            cArray[(i >> log2TileCols) * stepSize + colStart +
+                (i & (tileCols - 1))] = s_data[i];
+        __syncthreads();
+    }
+}
+
+#endif
@@ -0,0 +1,131 @@
+/*
+* Contains the CUDA event based timer used to profile the device work
+* done by each op, together with the wrapper-facing functions that
+* return and reset the CUDA extension's profile.
+*/
+#include <cuda.h>
+#include <cuda_runtime.h>
+#include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include "kernel_timer.h"
+
+// Pending event pairs beyond this are resolved by the op that records
+// the next one, so that long runs do not accumulate events without limit.
+#define MAX_PENDING_KERNEL_TIMINGS 512
+
+
+#ifdef XGPR_PROFILING
+
+//The event pairs recorded by ops that have not yet been resolved. Like the
+//workspace, this is never destroyed.
+struct PendingKernelTimings {
+    std::mutex lock;
+    std::deque<std::pair<cudaEvent_t, cudaEvent_t>> events;
+};
+
+static PendingKernelTimings &getPendingTimings(){
+    static PendingKernelTimings *pending = new PendingKernelTimings();
+    return *pending;
+}
+
+
+//Waits for the oldest numToResolve pending pairs to complete, charges the
+//time between each pair to the kernel phase and destroys the events.
+//Caller must hold the pending timings lock.
+static void resolveKernelTimings(PendingKernelTimings &pending, size_t numToResolve){
+    while (numToResolve > 0 && !pending.events.empty()){
+        std::pair<cudaEvent_t, cudaEvent_t> eventPair = pending.events.front();
+        pending.events.pop_front();
+        numToResolve--;
+
+        float milliseconds = 0;
+        if (cudaEventSynchronize(eventPair.second) == cudaSuccess &&
+                cudaEventElapsedTime(&milliseconds, eventPair.first,
+                    eventPair.second) == cudaSuccess) {
+            NativeProfiler::getInstance().addTime(0, PROFILE_KERNEL,
+                    static_cast<uint64_t>(1e6 * milliseconds));
+        }
+        cudaEventDestroy(eventPair.first);
+        cudaEventDestroy(eventPair.second);
+    }
+}
+
+#endif
+
+
+
+CudaKernelTimer::CudaKernelTimer(cudaStream_t stream, size_t numRows) : stream(stream) {
+#ifdef XGPR_PROFILING
+    if (!NativeProfiler::getInstance().enabled())
+        return;
+    NativeProfiler::getInstance().addCount(0, PROFILE_ROWS, numRows);
+    if (cudaEventCreate(&startEvent) != cudaSuccess){
+        startEvent = NULL;
+        return;
+    }
+    if (cudaEventRecord(startEvent, stream) != cudaSuccess){
+        cudaEventDestroy(startEvent);
+        startEvent = NULL;
+    }
+#else
+    (void)numRows;
+#endif
+}
+
+
+CudaKernelTimer::~CudaKernelTimer(){
+#ifdef XGPR_PROFILING
+    if (startEvent == NULL)
+        return;
+
+    cudaEvent_t stopEvent;
+    if (cudaEventCreate(&stopEvent) != cudaSuccess){
+        cudaEventDestroy(startEvent);
+        return;
+    }
+    if (cudaEventRecord(stopEvent, stream) != cudaSuccess){
+        cudaEventDestroy(startEvent);
+        cudaEventDestroy(stopEvent);
+        return;
+    }
+
+    PendingKernelTimings &pending = getPendingTimings();
+    std::lock_guard<std::mutex> guard(pending.lock);
+    pending.events.emplace_back(startEvent, stopEvent);
+    if (pending.events.size() > MAX_PENDING_KERNEL_TIMINGS)
+        resolveKernelTimings(pending, pending.events.size() / 2);
+#endif
+}
+
+
+
+//Wrapper-facing function that waits for any timed device work that is
+//still pending and returns the profile (see getNativeProfile_).
+nb::dict getCudaProfile_(){
+#ifdef XGPR_PROFILING
+    {
+        nb::gil_scoped_release release;
+        PendingKernelTimings &pending = getPendingTimings();
+        std::lock_guard<std::mutex> guard(pending.lock);
+        resolveKernelTimings(pending, pending.events.size());
+    }
+#endif
+    return getNativeProfile_();
+}
+
+
+//Wrapper-facing function that clears the profile, discarding any
+//timings that are still pending.
+int resetCudaProfile_(){
+#ifdef XGPR_PROFILING
+    {
+        nb::gil_scoped_release release;
+        PendingKernelTimings &pending = getPendingTimings();
+        std::lock_guard<std::mutex> guard(pending.lock);
+        resolveKernelTimings(pending, pending.events.size());
+    }
+#endif
+    return resetNativeProfile_();
+}
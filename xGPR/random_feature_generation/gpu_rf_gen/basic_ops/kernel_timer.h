@@ -0,0 +1,44 @@
+#ifndef CUDA_KERNEL_TIMER_H
+#define CUDA_KERNEL_TIMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <nanobind/nanobind.h>
+#include "device_workspace.h"
+#include "../../native_profiler.h"
+
+namespace nb = nanobind;
+
+
+// Times the device work an op enqueues on its stream when profiling is
+// on (see native_profiler.h). The constructor records a start event on
+// the stream and the destructor a stop event; the pair is only resolved
+// (and charged to the kernel phase) when the profile is read, or once
+// too many pairs are pending, so that the op itself never waits for
+// the device. Does nothing if profiling was off when it was constructed.
+class CudaKernelTimer {
+    public:
+        CudaKernelTimer(cudaStream_t stream, size_t numRows);
+        ~CudaKernelTimer();
+
+        CudaKernelTimer(const CudaKernelTimer&) = delete;
+        CudaKernelTimer &operator=(const CudaKernelTimer&) = delete;
+
+    private:
+        cudaStream_t stream;
+        cudaEvent_t startEvent = NULL;
+};
+
+
+#ifdef XGPR_PROFILING
+#define PROFILE_CUDA_KERNELS(stream, numRows) \
+    CudaKernelTimer cudaKernelTimer(stream, numRows)
+#else
+#define PROFILE_CUDA_KERNELS(stream, numRows)
+#endif
+
+
+nb::dict getCudaProfile_();
+int resetCudaProfile_();
+
+#endif
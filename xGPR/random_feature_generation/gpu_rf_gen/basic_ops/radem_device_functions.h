@@ -0,0 +1,58 @@
+#ifndef CUDA_RADEM_DEVICE_FUNCTIONS_H
+#define CUDA_RADEM_DEVICE_FUNCTIONS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+
+//The diagonal Rademacher matrices used by the SORF operations may be stored
+//either as int8_t, with one +/-1 entry per element, or bit-packed as uint8_t,
+//with bit (j & 7) of byte (j >> 3) of each diagonal set if element j is -1
+//(i.e. the layout produced by np.packbits(radem < 0, axis=2, bitorder="little")).
+//The packed form is 8x smaller, so the diagonals for large numbers of
+//frequencies are far more likely to stay in cache, and is applied by flipping
+//the sign bit of each element rather than by a convert and multiply.
+
+
+//Returns the number of diagonal elements stored in the last dimension of a
+//radem array of type R whose last dimension has length shape2.
+template <typename R>
+inline int getRademLength(size_t shape2){
+    return std::is_same<R, uint8_t>::value ? shape2 * 8 : shape2;
+}
+
+
+//Negates x if flip is 1 by XOR-ing its sign bit.
+__device__ __forceinline__ float flipSign(float x, unsigned int flip){
+    return __int_as_float(__float_as_int(x) ^ static_cast<int>(flip << 31));
+}
+
+__device__ __forceinline__ double flipSign(double x, unsigned int flip){
+    return __longlong_as_double(__double_as_longlong(x) ^
+            (static_cast<long long>(flip) << 63));
+}
+
+
+//Applies element j of diagonal sorfRep (0, 1 or 2) of an int8_t radem array
+//to x; each diagonal carries one Hadamard normalization constant.
+template <typename T>
+__device__ __forceinline__ T applyRademElement(T x, const int8_t *radem, int j,
+        T normConstant, int sorfRep){
+    return x * radem[j] * normConstant;
+}
+
+
+//As above for a bit-packed radem array. The first two diagonals are pure
+//sign flips and the last carries all three normalization constants, which
+//is equivalent since every step of the SORF operation is linear.
+template <typename T>
+__device__ __forceinline__ T applyRademElement(T x, const uint8_t *radem, int j,
+        T normConstant, int sorfRep){
+    T flipped = flipSign(x, (radem[j >> 3] >> (j & 7)) & 1);
+    if (sorfRep < 2)
+        return flipped;
+    return flipped * (normConstant * normConstant * normConstant);
+}
+
+#endif
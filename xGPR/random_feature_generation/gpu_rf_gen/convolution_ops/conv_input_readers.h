@@ -0,0 +1,63 @@
+#ifndef CUDA_CONV_INPUT_READERS_H
+#define CUDA_CONV_INPUT_READERS_H
+
+#include <stdint.h>
+#include "../half_precision.h"
+
+
+//The convolution kernels read their input through one of these, so that the
+//same kernels can be used for dense input and for token IDs. input(row, kmer, i)
+//returns element i of the (convWidth * xDim2) window for the kmer starting
+//at position kmer of row row, and offsetRows returns a reader for the rows
+//starting at row numRows, for callers that work on one block of rows at a time.
+
+
+//Reads a dense (N x D x C) array; element i of a window is element
+//kmer * C + i of the row.
+template <typename T>
+struct DenseConvInput {
+    const T *data;
+    int xDim1, xDim2;
+
+    __device__ compute_t<T> operator()(int row, int kmer, int i) const {
+        return static_cast<compute_t<T>>(data[static_cast<size_t>(row) * xDim1 * xDim2 +
+                kmer * xDim2 + i]);
+    }
+
+    DenseConvInput<T> offsetRows(int numRows) const {
+        return {data + static_cast<size_t>(numRows) * xDim1 * xDim2, xDim1, xDim2};
+    }
+};
+
+
+//Reads an (N x D) array of token IDs together with a (V x C) embedding table
+//whose row t holds the encoding of token t, expanding each window as it is
+//copied into the SORF buffer so the dense (N x D x C) array is never built.
+//The tokens are on the device, so the wrappers cannot cheaply check them;
+//token IDs outside [0, V) are instead read as zero vectors, so that an invalid
+//token cannot cause a read past the end of the embedding table. If embedding
+//is NULL the input is one-hot: token t is read as row t of the (C x C)
+//identity, and vocabSize is C.
+template <typename K, typename T>
+struct TokenConvInput {
+    const K *tokens;
+    const T *embedding;
+    int xDim1, xDim2, vocabSize;
+
+    __device__ T operator()(int row, int kmer, int i) const {
+        int position = i / xDim2;
+        int token = tokens[static_cast<size_t>(row) * xDim1 + kmer + position];
+        if (token < 0 || token >= vocabSize)
+            return 0;
+        if (embedding == NULL)
+            return (i - position * xDim2 == token) ? 1 : 0;
+        return embedding[token * xDim2 + i - position * xDim2];
+    }
+
+    TokenConvInput<K, T> offsetRows(int numRows) const {
+        return {tokens + static_cast<size_t>(numRows) * xDim1, embedding, xDim1,
+            xDim2, vocabSize};
+    }
+};
+
+#endif
@@ -6,50 +6,65 @@
 #include <cuda_runtime.h>
 #include <stdint.h>
 #include <math.h>
+#include <float.h>
 #include "../shared_constants.h"
 #include "../sharedmem.h"
+#include "../basic_ops/fht_device_functions.h"
+#include "../basic_ops/device_workspace.h"
+#include "../basic_ops/kernel_timer.h"
+#include "../basic_ops/basic_array_operations.h"
 #include "convolution.h"
+#include "conv_input_readers.h"
 
 //Generates the FastConv kernel features. This single kernel loops over 1) kmers
 //then 2) the number of repeats then inside that loop 3) the three diagonal
 //matrix multiplications and fast Hadamard transforms before
 //applying 4) diagonal matmul before activation function.
-template <typename T>
-__global__ void convMaxpoolFeatureGenKernel(const T origData[], T cArray[],
-        float *outputArray, const T chiArr[], const int8_t *radem,
+//
+//As for the RBF convolution kernels, each row may be split into several
+//slices (see getConvKmerLayout), each with its own scratch row in cArray
+//and its own row of numFreqs maxima in outputArray, which the caller
+//combines afterwards. input is one of the readers in conv_input_readers.h.
+template <typename T, typename InputReader>
+__global__ void convMaxpoolFeatureGenKernel(InputReader input, compute_t<T> cArray[],
+        float *outputArray, const compute_t<T> chiArr[], const int8_t *radem,
         int paddedBufferSize, int log2N, int numFreqs, int xDim1, int xDim2,
-        int nRepeats, T normConstant, int convWidth,
+        int nRepeats, compute_t<T> normConstant, int convWidth,
         const int32_t *seqlengths, int rademShape2){
 
     int stepSize = MIN(paddedBufferSize, MAX_BASE_LEVEL_TRANSFORM);
     int colCutoff = seqlengths[blockIdx.x] - convWidth + 1;
+    int numSlices = gridDim.y * blockDim.y;
+    int sliceRow = blockIdx.x * numSlices + blockIdx.y * blockDim.y + threadIdx.y;
 
-    SharedMemory<T> shared;
-    T *s_data = shared.getPointer();
-    int spacing, pos = threadIdx.x;
-    int lo, id1, id2;
+    SharedMemory<compute_t<T>> shared;
+    compute_t<T> *s_data = shared.getPointer() + threadIdx.y * stepSize;
     int tempArrPos, chiArrPos = 0, inputCutoff = xDim2 * convWidth;
-    int inputArrPos = (blockIdx.x * xDim1 * xDim2);
-    int outputArrPos = (blockIdx.x * numFreqs);
-    T y, outputVal;
+    int outputArrPos = (sliceRow * numFreqs);
+    compute_t<T> outputVal;
 
     const int8_t *rademPtr = radem;
 
-    //Loop over the kmers in this stretch.
-    for (int kmer = 0; kmer < colCutoff; kmer++){
+    //Loop over the kmers in this stretch. The loop bounds are the same for
+    //every thread in the block so that all threads reach each barrier;
+    //threads whose kmer is past the end of the sequence transform zeros
+    //and do not write any output.
+    for (int kmerStart = blockIdx.y * blockDim.y; kmerStart < colCutoff;
+            kmerStart += numSlices){
+        int kmer = kmerStart + threadIdx.y;
+        bool activeKmer = (kmer < colCutoff);
         chiArrPos = 0;
-        outputArrPos = (blockIdx.x * numFreqs);
-        inputArrPos = (blockIdx.x * xDim1 * xDim2) + kmer * xDim2;
+        outputArrPos = (sliceRow * numFreqs);
 
         //Run over the number of repeats required to generate the random
         //features.
         for (int rep = 0; rep < nRepeats; rep++){
-            tempArrPos = (blockIdx.x << log2N);
+            tempArrPos = (sliceRow << log2N);
 
             //Copy original data into the temporary array.
             for (int i = threadIdx.x; i < paddedBufferSize; i += blockDim.x){
-                if (i < inputCutoff)
-                    cArray[i + tempArrPos] = origData[i + inputArrPos];
+                if (i < inputCutoff && activeKmer)
+                    cArray[i + tempArrPos] = input(blockIdx.x, kmer, i);
                 else
                     cArray[i + tempArrPos] = 0;
             }
@@ -57,7 +72,7 @@ __global__ void convMaxpoolFeatureGenKernel(const T origData[], T cArray[],
             //Run over three repeats for the SORF procedure.
             for (int sorfRep = 0; sorfRep < 3; sorfRep++){
                 rademPtr = radem + paddedBufferSize * rep + sorfRep * rademShape2;
-                tempArrPos = (blockIdx.x << log2N);
+                tempArrPos = (sliceRow << log2N);
 
                 for (int hStep = 0; hStep < paddedBufferSize; hStep+=stepSize){
                     for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
@@ -71,25 +86,7 @@ __global__ void convMaxpoolFeatureGenKernel(const T origData[], T cArray[],
 
                     rademPtr += stepSize;
 
-                    id1 = (pos << 1);
-                    id2 = id1 + 1;
-                    __syncthreads();
-                    y = s_data[id2];
-                    s_data[id2] = s_data[id1] - y;
-                    s_data[id1] += y;
-
-                    for (spacing = 2; spacing < stepSize; spacing <<= 1){
-                        //Equivalent to pos mod spacing if spacing is a power of 2,
-                        //which here is always true.
-                        lo = pos & (spacing - 1);
-                        id1 = ((pos - lo) << 1) + lo;
-                        id2 = id1 + spacing;
-                        __syncthreads();
-                        y = s_data[id2];
-                        s_data[id2] = s_data[id1] - y;
-                        s_data[id1] += y;
-                    }
-                    __syncthreads();
+                    blockFHT<compute_t<T>>(s_data, stepSize);
 
                     for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
                         cArray[i + tempArrPos] = s_data[i];
@@ -98,31 +95,17 @@ __global__ void convMaxpoolFeatureGenKernel(const T origData[], T cArray[],
                     __syncthreads();
                 }
 
-                //A less efficient global memory procedure to complete the FHT
-                //for long arrays.
+                //Complete the FHT for long arrays.
                 if (paddedBufferSize > MAX_BASE_LEVEL_TRANSFORM){
-                    tempArrPos = (blockIdx.x << log2N);
-
-                    for (int spacing = stepSize; spacing < paddedBufferSize; spacing <<= 1){
-
-                        for (int k = 0; k < paddedBufferSize; k += (spacing << 1)){
-                            for (int i = threadIdx.x; i < spacing; i += blockDim.x){
-                                id1 = i + k + tempArrPos;
-                                id2 = id1 + spacing;
-                                y = cArray[id2];
-                                cArray[id2] = cArray[id1] - y;
-                                cArray[id1] += y;
-                            }
-                            __syncthreads();
-                        }
-                    }
+                    stridedFHT<compute_t<T>>(cArray + (sliceRow << log2N), s_data, paddedBufferSize,
+                            stepSize);
                 }
             }
             //Now take the results stored in the temporary array, apply the
             //activation function, and populate the output array.
-            tempArrPos = (blockIdx.x << log2N);
+            tempArrPos = (sliceRow << log2N);
 
-            for (int i = threadIdx.x; i < paddedBufferSize; i += blockDim.x){
+            for (int i = threadIdx.x; i < paddedBufferSize && activeKmer; i += blockDim.x){
                 if ((i + chiArrPos) >= numFreqs)
                     break;
                 outputVal = chiArr[chiArrPos + i] * cArray[tempArrPos + i];
@@ -138,14 +121,108 @@ __global__ void convMaxpoolFeatureGenKernel(const T origData[], T cArray[],
 
 
 
+//Takes the maximum over the per-slice maxima generated by
+//convMaxpoolFeatureGenKernel when each row is split into numSlices
+//slices and the current contents of the output.
+__global__ void maxKmerSlicesKernel(const float *sliceMaxima, float *outputArray,
+        int numRows, int numSlices, int numFreqs){
+    size_t i = static_cast<size_t>(blockIdx.x) * blockDim.x + threadIdx.x;
+    if (i >= static_cast<size_t>(numRows) * numFreqs)
+        return;
+
+    size_t row = i / numFreqs, col = i % numFreqs;
+    const float *slicePtr = sliceMaxima + row * numSlices * numFreqs + col;
+    float maxVal = outputArray[i];
+
+    for (int slice = 0; slice < numSlices; slice++)
+        maxVal = MAX(maxVal, slicePtr[static_cast<size_t>(slice) * numFreqs]);
+
+    outputArray[i] = maxVal;
+}
+
+
+//Sets every element of an array to a single value.
+__global__ void fillFloatArrayKernel(float *array, float value, size_t numElements){
+    size_t i = static_cast<size_t>(blockIdx.x) * blockDim.x + threadIdx.x;
+    if (i < numElements)
+        array[i] = value;
+}
+
+
+
+//Generates the maxpool convolution features for all rows once the caller
+//has checked the inputs and copied the sequence lengths to the device.
+//input is one of the readers in conv_input_readers.h, so that the dense
+//and token-ID wrappers can share this routine.
+template <typename T, typename InputReader>
+static int convMaxpoolGenRows(InputReader input, float *outputPtr,
+        const compute_t<T> *chiPtr, const int8_t *rademPtr, const int32_t *slenCudaPtr,
+        int zDim0, int zDim1, int zDim2, size_t numFreqs, int rademShape2,
+        int maxSeqLength, int convWidth, int paddedBufferSize, cudaStream_t stream){
+    //This is the Hadamard normalization constant.
+    compute_t<T> normConstant = log2(paddedBufferSize) / 2;
+    normConstant = 1 / pow(2, normConstant);
+    int stepSize = MIN(MAX_BASE_LEVEL_TRANSFORM, paddedBufferSize);
+    int log2N = log2(paddedBufferSize);
+
+    int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
+
+    int kmerTiles, windowsPerBlock;
+    int numSlices = getConvKmerLayout(zDim0, maxSeqLength - convWidth + 1, stepSize,
+            MAX(numFreqs, (size_t)paddedBufferSize), kmerTiles, windowsPerBlock);
+
+    compute_t<T> *featureArray = getWorkspaceBuffer<compute_t<T>>(WORKSPACE_FEATURE_SLOT,
+            (size_t)zDim0 * numSlices * paddedBufferSize, stream);
+    if (featureArray == NULL) {
+        throw std::runtime_error("Cuda is out of memory");
+        return 1;
+    };
+
+    dim3 gridSize(zDim0, kmerTiles);
+    dim3 blockSize(stepSize / 2, windowsPerBlock);
+    size_t sharedSize = windowsPerBlock * stepSize * sizeof(compute_t<T>);
+
+    if (numSlices == 1){
+        convMaxpoolFeatureGenKernel<T><<<gridSize, blockSize, sharedSize, stream>>>(input,
+                featureArray, outputPtr, chiPtr, rademPtr, paddedBufferSize, log2N, numFreqs,
+                zDim1, zDim2, numRepeats, normConstant, convWidth, slenCudaPtr, rademShape2);
+        return 0;
+    }
+
+    size_t numElements = static_cast<size_t>(zDim0) * numFreqs;
+    size_t sliceElements = numElements * numSlices;
+    float *sliceMaxima = getWorkspaceBuffer<float>(WORKSPACE_SLICE_SLOT,
+            sliceElements, stream);
+    if (sliceMaxima == NULL) {
+        throw std::runtime_error("Cuda is out of memory");
+        return 1;
+    };
+
+    int fillBlocks = (sliceElements + DEFAULT_THREADS_PER_BLOCK - 1) / DEFAULT_THREADS_PER_BLOCK;
+    int maxBlocks = (numElements + DEFAULT_THREADS_PER_BLOCK - 1) / DEFAULT_THREADS_PER_BLOCK;
+
+    fillFloatArrayKernel<<<fillBlocks, DEFAULT_THREADS_PER_BLOCK, 0, stream>>>(sliceMaxima,
+            -FLT_MAX, sliceElements);
+    convMaxpoolFeatureGenKernel<T><<<gridSize, blockSize, sharedSize, stream>>>(input,
+            featureArray, sliceMaxima, chiPtr, rademPtr, paddedBufferSize, log2N, numFreqs,
+            zDim1, zDim2, numRepeats, normConstant, convWidth, slenCudaPtr, rademShape2);
+    maxKmerSlicesKernel<<<maxBlocks, DEFAULT_THREADS_PER_BLOCK, 0, stream>>>(sliceMaxima,
+            outputPtr, zDim0, numSlices, numFreqs);
+
+    return 0;
+}
+
+
+
+
 //This function generates and sums random features for a Conv1d Maxpool-type kernel.
 template <typename T>
 int conv1dMaxpoolFeatureGen(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
         nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
-        nb::ndarray<T, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<compute_t<T>, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        int convWidth) {
+        int convWidth, uintptr_t streamPtr) {
 
     // Perform safety checks. Any exceptions thrown here are handed off to Python
     // by the Nanobind wrapper. We do not expect the user to see these because
@@ -159,7 +236,7 @@ int conv1dMaxpoolFeatureGen(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cuda
 
     T *inputPtr = static_cast<T*>(inputArr.data());
     float *outputPtr = static_cast<float*>(outputArr.data());
-    T *chiPtr = static_cast<T*>(chiArr.data());
+    compute_t<T> *chiPtr = static_cast<compute_t<T>*>(chiArr.data());
     int8_t *rademPtr = static_cast<int8_t*>(radem.data());
     int32_t *seqlengthsPtr = static_cast<int32_t*>(seqlengths.data());
 
@@ -198,59 +275,165 @@ int conv1dMaxpoolFeatureGen(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cuda
                 "array size.");
     }
 
-    int32_t *slenCudaPtr;
-    if (cudaMalloc(&slenCudaPtr, sizeof(int32_t) * seqlengths.shape(0)) != cudaSuccess) {
-        cudaFree(slenCudaPtr);
+    ScopedCudaDevice deviceGuard(inputArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, inputArr.shape(0));
+    int32_t *slenCudaPtr = copySeqlengthsToDevice(seqlengthsPtr,
+            seqlengths.shape(0), stream);
+    if (slenCudaPtr == NULL) {
         throw std::runtime_error("Cuda is out of memory");
         return 1;
     };
-    if (cudaMemcpy(slenCudaPtr, seqlengthsPtr, sizeof(int32_t) * seqlengths.shape(0),
-                cudaMemcpyHostToDevice) != cudaSuccess){
-        cudaFree(slenCudaPtr);
-        throw std::runtime_error("Cuda is out of memory");
-        return 1;
-    }
 
+    return convMaxpoolGenRows<T>(DenseConvInput<T>{inputPtr, zDim1, zDim2}, outputPtr,
+            chiPtr, rademPtr, slenCudaPtr, zDim0, zDim1, zDim2, numFreqs, radem.shape(2),
+            maxSeqLength, convWidth, paddedBufferSize, stream);
+}
+//Explicitly instantiate so wrapper can use.
+template int conv1dMaxpoolFeatureGen<double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, uintptr_t streamPtr);
+template int conv1dMaxpoolFeatureGen<float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, uintptr_t streamPtr);
+template int conv1dMaxpoolFeatureGen<__half>(nb::ndarray<__half, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, uintptr_t streamPtr);
+template int conv1dMaxpoolFeatureGen<__nv_bfloat16>(nb::ndarray<__nv_bfloat16, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, uintptr_t streamPtr);
 
 
 
-    int numKmers = zDim1 - convWidth + 1;
-    int numElements = zDim0 * numKmers * paddedBufferSize;
 
-    T *featureArray;
-    if (cudaMalloc(&featureArray, sizeof(T) * numElements) != cudaSuccess) {
-        cudaFree(slenCudaPtr);
-        cudaFree(featureArray);
+//As for conv1dMaxpoolFeatureGen, but the input is supplied as an (N x D)
+//array of token IDs together with a (V x C) embedding table whose row t is
+//the encoding of token t, or a (0 x C) table for one-hot input. Each window
+//is expanded from the table as it is read, so the dense input is never
+//built. See conv_input_readers.h.
+template <typename K, typename T>
+int conv1dTokenMaxpoolFeatureGen(nb::ndarray<K, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, uintptr_t streamPtr) {
+
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = tokenArr.shape(0);
+    int zDim1 = tokenArr.shape(1);
+    int zDim2 = embeddingArr.shape(1);
+    size_t numRffs = outputArr.shape(1);
+    size_t numFreqs = chiArr.shape(0);
+
+    K *tokenPtr = static_cast<K*>(tokenArr.data());
+    float *outputPtr = static_cast<float*>(outputArr.data());
+    T *chiPtr = static_cast<T*>(chiArr.data());
+    int8_t *rademPtr = static_cast<int8_t*>(radem.data());
+    int32_t *seqlengthsPtr = static_cast<int32_t*>(seqlengths.data());
+
+    if (tokenArr.shape(0) == 0 || outputArr.shape(0) != tokenArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numRffs < 2 || (numRffs & 1) != 0)
+        throw std::runtime_error("last dim of output must be even number");
+    if ( numFreqs != numRffs || numFreqs > radem.shape(2) )
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    if (seqlengths.shape(0) != tokenArr.shape(0))
+        throw std::runtime_error("wrong array sizes");
+    if (static_cast<int>(tokenArr.shape(1)) < convWidth || convWidth <= 0)
+        throw std::runtime_error("invalid conv_width");
+    if (embeddingArr.shape(1) == 0)
+        throw std::runtime_error("wrong array sizes");
+
+    // An embedding table with no rows stands for the (C x C) identity,
+    // i.e. one-hot input; see conv_input_readers.h.
+    bool oneHotInput = (embeddingArr.shape(0) == 0);
+    int vocabSize = oneHotInput ? embeddingArr.shape(1) : embeddingArr.shape(0);
+    T *embeddingPtr = oneHotInput ? NULL : static_cast<T*>(embeddingArr.data());
+
+    double expectedNFreq = static_cast<double>(convWidth * embeddingArr.shape(1));
+    expectedNFreq = MAX(expectedNFreq, 2);
+    double log2Freqs = std::log2(expectedNFreq);
+    log2Freqs = std::ceil(log2Freqs);
+    int paddedBufferSize = std::pow(2, log2Freqs);
+
+    if (radem.shape(2) % paddedBufferSize != 0)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+
+    int32_t minSeqLength = 2147483647, maxSeqLength = 0;
+    for (size_t i=0; i < seqlengths.shape(0); i++){
+        if (seqlengths(i) > maxSeqLength)
+            maxSeqLength = seqlengths(i);
+        if (seqlengths(i) < minSeqLength)
+            minSeqLength = seqlengths(i);
+    }
+
+    if (maxSeqLength > static_cast<int32_t>(tokenArr.shape(1)) || minSeqLength < convWidth){
+        throw std::runtime_error("All sequence lengths must be >= conv width and < "
+                "array size.");
+    }
+
+    ScopedCudaDevice deviceGuard(tokenArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, tokenArr.shape(0));
+    int32_t *slenCudaPtr = copySeqlengthsToDevice(seqlengthsPtr,
+            seqlengths.shape(0), stream);
+    if (slenCudaPtr == NULL) {
         throw std::runtime_error("Cuda is out of memory");
         return 1;
     };
 
-    //This is the Hadamard normalization constant.
-    T normConstant = log2(paddedBufferSize) / 2;
-    normConstant = 1 / pow(2, normConstant);
-    int stepSize = MIN(MAX_BASE_LEVEL_TRANSFORM, paddedBufferSize);
-    int log2N = log2(paddedBufferSize);
-
-    int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
+    TokenConvInput<K, T> input = {tokenPtr, embeddingPtr, zDim1, zDim2,
+        vocabSize};
 
-    convMaxpoolFeatureGenKernel<T><<<zDim0, stepSize / 2, stepSize * sizeof(T)>>>(inputPtr,
-            featureArray, outputPtr, chiPtr, rademPtr, paddedBufferSize, log2N, numFreqs,
-            zDim1, zDim2, numRepeats, normConstant, convWidth, slenCudaPtr, radem.shape(2));
-
-    cudaFree(slenCudaPtr);
-    cudaFree(featureArray);
-    return 0;
+    return convMaxpoolGenRows<T>(input, outputPtr, chiPtr, rademPtr, slenCudaPtr,
+            zDim0, zDim1, zDim2, numFreqs, radem.shape(2), maxSeqLength, convWidth,
+            paddedBufferSize, stream);
 }
 //Explicitly instantiate so wrapper can use.
-template int conv1dMaxpoolFeatureGen<double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+template int conv1dTokenMaxpoolFeatureGen<uint8_t, double>(nb::ndarray<uint8_t, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
         nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
         nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        int convWidth);
-template int conv1dMaxpoolFeatureGen<float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        int convWidth, uintptr_t streamPtr);
+template int conv1dTokenMaxpoolFeatureGen<uint8_t, float>(nb::ndarray<uint8_t, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, uintptr_t streamPtr);
+template int conv1dTokenMaxpoolFeatureGen<int16_t, double>(nb::ndarray<int16_t, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, uintptr_t streamPtr);
+template int conv1dTokenMaxpoolFeatureGen<int16_t, float>(nb::ndarray<int16_t, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
         nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
         nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        int convWidth);
+        int convWidth, uintptr_t streamPtr);
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <nanobind/nanobind.h>
 #include <nanobind/ndarray.h>
+#include "../half_precision.h"
 
 namespace nb = nanobind;
 
@@ -11,10 +12,19 @@ namespace nb = nanobind;
 
 template <typename T>
 int conv1dMaxpoolFeatureGen(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<compute_t<T>, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, uintptr_t streamPtr);
+
+template <typename K, typename T>
+int conv1dTokenMaxpoolFeatureGen(nb::ndarray<K, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
         nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
         nb::ndarray<T, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        int convWidth);
+        int convWidth, uintptr_t streamPtr);
 
 #endif
@@ -6,33 +6,45 @@
 #include <cuda_runtime.h>
 #include <stdint.h>
 #include <math.h>
+#include <type_traits>
 #include "../shared_constants.h"
 #include "../sharedmem.h"
+#include "../basic_ops/fht_device_functions.h"
+#include "../basic_ops/device_workspace.h"
+#include "../basic_ops/kernel_timer.h"
+#include "../basic_ops/basic_array_operations.h"
 #include "rbf_convolution.h"
+#include "conv_input_readers.h"
 
 //Generates the Conv kernel RBF features. This single kernel loops over 1) kmers
 //then 2) the number of repeats then inside that loop 3) the three diagonal
 //matrix multiplications and fast Hadamard transforms before
 //applying 4) diagonal matmul before activation function.
-template <typename T>
-__global__ void convRBFFeatureGenKernel(const T origData[], T cArray[],
-        double *outputArray, const T chiArr[], const int8_t *radem,
+//
+//Each row may be split into several slices (see getConvKmerLayout): the
+//row is handled by gridDim.y blocks, each of which works on blockDim.y
+//kmers at a time (one per threadIdx.y). Each slice has its own scratch
+//row in cArray and its own row of numFreqs * 2 sums in outputArray; the
+//caller combines the slices for each row afterwards. With a single slice
+//the kernel adds directly to the output row.
+template <typename T, typename InputReader>
+__global__ void convRBFFeatureGenKernel(InputReader input, compute_t<T> cArray[],
+        double *outputArray, const compute_t<T> chiArr[], const int8_t *radem,
         int paddedBufferSize, int log2N, int numFreqs, int xDim1, int xDim2,
-        int nRepeats, int rademShape2, T normConstant,
+        int nRepeats, int rademShape2, compute_t<T> normConstant,
         double scalingConstant, int scalingType,
         int convWidth, const int32_t *seqlengths){
 
     int stepSize = MIN(paddedBufferSize, MAX_BASE_LEVEL_TRANSFORM);
     int colCutoff = seqlengths[blockIdx.x] - convWidth + 1;
+    int numSlices = gridDim.y * blockDim.y;
+    int sliceRow = blockIdx.x * numSlices + blockIdx.y * blockDim.y + threadIdx.y;
 
-    SharedMemory<T> shared;
-    T *s_data = shared.getPointer();
-    int spacing, pos = threadIdx.x;
-    int lo, id1, id2;
+    SharedMemory<compute_t<T>> shared;
+    compute_t<T> *s_data = shared.getPointer() + threadIdx.y * stepSize;
     int tempArrPos, chiArrPos = 0, inputCutoff = xDim2 * convWidth;
-    int inputArrPos = (blockIdx.x * xDim1 * xDim2);
-    int outputArrPos = (blockIdx.x * numFreqs * 2);
-    T y, outputVal, modifiedScaling = scalingConstant;
+    int outputArrPos = (sliceRow * numFreqs * 2);
+    compute_t<T> outputVal, modifiedScaling = scalingConstant;
 
     const int8_t *rademPtr = radem;
 
@@ -47,21 +59,26 @@ __global__ void convRBFFeatureGenKernel(const T origData[], T cArray[],
             break;
     }
 
-    //Loop over the kmers in this stretch.
-    for (int kmer = 0; kmer < colCutoff; kmer++){
+    //Loop over the kmers in this stretch. The loop bounds are the same for
+    //every thread in the block so that all threads reach each barrier;
+    //threads whose kmer is past the end of the sequence transform zeros
+    //and do not write any output.
+    for (int kmerStart = blockIdx.y * blockDim.y; kmerStart < colCutoff;
+            kmerStart += numSlices){
+        int kmer = kmerStart + threadIdx.y;
+        bool activeKmer = (kmer < colCutoff);
         chiArrPos = 0;
-        outputArrPos = (blockIdx.x * numFreqs * 2);
-        inputArrPos = (blockIdx.x * xDim1 * xDim2) + kmer * xDim2;
+        outputArrPos = (sliceRow * numFreqs * 2);
 
         //Run over the number of repeats required to generate the random
         //features.
         for (int rep = 0; rep < nRepeats; rep++){
-            tempArrPos = (blockIdx.x << log2N);
+            tempArrPos = (sliceRow << log2N);
 
             //Copy original data into the temporary array.
             for (int i = threadIdx.x; i < paddedBufferSize; i += blockDim.x){
-                if (i < inputCutoff)
-                    cArray[i + tempArrPos] = origData[i + inputArrPos];
+                if (i < inputCutoff && activeKmer)
+                    cArray[i + tempArrPos] = input(blockIdx.x, kmer, i);
                 else
                     cArray[i + tempArrPos] = 0;
             }
@@ -69,7 +86,7 @@ __global__ void convRBFFeatureGenKernel(const T origData[], T cArray[],
             //Run over three repeats for the SORF procedure.
             for (int sorfRep = 0; sorfRep < 3; sorfRep++){
                 rademPtr = radem + paddedBufferSize * rep + sorfRep * rademShape2;
-                tempArrPos = (blockIdx.x << log2N);
+                tempArrPos = (sliceRow << log2N);
 
                 for (int hStep = 0; hStep < paddedBufferSize; hStep+=stepSize){
                     for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
@@ -83,25 +100,7 @@ __global__ void convRBFFeatureGenKernel(const T origData[], T cArray[],
 
                     rademPtr += stepSize;
 
-                    id1 = (pos << 1);
-                    id2 = id1 + 1;
-                    __syncthreads();
-                    y = s_data[id2];
-                    s_data[id2] = s_data[id1] - y;
-                    s_data[id1] += y;
-
-                    for (spacing = 2; spacing < stepSize; spacing <<= 1){
-                        //Equivalent to pos mod spacing if spacing is a power of 2,
-                        //which here is always true.
-                        lo = pos & (spacing - 1);
-                        id1 = ((pos - lo) << 1) + lo;
-                        id2 = id1 + spacing;
-                        __syncthreads();
-                        y = s_data[id2];
-                        s_data[id2] = s_data[id1] - y;
-                        s_data[id1] += y;
-                    }
-                    __syncthreads();
+                    blockFHT<compute_t<T>>(s_data, stepSize);
 
                     for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
                         cArray[i + tempArrPos] = s_data[i];
@@ -110,33 +109,19 @@ __global__ void convRBFFeatureGenKernel(const T origData[], T cArray[],
                     __syncthreads();
                 }
 
-                //A less efficient global memory procedure to complete the FHT
-                //for long arrays.
+                //Complete the FHT for long arrays.
                 if (paddedBufferSize > MAX_BASE_LEVEL_TRANSFORM){
-                    tempArrPos = (blockIdx.x << log2N);
-
-                    for (int spacing = stepSize; spacing < paddedBufferSize; spacing <<= 1){
-
-                        for (int k = 0; k < paddedBufferSize; k += (spacing << 1)){
-                            for (int i = threadIdx.x; i < spacing; i += blockDim.x){
-                                id1 = i + k + tempArrPos;
-                                id2 = id1 + spacing;
-                                y = cArray[id2];
-                                cArray[id2] = cArray[id1] - y;
-                                cArray[id1] += y;
-                            }
-                            __syncthreads();
-                        }
-                    }
+                    stridedFHT<compute_t<T>>(cArray + (sliceRow << log2N), s_data, paddedBufferSize,
+                            stepSize);
                 }
             }
             //Now take the results stored in the temporary array, apply the
             //activation function, and populate the output array. Note that
             //we multiply by 2 in the output array position since two
             //features are generated for each frequency sampled.
-            tempArrPos = (blockIdx.x << log2N);
+            tempArrPos = (sliceRow << log2N);
 
-            for (int i = threadIdx.x; i < paddedBufferSize; i += blockDim.x){
+            for (int i = threadIdx.x; i < paddedBufferSize && activeKmer; i += blockDim.x){
                 if ((i + chiArrPos) >= numFreqs)
                     break;
                 outputVal = chiArr[chiArrPos + i] * cArray[tempArrPos + i];
@@ -157,27 +142,28 @@ __global__ void convRBFFeatureGenKernel(const T origData[], T cArray[],
 //Generates the Conv kernel RBF features together with the gradient. This single
 //kernel loops over 1) kmers then 2) the number of repeats then inside that
 //loop 3) the three diagonal matrix multiplications and fast Hadamard transforms
-//before applying 4) diagonal matmul before activation function.
-template <typename T>
-__global__ void convRBFFeatureGradKernel(const T origData[], T cArray[],
-        double *outputArray, const T chiArr[], const int8_t *radem,
+//before applying 4) diagonal matmul before activation function. Rows are
+//split into slices in the same way as for convRBFFeatureGenKernel, and the
+//gradient uses the same slice layout as the output.
+template <typename T, typename InputReader>
+__global__ void convRBFFeatureGradKernel(InputReader input, compute_t<T> cArray[],
+        double *outputArray, const compute_t<T> chiArr[], const int8_t *radem,
         int paddedBufferSize, int log2N, int numFreqs, int xDim1, int xDim2,
-        int nRepeats, int rademShape2, T normConstant,
+        int nRepeats, int rademShape2, compute_t<T> normConstant,
         double scalingConstant, int scalingType,
         int convWidth, const int32_t *seqlengths,
-        double *gradient, T sigma){
+        double *gradient, compute_t<T> sigma){
 
     int stepSize = MIN(paddedBufferSize, MAX_BASE_LEVEL_TRANSFORM);
     int colCutoff = seqlengths[blockIdx.x] - convWidth + 1;
+    int numSlices = gridDim.y * blockDim.y;
+    int sliceRow = blockIdx.x * numSlices + blockIdx.y * blockDim.y + threadIdx.y;
 
-    SharedMemory<T> shared;
-    T *s_data = shared.getPointer();
-    int spacing, pos = threadIdx.x;
-    int lo, id1, id2;
+    SharedMemory<compute_t<T>> shared;
+    compute_t<T> *s_data = shared.getPointer() + threadIdx.y * stepSize;
     int tempArrPos, chiArrPos = 0, inputCutoff = xDim2 * convWidth;
-    int inputArrPos = (blockIdx.x * xDim1 * xDim2);
-    int outputArrPos = (blockIdx.x * numFreqs * 2);
-    T y, outputVal, modifiedScaling = scalingConstant;
+    int outputArrPos = (sliceRow * numFreqs * 2);
+    compute_t<T> outputVal, modifiedScaling = scalingConstant;
 
     const int8_t *rademPtr = radem;
 
@@ -192,21 +178,23 @@ __global__ void convRBFFeatureGradKernel(const T origData[], T cArray[],
             break;
     }
 
-    //Loop over the kmers in this stretch.
-    for (int kmer = 0; kmer < colCutoff; kmer++){
+    //Loop over the kmers in this stretch (see convRBFFeatureGenKernel).
+    for (int kmerStart = blockIdx.y * blockDim.y; kmerStart < colCutoff;
+            kmerStart += numSlices){
+        int kmer = kmerStart + threadIdx.y;
+        bool activeKmer = (kmer < colCutoff);
         chiArrPos = 0;
-        outputArrPos = (blockIdx.x * numFreqs * 2);
-        inputArrPos = (blockIdx.x * xDim1 * xDim2) + kmer * xDim2;
+        outputArrPos = (sliceRow * numFreqs * 2);
 
         //Run over the number of repeats required to generate the random
         //features.
         for (int rep = 0; rep < nRepeats; rep++){
-            tempArrPos = (blockIdx.x << log2N);
+            tempArrPos = (sliceRow << log2N);
 
             //Copy original data into the temporary array.
             for (int i = threadIdx.x; i < paddedBufferSize; i += blockDim.x){
-                if (i < inputCutoff)
-                    cArray[i + tempArrPos] = origData[i + inputArrPos];
+                if (i < inputCutoff && activeKmer)
+                    cArray[i + tempArrPos] = input(blockIdx.x, kmer, i);
                 else
                     cArray[i + tempArrPos] = 0;
             }
@@ -214,7 +202,7 @@ __global__ void convRBFFeatureGradKernel(const T origData[], T cArray[],
             //Run over three repeats for the SORF procedure.
             for (int sorfRep = 0; sorfRep < 3; sorfRep++){
                 rademPtr = radem + paddedBufferSize * rep + sorfRep * rademShape2;
-                tempArrPos = (blockIdx.x << log2N);
+                tempArrPos = (sliceRow << log2N);
 
                 for (int hStep = 0; hStep < paddedBufferSize; hStep+=stepSize){
                     for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
@@ -228,25 +216,7 @@ __global__ void convRBFFeatureGradKernel(const T origData[], T cArray[],
 
                     rademPtr += stepSize;
 
-                    id1 = (pos << 1);
-                    id2 = id1 + 1;
-                    __syncthreads();
-                    y = s_data[id2];
-                    s_data[id2] = s_data[id1] - y;
-                    s_data[id1] += y;
-
-                    for (spacing = 2; spacing < stepSize; spacing <<= 1){
-                        //Equivalent to pos mod spacing if spacing is a power of 2,
-                        //which here is always true.
-                        lo = pos & (spacing - 1);
-                        id1 = ((pos - lo) << 1) + lo;
-                        id2 = id1 + spacing;
-                        __syncthreads();
-                        y = s_data[id2];
-                        s_data[id2] = s_data[id1] - y;
-                        s_data[id1] += y;
-                    }
-                    __syncthreads();
+                    blockFHT<compute_t<T>>(s_data, stepSize);
 
                     for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
                         cArray[i + tempArrPos] = s_data[i];
@@ -255,33 +225,19 @@ __global__ void convRBFFeatureGradKernel(const T origData[], T cArray[],
                     __syncthreads();
                 }
 
-                //A less efficient global memory procedure to complete the FHT
-                //for long arrays.
+                //Complete the FHT for long arrays.
                 if (paddedBufferSize > MAX_BASE_LEVEL_TRANSFORM){
-                    tempArrPos = (blockIdx.x << log2N);
-
-                    for (int spacing = stepSize; spacing < paddedBufferSize; spacing <<= 1){
-
-                        for (int k = 0; k < paddedBufferSize; k += (spacing << 1)){
-                            for (int i = threadIdx.x; i < spacing; i += blockDim.x){
-                                id1 = i + k + tempArrPos;
-                                id2 = id1 + spacing;
-                                y = cArray[id2];
-                                cArray[id2] = cArray[id1] - y;
-                                cArray[id1] += y;
-                            }
-                            __syncthreads();
-                        }
-                    }
+                    stridedFHT<compute_t<T>>(cArray + (sliceRow << log2N), s_data, paddedBufferSize,
+                            stepSize);
                 }
             }
             //Now take the results stored in the temporary array, apply the
             //activation function, and populate the output array. Note that
             //we multiply by 2 in the output array position since two
             //features are generated for each frequency sampled.
-            tempArrPos = (blockIdx.x << log2N);
+            tempArrPos = (sliceRow << log2N);
 
-            for (int i = threadIdx.x; i < paddedBufferSize; i += blockDim.x){
+            for (int i = threadIdx.x; i < paddedBufferSize && activeKmer; i += blockDim.x){
                 if ((i + chiArrPos) >= numFreqs)
                     break;
                 outputVal = chiArr[chiArrPos + i] * cArray[tempArrPos + i];
@@ -302,16 +258,207 @@ __global__ void convRBFFeatureGradKernel(const T origData[], T cArray[],
 
 
 
+//Adds the per-slice sums generated by the convolution kernels when each row
+//is split into numSlices slices to the output. The slices for each element
+//are summed in a fixed order, so the result does not depend on how the
+//blocks were scheduled.
+__global__ void sumKmerSlicesKernel(const double *sliceSums, double *outputArray,
+        int numRows, int numSlices, int numRffs){
+    size_t i = static_cast<size_t>(blockIdx.x) * blockDim.x + threadIdx.x;
+    if (i >= static_cast<size_t>(numRows) * numRffs)
+        return;
+
+    size_t row = i / numRffs, col = i % numRffs;
+    const double *slicePtr = sliceSums + row * numSlices * numRffs + col;
+    double sum = 0;
+
+    for (int slice = 0; slice < numSlices; slice++)
+        sum += slicePtr[static_cast<size_t>(slice) * numRffs];
+
+    outputArray[i] += sum;
+}
+
+
+
+
+//Launches convRBFFeatureGenKernel (or, if gradient is not NULL,
+//convRBFFeatureGradKernel) on numRows rows using the layout chosen by
+//getConvKmerLayout, adding the features (and gradient) to outputArray
+//(gradient). If the rows are split into more than one slice, the
+//kernel writes into sliceSums instead (which must have room for
+//numRows * numSlices * numRffs elements, twice that if the gradient
+//is needed), which is then summed into the output. featureArray must
+//have room for numRows * numSlices * paddedBufferSize elements. input
+//is one of the readers in conv_input_readers.h.
+template <typename T, typename InputReader>
+void launchConvRBFKernel(InputReader input, compute_t<T> *featureArray, double *outputArray,
+        double *gradient, double *sliceSums, const compute_t<T> *chiPtr, const int8_t *rademPtr,
+        const int32_t *seqlengths, int numRows, int kmerTiles, int windowsPerBlock,
+        int paddedBufferSize, int numFreqs, int xDim1, int xDim2, int rademShape2,
+        double scalingTerm, int scalingType, int convWidth, compute_t<T> sigma,
+        cudaStream_t stream){
+    int numSlices = kmerTiles * windowsPerBlock;
+    int numRffs = 2 * numFreqs;
+    int stepSize = MIN(MAX_BASE_LEVEL_TRANSFORM, paddedBufferSize);
+    int log2N = log2(paddedBufferSize);
+    int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
+    size_t numElements = static_cast<size_t>(numRows) * numRffs;
+
+    //This is the Hadamard normalization constant.
+    compute_t<T> normConstant = log2(paddedBufferSize) / 2;
+    normConstant = 1 / pow(2, normConstant);
+
+    dim3 gridSize(numRows, kmerTiles);
+    dim3 blockSize(stepSize / 2, windowsPerBlock);
+    size_t sharedSize = windowsPerBlock * stepSize * sizeof(compute_t<T>);
+    double *kernelOutput = outputArray, *kernelGradient = gradient;
+
+    if (numSlices > 1){
+        kernelOutput = sliceSums;
+        kernelGradient = sliceSums + numElements * numSlices;
+        cudaMemsetAsync(sliceSums, 0, sizeof(double) * numElements * numSlices *
+                (gradient == NULL ? 1 : 2), stream);
+    }
+
+    if (gradient == NULL)
+        convRBFFeatureGenKernel<T><<<gridSize, blockSize, sharedSize, stream>>>(input,
+                featureArray, kernelOutput, chiPtr, rademPtr, paddedBufferSize, log2N, numFreqs,
+                xDim1, xDim2, numRepeats, rademShape2, normConstant, scalingTerm, scalingType,
+                convWidth, seqlengths);
+    else
+        convRBFFeatureGradKernel<T><<<gridSize, blockSize, sharedSize, stream>>>(input,
+                featureArray, kernelOutput, chiPtr, rademPtr, paddedBufferSize, log2N, numFreqs,
+                xDim1, xDim2, numRepeats, rademShape2, normConstant, scalingTerm, scalingType,
+                convWidth, seqlengths, kernelGradient, sigma);
+
+    if (numSlices > 1){
+        int sumBlocks = (numElements + DEFAULT_THREADS_PER_BLOCK - 1) / DEFAULT_THREADS_PER_BLOCK;
+        sumKmerSlicesKernel<<<sumBlocks, DEFAULT_THREADS_PER_BLOCK, 0, stream>>>(sliceSums,
+                outputArray, numRows, numSlices, numRffs);
+        if (gradient != NULL)
+            sumKmerSlicesKernel<<<sumBlocks, DEFAULT_THREADS_PER_BLOCK, 0, stream>>>(
+                    kernelGradient, gradient, numRows, numSlices, numRffs);
+    }
+}
+
+
+
+
+//Adds a block of features (or gradients) that was accumulated in double
+//to a lower-precision output array. Used by the convolution routines when
+//the caller supplies a float or half precision output, so that the sum
+//over kmers is still performed in double.
+template <typename U>
+__global__ void addFeatureBlockKernel(const double *featureBlock, U *outputArray,
+        size_t numElements){
+    size_t i = static_cast<size_t>(blockIdx.x) * blockDim.x + threadIdx.x;
+    if (i < numElements)
+        outputArray[i] = static_cast<U>(static_cast<double>(outputArray[i]) + featureBlock[i]);
+}
+
+
+
+
+//Generates and sums the RBF convolution features for all rows once the
+//caller has checked the inputs and copied the sequence lengths to the
+//device. input is one of the readers in conv_input_readers.h, so that the
+//dense and token-ID wrappers can share this routine.
+template <typename T, typename U, typename InputReader>
+static int convRBFGenRows(InputReader input, U *outputPtr, const compute_t<T> *chiPtr,
+        const int8_t *rademPtr, const int32_t *slenCudaPtr, int zDim0, int zDim1,
+        int zDim2, size_t numFreqs, int rademShape2, int maxSeqLength, int convWidth,
+        int paddedBufferSize, int scalingType, cudaStream_t stream){
+    size_t numRffs = 2 * numFreqs;
+    double scalingTerm = std::sqrt(1.0 / static_cast<double>(numFreqs));
+
+    int maxKmers = maxSeqLength - convWidth + 1;
+    int stepSize = MIN(MAX_BASE_LEVEL_TRANSFORM, paddedBufferSize);
+    int kmerTiles, windowsPerBlock;
+
+    if constexpr (std::is_same<U, double>::value) {
+        int numSlices = getConvKmerLayout(zDim0, maxKmers, stepSize,
+                MAX(numRffs, (size_t)paddedBufferSize), kmerTiles, windowsPerBlock);
+
+        compute_t<T> *featureArray = getWorkspaceBuffer<compute_t<T>>(WORKSPACE_FEATURE_SLOT,
+                (size_t)zDim0 * numSlices * paddedBufferSize, stream);
+        if (featureArray == NULL) {
+            throw std::runtime_error("Cuda is out of memory");
+            return 1;
+        };
+        double *sliceSums = NULL;
+        if (numSlices > 1){
+            sliceSums = getWorkspaceBuffer<double>(WORKSPACE_SLICE_SLOT,
+                    (size_t)zDim0 * numSlices * numRffs, stream);
+            if (sliceSums == NULL) {
+                throw std::runtime_error("Cuda is out of memory");
+                return 1;
+            };
+        }
+
+        launchConvRBFKernel<T>(input, featureArray, outputPtr, NULL, sliceSums,
+                chiPtr, rademPtr, slenCudaPtr, zDim0, kmerTiles, windowsPerBlock,
+                paddedBufferSize, numFreqs, zDim1, zDim2, rademShape2, scalingTerm,
+                scalingType, convWidth, 0, stream);
+    } else {
+        //For lower-precision output, generate one block of rows at a time in
+        //double, then add each block to the output.
+        int blockRows = getDesignMatrixBlockRows(zDim0, numRffs);
+        int numSlices = getConvKmerLayout(blockRows, maxKmers, stepSize,
+                MAX(numRffs, (size_t)paddedBufferSize), kmerTiles, windowsPerBlock);
+
+        compute_t<T> *featureArray = getWorkspaceBuffer<compute_t<T>>(WORKSPACE_FEATURE_SLOT,
+                (size_t)blockRows * numSlices * paddedBufferSize, stream);
+        if (featureArray == NULL) {
+            throw std::runtime_error("Cuda is out of memory");
+            return 1;
+        };
+        double *featureBlock = getWorkspaceBuffer<double>(WORKSPACE_BLOCK_SLOT,
+                (size_t)blockRows * numRffs, stream);
+        if (featureBlock == NULL) {
+            throw std::runtime_error("Cuda is out of memory");
+            return 1;
+        };
+        double *sliceSums = NULL;
+        if (numSlices > 1){
+            sliceSums = getWorkspaceBuffer<double>(WORKSPACE_SLICE_SLOT,
+                    (size_t)blockRows * numSlices * numRffs, stream);
+            if (sliceSums == NULL) {
+                throw std::runtime_error("Cuda is out of memory");
+                return 1;
+            };
+        }
+
+        for (int blockStart = 0; blockStart < zDim0; blockStart += blockRows){
+            int currentRows = MIN(blockRows, zDim0 - blockStart);
+            size_t blockElements = static_cast<size_t>(currentRows) * numRffs;
+            int addBlocks = (blockElements + DEFAULT_THREADS_PER_BLOCK - 1) /
+                DEFAULT_THREADS_PER_BLOCK;
+
+            cudaMemsetAsync(featureBlock, 0, sizeof(double) * blockElements, stream);
+            launchConvRBFKernel<T>(input.offsetRows(blockStart),
+                    featureArray, featureBlock, NULL, sliceSums, chiPtr, rademPtr,
+                    slenCudaPtr + blockStart, currentRows, kmerTiles, windowsPerBlock,
+                    paddedBufferSize, numFreqs, zDim1, zDim2, rademShape2, scalingTerm,
+                    scalingType, convWidth, 0, stream);
+            addFeatureBlockKernel<U><<<addBlocks, DEFAULT_THREADS_PER_BLOCK, 0, stream>>>(featureBlock,
+                    outputPtr + (size_t)blockStart * numRffs, blockElements);
+        }
+    }
+
+    return 0;
+}
+
+
 
 
 //This function generates and sums random features for a Conv1d RBF-type kernel.
-template <typename T>
+template <typename T, typename U>
 int convRBFFeatureGen(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
-        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
-        nb::ndarray<T, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<compute_t<T>, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        int convWidth, int scalingType) {
+        int convWidth, int scalingType, uintptr_t streamPtr) {
 
     // Perform safety checks. Any exceptions thrown here are handed off to Python
     // by the Nanobind wrapper. We do not expect the user to see these because
@@ -322,11 +469,10 @@ int convRBFFeatureGen(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cuda, nb::
     int zDim2 = inputArr.shape(2);
     size_t numRffs = outputArr.shape(1);
     size_t numFreqs = chiArr.shape(0);
-    double scalingTerm = std::sqrt(1.0 / static_cast<double>(numFreqs));
 
     T *inputPtr = inputArr.data();
-    double *outputPtr = outputArr.data();
-    T *chiPtr = chiArr.data();
+    U *outputPtr = outputArr.data();
+    compute_t<T> *chiPtr = chiArr.data();
     int8_t *rademPtr = radem.data();
     int32_t *seqlengthsPtr = seqlengths.data();
 
@@ -364,58 +510,158 @@ int convRBFFeatureGen(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cuda, nb::
                 "array size.");
     }
 
-    int32_t *slenCudaPtr;
-    if (cudaMalloc(&slenCudaPtr, sizeof(int32_t) * seqlengths.shape(0)) != cudaSuccess) {
-        cudaFree(slenCudaPtr);
+    ScopedCudaDevice deviceGuard(inputArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, inputArr.shape(0));
+    int32_t *slenCudaPtr = copySeqlengthsToDevice(seqlengthsPtr,
+            seqlengths.shape(0), stream);
+    if (slenCudaPtr == NULL) {
         throw std::runtime_error("Cuda is out of memory");
         return 1;
     };
-    if (cudaMemcpy(slenCudaPtr, seqlengthsPtr, sizeof(int32_t) * seqlengths.shape(0),
-                cudaMemcpyHostToDevice) != cudaSuccess){
-        cudaFree(slenCudaPtr);
-        throw std::runtime_error("Cuda is out of memory");
-        return 1;
-    }
-
-
-    //This is the Hadamard normalization constant.
-    T normConstant = log2(paddedBufferSize) / 2;
-    normConstant = 1 / pow(2, normConstant);
-
-    int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
-    int stepSize = MIN(MAX_BASE_LEVEL_TRANSFORM, paddedBufferSize);
-    int log2N = log2(paddedBufferSize);
-
-    T *featureArray;
-    if (cudaMalloc(&featureArray, sizeof(T) * zDim0 * paddedBufferSize) != cudaSuccess) {
-        cudaFree(slenCudaPtr);
-        cudaFree(featureArray);
-        throw std::runtime_error("Cuda is out of memory");
-        return 1;
-    };
-
-    convRBFFeatureGenKernel<T><<<zDim0, stepSize / 2, stepSize * sizeof(T)>>>(inputPtr,
-            featureArray, outputPtr, chiPtr, rademPtr, paddedBufferSize, log2N, numFreqs, zDim1, zDim2,
-            numRepeats, radem.shape(2), normConstant, scalingTerm, scalingType, convWidth,
-            slenCudaPtr);
 
-    cudaFree(slenCudaPtr);
-    cudaFree(featureArray);
-    return 0;
+    return convRBFGenRows<T, U>(DenseConvInput<T>{inputPtr, zDim1, zDim2}, outputPtr,
+            chiPtr, rademPtr, slenCudaPtr, zDim0, zDim1, zDim2, numFreqs, radem.shape(2),
+            maxSeqLength, convWidth, paddedBufferSize, scalingType, stream);
 }
 //Explicitly instantiate so wrapper can use.
-template int convRBFFeatureGen<double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+template int convRBFFeatureGen<double, double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
         nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        int convWidth, int scalingType);
-template int convRBFFeatureGen<float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFFeatureGen<float, double>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
         nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        int convWidth, int scalingType);
+        int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFFeatureGen<float, float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFFeatureGen<__half, float>(nb::ndarray<__half, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFFeatureGen<__half, __half>(nb::ndarray<__half, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<__half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFFeatureGen<__nv_bfloat16, float>(nb::ndarray<__nv_bfloat16, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFFeatureGen<__nv_bfloat16, __nv_bfloat16>(nb::ndarray<__nv_bfloat16, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<__nv_bfloat16, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, uintptr_t streamPtr);
+
+
+
+//As for convRBFGenRows, but also calculates the gradient, which is added
+//to gradientPtr.
+template <typename T, typename U, typename InputReader>
+static int convRBFGradRows(InputReader input, U *outputPtr, U *gradientPtr,
+        const compute_t<T> *chiPtr, const int8_t *rademPtr, const int32_t *slenCudaPtr,
+        int zDim0, int zDim1, int zDim2, size_t numFreqs, int rademShape2,
+        int maxSeqLength, int convWidth, int paddedBufferSize, double sigma,
+        int scalingType, cudaStream_t stream){
+    size_t numRffs = 2 * numFreqs;
+    double scalingTerm = std::sqrt(1.0 / static_cast<double>(numFreqs));
+
+    int maxKmers = maxSeqLength - convWidth + 1;
+    int stepSize = MIN(MAX_BASE_LEVEL_TRANSFORM, paddedBufferSize);
+    int kmerTiles, windowsPerBlock;
+
+    if constexpr (std::is_same<U, double>::value) {
+        int numSlices = getConvKmerLayout(zDim0, maxKmers, stepSize,
+                MAX(2 * numRffs, (size_t)paddedBufferSize), kmerTiles, windowsPerBlock);
+
+        compute_t<T> *featureArray = getWorkspaceBuffer<compute_t<T>>(WORKSPACE_FEATURE_SLOT,
+                (size_t)zDim0 * numSlices * paddedBufferSize, stream);
+        if (featureArray == NULL) {
+            throw std::runtime_error("Cuda is out of memory");
+            return 1;
+        };
+        double *sliceSums = NULL;
+        if (numSlices > 1){
+            sliceSums = getWorkspaceBuffer<double>(WORKSPACE_SLICE_SLOT,
+                    (size_t)2 * zDim0 * numSlices * numRffs, stream);
+            if (sliceSums == NULL) {
+                throw std::runtime_error("Cuda is out of memory");
+                return 1;
+            };
+        }
+
+        launchConvRBFKernel<T>(input, featureArray, outputPtr, gradientPtr, sliceSums,
+                chiPtr, rademPtr, slenCudaPtr, zDim0, kmerTiles, windowsPerBlock,
+                paddedBufferSize, numFreqs, zDim1, zDim2, rademShape2, scalingTerm,
+                scalingType, convWidth, static_cast<compute_t<T>>(sigma), stream);
+    } else {
+        //For lower-precision output, generate one block of rows at a time in
+        //double, then add each block to the output and gradient.
+        int blockRows = getDesignMatrixBlockRows(zDim0, numRffs);
+        int numSlices = getConvKmerLayout(blockRows, maxKmers, stepSize,
+                MAX(2 * numRffs, (size_t)paddedBufferSize), kmerTiles, windowsPerBlock);
+
+        compute_t<T> *featureArray = getWorkspaceBuffer<compute_t<T>>(WORKSPACE_FEATURE_SLOT,
+                (size_t)blockRows * numSlices * paddedBufferSize, stream);
+        if (featureArray == NULL) {
+            throw std::runtime_error("Cuda is out of memory");
+            return 1;
+        };
+        double *featureBlock = getWorkspaceBuffer<double>(WORKSPACE_BLOCK_SLOT,
+                (size_t)2 * blockRows * numRffs, stream);
+        if (featureBlock == NULL) {
+            throw std::runtime_error("Cuda is out of memory");
+            return 1;
+        };
+        double *gradientBlock = featureBlock + static_cast<size_t>(blockRows) * numRffs;
+        double *sliceSums = NULL;
+        if (numSlices > 1){
+            sliceSums = getWorkspaceBuffer<double>(WORKSPACE_SLICE_SLOT,
+                    (size_t)2 * blockRows * numSlices * numRffs, stream);
+            if (sliceSums == NULL) {
+                throw std::runtime_error("Cuda is out of memory");
+                return 1;
+            };
+        }
+
+        for (int blockStart = 0; blockStart < zDim0; blockStart += blockRows){
+            int currentRows = MIN(blockRows, zDim0 - blockStart);
+            size_t blockElements = static_cast<size_t>(currentRows) * numRffs;
+            int addBlocks = (blockElements + DEFAULT_THREADS_PER_BLOCK - 1) /
+                DEFAULT_THREADS_PER_BLOCK;
+
+            cudaMemsetAsync(featureBlock, 0, sizeof(double) * blockElements, stream);
+            cudaMemsetAsync(gradientBlock, 0, sizeof(double) * blockElements, stream);
+            launchConvRBFKernel<T>(input.offsetRows(blockStart),
+                    featureArray, featureBlock, gradientBlock, sliceSums, chiPtr, rademPtr,
+                    slenCudaPtr + blockStart, currentRows, kmerTiles, windowsPerBlock,
+                    paddedBufferSize, numFreqs, zDim1, zDim2, rademShape2, scalingTerm,
+                    scalingType, convWidth, static_cast<compute_t<T>>(sigma), stream);
+            addFeatureBlockKernel<U><<<addBlocks, DEFAULT_THREADS_PER_BLOCK, 0, stream>>>(featureBlock,
+                    outputPtr + (size_t)blockStart * numRffs, blockElements);
+            addFeatureBlockKernel<U><<<addBlocks, DEFAULT_THREADS_PER_BLOCK, 0, stream>>>(gradientBlock,
+                    gradientPtr + (size_t)blockStart * numRffs, blockElements);
+        }
+    }
+
+    return 0;
+}
+
 
 
 
@@ -426,14 +672,14 @@ template int convRBFFeatureGen<float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb
 //in cases where all of the features share the same
 //lengthscale; ARD-type kernels require a more complicated
 //gradient calculation not implemented here.
-template <typename T>
+template <typename T, typename U>
 int convRBFFeatureGrad(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
-        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
-        nb::ndarray<T, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<compute_t<T>, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
-        double sigma, int convWidth, int scalingType) {
+        nb::ndarray<U, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, uintptr_t streamPtr) {
 
     // Perform safety checks. Any exceptions thrown here are handed off to Python
     // by the Nanobind wrapper. We do not expect the user to see these because
@@ -444,14 +690,13 @@ int convRBFFeatureGrad(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cuda, nb:
     int zDim2 = inputArr.shape(2);
     size_t numRffs = outputArr.shape(1);
     size_t numFreqs = chiArr.shape(0);
-    double scalingTerm = std::sqrt(1.0 / static_cast<double>(numFreqs));
 
     T *inputPtr = inputArr.data();
-    double *outputPtr = outputArr.data();
-    T *chiPtr = chiArr.data();
+    U *outputPtr = outputArr.data();
+    compute_t<T> *chiPtr = chiArr.data();
     int8_t *rademPtr = radem.data();
     int32_t *seqlengthsPtr = seqlengths.data();
-    double *gradientPtr = gradArr.data();
+    U *gradientPtr = gradArr.data();
 
     if (inputArr.shape(0) == 0 || outputArr.shape(0) != inputArr.shape(0))
         throw std::runtime_error("no datapoints");
@@ -490,59 +735,662 @@ int convRBFFeatureGrad(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cuda, nb:
                 "array size.");
     }
 
-    int32_t *slenCudaPtr;
-    if (cudaMalloc(&slenCudaPtr, sizeof(int32_t) * seqlengths.shape(0)) != cudaSuccess) {
-        cudaFree(slenCudaPtr);
+    ScopedCudaDevice deviceGuard(inputArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, inputArr.shape(0));
+    int32_t *slenCudaPtr = copySeqlengthsToDevice(seqlengthsPtr,
+            seqlengths.shape(0), stream);
+    if (slenCudaPtr == NULL) {
         throw std::runtime_error("Cuda is out of memory");
         return 1;
     };
-    if (cudaMemcpy(slenCudaPtr, seqlengthsPtr, sizeof(int32_t) * seqlengths.shape(0),
-                cudaMemcpyHostToDevice) != cudaSuccess){
-        cudaFree(slenCudaPtr);
+
+    return convRBFGradRows<T, U>(DenseConvInput<T>{inputPtr, zDim1, zDim2}, outputPtr,
+            gradientPtr, chiPtr, rademPtr, slenCudaPtr, zDim0, zDim1, zDim2, numFreqs,
+            radem.shape(2), maxSeqLength, convWidth, paddedBufferSize, sigma,
+            scalingType, stream);
+}
+//Explicitly instantiate so wrapper can use.
+template int convRBFFeatureGrad<double, double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFFeatureGrad<float, double>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFFeatureGrad<float, float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<float, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFFeatureGrad<__half, float>(nb::ndarray<__half, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<float, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFFeatureGrad<__nv_bfloat16, float>(nb::ndarray<__nv_bfloat16, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<float, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, uintptr_t streamPtr);
+
+
+
+
+//As for convRBFFeatureGen, but the input is supplied as an (N x D) array of
+//token IDs together with a (V x C) embedding table whose row t is the
+//encoding of token t. A (0 x C) table stands for the (C x C) identity, i.e.
+//one-hot input; since the SORF is linear, any scaling of the input can then
+//be applied to chiArr instead. Each window is expanded from the table as it
+//is read, so the dense input is never built. See conv_input_readers.h. The
+//token ops are exposed by the extension only; the kernel classes and
+//OfflineDataset do not yet call them.
+template <typename K, typename T, typename U>
+int convRBFTokenFeatureGen(nb::ndarray<K, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, uintptr_t streamPtr) {
+
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = tokenArr.shape(0);
+    int zDim1 = tokenArr.shape(1);
+    int zDim2 = embeddingArr.shape(1);
+    size_t numRffs = outputArr.shape(1);
+    size_t numFreqs = chiArr.shape(0);
+
+    K *tokenPtr = tokenArr.data();
+    U *outputPtr = outputArr.data();
+    T *chiPtr = chiArr.data();
+    int8_t *rademPtr = radem.data();
+    int32_t *seqlengthsPtr = seqlengths.data();
+
+    if (tokenArr.shape(0) == 0 || outputArr.shape(0) != tokenArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numRffs < 2 || (numRffs & 1) != 0)
+        throw std::runtime_error("last dim of output must be even number");
+    if ( (2 * numFreqs) != numRffs || numFreqs > radem.shape(2) )
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    if (seqlengths.shape(0) != tokenArr.shape(0))
+        throw std::runtime_error("wrong array sizes");
+    if (static_cast<int>(tokenArr.shape(1)) < convWidth || convWidth <= 0)
+        throw std::runtime_error("invalid conv_width");
+    if (embeddingArr.shape(1) == 0)
+        throw std::runtime_error("wrong array sizes");
+
+    // An embedding table with no rows stands for the (C x C) identity,
+    // i.e. one-hot input; see conv_input_readers.h.
+    bool oneHotInput = (embeddingArr.shape(0) == 0);
+    int vocabSize = oneHotInput ? embeddingArr.shape(1) : embeddingArr.shape(0);
+    T *embeddingPtr = oneHotInput ? NULL : static_cast<T*>(embeddingArr.data());
+
+    double expectedNFreq = static_cast<double>(convWidth * embeddingArr.shape(1));
+    expectedNFreq = MAX(expectedNFreq, 2);
+    double log2Freqs = std::log2(expectedNFreq);
+    log2Freqs = std::ceil(log2Freqs);
+    int paddedBufferSize = std::pow(2, log2Freqs);
+
+    if (radem.shape(2) % paddedBufferSize != 0)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    int32_t minSeqLength = 2147483647, maxSeqLength = 0;
+    for (size_t i=0; i < seqlengths.shape(0); i++){
+        if (seqlengths(i) > maxSeqLength)
+            maxSeqLength = seqlengths(i);
+        if (seqlengths(i) < minSeqLength)
+            minSeqLength = seqlengths(i);
+    }
+
+    if (maxSeqLength > static_cast<int32_t>(tokenArr.shape(1)) || minSeqLength < convWidth){
+        throw std::runtime_error("All sequence lengths must be >= conv width and < "
+                "array size.");
+    }
+
+    ScopedCudaDevice deviceGuard(tokenArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, tokenArr.shape(0));
+    int32_t *slenCudaPtr = copySeqlengthsToDevice(seqlengthsPtr,
+            seqlengths.shape(0), stream);
+    if (slenCudaPtr == NULL) {
         throw std::runtime_error("Cuda is out of memory");
         return 1;
+    };
+
+    TokenConvInput<K, T> input = {tokenPtr, embeddingPtr, zDim1, zDim2,
+        vocabSize};
+
+    return convRBFGenRows<T, U>(input, outputPtr, chiPtr, rademPtr, slenCudaPtr,
+            zDim0, zDim1, zDim2, numFreqs, radem.shape(2), maxSeqLength, convWidth,
+            paddedBufferSize, scalingType, stream);
+}
+//Explicitly instantiate so wrapper can use.
+template int convRBFTokenFeatureGen<uint8_t, double, double>(nb::ndarray<uint8_t, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFTokenFeatureGen<uint8_t, float, double>(nb::ndarray<uint8_t, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFTokenFeatureGen<uint8_t, float, float>(nb::ndarray<uint8_t, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFTokenFeatureGen<int16_t, double, double>(nb::ndarray<int16_t, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFTokenFeatureGen<int16_t, float, double>(nb::ndarray<int16_t, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFTokenFeatureGen<int16_t, float, float>(nb::ndarray<int16_t, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, uintptr_t streamPtr);
+
+
+
+
+//As for convRBFFeatureGrad, but the input is supplied as token IDs together
+//with an embedding table, as for convRBFTokenFeatureGen. As for
+//convRBFFeatureGrad, the embedding table should not be multiplied by sigma.
+template <typename K, typename T, typename U>
+int convRBFTokenFeatureGrad(nb::ndarray<K, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<T, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<U, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, uintptr_t streamPtr) {
+
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = tokenArr.shape(0);
+    int zDim1 = tokenArr.shape(1);
+    int zDim2 = embeddingArr.shape(1);
+    size_t numRffs = outputArr.shape(1);
+    size_t numFreqs = chiArr.shape(0);
+
+    K *tokenPtr = tokenArr.data();
+    U *outputPtr = outputArr.data();
+    T *chiPtr = chiArr.data();
+    int8_t *rademPtr = radem.data();
+    int32_t *seqlengthsPtr = seqlengths.data();
+    U *gradientPtr = gradArr.data();
+
+    if (tokenArr.shape(0) == 0 || outputArr.shape(0) != tokenArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numRffs < 2 || (numRffs & 1) != 0)
+        throw std::runtime_error("last dim of output must be even number");
+    if ( (2 * numFreqs) != numRffs || numFreqs > radem.shape(2) )
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    if (seqlengths.shape(0) != tokenArr.shape(0))
+        throw std::runtime_error("wrong array sizes");
+    if (static_cast<int>(tokenArr.shape(1)) < convWidth || convWidth <= 0)
+        throw std::runtime_error("invalid conv_width");
+    if (embeddingArr.shape(1) == 0)
+        throw std::runtime_error("wrong array sizes");
+
+    // An embedding table with no rows stands for the (C x C) identity,
+    // i.e. one-hot input; see conv_input_readers.h.
+    bool oneHotInput = (embeddingArr.shape(0) == 0);
+    int vocabSize = oneHotInput ? embeddingArr.shape(1) : embeddingArr.shape(0);
+    T *embeddingPtr = oneHotInput ? NULL : static_cast<T*>(embeddingArr.data());
+
+    if (gradArr.shape(0) != outputArr.shape(0) || gradArr.shape(1) != outputArr.shape(1))
+        throw std::runtime_error("wrong array sizes");
+
+    double expectedNFreq = static_cast<double>(convWidth * embeddingArr.shape(1));
+    expectedNFreq = MAX(expectedNFreq, 2);
+    double log2Freqs = std::log2(expectedNFreq);
+    log2Freqs = std::ceil(log2Freqs);
+    int paddedBufferSize = std::pow(2, log2Freqs);
+
+    if (radem.shape(2) % paddedBufferSize != 0)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    int32_t minSeqLength = 2147483647, maxSeqLength = 0;
+    for (size_t i=0; i < seqlengths.shape(0); i++){
+        if (seqlengths(i) > maxSeqLength)
+            maxSeqLength = seqlengths(i);
+        if (seqlengths(i) < minSeqLength)
+            minSeqLength = seqlengths(i);
     }
 
+    if (maxSeqLength > static_cast<int32_t>(tokenArr.shape(1)) || minSeqLength < convWidth){
+        throw std::runtime_error("All sequence lengths must be >= conv width and < "
+                "array size.");
+    }
 
+    ScopedCudaDevice deviceGuard(tokenArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, tokenArr.shape(0));
+    int32_t *slenCudaPtr = copySeqlengthsToDevice(seqlengthsPtr,
+            seqlengths.shape(0), stream);
+    if (slenCudaPtr == NULL) {
+        throw std::runtime_error("Cuda is out of memory");
+        return 1;
+    };
 
+    TokenConvInput<K, T> input = {tokenPtr, embeddingPtr, zDim1, zDim2,
+        vocabSize};
 
-    //This is the Hadamard normalization constant.
-    T normConstant = log2(paddedBufferSize) / 2;
-    normConstant = 1 / pow(2, normConstant);
+    return convRBFGradRows<T, U>(input, outputPtr, gradientPtr, chiPtr, rademPtr,
+            slenCudaPtr, zDim0, zDim1, zDim2, numFreqs, radem.shape(2), maxSeqLength,
+            convWidth, paddedBufferSize, sigma, scalingType, stream);
+}
+//Explicitly instantiate so wrapper can use.
+template int convRBFTokenFeatureGrad<uint8_t, double, double>(nb::ndarray<uint8_t, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFTokenFeatureGrad<uint8_t, float, double>(nb::ndarray<uint8_t, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFTokenFeatureGrad<uint8_t, float, float>(nb::ndarray<uint8_t, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<float, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFTokenFeatureGrad<int16_t, double, double>(nb::ndarray<int16_t, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFTokenFeatureGrad<int16_t, float, double>(nb::ndarray<int16_t, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, uintptr_t streamPtr);
+template int convRBFTokenFeatureGrad<int16_t, float, float>(nb::ndarray<int16_t, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> tokenArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> embeddingArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        nb::ndarray<float, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        double sigma, int convWidth, int scalingType, uintptr_t streamPtr);
 
-    int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
+
+
+
+//This function generates and sums random features for a Conv1d RBF-type
+//kernel one block of rows at a time, adding Z^T Z and Z^T y for each block
+//to zTzArr and zTyArr so that the full feature array is never stored.
+template <typename T>
+int convRBFDesignMatrix(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> zTyArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<compute_t<T>, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, bool fitIntercept, uintptr_t streamPtr) {
+
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = inputArr.shape(0);
+    int zDim1 = inputArr.shape(1);
+    int zDim2 = inputArr.shape(2);
+    size_t numRffs = zTzArr.shape(1);
+    size_t numFreqs = chiArr.shape(0);
+    double scalingTerm = std::sqrt(1.0 / static_cast<double>(numFreqs));
+
+    T *inputPtr = inputArr.data();
+    double *yPtr = yArr.data();
+    double *zTzPtr = zTzArr.data();
+    double *zTyPtr = zTyArr.data();
+    compute_t<T> *chiPtr = chiArr.data();
+    int8_t *rademPtr = radem.data();
+    int32_t *seqlengthsPtr = seqlengths.data();
+
+    if (inputArr.shape(0) == 0 || yArr.shape(0) != inputArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numRffs < 2 || (numRffs & 1) != 0)
+        throw std::runtime_error("last dim of output must be even number");
+    if (zTzArr.shape(0) != numRffs || zTyArr.shape(0) != numRffs)
+        throw std::runtime_error("wrong array sizes");
+    if ( (2 * numFreqs) != numRffs || numFreqs > radem.shape(2) )
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    if (seqlengths.shape(0) != inputArr.shape(0))
+        throw std::runtime_error("wrong array sizes");
+    if (static_cast<int>(inputArr.shape(1)) < convWidth || convWidth <= 0)
+        throw std::runtime_error("invalid conv_width");
+
+    double expectedNFreq = static_cast<double>(convWidth * inputArr.shape(2));
+    expectedNFreq = MAX(expectedNFreq, 2);
+    double log2Freqs = std::log2(expectedNFreq);
+    log2Freqs = std::ceil(log2Freqs);
+    int paddedBufferSize = std::pow(2, log2Freqs);
+
+    if (radem.shape(2) % paddedBufferSize != 0)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    int32_t minSeqLength = 2147483647, maxSeqLength = 0;
+    for (size_t i=0; i < seqlengths.shape(0); i++){
+        if (seqlengths(i) > maxSeqLength)
+            maxSeqLength = seqlengths(i);
+        if (seqlengths(i) < minSeqLength)
+            minSeqLength = seqlengths(i);
+    }
+
+    if (maxSeqLength > static_cast<int32_t>(inputArr.shape(1)) || minSeqLength < convWidth){
+        throw std::runtime_error("All sequence lengths must be >= conv width and < "
+                "array size.");
+    }
+
+    ScopedCudaDevice deviceGuard(inputArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, inputArr.shape(0));
+    int32_t *slenCudaPtr = copySeqlengthsToDevice(seqlengthsPtr,
+            seqlengths.shape(0), stream);
+    if (slenCudaPtr == NULL) {
+        throw std::runtime_error("Cuda is out of memory");
+        return 1;
+    };
+
+
+    int maxKmers = maxSeqLength - convWidth + 1;
     int stepSize = MIN(MAX_BASE_LEVEL_TRANSFORM, paddedBufferSize);
-    int log2N = log2(paddedBufferSize);
+    int blockRows = getDesignMatrixBlockRows(zDim0, numRffs);
+    int kmerTiles, windowsPerBlock;
+    int numSlices = getConvKmerLayout(blockRows, maxKmers, stepSize,
+            MAX(numRffs, (size_t)paddedBufferSize), kmerTiles, windowsPerBlock);
+
+    compute_t<T> *featureArray = getWorkspaceBuffer<compute_t<T>>(WORKSPACE_FEATURE_SLOT,
+            (size_t)blockRows * numSlices * paddedBufferSize, stream);
+    if (featureArray == NULL) {
+        throw std::runtime_error("Cuda is out of memory");
+        return 1;
+    };
+    double *featureBlock = getWorkspaceBuffer<double>(WORKSPACE_BLOCK_SLOT,
+            (size_t)blockRows * numRffs, stream);
+    if (featureBlock == NULL) {
+        throw std::runtime_error("Cuda is out of memory");
+        return 1;
+    };
+    double *sliceSums = NULL;
+    if (numSlices > 1){
+        sliceSums = getWorkspaceBuffer<double>(WORKSPACE_SLICE_SLOT,
+                (size_t)blockRows * numSlices * numRffs, stream);
+        if (sliceSums == NULL) {
+            throw std::runtime_error("Cuda is out of memory");
+            return 1;
+        };
+    }
+
+    for (int blockStart = 0; blockStart < zDim0; blockStart += blockRows){
+        int currentRows = MIN(blockRows, zDim0 - blockStart);
+
+        //The feature generation kernel adds to the output, so it must
+        //be zeroed first.
+        cudaMemsetAsync(featureBlock, 0, sizeof(double) * currentRows * numRffs, stream);
+        launchConvRBFKernel<T>(DenseConvInput<T>{inputPtr, zDim1, zDim2}.offsetRows(blockStart),
+                featureArray, featureBlock, NULL, sliceSums, chiPtr, rademPtr,
+                slenCudaPtr + blockStart, currentRows, kmerTiles, windowsPerBlock,
+                paddedBufferSize, numFreqs, zDim1, zDim2, radem.shape(2), scalingTerm,
+                scalingType, convWidth, 0, stream);
+        cudaAccumulateGram(featureBlock, yPtr + blockStart, zTzPtr, zTyPtr,
+                currentRows, numRffs, fitIntercept, stream);
+    }
+
+    return 0;
+}
+//Explicitly instantiate so wrapper can use.
+template int convRBFDesignMatrix<double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> zTyArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, bool fitIntercept, uintptr_t streamPtr);
+template int convRBFDesignMatrix<float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> zTyArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, bool fitIntercept, uintptr_t streamPtr);
+template int convRBFDesignMatrix<__half>(nb::ndarray<__half, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> zTyArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, bool fitIntercept, uintptr_t streamPtr);
+template int convRBFDesignMatrix<__nv_bfloat16>(nb::ndarray<__nv_bfloat16, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> zTyArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, bool fitIntercept, uintptr_t streamPtr);
+
 
-    T *featureArray;
-    if (cudaMalloc(&featureArray, sizeof(T) * zDim0 * paddedBufferSize) != cudaSuccess) {
-        cudaFree(slenCudaPtr);
-        cudaFree(featureArray);
+//Generates random features for RBF-based convolution kernels one block
+//of rows at a time and adds Z^T (Z V) for a batch of vectors V to
+//outputArr, without storing the full feature array.
+template <typename T>
+int convRBFMatvec(nb::ndarray<T, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> vecArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<compute_t<T>, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, bool fitIntercept, uintptr_t streamPtr) {
+
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = inputArr.shape(0);
+    int zDim1 = inputArr.shape(1);
+    int zDim2 = inputArr.shape(2);
+    size_t numRffs = vecArr.shape(0);
+    int numVecs = vecArr.shape(1);
+    size_t numFreqs = chiArr.shape(0);
+    double scalingTerm = std::sqrt(1.0 / static_cast<double>(numFreqs));
+
+    T *inputPtr = inputArr.data();
+    double *vecPtr = vecArr.data();
+    double *outputPtr = outputArr.data();
+    compute_t<T> *chiPtr = chiArr.data();
+    int8_t *rademPtr = radem.data();
+    int32_t *seqlengthsPtr = seqlengths.data();
+
+    if (inputArr.shape(0) == 0)
+        throw std::runtime_error("no datapoints");
+    if (numRffs < 2 || (numRffs & 1) != 0)
+        throw std::runtime_error("last dim of output must be even number");
+    if (numVecs == 0 || outputArr.shape(0) != numRffs ||
+            outputArr.shape(1) != vecArr.shape(1))
+        throw std::runtime_error("wrong array sizes");
+    if ( (2 * numFreqs) != numRffs || numFreqs > radem.shape(2) )
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    if (seqlengths.shape(0) != inputArr.shape(0))
+        throw std::runtime_error("wrong array sizes");
+    if (static_cast<int>(inputArr.shape(1)) < convWidth || convWidth <= 0)
+        throw std::runtime_error("invalid conv_width");
+
+    double expectedNFreq = static_cast<double>(convWidth * inputArr.shape(2));
+    expectedNFreq = MAX(expectedNFreq, 2);
+    double log2Freqs = std::log2(expectedNFreq);
+    log2Freqs = std::ceil(log2Freqs);
+    int paddedBufferSize = std::pow(2, log2Freqs);
+
+    if (radem.shape(2) % paddedBufferSize != 0)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    int32_t minSeqLength = 2147483647, maxSeqLength = 0;
+    for (size_t i=0; i < seqlengths.shape(0); i++){
+        if (seqlengths(i) > maxSeqLength)
+            maxSeqLength = seqlengths(i);
+        if (seqlengths(i) < minSeqLength)
+            minSeqLength = seqlengths(i);
+    }
+
+    if (maxSeqLength > static_cast<int32_t>(inputArr.shape(1)) || minSeqLength < convWidth){
+        throw std::runtime_error("All sequence lengths must be >= conv width and < "
+                "array size.");
+    }
+
+    ScopedCudaDevice deviceGuard(inputArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, inputArr.shape(0));
+    int32_t *slenCudaPtr = copySeqlengthsToDevice(seqlengthsPtr,
+            seqlengths.shape(0), stream);
+    if (slenCudaPtr == NULL) {
+        throw std::runtime_error("Cuda is out of memory");
+        return 1;
+    };
+
+
+    int maxKmers = maxSeqLength - convWidth + 1;
+    int stepSize = MIN(MAX_BASE_LEVEL_TRANSFORM, paddedBufferSize);
+    int blockRows = getDesignMatrixBlockRows(zDim0, numRffs);
+    int kmerTiles, windowsPerBlock;
+    int numSlices = getConvKmerLayout(blockRows, maxKmers, stepSize,
+            MAX(numRffs, (size_t)paddedBufferSize), kmerTiles, windowsPerBlock);
+
+    compute_t<T> *featureArray = getWorkspaceBuffer<compute_t<T>>(WORKSPACE_FEATURE_SLOT,
+            (size_t)blockRows * numSlices * paddedBufferSize, stream);
+    if (featureArray == NULL) {
+        throw std::runtime_error("Cuda is out of memory");
+        return 1;
+    };
+    double *featureBlock = getWorkspaceBuffer<double>(WORKSPACE_BLOCK_SLOT,
+            (size_t)blockRows * numRffs, stream);
+    if (featureBlock == NULL) {
+        throw std::runtime_error("Cuda is out of memory");
+        return 1;
+    };
+    double *sliceSums = NULL;
+    if (numSlices > 1){
+        sliceSums = getWorkspaceBuffer<double>(WORKSPACE_SLICE_SLOT,
+                (size_t)blockRows * numSlices * numRffs, stream);
+        if (sliceSums == NULL) {
+            throw std::runtime_error("Cuda is out of memory");
+            return 1;
+        };
+    }
+    double *rowProducts = getWorkspaceBuffer<double>(WORKSPACE_PRODUCT_SLOT,
+            (size_t)blockRows * numVecs, stream);
+    if (rowProducts == NULL) {
         throw std::runtime_error("Cuda is out of memory");
         return 1;
     };
 
-    convRBFFeatureGradKernel<T><<<zDim0, stepSize / 2, stepSize * sizeof(T)>>>(inputPtr,
-            featureArray, outputPtr, chiPtr, rademPtr, paddedBufferSize, log2N, numFreqs, zDim1, zDim2,
-            numRepeats, radem.shape(2), normConstant, scalingTerm, scalingType, convWidth,
-            slenCudaPtr, gradientPtr, sigma);
+    for (int blockStart = 0; blockStart < zDim0; blockStart += blockRows){
+        int currentRows = MIN(blockRows, zDim0 - blockStart);
+
+        //The feature generation kernel adds to the output, so it must
+        //be zeroed first.
+        cudaMemsetAsync(featureBlock, 0, sizeof(double) * currentRows * numRffs, stream);
+        launchConvRBFKernel<T>(DenseConvInput<T>{inputPtr, zDim1, zDim2}.offsetRows(blockStart),
+                featureArray, featureBlock, NULL, sliceSums, chiPtr, rademPtr,
+                slenCudaPtr + blockStart, currentRows, kmerTiles, windowsPerBlock,
+                paddedBufferSize, numFreqs, zDim1, zDim2, radem.shape(2), scalingTerm,
+                scalingType, convWidth, 0, stream);
+        cudaAccumulateMatvec(featureBlock, vecPtr, outputPtr, rowProducts,
+                currentRows, numRffs, numVecs, fitIntercept, stream);
+    }
 
-    cudaFree(slenCudaPtr);
-    cudaFree(featureArray);
     return 0;
 }
 //Explicitly instantiate so wrapper can use.
-template int convRBFFeatureGrad<double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+template int convRBFMatvec<double>(nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> vecArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
         nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
-        double sigma, int convWidth, int scalingType);
-template int convRBFFeatureGrad<float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        int convWidth, int scalingType, bool fitIntercept, uintptr_t streamPtr);
+template int convRBFMatvec<float>(nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> vecArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
         nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
         nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
-        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
-        double sigma, int convWidth, int scalingType);
+        int convWidth, int scalingType, bool fitIntercept, uintptr_t streamPtr);
+template int convRBFMatvec<__half>(nb::ndarray<__half, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> vecArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, bool fitIntercept, uintptr_t streamPtr);
+template int convRBFMatvec<__nv_bfloat16>(nb::ndarray<__nv_bfloat16, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> vecArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<int8_t, nb::shape<3, 1, -1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cpu, nb::c_contig> seqlengths,
+        int convWidth, int scalingType, bool fitIntercept, uintptr_t streamPtr);
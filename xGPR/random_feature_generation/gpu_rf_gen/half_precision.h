@@ -0,0 +1,51 @@
+#ifndef CUDA_HALF_PRECISION_TYPES_H
+#define CUDA_HALF_PRECISION_TYPES_H
+
+#include <cuda_fp16.h>
+#include <cuda_bf16.h>
+#include <nanobind/nanobind.h>
+#include <nanobind/ndarray.h>
+
+
+// Lets nanobind accept float16 and bfloat16 device arrays (e.g. from
+// cupy, or from other libraries via DLPack) for the half precision
+// instantiations of the feature generation routines.
+namespace nanobind::detail {
+    template <> struct dtype_traits<__half> {
+        static constexpr dlpack::dtype value {
+            (uint8_t) dlpack::dtype_code::Float, 16, 1 };
+        static constexpr auto name = const_name("float16");
+    };
+
+    template <> struct dtype_traits<__nv_bfloat16> {
+        static constexpr dlpack::dtype value {
+            (uint8_t) dlpack::dtype_code::Bfloat, 16, 1 };
+        static constexpr auto name = const_name("bfloat16");
+    };
+}
+
+
+// The type used for arithmetic, scratch storage and the random feature
+// parameters (chiArr etc.) when the input is of type T. Half precision
+// inputs are only a storage format -- each element is converted to
+// float when it is read, and all of the transforms are performed in
+// float -- so float and double are used as is.
+template <typename T>
+struct ComputeType {
+    typedef T type;
+};
+
+template <>
+struct ComputeType<__half> {
+    typedef float type;
+};
+
+template <>
+struct ComputeType<__nv_bfloat16> {
+    typedef float type;
+};
+
+template <typename T>
+using compute_t = typename ComputeType<T>::type;
+
+#endif
@@ -10,42 +10,102 @@
 #include <math.h>
 #include "../shared_constants.h"
 #include "../sharedmem.h"
+#include "../basic_ops/device_workspace.h"
+#include "../basic_ops/kernel_timer.h"
 #include "ard_ops.h"
 
 
 
+//Orders the input columns by lengthscale (keeping their original order
+//within each lengthscale), writing the original column for each grouped
+//column to columnOrder and the first grouped column for each lengthscale
+//(followed by the number of grouped columns) to groupStarts. groupPositions
+//is scratch space for numLengthscales elements. The number of columns is
+//small next to the rest of the gradient calculation, so a single thread
+//does this. Columns with an invalid lengthscale index are skipped.
+__global__ void ardGroupColumns(const int32_t *sigmaMap, int32_t *columnOrder,
+        int32_t *groupStarts, int32_t *groupPositions, int dim1,
+        int numLengthscales){
+    if (blockIdx.x != 0 || threadIdx.x != 0)
+        return;
+
+    for (int l=0; l <= numLengthscales; l++)
+        groupStarts[l] = 0;
+    for (int k=0; k < dim1; k++){
+        if (sigmaMap[k] >= 0 && sigmaMap[k] < numLengthscales)
+            groupStarts[sigmaMap[k] + 1] += 1;
+    }
+    for (int l=0; l < numLengthscales; l++){
+        groupStarts[l + 1] += groupStarts[l];
+        groupPositions[l] = groupStarts[l];
+    }
+
+    for (int k=0; k < dim1; k++){
+        if (sigmaMap[k] >= 0 && sigmaMap[k] < numLengthscales){
+            columnOrder[groupPositions[sigmaMap[k]]] = k;
+            groupPositions[sigmaMap[k]] += 1;
+        }
+    }
+}
+
+
 //Performs the first piece of the gradient calculation for ARD kernels
 //only -- multiplying the input data by the precomputed weight matrix
-//and summing over rows that correspond to specific lengthscales.
+//and summing over columns that correspond to specific lengthscales.
+//Each block computes an ARD_TILE_DIM x ARD_TILE_DIM tile of rows x
+//frequencies, stepping through the columns for one lengthscale at a
+//time in ARD_TILE_DIM-wide tiles of the input and the weights staged
+//in shared memory, so that the per-lengthscale sums are tiled matrix
+//products rather than scatters into the gradient. If randomFeatures is
+//NULL only the per-lengthscale sums are calculated, and sigmaVals is
+//not used.
 template <typename T>
 __global__ void ardGradSetup(double *gradientArray,
-        T precomputedWeights[], T inputX[], int32_t *sigmaMap,
-        double *sigmaVals, double *randomFeatures,
-        int dim1, int numSetupElements, int numFreqs,
-        int numLengthscales){
+        const compute_t<T> precomputedWeights[], const T inputX[],
+        const int32_t *columnOrder, const int32_t *groupStarts,
+        const double *sigmaVals, double *randomFeatures,
+        int numRows, int dim1, int numFreqs, int numLengthscales){
+    __shared__ compute_t<T> xTile[ARD_TILE_DIM][ARD_TILE_DIM + 1];
+    __shared__ compute_t<T> wTile[ARD_TILE_DIM][ARD_TILE_DIM + 1];
+    __shared__ double sigmaTile[ARD_TILE_DIM];
 
-    int i, sigmaLoc;
-    int tid = blockDim.x * blockIdx.x + threadIdx.x;
-    int precompWRow = (tid % numFreqs);
-    int gradRow = tid / numFreqs;
+    int row = blockIdx.y * ARD_TILE_DIM + threadIdx.y;
+    int freq = blockIdx.x * ARD_TILE_DIM + threadIdx.x;
+    int loadFreq = blockIdx.x * ARD_TILE_DIM + threadIdx.y;
+    bool activeCell = (row < numRows && freq < numFreqs);
 
-    T outVal;
+    double *gradientElement = gradientArray + 2 * ((size_t)row * numFreqs + freq) * numLengthscales;
+    double rfVal = 0;
 
-    if (tid < numSetupElements){
-        T *precompWElement = precomputedWeights + precompWRow * dim1;
-        T *inputXElement = inputX + gradRow * dim1;
-        double *gradientElement = gradientArray + 2 * (gradRow * numFreqs + precompWRow) * numLengthscales;
-        double *randomFeature = randomFeatures + 2 * (gradRow * numFreqs + precompWRow);
-        double rfVal = 0;
+    for (int l=0; l < numLengthscales; l++){
+        int groupEnd = groupStarts[l + 1];
+        double gradVal = 0;
+
+        for (int tileStart = groupStarts[l]; tileStart < groupEnd; tileStart += ARD_TILE_DIM){
+            int k = tileStart + threadIdx.x;
+            int column = (k < groupEnd) ? columnOrder[k] : 0;
+
+            xTile[threadIdx.y][threadIdx.x] = (k < groupEnd && row < numRows) ?
+                static_cast<compute_t<T>>(inputX[(size_t)row * dim1 + column]) : 0;
+            wTile[threadIdx.y][threadIdx.x] = (k < groupEnd && loadFreq < numFreqs) ?
+                precomputedWeights[(size_t)loadFreq * dim1 + column] : 0;
+            if (threadIdx.y == 0)
+                sigmaTile[threadIdx.x] = (k < groupEnd && randomFeatures != NULL) ?
+                    sigmaVals[column] : 0;
+            __syncthreads();
 
-        for (i=0; i < dim1; i++){
-            sigmaLoc = sigmaMap[i];
-            outVal = precompWElement[i] * inputXElement[i];
-            gradientElement[sigmaLoc] += outVal;
-            rfVal += sigmaVals[i] * outVal;
+            for (int kk=0; kk < ARD_TILE_DIM; kk++){
+                compute_t<T> outVal = xTile[threadIdx.y][kk] * wTile[threadIdx.x][kk];
+                gradVal += outVal;
+                rfVal += sigmaTile[kk] * outVal;
+            }
+            __syncthreads();
         }
-        *randomFeature = rfVal;
+        if (activeCell)
+            gradientElement[l] = gradVal;
     }
+    if (activeCell && randomFeatures != NULL)
+        randomFeatures[2 * ((size_t)row * numFreqs + freq)] = rfVal;
 }
 
 
@@ -81,17 +141,56 @@ __global__ void ardGradRFMultiply(double *gradientArray, double *randomFeats,
 }
 
 
+//Calculates the random features and gradient for each of numCandidates
+//sets of lengthscales from the per-lengthscale sums that ardGradSetup has
+//written to the gradient array for the first candidate. The candidates
+//are processed in reverse order so that the sums are only overwritten
+//once the last candidate has used them.
+__global__ void ardMultiGradRFMultiply(double *gradientArray, double *randomFeats,
+        const double *lengthscales, int numRFElements, int numFreqs,
+        int numLengthscales, int numCandidates, double rbfNormConstant){
+    int tid = blockDim.x * blockIdx.x + threadIdx.x;
+
+    if (tid >= numRFElements)
+        return;
+
+    size_t gradPosition = 2 * (size_t)tid * numLengthscales;
+    size_t rfPosition = 2 * (size_t)tid;
+    size_t gradCandidateStride = 2 * (size_t)numRFElements * numLengthscales;
+    size_t rfCandidateStride = 2 * (size_t)numRFElements;
+    const double *gradSums = gradientArray + gradPosition;
+
+    for (int c = numCandidates - 1; c >= 0; c--){
+        double rfVal = 0;
+        for (int i=0; i < numLengthscales; i++)
+            rfVal += lengthscales[c * numLengthscales + i] * gradSums[i];
+
+        double cosVal = cos(rfVal) * rbfNormConstant;
+        double sinVal = sin(rfVal) * rbfNormConstant;
+        randomFeats[c * rfCandidateStride + rfPosition] = cosVal;
+        randomFeats[c * rfCandidateStride + rfPosition + 1] = sinVal;
+
+        double *gradientElement = gradientArray + c * gradCandidateStride + gradPosition;
+        for (int i=0; i < numLengthscales; i++){
+            double gradVal = gradSums[i];
+            gradientElement[i] = -gradVal * sinVal;
+            gradientElement[i + numLengthscales] = gradVal * cosVal;
+        }
+    }
+}
+
+
 //This function generates the gradient and random features
 //for ARD kernels only, using precomputed weights that take
 //the place of the H-transforms we would otherwise need to perform.
 template <typename T>
 int ardCudaGrad(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
-        nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> precompWeights,
+        nb::ndarray<compute_t<T>, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> precompWeights,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaMap,
         nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaVals,
         nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> gradArr,
-        bool fitIntercept){
+        bool fitIntercept, uintptr_t streamPtr){
 
     // Perform safety checks. Any exceptions thrown here are handed off to Python
     // by the Nanobind wrapper. We do not expect the user to see these because
@@ -101,7 +200,7 @@ int ardCudaGrad(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig>
     int zDim1 = inputArr.shape(1);
 
     T *inputPtr = static_cast<T*>(inputArr.data());
-    T *precompWeightsPtr = static_cast<T*>(precompWeights.data());
+    compute_t<T> *precompWeightsPtr = static_cast<compute_t<T>*>(precompWeights.data());
     double *outputPtr = static_cast<double*>(outputArr.data());
     double *gradientPtr = static_cast<double*>(gradArr.data());
     int32_t *sigmaMapPtr = static_cast<int32_t*>(sigmaMap.data());
@@ -123,7 +222,7 @@ int ardCudaGrad(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig>
         throw std::runtime_error("Wrong array sizes.");
 
 
-    T rbfNormConstant;
+    compute_t<T> rbfNormConstant;
 
     if (fitIntercept)
         rbfNormConstant = std::sqrt(1.0 / (numFreqsFlt - 0.5));
@@ -131,17 +230,32 @@ int ardCudaGrad(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig>
         rbfNormConstant = std::sqrt(1.0 / numFreqsFlt);
 
     int numRFElements = zDim0 * numFreqs;
-    int numSetupElements = zDim0 * numFreqs;
     int blocksPerGrid;
 
+    ScopedCudaDevice deviceGuard(inputArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, inputArr.shape(0));
+    int32_t *columnOrder = getWorkspaceBuffer<int32_t>(WORKSPACE_INDEX_SLOT,
+            zDim1 + 2 * numLengthscales + 1, stream);
+    if (columnOrder == NULL) {
+        throw std::runtime_error("out of memory on cuda");
+        return 1;
+    };
+    int32_t *groupStarts = columnOrder + zDim1;
+    int32_t *groupPositions = groupStarts + numLengthscales + 1;
 
-    blocksPerGrid = (numSetupElements + DEFAULT_THREADS_PER_BLOCK - 1) / DEFAULT_THREADS_PER_BLOCK;
-    ardGradSetup<T><<<blocksPerGrid, DEFAULT_THREADS_PER_BLOCK>>>(gradientPtr, precompWeightsPtr,
-            inputPtr, sigmaMapPtr, sigmaValsPtr, outputPtr, zDim1, numSetupElements,
-            numFreqs, numLengthscales);
+    ardGroupColumns<<<1, 1, 0, stream>>>(sigmaMapPtr, columnOrder, groupStarts,
+            groupPositions, zDim1, numLengthscales);
+
+    dim3 setupBlock(ARD_TILE_DIM, ARD_TILE_DIM);
+    dim3 setupGrid((numFreqs + ARD_TILE_DIM - 1) / ARD_TILE_DIM,
+            (zDim0 + ARD_TILE_DIM - 1) / ARD_TILE_DIM);
+    ardGradSetup<T><<<setupGrid, setupBlock, 0, stream>>>(gradientPtr, precompWeightsPtr,
+            inputPtr, columnOrder, groupStarts, sigmaValsPtr, outputPtr, zDim0,
+            zDim1, numFreqs, numLengthscales);
 
     blocksPerGrid = (numRFElements + DEFAULT_THREADS_PER_BLOCK - 1) / DEFAULT_THREADS_PER_BLOCK;
-    ardGradRFMultiply<<<blocksPerGrid, DEFAULT_THREADS_PER_BLOCK>>>(gradientPtr, outputPtr,
+    ardGradRFMultiply<<<blocksPerGrid, DEFAULT_THREADS_PER_BLOCK, 0, stream>>>(gradientPtr, outputPtr,
                 numRFElements, numFreqs, numLengthscales, rbfNormConstant);
 
     return 0;
@@ -153,11 +267,146 @@ template int ardCudaGrad<double>(nb::ndarray<double, nb::shape<-1,-1>, nb::devic
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaMap,
         nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaVals,
         nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> gradArr,
-        bool fitIntercept);
+        bool fitIntercept, uintptr_t streamPtr);
 template int ardCudaGrad<float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
         nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> precompWeights,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaMap,
         nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaVals,
         nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> gradArr,
-        bool fitIntercept);
+        bool fitIntercept, uintptr_t streamPtr);
+template int ardCudaGrad<__half>(nb::ndarray<__half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> precompWeights,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaMap,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaVals,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> gradArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int ardCudaGrad<__nv_bfloat16>(nb::ndarray<__nv_bfloat16, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> precompWeights,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaMap,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaVals,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> gradArr,
+        bool fitIntercept, uintptr_t streamPtr);
+
+
+
+
+//This function generates the gradient and random features for ARD kernels
+//only for each of S candidate sets of lengthscales. The per-lengthscale
+//products of the input with the precomputed weights are calculated once
+//and used for all of the candidates. outputArr is (S x N x 2 * numFreqs),
+//lengthscaleArr is (S x L) and gradArr is (S x N x 2 * numFreqs x L).
+template <typename T>
+int ardCudaMultiGrad(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<compute_t<T>, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> precompWeights,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaMap,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> lengthscaleArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,-1>, nb::device::cuda, nb::c_contig> gradArr,
+        bool fitIntercept, uintptr_t streamPtr){
+
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = inputArr.shape(0);
+    int zDim1 = inputArr.shape(1);
+
+    T *inputPtr = static_cast<T*>(inputArr.data());
+    compute_t<T> *precompWeightsPtr = static_cast<compute_t<T>*>(precompWeights.data());
+    double *outputPtr = static_cast<double*>(outputArr.data());
+    double *gradientPtr = static_cast<double*>(gradArr.data());
+    int32_t *sigmaMapPtr = static_cast<int32_t*>(sigmaMap.data());
+    double *lengthscalePtr = static_cast<double*>(lengthscaleArr.data());
+
+    size_t numFreqs = precompWeights.shape(0);
+    double numFreqsFlt = numFreqs;
+    size_t numLengthscales = gradArr.shape(3);
+    int numCandidates = lengthscaleArr.shape(0);
+
+    if (inputArr.shape(0) == 0 || outputArr.shape(1) != inputArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numCandidates == 0 || outputArr.shape(0) != lengthscaleArr.shape(0) ||
+            lengthscaleArr.shape(1) != numLengthscales)
+        throw std::runtime_error("Wrong array sizes.");
+    if (gradArr.shape(0) != outputArr.shape(0) || gradArr.shape(1) != outputArr.shape(1) ||
+            gradArr.shape(2) != outputArr.shape(2))
+        throw std::runtime_error("Wrong array sizes.");
+    if (precompWeights.shape(1) != inputArr.shape(1))
+        throw std::runtime_error("Wrong array sizes.");
+    if (outputArr.shape(2) != 2 * precompWeights.shape(0) || sigmaMap.shape(0) != precompWeights.shape(1))
+        throw std::runtime_error("Wrong array sizes.");
+
+
+    double rbfNormConstant;
+
+    if (fitIntercept)
+        rbfNormConstant = std::sqrt(1.0 / (numFreqsFlt - 0.5));
+    else
+        rbfNormConstant = std::sqrt(1.0 / numFreqsFlt);
+
+    int numRFElements = zDim0 * numFreqs;
+    int blocksPerGrid;
+
+    ScopedCudaDevice deviceGuard(inputArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, inputArr.shape(0));
+    int32_t *columnOrder = getWorkspaceBuffer<int32_t>(WORKSPACE_INDEX_SLOT,
+            zDim1 + 2 * numLengthscales + 1, stream);
+    if (columnOrder == NULL) {
+        throw std::runtime_error("out of memory on cuda");
+        return 1;
+    };
+    int32_t *groupStarts = columnOrder + zDim1;
+    int32_t *groupPositions = groupStarts + numLengthscales + 1;
+
+    ardGroupColumns<<<1, 1, 0, stream>>>(sigmaMapPtr, columnOrder, groupStarts,
+            groupPositions, zDim1, numLengthscales);
+
+    //The per-lengthscale sums are stored in the gradient for the first
+    //candidate, then expanded for every candidate by the second kernel.
+    dim3 setupBlock(ARD_TILE_DIM, ARD_TILE_DIM);
+    dim3 setupGrid((numFreqs + ARD_TILE_DIM - 1) / ARD_TILE_DIM,
+            (zDim0 + ARD_TILE_DIM - 1) / ARD_TILE_DIM);
+    ardGradSetup<T><<<setupGrid, setupBlock, 0, stream>>>(gradientPtr, precompWeightsPtr,
+            inputPtr, columnOrder, groupStarts, static_cast<double*>(NULL),
+            static_cast<double*>(NULL), zDim0, zDim1, numFreqs, numLengthscales);
+
+    blocksPerGrid = (numRFElements + DEFAULT_THREADS_PER_BLOCK - 1) / DEFAULT_THREADS_PER_BLOCK;
+    ardMultiGradRFMultiply<<<blocksPerGrid, DEFAULT_THREADS_PER_BLOCK, 0, stream>>>(gradientPtr,
+                outputPtr, lengthscalePtr, numRFElements, numFreqs, numLengthscales,
+                numCandidates, rbfNormConstant);
+
+    return 0;
+}
+//Explicitly instantiate so wrappers can access.
+template int ardCudaMultiGrad<double>(nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> precompWeights,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaMap,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> lengthscaleArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,-1>, nb::device::cuda, nb::c_contig> gradArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int ardCudaMultiGrad<float>(nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> precompWeights,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaMap,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> lengthscaleArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,-1>, nb::device::cuda, nb::c_contig> gradArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int ardCudaMultiGrad<__half>(nb::ndarray<__half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> precompWeights,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaMap,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> lengthscaleArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,-1>, nb::device::cuda, nb::c_contig> gradArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int ardCudaMultiGrad<__nv_bfloat16>(nb::ndarray<__nv_bfloat16, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> precompWeights,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaMap,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> lengthscaleArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,-1>, nb::device::cuda, nb::c_contig> gradArr,
+        bool fitIntercept, uintptr_t streamPtr);
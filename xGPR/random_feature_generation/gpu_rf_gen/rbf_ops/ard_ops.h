@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <nanobind/nanobind.h>
 #include <nanobind/ndarray.h>
+#include "../half_precision.h"
 
 namespace nb = nanobind;
 
@@ -12,10 +13,19 @@ namespace nb = nanobind;
 template <typename T>
 int ardCudaGrad(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
-        nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> precompWeights,
+        nb::ndarray<compute_t<T>, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> precompWeights,
         nb::ndarray<int32_t, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaMap,
         nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaVals,
         nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> gradArr,
-        bool fitIntercept);
+        bool fitIntercept, uintptr_t streamPtr);
+
+template <typename T>
+int ardCudaMultiGrad(nb::ndarray<T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<compute_t<T>, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> precompWeights,
+        nb::ndarray<int32_t, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaMap,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> lengthscaleArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,-1>, nb::device::cuda, nb::c_contig> gradArr,
+        bool fitIntercept, uintptr_t streamPtr);
 
 #endif
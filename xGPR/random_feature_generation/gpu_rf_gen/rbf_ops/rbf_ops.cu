@@ -10,6 +10,11 @@
 #include <math.h>
 #include "../shared_constants.h"
 #include "../sharedmem.h"
+#include "../basic_ops/fht_device_functions.h"
+#include "../basic_ops/device_workspace.h"
+#include "../basic_ops/kernel_timer.h"
+#include "../basic_ops/basic_array_operations.h"
+#include "../basic_ops/radem_device_functions.h"
 #include "rbf_ops.h"
 
 
@@ -19,24 +24,24 @@ namespace nb = nanobind;
 //Generates the RBF features. This single kernel loops over 1)
 //the number of repeats then inside that loop 2) the three diagonal
 //matrix multiplications and fast Hadamard transforms before
-//applying 3) diagonal matmul before activation function.
-template <typename T>
-__global__ void rbfFeatureGenKernel(const T origData[], T cArray[],
-        double *outputArray, const T chiArr[], const int8_t *radem,
+//applying 3) diagonal matmul before activation function. The output
+//may be float or double independent of the input type, and radem may be
+//int8_t or bit-packed (see radem_device_functions.h).
+template <typename T, typename U, typename R>
+__global__ void rbfFeatureGenKernel(const T origData[], compute_t<T> cArray[],
+        U *outputArray, const compute_t<T> chiArr[], const R *radem,
         int paddedBufferSize, int log2N, int numFreqs, int inputElementsPerRow,
-        int nRepeats, int rademShape2, T normConstant,
+        int nRepeats, int rademShape2, compute_t<T> normConstant,
         double scalingConstant){
     int stepSize = MIN(paddedBufferSize, MAX_BASE_LEVEL_TRANSFORM);
 
-    SharedMemory<T> shared;
-    T *s_data = shared.getPointer();
-    int spacing, pos = threadIdx.x;
-    int lo, id1, id2;
+    SharedMemory<compute_t<T>> shared;
+    compute_t<T> *s_data = shared.getPointer();
     int tempArrPos, chiArrPos = 0;
     int inputArrPos = (blockIdx.x * inputElementsPerRow);
     int outputArrPos = (blockIdx.x * numFreqs * 2);
-    T y, outputVal;
-    const int8_t *rademPtr = radem;
+    compute_t<T> outputVal;
+    int rademPos;
 
     //Run over the number of repeats required to generate the random
     //features.
@@ -46,14 +51,14 @@ __global__ void rbfFeatureGenKernel(const T origData[], T cArray[],
         //Copy original data into the temporary array.
         for (int i = threadIdx.x; i < paddedBufferSize; i += blockDim.x){
             if (i < inputElementsPerRow)
-                cArray[i + tempArrPos] = origData[i + inputArrPos];
+                cArray[i + tempArrPos] = static_cast<compute_t<T>>(origData[i + inputArrPos]);
             else
                 cArray[i + tempArrPos] = 0;
         }
 
         //Run over three repeats for the SORF procedure.
         for (int sorfRep = 0; sorfRep < 3; sorfRep++){
-            rademPtr = radem + paddedBufferSize * rep + sorfRep * rademShape2;
+            rademPos = paddedBufferSize * rep + sorfRep * rademShape2;
             tempArrPos = (blockIdx.x << log2N);
 
             for (int hStep = 0; hStep < paddedBufferSize; hStep+=stepSize){
@@ -64,29 +69,12 @@ __global__ void rbfFeatureGenKernel(const T origData[], T cArray[],
 
                 //Multiply by the diagonal array here.
                 for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
-                    s_data[i] = s_data[i] * rademPtr[i] * normConstant;
+                    s_data[i] = applyRademElement(s_data[i], radem, rademPos + i,
+                            normConstant, sorfRep);
 
-                rademPtr += stepSize;
+                rademPos += stepSize;
 
-                id1 = (pos << 1);
-                id2 = id1 + 1;
-                __syncthreads();
-                y = s_data[id2];
-                s_data[id2] = s_data[id1] - y;
-                s_data[id1] += y;
-
-                for (spacing = 2; spacing < stepSize; spacing <<= 1){
-                    //Equivalent to pos mod spacing if spacing is a power of 2,
-                    //which here is always true.
-                    lo = pos & (spacing - 1);
-                    id1 = ((pos - lo) << 1) + lo;
-                    id2 = id1 + spacing;
-                    __syncthreads();
-                    y = s_data[id2];
-                    s_data[id2] = s_data[id1] - y;
-                    s_data[id1] += y;
-                }
-                __syncthreads();
+                blockFHT<compute_t<T>>(s_data, stepSize);
 
                 for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
                     cArray[i + tempArrPos] = s_data[i];
@@ -95,24 +83,10 @@ __global__ void rbfFeatureGenKernel(const T origData[], T cArray[],
                 __syncthreads();
             }
 
-            //A less efficient global memory procedure to complete the FHT
-            //for long arrays.
+            //Complete the FHT for long arrays.
             if (paddedBufferSize > MAX_BASE_LEVEL_TRANSFORM){
-                tempArrPos = (blockIdx.x << log2N);
-
-                for (int spacing = stepSize; spacing < paddedBufferSize; spacing <<= 1){
-
-                    for (int k = 0; k < paddedBufferSize; k += (spacing << 1)){
-                        for (int i = threadIdx.x; i < spacing; i += blockDim.x){
-                            id1 = i + k + tempArrPos;
-                            id2 = id1 + spacing;
-                            y = cArray[id2];
-                            cArray[id2] = cArray[id1] - y;
-                            cArray[id1] += y;
-                        }
-                        __syncthreads();
-                    }
-                }
+                stridedFHT<compute_t<T>>(cArray + (blockIdx.x << log2N), s_data, paddedBufferSize,
+                        stepSize);
             }
         }
         //Now take the results stored in the temporary array, apply the
@@ -125,8 +99,8 @@ __global__ void rbfFeatureGenKernel(const T origData[], T cArray[],
             if ((i + chiArrPos) >= numFreqs)
                 break;
             outputVal = chiArr[chiArrPos + i] * cArray[tempArrPos + i];
-            outputArray[outputArrPos + 2 * i] = scalingConstant * cos(outputVal);
-            outputArray[outputArrPos + 2 * i + 1] = scalingConstant * sin(outputVal);
+            outputArray[outputArrPos + 2 * i] = static_cast<U>(scalingConstant * cos(outputVal));
+            outputArray[outputArrPos + 2 * i + 1] = static_cast<U>(scalingConstant * sin(outputVal));
         }
 
         chiArrPos += paddedBufferSize;
@@ -144,23 +118,21 @@ __global__ void rbfFeatureGenKernel(const T origData[], T cArray[],
 //matrix multiplications and fast Hadamard transforms before
 //applying 3) diagonal matmul before activation function. The only difference
 //from rbfFeatureGenKernel is that the gradient is also calculated.
-template <typename T>
-__global__ void rbfFeatureGradKernel(const T origData[], T cArray[],
-        double *outputArray, const T chiArr[], const int8_t *radem,
+template <typename T, typename U, typename R>
+__global__ void rbfFeatureGradKernel(const T origData[], compute_t<T> cArray[],
+        U *outputArray, const compute_t<T> chiArr[], const R *radem,
         int paddedBufferSize, int log2N, int numFreqs, int inputElementsPerRow,
-        int nRepeats, int rademShape2, T normConstant,
-        double scalingConstant, double *gradient, T sigma){
+        int nRepeats, int rademShape2, compute_t<T> normConstant,
+        double scalingConstant, U *gradient, compute_t<T> sigma){
     int stepSize = MIN(paddedBufferSize, MAX_BASE_LEVEL_TRANSFORM);
 
-    SharedMemory<T> shared;
-    T *s_data = shared.getPointer();
-    int spacing, pos = threadIdx.x;
-    int lo, id1, id2;
+    SharedMemory<compute_t<T>> shared;
+    compute_t<T> *s_data = shared.getPointer();
     int tempArrPos, chiArrPos = 0;
     int inputArrPos = (blockIdx.x * inputElementsPerRow);
     int outputArrPos = (blockIdx.x * numFreqs * 2);
-    T y, outputVal;
-    const int8_t *rademPtr = radem;
+    compute_t<T> outputVal;
+    int rademPos;
 
     //Run over the number of repeats required to generate the random
     //features.
@@ -170,14 +142,14 @@ __global__ void rbfFeatureGradKernel(const T origData[], T cArray[],
         //Copy original data into the temporary array.
         for (int i = threadIdx.x; i < paddedBufferSize; i += blockDim.x){
             if (i < inputElementsPerRow)
-                cArray[i + tempArrPos] = origData[i + inputArrPos];
+                cArray[i + tempArrPos] = static_cast<compute_t<T>>(origData[i + inputArrPos]);
             else
                 cArray[i + tempArrPos] = 0;
         }
 
         //Run over three repeats for the SORF procedure.
         for (int sorfRep = 0; sorfRep < 3; sorfRep++){
-            rademPtr = radem + paddedBufferSize * rep + sorfRep * rademShape2;
+            rademPos = paddedBufferSize * rep + sorfRep * rademShape2;
             tempArrPos = (blockIdx.x << log2N);
 
             for (int hStep = 0; hStep < paddedBufferSize; hStep+=stepSize){
@@ -188,29 +160,12 @@ __global__ void rbfFeatureGradKernel(const T origData[], T cArray[],
 
                 //Multiply by the diagonal array here.
                 for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
-                    s_data[i] = s_data[i] * rademPtr[i] * normConstant;
+                    s_data[i] = applyRademElement(s_data[i], radem, rademPos + i,
+                            normConstant, sorfRep);
 
-                rademPtr += stepSize;
+                rademPos += stepSize;
 
-                id1 = (pos << 1);
-                id2 = id1 + 1;
-                __syncthreads();
-                y = s_data[id2];
-                s_data[id2] = s_data[id1] - y;
-                s_data[id1] += y;
-
-                for (spacing = 2; spacing < stepSize; spacing <<= 1){
-                    //Equivalent to pos mod spacing if spacing is a power of 2,
-                    //which here is always true.
-                    lo = pos & (spacing - 1);
-                    id1 = ((pos - lo) << 1) + lo;
-                    id2 = id1 + spacing;
-                    __syncthreads();
-                    y = s_data[id2];
-                    s_data[id2] = s_data[id1] - y;
-                    s_data[id1] += y;
-                }
-                __syncthreads();
+                blockFHT<compute_t<T>>(s_data, stepSize);
 
                 for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
                     cArray[i + tempArrPos] = s_data[i];
@@ -219,24 +174,10 @@ __global__ void rbfFeatureGradKernel(const T origData[], T cArray[],
                 __syncthreads();
             }
 
-            //A less efficient global memory procedure to complete the FHT
-            //for long arrays.
+            //Complete the FHT for long arrays.
             if (paddedBufferSize > MAX_BASE_LEVEL_TRANSFORM){
-                tempArrPos = (blockIdx.x << log2N);
-
-                for (int spacing = stepSize; spacing < paddedBufferSize; spacing <<= 1){
-
-                    for (int k = 0; k < paddedBufferSize; k += (spacing << 1)){
-                        for (int i = threadIdx.x; i < spacing; i += blockDim.x){
-                            id1 = i + k + tempArrPos;
-                            id2 = id1 + spacing;
-                            y = cArray[id2];
-                            cArray[id2] = cArray[id1] - y;
-                            cArray[id1] += y;
-                        }
-                        __syncthreads();
-                    }
-                }
+                stridedFHT<compute_t<T>>(cArray + (blockIdx.x << log2N), s_data, paddedBufferSize,
+                        stepSize);
             }
         }
         //Now take the results stored in the temporary array, apply the
@@ -268,13 +209,175 @@ __global__ void rbfFeatureGradKernel(const T origData[], T cArray[],
 
 //This function generates random features for RBF / ARD kernels, if the
 //input has already been multiplied by the appropriate lengthscale values.
-template <typename T>
+template <typename T, typename U, typename R>
 int RBFFeatureGen(
         nb::ndarray<const T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const R, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const compute_t<T>, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr) {
+
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = inputArr.shape(0);
+    int zDim1 = inputArr.shape(1);
+    size_t numRffs = outputArr.shape(1);
+    size_t numFreqs = chiArr.shape(0);
+    double numFreqsFlt = numFreqs;
+
+    const T *inputPtr = inputArr.data();
+    U *outputPtr = outputArr.data();
+    const compute_t<T> *chiPtr = chiArr.data();
+    const R *rademPtr = radem.data();
+    int rademShape2 = getRademLength<R>(radem.shape(2));
+
+    if (inputArr.shape(0) == 0 || outputArr.shape(0) != inputArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numRffs < 2 || (numRffs & 1) != 0)
+        throw std::runtime_error("last dim of output must be even number");
+    if ( (2 * numFreqs) != numRffs || numFreqs > static_cast<size_t>(rademShape2) )
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    double expectedNFreq = (zDim1 > 2) ? static_cast<double>(zDim1) : 2.0;
+    double log2Freqs = std::log2(expectedNFreq);
+    log2Freqs = std::ceil(log2Freqs);
+    int paddedBufferSize = std::pow(2, log2Freqs);
+
+    if (rademShape2 % paddedBufferSize != 0)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    compute_t<T> rbfNormConstant;
+
+    if (fitIntercept)
+        rbfNormConstant = std::sqrt(1.0 / (numFreqsFlt - 0.5));
+    else
+        rbfNormConstant = std::sqrt(1.0 / numFreqsFlt);
+
+    //This is the Hadamard normalization constant.
+    compute_t<T> normConstant = log2(paddedBufferSize) / 2;
+    normConstant = 1 / pow(2, normConstant);
+    int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
+    int stepSize = MIN(MAX_BASE_LEVEL_TRANSFORM, paddedBufferSize);
+    int log2N = log2(paddedBufferSize);
+
+    ScopedCudaDevice deviceGuard(inputArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, inputArr.shape(0));
+    compute_t<T> *featureArray = getWorkspaceBuffer<compute_t<T>>(WORKSPACE_FEATURE_SLOT,
+            (size_t)zDim0 * paddedBufferSize, stream);
+    if (featureArray == NULL) {
+        throw std::runtime_error("out of memory on cuda");
+        return 1;
+    };
+
+    rbfFeatureGenKernel<T, U, R><<<zDim0, stepSize / 2, stepSize * sizeof(compute_t<T>), stream>>>(inputPtr,
+            featureArray, outputPtr, chiPtr, rademPtr, paddedBufferSize, log2N, numFreqs, zDim1,
+            numRepeats, rademShape2, normConstant, rbfNormConstant);
+
+    return 0;
+}
+//Instantiate templates so Cython / PyBind wrappers can import.
+template int RBFFeatureGen<double, double>(
+        nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
         nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
-        nb::ndarray<const T, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
-        bool fitIntercept) {
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGen<float, double>(
+        nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGen<float, float>(
+        nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGen<__half, float>(
+        nb::ndarray<const __half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGen<__half, __half>(
+        nb::ndarray<const __half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<__half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGen<__nv_bfloat16, float>(
+        nb::ndarray<const __nv_bfloat16, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGen<__nv_bfloat16, __nv_bfloat16>(
+        nb::ndarray<const __nv_bfloat16, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<__nv_bfloat16, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGen<double, double, uint8_t>(
+        nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const uint8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGen<float, double, uint8_t>(
+        nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const uint8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGen<float, float, uint8_t>(
+        nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const uint8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGen<__half, float, uint8_t>(
+        nb::ndarray<const __half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const uint8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGen<__half, __half, uint8_t>(
+        nb::ndarray<const __half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<__half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const uint8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGen<__nv_bfloat16, float, uint8_t>(
+        nb::ndarray<const __nv_bfloat16, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const uint8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGen<__nv_bfloat16, __nv_bfloat16, uint8_t>(
+        nb::ndarray<const __nv_bfloat16, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<__nv_bfloat16, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const uint8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+
+
+//This function generates random features for RBF / ARD kernels (if the
+//input has already been multiplied by the appropriate lengthscale values)
+//one block of rows at a time, adding Z^T Z and Z^T y for each block to
+//zTzArr and zTyArr so that the full feature array is never stored.
+template <typename T>
+int RBFDesignMatrix(
+        nb::ndarray<const T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> zTyArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const compute_t<T>, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr) {
 
     // Perform safety checks. Any exceptions thrown here are handed off to Python
     // by the Nanobind wrapper. We do not expect the user to see these because
@@ -282,19 +385,23 @@ int RBFFeatureGen(
     // -- so we do not need to provide detailed exception messages here.
     int zDim0 = inputArr.shape(0);
     int zDim1 = inputArr.shape(1);
-    size_t numRffs = outputArr.shape(1);
+    size_t numRffs = zTzArr.shape(1);
     size_t numFreqs = chiArr.shape(0);
     double numFreqsFlt = numFreqs;
 
     const T *inputPtr = inputArr.data();
-    double *outputPtr = outputArr.data();
-    const T *chiPtr = chiArr.data();
+    const double *yPtr = yArr.data();
+    double *zTzPtr = zTzArr.data();
+    double *zTyPtr = zTyArr.data();
+    const compute_t<T> *chiPtr = chiArr.data();
     const int8_t *rademPtr = radem.data();
 
-    if (inputArr.shape(0) == 0 || outputArr.shape(0) != inputArr.shape(0))
+    if (inputArr.shape(0) == 0 || yArr.shape(0) != inputArr.shape(0))
         throw std::runtime_error("no datapoints");
     if (numRffs < 2 || (numRffs & 1) != 0)
         throw std::runtime_error("last dim of output must be even number");
+    if (zTzArr.shape(0) != numRffs || zTyArr.shape(0) != numRffs)
+        throw std::runtime_error("wrong array sizes");
     if ( (2 * numFreqs) != numRffs || numFreqs > radem.shape(2) )
         throw std::runtime_error("incorrect number of rffs and or freqs.");
 
@@ -306,7 +413,7 @@ int RBFFeatureGen(
     if (radem.shape(2) % paddedBufferSize != 0)
         throw std::runtime_error("incorrect number of rffs and or freqs.");
 
-    T rbfNormConstant;
+    compute_t<T> rbfNormConstant;
 
     if (fitIntercept)
         rbfNormConstant = std::sqrt(1.0 / (numFreqsFlt - 0.5));
@@ -314,52 +421,217 @@ int RBFFeatureGen(
         rbfNormConstant = std::sqrt(1.0 / numFreqsFlt);
 
     //This is the Hadamard normalization constant.
-    T normConstant = log2(paddedBufferSize) / 2;
+    compute_t<T> normConstant = log2(paddedBufferSize) / 2;
     normConstant = 1 / pow(2, normConstant);
     int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
     int stepSize = MIN(MAX_BASE_LEVEL_TRANSFORM, paddedBufferSize);
     int log2N = log2(paddedBufferSize);
+    int blockRows = getDesignMatrixBlockRows(zDim0, numRffs);
+
+    ScopedCudaDevice deviceGuard(inputArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, inputArr.shape(0));
+    compute_t<T> *featureArray = getWorkspaceBuffer<compute_t<T>>(WORKSPACE_FEATURE_SLOT,
+            (size_t)blockRows * paddedBufferSize, stream);
+    if (featureArray == NULL) {
+        throw std::runtime_error("out of memory on cuda");
+        return 1;
+    };
+    double *featureBlock = getWorkspaceBuffer<double>(WORKSPACE_BLOCK_SLOT,
+            (size_t)blockRows * numRffs, stream);
+    if (featureBlock == NULL) {
+        throw std::runtime_error("out of memory on cuda");
+        return 1;
+    };
+
+    for (int blockStart = 0; blockStart < zDim0; blockStart += blockRows){
+        int currentRows = MIN(blockRows, zDim0 - blockStart);
+
+        rbfFeatureGenKernel<T, double, int8_t><<<currentRows, stepSize / 2, stepSize * sizeof(compute_t<T>), stream>>>(
+                inputPtr + (size_t)blockStart * zDim1, featureArray, featureBlock,
+                chiPtr, rademPtr, paddedBufferSize, log2N, numFreqs, zDim1,
+                numRepeats, radem.shape(2), normConstant, rbfNormConstant);
+        cudaAccumulateGram(featureBlock, yPtr + blockStart, zTzPtr, zTyPtr,
+                currentRows, numRffs, fitIntercept, stream);
+    }
 
-    T *featureArray;
-    if (cudaMalloc(&featureArray, sizeof(T) * zDim0 * paddedBufferSize) != cudaSuccess) {
-        cudaFree(featureArray);
+    return 0;
+}
+//Instantiate templates so Cython / PyBind wrappers can import.
+template int RBFDesignMatrix<double>(
+        nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> zTyArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFDesignMatrix<float>(
+        nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> zTyArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFDesignMatrix<__half>(
+        nb::ndarray<const __half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> zTyArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFDesignMatrix<__nv_bfloat16>(
+        nb::ndarray<const __nv_bfloat16, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> zTyArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+
+
+
+//This function generates random features for RBF, Matern and MiniARD
+//kernels one block of rows at a time and adds Z^T (Z V) for a batch of
+//vectors V to outputArr, without storing the full feature array.
+template <typename T>
+int RBFMatvec(
+        nb::ndarray<const T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> vecArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const compute_t<T>, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr) {
+
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = inputArr.shape(0);
+    int zDim1 = inputArr.shape(1);
+    size_t numRffs = vecArr.shape(0);
+    int numVecs = vecArr.shape(1);
+    size_t numFreqs = chiArr.shape(0);
+    double numFreqsFlt = numFreqs;
+
+    const T *inputPtr = inputArr.data();
+    const double *vecPtr = vecArr.data();
+    double *outputPtr = outputArr.data();
+    const compute_t<T> *chiPtr = chiArr.data();
+    const int8_t *rademPtr = radem.data();
+
+    if (inputArr.shape(0) == 0)
+        throw std::runtime_error("no datapoints");
+    if (numRffs < 2 || (numRffs & 1) != 0)
+        throw std::runtime_error("last dim of output must be even number");
+    if (numVecs == 0 || outputArr.shape(0) != numRffs ||
+            outputArr.shape(1) != vecArr.shape(1))
+        throw std::runtime_error("wrong array sizes");
+    if ( (2 * numFreqs) != numRffs || numFreqs > radem.shape(2) )
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    double expectedNFreq = (zDim1 > 2) ? static_cast<double>(zDim1) : 2.0;
+    double log2Freqs = std::log2(expectedNFreq);
+    log2Freqs = std::ceil(log2Freqs);
+    int paddedBufferSize = std::pow(2, log2Freqs);
+
+    if (radem.shape(2) % paddedBufferSize != 0)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    compute_t<T> rbfNormConstant;
+
+    if (fitIntercept)
+        rbfNormConstant = std::sqrt(1.0 / (numFreqsFlt - 0.5));
+    else
+        rbfNormConstant = std::sqrt(1.0 / numFreqsFlt);
+
+    //This is the Hadamard normalization constant.
+    compute_t<T> normConstant = log2(paddedBufferSize) / 2;
+    normConstant = 1 / pow(2, normConstant);
+    int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
+    int stepSize = MIN(MAX_BASE_LEVEL_TRANSFORM, paddedBufferSize);
+    int log2N = log2(paddedBufferSize);
+    int blockRows = getDesignMatrixBlockRows(zDim0, numRffs);
+
+    ScopedCudaDevice deviceGuard(inputArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, inputArr.shape(0));
+    compute_t<T> *featureArray = getWorkspaceBuffer<compute_t<T>>(WORKSPACE_FEATURE_SLOT,
+            (size_t)blockRows * paddedBufferSize, stream);
+    if (featureArray == NULL) {
+        throw std::runtime_error("out of memory on cuda");
+        return 1;
+    };
+    double *featureBlock = getWorkspaceBuffer<double>(WORKSPACE_BLOCK_SLOT,
+            (size_t)blockRows * numRffs, stream);
+    if (featureBlock == NULL) {
+        throw std::runtime_error("out of memory on cuda");
+        return 1;
+    };
+    double *rowProducts = getWorkspaceBuffer<double>(WORKSPACE_PRODUCT_SLOT,
+            (size_t)blockRows * numVecs, stream);
+    if (rowProducts == NULL) {
         throw std::runtime_error("out of memory on cuda");
         return 1;
     };
 
-    rbfFeatureGenKernel<T><<<zDim0, stepSize / 2, stepSize * sizeof(T)>>>(inputPtr,
-            featureArray, outputPtr, chiPtr, rademPtr, paddedBufferSize, log2N, numFreqs, zDim1,
-            numRepeats, radem.shape(2), normConstant, rbfNormConstant);
+    for (int blockStart = 0; blockStart < zDim0; blockStart += blockRows){
+        int currentRows = MIN(blockRows, zDim0 - blockStart);
+
+        rbfFeatureGenKernel<T, double, int8_t><<<currentRows, stepSize / 2, stepSize * sizeof(compute_t<T>), stream>>>(
+                inputPtr + (size_t)blockStart * zDim1, featureArray, featureBlock,
+                chiPtr, rademPtr, paddedBufferSize, log2N, numFreqs, zDim1,
+                numRepeats, radem.shape(2), normConstant, rbfNormConstant);
+        cudaAccumulateMatvec(featureBlock, vecPtr, outputPtr, rowProducts,
+                currentRows, numRffs, numVecs, fitIntercept, stream);
+    }
 
-    cudaFree(featureArray);
     return 0;
 }
 //Instantiate templates so Cython / PyBind wrappers can import.
-template int RBFFeatureGen<double>(
+template int RBFMatvec<double>(
         nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> vecArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
         nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
         nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
-        bool fitIntercept);
-template int RBFFeatureGen<float>(
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFMatvec<float>(
         nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> vecArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFMatvec<__half>(
+        nb::ndarray<const __half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> vecArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFMatvec<__nv_bfloat16>(
+        nb::ndarray<const __nv_bfloat16, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> vecArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
         nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
         nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
-        bool fitIntercept);
+        bool fitIntercept, uintptr_t streamPtr);
 
 
 //This function generates random features for RBF kernels ONLY
 //(NOT ARD), and simultaneously generates the gradient, storing
 //it in a separate array.
-template <typename T>
+template <typename T, typename U, typename R>
 int RBFFeatureGrad(
         nb::ndarray<const T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
-        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
-        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
-        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
-        nb::ndarray<const T, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
-        float sigma, bool fitIntercept) {
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<U, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const R, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const compute_t<T>, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        float sigma, bool fitIntercept, uintptr_t streamPtr) {
 
     // Perform safety checks. Any exceptions thrown here are handed off to Python
     // by the Nanobind wrapper. We do not expect the user to see these because
@@ -372,16 +644,17 @@ int RBFFeatureGrad(
     double numFreqsFlt = numFreqs;
 
     const T *inputPtr = inputArr.data();
-    double *outputPtr = outputArr.data();
-    double *gradientPtr = gradArr.data();
-    const T *chiPtr = chiArr.data();
-    const int8_t *rademPtr = radem.data();
+    U *outputPtr = outputArr.data();
+    U *gradientPtr = gradArr.data();
+    const compute_t<T> *chiPtr = chiArr.data();
+    const R *rademPtr = radem.data();
+    int rademShape2 = getRademLength<R>(radem.shape(2));
 
     if (inputArr.shape(0) == 0 || outputArr.shape(0) != inputArr.shape(0))
         throw std::runtime_error("no datapoints");
     if (numRffs < 2 || (numRffs & 1) != 0)
         throw std::runtime_error("last dim of output must be even number");
-    if ( (2 * numFreqs) != numRffs || numFreqs > radem.shape(2) )
+    if ( (2 * numFreqs) != numRffs || numFreqs > static_cast<size_t>(rademShape2) )
         throw std::runtime_error("incorrect number of rffs and or freqs.");
     if (gradArr.shape(0) != outputArr.shape(0) || gradArr.shape(1) != outputArr.shape(1))
         throw std::runtime_error("Wrong array sizes.");
@@ -391,10 +664,10 @@ int RBFFeatureGrad(
     log2Freqs = std::ceil(log2Freqs);
     int paddedBufferSize = std::pow(2, log2Freqs);
 
-    if (radem.shape(2) % paddedBufferSize != 0)
+    if (rademShape2 % paddedBufferSize != 0)
         throw std::runtime_error("incorrect number of rffs and or freqs.");
 
-    T rbfNormConstant;
+    compute_t<T> rbfNormConstant;
 
     if (fitIntercept)
         rbfNormConstant = std::sqrt(1.0 / (numFreqsFlt - 0.5));
@@ -403,39 +676,723 @@ int RBFFeatureGrad(
 
 
     //This is the Hadamard normalization constant.
-    T normConstant = log2(paddedBufferSize) / 2;
+    compute_t<T> normConstant = log2(paddedBufferSize) / 2;
     normConstant = 1 / pow(2, normConstant);
     int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
     int stepSize = MIN(MAX_BASE_LEVEL_TRANSFORM, paddedBufferSize);
     int log2N = log2(paddedBufferSize);
 
-    T *featureArray;
-    if (cudaMalloc(&featureArray, sizeof(T) * zDim0 * paddedBufferSize) != cudaSuccess) {
-        cudaFree(featureArray);
+    ScopedCudaDevice deviceGuard(inputArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, inputArr.shape(0));
+    compute_t<T> *featureArray = getWorkspaceBuffer<compute_t<T>>(WORKSPACE_FEATURE_SLOT,
+            (size_t)zDim0 * paddedBufferSize, stream);
+    if (featureArray == NULL) {
         throw std::runtime_error("out of memory on cuda");
         return 1;
     };
 
-    rbfFeatureGradKernel<T><<<zDim0, stepSize / 2, stepSize * sizeof(T)>>>(inputPtr,
+    rbfFeatureGradKernel<T, U, R><<<zDim0, stepSize / 2, stepSize * sizeof(compute_t<T>), stream>>>(inputPtr,
             featureArray, outputPtr, chiPtr, rademPtr, paddedBufferSize, log2N, numFreqs, zDim1,
-            numRepeats, radem.shape(2), normConstant, rbfNormConstant, gradientPtr,
+            numRepeats, rademShape2, normConstant, rbfNormConstant, gradientPtr,
             sigma);
 
-    cudaFree(featureArray);
     return 0;
 }
 //Instantiate templates so Cython / PyBind wrappers can import.
-template int RBFFeatureGrad<double>(
+template int RBFFeatureGrad<double, double>(
         nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
         nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
         nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
         nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
-        float sigma, bool fitIntercept);
-template int RBFFeatureGrad<float>(
+        float sigma, bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGrad<float, double>(
         nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
         nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
         nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
         nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
-        float sigma, bool fitIntercept);
+        float sigma, bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGrad<float, float>(
+        nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        float sigma, bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGrad<__half, float>(
+        nb::ndarray<const __half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        float sigma, bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGrad<__nv_bfloat16, float>(
+        nb::ndarray<const __nv_bfloat16, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        float sigma, bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGrad<double, double, uint8_t>(
+        nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const uint8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        float sigma, bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGrad<float, double, uint8_t>(
+        nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const uint8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        float sigma, bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGrad<float, float, uint8_t>(
+        nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const uint8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        float sigma, bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGrad<__half, float, uint8_t>(
+        nb::ndarray<const __half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const uint8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        float sigma, bool fitIntercept, uintptr_t streamPtr);
+template int RBFFeatureGrad<__nv_bfloat16, float, uint8_t>(
+        nb::ndarray<const __nv_bfloat16, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const uint8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        float sigma, bool fitIntercept, uintptr_t streamPtr);
+
+
+
+
+//Generates the pre-activation projections chi * SORF(x) for the RBF
+//kernels, which do not depend on sigma, and stores them in projArray.
+//Other than writing the projections instead of applying the activation
+//function this is the same as rbfFeatureGenKernel. The projections may
+//be stored in a lower precision type than is used for the transform.
+template <typename T, typename P>
+__global__ void rbfProjectionKernel(const T origData[], compute_t<T> cArray[],
+        P *projArray, const compute_t<T> chiArr[], const int8_t *radem,
+        int paddedBufferSize, int log2N, int numFreqs, int inputElementsPerRow,
+        int nRepeats, int rademShape2, compute_t<T> normConstant){
+    int stepSize = MIN(paddedBufferSize, MAX_BASE_LEVEL_TRANSFORM);
+
+    SharedMemory<compute_t<T>> shared;
+    compute_t<T> *s_data = shared.getPointer();
+    int tempArrPos, chiArrPos = 0;
+    int inputArrPos = (blockIdx.x * inputElementsPerRow);
+    size_t projArrPos = ((size_t)blockIdx.x * numFreqs);
+    const int8_t *rademPtr = radem;
+
+    for (int rep = 0; rep < nRepeats; rep++){
+        tempArrPos = (blockIdx.x << log2N);
+
+        for (int i = threadIdx.x; i < paddedBufferSize; i += blockDim.x){
+            if (i < inputElementsPerRow)
+                cArray[i + tempArrPos] = static_cast<compute_t<T>>(origData[i + inputArrPos]);
+            else
+                cArray[i + tempArrPos] = 0;
+        }
+
+        for (int sorfRep = 0; sorfRep < 3; sorfRep++){
+            rademPtr = radem + paddedBufferSize * rep + sorfRep * rademShape2;
+            tempArrPos = (blockIdx.x << log2N);
+
+            for (int hStep = 0; hStep < paddedBufferSize; hStep+=stepSize){
+                for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
+                    s_data[i] = cArray[i + tempArrPos];
+
+                __syncthreads();
+
+                for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
+                    s_data[i] = s_data[i] * rademPtr[i] * normConstant;
+
+                rademPtr += stepSize;
+
+                blockFHT<compute_t<T>>(s_data, stepSize);
+
+                for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
+                    cArray[i + tempArrPos] = s_data[i];
+
+                tempArrPos += stepSize;
+                __syncthreads();
+            }
+
+            if (paddedBufferSize > MAX_BASE_LEVEL_TRANSFORM){
+                stridedFHT<compute_t<T>>(cArray + (blockIdx.x << log2N), s_data, paddedBufferSize,
+                        stepSize);
+            }
+        }
+        tempArrPos = (blockIdx.x << log2N);
+
+        for (int i = threadIdx.x; i < paddedBufferSize; i += blockDim.x){
+            if ((i + chiArrPos) >= numFreqs)
+                break;
+            projArray[projArrPos + i] = static_cast<P>(chiArr[chiArrPos + i] *
+                    cArray[tempArrPos + i]);
+        }
+
+        chiArrPos += paddedBufferSize;
+        projArrPos += paddedBufferSize;
+        __syncthreads();
+    }
+}
+
+
+
+//Applies the activation function to stored projections for each of
+//numSigmas sigma values. Each thread loads one projection once and
+//writes the features (and the gradient, if gradient is not NULL) for
+//every sigma; the output for sigma s and row i is row s * numRows + i.
+template <typename P, typename U>
+__global__ void rbfProjectionActivationKernel(const P projArray[],
+        const double sigmaArr[], U *outputArray, U *gradient,
+        size_t numProjElements, int numSigmas, double scalingConstant){
+    size_t tid = (size_t)blockDim.x * blockIdx.x + threadIdx.x;
+
+    if (tid >= numProjElements)
+        return;
+
+    compute_t<P> projVal = static_cast<compute_t<P>>(projArray[tid]);
+
+    for (int s = 0; s < numSigmas; s++){
+        size_t outputArrPos = 2 * (s * numProjElements + tid);
+        compute_t<P> prodVal = projVal * static_cast<compute_t<P>>(sigmaArr[s]);
+        double cosVal = scalingConstant * cos(prodVal);
+        double sinVal = scalingConstant * sin(prodVal);
+        outputArray[outputArrPos] = static_cast<U>(cosVal);
+        outputArray[outputArrPos + 1] = static_cast<U>(sinVal);
+        if (gradient != NULL){
+            gradient[outputArrPos] = static_cast<U>(-sinVal * projVal);
+            gradient[outputArrPos + 1] = static_cast<U>(cosVal * projVal);
+        }
+    }
+}
+
+
+
+//This function stores the pre-activation projections for RBF kernels
+//ONLY (NOT ARD), so that features and gradients for many sigma values
+//can later be generated from them by RBFProjectionFeatureGen and
+//RBFProjectionGrad without repeating the SORF transform. The input
+//should NOT have been multiplied by sigma. P may be a half precision
+//type to reduce the memory needed to store the projections.
+template <typename T, typename P>
+int RBFProjection(
+        nb::ndarray<const T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<P, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const compute_t<T>, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        uintptr_t streamPtr) {
+
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = inputArr.shape(0);
+    int zDim1 = inputArr.shape(1);
+    size_t numFreqs = chiArr.shape(0);
+
+    const T *inputPtr = inputArr.data();
+    P *projPtr = projArr.data();
+    const compute_t<T> *chiPtr = chiArr.data();
+    const int8_t *rademPtr = radem.data();
+
+    if (inputArr.shape(0) == 0 || projArr.shape(0) != inputArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numFreqs == 0 || projArr.shape(1) != numFreqs || numFreqs > radem.shape(2) )
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    double expectedNFreq = (zDim1 > 2) ? static_cast<double>(zDim1) : 2.0;
+    double log2Freqs = std::log2(expectedNFreq);
+    log2Freqs = std::ceil(log2Freqs);
+    int paddedBufferSize = std::pow(2, log2Freqs);
+
+    if (radem.shape(2) % paddedBufferSize != 0)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    //This is the Hadamard normalization constant.
+    compute_t<T> normConstant = log2(paddedBufferSize) / 2;
+    normConstant = 1 / pow(2, normConstant);
+    int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
+    int stepSize = MIN(MAX_BASE_LEVEL_TRANSFORM, paddedBufferSize);
+    int log2N = log2(paddedBufferSize);
+
+    ScopedCudaDevice deviceGuard(inputArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, inputArr.shape(0));
+    compute_t<T> *featureArray = getWorkspaceBuffer<compute_t<T>>(WORKSPACE_FEATURE_SLOT,
+            (size_t)zDim0 * paddedBufferSize, stream);
+    if (featureArray == NULL) {
+        throw std::runtime_error("out of memory on cuda");
+        return 1;
+    };
+
+    rbfProjectionKernel<T, P><<<zDim0, stepSize / 2, stepSize * sizeof(compute_t<T>), stream>>>(inputPtr,
+            featureArray, projPtr, chiPtr, rademPtr, paddedBufferSize, log2N, numFreqs, zDim1,
+            numRepeats, radem.shape(2), normConstant);
+
+    return 0;
+}
+//Instantiate templates so Cython / PyBind wrappers can import.
+template int RBFProjection<double, double>(
+        nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        uintptr_t streamPtr);
+template int RBFProjection<double, float>(
+        nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        uintptr_t streamPtr);
+template int RBFProjection<double, __half>(
+        nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<__half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        uintptr_t streamPtr);
+template int RBFProjection<float, float>(
+        nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        uintptr_t streamPtr);
+template int RBFProjection<float, __half>(
+        nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<__half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        uintptr_t streamPtr);
+template int RBFProjection<__half, __half>(
+        nb::ndarray<const __half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<__half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        uintptr_t streamPtr);
+
+
+
+//Shared by RBFProjectionFeatureGen and RBFProjectionGrad once they have
+//checked array sizes: launches the activation kernel for stored projections.
+template <typename P, typename U>
+static int launchProjectionActivation(const P *projPtr, int zDim0, size_t numFreqs,
+        const double *sigmaPtr, int numSigmas, U *outputPtr, U *gradientPtr,
+        bool fitIntercept, int deviceId, uintptr_t streamPtr) {
+    double numFreqsFlt = numFreqs;
+    double rbfNormConstant;
+
+    if (fitIntercept)
+        rbfNormConstant = std::sqrt(1.0 / (numFreqsFlt - 0.5));
+    else
+        rbfNormConstant = std::sqrt(1.0 / numFreqsFlt);
+
+    size_t numProjElements = (size_t)zDim0 * numFreqs;
+    int blocksPerGrid = (numProjElements + DEFAULT_THREADS_PER_BLOCK - 1) / DEFAULT_THREADS_PER_BLOCK;
+
+    ScopedCudaDevice deviceGuard(deviceId);
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, zDim0);
+    rbfProjectionActivationKernel<P, U><<<blocksPerGrid, DEFAULT_THREADS_PER_BLOCK, 0, stream>>>(
+            projPtr, sigmaPtr, outputPtr, gradientPtr, numProjElements, numSigmas,
+            rbfNormConstant);
+    return 0;
+}
+
+
+
+//This function generates random features for RBF kernels ONLY (NOT ARD)
+//from projections stored by RBFProjection, for each of the S sigma values
+//in sigmaArr. outputArr is (S x N x 2 * numFreqs).
+template <typename P, typename U>
+int RBFProjectionFeatureGen(
+        nb::ndarray<const P, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr) {
+
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    if (projArr.shape(0) == 0 || outputArr.shape(1) != projArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (sigmaArr.shape(0) == 0 || outputArr.shape(0) != sigmaArr.shape(0))
+        throw std::runtime_error("Wrong array sizes.");
+    if (projArr.shape(1) == 0 || outputArr.shape(2) != 2 * projArr.shape(1))
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    return launchProjectionActivation<P, U>(projArr.data(), projArr.shape(0),
+            projArr.shape(1), sigmaArr.data(), sigmaArr.shape(0), outputArr.data(),
+            static_cast<U*>(NULL), fitIntercept, projArr.device_id(), streamPtr);
+}
+//Instantiate templates so Cython / PyBind wrappers can import.
+template int RBFProjectionFeatureGen<double, double>(
+        nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFProjectionFeatureGen<float, double>(
+        nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFProjectionFeatureGen<float, float>(
+        nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFProjectionFeatureGen<__half, double>(
+        nb::ndarray<const __half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFProjectionFeatureGen<__half, float>(
+        nb::ndarray<const __half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+
+
+
+//This function generates random features and the gradient w/r/t sigma
+//for RBF kernels ONLY (NOT ARD) from projections stored by RBFProjection,
+//for each of the S sigma values in sigmaArr. outputArr is
+//(S x N x 2 * numFreqs) and gradArr is (S x N x 2 * numFreqs x 1).
+template <typename P, typename U>
+int RBFProjectionGrad(
+        nb::ndarray<const P, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr) {
+
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    if (projArr.shape(0) == 0 || outputArr.shape(1) != projArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (sigmaArr.shape(0) == 0 || outputArr.shape(0) != sigmaArr.shape(0))
+        throw std::runtime_error("Wrong array sizes.");
+    if (projArr.shape(1) == 0 || outputArr.shape(2) != 2 * projArr.shape(1))
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+    if (gradArr.shape(0) != outputArr.shape(0) || gradArr.shape(1) != outputArr.shape(1) ||
+            gradArr.shape(2) != outputArr.shape(2))
+        throw std::runtime_error("Wrong array sizes.");
+
+    return launchProjectionActivation<P, U>(projArr.data(), projArr.shape(0),
+            projArr.shape(1), sigmaArr.data(), sigmaArr.shape(0), outputArr.data(),
+            gradArr.data(), fitIntercept, projArr.device_id(), streamPtr);
+}
+//Instantiate templates so Cython / PyBind wrappers can import.
+template int RBFProjectionGrad<double, double>(
+        nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFProjectionGrad<float, double>(
+        nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFProjectionGrad<float, float>(
+        nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFProjectionGrad<__half, double>(
+        nb::ndarray<const __half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFProjectionGrad<__half, float>(
+        nb::ndarray<const __half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+
+
+
+
+//Generates the RBF features with gradient for each of numSigmas sigma
+//values. Other than applying every sigma to each transformed element while
+//it is in a register, writing the output for sigma s and row i to row
+//s * gridDim.x + i, this is the same as rbfFeatureGradKernel.
+template <typename T, typename U, typename R>
+__global__ void rbfMultiSigmaGradKernel(const T origData[], compute_t<T> cArray[],
+        U *outputArray, const compute_t<T> chiArr[], const R *radem,
+        int paddedBufferSize, int log2N, int numFreqs, int inputElementsPerRow,
+        int nRepeats, int rademShape2, compute_t<T> normConstant,
+        double scalingConstant, U *gradient, const double sigmaArr[],
+        int numSigmas){
+    int stepSize = MIN(paddedBufferSize, MAX_BASE_LEVEL_TRANSFORM);
+
+    SharedMemory<compute_t<T>> shared;
+    compute_t<T> *s_data = shared.getPointer();
+    int tempArrPos, chiArrPos = 0;
+    int inputArrPos = (blockIdx.x * inputElementsPerRow);
+    int outputArrPos = (blockIdx.x * numFreqs * 2);
+    size_t sigmaStride = (size_t)gridDim.x * numFreqs * 2;
+    compute_t<T> outputVal;
+    int rademPos;
+
+    //Run over the number of repeats required to generate the random
+    //features.
+    for (int rep = 0; rep < nRepeats; rep++){
+        tempArrPos = (blockIdx.x << log2N);
+
+        //Copy original data into the temporary array.
+        for (int i = threadIdx.x; i < paddedBufferSize; i += blockDim.x){
+            if (i < inputElementsPerRow)
+                cArray[i + tempArrPos] = static_cast<compute_t<T>>(origData[i + inputArrPos]);
+            else
+                cArray[i + tempArrPos] = 0;
+        }
+
+        //Run over three repeats for the SORF procedure.
+        for (int sorfRep = 0; sorfRep < 3; sorfRep++){
+            rademPos = paddedBufferSize * rep + sorfRep * rademShape2;
+            tempArrPos = (blockIdx.x << log2N);
+
+            for (int hStep = 0; hStep < paddedBufferSize; hStep+=stepSize){
+                for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
+                    s_data[i] = cArray[i + tempArrPos];
+
+                __syncthreads();
+
+                //Multiply by the diagonal array here.
+                for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
+                    s_data[i] = applyRademElement(s_data[i], radem, rademPos + i,
+                            normConstant, sorfRep);
+
+                rademPos += stepSize;
+
+                blockFHT<compute_t<T>>(s_data, stepSize);
+
+                for (int i = threadIdx.x; i < stepSize; i += blockDim.x)
+                    cArray[i + tempArrPos] = s_data[i];
+
+                tempArrPos += stepSize;
+                __syncthreads();
+            }
+
+            //Complete the FHT for long arrays.
+            if (paddedBufferSize > MAX_BASE_LEVEL_TRANSFORM){
+                stridedFHT<compute_t<T>>(cArray + (blockIdx.x << log2N), s_data, paddedBufferSize,
+                        stepSize);
+            }
+        }
+        //Now take the results stored in the temporary array and, for
+        //each sigma, apply the activation function and populate the
+        //output array.
+        tempArrPos = (blockIdx.x << log2N);
+
+        for (int i = threadIdx.x; i < paddedBufferSize; i += blockDim.x){
+            if ((i + chiArrPos) >= numFreqs)
+                break;
+            outputVal = chiArr[chiArrPos + i] * cArray[tempArrPos + i];
+
+            for (int s = 0; s < numSigmas; s++){
+                size_t sigmaArrPos = s * sigmaStride + outputArrPos + 2 * i;
+                double prodVal = outputVal * sigmaArr[s];
+                double cosVal = scalingConstant * cos(prodVal);
+                double sinVal = scalingConstant * sin(prodVal);
+                outputArray[sigmaArrPos] = cosVal;
+                outputArray[sigmaArrPos + 1] = sinVal;
+                gradient[sigmaArrPos] = -sinVal * outputVal;
+                gradient[sigmaArrPos + 1] = cosVal * outputVal;
+            }
+        }
+
+        chiArrPos += paddedBufferSize;
+        outputArrPos += 2 * paddedBufferSize;
+        __syncthreads();
+
+    }
+}
+
+
+
+
+//This function generates random features and the gradient w/r/t sigma
+//for RBF kernels ONLY (NOT ARD) for each of the S sigma values in
+//sigmaArr, using one kernel launch and one SORF transform per row for
+//all of them. The input should NOT have been multiplied by sigma.
+//outputArr is (S x N x 2 * numFreqs) and gradArr is
+//(S x N x 2 * numFreqs x 1).
+template <typename T, typename U, typename R>
+int RBFMultiSigmaGrad(
+        nb::ndarray<const T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const R, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const compute_t<T>, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr) {
+
+    // Perform safety checks. Any exceptions thrown here are handed off to Python
+    // by the Nanobind wrapper. We do not expect the user to see these because
+    // the Python code will always ensure inputs are correct -- these are a failsafe
+    // -- so we do not need to provide detailed exception messages here.
+    int zDim0 = inputArr.shape(0);
+    int zDim1 = inputArr.shape(1);
+    int numSigmas = sigmaArr.shape(0);
+    size_t numFreqs = chiArr.shape(0);
+    double numFreqsFlt = numFreqs;
+
+    const T *inputPtr = inputArr.data();
+    U *outputPtr = outputArr.data();
+    U *gradientPtr = gradArr.data();
+    const compute_t<T> *chiPtr = chiArr.data();
+    const double *sigmaPtr = sigmaArr.data();
+    const R *rademPtr = radem.data();
+    int rademShape2 = getRademLength<R>(radem.shape(2));
+
+    if (inputArr.shape(0) == 0 || outputArr.shape(1) != inputArr.shape(0))
+        throw std::runtime_error("no datapoints");
+    if (numSigmas == 0 || outputArr.shape(0) != sigmaArr.shape(0))
+        throw std::runtime_error("Wrong array sizes.");
+    if (numFreqs == 0 || outputArr.shape(2) != 2 * numFreqs ||
+            numFreqs > static_cast<size_t>(rademShape2) )
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+    if (gradArr.shape(0) != outputArr.shape(0) || gradArr.shape(1) != outputArr.shape(1) ||
+            gradArr.shape(2) != outputArr.shape(2))
+        throw std::runtime_error("Wrong array sizes.");
+
+    double expectedNFreq = (zDim1 > 2) ? static_cast<double>(zDim1) : 2.0;
+    double log2Freqs = std::log2(expectedNFreq);
+    log2Freqs = std::ceil(log2Freqs);
+    int paddedBufferSize = std::pow(2, log2Freqs);
+
+    if (rademShape2 % paddedBufferSize != 0)
+        throw std::runtime_error("incorrect number of rffs and or freqs.");
+
+    double rbfNormConstant;
+
+    if (fitIntercept)
+        rbfNormConstant = std::sqrt(1.0 / (numFreqsFlt - 0.5));
+    else
+        rbfNormConstant = std::sqrt(1.0 / numFreqsFlt);
+
+
+    //This is the Hadamard normalization constant.
+    compute_t<T> normConstant = log2(paddedBufferSize) / 2;
+    normConstant = 1 / pow(2, normConstant);
+    int numRepeats = (numFreqs + paddedBufferSize - 1) / paddedBufferSize;
+    int stepSize = MIN(MAX_BASE_LEVEL_TRANSFORM, paddedBufferSize);
+    int log2N = log2(paddedBufferSize);
+
+    ScopedCudaDevice deviceGuard(inputArr.device_id());
+    cudaStream_t stream = getCudaStream(streamPtr);
+    PROFILE_CUDA_KERNELS(stream, inputArr.shape(0));
+    compute_t<T> *featureArray = getWorkspaceBuffer<compute_t<T>>(WORKSPACE_FEATURE_SLOT,
+            (size_t)zDim0 * paddedBufferSize, stream);
+    if (featureArray == NULL) {
+        throw std::runtime_error("out of memory on cuda");
+        return 1;
+    };
+
+    rbfMultiSigmaGradKernel<T, U, R><<<zDim0, stepSize / 2, stepSize * sizeof(compute_t<T>), stream>>>(inputPtr,
+            featureArray, outputPtr, chiPtr, rademPtr, paddedBufferSize, log2N, numFreqs, zDim1,
+            numRepeats, rademShape2, normConstant, rbfNormConstant, gradientPtr,
+            sigmaPtr, numSigmas);
+
+    return 0;
+}
+//Instantiate templates so Cython / PyBind wrappers can import.
+template int RBFMultiSigmaGrad<double, double>(
+        nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFMultiSigmaGrad<float, double>(
+        nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFMultiSigmaGrad<float, float>(
+        nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFMultiSigmaGrad<__half, float>(
+        nb::ndarray<const __half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFMultiSigmaGrad<__nv_bfloat16, float>(
+        nb::ndarray<const __nv_bfloat16, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFMultiSigmaGrad<double, double, uint8_t>(
+        nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const uint8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFMultiSigmaGrad<float, double, uint8_t>(
+        nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<double, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const uint8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFMultiSigmaGrad<float, float, uint8_t>(
+        nb::ndarray<const float, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const uint8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFMultiSigmaGrad<__half, float, uint8_t>(
+        nb::ndarray<const __half, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const uint8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+template int RBFMultiSigmaGrad<__nv_bfloat16, float, uint8_t>(
+        nb::ndarray<const __nv_bfloat16, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<float, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const uint8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const float, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
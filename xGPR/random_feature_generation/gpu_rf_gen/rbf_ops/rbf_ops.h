@@ -4,27 +4,81 @@
 #include <stdint.h>
 #include <nanobind/nanobind.h>
 #include <nanobind/ndarray.h>
+#include "../half_precision.h"
 
 namespace nb = nanobind;
 
 
 
-template <typename T>
+template <typename T, typename U, typename R = int8_t>
 int RBFFeatureGen(
         nb::ndarray<const T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
-        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const R, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const compute_t<T>, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+
+template <typename T, typename U, typename R = int8_t>
+int RBFFeatureGrad(
+        nb::ndarray<const T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<U, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<U, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const R, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const compute_t<T>, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        float sigma, bool fitIntercept, uintptr_t streamPtr);
+
+template <typename T>
+int RBFDesignMatrix(
+        nb::ndarray<const T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> yArr,
+        nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> zTzArr,
+        nb::ndarray<double, nb::shape<-1>, nb::device::cuda, nb::c_contig> zTyArr,
         nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
-        nb::ndarray<const T, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
-        bool fitIntercept);
+        nb::ndarray<const compute_t<T>, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
 
 template <typename T>
-int RBFFeatureGrad(
+int RBFMatvec(
         nb::ndarray<const T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<const double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> vecArr,
         nb::ndarray<double, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
-        nb::ndarray<double, nb::shape<-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
         nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
-        nb::ndarray<const T, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
-        float sigma, bool fitIntercept);
+        nb::ndarray<const compute_t<T>, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        bool fitIntercept, uintptr_t streamPtr);
+
+
+template <typename T, typename P>
+int RBFProjection(
+        nb::ndarray<const T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<P, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<const int8_t, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const compute_t<T>, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        uintptr_t streamPtr);
+
+template <typename P, typename U>
+int RBFProjectionFeatureGen(
+        nb::ndarray<const P, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+
+template <typename P, typename U>
+int RBFProjectionGrad(
+        nb::ndarray<const P, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> projArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
+
+template <typename T, typename U, typename R = int8_t>
+int RBFMultiSigmaGrad(
+        nb::ndarray<const T, nb::shape<-1,-1>, nb::device::cuda, nb::c_contig> inputArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1>, nb::device::cuda, nb::c_contig> outputArr,
+        nb::ndarray<U, nb::shape<-1,-1,-1,1>, nb::device::cuda, nb::c_contig> gradArr,
+        nb::ndarray<const R, nb::shape<3,1,-1>, nb::device::cuda, nb::c_contig> radem,
+        nb::ndarray<const compute_t<T>, nb::shape<-1>, nb::device::cuda, nb::c_contig> chiArr,
+        nb::ndarray<const double, nb::shape<-1>, nb::device::cuda, nb::c_contig> sigmaArr,
+        bool fitIntercept, uintptr_t streamPtr);
 
 
 #endif
@@ -6,9 +6,18 @@
 
 #define DEFAULT_THREADS_PER_BLOCK 256
 #define DEFAULT_THREADS_PER_BLREDUCE 32
+#define WARP_SIZE 32
+#define FULL_WARP_MASK 0xffffffff
 
 #define MAX_BASE_LEVEL_TRANSFORM 1024
 #define MAX_SINGLE_STAGE_TRANSFORM 1024
 
+#define DESIGN_MATRIX_BLOCK_ELEMENTS 4194304
+#define GRAM_TILE_DIM 16
+#define ARD_TILE_DIM 16
+
+#define CONV_MIN_THREADS_PER_BLOCK 128
+#define CONV_TARGET_BLOCKS 2048
+
 
 #endif
@@ -3,87 +3,586 @@
 
 #include <nanobind/nanobind.h>
 #include <nanobind/ndarray.h>
+#include <nanobind/stl/vector.h>
 #include "basic_ops/basic_array_operations.h"
 #include "rbf_ops/rbf_ops.h"
 #include "rbf_ops/ard_ops.h"
 #include "convolution_ops/convolution.h"
 #include "convolution_ops/rbf_convolution.h"
+#include "basic_ops/device_workspace.h"
+#include "basic_ops/kernel_timer.h"
+#include "../async_native_ops.h"
 
 
 namespace nb = nanobind;
 using namespace std;
 
 NB_MODULE(xgpr_cuda_rfgen_cpp_ext, m){
-    m.def("cudaFastHadamardTransform2D", &cudaHTransform<float>,
-            nb::arg("inputArr").noconvert());
-    m.def("cudaFastHadamardTransform2D", &cudaHTransform<double>,
-            nb::arg("inputArr").noconvert());
-    m.def("cudaSRHT", &cudaSRHT2d<float>,
+    defAsyncOpHandle<CudaOpLock>(m, "cudaAsyncOpHandle");
+
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaFastHadamardTransform2D", &cudaHTransform<float>,
+            nb::arg("inputArr").noconvert(), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaFastHadamardTransform2D", &cudaHTransform<double>,
+            nb::arg("inputArr").noconvert(), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaSRHT", &cudaSRHT2d<float>,
             nb::arg("inputArr").noconvert(), nb::arg("radem").noconvert(),
-            nb::arg("numThreads"));
-    m.def("cudaSRHT", &cudaSRHT2d<double>,
+            nb::arg("numThreads"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaSRHT", &cudaSRHT2d<double>,
             nb::arg("inputArr").noconvert(), nb::arg("radem").noconvert(),
-            nb::arg("numThreads"));
+            nb::arg("numThreads"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaSubsampledSRHT", &cudaSubsampledSRHT2d<float>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("colIdx").noconvert(),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaSubsampledSRHT", &cudaSubsampledSRHT2d<double>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("colIdx").noconvert(),
+            nb::arg("stream") = 0);
 
-    m.def("cudaRBFFeatureGen", &RBFFeatureGen<float>,
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFFeatureGen", &RBFFeatureGen<float, double>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFFeatureGen", &RBFFeatureGen<float, float>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFFeatureGen", &RBFFeatureGen<double, double>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFFeatureGen", &RBFFeatureGen<__half, float>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFFeatureGen", &RBFFeatureGen<__half, __half>,
             nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
             nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
-            nb::arg("fitIntercept"));
-    m.def("cudaRBFFeatureGen", &RBFFeatureGen<double>,
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFFeatureGen", &RBFFeatureGen<__nv_bfloat16, float>,
             nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
             nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
-            nb::arg("fitIntercept"));
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFFeatureGen", &RBFFeatureGen<__nv_bfloat16, __nv_bfloat16>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFFeatureGen", &RBFFeatureGen<float, double, uint8_t>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFFeatureGen", &RBFFeatureGen<float, float, uint8_t>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFFeatureGen", &RBFFeatureGen<double, double, uint8_t>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFFeatureGen", &RBFFeatureGen<__half, float, uint8_t>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFFeatureGen", &RBFFeatureGen<__half, __half, uint8_t>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFFeatureGen", &RBFFeatureGen<__nv_bfloat16, float, uint8_t>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFFeatureGen", &RBFFeatureGen<__nv_bfloat16, __nv_bfloat16, uint8_t>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
 
-    m.def("cudaRBFGrad", &RBFFeatureGrad<float>,
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFGrad", &RBFFeatureGrad<float, double>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("sigma"), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFGrad", &RBFFeatureGrad<float, float>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("sigma"), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFGrad", &RBFFeatureGrad<double, double>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("sigma"), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFGrad", &RBFFeatureGrad<__half, float>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("sigma"), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFGrad", &RBFFeatureGrad<__nv_bfloat16, float>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("sigma"), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFGrad", &RBFFeatureGrad<float, double, uint8_t>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("sigma"), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFGrad", &RBFFeatureGrad<float, float, uint8_t>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("sigma"), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFGrad", &RBFFeatureGrad<double, double, uint8_t>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("sigma"), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFGrad", &RBFFeatureGrad<__half, float, uint8_t>,
             nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
             nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
-            nb::arg("chiArr").noconvert(), nb::arg("sigma"), nb::arg("fitIntercept"));
-    m.def("cudaRBFGrad", &RBFFeatureGrad<double>,
+            nb::arg("chiArr").noconvert(), nb::arg("sigma"), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFGrad", &RBFFeatureGrad<__nv_bfloat16, float, uint8_t>,
             nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
             nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
-            nb::arg("chiArr").noconvert(), nb::arg("sigma"), nb::arg("fitIntercept"));
+            nb::arg("chiArr").noconvert(), nb::arg("sigma"), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
 
-    m.def("cudaMiniARDGrad", &ardCudaGrad<float>,
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFProjection", &RBFProjection<float, float>,
+            nb::arg("inputArr").noconvert(), nb::arg("projArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFProjection", &RBFProjection<float, __half>,
+            nb::arg("inputArr").noconvert(), nb::arg("projArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFProjection", &RBFProjection<double, double>,
+            nb::arg("inputArr").noconvert(), nb::arg("projArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFProjection", &RBFProjection<double, float>,
+            nb::arg("inputArr").noconvert(), nb::arg("projArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFProjection", &RBFProjection<double, __half>,
+            nb::arg("inputArr").noconvert(), nb::arg("projArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFProjection", &RBFProjection<__half, __half>,
+            nb::arg("inputArr").noconvert(), nb::arg("projArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("stream") = 0);
+
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFProjectionFGen", &RBFProjectionFeatureGen<float, double>,
+            nb::arg("projArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("sigmaArr").noconvert(), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFProjectionFGen", &RBFProjectionFeatureGen<float, float>,
+            nb::arg("projArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("sigmaArr").noconvert(), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFProjectionFGen", &RBFProjectionFeatureGen<double, double>,
+            nb::arg("projArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("sigmaArr").noconvert(), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFProjectionFGen", &RBFProjectionFeatureGen<__half, double>,
+            nb::arg("projArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("sigmaArr").noconvert(), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFProjectionFGen", &RBFProjectionFeatureGen<__half, float>,
+            nb::arg("projArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("sigmaArr").noconvert(), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
+
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFProjectionGrad", &RBFProjectionGrad<float, double>,
+            nb::arg("projArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFProjectionGrad", &RBFProjectionGrad<float, float>,
+            nb::arg("projArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFProjectionGrad", &RBFProjectionGrad<double, double>,
+            nb::arg("projArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFProjectionGrad", &RBFProjectionGrad<__half, double>,
+            nb::arg("projArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFProjectionGrad", &RBFProjectionGrad<__half, float>,
+            nb::arg("projArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFMultiSigmaGrad", &RBFMultiSigmaGrad<float, double>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFMultiSigmaGrad", &RBFMultiSigmaGrad<float, float>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFMultiSigmaGrad", &RBFMultiSigmaGrad<double, double>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFMultiSigmaGrad", &RBFMultiSigmaGrad<__half, float>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFMultiSigmaGrad", &RBFMultiSigmaGrad<__nv_bfloat16, float>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFMultiSigmaGrad", &RBFMultiSigmaGrad<float, double, uint8_t>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFMultiSigmaGrad", &RBFMultiSigmaGrad<float, float, uint8_t>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFMultiSigmaGrad", &RBFMultiSigmaGrad<double, double, uint8_t>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFMultiSigmaGrad", &RBFMultiSigmaGrad<__half, float, uint8_t>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFMultiSigmaGrad", &RBFMultiSigmaGrad<__nv_bfloat16, float, uint8_t>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("gradArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("sigmaArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaMiniARDGrad", &ardCudaGrad<float>,
             nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
             nb::arg("precompWeights").noconvert(), nb::arg("sigmaMap").noconvert(),
             nb::arg("sigmaVals").noconvert(), nb::arg("gradArr").noconvert(),
-            nb::arg("fitIntercept"));
-    m.def("cudaMiniARDGrad", &ardCudaGrad<double>,
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaMiniARDGrad", &ardCudaGrad<double>,
             nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
             nb::arg("precompWeights").noconvert(), nb::arg("sigmaMap").noconvert(),
             nb::arg("sigmaVals").noconvert(), nb::arg("gradArr").noconvert(),
-            nb::arg("fitIntercept"));
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaMiniARDGrad", &ardCudaGrad<__half>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("precompWeights").noconvert(), nb::arg("sigmaMap").noconvert(),
+            nb::arg("sigmaVals").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaMiniARDGrad", &ardCudaGrad<__nv_bfloat16>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("precompWeights").noconvert(), nb::arg("sigmaMap").noconvert(),
+            nb::arg("sigmaVals").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaMiniARDMultiGrad", &ardCudaMultiGrad<float>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("precompWeights").noconvert(), nb::arg("sigmaMap").noconvert(),
+            nb::arg("lengthscaleArr").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaMiniARDMultiGrad", &ardCudaMultiGrad<double>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("precompWeights").noconvert(), nb::arg("sigmaMap").noconvert(),
+            nb::arg("lengthscaleArr").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaMiniARDMultiGrad", &ardCudaMultiGrad<__half>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("precompWeights").noconvert(), nb::arg("sigmaMap").noconvert(),
+            nb::arg("lengthscaleArr").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaMiniARDMultiGrad", &ardCudaMultiGrad<__nv_bfloat16>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("precompWeights").noconvert(), nb::arg("sigmaMap").noconvert(),
+            nb::arg("lengthscaleArr").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
 
-    m.def("cudaConv1dMaxpool", &conv1dMaxpoolFeatureGen<float>,
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dMaxpool", &conv1dMaxpoolFeatureGen<float>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dMaxpool", &conv1dMaxpoolFeatureGen<double>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dMaxpool", &conv1dMaxpoolFeatureGen<__half>,
             nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
             nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
-            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"));
-    m.def("cudaConv1dMaxpool", &conv1dMaxpoolFeatureGen<double>,
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dMaxpool", &conv1dMaxpoolFeatureGen<__nv_bfloat16>,
             nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
             nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
-            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"));
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dMaxpool", &conv1dTokenMaxpoolFeatureGen<uint8_t, float>,
+            nb::arg("tokenArr").noconvert(), nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dMaxpool", &conv1dTokenMaxpoolFeatureGen<uint8_t, double>,
+            nb::arg("tokenArr").noconvert(), nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dMaxpool", &conv1dTokenMaxpoolFeatureGen<int16_t, float>,
+            nb::arg("tokenArr").noconvert(), nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dMaxpool", &conv1dTokenMaxpoolFeatureGen<int16_t, double>,
+            nb::arg("tokenArr").noconvert(), nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"), nb::arg("stream") = 0);
 
-    m.def("cudaConv1dFGen", &convRBFFeatureGen<float>,
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dFGen", &convRBFFeatureGen<float, double>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dFGen", &convRBFFeatureGen<float, float>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dFGen", &convRBFFeatureGen<double, double>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dFGen", &convRBFFeatureGen<__half, float>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dFGen", &convRBFFeatureGen<__half, __half>,
             nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
             nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
             nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
-            nb::arg("scalingType"));
-    m.def("cudaConv1dFGen", &convRBFFeatureGen<double>,
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dFGen", &convRBFFeatureGen<__nv_bfloat16, float>,
             nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
             nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
             nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
-            nb::arg("scalingType"));
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dFGen", &convRBFFeatureGen<__nv_bfloat16, __nv_bfloat16>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dFGen", &convRBFTokenFeatureGen<uint8_t, float, double>,
+            nb::arg("tokenArr").noconvert(), nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dFGen", &convRBFTokenFeatureGen<uint8_t, float, float>,
+            nb::arg("tokenArr").noconvert(), nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dFGen", &convRBFTokenFeatureGen<uint8_t, double, double>,
+            nb::arg("tokenArr").noconvert(), nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dFGen", &convRBFTokenFeatureGen<int16_t, float, double>,
+            nb::arg("tokenArr").noconvert(), nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dFGen", &convRBFTokenFeatureGen<int16_t, float, float>,
+            nb::arg("tokenArr").noconvert(), nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dFGen", &convRBFTokenFeatureGen<int16_t, double, double>,
+            nb::arg("tokenArr").noconvert(), nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
 
-    m.def("cudaConvGrad", &convRBFFeatureGrad<float>,
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConvGrad", &convRBFFeatureGrad<float, double>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("sigma"), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConvGrad", &convRBFFeatureGrad<float, float>,
             nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
             nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
             nb::arg("seqlengths").noconvert(), nb::arg("gradArr").noconvert(),
             nb::arg("sigma"), nb::arg("convWidth"),
-            nb::arg("scalingType"));
-    m.def("cudaConvGrad", &convRBFFeatureGrad<double>,
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConvGrad", &convRBFFeatureGrad<double, double>,
             nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
             nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
             nb::arg("seqlengths").noconvert(), nb::arg("gradArr").noconvert(),
             nb::arg("sigma"), nb::arg("convWidth"),
-            nb::arg("scalingType"));
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConvGrad", &convRBFFeatureGrad<__half, float>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("sigma"), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConvGrad", &convRBFFeatureGrad<__nv_bfloat16, float>,
+            nb::arg("inputArr").noconvert(), nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("sigma"), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConvGrad", &convRBFTokenFeatureGrad<uint8_t, float, double>,
+            nb::arg("tokenArr").noconvert(), nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("sigma"), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConvGrad", &convRBFTokenFeatureGrad<uint8_t, float, float>,
+            nb::arg("tokenArr").noconvert(), nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("sigma"), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConvGrad", &convRBFTokenFeatureGrad<uint8_t, double, double>,
+            nb::arg("tokenArr").noconvert(), nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("sigma"), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConvGrad", &convRBFTokenFeatureGrad<int16_t, float, double>,
+            nb::arg("tokenArr").noconvert(), nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("sigma"), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConvGrad", &convRBFTokenFeatureGrad<int16_t, float, float>,
+            nb::arg("tokenArr").noconvert(), nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("sigma"), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConvGrad", &convRBFTokenFeatureGrad<int16_t, double, double>,
+            nb::arg("tokenArr").noconvert(), nb::arg("embeddingArr").noconvert(),
+            nb::arg("outputArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("gradArr").noconvert(),
+            nb::arg("sigma"), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("stream") = 0);
+
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFDesignMatrix", &RBFDesignMatrix<float>,
+            nb::arg("inputArr").noconvert(), nb::arg("yArr").noconvert(),
+            nb::arg("zTzArr").noconvert(), nb::arg("zTyArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFDesignMatrix", &RBFDesignMatrix<double>,
+            nb::arg("inputArr").noconvert(), nb::arg("yArr").noconvert(),
+            nb::arg("zTzArr").noconvert(), nb::arg("zTyArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFDesignMatrix", &RBFDesignMatrix<__half>,
+            nb::arg("inputArr").noconvert(), nb::arg("yArr").noconvert(),
+            nb::arg("zTzArr").noconvert(), nb::arg("zTyArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFDesignMatrix", &RBFDesignMatrix<__nv_bfloat16>,
+            nb::arg("inputArr").noconvert(), nb::arg("yArr").noconvert(),
+            nb::arg("zTzArr").noconvert(), nb::arg("zTyArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("fitIntercept"), nb::arg("stream") = 0);
+
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dDesignMatrix", &convRBFDesignMatrix<float>,
+            nb::arg("inputArr").noconvert(), nb::arg("yArr").noconvert(),
+            nb::arg("zTzArr").noconvert(), nb::arg("zTyArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dDesignMatrix", &convRBFDesignMatrix<double>,
+            nb::arg("inputArr").noconvert(), nb::arg("yArr").noconvert(),
+            nb::arg("zTzArr").noconvert(), nb::arg("zTyArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dDesignMatrix", &convRBFDesignMatrix<__half>,
+            nb::arg("inputArr").noconvert(), nb::arg("yArr").noconvert(),
+            nb::arg("zTzArr").noconvert(), nb::arg("zTyArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dDesignMatrix", &convRBFDesignMatrix<__nv_bfloat16>,
+            nb::arg("inputArr").noconvert(), nb::arg("yArr").noconvert(),
+            nb::arg("zTzArr").noconvert(), nb::arg("zTyArr").noconvert(),
+            nb::arg("radem").noconvert(), nb::arg("chiArr").noconvert(),
+            nb::arg("seqlengths").noconvert(), nb::arg("convWidth"),
+            nb::arg("scalingType"), nb::arg("fitIntercept"), nb::arg("stream") = 0);
+
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFMatvec", &RBFMatvec<float>,
+            nb::arg("inputArr").noconvert(), nb::arg("vecArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFMatvec", &RBFMatvec<double>,
+            nb::arg("inputArr").noconvert(), nb::arg("vecArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFMatvec", &RBFMatvec<__half>,
+            nb::arg("inputArr").noconvert(), nb::arg("vecArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("fitIntercept"), nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaRBFMatvec", &RBFMatvec<__nv_bfloat16>,
+            nb::arg("inputArr").noconvert(), nb::arg("vecArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("fitIntercept"), nb::arg("stream") = 0);
+
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dMatvec", &convRBFMatvec<float>,
+            nb::arg("inputArr").noconvert(), nb::arg("vecArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("scalingType"), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dMatvec", &convRBFMatvec<double>,
+            nb::arg("inputArr").noconvert(), nb::arg("vecArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("scalingType"), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dMatvec", &convRBFMatvec<__half>,
+            nb::arg("inputArr").noconvert(), nb::arg("vecArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("scalingType"), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
+    DEF_NATIVE_OP(m, CudaOpLock, "cudaConv1dMatvec", &convRBFMatvec<__nv_bfloat16>,
+            nb::arg("inputArr").noconvert(), nb::arg("vecArr").noconvert(),
+            nb::arg("outputArr").noconvert(), nb::arg("radem").noconvert(),
+            nb::arg("chiArr").noconvert(), nb::arg("seqlengths").noconvert(),
+            nb::arg("convWidth"), nb::arg("scalingType"), nb::arg("fitIntercept"),
+            nb::arg("stream") = 0);
+
+    m.def("cudaGetWorkspaceSize", &getCudaWorkspaceSize_);
+    m.def("cudaReleaseWorkspace", &releaseCudaWorkspace_,
+            nb::call_guard<nb::gil_scoped_release>());
+    m.def("cudaGetDeviceCount", &getCudaDeviceCount_);
+    m.def("cudaEnablePeerAccess", &enableCudaPeerAccess_, nb::arg("deviceIds"));
+
+    m.def("cudaSetProfiling", &setNativeProfiling_, nb::arg("enabled"));
+    m.def("cudaGetProfile", &getCudaProfile_);
+    m.def("cudaResetProfile", &resetCudaProfile_);
 }
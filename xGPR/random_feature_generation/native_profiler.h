@@ -0,0 +1,359 @@
+#ifndef XGPR_NATIVE_PROFILER_H
+#define XGPR_NATIVE_PROFILER_H
+
+/*!
+ * # native_profiler.h
+ *
+ * Optional instrumentation shared by the CPU and CUDA extensions. When
+ * the extensions are built with XGPR_PROFILING defined (see the CMake
+ * option of the same name), the ops record, for each thread, the time
+ * spent in each phase and the rows, kmers and bytes they processed,
+ * and the CPU thread pool records how unevenly each job's work was
+ * split across its threads. Recording must also be switched on at
+ * runtime (setNativeProfiling_), and the results are returned to Python
+ * as a dict by getNativeProfile_.
+ *
+ * Without XGPR_PROFILING every PROFILE_ macro expands to nothing (its
+ * arguments are not evaluated), so the hot loops are unchanged, and
+ * getNativeProfile_ returns a dict reporting that profiling is unavailable.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <nanobind/nanobind.h>
+
+namespace nb = nanobind;
+
+
+// The phases time is recorded under. ALLOC, H2D and KERNEL are only
+// used by the CUDA extension, where KERNEL is measured with CUDA events.
+enum ProfilePhase {
+    PROFILE_COPY = 0,
+    PROFILE_FHT = 1,
+    PROFILE_POSTPROCESS = 2,
+    PROFILE_THREAD_JOB = 3,
+    PROFILE_ALLOC = 4,
+    PROFILE_H2D = 5,
+    PROFILE_KERNEL = 6,
+    NUM_PROFILE_PHASES = 7
+};
+
+enum ProfileCounter {
+    PROFILE_ROWS = 0,
+    PROFILE_KMERS = 1,
+    PROFILE_BYTES = 2,
+    NUM_PROFILE_COUNTERS = 3
+};
+
+// Thread indices at or beyond this share the last slot.
+#define PROFILE_MAX_THREADS 256
+
+
+#ifdef XGPR_PROFILING
+
+/*!
+ * # NativeProfiler
+ *
+ * Process-wide (per extension) store for the profile. Each thread
+ * index has its own cache-line aligned slot of relaxed atomic
+ * counters, so threads recording at the same time do not contend.
+ * Like the other process-wide native state it is never destroyed.
+ */
+class NativeProfiler {
+    public:
+        static NativeProfiler &getInstance(){
+            static NativeProfiler *profiler = new NativeProfiler();
+            return *profiler;
+        }
+
+        bool enabled() const {
+            return isEnabled.load(std::memory_order_relaxed);
+        }
+
+        void setEnabled(bool enabled){
+            isEnabled.store(enabled, std::memory_order_relaxed);
+        }
+
+        // The thread index recorded against on the calling thread. The CPU
+        // thread pool sets this for each of its workers; every other
+        // thread (including the caller of a pool job) records as thread 0.
+        static int &currentThread(){
+            thread_local int threadIndex = 0;
+            return threadIndex;
+        }
+
+        void addTime(int threadIndex, ProfilePhase phase, uint64_t nanoseconds){
+            ThreadSlot &slot = getSlot(threadIndex);
+            slot.phaseNs[phase].fetch_add(nanoseconds, std::memory_order_relaxed);
+            slot.phaseCalls[phase].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        void addCount(int threadIndex, ProfileCounter counter, uint64_t count){
+            getSlot(threadIndex).counters[counter].fetch_add(count,
+                    std::memory_order_relaxed);
+        }
+
+        // Records one thread pool job from the time each of its threads
+        // spent in it. The imbalance of a job is the time the slowest
+        // thread spent beyond the average, i.e. the time the other
+        // threads were (on average) left idle.
+        void addJob(const std::vector<uint64_t> &threadNs){
+            if (threadNs.empty())
+                return;
+            uint64_t maxNs = 0, totalNs = 0;
+            for (size_t i=0; i < threadNs.size(); i++){
+                addTime(static_cast<int>(i), PROFILE_THREAD_JOB, threadNs[i]);
+                totalNs += threadNs[i];
+                if (threadNs[i] > maxNs)
+                    maxNs = threadNs[i];
+            }
+            uint64_t meanNs = totalNs / threadNs.size();
+            numJobs.fetch_add(1, std::memory_order_relaxed);
+            jobMaxNs.fetch_add(maxNs, std::memory_order_relaxed);
+            jobImbalanceNs.fetch_add(maxNs - meanNs, std::memory_order_relaxed);
+        }
+
+        void reset(){
+            for (auto &slot : slots){
+                for (auto &value : slot.phaseNs)
+                    value.store(0, std::memory_order_relaxed);
+                for (auto &value : slot.phaseCalls)
+                    value.store(0, std::memory_order_relaxed);
+                for (auto &value : slot.counters)
+                    value.store(0, std::memory_order_relaxed);
+            }
+            numJobs.store(0, std::memory_order_relaxed);
+            jobMaxNs.store(0, std::memory_order_relaxed);
+            jobImbalanceNs.store(0, std::memory_order_relaxed);
+        }
+
+        nb::dict toDict();
+
+        NativeProfiler(const NativeProfiler&) = delete;
+        NativeProfiler &operator=(const NativeProfiler&) = delete;
+
+    private:
+        NativeProfiler() = default;
+
+        struct alignas(64) ThreadSlot {
+            std::atomic<uint64_t> phaseNs[NUM_PROFILE_PHASES] = {};
+            std::atomic<uint64_t> phaseCalls[NUM_PROFILE_PHASES] = {};
+            std::atomic<uint64_t> counters[NUM_PROFILE_COUNTERS] = {};
+        };
+
+        ThreadSlot &getSlot(int threadIndex){
+            if (threadIndex < 0)
+                threadIndex = 0;
+            if (threadIndex >= PROFILE_MAX_THREADS)
+                threadIndex = PROFILE_MAX_THREADS - 1;
+            return slots[threadIndex];
+        }
+
+        std::atomic<bool> isEnabled{false};
+        ThreadSlot slots[PROFILE_MAX_THREADS];
+        std::atomic<uint64_t> numJobs{0};
+        std::atomic<uint64_t> jobMaxNs{0};
+        std::atomic<uint64_t> jobImbalanceNs{0};
+};
+
+
+
+/*!
+ * # ProfileLap
+ *
+ * Times consecutive phases of the calling thread's work with one clock
+ * read per phase boundary: lap(phase) charges the time since the previous
+ * lap (or construction) to phase. Does nothing if profiling was off
+ * when it was constructed.
+ */
+class ProfileLap {
+    public:
+        ProfileLap() : threadIndex(NativeProfiler::currentThread()),
+            active(NativeProfiler::getInstance().enabled()) {
+            if (active)
+                lapStart = std::chrono::steady_clock::now();
+        }
+
+        void lap(ProfilePhase phase){
+            if (!active)
+                return;
+            auto now = std::chrono::steady_clock::now();
+            NativeProfiler::getInstance().addTime(threadIndex, phase,
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        now - lapStart).count());
+            lapStart = now;
+        }
+
+    private:
+        int threadIndex;
+        bool active;
+        std::chrono::steady_clock::time_point lapStart;
+};
+
+
+// Charges the lifetime of the object to a single phase.
+class ProfileScope {
+    public:
+        explicit ProfileScope(ProfilePhase phase) : phase(phase) {}
+        ~ProfileScope(){
+            profileLap.lap(phase);
+        }
+
+        ProfileScope(const ProfileScope&) = delete;
+        ProfileScope &operator=(const ProfileScope&) = delete;
+
+    private:
+        ProfileLap profileLap;
+        ProfilePhase phase;
+};
+
+
+inline void profileCount(ProfileCounter counter, uint64_t count){
+    NativeProfiler &profiler = NativeProfiler::getInstance();
+    if (profiler.enabled())
+        profiler.addCount(NativeProfiler::currentThread(), counter, count);
+}
+
+
+inline nb::dict NativeProfiler::toDict(){
+    const char *phaseNames[NUM_PROFILE_PHASES] = {"copy", "fht", "postprocess",
+        "thread_job", "alloc", "h2d", "kernel"};
+    const char *counterNames[NUM_PROFILE_COUNTERS] = {"rows", "kmers", "bytes"};
+
+    // Only report threads that recorded something.
+    int numThreads = 0;
+    for (int i=0; i < PROFILE_MAX_THREADS; i++){
+        bool used = false;
+        for (auto &value : slots[i].phaseCalls)
+            used = used || value.load(std::memory_order_relaxed) > 0;
+        for (auto &value : slots[i].counters)
+            used = used || value.load(std::memory_order_relaxed) > 0;
+        if (used)
+            numThreads = i + 1;
+    }
+
+    nb::dict profile, phaseSeconds, phaseCalls, threadSeconds, counts, threadCounts;
+    for (int phase=0; phase < NUM_PROFILE_PHASES; phase++){
+        nb::list perThread;
+        double totalSeconds = 0;
+        uint64_t totalCalls = 0;
+        for (int i=0; i < numThreads; i++){
+            double seconds = 1e-9 * slots[i].phaseNs[phase].load(std::memory_order_relaxed);
+            perThread.append(seconds);
+            totalSeconds += seconds;
+            totalCalls += slots[i].phaseCalls[phase].load(std::memory_order_relaxed);
+        }
+        phaseSeconds[phaseNames[phase]] = totalSeconds;
+        phaseCalls[phaseNames[phase]] = totalCalls;
+        threadSeconds[phaseNames[phase]] = perThread;
+    }
+    for (int counter=0; counter < NUM_PROFILE_COUNTERS; counter++){
+        nb::list perThread;
+        uint64_t total = 0;
+        for (int i=0; i < numThreads; i++){
+            uint64_t count = slots[i].counters[counter].load(std::memory_order_relaxed);
+            perThread.append(count);
+            total += count;
+        }
+        counts[counterNames[counter]] = total;
+        threadCounts[counterNames[counter]] = perThread;
+    }
+
+    uint64_t maxNs = jobMaxNs.load(std::memory_order_relaxed);
+    uint64_t imbalanceNs = jobImbalanceNs.load(std::memory_order_relaxed);
+    nb::dict imbalance;
+    imbalance["jobs"] = numJobs.load(std::memory_order_relaxed);
+    imbalance["wall_seconds"] = 1e-9 * maxNs;
+    imbalance["idle_seconds"] = 1e-9 * imbalanceNs;
+    imbalance["idle_fraction"] = maxNs > 0 ? static_cast<double>(imbalanceNs) / maxNs : 0.0;
+
+    profile["available"] = true;
+    profile["enabled"] = enabled();
+    profile["phase_seconds"] = phaseSeconds;
+    profile["phase_calls"] = phaseCalls;
+    profile["thread_phase_seconds"] = threadSeconds;
+    profile["counts"] = counts;
+    profile["thread_counts"] = threadCounts;
+    profile["load_imbalance"] = imbalance;
+    return profile;
+}
+
+
+#define PROFILE_ENABLED() (NativeProfiler::getInstance().enabled())
+#define PROFILE_SET_THREAD(threadIndex) (NativeProfiler::currentThread() = (threadIndex))
+#define PROFILE_LAP_START(lapName) ProfileLap lapName
+#define PROFILE_LAP(lapName, phase) lapName.lap(phase)
+#define PROFILE_SCOPE_NAME_(line) profileScope##line
+#define PROFILE_SCOPE_NAME(line) PROFILE_SCOPE_NAME_(line)
+#define PROFILE_SCOPE(phase) ProfileScope PROFILE_SCOPE_NAME(__LINE__)(phase)
+#define PROFILE_COUNT(counter, count) profileCount(counter, count)
+
+#else
+
+#define PROFILE_ENABLED() false
+#define PROFILE_SET_THREAD(threadIndex) ((void)0)
+#define PROFILE_LAP_START(lapName)
+#define PROFILE_LAP(lapName, phase) ((void)0)
+#define PROFILE_SCOPE(phase)
+#define PROFILE_COUNT(counter, count) ((void)0)
+
+#endif
+
+
+
+/*!
+ * # setNativeProfiling_
+ *
+ * Wrapper-facing function that switches recording on or off. Returns
+ * false (and does nothing) if the extension was built without
+ * XGPR_PROFILING.
+ */
+inline bool setNativeProfiling_(bool enabled){
+#ifdef XGPR_PROFILING
+    NativeProfiler::getInstance().setEnabled(enabled);
+    return true;
+#else
+    (void)enabled;
+    return false;
+#endif
+}
+
+
+/*!
+ * # getNativeProfile_
+ *
+ * Wrapper-facing function that returns the profile recorded since the
+ * last reset as a dict of per-phase times (in seconds, in total and
+ * per thread), counts of rows, kmers and bytes processed, and the
+ * thread pool load imbalance. If the extension was built without
+ * XGPR_PROFILING the dict has only the keys "available" and "enabled",
+ * both False.
+ */
+inline nb::dict getNativeProfile_(){
+#ifdef XGPR_PROFILING
+    return NativeProfiler::getInstance().toDict();
+#else
+    nb::dict profile;
+    profile["available"] = false;
+    profile["enabled"] = false;
+    return profile;
+#endif
+}
+
+
+/*!
+ * # resetNativeProfile_
+ *
+ * Wrapper-facing function that clears everything recorded so far.
+ */
+inline int resetNativeProfile_(){
+#ifdef XGPR_PROFILING
+    NativeProfiler::getInstance().reset();
+#endif
+    return 0;
+}
+
+#endif
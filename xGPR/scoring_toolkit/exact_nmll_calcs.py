@@ -66,10 +66,8 @@ def calc_design_mat(dataset, kernel):
         z_trans_y = cp.zeros((num_rffs))
     y_trans_y = 0.0
     for i, (xin, yin, ldata) in enumerate(dataset.get_chunked_data()):
-        xfeatures, ydata = kernel.transform_x_y(xin, yin, ldata)
-        z_trans_y += xfeatures.T @ ydata
-        z_trans_z += xfeatures.T @ xfeatures
-        y_trans_y += ydata.T @ ydata
+        kernel.accumulate_design_mat(xin, yin, z_trans_z, z_trans_y, ldata)
+        y_trans_y += float( (yin**2).sum() )
         if i % 2 == 0:
             if kernel.device == "cuda":
                 mempool = cp.get_default_memory_pool()
@@ -115,22 +115,26 @@ class xGPRegression(ModelBaseclass):
 
         for i in range(0, input_x.shape[0], chunk_size):
             cutoff = min(i + chunk_size, input_x.shape[0])
-            if sequence_lengths is not None:
-                xfeatures = self.kernel.transform_x(input_x[i:cutoff,...],
-                        sequence_lengths[i:cutoff])
-            else:
-                xfeatures = self.kernel.transform_x(input_x[i:cutoff,...])
+            slen = None if sequence_lengths is None else sequence_lengths[i:cutoff]
+
+            # Where the variance (if needed) is an explicit matrix, the
+            # kernel can calculate both without storing the features.
+            if not get_var or self.exact_var_calculation:
+                pred_mean, pred_var = self.kernel.predict_mean_var(
+                        input_x[i:cutoff,...], self.weights,
+                        self.var if get_var else None, slen)
+                preds.append(pred_mean)
+                if get_var:
+                    var.append(lambda_**2 + lambda_**2 * pred_var)
+                continue
+
+            xfeatures = self.kernel.transform_x(input_x[i:cutoff,...], slen)
 
             preds.append((xfeatures * self.weights[None, :]).sum(axis = 1))
 
-            if get_var:
-                if self.exact_var_calculation:
-                    xfeatures = xfeatures[:,:self.variance_rffs]
-                    pred_var = (self.var @ xfeatures.T).T
-                else:
-                    pred_var = self.var.batch_matvec(xfeatures.T).T
-                pred_var = lambda_**2 + lambda_**2 * (xfeatures * pred_var).sum(axis=1)
-                var.append(pred_var)
+            pred_var = self.var.batch_matvec(xfeatures.T).T
+            pred_var = lambda_**2 + lambda_**2 * (xfeatures * pred_var).sum(axis=1)
+            var.append(pred_var)
 
         if self.device == "cuda":
             preds = cp.asnumpy(cp.concatenate(preds))